@@ -158,6 +158,7 @@ void user_event_handler_on(tuya_iot_client_t *client, tuya_event_msg_t *event)
         PR_INFO("Device Bind Start!");
         if (_need_reset == 1) {
             PR_INFO("Device Reset!");
+            tal_kv_flush();
             tal_system_reset();
         }
 
@@ -490,3 +490,16 @@ int tuya_base64_decode(const char *base64, unsigned char *bindata)
 
     return olen;
 }
+
+uint32_t tuya_fnv1a32(const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t hash = 2166136261u;
+
+    while (len--) {
+        hash ^= *p++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
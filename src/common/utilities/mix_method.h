@@ -203,6 +203,18 @@ char *tuya_base64_encode(const unsigned char *bindata, char *base64,
  */
 int tuya_base64_decode(const char * base64, unsigned char * bindata);
 
+/**
+ * @brief 32 bit FNV-1a hash of a buffer, used to bucket topics, keys and names.
+ *
+ * For a NUL-terminated string pass strlen() as len, so the same key hashes
+ * the same whether it arrives terminated or with a length.
+ *
+ * @param data The data to hash.
+ * @param len The length of the data in bytes.
+ * @return The hash value.
+ */
+uint32_t tuya_fnv1a32(const void *data, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
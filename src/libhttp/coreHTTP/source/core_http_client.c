@@ -2726,7 +2726,10 @@ HTTPStatus_t HTTPClient_Request( const TransportInterface_t * pTransport,
                 LogError( ( "Failed to receive HTTP data: Transport recv() "
                             "returned error: TransportStatus=%ld",
                             ( long int ) currentReceived ) );
-                return HTTPNetworkError;
+                /* Nothing received at all tells the caller the request can be
+                 * retried on a new connection. */
+                returnStatus = (0U == totalReceived) ? HTTPNoResponse : HTTPPartialResponse;
+                goto __exit;
             }
             totalReceived += currentReceived;
             pResponse->pBuffer[totalReceived] = 0;
@@ -2812,7 +2815,8 @@ HTTPStatus_t HTTPClient_Request( const TransportInterface_t * pTransport,
                 LogError( ( "Failed to receive HTTP data: Transport recv() "
                             "returned error: TransportStatus=%ld",
                             ( long int ) currentReceived ) );
-                return HTTPNetworkError;
+                returnStatus = HTTPPartialResponse;
+                goto __exit;
             }
             chunkLen = currentReceived;
             parsingContext.recvState = HTTP_PARSE_CHUNK;
@@ -2844,7 +2848,8 @@ HTTPStatus_t HTTPClient_Request( const TransportInterface_t * pTransport,
                 LogError( ( "Failed to receive HTTP data: Transport recv() "
                             "returned error: TransportStatus=%ld",
                             ( long int ) currentReceived ) );
-                return HTTPNetworkError;
+                returnStatus = HTTPPartialResponse;
+                goto __exit;
             }
             bodyLen += currentReceived;
             if (pResponse->contentLength == bodyLen) {
@@ -2880,10 +2885,12 @@ __exit:
 
     if (pResponse->pBuffer) {
         HTTP_FREE(pResponse->pBuffer);
+        pResponse->pBuffer = NULL;
     }
 
     if (pResponse->pBody) {
         HTTP_FREE(pResponse->pBody);
+        pResponse->pBody = NULL;
     }
 
     return returnStatus;
@@ -2899,11 +2906,16 @@ int32_t HTTPClient_Recv(const TransportInterface_t *pTransport,
     int32_t currentReceived = 0;
 
     if (pResponse->pBody && pResponse->bodyLen) {
-        memcpy(data, pResponse->pBody, pResponse->bodyLen);
-        currentReceived = pResponse->bodyLen;
-        HTTP_FREE(pResponse->pBody);
-        pResponse->pBody = NULL;
-        pResponse->bodyLen = 0;
+        /* The body received with the headers, as much of it as fits. */
+        currentReceived = (pResponse->bodyLen < dataLen) ? pResponse->bodyLen : dataLen;
+        memcpy(data, pResponse->pBody, currentReceived);
+        pResponse->bodyLen -= currentReceived;
+        if (pResponse->bodyLen) {
+            memmove((uint8_t *)pResponse->pBody, pResponse->pBody + currentReceived, pResponse->bodyLen);
+        } else {
+            HTTP_FREE(pResponse->pBody);
+            pResponse->pBody = NULL;
+        }
         return currentReceived;
     }
 
@@ -17,6 +17,17 @@ typedef enum {
     DL_EVENT_FAULT,
 } http_download_event_id_t;
 
+/**
+ * @brief ON_DATA hands data of the file at offset, remain_len is what the
+ * handler left of the previous data and is handed again at the head of this
+ * one, the handler sets it to the bytes it did not consume this time.
+ *
+ * When resumed from a checkpoint, offset at ON_FILESIZE and at the first
+ * ON_DATA is where the download resumes, the handler must have kept the data
+ * before it. That is up to 63 bytes before where the handler stopped, and the
+ * download only resumes when config->sha256 is given. sha256 is the digest of
+ * the file at FINISH.
+ */
 typedef struct {
     void *data;
     size_t offset;
@@ -24,6 +35,7 @@ typedef struct {
     size_t file_size;
     uint32_t remain_len;
     void *user_data;
+    const uint8_t *sha256;
 } http_download_event_t;
 
 typedef void (*http_download_event_cb_t)(http_download_event_id_t id, http_download_event_t *event);
@@ -37,8 +49,18 @@ typedef struct {
     size_t file_size;
     void *user_data;
     http_download_event_cb_t event_handler;
+    uint8_t segment_num;    // range requests run at once, 0 for HTTP_DOWNLOAD_SEGMENT_NUM
+    const char *resume_key; // KV key of the progress checkpoint, NULL to start over after a restart, needs sha256
+    const uint8_t *sha256;  // expected SHA-256 of the file, NULL to not verify it
 } http_download_config_t;
 
+/**
+ * @brief download the file of config->url, the events are sent on the calling
+ * thread and the data in file order, whatever the number of segments
+ *
+ * @return OPRT_OK after FINISH, others after FAULT, OPRT_CRC32_FAILED if the
+ * file does not match config->sha256
+ */
 int http_file_download(http_download_config_t *config);
 
 #ifdef __cplusplus
@@ -4,6 +4,10 @@
 #include "core_http_client.h"
 #include "tuya_tls.h"
 #include "tal_log.h"
+#include "tal_system.h"
+#include "tal_mutex.h"
+#include "tal_sw_timer.h"
+#include "mbedtls/sha256.h"
 
 #define log_debug PR_DEBUG
 #define log_error PR_ERR
@@ -11,10 +15,331 @@
 #define HEADER_BUFFER_LENGTH (255)
 #define DEFAULT_HTTP_PORT    (80)
 #define DEFAULT_HTTPS_PORT   (443)
-static http_client_status_t core_http_request_send(const TransportInterface_t *pTransportInterface,
+
+#ifndef HTTP_CLIENT_KEEPALIVE_NUM
+#define HTTP_CLIENT_KEEPALIVE_NUM 2
+#endif
+
+#ifndef HTTP_CLIENT_KEEPALIVE_IDLE_MS
+#define HTTP_CLIENT_KEEPALIVE_IDLE_MS (30 * 1000)
+#endif
+
+#if HTTP_CLIENT_KEEPALIVE_NUM > 0
+#define HTTP_CLIENT_HOST_LEN   (128)
+#define HTTP_CLIENT_CACERT_LEN (32)
+
+// connection kept open after its response, reused by the next request to the
+// same host that trusts the same certificate
+typedef struct {
+    NetworkContext_t network; // NULL if the slot is free
+    char host[HTTP_CLIENT_HOST_LEN];
+    uint16_t port;
+    bool tls;
+    uint8_t cacert[HTTP_CLIENT_CACERT_LEN]; // sha256 of the certificate the server was verified with
+    SYS_TIME_T idle_time;
+} http_client_conn_t;
+
+static http_client_conn_t s_conn_pool[HTTP_CLIENT_KEEPALIVE_NUM];
+static MUTEX_HANDLE s_conn_pool_mutex = NULL;
+static TIMER_ID s_conn_pool_timer = NULL;
+#endif
+
+static void http_client_conn_close(NetworkContext_t network)
+{
+    tuya_transporter_close(network);
+    tuya_transporter_destroy(network);
+}
+
+#if HTTP_CLIENT_KEEPALIVE_NUM > 0
+/**
+ * @brief take the connections idle for HTTP_CLIENT_KEEPALIVE_IDLE_MS out of
+ * the pool, with the pool lock held
+ *
+ * @param[out] expired the connections to close once the lock is dropped, a
+ * TLS close_notify must not hold up the other requests
+ *
+ * @return count of expired
+ */
+static int http_client_pool_expire(NetworkContext_t expired[HTTP_CLIENT_KEEPALIVE_NUM])
+{
+    SYS_TIME_T now = tal_system_get_millisecond();
+    SYS_TIME_T next = HTTP_CLIENT_KEEPALIVE_IDLE_MS;
+    bool idle = false;
+    int num = 0;
+    int i;
+
+    for (i = 0; i < HTTP_CLIENT_KEEPALIVE_NUM; i++) {
+        http_client_conn_t *conn = &s_conn_pool[i];
+        if (NULL == conn->network) {
+            continue;
+        }
+        SYS_TIME_T elapsed = now - conn->idle_time;
+        if (elapsed >= HTTP_CLIENT_KEEPALIVE_IDLE_MS) {
+            log_debug("http keep-alive %s:%d idle, close", conn->host, conn->port);
+            expired[num++] = conn->network;
+            conn->network = NULL;
+        } else {
+            idle = true;
+            next = (HTTP_CLIENT_KEEPALIVE_IDLE_MS - elapsed < next) ? HTTP_CLIENT_KEEPALIVE_IDLE_MS - elapsed : next;
+        }
+    }
+
+    if (idle) {
+        tal_sw_timer_start(s_conn_pool_timer, next, TAL_TIMER_ONCE);
+    }
+
+    return num;
+}
+
+static void http_client_pool_close(NetworkContext_t networks[], int num)
+{
+    int i;
+
+    for (i = 0; i < num; i++) {
+        http_client_conn_close(networks[i]);
+    }
+}
+
+static void http_client_pool_timer_cb(TIMER_ID timer_id, void *arg)
+{
+    NetworkContext_t expired[HTTP_CLIENT_KEEPALIVE_NUM];
+    int num = 0;
+
+    tal_mutex_lock(s_conn_pool_mutex);
+    num = http_client_pool_expire(expired);
+    tal_mutex_unlock(s_conn_pool_mutex);
+    http_client_pool_close(expired, num);
+}
+
+// identity of the certificate a TLS connection was verified with
+static void http_client_cacert_id(const http_client_request_t *request, uint8_t id[HTTP_CLIENT_CACERT_LEN])
+{
+    memset(id, 0, HTTP_CLIENT_CACERT_LEN);
+    if (request->cacert) {
+        mbedtls_sha256(request->cacert, request->cacert_len, id, 0);
+    }
+}
+
+static OPERATE_RET http_client_pool_init(void)
+{
+    OPERATE_RET rt = OPRT_OK;
+
+    if (NULL == s_conn_pool_mutex) {
+        TUYA_CALL_ERR_RETURN(tal_mutex_create_init(&s_conn_pool_mutex));
+    }
+
+    if (NULL == s_conn_pool_timer) {
+        TUYA_CALL_ERR_RETURN(tal_sw_timer_create(http_client_pool_timer_cb, NULL, &s_conn_pool_timer));
+    }
+
+    return rt;
+}
+
+/**
+ * @brief take an idle connection to host out of the pool, made with the same
+ * certificate
+ *
+ * @return the connection, NULL if there is none
+ */
+static NetworkContext_t http_client_pool_take(const char *host, uint16_t port, bool tls,
+                                              const uint8_t cacert[HTTP_CLIENT_CACERT_LEN], uint32_t timeout_ms)
+{
+    NetworkContext_t network = NULL;
+    // the expired ones and one closed by the server
+    NetworkContext_t closed[HTTP_CLIENT_KEEPALIVE_NUM + 1];
+    int num = 0;
+    int i;
+
+    if (OPRT_OK != http_client_pool_init()) {
+        return NULL;
+    }
+
+    tal_mutex_lock(s_conn_pool_mutex);
+    num = http_client_pool_expire(closed);
+    for (i = 0; i < HTTP_CLIENT_KEEPALIVE_NUM && NULL == network; i++) {
+        http_client_conn_t *conn = &s_conn_pool[i];
+        if (NULL == conn->network || conn->port != port || conn->tls != tls || strcmp(conn->host, host) ||
+            memcmp(conn->cacert, cacert, HTTP_CLIENT_CACERT_LEN)) {
+            continue;
+        }
+        // nothing is expected on an idle connection, readable means the server closed it
+        if (0 != tuya_transporter_poll_read(conn->network, 0)) {
+            log_debug("http keep-alive %s:%d closed by server", conn->host, conn->port);
+            closed[num++] = conn->network;
+        } else {
+            network = conn->network;
+        }
+        conn->network = NULL;
+    }
+    tal_mutex_unlock(s_conn_pool_mutex);
+    http_client_pool_close(closed, num);
+
+    if (network && tls) {
+        tuya_tls_config_t *tls_config = NULL;
+        tuya_transporter_ctrl(network, TUYA_TRANSPORTER_GET_TLS_CONFIG, &tls_config);
+        if (tls_config) {
+            tls_config->timeout = timeout_ms;
+        }
+    }
+
+    return network;
+}
+
+/**
+ * @brief keep a connection whose response was read completely for the next
+ * request to host, the oldest idle connection is closed if the pool is full
+ */
+static void http_client_pool_put(NetworkContext_t network, const char *host, uint16_t port, bool tls,
+                                 const uint8_t cacert[HTTP_CLIENT_CACERT_LEN])
+{
+    http_client_conn_t *conn = NULL;
+    NetworkContext_t evicted = NULL;
+    int i;
+
+    if (strlen(host) >= HTTP_CLIENT_HOST_LEN || OPRT_OK != http_client_pool_init()) {
+        http_client_conn_close(network);
+        return;
+    }
+
+    if (tls) {
+        // the request owns the host and the certificate the connection was made with
+        tuya_tls_config_t *tls_config = NULL;
+        tuya_transporter_ctrl(network, TUYA_TRANSPORTER_GET_TLS_CONFIG, &tls_config);
+        if (tls_config) {
+            tls_config->hostname = NULL;
+            tls_config->ca_cert = NULL;
+            tls_config->ca_cert_size = 0;
+        }
+    }
+
+    tal_mutex_lock(s_conn_pool_mutex);
+    for (i = 0; i < HTTP_CLIENT_KEEPALIVE_NUM; i++) {
+        if (NULL == s_conn_pool[i].network) {
+            conn = &s_conn_pool[i];
+            break;
+        }
+        if (NULL == conn || s_conn_pool[i].idle_time < conn->idle_time) {
+            conn = &s_conn_pool[i];
+        }
+    }
+    evicted = conn->network;
+    conn->network = network;
+    strcpy(conn->host, host);
+    conn->port = port;
+    conn->tls = tls;
+    memcpy(conn->cacert, cacert, HTTP_CLIENT_CACERT_LEN);
+    conn->idle_time = tal_system_get_millisecond();
+    if (!tal_sw_timer_is_running(s_conn_pool_timer)) {
+        tal_sw_timer_start(s_conn_pool_timer, HTTP_CLIENT_KEEPALIVE_IDLE_MS, TAL_TIMER_ONCE);
+    }
+    tal_mutex_unlock(s_conn_pool_mutex);
+
+    if (evicted) {
+        http_client_conn_close(evicted);
+    }
+}
+
+// HTTP/1.1 keeps the connection unless the server says otherwise
+static bool http_client_response_keepalive(const HTTPResponse_t *response)
+{
+    if (response->respFlags & HTTP_RESPONSE_CONNECTION_CLOSE_FLAG) {
+        return false;
+    }
+
+    if (response->respFlags & HTTP_RESPONSE_CONNECTION_KEEP_ALIVE_FLAG) {
+        return true;
+    }
+
+    return response->pBuffer && 0 == strncmp((const char *)response->pBuffer, "HTTP/1.1", 8);
+}
+#endif
+
+static http_client_status_t http_client_conn_open(const http_client_request_t *request, uint16_t port,
+                                                  NetworkContext_t *network)
+{
+    int ret = OPRT_OK;
+
+    /* TLS pre init */
+    TUYA_TRANSPORT_TYPE_E transport_type = (request->cacert == NULL) ? TRANSPORT_TYPE_TCP : TRANSPORT_TYPE_TLS;
+    *network = tuya_transporter_create(transport_type, NULL);
+    if (NULL == *network) {
+        return HTTP_CLIENT_MALLOC_FAULT;
+    }
+
+    if (transport_type == TRANSPORT_TYPE_TLS) {
+        tuya_tls_config_t tls_config = {
+            .ca_cert = (char *)request->cacert,
+            .ca_cert_size = request->cacert_len,
+            .hostname = (char *)request->host,
+            .port = port,
+            .timeout = request->timeout_ms,
+            .mode = TUYA_TLS_SERVER_CERT_MODE,
+            .verify = true,
+        };
+
+        ret = tuya_transporter_ctrl(*network, TUYA_TRANSPORTER_SET_TLS_CONFIG, &tls_config);
+        if (OPRT_OK != ret) {
+            log_error("network_tls_init fail:%d", ret);
+            tuya_transporter_destroy(*network);
+            return HTTP_CLIENT_SEND_FAULT;
+        }
+    }
+
+    ret = tuya_transporter_connect(*network, request->host, port, request->timeout_ms);
+    if (OPRT_OK != ret) {
+        http_client_conn_close(*network);
+        return HTTP_CLIENT_SEND_FAULT;
+    }
+
+    log_debug("%s connencted!", (transport_type == TRANSPORT_TYPE_TLS) ? "tls" : "tcp");
+
+    return HTTP_CLIENT_SUCCESS;
+}
+
+// network of a request, coreHTTP sends the headers and the body apart, the
+// headers are held back to be written with the body so that both leave in the
+// same segments instead of the body waiting on the ack of the headers
+typedef struct {
+    NetworkContext_t network; // first, NetworkTransportRecv reads it through the context
+    const uint8_t *held;
+    size_t held_len;
+    bool hold;        // the next send is headers followed by a body
+    bool send_failed; // a write failed, the request did not reach the server whole
+} http_client_send_ctx_t;
+
+static int http_client_transport_send(NetworkContext_t *pNetwork, const unsigned char *pMsg, size_t len)
+{
+    http_client_send_ctx_t *ctx = (http_client_send_ctx_t *)pNetwork;
+
+    if (ctx->hold) {
+        ctx->hold = false;
+        ctx->held = pMsg;
+        ctx->held_len = len;
+        return len;
+    }
+    if (NULL == ctx->held) {
+        int sent = tuya_transporter_write(ctx->network, (uint8_t *)pMsg, len, 0);
+        ctx->send_failed |= (sent < 0);
+        return sent;
+    }
+
+    tuya_transporter_iovec_t iov[] = {{.buf = ctx->held, .len = ctx->held_len}, {.buf = pMsg, .len = len}};
+    size_t held_len = ctx->held_len;
+    ctx->held = NULL;
+    int sent = tuya_transporter_writev(ctx->network, iov, 2, 0);
+    if (sent < 0 || (size_t)sent < held_len) {
+        // part of the headers already reported sent did not go
+        ctx->send_failed = true;
+        return (sent < 0) ? sent : -1;
+    }
+    return sent - held_len;
+}
+
+static http_client_status_t core_http_request_send(NetworkContext_t network,
                                                    const HTTPRequestInfo_t *requestInfo, http_client_header_t *headers,
                                                    uint8_t headers_count, const uint8_t *pRequestBodyBuf,
-                                                   size_t reqBodyBufLen, HTTPResponse_t *response)
+                                                   size_t reqBodyBufLen, HTTPResponse_t *response,
+                                                   HTTPStatus_t *status, bool *send_failed)
 {
     /* Represents header data that will be sent in an HTTP request. */
     HTTPRequestHeaders_t requestHeaders;
@@ -27,15 +352,19 @@ static http_client_status_t core_http_request_send(const TransportInterface_t *p
     }
     /* Initialize all HTTP Client library API structs to 0. */
     (void)memset(&requestHeaders, 0, sizeof(requestHeaders));
-    /* Set the buffer used for storing request headers. */
-    requestHeaders.bufferLen = HEADER_BUFFER_LENGTH + headers_count * 32;
+    /* Set the buffer used for storing request headers, sized on the path,
+     * host and headers so that long ATOP paths fit. */
+    int i;
+    requestHeaders.bufferLen = HEADER_BUFFER_LENGTH + requestInfo->pathLen + requestInfo->hostLen;
+    for (i = 0; i < headers_count; i++) {
+        requestHeaders.bufferLen += strlen(headers[i].key) + strlen(headers[i].value) + 4; // ": " and "\r\n"
+    }
     requestHeaders.pBuffer = tal_malloc(requestHeaders.bufferLen);
     if (requestHeaders.pBuffer == NULL) {
         return HTTP_CLIENT_MALLOC_FAULT;
     }
 
     httpStatus = HTTPClient_InitializeRequestHeaders(&requestHeaders, requestInfo);
-    int i;
     for (i = 0; i < headers_count; i++) {
         log_debug("HTTP header add key:value\r\nkey=%s : value=%s", headers[i].key, headers[i].value);
         httpStatus |= HTTPClient_AddHeader(&requestHeaders, headers[i].key, strlen(headers[i].key), headers[i].value,
@@ -51,13 +380,21 @@ static http_client_status_t core_http_request_send(const TransportInterface_t *p
     log_debug("Sending HTTP %.*s request to %.*s%.*s", (int32_t)requestInfo->methodLen, requestInfo->pMethod,
               (int32_t)requestInfo->hostLen, requestInfo->pHost, (int32_t)requestInfo->pathLen, requestInfo->pPath);
 
+    /* http client TransportInterface */
+    http_client_send_ctx_t ctx = {.network = network, .hold = (pRequestBodyBuf != NULL && reqBodyBufLen > 0)};
+    TransportInterface_t transport = {.pNetworkContext = (NetworkContext_t *)&ctx,
+                                      .recv = (TransportRecv_t)NetworkTransportRecv,
+                                      .send = (TransportSend_t)http_client_transport_send};
+
     /* Send the request and receive the response. */
-    httpStatus = HTTPClient_Request(pTransportInterface, &requestHeaders, (uint8_t *)pRequestBodyBuf, reqBodyBufLen,
-                                    response, 0);
+    httpStatus =
+        HTTPClient_Request(&transport, &requestHeaders, (uint8_t *)pRequestBodyBuf, reqBodyBufLen, response, 0);
 
     /* Release headers buffer */
     tal_free(requestHeaders.pBuffer);
 
+    *status = httpStatus;
+    *send_failed = ctx.send_failed;
     if (httpStatus != HTTPSuccess) {
         log_error("Failed to send HTTP %.*s request to %.*s%.*s: Error=%s.", (int32_t)requestInfo->methodLen,
                   requestInfo->pMethod, (int32_t)requestInfo->hostLen, requestInfo->pHost,
@@ -77,54 +414,23 @@ static http_client_status_t core_http_request_send(const TransportInterface_t *p
 http_client_status_t http_client_request(const http_client_request_t *request, http_client_response_t *response)
 {
     http_client_status_t rt = HTTP_CLIENT_SUCCESS;
-    int ret = OPRT_OK;
-
-    /* TLS pre init */
-    NetworkContext_t network;
-    TUYA_TRANSPORT_TYPE_E transport_type = (request->cacert == NULL) ? TRANSPORT_TYPE_TCP : TRANSPORT_TYPE_TLS;
-    network = tuya_transporter_create(transport_type, NULL);
-    if (NULL == network) {
-        return HTTP_CLIENT_MALLOC_FAULT;
-    }
-
-    if (transport_type == TRANSPORT_TYPE_TLS) {
-        tuya_tls_config_t tls_config = {
-            .ca_cert = (char *)request->cacert,
-            .ca_cert_size = request->cacert_len,
-            .hostname = (char *)request->host,
-            .port = (request->port == 0) ? DEFAULT_HTTPS_PORT : request->port,
-            .timeout = request->timeout_ms,
-            .mode = TUYA_TLS_SERVER_CERT_MODE,
-            .verify = true,
-        };
-
-        ret = tuya_transporter_ctrl(network, TUYA_TRANSPORTER_SET_TLS_CONFIG, &tls_config);
-        if (OPRT_OK != ret) {
-            log_error("network_tls_init fail:%d", ret);
-            return ret;
-        }
-
-        ret = tuya_transporter_connect(network, tls_config.hostname, tls_config.port, tls_config.timeout);
-        if (OPRT_OK != ret) {
-            tuya_transporter_close(network);
-            tuya_transporter_destroy(network);
-            return HTTP_CLIENT_SEND_FAULT;
-        }
+    bool tls = (request->cacert != NULL);
+    uint16_t port = request->port ? request->port : (tls ? DEFAULT_HTTPS_PORT : DEFAULT_HTTP_PORT);
+    NetworkContext_t network = NULL;
+    bool reused = false;
 
-        log_debug("tls connencted!");
-    } else {
-        ret = tuya_transporter_connect(network, request->host, (request->port == 0) ? DEFAULT_HTTP_PORT : request->port,
-                                       request->timeout_ms);
-        if (OPRT_OK != ret) {
-            tuya_transporter_close(network);
-            tuya_transporter_destroy(network);
-            return HTTP_CLIENT_SEND_FAULT;
+#if HTTP_CLIENT_KEEPALIVE_NUM > 0
+    uint8_t cacert[HTTP_CLIENT_CACERT_LEN];
+    http_client_cacert_id(request, cacert);
+    network = http_client_pool_take(request->host, port, tls, cacert, request->timeout_ms);
+    reused = (network != NULL);
+#endif
+    if (!reused) {
+        rt = http_client_conn_open(request, port, &network);
+        if (HTTP_CLIENT_SUCCESS != rt) {
+            return rt;
         }
     }
-    /* http client TransportInterface */
-    TransportInterface_t pTransportInterface = {.pNetworkContext = (NetworkContext_t *)&network,
-                                                .recv = (TransportRecv_t)NetworkTransportRecv,
-                                                .send = (TransportSend_t)NetworkTransportSend};
 
     /* http client request object make */
     HTTPRequestInfo_t requestInfo = {
@@ -134,19 +440,49 @@ http_client_status_t http_client_request(const http_client_request_t *request, h
         .hostLen = strlen(request->host),
         .pPath = request->path,
         .pathLen = strlen(request->path),
+#if HTTP_CLIENT_KEEPALIVE_NUM > 0
+        .reqFlags = HTTP_REQUEST_KEEP_ALIVE_FLAG,
+#endif
     };
 
     HTTPResponse_t http_response = {0};
+    HTTPStatus_t http_status = HTTPSuccess;
+    bool send_failed = false;
 
     /* HTTP request send */
     log_debug("http request send!");
-    rt = core_http_request_send((const TransportInterface_t *)&pTransportInterface,
-                                (const HTTPRequestInfo_t *)&requestInfo, request->headers, request->headers_count,
-                                (const uint8_t *)request->body, request->body_length, &http_response);
+    rt = core_http_request_send(network, (const HTTPRequestInfo_t *)&requestInfo, request->headers,
+                                request->headers_count, (const uint8_t *)request->body, request->body_length,
+                                &http_response, &http_status, &send_failed);
+    /* The server closed the kept connection meanwhile. Once the request went
+     * out whole it may have been executed even though no response came back,
+     * so only a request that failed to send or a GET or HEAD is sent again on
+     * a new connection. */
+    bool idempotent = !strcmp(request->method, "GET") || !strcmp(request->method, "HEAD");
+    if (HTTP_CLIENT_SEND_FAULT == rt && reused &&
+        ((HTTPNetworkError == http_status && send_failed) ||
+         (idempotent && (HTTPNetworkError == http_status || HTTPNoResponse == http_status)))) {
+        log_debug("http keep-alive connection lost, reconnect");
+        http_client_conn_close(network);
+        rt = http_client_conn_open(request, port, &network);
+        if (HTTP_CLIENT_SUCCESS != rt) {
+            return rt;
+        }
+        rt = core_http_request_send(network, (const HTTPRequestInfo_t *)&requestInfo, request->headers,
+                                    request->headers_count, (const uint8_t *)request->body, request->body_length,
+                                    &http_response, &http_status, &send_failed);
+    }
 
+#if HTTP_CLIENT_KEEPALIVE_NUM > 0
+    if (OPRT_OK == rt && http_client_response_keepalive(&http_response)) {
+        http_client_pool_put(network, request->host, port, tls, cacert);
+    } else {
+        http_client_conn_close(network);
+    }
+#else
     /* tls disconnect */
-    tuya_transporter_close(network);
-    tuya_transporter_destroy(network);
+    http_client_conn_close(network);
+#endif
 
     if (OPRT_OK != rt) {
         log_error("http_request_send error:%d", rt);
@@ -6,34 +6,89 @@
 #include "http_download.h"
 #include "http_parser.h"
 
-typedef enum {
-    DL_STATE_IDLE,
-    DL_STATE_START,
-    DL_STATE_NETWORK_CONNECT,
-    DL_STATE_NETWORK_RECONNECT,
-    DL_STATE_FILESIZE_GET,
-    DL_STATE_RANGE_REQUEST,
-    DL_STATE_DATE_GET,
-    DL_STATE_COMPLETE,
-} http_download_state_t;
+#include "mbedtls/sha256.h"
 
+#ifndef HTTP_DOWNLOAD_SEGMENT_NUM
+#define HTTP_DOWNLOAD_SEGMENT_NUM 1
+#endif
+
+#ifndef HTTP_DOWNLOAD_SEGMENT_SIZE
+#define HTTP_DOWNLOAD_SEGMENT_SIZE (8 * 1024)
+#endif
+
+#ifndef HTTP_DOWNLOAD_CHECKPOINT_SIZE
+#define HTTP_DOWNLOAD_CHECKPOINT_SIZE (64 * 1024)
+#endif
+
+typedef struct http_download http_download_t;
+
+/**
+ * @brief a segment fetches the chunks segment_num apart, chunk k in segment
+ * k % segment_num, so the buffers are used as a ring in file order
+ *
+ * The buffer has a head room of range_length for the bytes the event handler
+ * left of the previous chunk, then HTTP_DOWNLOAD_SEGMENT_SIZE bytes that are
+ * received into in place. A chunk larger than that, only with one segment,
+ * rewinds to the start once all of it was handed to the event handler.
+ */
 typedef struct {
-    http_download_config_t config;
-    http_download_event_t event;
+    http_download_t *ctx;
+    NetworkContext_t network;
     TransportInterface_t transport;
     HTTPRequestHeaders_t requestHeaders;
-    HTTPRequestInfo_t requestInfo;
     HTTPResponse_t response;
+    THREAD_HANDLE thread;
+    SEM_HANDLE space; // posted when the buffer is freed or rewound
+    uint8_t *buffer;
+    size_t start; // chunk [start, end) of the file
+    size_t end;
+    size_t base;     // file offset at buffer + range_length
+    size_t received; // file offset received up to
+    bool busy;       // holds a chunk not handed to the event handler yet
+    bool connected;
+} http_download_segment_t;
+
+/**
+ * @brief the progress kept in KV, only with the expected SHA-256 of the file
+ *
+ * offset is a multiple of the SHA-256 block, so the digest state after it is
+ * its 8 state words alone, whatever the layout of mbedtls_sha256_context.
+ */
+typedef struct {
+    uint32_t file_size;
+    uint32_t offset;
+    uint8_t sha256[32]; // the expected one
+    uint32_t state[8];
+} http_download_checkpoint_t;
+
+#define HTTP_DOWNLOAD_CHECKPOINT_ALIGN 64
+
+struct http_download {
+    http_download_config_t config;
+    http_download_event_t event;
+    HTTPRequestInfo_t requestInfo;
     char *host;
     char *path;
     uint16_t port;
     size_t file_size;
-    size_t received_size;
-    size_t remain_len;
-    size_t offset;
-    uint8_t state;
-    uint8_t *buffer;
-} http_download_t;
+    size_t start;      // where this run starts, not 0 when resumed
+    size_t chunk_size;
+    size_t chunk_num;
+    size_t head;       // chunk handed to the event handler
+    size_t consumed;   // file offset the event handler consumed up to
+    size_t delivered;  // file offset handed to the event handler up to
+    size_t checkpoint; // offset of the last checkpoint
+    uint8_t segment_num;
+    http_download_segment_t *segments;
+    MUTEX_HANDLE mutex;
+    SEM_HANDLE data; // posted when a segment received data
+    SEM_HANDLE done; // posted by each segment thread that exits
+    volatile bool abort;
+    int error;
+    TIME_T progress_time;
+    mbedtls_sha256_context hash;
+    uint8_t sha256[32];
+};
 
 #define MAX_RETRY_TIMES (8u)
 /*-----------------------------------------------------------*/
@@ -66,11 +121,27 @@ typedef struct {
  */
 #define HTTP_STATUS_CODE_PARTIAL_CONTENT 206
 
+/**
+ * @brief HTTP status code of a whole file.
+ */
+#define HTTP_STATUS_CODE_OK 200
+
 //! timeout sec
 #define HTTP_DOWNLOAD_TIMEOUT 180
 
 /*-----------------------------------------------------------*/
-static int http_download_filesize_get(http_download_t *ctx)
+static void http_download_response_free(HTTPResponse_t *response)
+{
+    if (response->pBuffer) {
+        tal_free(response->pBuffer);
+    }
+    if (response->pBody) {
+        tal_free((void *)response->pBody);
+    }
+    memset(response, 0, sizeof(HTTPResponse_t));
+}
+
+static int http_download_filesize_get(http_download_t *ctx, http_download_segment_t *seg)
 {
     int rt = 0;
     /* The location of the file size in contentRangeValStr. */
@@ -80,19 +151,19 @@ static int http_download_filesize_get(http_download_t *ctx)
     size_t contentRangeValStrLength = 0;
 
     PR_DEBUG("Getting file object size from host...");
-    TUYA_CALL_ERR_GOTO(HTTPClient_InitializeRequestHeaders(&ctx->requestHeaders, &ctx->requestInfo), __exit);
-    TUYA_CALL_ERR_GOTO(HTTPClient_AddRangeHeader(&ctx->requestHeaders, 0, 0), __exit);
-    TUYA_CALL_ERR_GOTO(HTTPClient_Request(&ctx->transport, &ctx->requestHeaders, NULL, 0, &ctx->response, 0), __exit);
+    TUYA_CALL_ERR_GOTO(HTTPClient_InitializeRequestHeaders(&seg->requestHeaders, &ctx->requestInfo), __exit);
+    TUYA_CALL_ERR_GOTO(HTTPClient_AddRangeHeader(&seg->requestHeaders, 0, 0), __exit);
+    TUYA_CALL_ERR_GOTO(HTTPClient_Request(&seg->transport, &seg->requestHeaders, NULL, 0, &seg->response, 0), __exit);
     PR_DEBUG("Received HTTP response from %s%s...", ctx->host, ctx->path);
-    PR_DEBUG("Response Headers:\n%.*s", (int32_t)ctx->response.headersLen, ctx->response.pHeaders);
-    if (ctx->response.statusCode != HTTP_STATUS_CODE_PARTIAL_CONTENT) {
+    PR_DEBUG("Response Headers:\n%.*s", (int32_t)seg->response.headersLen, seg->response.pHeaders);
+    if (seg->response.statusCode != HTTP_STATUS_CODE_PARTIAL_CONTENT) {
         PR_ERR("Received an invalid response from the server "
                "(Status Code: %u).",
-               ctx->response.statusCode);
+               seg->response.statusCode);
         rt = OPRT_NOT_SUPPORTED;
         goto __exit;
     }
-    TUYA_CALL_ERR_GOTO(HTTPClient_ReadHeader(&ctx->response, (char *)HTTP_CONTENT_RANGE_HEADER_FIELD,
+    TUYA_CALL_ERR_GOTO(HTTPClient_ReadHeader(&seg->response, (char *)HTTP_CONTENT_RANGE_HEADER_FIELD,
                                              (size_t)HTTP_CONTENT_RANGE_HEADER_FIELD_LENGTH,
                                              (const char **)&contentRangeValStr, &contentRangeValStrLength),
                        __exit);
@@ -105,31 +176,366 @@ static int http_download_filesize_get(http_download_t *ctx)
     pFileSizeStr += sizeof(char);
     ctx->file_size = (size_t)strtoul(pFileSizeStr, NULL, 10);
     PR_INFO("The file is %d bytes long.", (int32_t)ctx->file_size);
-    if (ctx->response.pBuffer) {
-        tal_free(ctx->response.pBuffer);
-    }
-    memset(&ctx->response, 0, sizeof(ctx->response));
 __exit:
+    http_download_response_free(&seg->response);
     return rt;
 }
 
-static int http_download_range_request(http_download_t *ctx, uint32_t range_start, uint32_t range_end)
+static int http_download_range_request(http_download_t *ctx, http_download_segment_t *seg)
 {
     int rt = OPRT_OK;
 
-    PR_DEBUG("Downloading bytes %d-%d, from %s...: ", range_start, range_end, ctx->host);
-    TUYA_CALL_ERR_GOTO(HTTPClient_InitializeRequestHeaders(&ctx->requestHeaders, &ctx->requestInfo), __exit);
-    TUYA_CALL_ERR_GOTO(HTTPClient_AddRangeHeader(&ctx->requestHeaders, range_start, range_end), __exit);
-    PR_TRACE("Request Headers:\n%.*s", (int32_t)ctx->requestHeaders.headersLen, (char *)ctx->requestHeaders.pBuffer);
-    TUYA_CALL_ERR_GOTO(HTTPClient_Request(&ctx->transport, &ctx->requestHeaders, NULL, 0, &ctx->response,
+    PR_DEBUG("Downloading bytes %d-%d, from %s...: ", seg->received, seg->end - 1, ctx->host);
+    TUYA_CALL_ERR_GOTO(HTTPClient_InitializeRequestHeaders(&seg->requestHeaders, &ctx->requestInfo), __exit);
+    TUYA_CALL_ERR_GOTO(HTTPClient_AddRangeHeader(&seg->requestHeaders, seg->received, seg->end - 1), __exit);
+    PR_TRACE("Request Headers:\n%.*s", (int32_t)seg->requestHeaders.headersLen, (char *)seg->requestHeaders.pBuffer);
+    TUYA_CALL_ERR_GOTO(HTTPClient_Request(&seg->transport, &seg->requestHeaders, NULL, 0, &seg->response,
                                           HTTP_SEND_DISABLE_RECV_BODY_FLAG),
                        __exit);
     PR_TRACE("Received HTTP response from %s%s...", ctx->host, ctx->path);
-    PR_TRACE("Response Headers:\n%.*s", (int32_t)ctx->response.headersLen, ctx->response.pHeaders);
+    PR_TRACE("Response Headers:\n%.*s", (int32_t)seg->response.headersLen, seg->response.pHeaders);
+    /* A server ignoring the range sends the whole file, fine when that is what was asked. */
+    if (seg->response.statusCode != HTTP_STATUS_CODE_PARTIAL_CONTENT &&
+        !(seg->response.statusCode == HTTP_STATUS_CODE_OK && 0 == seg->received && seg->end == ctx->file_size)) {
+        PR_ERR("Range request status code %u.", seg->response.statusCode);
+        rt = OPRT_NOT_SUPPORTED;
+    }
 __exit:
+    if (OPRT_OK != rt) {
+        http_download_response_free(&seg->response);
+    } else if (seg->response.pBuffer) {
+        /* the body received with the headers stays for HTTPClient_Recv */
+        tal_free(seg->response.pBuffer);
+        seg->response.pBuffer = NULL;
+    }
+    return rt;
+}
+
+/*-----------------------------------------------------------*/
+/**
+ * @brief resume from the checkpoint of resume_key, when it is of this file
+ *
+ * Without config->sha256 a changed file of the same size can not be told from
+ * the one of the checkpoint, so the download starts over.
+ */
+static void http_download_checkpoint_load(http_download_t *ctx)
+{
+    uint8_t *value = NULL;
+    size_t length = 0;
+
+    if (NULL == ctx->config.resume_key) {
+        return;
+    }
+    if (NULL == ctx->config.sha256) {
+        PR_WARN("no sha256 to resume the download with, start over");
+        return;
+    }
+    if (OPRT_OK != tal_kv_get(ctx->config.resume_key, &value, &length)) {
+        return;
+    }
+    http_download_checkpoint_t *checkpoint = (http_download_checkpoint_t *)value;
+    if (length == sizeof(http_download_checkpoint_t) && checkpoint->file_size == ctx->file_size &&
+        checkpoint->offset < ctx->file_size && 0 == checkpoint->offset % HTTP_DOWNLOAD_CHECKPOINT_ALIGN &&
+        0 == memcmp(checkpoint->sha256, ctx->config.sha256, sizeof(checkpoint->sha256))) {
+        memcpy(ctx->hash.MBEDTLS_PRIVATE(state), checkpoint->state, sizeof(checkpoint->state));
+        ctx->hash.MBEDTLS_PRIVATE(total)[0] = checkpoint->offset;
+        ctx->hash.MBEDTLS_PRIVATE(total)[1] = 0;
+        ctx->start = checkpoint->offset;
+        ctx->checkpoint = checkpoint->offset;
+        PR_INFO("resume download at %u of %u", checkpoint->offset, checkpoint->file_size);
+    }
+    tal_kv_free(value);
+}
+
+/**
+ * @brief keep the progress up to the last whole SHA-256 block consumed, the
+ * bytes past it are downloaded again on resume
+ */
+static void http_download_checkpoint_save(http_download_t *ctx)
+{
+    http_download_checkpoint_t checkpoint;
+    size_t offset = ctx->consumed - ctx->consumed % HTTP_DOWNLOAD_CHECKPOINT_ALIGN;
+
+    if (NULL == ctx->config.resume_key || NULL == ctx->config.sha256 || ctx->checkpoint == offset) {
+        return;
+    }
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    checkpoint.file_size = ctx->file_size;
+    checkpoint.offset = offset;
+    memcpy(checkpoint.sha256, ctx->config.sha256, sizeof(checkpoint.sha256));
+    /* the state words are those of the blocks before offset, the rest is buffered */
+    memcpy(checkpoint.state, ctx->hash.MBEDTLS_PRIVATE(state), sizeof(checkpoint.state));
+    if (OPRT_OK == tal_kv_set(ctx->config.resume_key, (const uint8_t *)&checkpoint, sizeof(checkpoint))) {
+        ctx->checkpoint = offset;
+    }
+}
+
+/*-----------------------------------------------------------*/
+static uint8_t *http_download_segment_ptr(http_download_t *ctx, http_download_segment_t *seg, size_t offset)
+{
+    return seg->buffer + ctx->config.range_length + offset - seg->base;
+}
+
+static void http_download_fail(http_download_t *ctx, int error)
+{
+    tal_mutex_lock(ctx->mutex);
+    if (!ctx->abort) {
+        ctx->error = error;
+        ctx->abort = true;
+    }
+    tal_mutex_unlock(ctx->mutex);
+}
+
+/**
+ * @brief hand the data received to the event handler, in file order
+ *
+ * Runs on the thread of http_file_download, or on the segment when it is the
+ * only one. The data is handed from the segment buffer it was received into,
+ * at most range_length at once. The bytes the handler leaves stay where they
+ * are and are handed again with the next ones, they are only copied to the
+ * head room when the buffer rewinds or at the next chunk.
+ */
+static void http_download_deliver(http_download_t *ctx)
+{
+    http_download_segment_t *seg = NULL;
+    http_download_segment_t *next = NULL;
+    size_t chunk_start = 0;
+    size_t received = 0;
+    size_t end = 0;
+    size_t remain_len = 0;
+    bool holds = false;
+
+    while (!ctx->abort && ctx->head < ctx->chunk_num) {
+        chunk_start = ctx->start + ctx->head * ctx->chunk_size;
+        seg = &ctx->segments[ctx->head % ctx->segment_num];
+
+        tal_mutex_lock(ctx->mutex);
+        holds = seg->busy && seg->start == chunk_start;
+        received = holds ? seg->received : chunk_start;
+        tal_mutex_unlock(ctx->mutex);
+
+        if (ctx->delivered < received) {
+            end = ctx->consumed + ctx->config.range_length;
+            if (end > received) {
+                end = received;
+            }
+            if (end <= ctx->delivered) {
+                PR_ERR("event handler left all of %u bytes", (uint32_t)ctx->config.range_length);
+                http_download_fail(ctx, OPRT_BUFFER_NOT_ENOUGH);
+                return;
+            }
+            ctx->event.data = http_download_segment_ptr(ctx, seg, ctx->consumed);
+            ctx->event.data_len = end - ctx->consumed;
+            ctx->event.offset = ctx->consumed;
+            ctx->event.remain_len = ctx->delivered - ctx->consumed;
+            remain_len = 0;
+            if (ctx->config.event_handler) {
+                ctx->config.event_handler(DL_EVENT_ON_DATA, &ctx->event);
+                remain_len = ctx->event.remain_len < ctx->event.data_len ? ctx->event.remain_len : ctx->event.data_len;
+            }
+            mbedtls_sha256_update(&ctx->hash, ctx->event.data, ctx->event.data_len - remain_len);
+            ctx->consumed += ctx->event.data_len - remain_len;
+            ctx->delivered = end;
+            ctx->progress_time = tal_time_get_posix();
+            if (ctx->consumed - ctx->checkpoint >= HTTP_DOWNLOAD_CHECKPOINT_SIZE) {
+                http_download_checkpoint_save(ctx);
+            }
+            continue;
+        }
+
+        if (!holds) {
+            return;
+        }
+        remain_len = ctx->delivered - ctx->consumed;
+        if (ctx->delivered == seg->end) {
+            /* the next chunk starts with what is left of this one */
+            ctx->head++;
+            if (ctx->head < ctx->chunk_num && remain_len) {
+                next = &ctx->segments[ctx->head % ctx->segment_num];
+                memcpy(next->buffer + ctx->config.range_length - remain_len,
+                       http_download_segment_ptr(ctx, seg, ctx->consumed), remain_len);
+            }
+            tal_mutex_lock(ctx->mutex);
+            seg->busy = false;
+            tal_mutex_unlock(ctx->mutex);
+            tal_semaphore_post(seg->space);
+        } else if (ctx->delivered == seg->base + HTTP_DOWNLOAD_SEGMENT_SIZE) {
+            memmove(seg->buffer + ctx->config.range_length - remain_len,
+                    http_download_segment_ptr(ctx, seg, ctx->consumed), remain_len);
+            tal_mutex_lock(ctx->mutex);
+            seg->base = ctx->delivered;
+            tal_mutex_unlock(ctx->mutex);
+            tal_semaphore_post(seg->space);
+        } else {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief fetch the rest of the chunk of the segment on its connection
+ */
+static int http_download_segment_fetch(http_download_t *ctx, http_download_segment_t *seg)
+{
+    int rt = OPRT_OK;
+    size_t space = 0;
+    int32_t read_size = 0;
+
+    if (!seg->connected) {
+        TUYA_CALL_ERR_RETURN(tuya_transporter_connect(seg->network, ctx->host, ctx->port, ctx->config.timeout_ms));
+        seg->connected = true;
+    }
+    TUYA_CALL_ERR_RETURN(http_download_range_request(ctx, seg));
+
+    while (seg->received < seg->end) {
+        if (ctx->abort) {
+            return OPRT_COM_ERROR;
+        }
+        tal_mutex_lock(ctx->mutex);
+        space = seg->base + HTTP_DOWNLOAD_SEGMENT_SIZE - seg->received;
+        tal_mutex_unlock(ctx->mutex);
+        if (0 == space) {
+            tal_semaphore_wait(seg->space, 1000);
+            continue;
+        }
+        if (space > seg->end - seg->received) {
+            space = seg->end - seg->received;
+        }
+        read_size = HTTPClient_Recv(&seg->transport, &seg->response,
+                                    http_download_segment_ptr(ctx, seg, seg->received), space);
+        if (read_size <= 0) {
+            PR_WARN("file download range get error:%d, goto retry", read_size);
+            return OPRT_RECV_ERR;
+        }
+        tal_mutex_lock(ctx->mutex);
+        seg->received += read_size;
+        tal_mutex_unlock(ctx->mutex);
+        if (1 == ctx->segment_num) {
+            http_download_deliver(ctx);
+        } else {
+            tal_semaphore_post(ctx->data);
+        }
+    }
+
     return rt;
 }
 
+static void http_download_segment_run(http_download_segment_t *seg)
+{
+    http_download_t *ctx = seg->ctx;
+    size_t chunk = seg - ctx->segments;
+    size_t received = 0;
+    uint32_t retry = 0;
+    bool busy = false;
+    int rt = OPRT_OK;
+
+    for (; chunk < ctx->chunk_num && !ctx->abort; chunk += ctx->segment_num) {
+        /* the buffer is free once the chunk segment_num before was handed */
+        for (;;) {
+            tal_mutex_lock(ctx->mutex);
+            busy = seg->busy;
+            tal_mutex_unlock(ctx->mutex);
+            if (!busy || ctx->abort) {
+                break;
+            }
+            tal_semaphore_wait(seg->space, 1000);
+        }
+
+        tal_mutex_lock(ctx->mutex);
+        seg->start = ctx->start + chunk * ctx->chunk_size;
+        seg->end = seg->start + ctx->chunk_size < ctx->file_size ? seg->start + ctx->chunk_size : ctx->file_size;
+        seg->base = seg->start;
+        seg->received = seg->start;
+        seg->busy = true;
+        tal_mutex_unlock(ctx->mutex);
+
+        while (!ctx->abort) {
+            received = seg->received;
+            rt = http_download_segment_fetch(ctx, seg);
+            if (OPRT_OK == rt || ctx->abort) {
+                break;
+            }
+            tuya_transporter_close(seg->network);
+            seg->connected = false;
+            http_download_response_free(&seg->response);
+            /* a connection dropped midway is retried at once */
+            if (seg->received > received) {
+                retry = 0;
+                continue;
+            }
+            if (++retry > MAX_RETRY_TIMES) {
+                http_download_fail(ctx, rt);
+                break;
+            }
+            tal_system_sleep(3000);
+        }
+    }
+}
+
+static void http_download_segment_thread(void *arg)
+{
+    http_download_segment_t *seg = (http_download_segment_t *)arg;
+    http_download_t *ctx = seg->ctx;
+
+    http_download_segment_run(seg);
+    tal_semaphore_post(ctx->data);
+    tal_thread_delete(seg->thread);
+    tal_semaphore_post(ctx->done);
+}
+
+static int http_download_run(http_download_t *ctx)
+{
+    int rt = OPRT_OK;
+    uint8_t i = 0;
+    uint8_t started = 0;
+
+    if (0 == ctx->chunk_num) {
+        return OPRT_OK;
+    }
+    for (i = 0; i < ctx->segment_num; i++) {
+        if (NULL == ctx->segments[i].buffer) {
+            ctx->segments[i].buffer = tal_malloc(ctx->config.range_length + HTTP_DOWNLOAD_SEGMENT_SIZE);
+            TUYA_CHECK_NULL_RETURN(ctx->segments[i].buffer, OPRT_MALLOC_FAILED);
+        }
+    }
+    ctx->progress_time = tal_time_get_posix();
+
+    if (1 == ctx->segment_num) {
+        http_download_segment_run(&ctx->segments[0]);
+    } else {
+        THREAD_CFG_T thrd_param = {.priority = THREAD_PRIO_3, .stackDepth = 4096, .thrdname = "http_download"};
+        for (i = 0; i < ctx->segment_num; i++) {
+            rt = tal_thread_create_and_start(&ctx->segments[i].thread, NULL, NULL, http_download_segment_thread,
+                                             &ctx->segments[i], &thrd_param);
+            if (OPRT_OK != rt) {
+                http_download_fail(ctx, rt);
+                break;
+            }
+            started++;
+        }
+        while (!ctx->abort && ctx->head < ctx->chunk_num) {
+            tal_semaphore_wait(ctx->data, 1000);
+            http_download_deliver(ctx);
+            if ((tal_time_get_posix() - ctx->progress_time) >= HTTP_DOWNLOAD_TIMEOUT) {
+                http_download_fail(ctx, OPRT_TIMEOUT);
+            }
+        }
+        /* stop the segments still running, one waiting in recv stops at its timeout */
+        http_download_fail(ctx, OPRT_OK);
+        for (i = 0; i < ctx->segment_num; i++) {
+            tal_semaphore_post(ctx->segments[i].space);
+        }
+        while (started--) {
+            tal_semaphore_wait_forever(ctx->done);
+        }
+    }
+
+    if (ctx->head == ctx->chunk_num) {
+        return OPRT_OK;
+    }
+    return OPRT_OK != ctx->error ? ctx->error : OPRT_COM_ERROR;
+}
+
 /*-----------------------------------------------------------*/
 static int http_file_download_init(http_download_t *ctx, http_download_config_t *config)
 {
@@ -145,7 +551,12 @@ static int http_file_download_init(http_download_t *ctx, http_download_config_t
     if (config->range_length == 0) {
         ctx->config.range_length = RANGE_REQUEST_LENGTH_DEFAULT;
     }
+    if (config->segment_num == 0) {
+        ctx->config.segment_num = HTTP_DOWNLOAD_SEGMENT_NUM;
+    }
     ctx->event.user_data = ctx->config.user_data;
+    mbedtls_sha256_init(&ctx->hash);
+    mbedtls_sha256_starts(&ctx->hash, 0);
 
     /* url parse to host port path */
     struct http_parser_url purl;
@@ -184,9 +595,6 @@ static int http_file_download_init(http_download_t *ctx, http_download_config_t
     memcpy(ctx->path, p_path, path_len);
     ctx->path[path_len] = 0;
 
-    ctx->buffer = tal_malloc(ctx->config.range_length + 1);
-    TUYA_CHECK_NULL_RETURN(ctx->buffer, OPRT_MALLOC_FAILED);
-
     HTTPRequestInfo_t *requestInfo = &ctx->requestInfo;
     requestInfo->pHost = ctx->host;
     requestInfo->hostLen = strlen(ctx->host);
@@ -195,164 +603,185 @@ static int http_file_download_init(http_download_t *ctx, http_download_config_t
     requestInfo->pPath = ctx->path;
     requestInfo->pathLen = strlen(ctx->path);
     requestInfo->reqFlags = HTTP_REQUEST_KEEP_ALIVE_FLAG;
-    /* Set the buffer used for storing request headers. */
 
-    HTTPRequestHeaders_t *requestHeaders = &ctx->requestHeaders;
-    requestHeaders->bufferLen = 512;
-    requestHeaders->pBuffer = tal_malloc(requestHeaders->bufferLen);
-    TUYA_CHECK_NULL_RETURN(requestHeaders->pBuffer, OPRT_MALLOC_FAILED);
+    TUYA_CALL_ERR_RETURN(tal_mutex_create_init(&ctx->mutex));
+    TUYA_CALL_ERR_RETURN(tal_semaphore_create_init(&ctx->data, 0, 1));
+    TUYA_CALL_ERR_RETURN(tal_semaphore_create_init(&ctx->done, 0, ctx->config.segment_num));
 
-    return rt;
-}
+    ctx->segments = tal_calloc(ctx->config.segment_num, sizeof(http_download_segment_t));
+    TUYA_CHECK_NULL_RETURN(ctx->segments, OPRT_MALLOC_FAILED);
 
-int http_file_download(http_download_config_t *config)
-{
-    int rt = OPRT_OK;
-
-    http_download_t *ctx = tal_calloc(1, sizeof(http_download_t));
-    TUYA_CHECK_NULL_GOTO(ctx, __exit);
-    TUYA_CALL_ERR_GOTO(http_file_download_init(ctx, config), __exit);
-    /* TLS pre init */
     TUYA_TRANSPORT_TYPE_E transport_type = (config->cacert == NULL) ? TRANSPORT_TYPE_TCP : TRANSPORT_TYPE_TLS;
-    NetworkContext_t network;
-    TUYA_CHECK_NULL_GOTO(network = tuya_transporter_create(transport_type, NULL), __exit);
-    if (transport_type == TRANSPORT_TYPE_TLS) {
-        tuya_tls_config_t tls_config = {
-            .ca_cert = (char *)config->cacert,
-            .ca_cert_size = config->cacert_len,
-            .hostname = (char *)ctx->host,
-            .port = ctx->port,
-            .mode = TUYA_TLS_SERVER_CERT_MODE,
-            .verify = true,
-        };
-
-        TUYA_CALL_ERR_GOTO(tuya_transporter_ctrl(network, TUYA_TRANSPORTER_SET_TLS_CONFIG, &tls_config), __exit);
-    }
-    /* http client TransportInterface */
-    ctx->transport.pNetworkContext = (NetworkContext_t *)&network;
-    ctx->transport.send = (TransportSend_t)NetworkTransportSend;
-    ctx->transport.recv = (TransportRecv_t)NetworkTransportRecv;
-
-    ctx->state = DL_STATE_NETWORK_CONNECT;
-    TIME_T download_time = tal_time_get_posix();
-
-    bool is_completed = false;
-
-    int32_t read_size = 0;
-
-    if (ctx->config.event_handler) {
-        ctx->config.event_handler(DL_EVENT_START, &ctx->event);
+    for (uint8_t i = 0; i < ctx->config.segment_num; i++) {
+        http_download_segment_t *seg = &ctx->segments[i];
+
+        seg->ctx = ctx;
+        TUYA_CALL_ERR_RETURN(tal_semaphore_create_init(&seg->space, 0, 1));
+        seg->network = tuya_transporter_create(transport_type, NULL);
+        TUYA_CHECK_NULL_RETURN(seg->network, OPRT_MALLOC_FAILED);
+        if (transport_type == TRANSPORT_TYPE_TLS) {
+            tuya_tls_config_t tls_config = {
+                .ca_cert = (char *)config->cacert,
+                .ca_cert_size = config->cacert_len,
+                .hostname = (char *)ctx->host,
+                .port = ctx->port,
+                .mode = TUYA_TLS_SERVER_CERT_MODE,
+                .verify = true,
+            };
+
+            TUYA_CALL_ERR_RETURN(tuya_transporter_ctrl(seg->network, TUYA_TRANSPORTER_SET_TLS_CONFIG, &tls_config));
+        }
+        /* http client TransportInterface */
+        seg->transport.pNetworkContext = (NetworkContext_t *)&seg->network;
+        seg->transport.send = (TransportSend_t)NetworkTransportSend;
+        seg->transport.recv = (TransportRecv_t)NetworkTransportRecv;
+        /* Set the buffer used for storing request headers. */
+        seg->requestHeaders.bufferLen = 512;
+        seg->requestHeaders.pBuffer = tal_malloc(seg->requestHeaders.bufferLen);
+        TUYA_CHECK_NULL_RETURN(seg->requestHeaders.pBuffer, OPRT_MALLOC_FAILED);
     }
 
-    do {
-
-        switch (ctx->state) {
+    return rt;
+}
 
-        case DL_STATE_NETWORK_CONNECT:
-            rt = tuya_transporter_connect(network, ctx->host, ctx->port, config->timeout_ms);
-            if (OPRT_OK == rt) {
-                ctx->state = DL_STATE_FILESIZE_GET;
-            } else {
-                ctx->state = DL_STATE_NETWORK_RECONNECT;
-            }
-            break;
+static void http_file_download_deinit(http_download_t *ctx)
+{
+    if (ctx->segments) {
+        for (uint8_t i = 0; i < ctx->config.segment_num; i++) {
+            http_download_segment_t *seg = &ctx->segments[i];
 
-        case DL_STATE_FILESIZE_GET:
-            if (0 == ctx->file_size) {
-                rt = http_download_filesize_get(ctx);
+            if (seg->network) {
+                tuya_transporter_close(seg->network);
+                tuya_transporter_destroy(seg->network);
             }
-            if (OPRT_OK != rt) {
-                ctx->state = DL_STATE_NETWORK_RECONNECT;
-                break;
+            if (seg->space) {
+                tal_semaphore_release(seg->space);
             }
-            if (ctx->config.event_handler) {
-                ctx->event.file_size = ctx->file_size;
-                ctx->config.event_handler(DL_EVENT_ON_FILESIZE, &ctx->event);
+            if (seg->buffer) {
+                tal_free(seg->buffer);
             }
-            ctx->state = DL_STATE_RANGE_REQUEST;
-            break;
-
-        case DL_STATE_RANGE_REQUEST:
-            rt = http_download_range_request(ctx, ctx->received_size, ctx->file_size);
-            if (OPRT_OK != rt) {
-                ctx->state = DL_STATE_NETWORK_RECONNECT;
-                break;
+            if (seg->requestHeaders.pBuffer) {
+                tal_free(seg->requestHeaders.pBuffer);
             }
-            ctx->state = DL_STATE_DATE_GET;
+            http_download_response_free(&seg->response);
+        }
+        tal_free(ctx->segments);
+    }
+    if (ctx->mutex) {
+        tal_mutex_release(ctx->mutex);
+    }
+    if (ctx->data) {
+        tal_semaphore_release(ctx->data);
+    }
+    if (ctx->done) {
+        tal_semaphore_release(ctx->done);
+    }
+    if (ctx->host) {
+        tal_free(ctx->host);
+    }
+    if (ctx->path) {
+        tal_free(ctx->path);
+    }
+    mbedtls_sha256_free(&ctx->hash);
+}
 
-        case DL_STATE_DATE_GET: {
-            read_size = HTTPClient_Recv(&ctx->transport, &ctx->response, ctx->buffer + ctx->remain_len,
-                                        ctx->config.range_length - ctx->remain_len);
+/**
+ * @brief connect the first segment, get the file size when not given and
+ * split what is left to download in chunks
+ */
+static int http_file_download_prepare(http_download_t *ctx)
+{
+    int rt = OPRT_OK;
+    uint32_t retry = 0;
+    http_download_segment_t *seg = &ctx->segments[0];
 
-            if (read_size <= 0) {
-                PR_WARN("file download range get error:%d, goto retry", rt);
-                ctx->state = DL_STATE_NETWORK_RECONNECT;
-                break;
-            }
-            if (ctx->config.event_handler) {
-                ctx->event.data = (uint8_t *)ctx->buffer;
-                ctx->event.data_len = read_size + ctx->remain_len;
-                ctx->event.offset = ctx->received_size - ctx->remain_len;
-                ctx->event.remain_len = ctx->remain_len;
-                ctx->config.event_handler(DL_EVENT_ON_DATA, &ctx->event);
-                if (ctx->event.remain_len) {
-                    memmove(ctx->buffer, ctx->buffer + (ctx->event.data_len - ctx->event.remain_len),
-                            ctx->event.remain_len);
-                }
-                ctx->remain_len = ctx->event.remain_len;
-                ctx->received_size += read_size;
-            }
-            //! reset time
-            download_time = tal_time_get_posix();
-            /* File download complete? */
-            if (ctx->received_size >= ctx->file_size) {
-                ctx->state = DL_STATE_COMPLETE;
+    for (;;) {
+        rt = tuya_transporter_connect(seg->network, ctx->host, ctx->port, ctx->config.timeout_ms);
+        if (OPRT_OK == rt) {
+            seg->connected = true;
+            if (0 == ctx->file_size) {
+                rt = http_download_filesize_get(ctx, seg);
             }
+        }
+        if (OPRT_OK == rt || ++retry > MAX_RETRY_TIMES) {
             break;
         }
+        tuya_transporter_close(seg->network);
+        seg->connected = false;
+        tal_system_sleep(3000);
+    }
+    TUYA_CALL_ERR_RETURN(rt);
+
+    http_download_checkpoint_load(ctx);
+    ctx->consumed = ctx->start;
+    ctx->delivered = ctx->start;
+
+    /* one segment takes the rest with one request, more take it in chunks */
+    size_t rest = ctx->file_size - ctx->start;
+    ctx->chunk_size = (1 == ctx->config.segment_num) ? rest : HTTP_DOWNLOAD_SEGMENT_SIZE;
+    ctx->chunk_num = rest ? (rest + ctx->chunk_size - 1) / ctx->chunk_size : 0;
+    ctx->segment_num = ctx->config.segment_num;
+    if (ctx->segment_num > ctx->chunk_num) {
+        ctx->segment_num = ctx->chunk_num ? ctx->chunk_num : 1;
+    }
 
-        case DL_STATE_NETWORK_RECONNECT:
-            tuya_transporter_close(network);
-            tal_system_sleep(3000);
-            ctx->state = DL_STATE_NETWORK_CONNECT;
-            break;
+    return rt;
+}
 
-        case DL_STATE_COMPLETE:
-            PR_INFO("Download Complete!");
-            is_completed = true;
-            if (ctx->config.event_handler) {
-                ctx->config.event_handler(DL_EVENT_FINISH, &ctx->event);
-            }
-            break;
-        }
-    } while (((tal_time_get_posix() - download_time) < HTTP_DOWNLOAD_TIMEOUT) && !is_completed);
+int http_file_download(http_download_config_t *config)
+{
+    int rt = OPRT_OK;
+
+    http_download_t *ctx = tal_calloc(1, sizeof(http_download_t));
+    TUYA_CHECK_NULL_RETURN(ctx, OPRT_MALLOC_FAILED);
+    TUYA_CALL_ERR_GOTO(http_file_download_init(ctx, config), __exit);
 
-    tuya_transporter_close(network);
-    tuya_transporter_destroy(network);
+    if (ctx->config.event_handler) {
+        ctx->config.event_handler(DL_EVENT_START, &ctx->event);
+    }
 
-    if (!is_completed) {
+    rt = http_file_download_prepare(ctx);
+    if (OPRT_OK == rt) {
         if (ctx->config.event_handler) {
-            ctx->config.event_handler(DL_EVENT_FAULT, &ctx->event);
+            ctx->event.file_size = ctx->file_size;
+            ctx->event.offset = ctx->start;
+            ctx->config.event_handler(DL_EVENT_ON_FILESIZE, &ctx->event);
         }
+        rt = http_download_run(ctx);
     }
-
-__exit:
-    if (ctx) {
-        if (ctx->host) {
-            tal_free(ctx->host);
+    if (OPRT_OK == rt) {
+        mbedtls_sha256_finish(&ctx->hash, ctx->sha256);
+        ctx->event.sha256 = ctx->sha256;
+        if (ctx->config.sha256 && memcmp(ctx->config.sha256, ctx->sha256, sizeof(ctx->sha256))) {
+            PR_ERR("file sha256 mismatch");
+            rt = OPRT_CRC32_FAILED;
         }
-        if (ctx->path) {
-            tal_free(ctx->path);
+    }
+
+    /* keep the progress for a restart, unless there is nothing to resume */
+    if (ctx->config.resume_key) {
+        if (OPRT_OK == rt || OPRT_CRC32_FAILED == rt) {
+            tal_kv_del(ctx->config.resume_key);
+        } else {
+            http_download_checkpoint_save(ctx);
         }
-        if (ctx->requestHeaders.pBuffer) {
-            tal_free(ctx->requestHeaders.pBuffer);
+    }
+
+    if (OPRT_OK == rt) {
+        PR_INFO("Download Complete!");
+        if (ctx->config.event_handler) {
+            ctx->config.event_handler(DL_EVENT_FINISH, &ctx->event);
         }
-        if (ctx->response.pBuffer) {
-            tal_free(ctx->response.pBuffer);
+    } else {
+        PR_ERR("Download fault:%d, %u of %u bytes", rt, (uint32_t)ctx->consumed, (uint32_t)ctx->file_size);
+        if (ctx->config.event_handler) {
+            ctx->config.event_handler(DL_EVENT_FAULT, &ctx->event);
         }
-
-        tal_free(ctx);
     }
 
+__exit:
+    http_file_download_deinit(ctx);
+    tal_free(ctx);
+
     return rt;
 }
@@ -0,0 +1,286 @@
+/**
+ * @file test_http_client_keepalive.cpp
+ * @brief unit test and benchmark of the http_client_request keep-alive pool,
+ * against a plain HTTP/1.1 server on loopback
+ */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_api.h"
+#include "http_client_interface.h"
+
+// same default as http_client_wrapper.c
+#ifndef HTTP_CLIENT_KEEPALIVE_NUM
+#define HTTP_CLIENT_KEEPALIVE_NUM 2
+#endif
+
+namespace {
+
+// answers every request with "ok", closing after each response if asked to
+class LoopbackServer {
+  public:
+    explicit LoopbackServer(bool close_after = false) : close_after_(close_after)
+    {
+        struct sockaddr_in addr = {};
+        socklen_t len = sizeof(addr);
+        int on = 1;
+
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listen_fd_, (struct sockaddr *)&addr, sizeof(addr));
+        listen(listen_fd_, 8);
+        getsockname(listen_fd_, (struct sockaddr *)&addr, &len);
+        port_ = ntohs(addr.sin_port);
+        thread_ = std::thread([this] { run(); });
+    }
+
+    ~LoopbackServer()
+    {
+        stop_ = true;
+        shutdown(listen_fd_, SHUT_RDWR);
+        close(listen_fd_);
+        thread_.join();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    uint16_t port() const
+    {
+        return port_;
+    }
+
+    // connections accepted so far
+    int accepts() const
+    {
+        return accepts_;
+    }
+
+    // requests answered so far
+    int requests() const
+    {
+        return requests_;
+    }
+
+    // close the idle connections without answering, as a server timeout does
+    void drop_idle()
+    {
+        drop_ = true;
+    }
+
+    // read the next request and close without answering it, as a server dying mid request does
+    void swallow_next()
+    {
+        swallow_ = true;
+    }
+
+  private:
+    void run()
+    {
+        while (!stop_) {
+            int fd = accept(listen_fd_, NULL, NULL);
+            if (fd < 0) {
+                break;
+            }
+            accepts_++;
+            workers_.emplace_back([this, fd] { serve(fd); });
+        }
+    }
+
+    void serve(int fd)
+    {
+        static const char rsp_keep[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+        static const char rsp_close[] = "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 2\r\n\r\nok";
+        struct timeval tv = {0, 20 * 1000};
+        std::string in;
+        char buf[1024];
+        int served = 0;
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        while (!stop_) {
+            size_t end = in.find("\r\n\r\n");
+            if (std::string::npos != end) {
+                size_t body = 0, pos = in.find("Content-Length: ");
+                if (std::string::npos != pos && pos < end) {
+                    body = strtoul(in.c_str() + pos + 16, NULL, 10);
+                }
+                if (in.size() >= end + 4 + body) {
+                    in.erase(0, end + 4 + body);
+                    requests_++;
+                    served++;
+                    if (swallow_.exchange(false)) {
+                        break;
+                    }
+                    const char *rsp = close_after_ ? rsp_close : rsp_keep;
+                    size_t len = close_after_ ? sizeof(rsp_close) - 1 : sizeof(rsp_keep) - 1;
+                    if (write(fd, rsp, len) != (ssize_t)len || close_after_) {
+                        break;
+                    }
+                    continue;
+                }
+            }
+
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n > 0) {
+                in.append(buf, n);
+            } else if (0 == n || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                break;
+            } else if (drop_ && served > 0 && in.empty()) {
+                break;
+            }
+        }
+        close(fd);
+    }
+
+    bool close_after_;
+    int listen_fd_ = -1;
+    uint16_t port_ = 0;
+    std::thread thread_;
+    std::vector<std::thread> workers_;
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> drop_{false};
+    std::atomic<bool> swallow_{false};
+    std::atomic<int> accepts_{0};
+    std::atomic<int> requests_{0};
+};
+
+http_client_status_t request(uint16_t port, const uint8_t *body, size_t body_len)
+{
+    http_client_header_t header = {"Content-Type", "application/x-www-form-urlencoded"};
+    http_client_request_t req = {};
+    http_client_response_t rsp = {};
+
+    req.host = "127.0.0.1";
+    req.port = port;
+    req.path = "/keepalive";
+    req.method = body ? "POST" : "GET";
+    req.headers = &header;
+    req.headers_count = 1;
+    req.body = body;
+    req.body_length = body_len;
+    req.timeout_ms = 3000;
+
+    http_client_status_t rt = http_client_request(&req, &rsp);
+    if (HTTP_CLIENT_SUCCESS == rt) {
+        EXPECT_EQ(200, rsp.status_code);
+        EXPECT_EQ(std::string("ok"), std::string((const char *)rsp.body, rsp.body_length));
+        http_client_free(&rsp);
+    }
+
+    return rt;
+}
+
+class HttpKeepAliveTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        ASSERT_EQ(OPRT_OK, tal_sw_timer_init());
+    }
+};
+
+} // namespace
+
+#if HTTP_CLIENT_KEEPALIVE_NUM > 0
+TEST_F(HttpKeepAliveTest, RequestsShareOneConnection)
+{
+    LoopbackServer server;
+    const uint8_t body[] = "a=1&b=2";
+
+    for (int i = 0; i < 20; i++) {
+        bool post = i & 1;
+        ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), post ? body : NULL, post ? sizeof(body) - 1 : 0)) << i;
+    }
+    EXPECT_EQ(20, server.requests());
+    EXPECT_EQ(1, server.accepts());
+}
+
+TEST_F(HttpKeepAliveTest, ConnectionCloseIsHonoured)
+{
+    LoopbackServer server(true);
+
+    for (int i = 0; i < 5; i++) {
+        ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), NULL, 0)) << i;
+    }
+    EXPECT_EQ(5, server.accepts());
+}
+
+TEST_F(HttpKeepAliveTest, ConnectionClosedByServerIsReplaced)
+{
+    LoopbackServer server;
+
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), NULL, 0));
+    server.drop_idle();
+    tal_system_sleep(100);
+
+    // the kept connection is gone, the request goes out on a new one
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), NULL, 0));
+    EXPECT_EQ(2, server.accepts());
+    EXPECT_EQ(2, server.requests());
+}
+
+TEST_F(HttpKeepAliveTest, PostWithoutResponseIsNotReplayed)
+{
+    LoopbackServer server;
+    const uint8_t body[] = "a=1&b=2";
+
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), body, sizeof(body) - 1));
+    server.swallow_next();
+
+    // the POST reached the server, it may have been executed, so it is not sent again
+    EXPECT_NE(HTTP_CLIENT_SUCCESS, request(server.port(), body, sizeof(body) - 1));
+    EXPECT_EQ(1, server.accepts());
+    EXPECT_EQ(2, server.requests());
+}
+
+TEST_F(HttpKeepAliveTest, GetWithoutResponseIsReplayed)
+{
+    LoopbackServer server;
+
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), NULL, 0));
+    server.swallow_next();
+
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), NULL, 0));
+    EXPECT_EQ(2, server.accepts());
+    EXPECT_EQ(3, server.requests());
+}
+#endif
+
+TEST_F(HttpKeepAliveTest, BenchmarkSequentialRequests)
+{
+    LoopbackServer server;
+    const uint8_t body[] = "{\"t\":1700000000,\"data\":\"0123456789abcdef\"}";
+    const int count = 300;
+
+    for (const uint8_t *payload : {(const uint8_t *)NULL, body}) {
+        std::vector<double> us;
+        int accepts = server.accepts();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) {
+            auto begin = std::chrono::steady_clock::now();
+            ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), payload, payload ? sizeof(body) - 1 : 0)) << i;
+            us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::sort(us.begin(), us.end());
+        printf("[   INFO   ] %s: %d requests, %.0f req/s, p50 %.0f us, p99 %.0f us, %d connections\n",
+               payload ? "POST with body" : "GET", count, count * 1e3 / ms, us[us.size() / 2], us[us.size() * 99 / 100],
+               server.accepts() - accepts);
+    }
+}
@@ -0,0 +1,430 @@
+/**
+ * @file test_http_client_tls.cpp
+ * @brief unit test and benchmark of http_client_request over TLS, against an
+ * mbedtls HTTP/1.1 server on loopback with a self-signed certificate, for the
+ * session resumption of tuya_tls and the keep-alive pool
+ */
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_api.h"
+#include "tuya_tls.h"
+#include "http_client_interface.h"
+
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+
+// same defaults as http_client_wrapper.c and tuya_tls.c
+#ifndef HTTP_CLIENT_KEEPALIVE_NUM
+#define HTTP_CLIENT_KEEPALIVE_NUM 2
+#endif
+
+#ifndef TLS_SESSION_CACHE_NUM
+#define TLS_SESSION_CACHE_NUM 2
+#endif
+
+// the server side needs ENABLE_MBEDTLS_SSL_SRV_C
+#if defined(MBEDTLS_SSL_SRV_C)
+
+namespace {
+
+struct Drbg {
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctx;
+
+    Drbg()
+    {
+        mbedtls_entropy_init(&entropy);
+        mbedtls_ctr_drbg_init(&ctx);
+        mbedtls_ctr_drbg_seed(&ctx, mbedtls_entropy_func, &entropy, (const unsigned char *)"ut", 2);
+    }
+
+    ~Drbg()
+    {
+        mbedtls_ctr_drbg_free(&ctx);
+        mbedtls_entropy_free(&entropy);
+    }
+};
+
+// a self-signed P-256 certificate of 127.0.0.1 and its key
+struct Identity {
+    mbedtls_pk_context key;
+    mbedtls_x509_crt crt;
+    std::string pem;
+
+    explicit Identity(Drbg &rng)
+    {
+        mbedtls_x509write_cert writer;
+        mbedtls_mpi serial;
+        unsigned char buf[2048] = {0};
+
+        mbedtls_pk_init(&key);
+        mbedtls_x509_crt_init(&crt);
+        mbedtls_x509write_crt_init(&writer);
+        mbedtls_mpi_init(&serial);
+
+        mbedtls_pk_setup(&key, mbedtls_pk_info_from_type(MBEDTLS_PK_ECKEY));
+        mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, mbedtls_pk_ec(key), mbedtls_ctr_drbg_random, &rng.ctx);
+        mbedtls_mpi_lset(&serial, 1);
+        mbedtls_x509write_crt_set_version(&writer, MBEDTLS_X509_CRT_VERSION_3);
+        mbedtls_x509write_crt_set_md_alg(&writer, MBEDTLS_MD_SHA256);
+        mbedtls_x509write_crt_set_subject_key(&writer, &key);
+        mbedtls_x509write_crt_set_issuer_key(&writer, &key);
+        mbedtls_x509write_crt_set_subject_name(&writer, "CN=127.0.0.1");
+        mbedtls_x509write_crt_set_issuer_name(&writer, "CN=127.0.0.1");
+        mbedtls_x509write_crt_set_serial(&writer, &serial);
+        mbedtls_x509write_crt_set_validity(&writer, "20200101000000", "20991231235959");
+        mbedtls_x509write_crt_set_basic_constraints(&writer, 1, 0);
+        if (0 == mbedtls_x509write_crt_pem(&writer, buf, sizeof(buf), mbedtls_ctr_drbg_random, &rng.ctx)) {
+            pem = (const char *)buf;
+            mbedtls_x509_crt_parse(&crt, (const unsigned char *)pem.c_str(), pem.size() + 1);
+        }
+
+        mbedtls_mpi_free(&serial);
+        mbedtls_x509write_crt_free(&writer);
+    }
+
+    ~Identity()
+    {
+        mbedtls_x509_crt_free(&crt);
+        mbedtls_pk_free(&key);
+    }
+};
+
+// answers every request with "ok" over TLS, closing after each response if
+// asked to, and keeps the sessions it hands out for resumption
+class TlsServer {
+  public:
+    TlsServer(Identity &identity, Drbg &rng, bool close_after = false) : close_after_(close_after)
+    {
+        struct sockaddr_in addr = {};
+        socklen_t len = sizeof(addr);
+        int on = 1;
+
+        mbedtls_ssl_config_init(&conf_);
+        mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT);
+        mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &rng.ctx);
+        mbedtls_ssl_conf_own_cert(&conf_, &identity.crt, &identity.key);
+        mbedtls_ssl_conf_session_cache(&conf_, this, cache_get, cache_set);
+
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listen_fd_, (struct sockaddr *)&addr, sizeof(addr));
+        listen(listen_fd_, 8);
+        getsockname(listen_fd_, (struct sockaddr *)&addr, &len);
+        port_ = ntohs(addr.sin_port);
+        thread_ = std::thread([this] { run(); });
+    }
+
+    ~TlsServer()
+    {
+        stop_ = true;
+        shutdown(listen_fd_, SHUT_RDWR);
+        close(listen_fd_);
+        thread_.join();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+        mbedtls_ssl_config_free(&conf_);
+    }
+
+    uint16_t port() const
+    {
+        return port_;
+    }
+
+    int accepts() const
+    {
+        return accepts_;
+    }
+
+    int requests() const
+    {
+        return requests_;
+    }
+
+    // handshakes completed, full and resumed
+    int handshakes() const
+    {
+        return handshakes_;
+    }
+
+    // full handshakes, mbedtls caches the session of these only
+    int full_handshakes() const
+    {
+        return full_;
+    }
+
+  private:
+    static int cache_get(void *data, unsigned char const *id, size_t id_len, mbedtls_ssl_session *session)
+    {
+        TlsServer *self = (TlsServer *)data;
+        std::lock_guard<std::mutex> guard(self->lock_);
+
+        auto it = self->sessions_.find(std::string((const char *)id, id_len));
+        if (it == self->sessions_.end()) {
+            return -1;
+        }
+        return mbedtls_ssl_session_load(session, it->second.data(), it->second.size());
+    }
+
+    static int cache_set(void *data, unsigned char const *id, size_t id_len, const mbedtls_ssl_session *session)
+    {
+        TlsServer *self = (TlsServer *)data;
+        size_t len = 0;
+
+        mbedtls_ssl_session_save(session, NULL, 0, &len);
+        std::vector<unsigned char> saved(len);
+        if (0 != mbedtls_ssl_session_save(session, saved.data(), saved.size(), &len)) {
+            return -1;
+        }
+        std::lock_guard<std::mutex> guard(self->lock_);
+        self->sessions_[std::string((const char *)id, id_len)] = saved;
+        self->full_++;
+        return 0;
+    }
+
+    static int bio_send(void *ctx, const unsigned char *buf, size_t len)
+    {
+        ssize_t n = send(*(int *)ctx, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            return (EAGAIN == errno || EWOULDBLOCK == errno) ? MBEDTLS_ERR_SSL_WANT_WRITE
+                                                             : MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+        }
+        return (int)n;
+    }
+
+    static int bio_recv(void *ctx, unsigned char *buf, size_t len)
+    {
+        ssize_t n = recv(*(int *)ctx, buf, len, 0);
+        if (n < 0) {
+            return (EAGAIN == errno || EWOULDBLOCK == errno) ? MBEDTLS_ERR_SSL_WANT_READ
+                                                             : MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+        }
+        return (int)n;
+    }
+
+    void run()
+    {
+        while (!stop_) {
+            int fd = accept(listen_fd_, NULL, NULL);
+            if (fd < 0) {
+                break;
+            }
+            accepts_++;
+            workers_.emplace_back([this, fd] { serve(fd); });
+        }
+    }
+
+    void serve(int fd)
+    {
+        static const char rsp_keep[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+        static const char rsp_close[] = "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 2\r\n\r\nok";
+        struct timeval tv = {0, 20 * 1000};
+        mbedtls_ssl_context ssl;
+        std::string in;
+        unsigned char buf[1024];
+        int ret = 0;
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        mbedtls_ssl_init(&ssl);
+        mbedtls_ssl_setup(&ssl, &conf_);
+        mbedtls_ssl_set_bio(&ssl, &fd, bio_send, bio_recv, NULL);
+
+        while ((ret = mbedtls_ssl_handshake(&ssl)) != 0 && !stop_) {
+            if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+                break;
+            }
+        }
+        if (0 == ret) {
+            handshakes_++;
+        }
+
+        while (0 == ret && !stop_) {
+            size_t end = in.find("\r\n\r\n");
+            if (std::string::npos != end) {
+                size_t body = 0, pos = in.find("Content-Length: ");
+                if (std::string::npos != pos && pos < end) {
+                    body = strtoul(in.c_str() + pos + 16, NULL, 10);
+                }
+                if (in.size() >= end + 4 + body) {
+                    in.erase(0, end + 4 + body);
+                    requests_++;
+                    const char *rsp = close_after_ ? rsp_close : rsp_keep;
+                    size_t len = close_after_ ? sizeof(rsp_close) - 1 : sizeof(rsp_keep) - 1;
+                    if (mbedtls_ssl_write(&ssl, (const unsigned char *)rsp, len) != (int)len || close_after_) {
+                        mbedtls_ssl_close_notify(&ssl);
+                        break;
+                    }
+                    continue;
+                }
+            }
+
+            int n = mbedtls_ssl_read(&ssl, buf, sizeof(buf));
+            if (n > 0) {
+                in.append((const char *)buf, n);
+            } else if (n != MBEDTLS_ERR_SSL_WANT_READ) {
+                break;
+            }
+        }
+
+        mbedtls_ssl_free(&ssl);
+        close(fd);
+    }
+
+    bool close_after_;
+    mbedtls_ssl_config conf_;
+    int listen_fd_ = -1;
+    uint16_t port_ = 0;
+    std::thread thread_;
+    std::vector<std::thread> workers_;
+    std::mutex lock_;
+    std::map<std::string, std::vector<unsigned char>> sessions_;
+    std::atomic<bool> stop_{false};
+    std::atomic<int> accepts_{0};
+    std::atomic<int> requests_{0};
+    std::atomic<int> handshakes_{0};
+    std::atomic<int> full_{0};
+};
+
+http_client_status_t request(uint16_t port, const std::string &cacert)
+{
+    http_client_request_t req = {};
+    http_client_response_t rsp = {};
+
+    req.cacert = (const uint8_t *)cacert.c_str();
+    req.cacert_len = cacert.size() + 1;
+    req.host = "127.0.0.1";
+    req.port = port;
+    req.path = "/tls";
+    req.method = "GET";
+    req.timeout_ms = 3000;
+
+    http_client_status_t rt = http_client_request(&req, &rsp);
+    if (HTTP_CLIENT_SUCCESS == rt) {
+        EXPECT_EQ(200, rsp.status_code);
+        EXPECT_EQ(std::string("ok"), std::string((const char *)rsp.body, rsp.body_length));
+        http_client_free(&rsp);
+    }
+
+    return rt;
+}
+
+class HttpTlsTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        ASSERT_EQ(OPRT_OK, tal_sw_timer_init());
+        ASSERT_EQ(OPRT_OK, tuya_tls_init());
+        s_rng = new Drbg();
+        s_identity = new Identity(*s_rng);
+        s_other = new Identity(*s_rng);
+        ASSERT_FALSE(s_identity->pem.empty());
+        ASSERT_FALSE(s_other->pem.empty());
+    }
+
+    static void TearDownTestSuite()
+    {
+        delete s_other;
+        delete s_identity;
+        delete s_rng;
+    }
+
+    static Drbg *s_rng;
+    static Identity *s_identity; // the certificate the server presents
+    static Identity *s_other;    // a certificate that does not sign it
+};
+
+Drbg *HttpTlsTest::s_rng = NULL;
+Identity *HttpTlsTest::s_identity = NULL;
+Identity *HttpTlsTest::s_other = NULL;
+
+} // namespace
+
+#if TLS_SESSION_CACHE_NUM > 0
+TEST_F(HttpTlsTest, SecondConnectionResumesTheSession)
+{
+    TlsServer server(*s_identity, *s_rng, true);
+
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), s_identity->pem));
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), s_identity->pem));
+    EXPECT_EQ(2, server.accepts());
+    EXPECT_EQ(2, server.handshakes());
+    EXPECT_EQ(1, server.full_handshakes()) << "the second connection ran a full handshake";
+}
+
+TEST_F(HttpTlsTest, SessionIsNotResumedUnderAnotherCa)
+{
+    TlsServer server(*s_identity, *s_rng, true);
+
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), s_identity->pem));
+    // a resumed session would skip the check of the certificate
+    EXPECT_NE(HTTP_CLIENT_SUCCESS, request(server.port(), s_other->pem));
+    EXPECT_EQ(1, server.requests());
+}
+#endif
+
+#if HTTP_CLIENT_KEEPALIVE_NUM > 0
+TEST_F(HttpTlsTest, KeptConnectionIsNotSharedAcrossCas)
+{
+    TlsServer server(*s_identity, *s_rng);
+
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), s_identity->pem));
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), s_identity->pem));
+    EXPECT_EQ(1, server.accepts());
+
+    // the kept connection was verified against another CA than the request trusts
+    EXPECT_NE(HTTP_CLIENT_SUCCESS, request(server.port(), s_other->pem));
+    EXPECT_EQ(2, server.accepts());
+    EXPECT_EQ(2, server.requests());
+}
+#endif
+
+TEST_F(HttpTlsTest, BenchmarkHandshakes)
+{
+    const int count = 20;
+
+    // closed after each response the connections resume, kept alive there is one
+    for (bool close_after : {true, false}) {
+        TlsServer server(*s_identity, *s_rng, close_after);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) {
+            ASSERT_EQ(HTTP_CLIENT_SUCCESS, request(server.port(), s_identity->pem)) << i;
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        printf("[   INFO   ] %s: %d requests, %.0f req/s, %d connections, %d full and %d resumed handshakes\n",
+               close_after ? "Connection: close" : "keep-alive", count, count * 1e3 / ms, server.accepts(),
+               server.full_handshakes(), server.handshakes() - server.full_handshakes());
+        EXPECT_EQ(server.accepts(), server.handshakes());
+#if TLS_SESSION_CACHE_NUM > 0
+        EXPECT_EQ(1, server.full_handshakes());
+#endif
+#if HTTP_CLIENT_KEEPALIVE_NUM > 0
+        if (!close_after) {
+            EXPECT_EQ(1, server.accepts());
+        }
+#endif
+    }
+}
+
+#endif
@@ -0,0 +1,378 @@
+/**
+ * @file test_http_download.cpp
+ * @brief unit test and benchmark of http_file_download, against a loopback
+ * server answering range requests and dropping connections midway
+ */
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "mbedtls/sha256.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_api.h"
+#include "tal_kv.h"
+#include "http_download.h"
+
+namespace {
+
+// serves one file, with ranges, closing each connection after a random
+// number of body bytes when drops are on
+class RangeServer {
+  public:
+    RangeServer(const std::vector<uint8_t> &file, size_t drop_min, size_t drop_max)
+        : file_(file), drop_min_(drop_min), drop_max_(drop_max), rand_(7)
+    {
+        struct sockaddr_in addr = {};
+        socklen_t len = sizeof(addr);
+        int on = 1;
+
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listen_fd_, (struct sockaddr *)&addr, sizeof(addr));
+        listen(listen_fd_, 8);
+        getsockname(listen_fd_, (struct sockaddr *)&addr, &len);
+        url_ = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/image.bin";
+        thread_ = std::thread([this] { run(); });
+    }
+
+    ~RangeServer()
+    {
+        stop_ = true;
+        shutdown(listen_fd_, SHUT_RDWR);
+        close(listen_fd_);
+        thread_.join();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    const char *url() const
+    {
+        return url_.c_str();
+    }
+
+    // connections closed in the middle of a body
+    int drops() const
+    {
+        return drops_;
+    }
+
+  private:
+    void run()
+    {
+        while (!stop_) {
+            int fd = accept(listen_fd_, NULL, NULL);
+            if (fd < 0) {
+                break;
+            }
+            size_t budget = drop_max_ ? drop_min_ + rand_() % (drop_max_ - drop_min_ + 1) : 0;
+            workers_.emplace_back([this, fd, budget] { serve(fd, budget); });
+        }
+    }
+
+    void serve(int fd, size_t budget)
+    {
+        struct timeval tv = {0, 50 * 1000};
+        std::string in;
+        char buf[1024];
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        while (!stop_) {
+            size_t end = in.find("\r\n\r\n");
+            if (std::string::npos == end) {
+                ssize_t n = read(fd, buf, sizeof(buf));
+                if (n > 0) {
+                    in.append(buf, n);
+                    continue;
+                }
+                if (0 == n || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    break;
+                }
+                continue;
+            }
+
+            size_t first = 0, last = file_.size() - 1;
+            size_t pos = in.find("Range: bytes=");
+            if (std::string::npos != pos && pos < end) {
+                char *next = NULL;
+                first = strtoul(in.c_str() + pos + 13, &next, 10);
+                last = strtoul(next + 1, NULL, 10);
+            }
+            in.erase(0, end + 4);
+
+            std::string head = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " + std::to_string(first) + "-" +
+                               std::to_string(last) + "/" + std::to_string(file_.size()) +
+                               "\r\nContent-Length: " + std::to_string(last - first + 1) + "\r\n\r\n";
+            if (write(fd, head.data(), head.size()) != (ssize_t)head.size()) {
+                break;
+            }
+            size_t len = last - first + 1;
+            bool drop = budget && budget < len;
+            if (drop) {
+                len = budget;
+            }
+            if (!send_all(fd, &file_[first], len)) {
+                break;
+            }
+            if (drop) {
+                drops_++;
+                break;
+            }
+            budget -= budget ? len : 0;
+        }
+        close(fd);
+    }
+
+    bool send_all(int fd, const uint8_t *data, size_t len)
+    {
+        while (len) {
+            ssize_t n = write(fd, data, len);
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    const std::vector<uint8_t> &file_;
+    size_t drop_min_;
+    size_t drop_max_;
+    std::minstd_rand rand_;
+    std::string url_;
+    int listen_fd_ = -1;
+    std::thread thread_;
+    std::vector<std::thread> workers_;
+    std::atomic<bool> stop_{false};
+    std::atomic<int> drops_{0};
+};
+
+// what the event handler saw, it keeps all it consumed like an OTA writer
+struct Sink {
+    std::vector<uint8_t> data;
+    size_t resumed_at = 0;
+    size_t stop_at = 0; // leaves everything past this offset, which fails the download
+    bool finished = false;
+    bool faulted = false;
+    bool in_order = true;
+    uint8_t sha256[32] = {0};
+};
+
+void sink_event(http_download_event_id_t id, http_download_event_t *event)
+{
+    Sink *sink = (Sink *)event->user_data;
+
+    switch (id) {
+    case DL_EVENT_ON_FILESIZE:
+        sink->resumed_at = event->offset;
+        sink->data.resize(event->offset);
+        break;
+    case DL_EVENT_ON_DATA: {
+        size_t keep = event->data_len;
+        if (sink->stop_at && event->offset + keep > sink->stop_at) {
+            keep = sink->stop_at > event->offset ? sink->stop_at - event->offset : 0;
+        }
+        // a writer taking whole 1 KB blocks, the rest is handed again
+        if (event->offset + event->data_len < event->file_size) {
+            keep &= ~(size_t)1023;
+        }
+        if (event->offset != sink->data.size()) {
+            sink->in_order = false;
+        }
+        sink->data.insert(sink->data.end(), (uint8_t *)event->data, (uint8_t *)event->data + keep);
+        event->remain_len = event->data_len - keep;
+        break;
+    }
+    case DL_EVENT_FINISH:
+        sink->finished = true;
+        memcpy(sink->sha256, event->sha256, sizeof(sink->sha256));
+        break;
+    case DL_EVENT_FAULT:
+        sink->faulted = true;
+        break;
+    default:
+        break;
+    }
+}
+
+std::vector<uint8_t> make_file(size_t size)
+{
+    std::vector<uint8_t> file(size);
+    std::minstd_rand rand(1);
+
+    for (auto &byte : file) {
+        byte = (uint8_t)rand();
+    }
+    return file;
+}
+
+std::vector<uint8_t> sha256_of(const std::vector<uint8_t> &data)
+{
+    std::vector<uint8_t> out(32);
+    mbedtls_sha256(data.data(), data.size(), out.data(), 0);
+    return out;
+}
+
+int download(const char *url, uint8_t segments, const char *resume_key, const uint8_t *sha256, Sink *sink)
+{
+    http_download_config_t config = {};
+
+    config.url = url;
+    config.timeout_ms = 3000;
+    config.range_length = 4096;
+    config.user_data = sink;
+    config.event_handler = sink_event;
+    config.segment_num = segments;
+    config.resume_key = resume_key;
+    config.sha256 = sha256;
+    return http_file_download(&config);
+}
+
+class HttpDownloadTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        tal_kv_cfg_t cfg = {};
+        memcpy(cfg.seed, "vmlkasdh93dlvlcy", TAL_LV_KEY_LEN);
+        memcpy(cfg.key, "dflfuap134ddlduq", TAL_LV_KEY_LEN);
+        ASSERT_EQ(OPRT_OK, tal_kv_init(&cfg));
+    }
+};
+
+} // namespace
+
+TEST_F(HttpDownloadTest, SegmentsDeliverTheFileInOrder)
+{
+    std::vector<uint8_t> file = make_file(300 * 1024 + 123);
+    std::vector<uint8_t> sha256 = sha256_of(file);
+    RangeServer server(file, 0, 0);
+
+    for (uint8_t segments : {1, 2, 4}) {
+        Sink sink;
+        ASSERT_EQ(OPRT_OK, download(server.url(), segments, NULL, sha256.data(), &sink)) << (int)segments;
+        EXPECT_TRUE(sink.finished);
+        EXPECT_TRUE(sink.in_order);
+        EXPECT_TRUE(file == sink.data) << (int)segments << " segments";
+        EXPECT_EQ(0, memcmp(sha256.data(), sink.sha256, 32));
+    }
+}
+
+TEST_F(HttpDownloadTest, DroppedConnectionsAreResumed)
+{
+    std::vector<uint8_t> file = make_file(512 * 1024);
+    std::vector<uint8_t> sha256 = sha256_of(file);
+    RangeServer server(file, 20 * 1024, 60 * 1024);
+
+    for (uint8_t segments : {1, 3}) {
+        Sink sink;
+        int drops = server.drops();
+        ASSERT_EQ(OPRT_OK, download(server.url(), segments, NULL, sha256.data(), &sink)) << (int)segments;
+        EXPECT_TRUE(file == sink.data) << (int)segments << " segments";
+        EXPECT_GT(server.drops(), drops);
+    }
+}
+
+TEST_F(HttpDownloadTest, WrongSha256Faults)
+{
+    std::vector<uint8_t> file = make_file(64 * 1024);
+    std::vector<uint8_t> sha256 = sha256_of(file);
+    RangeServer server(file, 0, 0);
+    Sink sink;
+
+    sha256[0] ^= 1;
+    EXPECT_EQ(OPRT_CRC32_FAILED, download(server.url(), 2, NULL, sha256.data(), &sink));
+    EXPECT_TRUE(sink.faulted);
+    EXPECT_FALSE(sink.finished);
+}
+
+TEST_F(HttpDownloadTest, RestartResumesFromTheCheckpoint)
+{
+    const char *key = "ut.dl.resume";
+    std::vector<uint8_t> file = make_file(400 * 1024 + 77);
+    std::vector<uint8_t> sha256 = sha256_of(file);
+    RangeServer server(file, 0, 0);
+
+    tal_kv_del(key);
+    // the first run stops taking data at 150 KB, as a reboot would
+    Sink first;
+    first.stop_at = 150 * 1024;
+    ASSERT_NE(OPRT_OK, download(server.url(), 2, key, sha256.data(), &first));
+    EXPECT_TRUE(first.faulted);
+    ASSERT_EQ(first.stop_at, first.data.size());
+
+    // the second starts where the first stopped and still verifies the whole file
+    Sink second;
+    second.data = first.data;
+    ASSERT_EQ(OPRT_OK, download(server.url(), 2, key, sha256.data(), &second));
+    EXPECT_EQ(first.stop_at, second.resumed_at);
+    EXPECT_TRUE(second.in_order);
+    EXPECT_TRUE(file == second.data);
+
+    // the checkpoint is gone after FINISH
+    uint8_t *value = NULL;
+    size_t length = 0;
+    EXPECT_NE(OPRT_OK, tal_kv_get(key, &value, &length));
+}
+
+TEST_F(HttpDownloadTest, RestartWithoutSha256StartsOver)
+{
+    const char *key = "ut.dl.nosha";
+    std::vector<uint8_t> file = make_file(200 * 1024);
+    std::vector<uint8_t> changed = file;
+
+    tal_kv_del(key);
+    Sink first;
+    first.stop_at = 100 * 1024;
+    {
+        RangeServer server(file, 0, 0);
+        ASSERT_NE(OPRT_OK, download(server.url(), 2, key, NULL, &first));
+    }
+    uint8_t *value = NULL;
+    size_t length = 0;
+    EXPECT_NE(OPRT_OK, tal_kv_get(key, &value, &length));
+
+    // the file changed on the server, to one of the same size
+    changed[10] ^= 0xff;
+    changed[150 * 1024] ^= 0xff;
+    RangeServer server(changed, 0, 0);
+    Sink second;
+    second.data = first.data;
+    ASSERT_EQ(OPRT_OK, download(server.url(), 2, key, NULL, &second));
+    EXPECT_EQ(0u, second.resumed_at);
+    EXPECT_TRUE(changed == second.data);
+}
+
+TEST_F(HttpDownloadTest, BenchmarkWithDrops)
+{
+    std::vector<uint8_t> file = make_file(2 * 1024 * 1024);
+    std::vector<uint8_t> sha256 = sha256_of(file);
+
+    for (size_t drop_max : {(size_t)0, (size_t)300 * 1024}) {
+        for (uint8_t segments : {1, 2, 4}) {
+            RangeServer server(file, drop_max / 3, drop_max);
+            Sink sink;
+            auto start = std::chrono::steady_clock::now();
+            ASSERT_EQ(OPRT_OK, download(server.url(), segments, NULL, sha256.data(), &sink));
+            double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            EXPECT_TRUE(file == sink.data);
+            printf("[   INFO   ] 2 MiB, %d segment(s), %s: %.1f MB/s, %d drops\n", segments,
+                   drop_max ? "drops" : "no drops", file.size() / sec / 1e6, server.drops());
+        }
+    }
+}
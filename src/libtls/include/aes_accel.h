@@ -0,0 +1,90 @@
+/**
+ * @file aes_accel.h
+ * @brief AES-ECB/CBC/GCM on the AES-NI and PCLMULQDQ instructions of x86-64
+ * hosts.
+ *
+ * Built when ENABLE_MBEDTLS_HW_ACCEL is set, see tuya_tls_config.h. The
+ * functions use round keys expanded by mbedtls_aes_setkey_enc/dec, so one
+ * context works with both implementations. Callers check
+ * aes_accel_supported() at run time and stay on mbedtls when it returns 0.
+ *
+ * @copyright Copyright (c) 2021-2025 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef __AES_ACCEL_H__
+#define __AES_ACCEL_H__
+
+#include <stddef.h>
+#include "mbedtls/aes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(MBEDTLS_HW_ACCEL_HOST) && defined(__x86_64__)
+#define MBEDTLS_AES_ACCEL_C
+#endif
+
+#if defined(MBEDTLS_AES_ACCEL_C)
+
+/**
+ * AES-GCM key, the hash subkey powers are computed once by
+ * aes_accel_gcm_setkey so four blocks share one GHASH reduction.
+ */
+typedef struct {
+    mbedtls_aes_context aes;
+    unsigned char h[4][16]; /*!< H^1..H^4, byte reversed */
+} aes_accel_gcm_context;
+
+/**
+ * @brief check the CPU has AES-NI, PCLMULQDQ and SSE4.1
+ *
+ * @return 1 if the other functions can be used, 0 otherwise
+ */
+int aes_accel_supported(void);
+
+/**
+ * @brief AES-ECB, length is a multiple of 16, output may be input
+ *
+ * @param[in] mode MBEDTLS_AES_ENCRYPT or MBEDTLS_AES_DECRYPT, matching the key of ctx
+ */
+void aes_accel_crypt_ecb(const mbedtls_aes_context *ctx, int mode, size_t length, const unsigned char *input,
+                         unsigned char *output);
+
+/**
+ * @brief AES-CBC, same as mbedtls_aes_crypt_cbc, iv is updated for the next call
+ */
+int aes_accel_crypt_cbc(const mbedtls_aes_context *ctx, int mode, size_t length, unsigned char iv[16],
+                        const unsigned char *input, unsigned char *output);
+
+void aes_accel_gcm_init(aes_accel_gcm_context *ctx);
+
+int aes_accel_gcm_setkey(aes_accel_gcm_context *ctx, const unsigned char *key, unsigned int keybits);
+
+void aes_accel_gcm_free(aes_accel_gcm_context *ctx);
+
+/**
+ * @brief same as mbedtls_gcm_crypt_and_tag, iv_len must be 12
+ */
+int aes_accel_gcm_crypt_and_tag(const aes_accel_gcm_context *ctx, int mode, size_t length, const unsigned char *iv,
+                                size_t iv_len, const unsigned char *add, size_t add_len, const unsigned char *input,
+                                unsigned char *output, size_t tag_len, unsigned char *tag);
+
+/**
+ * @brief same as mbedtls_gcm_auth_decrypt, iv_len must be 12
+ *
+ * @return 0 on success, MBEDTLS_ERR_GCM_AUTH_FAILED with output cleared if
+ * the tag does not match
+ */
+int aes_accel_gcm_auth_decrypt(const aes_accel_gcm_context *ctx, size_t length, const unsigned char *iv,
+                               size_t iv_len, const unsigned char *add, size_t add_len, const unsigned char *tag,
+                               size_t tag_len, const unsigned char *input, unsigned char *output);
+
+#endif /* MBEDTLS_AES_ACCEL_C */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AES_ACCEL_H__ */
@@ -9,6 +9,8 @@ extern "C" {
 #include "mbedtls/platform.h"
 #include "mbedtls/cipher.h"
 #include "mbedtls/md.h"
+#include "mbedtls/gcm.h"
+#include "aes_accel.h"
 
 typedef struct {
     unsigned char *key;
@@ -22,12 +24,38 @@ typedef struct {
     mbedtls_cipher_type_t cipher_type;
 } cipher_params_t;
 
+/**
+ * AES-GCM key handle, the key is expanded once by mbedtls_gcm_key_setup_wrapper
+ * and reused by every encrypt/decrypt call. Calls on one handle must not run
+ * concurrently.
+ */
+typedef struct {
+    mbedtls_gcm_context gcm;
+    unsigned char key[32];
+    size_t key_len;
+#if defined(MBEDTLS_AES_ACCEL_C)
+    aes_accel_gcm_context accel; /*!< used instead of gcm for 96 bit nonces when the CPU supports it */
+#endif
+} cipher_gcm_key_t;
+
 int mbedtls_cipher_auth_encrypt_wrapper(const cipher_params_t *input, unsigned char *output, size_t *olen,
                                         unsigned char *tag, size_t tag_len);
 
 int mbedtls_cipher_auth_decrypt_wrapper(const cipher_params_t *input, unsigned char *output, size_t *olen,
                                         unsigned char *tag, size_t tag_len);
 
+void mbedtls_gcm_key_init_wrapper(cipher_gcm_key_t *gcm_key);
+
+int mbedtls_gcm_key_setup_wrapper(cipher_gcm_key_t *gcm_key, const unsigned char *key, size_t key_len);
+
+void mbedtls_gcm_key_free_wrapper(cipher_gcm_key_t *gcm_key);
+
+int mbedtls_gcm_key_encrypt_wrapper(cipher_gcm_key_t *gcm_key, const cipher_params_t *input, unsigned char *output,
+                                    size_t *olen, unsigned char *tag, size_t tag_len);
+
+int mbedtls_gcm_key_decrypt_wrapper(cipher_gcm_key_t *gcm_key, const cipher_params_t *input, unsigned char *output,
+                                    size_t *olen, const unsigned char *tag, size_t tag_len);
+
 int mbedtls_message_digest(mbedtls_md_type_t md_type, const uint8_t *input, size_t ilen, uint8_t *digest);
 
 int mbedtls_message_digest_hmac(mbedtls_md_type_t md_type, const uint8_t *key, size_t keylen, const uint8_t *input,
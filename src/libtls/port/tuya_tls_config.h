@@ -90,6 +90,21 @@
  */
 //#define MBEDTLS_HAVE_ASM
 
+/*
+ * ENABLE_MBEDTLS_HW_ACCEL: use the crypto extensions of x86-64 and AArch64
+ * hosts. Support is detected at run time, other CPUs keep the portable code.
+ *      x86-64:  AES-NI for AES, PCLMULQDQ for GHASH, SHA-NI for SHA-256
+ *      AArch64: ARMv8-CE for SHA-256
+ */
+#if defined(ENABLE_MBEDTLS_HW_ACCEL) && (ENABLE_MBEDTLS_HW_ACCEL == 1) && defined(__GNUC__) &&                         \
+    (defined(__x86_64__) || defined(__aarch64__))
+#define MBEDTLS_HW_ACCEL_HOST
+#endif
+
+#if defined(MBEDTLS_HW_ACCEL_HOST) && defined(__x86_64__)
+#define MBEDTLS_HAVE_ASM
+#endif
+
 /**
  * \def MBEDTLS_NO_UDBL_DIVISION
  *
@@ -499,7 +514,9 @@
 //#define MBEDTLS_MD5_PROCESS_ALT
 //#define MBEDTLS_RIPEMD160_PROCESS_ALT
 //#define MBEDTLS_SHA1_PROCESS_ALT
-//#define MBEDTLS_SHA256_PROCESS_ALT
+#if defined(MBEDTLS_HW_ACCEL_HOST)
+#define MBEDTLS_SHA256_PROCESS_ALT // src/sha256_accel.c
+#endif
 //#define MBEDTLS_SHA512_PROCESS_ALT
 //#define MBEDTLS_DES_SETKEY_ALT
 //#define MBEDTLS_DES_CRYPT_ECB_ALT
@@ -2135,7 +2152,9 @@
  *
  * This modules adds support for the AES-NI instructions on x86-64
  */
-//#define MBEDTLS_AESNI_C
+#if defined(MBEDTLS_HW_ACCEL_HOST) && defined(__x86_64__)
+#define MBEDTLS_AESNI_C
+#endif
 
 /**
  * \def MBEDTLS_AES_C
@@ -0,0 +1,461 @@
+/**
+ * @file aes_accel.c
+ * @brief AES-ECB/CBC/GCM on the AES-NI and PCLMULQDQ instructions of x86-64
+ * hosts.
+ *
+ * mbedtls (MBEDTLS_AESNI_C) runs AES-NI one block per call and GHASH one
+ * block per reduction. Here ECB, CBC decryption and the GCM counter stream
+ * keep four blocks in flight, and GHASH multiplies four blocks by H^4..H^1
+ * before a single reduction. CBC encryption is serial by definition.
+ *
+ * GHASH works on byte reversed blocks with the carry-less multiply and
+ * reduction from the Intel "Carry-Less Multiplication Instruction and its
+ * Usage for Computing the GCM Mode" white paper.
+ *
+ * @copyright Copyright (c) 2021-2025 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include "aes_accel.h"
+
+#if defined(MBEDTLS_AES_ACCEL_C)
+
+#include <string.h>
+#include <cpuid.h>
+#include <immintrin.h>
+
+#include "mbedtls/gcm.h"
+#include "mbedtls/platform_util.h"
+
+/***********************************************************
+*************************micro define***********************
+***********************************************************/
+#define AES_ACCEL_TARGET __attribute__((target("aes,pclmul,sse4.1")))
+
+#define AES_ACCEL_BSWAP_MASK() _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+
+/***********************************************************
+*************************variable define********************
+***********************************************************/
+// written once by the first caller, racing callers store the same value
+static volatile int sg_aes_accel = -1;
+
+/***********************************************************
+*************************function define********************
+***********************************************************/
+int aes_accel_supported(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (sg_aes_accel < 0) {
+        sg_aes_accel = (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES) && (ecx & bit_PCLMUL) &&
+                        (ecx & bit_SSE4_1))
+                           ? 1
+                           : 0;
+    }
+
+    return sg_aes_accel;
+}
+
+AES_ACCEL_TARGET static int __aes_load_keys(const mbedtls_aes_context *ctx, __m128i rk[15])
+{
+    const uint32_t *src = ctx->MBEDTLS_PRIVATE(rk);
+    int nr = ctx->MBEDTLS_PRIVATE(nr);
+    int i;
+
+    for (i = 0; i <= nr; i++) {
+        rk[i] = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+    }
+
+    return nr;
+}
+
+AES_ACCEL_TARGET static inline __m128i __aes_enc1(const __m128i *rk, int nr, __m128i x)
+{
+    int i;
+
+    x = _mm_xor_si128(x, rk[0]);
+    for (i = 1; i < nr; i++) {
+        x = _mm_aesenc_si128(x, rk[i]);
+    }
+
+    return _mm_aesenclast_si128(x, rk[nr]);
+}
+
+AES_ACCEL_TARGET static inline __m128i __aes_dec1(const __m128i *rk, int nr, __m128i x)
+{
+    int i;
+
+    x = _mm_xor_si128(x, rk[0]);
+    for (i = 1; i < nr; i++) {
+        x = _mm_aesdec_si128(x, rk[i]);
+    }
+
+    return _mm_aesdeclast_si128(x, rk[nr]);
+}
+
+AES_ACCEL_TARGET static inline void __aes_enc4(const __m128i *rk, int nr, __m128i b[4])
+{
+    int i;
+
+    b[0] = _mm_xor_si128(b[0], rk[0]);
+    b[1] = _mm_xor_si128(b[1], rk[0]);
+    b[2] = _mm_xor_si128(b[2], rk[0]);
+    b[3] = _mm_xor_si128(b[3], rk[0]);
+    for (i = 1; i < nr; i++) {
+        b[0] = _mm_aesenc_si128(b[0], rk[i]);
+        b[1] = _mm_aesenc_si128(b[1], rk[i]);
+        b[2] = _mm_aesenc_si128(b[2], rk[i]);
+        b[3] = _mm_aesenc_si128(b[3], rk[i]);
+    }
+    b[0] = _mm_aesenclast_si128(b[0], rk[nr]);
+    b[1] = _mm_aesenclast_si128(b[1], rk[nr]);
+    b[2] = _mm_aesenclast_si128(b[2], rk[nr]);
+    b[3] = _mm_aesenclast_si128(b[3], rk[nr]);
+}
+
+AES_ACCEL_TARGET static inline void __aes_dec4(const __m128i *rk, int nr, __m128i b[4])
+{
+    int i;
+
+    b[0] = _mm_xor_si128(b[0], rk[0]);
+    b[1] = _mm_xor_si128(b[1], rk[0]);
+    b[2] = _mm_xor_si128(b[2], rk[0]);
+    b[3] = _mm_xor_si128(b[3], rk[0]);
+    for (i = 1; i < nr; i++) {
+        b[0] = _mm_aesdec_si128(b[0], rk[i]);
+        b[1] = _mm_aesdec_si128(b[1], rk[i]);
+        b[2] = _mm_aesdec_si128(b[2], rk[i]);
+        b[3] = _mm_aesdec_si128(b[3], rk[i]);
+    }
+    b[0] = _mm_aesdeclast_si128(b[0], rk[nr]);
+    b[1] = _mm_aesdeclast_si128(b[1], rk[nr]);
+    b[2] = _mm_aesdeclast_si128(b[2], rk[nr]);
+    b[3] = _mm_aesdeclast_si128(b[3], rk[nr]);
+}
+
+AES_ACCEL_TARGET void aes_accel_crypt_ecb(const mbedtls_aes_context *ctx, int mode, size_t length,
+                                          const unsigned char *input, unsigned char *output)
+{
+    __m128i rk[15], b[4];
+    int nr = __aes_load_keys(ctx, rk);
+    int i;
+
+    for (; length >= 64; length -= 64, input += 64, output += 64) {
+        for (i = 0; i < 4; i++) {
+            b[i] = _mm_loadu_si128((const __m128i *)(input + 16 * i));
+        }
+        if (MBEDTLS_AES_ENCRYPT == mode) {
+            __aes_enc4(rk, nr, b);
+        } else {
+            __aes_dec4(rk, nr, b);
+        }
+        for (i = 0; i < 4; i++) {
+            _mm_storeu_si128((__m128i *)(output + 16 * i), b[i]);
+        }
+    }
+    for (; length >= 16; length -= 16, input += 16, output += 16) {
+        b[0] = _mm_loadu_si128((const __m128i *)input);
+        b[0] = (MBEDTLS_AES_ENCRYPT == mode) ? __aes_enc1(rk, nr, b[0]) : __aes_dec1(rk, nr, b[0]);
+        _mm_storeu_si128((__m128i *)output, b[0]);
+    }
+}
+
+AES_ACCEL_TARGET int aes_accel_crypt_cbc(const mbedtls_aes_context *ctx, int mode, size_t length, unsigned char iv[16],
+                                         const unsigned char *input, unsigned char *output)
+{
+    __m128i rk[15], b[4], c[4];
+    __m128i v = _mm_loadu_si128((const __m128i *)iv);
+    int nr;
+    int i;
+
+    if (length % 16) {
+        return MBEDTLS_ERR_AES_INVALID_INPUT_LENGTH;
+    }
+    nr = __aes_load_keys(ctx, rk);
+
+    if (MBEDTLS_AES_ENCRYPT == mode) {
+        for (; length; length -= 16, input += 16, output += 16) {
+            v = __aes_enc1(rk, nr, _mm_xor_si128(_mm_loadu_si128((const __m128i *)input), v));
+            _mm_storeu_si128((__m128i *)output, v);
+        }
+        _mm_storeu_si128((__m128i *)iv, v);
+        return 0;
+    }
+
+    // the ciphertext is loaded first, input may be output
+    for (; length >= 64; length -= 64, input += 64, output += 64) {
+        for (i = 0; i < 4; i++) {
+            c[i] = _mm_loadu_si128((const __m128i *)(input + 16 * i));
+            b[i] = c[i];
+        }
+        __aes_dec4(rk, nr, b);
+        b[0] = _mm_xor_si128(b[0], v);
+        b[1] = _mm_xor_si128(b[1], c[0]);
+        b[2] = _mm_xor_si128(b[2], c[1]);
+        b[3] = _mm_xor_si128(b[3], c[2]);
+        v = c[3];
+        for (i = 0; i < 4; i++) {
+            _mm_storeu_si128((__m128i *)(output + 16 * i), b[i]);
+        }
+    }
+    for (; length; length -= 16, input += 16, output += 16) {
+        c[0] = _mm_loadu_si128((const __m128i *)input);
+        _mm_storeu_si128((__m128i *)output, _mm_xor_si128(__aes_dec1(rk, nr, c[0]), v));
+        v = c[0];
+    }
+    _mm_storeu_si128((__m128i *)iv, v);
+
+    return 0;
+}
+
+/* 256 bit carry-less product of a and b, left unreduced so products can be summed */
+AES_ACCEL_TARGET static inline void __ghash_mul_wide(__m128i a, __m128i b, __m128i *lo, __m128i *hi)
+{
+    __m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+    __m128i t1 = _mm_clmulepi64_si128(a, b, 0x10);
+    __m128i t2 = _mm_clmulepi64_si128(a, b, 0x01);
+    __m128i t3 = _mm_clmulepi64_si128(a, b, 0x11);
+
+    t1 = _mm_xor_si128(t1, t2);
+    *lo = _mm_xor_si128(*lo, _mm_xor_si128(t0, _mm_slli_si128(t1, 8)));
+    *hi = _mm_xor_si128(*hi, _mm_xor_si128(t3, _mm_srli_si128(t1, 8)));
+}
+
+/* shift the reflected product left by one and reduce it modulo x^128 + x^7 + x^2 + x + 1 */
+AES_ACCEL_TARGET static inline __m128i __ghash_reduce(__m128i lo, __m128i hi)
+{
+    __m128i t2, t4, t5, t7, t8, t9;
+
+    t7 = _mm_srli_epi32(lo, 31);
+    t8 = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    lo = _mm_or_si128(lo, t7);
+    hi = _mm_or_si128(hi, t8);
+    hi = _mm_or_si128(hi, t9);
+
+    t7 = _mm_slli_epi32(lo, 31);
+    t8 = _mm_slli_epi32(lo, 30);
+    t9 = _mm_slli_epi32(lo, 25);
+    t7 = _mm_xor_si128(t7, t8);
+    t7 = _mm_xor_si128(t7, t9);
+    t8 = _mm_srli_si128(t7, 4);
+    t7 = _mm_slli_si128(t7, 12);
+    lo = _mm_xor_si128(lo, t7);
+
+    t2 = _mm_srli_epi32(lo, 1);
+    t4 = _mm_srli_epi32(lo, 2);
+    t5 = _mm_srli_epi32(lo, 7);
+    t2 = _mm_xor_si128(t2, t4);
+    t2 = _mm_xor_si128(t2, t5);
+    t2 = _mm_xor_si128(t2, t8);
+    lo = _mm_xor_si128(lo, t2);
+
+    return _mm_xor_si128(hi, lo);
+}
+
+AES_ACCEL_TARGET static inline __m128i __ghash_mul(__m128i a, __m128i b)
+{
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+
+    __ghash_mul_wide(a, b, &lo, &hi);
+
+    return __ghash_reduce(lo, hi);
+}
+
+/* x = (x + d[0]) * H^4 + d[1] * H^3 + d[2] * H^2 + d[3] * H, d in wire byte order */
+AES_ACCEL_TARGET static inline __m128i __ghash4(const __m128i h[4], __m128i x, const __m128i d[4])
+{
+    const __m128i mask = AES_ACCEL_BSWAP_MASK();
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+
+    __ghash_mul_wide(_mm_xor_si128(x, _mm_shuffle_epi8(d[0], mask)), h[3], &lo, &hi);
+    __ghash_mul_wide(_mm_shuffle_epi8(d[1], mask), h[2], &lo, &hi);
+    __ghash_mul_wide(_mm_shuffle_epi8(d[2], mask), h[1], &lo, &hi);
+    __ghash_mul_wide(_mm_shuffle_epi8(d[3], mask), h[0], &lo, &hi);
+
+    return __ghash_reduce(lo, hi);
+}
+
+AES_ACCEL_TARGET static __m128i __ghash_buf(const __m128i h[4], __m128i x, const unsigned char *buf, size_t len)
+{
+    const __m128i mask = AES_ACCEL_BSWAP_MASK();
+    unsigned char last[16];
+    __m128i d[4];
+    int i;
+
+    for (; len >= 64; len -= 64, buf += 64) {
+        for (i = 0; i < 4; i++) {
+            d[i] = _mm_loadu_si128((const __m128i *)(buf + 16 * i));
+        }
+        x = __ghash4(h, x, d);
+    }
+    for (; len >= 16; len -= 16, buf += 16) {
+        x = __ghash_mul(_mm_xor_si128(x, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)buf), mask)), h[0]);
+    }
+    if (len) {
+        memset(last, 0, sizeof(last));
+        memcpy(last, buf, len);
+        x = __ghash_mul(_mm_xor_si128(x, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)last), mask)), h[0]);
+    }
+
+    return x;
+}
+
+AES_ACCEL_TARGET static inline __m128i __gcm_ctr_block(__m128i j0, uint32_t ctr)
+{
+    return _mm_insert_epi32(j0, (int)__builtin_bswap32(ctr), 3);
+}
+
+/* GCM with a 96 bit iv, the full 16 byte tag is written to tag */
+AES_ACCEL_TARGET static void __aes_gcm(const aes_accel_gcm_context *ctx, int decrypt, size_t length,
+                                       const unsigned char *iv, const unsigned char *add, size_t add_len,
+                                       const unsigned char *input, unsigned char *output, unsigned char tag[16])
+{
+    const __m128i mask = AES_ACCEL_BSWAP_MASK();
+    __m128i rk[15], h[4], b[4], c[4], j0, x;
+    unsigned char last[16];
+    uint32_t ctr = 1;
+    size_t total = length;
+    int nr = __aes_load_keys(&ctx->aes, rk);
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        h[i] = _mm_loadu_si128((const __m128i *)ctx->h[i]);
+    }
+    memcpy(last, iv, 12);
+    last[12] = 0;
+    last[13] = 0;
+    last[14] = 0;
+    last[15] = 1;
+    j0 = _mm_loadu_si128((const __m128i *)last);
+
+    x = __ghash_buf(h, _mm_setzero_si128(), add, add_len);
+
+    // the input is loaded before output is stored, input may be output
+    for (; length >= 64; length -= 64, input += 64, output += 64) {
+        for (i = 0; i < 4; i++) {
+            c[i] = _mm_loadu_si128((const __m128i *)(input + 16 * i));
+            b[i] = __gcm_ctr_block(j0, ++ctr);
+        }
+        __aes_enc4(rk, nr, b);
+        for (i = 0; i < 4; i++) {
+            b[i] = _mm_xor_si128(b[i], c[i]);
+            _mm_storeu_si128((__m128i *)(output + 16 * i), b[i]);
+        }
+        x = __ghash4(h, x, decrypt ? c : b);
+    }
+    for (; length >= 16; length -= 16, input += 16, output += 16) {
+        c[0] = _mm_loadu_si128((const __m128i *)input);
+        b[0] = _mm_xor_si128(__aes_enc1(rk, nr, __gcm_ctr_block(j0, ++ctr)), c[0]);
+        _mm_storeu_si128((__m128i *)output, b[0]);
+        x = __ghash_mul(_mm_xor_si128(x, _mm_shuffle_epi8(decrypt ? c[0] : b[0], mask)), h[0]);
+    }
+    if (length) {
+        memset(last, 0, sizeof(last));
+        memcpy(last, input, length);
+        c[0] = _mm_loadu_si128((const __m128i *)last);
+        b[0] = _mm_xor_si128(__aes_enc1(rk, nr, __gcm_ctr_block(j0, ++ctr)), c[0]);
+        _mm_storeu_si128((__m128i *)last, b[0]);
+        memcpy(output, last, length);
+        if (!decrypt) {
+            memset(last + length, 0, sizeof(last) - length);
+            c[0] = _mm_loadu_si128((const __m128i *)last);
+        }
+        x = __ghash_mul(_mm_xor_si128(x, _mm_shuffle_epi8(c[0], mask)), h[0]);
+    }
+
+    // len(A) || len(C) in bits, byte reversed
+    x = __ghash_mul(_mm_xor_si128(x, _mm_set_epi64x((long long)add_len * 8, (long long)total * 8)), h[0]);
+    x = _mm_xor_si128(_mm_shuffle_epi8(x, mask), __aes_enc1(rk, nr, j0));
+    _mm_storeu_si128((__m128i *)tag, x);
+
+    mbedtls_platform_zeroize(last, sizeof(last));
+}
+
+AES_ACCEL_TARGET static void __aes_gcm_hash_key(aes_accel_gcm_context *ctx)
+{
+    __m128i rk[15], h, hn;
+    int nr = __aes_load_keys(&ctx->aes, rk);
+    int i;
+
+    h = _mm_shuffle_epi8(__aes_enc1(rk, nr, _mm_setzero_si128()), AES_ACCEL_BSWAP_MASK());
+    hn = h;
+    for (i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i *)ctx->h[i], hn);
+        hn = __ghash_mul(hn, h);
+    }
+}
+
+void aes_accel_gcm_init(aes_accel_gcm_context *ctx)
+{
+    memset(ctx, 0, sizeof(aes_accel_gcm_context));
+    mbedtls_aes_init(&ctx->aes);
+}
+
+int aes_accel_gcm_setkey(aes_accel_gcm_context *ctx, const unsigned char *key, unsigned int keybits)
+{
+    int ret = mbedtls_aes_setkey_enc(&ctx->aes, key, keybits);
+    if (ret != 0) {
+        return ret;
+    }
+    __aes_gcm_hash_key(ctx);
+
+    return 0;
+}
+
+void aes_accel_gcm_free(aes_accel_gcm_context *ctx)
+{
+    mbedtls_aes_free(&ctx->aes);
+    mbedtls_platform_zeroize(ctx, sizeof(aes_accel_gcm_context));
+}
+
+int aes_accel_gcm_crypt_and_tag(const aes_accel_gcm_context *ctx, int mode, size_t length, const unsigned char *iv,
+                                size_t iv_len, const unsigned char *add, size_t add_len, const unsigned char *input,
+                                unsigned char *output, size_t tag_len, unsigned char *tag)
+{
+    unsigned char full_tag[16];
+
+    if (iv_len != 12 || tag_len < 4 || tag_len > 16) {
+        return MBEDTLS_ERR_GCM_BAD_INPUT;
+    }
+
+    __aes_gcm(ctx, MBEDTLS_GCM_DECRYPT == mode, length, iv, add, add_len, input, output, full_tag);
+    memcpy(tag, full_tag, tag_len);
+
+    return 0;
+}
+
+int aes_accel_gcm_auth_decrypt(const aes_accel_gcm_context *ctx, size_t length, const unsigned char *iv,
+                               size_t iv_len, const unsigned char *add, size_t add_len, const unsigned char *tag,
+                               size_t tag_len, const unsigned char *input, unsigned char *output)
+{
+    unsigned char full_tag[16];
+    unsigned char diff = 0;
+    size_t i;
+
+    if (iv_len != 12 || tag_len < 4 || tag_len > 16) {
+        return MBEDTLS_ERR_GCM_BAD_INPUT;
+    }
+
+    __aes_gcm(ctx, 1, length, iv, add, add_len, input, output, full_tag);
+
+    // compare in constant time
+    for (i = 0; i < tag_len; i++) {
+        diff |= full_tag[i] ^ tag[i];
+    }
+    if (diff != 0) {
+        mbedtls_platform_zeroize(output, length);
+        return MBEDTLS_ERR_GCM_AUTH_FAILED;
+    }
+
+    return 0;
+}
+
+#endif /* MBEDTLS_AES_ACCEL_C */
@@ -141,6 +141,113 @@ EXIT:
     return (ret);
 }
 
+/*
+ * Keyed AES-GCM. The one-shot wrappers above set up a cipher context and
+ * expand the key for every message and copy the output through a temporary
+ * buffer to split off the tag. With a cipher_gcm_key_t the key is expanded
+ * once, the tag is written separately and output may be the same as
+ * input->data. The key fields of input are not used.
+ */
+void mbedtls_gcm_key_init_wrapper(cipher_gcm_key_t *gcm_key)
+{
+    memset(gcm_key, 0, sizeof(cipher_gcm_key_t));
+    mbedtls_gcm_init(&gcm_key->gcm);
+#if defined(MBEDTLS_AES_ACCEL_C)
+    aes_accel_gcm_init(&gcm_key->accel);
+#endif
+}
+
+int mbedtls_gcm_key_setup_wrapper(cipher_gcm_key_t *gcm_key, const unsigned char *key, size_t key_len)
+{
+    if (gcm_key == NULL || key == NULL || (key_len != 16 && key_len != 24 && key_len != 32)) {
+        return OPRT_INVALID_PARM;
+    }
+
+    // same key as last time, keep the expanded one
+    if (gcm_key->key_len == key_len && memcmp(gcm_key->key, key, key_len) == 0) {
+        return OPRT_OK;
+    }
+
+    gcm_key->key_len = 0;
+    int ret = mbedtls_gcm_setkey(&gcm_key->gcm, MBEDTLS_CIPHER_ID_AES, key, key_len * 8);
+    if (ret != 0) {
+        PR_ERR("mbedtls_gcm_setkey() returned -0x%04x", -ret);
+        return ret;
+    }
+#if defined(MBEDTLS_AES_ACCEL_C)
+    if (aes_accel_supported() && (ret = aes_accel_gcm_setkey(&gcm_key->accel, key, key_len * 8)) != 0) {
+        PR_ERR("aes_accel_gcm_setkey() returned -0x%04x", -ret);
+        return ret;
+    }
+#endif
+    memcpy(gcm_key->key, key, key_len);
+    gcm_key->key_len = key_len;
+
+    return OPRT_OK;
+}
+
+void mbedtls_gcm_key_free_wrapper(cipher_gcm_key_t *gcm_key)
+{
+    mbedtls_gcm_free(&gcm_key->gcm);
+#if defined(MBEDTLS_AES_ACCEL_C)
+    aes_accel_gcm_free(&gcm_key->accel);
+#endif
+    memset(gcm_key, 0, sizeof(cipher_gcm_key_t));
+}
+
+int mbedtls_gcm_key_encrypt_wrapper(cipher_gcm_key_t *gcm_key, const cipher_params_t *input, unsigned char *output,
+                                    size_t *olen, unsigned char *tag, size_t tag_len)
+{
+    if (gcm_key == NULL || gcm_key->key_len == 0 || input == NULL || output == NULL || olen == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+
+    int ret;
+#if defined(MBEDTLS_AES_ACCEL_C)
+    if (input->nonce_len == 12 && aes_accel_supported()) {
+        ret = aes_accel_gcm_crypt_and_tag(&gcm_key->accel, MBEDTLS_GCM_ENCRYPT, input->data_len, input->nonce,
+                                          input->nonce_len, input->ad, input->ad_len, input->data, output, tag_len,
+                                          tag);
+    } else
+#endif
+    {
+        ret = mbedtls_gcm_crypt_and_tag(&gcm_key->gcm, MBEDTLS_GCM_ENCRYPT, input->data_len, input->nonce,
+                                        input->nonce_len, input->ad, input->ad_len, input->data, output, tag_len, tag);
+    }
+    if (ret != 0) {
+        return ret;
+    }
+    *olen = input->data_len;
+
+    return OPRT_OK;
+}
+
+int mbedtls_gcm_key_decrypt_wrapper(cipher_gcm_key_t *gcm_key, const cipher_params_t *input, unsigned char *output,
+                                    size_t *olen, const unsigned char *tag, size_t tag_len)
+{
+    if (gcm_key == NULL || gcm_key->key_len == 0 || input == NULL || output == NULL || olen == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+
+    int ret;
+#if defined(MBEDTLS_AES_ACCEL_C)
+    if (input->nonce_len == 12 && aes_accel_supported()) {
+        ret = aes_accel_gcm_auth_decrypt(&gcm_key->accel, input->data_len, input->nonce, input->nonce_len, input->ad,
+                                         input->ad_len, tag, tag_len, input->data, output);
+    } else
+#endif
+    {
+        ret = mbedtls_gcm_auth_decrypt(&gcm_key->gcm, input->data_len, input->nonce, input->nonce_len, input->ad,
+                                       input->ad_len, tag, tag_len, input->data, output);
+    }
+    if (ret != 0) {
+        return ret;
+    }
+    *olen = input->data_len;
+
+    return OPRT_OK;
+}
+
 int mbedtls_message_digest(mbedtls_md_type_t md_type, const uint8_t *input, size_t ilen, uint8_t *digest)
 {
     if (input == NULL || ilen == 0 || digest == NULL) {
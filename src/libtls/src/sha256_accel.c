@@ -0,0 +1,228 @@
+/**
+ * @file sha256_accel.c
+ * @brief SHA-256 block function for x86-64 and AArch64 hosts.
+ *
+ * tuya_tls_config.h defines MBEDTLS_SHA256_PROCESS_ALT when
+ * ENABLE_MBEDTLS_HW_ACCEL is set, library/sha256.c then calls the
+ * mbedtls_internal_sha256_process below for every 64 byte block. It uses
+ * SHA-NI on x86-64 and the ARMv8 crypto extension on AArch64 when the CPU
+ * reports them, and the portable C rounds otherwise. The result is checked
+ * bit for bit by mbedtls_sha256_self_test.
+ *
+ * @copyright Copyright (c) 2021-2025 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include "mbedtls/build_info.h"
+
+#if defined(MBEDTLS_SHA256_C) && defined(MBEDTLS_SHA256_PROCESS_ALT)
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mbedtls/sha256.h"
+#include "mbedtls/platform_util.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_ACCEL_X86
+#elif defined(__aarch64__) && !defined(__clang__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#pragma GCC push_options
+#pragma GCC target("arch=armv8-a+crypto")
+#include <arm_neon.h>
+#define SHA256_ACCEL_A64
+#endif
+
+/***********************************************************
+*************************micro define***********************
+***********************************************************/
+#define SHA256_GET_U32_BE(b, i)                                                                                        \
+    (((uint32_t)(b)[(i)] << 24) | ((uint32_t)(b)[(i) + 1] << 16) | ((uint32_t)(b)[(i) + 2] << 8) |                   \
+     ((uint32_t)(b)[(i) + 3]))
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA256_S0(x)      (SHA256_ROTR(x, 7) ^ SHA256_ROTR(x, 18) ^ ((x) >> 3))
+#define SHA256_S1(x)      (SHA256_ROTR(x, 17) ^ SHA256_ROTR(x, 19) ^ ((x) >> 10))
+#define SHA256_S2(x)      (SHA256_ROTR(x, 2) ^ SHA256_ROTR(x, 13) ^ SHA256_ROTR(x, 22))
+#define SHA256_S3(x)      (SHA256_ROTR(x, 6) ^ SHA256_ROTR(x, 11) ^ SHA256_ROTR(x, 25))
+#define SHA256_F0(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define SHA256_F1(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+
+typedef enum {
+    SHA256_IMPL_UNKNOWN = 0,
+    SHA256_IMPL_C,
+    SHA256_IMPL_CPU,
+} SHA256_IMPL_E;
+
+/***********************************************************
+*************************variable define********************
+***********************************************************/
+static const uint32_t sg_sha256_k[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+// written once by the first caller, racing callers store the same value
+static volatile SHA256_IMPL_E sg_sha256_impl = SHA256_IMPL_UNKNOWN;
+
+/***********************************************************
+*************************function define********************
+***********************************************************/
+static void __sha256_block_c(uint32_t state[8], const unsigned char data[64])
+{
+    uint32_t w[64];
+    uint32_t a[8];
+    uint32_t t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = SHA256_GET_U32_BE(data, 4 * i);
+    }
+    for (; i < 64; i++) {
+        w[i] = SHA256_S1(w[i - 2]) + w[i - 7] + SHA256_S0(w[i - 15]) + w[i - 16];
+    }
+    memcpy(a, state, sizeof(a));
+
+    for (i = 0; i < 64; i++) {
+        t1 = a[7] + SHA256_S3(a[4]) + SHA256_F1(a[4], a[5], a[6]) + sg_sha256_k[i] + w[i];
+        t2 = SHA256_S2(a[0]) + SHA256_F0(a[0], a[1], a[2]);
+        a[7] = a[6];
+        a[6] = a[5];
+        a[5] = a[4];
+        a[4] = a[3] + t1;
+        a[3] = a[2];
+        a[2] = a[1];
+        a[1] = a[0];
+        a[0] = t1 + t2;
+    }
+
+    for (i = 0; i < 8; i++) {
+        state[i] += a[i];
+    }
+
+    mbedtls_platform_zeroize(w, sizeof(w));
+    mbedtls_platform_zeroize(a, sizeof(a));
+}
+
+#if defined(SHA256_ACCEL_X86)
+static int __sha256_cpu_supported(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1)) {
+        return 0;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+
+    return (ebx & bit_SHA) ? 1 : 0;
+}
+
+__attribute__((target("sha,sse4.1"))) static void __sha256_block_cpu(uint32_t state[8], const unsigned char data[64])
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, abef, cdgh, msg, tmp;
+    __m128i w[4];
+    int i;
+
+    // state is ABCD EFGH, the rounds want ABEF CDGH
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+    abef = state0;
+    cdgh = state1;
+
+    for (i = 0; i < 4; i++) {
+        w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * i)), mask);
+    }
+
+    // four rounds per step, w[i & 3] then becomes the schedule for step i + 4
+    for (i = 0; i < 16; i++) {
+        msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&sg_sha256_k[4 * i]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        if (i < 12) {
+            tmp = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+            tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+            w[i & 3] = _mm_sha256msg2_epu32(tmp, w[(i + 3) & 3]);
+        }
+        msg = _mm_shuffle_epi32(msg, 0x0E);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    }
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+#elif defined(SHA256_ACCEL_A64)
+static int __sha256_cpu_supported(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) ? 1 : 0;
+}
+
+static void __sha256_block_cpu(uint32_t state[8], const unsigned char data[64])
+{
+    uint32x4_t abcd = vld1q_u32(&state[0]);
+    uint32x4_t efgh = vld1q_u32(&state[4]);
+    uint32x4_t abcd_orig = abcd;
+    uint32x4_t efgh_orig = efgh;
+    uint32x4_t w[4];
+    uint32x4_t msg, prev;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+    }
+
+    // four rounds per step, w[i & 3] then becomes the schedule for step i + 4
+    for (i = 0; i < 16; i++) {
+        msg = vaddq_u32(w[i & 3], vld1q_u32(&sg_sha256_k[4 * i]));
+        prev = abcd;
+        abcd = vsha256hq_u32(prev, efgh, msg);
+        efgh = vsha256h2q_u32(efgh, prev, msg);
+        if (i < 12) {
+            w[i & 3] = vsha256su1q_u32(vsha256su0q_u32(w[i & 3], w[(i + 1) & 3]), w[(i + 2) & 3], w[(i + 3) & 3]);
+        }
+    }
+
+    vst1q_u32(&state[0], vaddq_u32(abcd, abcd_orig));
+    vst1q_u32(&state[4], vaddq_u32(efgh, efgh_orig));
+}
+#endif
+
+int mbedtls_internal_sha256_process(mbedtls_sha256_context *ctx, const unsigned char data[64])
+{
+#if defined(SHA256_ACCEL_X86) || defined(SHA256_ACCEL_A64)
+    if (SHA256_IMPL_UNKNOWN == sg_sha256_impl) {
+        sg_sha256_impl = __sha256_cpu_supported() ? SHA256_IMPL_CPU : SHA256_IMPL_C;
+    }
+    if (SHA256_IMPL_CPU == sg_sha256_impl) {
+        __sha256_block_cpu(ctx->MBEDTLS_PRIVATE(state), data);
+        return 0;
+    }
+#endif
+
+    __sha256_block_c(ctx->MBEDTLS_PRIVATE(state), data);
+
+    return 0;
+}
+
+#if defined(SHA256_ACCEL_A64)
+#pragma GCC pop_options
+#endif
+
+#endif /* MBEDTLS_SHA256_C && MBEDTLS_SHA256_PROCESS_ALT */
@@ -0,0 +1,211 @@
+/**
+ * @file test_crypto_accel.cpp
+ * @brief unit test and benchmark of the host AES/GHASH/SHA-256 acceleration
+ */
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "mbedtls/aes.h"
+#include "mbedtls/gcm.h"
+#include "mbedtls/sha256.h"
+#include "aes_accel.h"
+
+namespace {
+
+double mb_per_s(size_t bytes, std::chrono::steady_clock::duration cost)
+{
+    double sec = std::chrono::duration<double>(cost).count();
+    return sec > 0 ? bytes / sec / 1e6 : 0;
+}
+
+std::vector<unsigned char> unhex(const char *hex)
+{
+    std::vector<unsigned char> out;
+    for (; hex[0] && hex[1]; hex += 2) {
+        out.push_back((unsigned char)strtoul(std::string(hex, 2).c_str(), NULL, 16));
+    }
+    return out;
+}
+
+} // namespace
+
+TEST(CryptoAccel, Sha256KnownAnswers)
+{
+    struct {
+        std::string msg;
+        const char *digest;
+    } vectors[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+    unsigned char digest[32];
+
+    for (auto &v : vectors) {
+        ASSERT_EQ(0, mbedtls_sha256((const unsigned char *)v.msg.data(), v.msg.size(), digest, 0));
+        EXPECT_EQ(unhex(v.digest), std::vector<unsigned char>(digest, digest + 32)) << v.msg.size();
+    }
+
+    // same digest when the input arrives in odd pieces
+    std::string msg(1000, 'x');
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    for (size_t off = 0, step = 1; off < msg.size(); off += step, step = step * 3 % 97 + 1) {
+        mbedtls_sha256_update(&ctx, (const unsigned char *)msg.data() + off, std::min(step, msg.size() - off));
+    }
+    unsigned char pieces[32];
+    mbedtls_sha256_finish(&ctx, pieces);
+    mbedtls_sha256_free(&ctx);
+    mbedtls_sha256((const unsigned char *)msg.data(), msg.size(), digest, 0);
+    EXPECT_EQ(0, memcmp(pieces, digest, 32));
+}
+
+#if defined(MBEDTLS_AES_ACCEL_C)
+
+TEST(CryptoAccel, AesMatchesMbedtls)
+{
+    if (!aes_accel_supported()) {
+        GTEST_SKIP() << "CPU has no AES-NI/PCLMULQDQ";
+    }
+
+    std::mt19937 rng(1);
+    unsigned char key[32], iv[12], add[80], in[600], o1[600], o2[600], t1[16], t2[16];
+
+    for (int it = 0; it < 3000; it++) {
+        unsigned int keybits = 128 + 64 * (it % 3);
+        for (auto &b : key) {
+            b = rng();
+        }
+        for (auto &b : iv) {
+            b = rng();
+        }
+        size_t len = rng() % sizeof(in), add_len = rng() % sizeof(add), tag_len = 4 + rng() % 13;
+        for (size_t i = 0; i < len; i++) {
+            in[i] = rng();
+        }
+        for (size_t i = 0; i < add_len; i++) {
+            add[i] = rng();
+        }
+
+        mbedtls_gcm_context gcm;
+        aes_accel_gcm_context accel;
+        mbedtls_gcm_init(&gcm);
+        aes_accel_gcm_init(&accel);
+        ASSERT_EQ(0, mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, keybits));
+        ASSERT_EQ(0, aes_accel_gcm_setkey(&accel, key, keybits));
+
+        // GCM, the accelerated side in place
+        ASSERT_EQ(0, mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, len, iv, 12, add, add_len, in, o1, tag_len,
+                                               t1));
+        memcpy(o2, in, len);
+        ASSERT_EQ(0, aes_accel_gcm_crypt_and_tag(&accel, MBEDTLS_GCM_ENCRYPT, len, iv, 12, add, add_len, o2, o2,
+                                                 tag_len, t2));
+        ASSERT_EQ(0, memcmp(o1, o2, len)) << "gcm len " << len << " keybits " << keybits;
+        ASSERT_EQ(0, memcmp(t1, t2, tag_len));
+        ASSERT_EQ(0, aes_accel_gcm_auth_decrypt(&accel, len, iv, 12, add, add_len, t1, tag_len, o1, o2));
+        ASSERT_EQ(0, memcmp(o2, in, len));
+        t1[0] ^= 1;
+        ASSERT_EQ(MBEDTLS_ERR_GCM_AUTH_FAILED,
+                  aes_accel_gcm_auth_decrypt(&accel, len, iv, 12, add, add_len, t1, tag_len, o1, o2));
+
+        // CBC and ECB on the round keys mbedtls expanded
+        size_t blocks = len / 16 * 16;
+        unsigned char iv1[16] = {0}, iv2[16] = {0};
+        memcpy(iv1, iv, sizeof(iv));
+        memcpy(iv2, iv, sizeof(iv));
+        mbedtls_aes_context enc, dec;
+        mbedtls_aes_init(&enc);
+        mbedtls_aes_init(&dec);
+        mbedtls_aes_setkey_enc(&enc, key, keybits);
+        mbedtls_aes_setkey_dec(&dec, key, keybits);
+
+        mbedtls_aes_crypt_cbc(&enc, MBEDTLS_AES_ENCRYPT, blocks, iv1, in, o1);
+        aes_accel_crypt_cbc(&enc, MBEDTLS_AES_ENCRYPT, blocks, iv2, in, o2);
+        ASSERT_EQ(0, memcmp(o1, o2, blocks));
+        ASSERT_EQ(0, memcmp(iv1, iv2, 16));
+        memcpy(iv2, iv, sizeof(iv));
+        memset(iv2 + sizeof(iv), 0, 16 - sizeof(iv));
+        aes_accel_crypt_cbc(&dec, MBEDTLS_AES_DECRYPT, blocks, iv2, o2, o2);
+        ASSERT_EQ(0, memcmp(o2, in, blocks));
+
+        for (size_t i = 0; i < blocks; i += 16) {
+            mbedtls_aes_crypt_ecb(&enc, MBEDTLS_AES_ENCRYPT, in + i, o1 + i);
+        }
+        aes_accel_crypt_ecb(&enc, MBEDTLS_AES_ENCRYPT, blocks, in, o2);
+        ASSERT_EQ(0, memcmp(o1, o2, blocks));
+        aes_accel_crypt_ecb(&dec, MBEDTLS_AES_DECRYPT, blocks, o2, o2);
+        ASSERT_EQ(0, memcmp(o2, in, blocks));
+
+        mbedtls_gcm_free(&gcm);
+        aes_accel_gcm_free(&accel);
+        mbedtls_aes_free(&enc);
+        mbedtls_aes_free(&dec);
+    }
+}
+
+TEST(CryptoAccel, BenchThroughput)
+{
+    if (!aes_accel_supported()) {
+        GTEST_SKIP() << "CPU has no AES-NI/PCLMULQDQ";
+    }
+
+    const int loops = 500;
+    static unsigned char buf[16384], out[16384];
+    unsigned char key[32] = {1}, iv[16] = {2}, tag[16];
+
+    memset(buf, 0x5a, sizeof(buf));
+
+    mbedtls_aes_context aes;
+    mbedtls_aes_init(&aes);
+    mbedtls_aes_setkey_enc(&aes, key, 128);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++) {
+        mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, sizeof(buf), iv, buf, out);
+    }
+    double cbc_base = mb_per_s(loops * sizeof(buf), std::chrono::steady_clock::now() - start);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++) {
+        aes_accel_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, sizeof(buf), iv, buf, out);
+    }
+    double cbc_accel = mb_per_s(loops * sizeof(buf), std::chrono::steady_clock::now() - start);
+    mbedtls_aes_free(&aes);
+
+    mbedtls_gcm_context gcm;
+    aes_accel_gcm_context accel;
+    mbedtls_gcm_init(&gcm);
+    aes_accel_gcm_init(&accel);
+    mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, 256);
+    aes_accel_gcm_setkey(&accel, key, 256);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++) {
+        mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, sizeof(buf), iv, 12, NULL, 0, buf, out, 16, tag);
+    }
+    double gcm_base = mb_per_s(loops * sizeof(buf), std::chrono::steady_clock::now() - start);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++) {
+        aes_accel_gcm_crypt_and_tag(&accel, MBEDTLS_GCM_ENCRYPT, sizeof(buf), iv, 12, NULL, 0, buf, out, 16, tag);
+    }
+    double gcm_accel = mb_per_s(loops * sizeof(buf), std::chrono::steady_clock::now() - start);
+    mbedtls_gcm_free(&gcm);
+    aes_accel_gcm_free(&accel);
+
+    unsigned char digest[32];
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++) {
+        mbedtls_sha256(buf, sizeof(buf), digest, 0);
+    }
+    double sha = mb_per_s(loops * sizeof(buf), std::chrono::steady_clock::now() - start);
+
+    printf("AES-128-CBC enc  mbedtls %6.0f MB/s  accel %6.0f MB/s\n", cbc_base, cbc_accel);
+    printf("AES-256-GCM enc  mbedtls %6.0f MB/s  accel %6.0f MB/s\n", gcm_base, gcm_accel);
+    printf("SHA-256          %6.0f MB/s\n", sha);
+    EXPECT_GT(gcm_accel, gcm_base);
+}
+
+#endif /* MBEDTLS_AES_ACCEL_C */
@@ -0,0 +1,211 @@
+/**
+ * @file test_gcm_key.cpp
+ * @brief known answers and benchmark of the keyed AES-GCM wrapper against the one-shot one
+ */
+#include <chrono>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "gtest/gtest.h"
+
+#include "cipher_wrapper.h"
+
+namespace {
+
+std::vector<unsigned char> unhex(const char *hex)
+{
+    std::vector<unsigned char> out;
+    for (; hex[0] && hex[1]; hex += 2) {
+        out.push_back((unsigned char)strtoul(std::string(hex, 2).c_str(), NULL, 16));
+    }
+    return out;
+}
+
+// cycles on x86, nanoseconds elsewhere
+const char *TICK_UNIT =
+#if defined(__x86_64__) || defined(__i386__)
+    "cycles";
+#else
+    "ns";
+#endif
+
+uint64_t ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+template <typename F> double ticks_per_call(F fn, int calls)
+{
+    double best = 0;
+
+    for (int round = 0; round < 3; round++) {
+        uint64_t start = ticks();
+        for (int i = 0; i < calls; i++) {
+            fn();
+        }
+        double cost = (double)(ticks() - start) / calls;
+        if (0 == round || cost < best) {
+            best = cost;
+        }
+    }
+    return best;
+}
+
+// GCM spec (McGrew/Viega) test cases 3 and 4
+const char *GCM_KEY = "feffe9928665731c6d6a8f9467308308";
+const char *GCM_IV = "cafebabefacedbaddecaf888";
+const char *GCM_PT = "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+                     "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255";
+const char *GCM_CT = "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+                     "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985";
+const char *GCM_TAG3 = "4d5c2af327cd64a62cf35abd2ba6fab4";
+const char *GCM_AAD4 = "feedfacedeadbeeffeedfacedeadbeefabaddad2";
+const char *GCM_TAG4 = "5bc94fbc3221a5db94fae95ae7121a47";
+
+cipher_params_t gcm_params(std::vector<unsigned char> &key, std::vector<unsigned char> &iv,
+                           std::vector<unsigned char> &ad, unsigned char *data, size_t data_len)
+{
+    cipher_params_t params = {};
+
+    params.key = key.data();
+    params.key_len = key.size();
+    params.nonce = iv.data();
+    params.nonce_len = iv.size();
+    params.ad = ad.empty() ? NULL : ad.data();
+    params.ad_len = ad.size();
+    params.data = data;
+    params.data_len = data_len;
+    params.cipher_type = MBEDTLS_CIPHER_AES_128_GCM;
+    return params;
+}
+
+} // namespace
+
+TEST(GcmKey, KnownAnswers)
+{
+    std::vector<unsigned char> key = unhex(GCM_KEY), iv = unhex(GCM_IV), pt = unhex(GCM_PT), ct = unhex(GCM_CT);
+    std::vector<unsigned char> no_ad, ad4 = unhex(GCM_AAD4);
+    std::vector<unsigned char> out(pt.size());
+    unsigned char tag[16];
+    size_t olen = 0;
+    cipher_gcm_key_t gcm_key;
+
+    mbedtls_gcm_key_init_wrapper(&gcm_key);
+    ASSERT_EQ(OPRT_OK, mbedtls_gcm_key_setup_wrapper(&gcm_key, key.data(), key.size()));
+
+    // test case 3, no additional data
+    cipher_params_t params = gcm_params(key, iv, no_ad, pt.data(), pt.size());
+    ASSERT_EQ(OPRT_OK, mbedtls_gcm_key_encrypt_wrapper(&gcm_key, &params, out.data(), &olen, tag, sizeof(tag)));
+    EXPECT_EQ(pt.size(), olen);
+    EXPECT_EQ(ct, out);
+    EXPECT_EQ(unhex(GCM_TAG3), std::vector<unsigned char>(tag, tag + 16));
+
+    // test case 4, 60 bytes with additional data
+    params = gcm_params(key, iv, ad4, pt.data(), 60);
+    ASSERT_EQ(OPRT_OK, mbedtls_gcm_key_encrypt_wrapper(&gcm_key, &params, out.data(), &olen, tag, sizeof(tag)));
+    EXPECT_EQ(60u, olen);
+    EXPECT_EQ(0, memcmp(ct.data(), out.data(), 60));
+    EXPECT_EQ(unhex(GCM_TAG4), std::vector<unsigned char>(tag, tag + 16));
+
+    params = gcm_params(key, iv, ad4, ct.data(), 60);
+    ASSERT_EQ(OPRT_OK, mbedtls_gcm_key_decrypt_wrapper(&gcm_key, &params, out.data(), &olen, tag, sizeof(tag)));
+    EXPECT_EQ(0, memcmp(pt.data(), out.data(), 60));
+
+    // a flipped tag bit or a changed AAD byte fails to decrypt
+    tag[0] ^= 0x01;
+    EXPECT_NE(OPRT_OK, mbedtls_gcm_key_decrypt_wrapper(&gcm_key, &params, out.data(), &olen, tag, sizeof(tag)));
+    tag[0] ^= 0x01;
+    ad4[0] ^= 0x80;
+    params = gcm_params(key, iv, ad4, ct.data(), 60);
+    EXPECT_NE(OPRT_OK, mbedtls_gcm_key_decrypt_wrapper(&gcm_key, &params, out.data(), &olen, tag, sizeof(tag)));
+
+    // in place, output the same buffer as input
+    std::vector<unsigned char> buf = pt;
+    params = gcm_params(key, iv, no_ad, buf.data(), buf.size());
+    ASSERT_EQ(OPRT_OK, mbedtls_gcm_key_encrypt_wrapper(&gcm_key, &params, buf.data(), &olen, tag, sizeof(tag)));
+    EXPECT_EQ(ct, buf);
+
+    mbedtls_gcm_key_free_wrapper(&gcm_key);
+}
+
+TEST(GcmKey, KeyedMatchesOneShot)
+{
+    std::vector<unsigned char> key = unhex(GCM_KEY), iv = unhex(GCM_IV), ad = unhex(GCM_AAD4);
+    std::vector<unsigned char> other_key(16, 0x42);
+    cipher_gcm_key_t gcm_key;
+
+    mbedtls_gcm_key_init_wrapper(&gcm_key);
+
+    for (int pass = 0; pass < 2; pass++) {
+        // the second pass switches key on the same handle
+        std::vector<unsigned char> &k = pass ? other_key : key;
+        ASSERT_EQ(OPRT_OK, mbedtls_gcm_key_setup_wrapper(&gcm_key, k.data(), k.size()));
+
+        for (size_t len = 1; len <= 1500; len = len * 3 + 1) {
+            std::vector<unsigned char> pt(len), keyed(len), one_shot(len), back(len);
+            unsigned char keyed_tag[16], one_shot_tag[16];
+            size_t olen = 0;
+
+            for (size_t i = 0; i < len; i++) {
+                pt[i] = (unsigned char)(i * 13 + pass);
+            }
+            iv[11] = (unsigned char)len;
+
+            cipher_params_t params = gcm_params(k, iv, ad, pt.data(), len);
+            ASSERT_EQ(OPRT_OK, mbedtls_gcm_key_encrypt_wrapper(&gcm_key, &params, keyed.data(), &olen, keyed_tag, 16));
+            ASSERT_EQ(OPRT_OK, mbedtls_cipher_auth_encrypt_wrapper(&params, one_shot.data(), &olen, one_shot_tag, 16));
+            ASSERT_EQ(len, olen);
+            ASSERT_EQ(one_shot, keyed) << len;
+            ASSERT_EQ(0, memcmp(keyed_tag, one_shot_tag, 16)) << len;
+
+            // each decrypts what the other encrypted
+            params = gcm_params(k, iv, ad, one_shot.data(), len);
+            ASSERT_EQ(OPRT_OK, mbedtls_gcm_key_decrypt_wrapper(&gcm_key, &params, back.data(), &olen, one_shot_tag, 16));
+            ASSERT_EQ(pt, back) << len;
+            params = gcm_params(k, iv, ad, keyed.data(), len);
+            ASSERT_EQ(OPRT_OK, mbedtls_cipher_auth_decrypt_wrapper(&params, back.data(), &olen, keyed_tag, 16));
+            ASSERT_EQ(pt, back) << len;
+        }
+    }
+
+    mbedtls_gcm_key_free_wrapper(&gcm_key);
+}
+
+TEST(GcmKey, BenchmarkKeyedVsOneShot)
+{
+    const size_t sizes[] = {16, 64, 256, 1024, 4096};
+    std::vector<unsigned char> key = unhex(GCM_KEY), iv = unhex(GCM_IV), ad(13, 0x17);
+    std::vector<unsigned char> data(4096, 0x5a), out(4096);
+    unsigned char tag[16];
+    size_t olen = 0;
+    cipher_gcm_key_t gcm_key;
+
+    mbedtls_gcm_key_init_wrapper(&gcm_key);
+    ASSERT_EQ(OPRT_OK, mbedtls_gcm_key_setup_wrapper(&gcm_key, key.data(), key.size()));
+
+    for (size_t size : sizes) {
+        int calls = (int)(200000 / size) + 100;
+        cipher_params_t params = gcm_params(key, iv, ad, data.data(), size);
+
+        double keyed = ticks_per_call(
+            [&]() { mbedtls_gcm_key_encrypt_wrapper(&gcm_key, &params, out.data(), &olen, tag, sizeof(tag)); }, calls);
+        double one_shot = ticks_per_call(
+            [&]() { mbedtls_cipher_auth_encrypt_wrapper(&params, out.data(), &olen, tag, sizeof(tag)); }, calls);
+        printf("[   INFO   ] aes-128-gcm  %5zu bytes: keyed %8.1f %s/call %6.2f %s/byte, one-shot %8.1f %s/call %6.2f "
+               "%s/byte, overhead %8.1f %s/call\n",
+               size, keyed, TICK_UNIT, keyed / size, TICK_UNIT, one_shot, TICK_UNIT, one_shot / size, TICK_UNIT,
+               one_shot - keyed, TICK_UNIT);
+        EXPECT_LT(keyed, one_shot * 1.2) << size;
+    }
+
+    mbedtls_gcm_key_free_wrapper(&gcm_key);
+}
@@ -53,6 +53,15 @@ typedef struct {
     uint16_t len; // property length
 } kv_db_t;
 
+/**
+ * @brief storage format of tal_kv_serialize_set_fmt, tal_kv_serialize_get
+ * detects the format by itself
+ *
+ */
+typedef uint8_t kv_fmt_t;
+#define KV_FMT_JSON 0 // json text, raw data base64 encoded
+#define KV_FMT_TLV  1 // binary, key + type + varint or length-prefixed value
+
 #define TAL_LV_KEY_LEN 16
 
 typedef struct {
@@ -102,6 +111,22 @@ int tal_kv_set(const char *key, const uint8_t *value, size_t length);
  */
 int tal_kv_get(const char *key, uint8_t **value, size_t *length);
 
+/**
+ * @brief Retrieves the value of a key into a caller-supplied buffer.
+ *
+ * No memory is allocated for the value, so there is nothing to free. The value
+ * is NUL-terminated when buf has a spare byte. A buffer of at least the value
+ * length rounded up to the next 16 bytes lets the value be decrypted in place.
+ *
+ * @param key The key to retrieve the value for.
+ * @param buf The buffer to receive the value.
+ * @param len The size of buf in bytes.
+ * @param out_len Receives the length of the value, also when buf is too small.
+ * @return 0 if the value was successfully retrieved, OPRT_BUFFER_NOT_ENOUGH if
+ * buf is too small, or another negative error code if an error occurred.
+ */
+int tal_kv_get_into(const char *key, uint8_t *buf, size_t len, size_t *out_len);
+
 /**
  * @brief Frees the memory allocated for a value in the TAL Key-Value store.
  *
@@ -125,6 +150,27 @@ int tal_kv_free(uint8_t *value);
  */
 int tal_kv_del(const char *key);
 
+/**
+ * @brief Writes pending key-value records to flash.
+ *
+ * With ENABLE_KV_LOG_ENGINE, writes are committed in batches after
+ * KV_LOG_COMMIT_MS. Call this before reboot or power down so the latest
+ * writes are not lost.
+ *
+ * @return 0 on success, or a negative error code if an error occurred.
+ */
+int tal_kv_flush(void);
+
+/**
+ * @brief Writes pending records to flash and unmounts the key-value store.
+ *
+ * tal_kv_init mounts the store again and rebuilds its index from flash, the
+ * same as at boot.
+ *
+ * @return 0 on success, or a negative error code if an error occurred.
+ */
+int tal_kv_deinit(void);
+
 /**
  * @brief Serializes and sets the value of a key in the key-value database.
  *
@@ -138,6 +184,21 @@ int tal_kv_del(const char *key);
  */
 int tal_kv_serialize_set(const char *key, kv_db_t *db, size_t dbcnt);
 
+/**
+ * @brief Serializes and sets the value of a key in the given format.
+ *
+ * Same as tal_kv_serialize_set, which uses KV_FMT_TLV when
+ * ENABLE_KV_SERIALIZE_TLV is set and KV_FMT_JSON otherwise. Records of both
+ * formats are read back by tal_kv_serialize_get.
+ *
+ * @param key The key to set in the database.
+ * @param db A pointer to the key-value database.
+ * @param dbcnt The size of the key-value database.
+ * @param fmt KV_FMT_JSON or KV_FMT_TLV.
+ * @return Returns 0 on success, or a negative error code on failure.
+ */
+int tal_kv_serialize_set_fmt(const char *key, kv_db_t *db, size_t dbcnt, kv_fmt_t fmt);
+
 /**
  * @brief Serializes a key-value pair retrieval operation.
  *
@@ -0,0 +1,277 @@
+/**
+ * @file kv_cache.c
+ * @brief Size-bounded LRU cache of decrypted tal_kv values.
+ *
+ * Values read by tal_kv_get/tal_kv_get_into are kept in RAM, most recently
+ * used first, until KV_CACHE_SIZE bytes are used. tal_kv_set writes the new
+ * value through to the cache and tal_kv_del drops it, so the cache never
+ * returns a value the store no longer has. Sets and deletes hold one write
+ * lock across the flash write and the cache update, so concurrent writers of
+ * a key leave the cache with the value that reached flash last.
+ *
+ * A read that misses takes a generation number before going to flash and
+ * only fills the cache if no set/del happened meanwhile, so a slow reader
+ * can not put back a value that was just overwritten.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include "tal_kv.h"
+#include "tal_api.h"
+#include "tuya_list.h"
+#include "mix_method.h"
+
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+
+/***********************************************************
+*************************micro define***********************
+***********************************************************/
+#ifndef KV_CACHE_SIZE
+#define KV_CACHE_SIZE 2048
+#endif
+
+// larger values would evict most of the cache for one key
+#define KV_CACHE_VALUE_MAX (KV_CACHE_SIZE / 4)
+
+typedef struct {
+    LIST_HEAD node;
+    uint32_t hash;
+    uint32_t len; // value length
+    char *key;    // points into data, behind the value
+    uint8_t data[0];
+} KV_CACHE_NODE_T;
+
+#define KV_CACHE_NODE_SIZE(key_len, len) (sizeof(KV_CACHE_NODE_T) + (len) + 1 + (key_len) + 1)
+
+typedef struct {
+    MUTEX_HANDLE mutex;
+    LIST_HEAD lru; // most recently used first
+    uint32_t used;
+    uint32_t gen;
+
+    uint32_t hit_cnt;
+    uint32_t miss_cnt;
+} KV_CACHE_T;
+
+/***********************************************************
+*************************variable define********************
+***********************************************************/
+static KV_CACHE_T sg_kv_cache;
+
+/***********************************************************
+*************************function define********************
+***********************************************************/
+static KV_CACHE_NODE_T *__kv_cache_find(const char *key, uint32_t hash)
+{
+    P_LIST_HEAD pos = NULL;
+    KV_CACHE_NODE_T *node = NULL;
+
+    tuya_list_for_each(pos, &sg_kv_cache.lru)
+    {
+        node = tuya_list_entry(pos, KV_CACHE_NODE_T, node);
+        if (node->hash == hash && 0 == strcmp(node->key, key)) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+static void __kv_cache_remove(KV_CACHE_NODE_T *node)
+{
+    tuya_list_del(&node->node);
+    sg_kv_cache.used -= KV_CACHE_NODE_SIZE(strlen(node->key), node->len);
+    tal_free(node);
+}
+
+static void __kv_cache_insert(const char *key, uint32_t hash, const uint8_t *value, size_t len)
+{
+    size_t key_len = strlen(key);
+    uint32_t size = KV_CACHE_NODE_SIZE(key_len, len);
+
+    while (sg_kv_cache.used + size > KV_CACHE_SIZE && !tuya_list_empty(&sg_kv_cache.lru)) {
+        __kv_cache_remove(tuya_list_entry(sg_kv_cache.lru.prev, KV_CACHE_NODE_T, node));
+    }
+
+    KV_CACHE_NODE_T *node = (KV_CACHE_NODE_T *)tal_malloc(size);
+    if (NULL == node) {
+        return;
+    }
+    node->hash = hash;
+    node->len = len;
+    memcpy(node->data, value, len);
+    node->data[len] = '\0';
+    node->key = (char *)node->data + len + 1;
+    memcpy(node->key, key, key_len + 1);
+    tuya_list_add(&node->node, &sg_kv_cache.lru);
+    sg_kv_cache.used += size;
+}
+
+/**
+ * @brief init the cache
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int kv_cache_init(void)
+{
+    if (sg_kv_cache.mutex) {
+        return OPRT_OK;
+    }
+
+    INIT_LIST_HEAD(&sg_kv_cache.lru);
+
+    return tal_mutex_create_init(&sg_kv_cache.mutex);
+}
+
+/**
+ * @brief copy a cached value into buf
+ *
+ * @param[out] gen generation to pass to kv_cache_fill on a miss
+ *
+ * @return OPRT_OK on hit, OPRT_NOT_FOUND on miss, OPRT_BUFFER_NOT_ENOUGH if
+ * buf is too small (out_len is set)
+ */
+int kv_cache_get(const char *key, uint8_t *buf, size_t len, size_t *out_len, uint32_t *gen)
+{
+    OPERATE_RET rt = OPRT_OK;
+
+    if (NULL == sg_kv_cache.mutex) {
+        return OPRT_NOT_FOUND;
+    }
+
+    tal_mutex_lock(sg_kv_cache.mutex);
+    *gen = sg_kv_cache.gen;
+    KV_CACHE_NODE_T *node = __kv_cache_find(key, tuya_fnv1a32(key, strlen(key)));
+    if (NULL == node) {
+        sg_kv_cache.miss_cnt++;
+        tal_mutex_unlock(sg_kv_cache.mutex);
+        return OPRT_NOT_FOUND;
+    }
+
+    sg_kv_cache.hit_cnt++;
+    tuya_list_del(&node->node);
+    tuya_list_add(&node->node, &sg_kv_cache.lru);
+    *out_len = node->len;
+    if (node->len > len) {
+        rt = OPRT_BUFFER_NOT_ENOUGH;
+    } else {
+        memcpy(buf, node->data, node->len);
+        if (node->len < len) {
+            buf[node->len] = '\0';
+        }
+    }
+    tal_mutex_unlock(sg_kv_cache.mutex);
+
+    return rt;
+}
+
+/**
+ * @brief get a copy of a cached value, free it with tal_free
+ *
+ * @return OPRT_OK on hit, OPRT_NOT_FOUND on miss, others on error
+ */
+int kv_cache_dup(const char *key, uint8_t **value, size_t *length, uint32_t *gen)
+{
+    OPERATE_RET rt = OPRT_OK;
+
+    if (NULL == sg_kv_cache.mutex) {
+        return OPRT_NOT_FOUND;
+    }
+
+    tal_mutex_lock(sg_kv_cache.mutex);
+    *gen = sg_kv_cache.gen;
+    KV_CACHE_NODE_T *node = __kv_cache_find(key, tuya_fnv1a32(key, strlen(key)));
+    if (NULL == node) {
+        sg_kv_cache.miss_cnt++;
+        tal_mutex_unlock(sg_kv_cache.mutex);
+        return OPRT_NOT_FOUND;
+    }
+
+    sg_kv_cache.hit_cnt++;
+    tuya_list_del(&node->node);
+    tuya_list_add(&node->node, &sg_kv_cache.lru);
+    *value = tal_malloc(node->len + 1);
+    if (NULL == *value) {
+        rt = OPRT_MALLOC_FAILED;
+    } else {
+        memcpy(*value, node->data, node->len + 1);
+        *length = node->len;
+    }
+    tal_mutex_unlock(sg_kv_cache.mutex);
+
+    return rt;
+}
+
+/**
+ * @brief add a value read from flash, unless the key changed since gen
+ */
+void kv_cache_fill(const char *key, const uint8_t *value, size_t length, uint32_t gen)
+{
+    if (NULL == sg_kv_cache.mutex || length > KV_CACHE_VALUE_MAX) {
+        return;
+    }
+
+    tal_mutex_lock(sg_kv_cache.mutex);
+    uint32_t hash = tuya_fnv1a32(key, strlen(key));
+    if (gen == sg_kv_cache.gen && NULL == __kv_cache_find(key, hash)) {
+        __kv_cache_insert(key, hash, value, length);
+    }
+    tal_mutex_unlock(sg_kv_cache.mutex);
+}
+
+/**
+ * @brief write a new value through to the cache, or drop the key if value is NULL
+ */
+void kv_cache_put(const char *key, const uint8_t *value, size_t length)
+{
+    if (NULL == sg_kv_cache.mutex) {
+        return;
+    }
+
+    tal_mutex_lock(sg_kv_cache.mutex);
+    sg_kv_cache.gen++;
+    uint32_t hash = tuya_fnv1a32(key, strlen(key));
+    KV_CACHE_NODE_T *node = __kv_cache_find(key, hash);
+    if (node) {
+        __kv_cache_remove(node);
+    }
+    if (value && length <= KV_CACHE_VALUE_MAX) {
+        __kv_cache_insert(key, hash, value, length);
+    }
+    tal_mutex_unlock(sg_kv_cache.mutex);
+}
+
+/**
+ * @brief drop every cached value, e.g. when the store is unmounted
+ */
+void kv_cache_clear(void)
+{
+    if (NULL == sg_kv_cache.mutex) {
+        return;
+    }
+
+    tal_mutex_lock(sg_kv_cache.mutex);
+    sg_kv_cache.gen++;
+    while (!tuya_list_empty(&sg_kv_cache.lru)) {
+        __kv_cache_remove(tuya_list_entry(sg_kv_cache.lru.next, KV_CACHE_NODE_T, node));
+    }
+    tal_mutex_unlock(sg_kv_cache.mutex);
+}
+
+/**
+ * @brief print cache usage and hit rate
+ */
+void kv_cache_dump(void)
+{
+    if (NULL == sg_kv_cache.mutex) {
+        return;
+    }
+
+    tal_mutex_lock(sg_kv_cache.mutex);
+    PR_DEBUG("kv cache used %d/%d, hit %d, miss %d", sg_kv_cache.used, KV_CACHE_SIZE, sg_kv_cache.hit_cnt,
+             sg_kv_cache.miss_cnt);
+    tal_mutex_unlock(sg_kv_cache.mutex);
+}
+
+#endif
@@ -0,0 +1,909 @@
+/**
+ * @file kv_log.c
+ * @brief Log-structured key-value engine for tal_kv.
+ *
+ * All keys live in one append-only log file on littlefs instead of one file
+ * per key. Each record is a small head, the key and the AES-128-CBC encrypted
+ * value. An in-RAM hash index maps every live key to the offset of its latest
+ * record, so a read is a single seek and read.
+ *
+ * Writes are appended to a RAM batch and committed with one write and one
+ * sync after KV_LOG_COMMIT_MS, or right away when the batch is full or when
+ * KV_LOG_COMMIT_MS is 0. When most of the log is overwritten or deleted
+ * records, the live records are copied to a new log that atomically replaces
+ * the old one (compaction). Commits and compaction run as delayed work on the
+ * system workqueue, not in the caller of tal_kv_set and not on the shared
+ * software timer thread.
+ *
+ * At init the log is scanned to rebuild the index. A record with a bad CRC
+ * (e.g. torn by power loss) ends the scan and the log is truncated there.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include "tal_kv.h"
+#include "lfs_config.h"
+#include "tal_api.h"
+#include "tal_security.h"
+#include "tal_workq_service.h"
+#include "mix_method.h"
+
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+
+/***********************************************************
+*************************micro define***********************
+***********************************************************/
+#ifndef KV_LOG_COMMIT_MS
+#define KV_LOG_COMMIT_MS 100
+#endif
+
+#ifndef KV_LOG_BATCH_SIZE
+#define KV_LOG_BATCH_SIZE 1024
+#endif
+
+#ifndef KV_LOG_COMPACT_SIZE
+#define KV_LOG_COMPACT_SIZE (32 * 1024)
+#endif
+
+#ifndef KV_LOG_HASH_BUCKET
+#define KV_LOG_HASH_BUCKET 32
+#endif
+
+#define KV_LOG_FILE     "kv.log"
+#define KV_LOG_TMP_FILE "kv.log.tmp"
+
+#define KV_LOG_MAGIC 0x4B56 // "KV"
+#define KV_LOG_PUT   1
+#define KV_LOG_DEL   2
+
+// delay of a compaction that is not triggered by a pending commit
+#define KV_LOG_COMPACT_DELAY_MS 1000
+
+#define KV_LOG_COPY_CHUNK 128
+
+typedef struct {
+    uint16_t magic;
+    uint8_t type;
+    uint8_t key_len;  // without '\0'
+    uint32_t val_len; // length of the encrypted value
+    uint32_t crc;     // lfs_crc of the fields above (magic excluded), key and value
+} KV_LOG_REC_HEAD_T;
+
+#define KV_LOG_REC_LEN(key_len, val_len) (sizeof(KV_LOG_REC_HEAD_T) + (key_len) + (val_len))
+
+typedef struct kv_log_entry {
+    struct kv_log_entry *next;
+    uint32_t hash;
+    uint32_t offset;     // offset of the record head in the log
+    uint32_t val_len;    // length of the encrypted value
+    uint32_t new_offset; // offset in the log being written by compaction
+    uint8_t key_len;
+    char key[0];
+} KV_LOG_ENTRY_T;
+
+typedef struct {
+    lfs_t *lfs;
+    lfs_file_t file;
+    MUTEX_HANDLE mutex;
+
+    // keyed once at init, reused by every record
+    TKL_SYMMETRY_HANDLE enc_ctx;
+    TKL_SYMMETRY_HANDLE dec_ctx;
+    uint8_t iv[16];
+
+    KV_LOG_ENTRY_T *bucket[KV_LOG_HASH_BUCKET];
+    uint32_t key_cnt;
+
+    uint32_t log_size;  // bytes committed to the log file
+    uint32_t live_size; // bytes of records still referenced by the index
+
+    // records appended after log_size, not yet written
+    uint8_t batch[KV_LOG_BATCH_SIZE];
+    uint32_t batch_len;
+
+    DELAYED_WORK_HANDLE work;
+    BOOL_T work_pending;
+    // the log file could not be reopened after compaction, refuse all requests
+    BOOL_T broken;
+
+    uint32_t write_cnt;
+    uint32_t commit_cnt;
+    uint32_t compact_cnt;
+    uint32_t flash_bytes;
+} KV_LOG_T;
+
+/***********************************************************
+*************************variable define********************
+***********************************************************/
+static KV_LOG_T *sg_kv_log = NULL;
+
+/***********************************************************
+*************************function define********************
+***********************************************************/
+static KV_LOG_ENTRY_T **__kv_log_find(const char *key, uint8_t key_len, uint32_t hash)
+{
+    KV_LOG_ENTRY_T **pp = &sg_kv_log->bucket[hash % KV_LOG_HASH_BUCKET];
+
+    while (*pp) {
+        if ((*pp)->hash == hash && (*pp)->key_len == key_len && 0 == memcmp((*pp)->key, key, key_len)) {
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+
+    return pp;
+}
+
+static OPERATE_RET __kv_log_index_put(const char *key, uint8_t key_len, uint32_t offset, uint32_t val_len)
+{
+    uint32_t hash = tuya_fnv1a32(key, key_len);
+    KV_LOG_ENTRY_T **pp = __kv_log_find(key, key_len, hash);
+    KV_LOG_ENTRY_T *entry = *pp;
+
+    if (entry) {
+        sg_kv_log->live_size -= KV_LOG_REC_LEN(entry->key_len, entry->val_len);
+    } else {
+        entry = (KV_LOG_ENTRY_T *)tal_malloc(sizeof(KV_LOG_ENTRY_T) + key_len + 1);
+        TUYA_CHECK_NULL_RETURN(entry, OPRT_MALLOC_FAILED);
+        entry->next = NULL;
+        entry->hash = hash;
+        entry->key_len = key_len;
+        memcpy(entry->key, key, key_len);
+        entry->key[key_len] = '\0';
+        *pp = entry;
+        sg_kv_log->key_cnt++;
+    }
+    entry->offset = offset;
+    entry->val_len = val_len;
+    sg_kv_log->live_size += KV_LOG_REC_LEN(key_len, val_len);
+
+    return OPRT_OK;
+}
+
+static BOOL_T __kv_log_index_del(const char *key, uint8_t key_len)
+{
+    KV_LOG_ENTRY_T **pp = __kv_log_find(key, key_len, tuya_fnv1a32(key, key_len));
+    KV_LOG_ENTRY_T *entry = *pp;
+
+    if (NULL == entry) {
+        return FALSE;
+    }
+
+    *pp = entry->next;
+    sg_kv_log->live_size -= KV_LOG_REC_LEN(entry->key_len, entry->val_len);
+    sg_kv_log->key_cnt--;
+    tal_free(entry);
+
+    return TRUE;
+}
+
+static uint32_t __kv_log_rec_crc(KV_LOG_REC_HEAD_T *head, const char *key, const uint8_t *val)
+{
+    uint32_t crc = lfs_crc(0xffffffff, &head->type, sizeof(head->type) + sizeof(head->key_len) + sizeof(head->val_len));
+
+    crc = lfs_crc(crc, key, head->key_len);
+    if (val && head->val_len) {
+        crc = lfs_crc(crc, val, head->val_len);
+    }
+
+    return crc;
+}
+
+static int __kv_log_read_at(lfs_file_t *file, uint32_t offset, void *buf, uint32_t len)
+{
+    if (lfs_file_seek(sg_kv_log->lfs, file, offset, LFS_SEEK_SET) < 0) {
+        return OPRT_KVS_RD_FAIL;
+    }
+    if (lfs_file_read(sg_kv_log->lfs, file, buf, len) != (lfs_ssize_t)len) {
+        return OPRT_KVS_RD_FAIL;
+    }
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief write the batch to the log file with one write and one sync
+ */
+static OPERATE_RET __kv_log_commit(void)
+{
+    KV_LOG_T *kv_log = sg_kv_log;
+
+    if (0 == kv_log->batch_len) {
+        return OPRT_OK;
+    }
+
+    if (lfs_file_seek(kv_log->lfs, &kv_log->file, kv_log->log_size, LFS_SEEK_SET) < 0 ||
+        lfs_file_write(kv_log->lfs, &kv_log->file, kv_log->batch, kv_log->batch_len) != (lfs_ssize_t)kv_log->batch_len ||
+        LFS_ERR_OK != lfs_file_sync(kv_log->lfs, &kv_log->file)) {
+        // keep the batch, the index still points into it; retry on next commit
+        PR_ERR("kv log commit %d bytes failed", kv_log->batch_len);
+        lfs_file_truncate(kv_log->lfs, &kv_log->file, kv_log->log_size);
+        return OPRT_KVS_WR_FAIL;
+    }
+
+    kv_log->log_size += kv_log->batch_len;
+    kv_log->flash_bytes += kv_log->batch_len;
+    kv_log->batch_len = 0;
+    kv_log->commit_cnt++;
+
+    return OPRT_OK;
+}
+
+static BOOL_T __kv_log_need_compact(void)
+{
+    return (sg_kv_log->log_size >= KV_LOG_COMPACT_SIZE && sg_kv_log->live_size * 2 < sg_kv_log->log_size);
+}
+
+static OPERATE_RET __kv_log_copy(lfs_file_t *dst, uint32_t offset, uint32_t len)
+{
+    uint8_t chunk[KV_LOG_COPY_CHUNK];
+    uint32_t n = 0;
+
+    while (len) {
+        n = (len > sizeof(chunk)) ? sizeof(chunk) : len;
+        if (OPRT_OK != __kv_log_read_at(&sg_kv_log->file, offset, chunk, n)) {
+            return OPRT_KVS_RD_FAIL;
+        }
+        if (lfs_file_write(sg_kv_log->lfs, dst, chunk, n) != (lfs_ssize_t)n) {
+            return OPRT_KVS_WR_FAIL;
+        }
+        offset += n;
+        len -= n;
+    }
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief copy all live records to a new log and replace the old one with it
+ *
+ * The new log is written to KV_LOG_TMP_FILE and renamed over KV_LOG_FILE, so a
+ * power loss at any point leaves one complete log behind.
+ */
+static OPERATE_RET __kv_log_compact(void)
+{
+    KV_LOG_T *kv_log = sg_kv_log;
+    OPERATE_RET rt = OPRT_OK;
+    lfs_file_t tmp;
+    KV_LOG_ENTRY_T *entry = NULL;
+    uint32_t new_size = 0;
+    uint32_t i = 0;
+
+    TUYA_CALL_ERR_RETURN(__kv_log_commit());
+
+    if (LFS_ERR_OK != lfs_file_open(kv_log->lfs, &tmp, KV_LOG_TMP_FILE, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC)) {
+        return OPRT_KVS_WR_FAIL;
+    }
+
+    for (i = 0; i < KV_LOG_HASH_BUCKET && OPRT_OK == rt; i++) {
+        for (entry = kv_log->bucket[i]; entry && OPRT_OK == rt; entry = entry->next) {
+            uint32_t rec_len = KV_LOG_REC_LEN(entry->key_len, entry->val_len);
+            rt = __kv_log_copy(&tmp, entry->offset, rec_len);
+            entry->new_offset = new_size;
+            new_size += rec_len;
+        }
+    }
+    if (OPRT_OK == rt && LFS_ERR_OK != lfs_file_sync(kv_log->lfs, &tmp)) {
+        rt = OPRT_KVS_WR_FAIL;
+    }
+    lfs_file_close(kv_log->lfs, &tmp);
+    if (OPRT_OK != rt) {
+        PR_ERR("kv log compact failed %d", rt);
+        lfs_remove(kv_log->lfs, KV_LOG_TMP_FILE);
+        return rt;
+    }
+
+    lfs_file_close(kv_log->lfs, &kv_log->file);
+    rt = lfs_rename(kv_log->lfs, KV_LOG_TMP_FILE, KV_LOG_FILE);
+    if (LFS_ERR_OK != rt) {
+        // old log is still in place and the index still matches it
+        PR_ERR("kv log rename failed %d", rt);
+        lfs_remove(kv_log->lfs, KV_LOG_TMP_FILE);
+    } else {
+        for (i = 0; i < KV_LOG_HASH_BUCKET; i++) {
+            for (entry = kv_log->bucket[i]; entry; entry = entry->next) {
+                entry->offset = entry->new_offset;
+            }
+        }
+        PR_DEBUG("kv log compact %d -> %d", kv_log->log_size, new_size);
+        kv_log->log_size = new_size;
+        kv_log->live_size = new_size;
+        kv_log->flash_bytes += new_size;
+        kv_log->compact_cnt++;
+    }
+
+    if (LFS_ERR_OK != lfs_file_open(kv_log->lfs, &kv_log->file, KV_LOG_FILE, LFS_O_RDWR | LFS_O_CREAT)) {
+        // without the file the index can not be read nor appended to, the
+        // log on flash is complete and is loaded again at the next init
+        PR_ERR("kv log reopen failed, log closed");
+        kv_log->broken = TRUE;
+        return OPRT_KVS_RD_FAIL;
+    }
+
+    return (LFS_ERR_OK == rt) ? OPRT_OK : OPRT_KVS_WR_FAIL;
+}
+
+/**
+ * @brief commit the batch, then compact if most of the log is stale
+ */
+static OPERATE_RET __kv_log_commit_compact(void)
+{
+    OPERATE_RET rt = __kv_log_commit();
+
+    if (OPRT_OK == rt && __kv_log_need_compact()) {
+        __kv_log_compact();
+    }
+
+    return rt;
+}
+
+static void __kv_log_work_cb(void *data)
+{
+    MUTEX_HANDLE mutex = (MUTEX_HANDLE)data;
+
+    tal_mutex_lock(mutex);
+    // the log may have been closed while this work waited for the lock
+    if (sg_kv_log && !sg_kv_log->broken) {
+        sg_kv_log->work_pending = FALSE;
+        __kv_log_commit_compact();
+    }
+    tal_mutex_unlock(mutex);
+}
+
+/**
+ * @brief make sure the commit work is queued, commit right away if it can not be
+ */
+static OPERATE_RET __kv_log_kick(uint32_t delay_ms)
+{
+    KV_LOG_T *kv_log = sg_kv_log;
+
+    if (NULL == kv_log->work &&
+        OPRT_OK != tal_workq_init_delayed(WORKQ_SYSTEM, __kv_log_work_cb, kv_log->mutex, &kv_log->work)) {
+        kv_log->work = NULL;
+    }
+    if (NULL == kv_log->work) {
+        return __kv_log_commit_compact();
+    }
+    // restarting would push the deadline back, keep the earliest one
+    if (!kv_log->work_pending) {
+        if (OPRT_OK != tal_workq_start_delayed(kv_log->work, delay_ms, LOOP_ONCE)) {
+            return __kv_log_commit_compact();
+        }
+        kv_log->work_pending = TRUE;
+    }
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief append one record, committing the batch first if it has no room
+ *
+ * @param[in] val plain value, encrypted into the record; NULL for a delete
+ * @param[out] offset log offset of the record
+ * @param[out] enc_len length of the encrypted value
+ */
+static OPERATE_RET __kv_log_append(uint8_t type, const char *key, uint8_t key_len, const uint8_t *val,
+                                   uint32_t val_len, uint32_t *offset, uint32_t *enc_len)
+{
+    KV_LOG_T *kv_log = sg_kv_log;
+    OPERATE_RET rt = OPRT_OK;
+    KV_LOG_REC_HEAD_T head;
+    uint8_t *rec = NULL;
+    uint8_t iv[16];
+
+    head.magic = KV_LOG_MAGIC;
+    head.type = type;
+    head.key_len = key_len;
+    head.val_len = val ? (val_len + 16 - val_len % 16) : 0; // PKCS7 always adds 1..16 bytes
+    uint32_t rec_len = KV_LOG_REC_LEN(key_len, head.val_len);
+
+    if (kv_log->batch_len + rec_len > KV_LOG_BATCH_SIZE) {
+        TUYA_CALL_ERR_RETURN(__kv_log_commit());
+    }
+
+    // encrypt straight into the batch, records larger than the batch use a temporary buffer
+    BOOL_T direct = (rec_len > KV_LOG_BATCH_SIZE);
+    if (direct) {
+        rec = tal_malloc(rec_len);
+        TUYA_CHECK_NULL_RETURN(rec, OPRT_MALLOC_FAILED);
+    } else {
+        rec = kv_log->batch + kv_log->batch_len;
+    }
+
+    uint8_t *p_key = rec + sizeof(KV_LOG_REC_HEAD_T);
+    uint8_t *p_val = p_key + key_len;
+    memcpy(p_key, key, key_len);
+    if (val) {
+        memcpy(p_val, val, val_len);
+        tal_pkcs7padding_buffer(p_val, val_len);
+        memcpy(iv, kv_log->iv, sizeof(iv));
+        rt = tal_aes_crypt_cbc(kv_log->enc_ctx, SYMMETRY_ENCRYPT, head.val_len, iv, p_val, p_val);
+        if (OPRT_OK != rt) {
+            goto __EXIT;
+        }
+    }
+    head.crc = __kv_log_rec_crc(&head, key, p_val);
+    memcpy(rec, &head, sizeof(head));
+
+    *offset = kv_log->log_size + kv_log->batch_len;
+    *enc_len = head.val_len;
+    kv_log->write_cnt++;
+
+    if (!direct) {
+        kv_log->batch_len += rec_len;
+        goto __EXIT;
+    }
+
+    // batch is empty here, so the record goes right behind log_size
+    if (lfs_file_seek(kv_log->lfs, &kv_log->file, kv_log->log_size, LFS_SEEK_SET) < 0 ||
+        lfs_file_write(kv_log->lfs, &kv_log->file, rec, rec_len) != (lfs_ssize_t)rec_len ||
+        LFS_ERR_OK != lfs_file_sync(kv_log->lfs, &kv_log->file)) {
+        lfs_file_truncate(kv_log->lfs, &kv_log->file, kv_log->log_size);
+        rt = OPRT_KVS_WR_FAIL;
+        goto __EXIT;
+    }
+    kv_log->log_size += rec_len;
+    kv_log->flash_bytes += rec_len;
+    kv_log->commit_cnt++;
+
+__EXIT:
+    if (direct) {
+        tal_free(rec);
+    }
+    return rt;
+}
+
+/**
+ * @brief rebuild the index from the log, drop a torn tail
+ */
+static OPERATE_RET __kv_log_load(void)
+{
+    KV_LOG_T *kv_log = sg_kv_log;
+    KV_LOG_REC_HEAD_T head;
+    char key[LFS_NAME_MAX + 1];
+    uint8_t chunk[KV_LOG_COPY_CHUNK];
+    uint32_t offset = 0, pos = 0, n = 0, crc = 0;
+    lfs_soff_t file_size = lfs_file_size(kv_log->lfs, &kv_log->file);
+
+    if (file_size < 0) {
+        return OPRT_KVS_RD_FAIL;
+    }
+
+    while (offset + sizeof(head) <= (uint32_t)file_size) {
+        if (OPRT_OK != __kv_log_read_at(&kv_log->file, offset, &head, sizeof(head))) {
+            break;
+        }
+        if (KV_LOG_MAGIC != head.magic || 0 == head.key_len ||
+            offset + KV_LOG_REC_LEN(head.key_len, head.val_len) > (uint32_t)file_size) {
+            break;
+        }
+        if (lfs_file_read(kv_log->lfs, &kv_log->file, key, head.key_len) != head.key_len) {
+            break;
+        }
+        crc = __kv_log_rec_crc(&head, key, NULL);
+        for (pos = 0; pos < head.val_len; pos += n) {
+            n = (head.val_len - pos > sizeof(chunk)) ? sizeof(chunk) : head.val_len - pos;
+            if (lfs_file_read(kv_log->lfs, &kv_log->file, chunk, n) != (lfs_ssize_t)n) {
+                break;
+            }
+            crc = lfs_crc(crc, chunk, n);
+        }
+        if (pos < head.val_len || crc != head.crc) {
+            break;
+        }
+
+        if (KV_LOG_PUT == head.type) {
+            if (OPRT_OK != __kv_log_index_put(key, head.key_len, offset, head.val_len)) {
+                return OPRT_MALLOC_FAILED;
+            }
+        } else {
+            __kv_log_index_del(key, head.key_len);
+        }
+        offset += KV_LOG_REC_LEN(head.key_len, head.val_len);
+    }
+
+    if (offset < (uint32_t)file_size) {
+        PR_WARN("kv log truncated at %d of %d", offset, file_size);
+        lfs_file_truncate(kv_log->lfs, &kv_log->file, offset);
+        lfs_file_sync(kv_log->lfs, &kv_log->file);
+    }
+    kv_log->log_size = offset;
+
+    return OPRT_OK;
+}
+
+static void __kv_log_free(KV_LOG_T *kv_log)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < KV_LOG_HASH_BUCKET; i++) {
+        while (kv_log->bucket[i]) {
+            KV_LOG_ENTRY_T *entry = kv_log->bucket[i];
+            kv_log->bucket[i] = entry->next;
+            tal_free(entry);
+        }
+    }
+    if (kv_log->enc_ctx) {
+        tal_aes_free(kv_log->enc_ctx);
+    }
+    if (kv_log->dec_ctx) {
+        tal_aes_free(kv_log->dec_ctx);
+    }
+    tal_free(kv_log);
+}
+
+/**
+ * @brief open the log and build the index
+ *
+ * @param[in] lfs mounted littlefs
+ * @param[in] mutex lock shared with the rest of tal_kv
+ * @param[in] key AES-128 key of the values
+ * @param[in] iv AES-128-CBC iv of the values
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int kv_log_init(lfs_t *lfs, MUTEX_HANDLE mutex, const uint8_t *key, const uint8_t *iv)
+{
+    OPERATE_RET rt = OPRT_OK;
+
+    if (sg_kv_log) {
+        return OPRT_OK;
+    }
+
+    KV_LOG_T *kv_log = (KV_LOG_T *)tal_calloc(1, sizeof(KV_LOG_T));
+    TUYA_CHECK_NULL_RETURN(kv_log, OPRT_MALLOC_FAILED);
+    kv_log->lfs = lfs;
+    kv_log->mutex = mutex;
+    memcpy(kv_log->iv, iv, sizeof(kv_log->iv));
+
+    TUYA_CALL_ERR_GOTO(tal_aes_create_init(&kv_log->enc_ctx), __ERR);
+    TUYA_CALL_ERR_GOTO(tal_aes_setkey_enc(kv_log->enc_ctx, (uint8_t *)key, 128), __ERR);
+    TUYA_CALL_ERR_GOTO(tal_aes_create_init(&kv_log->dec_ctx), __ERR);
+    TUYA_CALL_ERR_GOTO(tal_aes_setkey_dec(kv_log->dec_ctx, (uint8_t *)key, 128), __ERR);
+
+    // a left over temporary log is an unfinished compaction, the old log is complete
+    lfs_remove(lfs, KV_LOG_TMP_FILE);
+    if (LFS_ERR_OK != lfs_file_open(lfs, &kv_log->file, KV_LOG_FILE, LFS_O_RDWR | LFS_O_CREAT)) {
+        rt = OPRT_KVS_RD_FAIL;
+        goto __ERR;
+    }
+
+    sg_kv_log = kv_log;
+    rt = __kv_log_load();
+    if (OPRT_OK != rt) {
+        sg_kv_log = NULL;
+        lfs_file_close(lfs, &kv_log->file);
+        goto __ERR;
+    }
+    PR_DEBUG("kv log keys %d, size %d, live %d", kv_log->key_cnt, kv_log->log_size, kv_log->live_size);
+
+    return OPRT_OK;
+
+__ERR:
+    __kv_log_free(kv_log);
+    return rt;
+}
+
+/**
+ * @brief commit pending records, close the log and drop the index
+ *
+ * kv_log_init loads the log again, as it does at boot.
+ *
+ * @return OPRT_OK on success, others if pending records could not be committed
+ */
+int kv_log_deinit(void)
+{
+    OPERATE_RET rt = OPRT_OK;
+    KV_LOG_T *kv_log = sg_kv_log;
+
+    if (NULL == kv_log) {
+        return OPRT_OK;
+    }
+
+    tal_mutex_lock(kv_log->mutex);
+    if (!kv_log->broken) {
+        rt = __kv_log_commit();
+        lfs_file_close(kv_log->lfs, &kv_log->file);
+    }
+    if (kv_log->work) {
+        tal_workq_cancel_delayed(kv_log->work);
+    }
+    // a commit work already running finds no log once it gets the lock
+    sg_kv_log = NULL;
+    tal_mutex_unlock(kv_log->mutex);
+
+    __kv_log_free(kv_log);
+
+    return rt;
+}
+
+static int __kv_log_set(const char *key, const uint8_t *value, size_t length, BOOL_T *is_new, BOOL_T only_absent)
+{
+    OPERATE_RET rt = OPRT_OK;
+    uint32_t offset = 0, enc_len = 0;
+    size_t key_len = strlen(key);
+
+    if (NULL == sg_kv_log || 0 == key_len || key_len > LFS_NAME_MAX) {
+        return OPRT_INVALID_PARM;
+    }
+
+    tal_mutex_lock(sg_kv_log->mutex);
+    if (sg_kv_log->broken) {
+        tal_mutex_unlock(sg_kv_log->mutex);
+        return OPRT_KVS_WR_FAIL;
+    }
+    BOOL_T absent = (NULL == *__kv_log_find(key, key_len, tuya_fnv1a32(key, key_len)));
+    if (is_new) {
+        *is_new = absent;
+    }
+    if (only_absent && !absent) {
+        tal_mutex_unlock(sg_kv_log->mutex);
+        return OPRT_OK;
+    }
+    rt = __kv_log_append(KV_LOG_PUT, key, key_len, value, length, &offset, &enc_len);
+    if (OPRT_OK == rt) {
+        rt = __kv_log_index_put(key, key_len, offset, enc_len);
+    }
+    if (OPRT_OK == rt) {
+        rt = (0 == KV_LOG_COMMIT_MS) ? __kv_log_commit() : __kv_log_kick(KV_LOG_COMMIT_MS);
+    }
+    if (OPRT_OK == rt && __kv_log_need_compact()) {
+        __kv_log_kick(KV_LOG_COMPACT_DELAY_MS);
+    }
+    tal_mutex_unlock(sg_kv_log->mutex);
+
+    return rt;
+}
+
+/**
+ * @brief set a key, the record is committed by the commit work
+ *
+ * @param[out] is_new TRUE if the key was not in the log before
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int kv_log_set(const char *key, const uint8_t *value, size_t length, BOOL_T *is_new)
+{
+    return __kv_log_set(key, value, length, is_new, FALSE);
+}
+
+/**
+ * @brief set a key only if it is not in the log yet, as when a per-key file
+ * is moved into the log
+ *
+ * @param[out] inserted TRUE if the value was put, FALSE if the key was there
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int kv_log_set_if_absent(const char *key, const uint8_t *value, size_t length, BOOL_T *inserted)
+{
+    return __kv_log_set(key, value, length, inserted, TRUE);
+}
+
+/**
+ * @brief read and decrypt the value of an entry into buf, in place
+ *
+ * @param[out] buf at least entry->val_len bytes
+ *
+ * @return length of the plain value, or a negative error code
+ */
+static int __kv_log_read_value(KV_LOG_ENTRY_T *entry, uint8_t *buf)
+{
+    KV_LOG_T *kv_log = sg_kv_log;
+    OPERATE_RET rt = OPRT_OK;
+    uint8_t iv[16];
+
+    uint32_t val_offset = entry->offset + sizeof(KV_LOG_REC_HEAD_T) + entry->key_len;
+    if (entry->offset >= kv_log->log_size) {
+        memcpy(buf, kv_log->batch + (val_offset - kv_log->log_size), entry->val_len);
+    } else {
+        rt = __kv_log_read_at(&kv_log->file, val_offset, buf, entry->val_len);
+    }
+    if (OPRT_OK == rt) {
+        memcpy(iv, kv_log->iv, sizeof(iv));
+        rt = tal_aes_crypt_cbc(kv_log->dec_ctx, SYMMETRY_DECRYPT, entry->val_len, iv, buf, buf);
+    }
+    int32_t dec_len = tal_aes_get_actual_length(buf, entry->val_len);
+    if (OPRT_OK != rt || dec_len < 0) {
+        PR_ERR("kv log read %s failed %d", entry->key, rt);
+        return OPRT_KVS_RD_FAIL;
+    }
+
+    return dec_len;
+}
+
+/**
+ * @brief get a key into a new buffer, free it with tal_free
+ *
+ * @return OPRT_OK on success, OPRT_NOT_FOUND if the key is not in the log,
+ * others on error
+ */
+int kv_log_get(const char *key, uint8_t **value, size_t *length)
+{
+    KV_LOG_T *kv_log = sg_kv_log;
+    uint8_t *buf = NULL;
+    int dec_len = 0;
+    size_t key_len = strlen(key);
+
+    if (NULL == kv_log || 0 == key_len || key_len > LFS_NAME_MAX) {
+        return OPRT_INVALID_PARM;
+    }
+
+    tal_mutex_lock(kv_log->mutex);
+    if (kv_log->broken) {
+        tal_mutex_unlock(kv_log->mutex);
+        return OPRT_KVS_RD_FAIL;
+    }
+    KV_LOG_ENTRY_T *entry = *__kv_log_find(key, key_len, tuya_fnv1a32(key, key_len));
+    if (NULL == entry) {
+        tal_mutex_unlock(kv_log->mutex);
+        return OPRT_NOT_FOUND;
+    }
+
+    buf = tal_malloc(entry->val_len + 1);
+    if (NULL == buf) {
+        tal_mutex_unlock(kv_log->mutex);
+        return OPRT_MALLOC_FAILED;
+    }
+    dec_len = __kv_log_read_value(entry, buf);
+    tal_mutex_unlock(kv_log->mutex);
+
+    if (dec_len < 0) {
+        tal_free(buf);
+        return dec_len;
+    }
+    buf[dec_len] = '\0';
+    *value = buf;
+    *length = (size_t)dec_len;
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief get a key into a caller buffer
+ *
+ * Decrypts in place when buf can hold the encrypted value (value length
+ * rounded up to the next 16 bytes), otherwise through a temporary buffer.
+ *
+ * @param[out] out_len length of the value, also set when buf is too small
+ *
+ * @return OPRT_OK on success, OPRT_NOT_FOUND if the key is not in the log,
+ * OPRT_BUFFER_NOT_ENOUGH if buf is too small, others on error
+ */
+int kv_log_get_into(const char *key, uint8_t *buf, size_t len, size_t *out_len)
+{
+    KV_LOG_T *kv_log = sg_kv_log;
+    uint8_t *tmp = NULL;
+    int dec_len = 0;
+    size_t key_len = strlen(key);
+
+    if (NULL == kv_log || 0 == key_len || key_len > LFS_NAME_MAX) {
+        return OPRT_INVALID_PARM;
+    }
+
+    tal_mutex_lock(kv_log->mutex);
+    if (kv_log->broken) {
+        tal_mutex_unlock(kv_log->mutex);
+        return OPRT_KVS_RD_FAIL;
+    }
+    KV_LOG_ENTRY_T *entry = *__kv_log_find(key, key_len, tuya_fnv1a32(key, key_len));
+    if (NULL == entry) {
+        tal_mutex_unlock(kv_log->mutex);
+        return OPRT_NOT_FOUND;
+    }
+
+    if (len >= entry->val_len) {
+        dec_len = __kv_log_read_value(entry, buf);
+    } else {
+        tmp = tal_malloc(entry->val_len);
+        if (NULL == tmp) {
+            tal_mutex_unlock(kv_log->mutex);
+            return OPRT_MALLOC_FAILED;
+        }
+        dec_len = __kv_log_read_value(entry, tmp);
+        if (dec_len >= 0 && (size_t)dec_len <= len) {
+            memcpy(buf, tmp, dec_len);
+        }
+        tal_free(tmp);
+    }
+    tal_mutex_unlock(kv_log->mutex);
+
+    if (dec_len < 0) {
+        return dec_len;
+    }
+    *out_len = (size_t)dec_len;
+    if ((size_t)dec_len > len) {
+        return OPRT_BUFFER_NOT_ENOUGH;
+    }
+    if ((size_t)dec_len < len) {
+        buf[dec_len] = '\0';
+    }
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief delete a key
+ *
+ * @return OPRT_OK on success, OPRT_NOT_FOUND if the key is not in the log,
+ * others on error
+ */
+int kv_log_del(const char *key)
+{
+    OPERATE_RET rt = OPRT_OK;
+    uint32_t offset = 0, enc_len = 0;
+    size_t key_len = strlen(key);
+
+    if (NULL == sg_kv_log || 0 == key_len || key_len > LFS_NAME_MAX) {
+        return OPRT_INVALID_PARM;
+    }
+
+    tal_mutex_lock(sg_kv_log->mutex);
+    if (sg_kv_log->broken) {
+        tal_mutex_unlock(sg_kv_log->mutex);
+        return OPRT_KVS_WR_FAIL;
+    }
+    if (NULL == *__kv_log_find(key, key_len, tuya_fnv1a32(key, key_len))) {
+        tal_mutex_unlock(sg_kv_log->mutex);
+        return OPRT_NOT_FOUND;
+    }
+    // keep the entry until the delete record is in the log, a failed append
+    // must not hide a value that is still on flash
+    rt = __kv_log_append(KV_LOG_DEL, key, key_len, NULL, 0, &offset, &enc_len);
+    if (OPRT_OK == rt) {
+        __kv_log_index_del(key, key_len);
+        rt = (0 == KV_LOG_COMMIT_MS) ? __kv_log_commit() : __kv_log_kick(KV_LOG_COMMIT_MS);
+    }
+    tal_mutex_unlock(sg_kv_log->mutex);
+
+    return rt;
+}
+
+/**
+ * @brief commit pending records now, e.g. before reboot
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int kv_log_flush(void)
+{
+    OPERATE_RET rt = OPRT_OK;
+
+    if (NULL == sg_kv_log) {
+        return OPRT_OK;
+    }
+
+    tal_mutex_lock(sg_kv_log->mutex);
+    rt = sg_kv_log->broken ? OPRT_KVS_WR_FAIL : __kv_log_commit();
+    tal_mutex_unlock(sg_kv_log->mutex);
+
+    return rt;
+}
+
+/**
+ * @brief print keys and counters of the log
+ */
+void kv_log_dump(void)
+{
+    KV_LOG_ENTRY_T *entry = NULL;
+    uint32_t i = 0;
+
+    if (NULL == sg_kv_log) {
+        return;
+    }
+
+    tal_mutex_lock(sg_kv_log->mutex);
+    for (i = 0; i < KV_LOG_HASH_BUCKET; i++) {
+        for (entry = sg_kv_log->bucket[i]; entry; entry = entry->next) {
+            PR_DEBUG_RAW("%s  ", entry->key);
+        }
+    }
+    PR_DEBUG_RAW("\r\n");
+    PR_DEBUG("keys %d, log %d, live %d, pending %d", sg_kv_log->key_cnt, sg_kv_log->log_size, sg_kv_log->live_size,
+             sg_kv_log->batch_len);
+    PR_DEBUG("writes %d, commits %d, compacts %d, flash bytes %d", sg_kv_log->write_cnt, sg_kv_log->commit_cnt,
+             sg_kv_log->compact_cnt, sg_kv_log->flash_bytes);
+    tal_mutex_unlock(sg_kv_log->mutex);
+}
+
+#endif
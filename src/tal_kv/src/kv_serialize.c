@@ -15,6 +15,17 @@
  * includes optimizations for memory usage and processing time, making it
  * suitable for resource-constrained environments.
  *
+ * kv_serialize_tlv/kv_deserialize_tlv implement a compact binary format for
+ * the same kv_db_t arrays. A record is
+ *
+ *   magic(0xB5) version(1) varint(count) { key_len key type varint(value) }
+ *
+ * where integers are zigzag varints, bools one byte and strings/raw data a
+ * varint length followed by the bytes. Keys are kept so fields can still be
+ * added or reordered like with JSON. kv_is_tlv tells the two apart on read:
+ * JSON is UTF-8 text, where 0xB5 is never the first byte and is never
+ * followed by a control character such as the version byte.
+ *
  * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
  *
  */
@@ -275,3 +286,338 @@ ERR_EXIT:
 
     return op_ret;
 }
+
+/***********************************************************
+ * binary TLV format
+ ***********************************************************/
+#define KV_TLV_MAGIC   0xB5
+#define KV_TLV_VERSION 1
+#define KV_VARINT_MAX  5
+
+static uint32_t __kv_varint_put(uint8_t *buf, uint32_t val)
+{
+    uint32_t i = 0;
+
+    while (val >= 0x80) {
+        buf[i++] = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+    buf[i++] = (uint8_t)val;
+
+    return i;
+}
+
+static int __kv_varint_get(const uint8_t *buf, uint32_t len, uint32_t *offset, uint32_t *val)
+{
+    uint32_t result = 0;
+    uint32_t shift = 0;
+
+    while (*offset < len && shift < 7 * KV_VARINT_MAX) {
+        uint8_t byte = buf[(*offset)++];
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if (0 == (byte & 0x80)) {
+            *val = result;
+            return OPRT_OK;
+        }
+        shift += 7;
+    }
+
+    return OPRT_COM_ERROR;
+}
+
+static int32_t __kv_db_get_int(const kv_db_t *db)
+{
+    switch (db->tp) {
+    case KV_CHAR:
+        return *((char *)db->val);
+    case KV_BYTE:
+        return *((uint8_t *)db->val);
+    case KV_SHORT:
+        return *((int16_t *)db->val);
+    case KV_USHORT:
+        return *((uint16_t *)db->val);
+    default:
+        return *((int32_t *)db->val);
+    }
+}
+
+static int __kv_db_set_int(kv_db_t *db, int32_t val)
+{
+    switch (db->tp) {
+    case KV_CHAR:
+        if (val < -128 || val > 127) {
+            return OPRT_COM_ERROR;
+        }
+        *((char *)db->val) = val;
+        break;
+    case KV_BYTE:
+        if (val < 0 || val > 255) {
+            return OPRT_COM_ERROR;
+        }
+        *((uint8_t *)db->val) = val;
+        break;
+    case KV_SHORT:
+        if (val < -32768 || val > 32767) {
+            return OPRT_COM_ERROR;
+        }
+        *((int16_t *)db->val) = val;
+        break;
+    case KV_USHORT:
+        if (val < 0 || val > 65535) {
+            return OPRT_COM_ERROR;
+        }
+        *((uint16_t *)db->val) = val;
+        break;
+    default:
+        *((int *)db->val) = val;
+        break;
+    }
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief Check whether a stored record uses the binary TLV format.
+ *
+ * @param[in] in The stored record.
+ * @param[in] len The length of the record.
+ * @return TRUE if the record was written by kv_serialize_tlv.
+ */
+BOOL_T kv_is_tlv(const uint8_t *in, uint32_t len)
+{
+    // versions stay below 0x20, text that merely starts with 0xB5 is not taken for a record
+    return (len >= 2 && KV_TLV_MAGIC == in[0] && in[1] < 0x20) ? TRUE : FALSE;
+}
+
+/**
+ * Serializes the key-value pairs in the given database into the binary TLV
+ * format.
+ *
+ * @param db The pointer to the database containing the key-value pairs.
+ * @param dbcnt The number of key-value pairs in the database.
+ * @param out The pointer to store the serialized record, free it with tal_free.
+ * @param out_len The pointer to store the length of the serialized record.
+ * @return Returns OPRT_OK if serialization is successful, otherwise returns an
+ * error code.
+ */
+int kv_serialize_tlv(const kv_db_t *db, const uint32_t dbcnt, uint8_t **out, uint32_t *out_len)
+{
+    int i = 0;
+    // count need buf size, values take at most KV_VARINT_MAX bytes
+    uint32_t len = 2 + KV_VARINT_MAX;
+    for (i = 0; i < dbcnt; i++) {
+        len += 1 + strlen(db[i].key) + 1 + KV_VARINT_MAX;
+        if (db[i].tp == KV_STRING || db[i].tp == KV_RAW) {
+            len += db[i].len;
+        }
+    }
+
+    uint32_t offset = 0;
+    uint8_t *buf = tal_malloc(len);
+    if (NULL == buf) {
+        PR_ERR("maloc fails %d", len);
+        return OPRT_MALLOC_FAILED;
+    }
+    buf[offset++] = KV_TLV_MAGIC;
+    buf[offset++] = KV_TLV_VERSION;
+    offset += __kv_varint_put(buf + offset, dbcnt);
+
+    for (i = 0; i < dbcnt; i++) {
+        // add key
+        uint32_t key_len = strlen(db[i].key);
+        if (key_len > 0xFF) {
+            PR_ERR("key too long %s", db[i].key);
+            tal_free(buf);
+            return OPRT_INVALID_PARM;
+        }
+        buf[offset++] = key_len;
+        memcpy(buf + offset, db[i].key, key_len);
+        offset += key_len;
+        buf[offset++] = db[i].tp;
+
+        // add value
+        switch (db[i].tp) {
+        case KV_CHAR:
+        case KV_BYTE:
+        case KV_SHORT:
+        case KV_USHORT:
+        case KV_INT: {
+            int32_t val = __kv_db_get_int(&db[i]);
+            offset += __kv_varint_put(buf + offset, ((uint32_t)val << 1) ^ (uint32_t)(val >> 31));
+        } break;
+
+        case KV_BOOL: {
+            buf[offset++] = (FALSE == *((BOOL_T *)(db[i].val))) ? 0 : 1;
+        } break;
+
+        case KV_STRING: {
+            // stops at NUL like the JSON format, an empty string is read back as empty
+            uint32_t str_len = strnlen((char *)db[i].val, db[i].len);
+            offset += __kv_varint_put(buf + offset, str_len);
+            memcpy(buf + offset, db[i].val, str_len);
+            offset += str_len;
+        } break;
+
+        case KV_RAW: {
+            offset += __kv_varint_put(buf + offset, db[i].len);
+            memcpy(buf + offset, db[i].val, db[i].len);
+            offset += db[i].len;
+        } break;
+
+        default: {
+            PR_ERR("type invalid %d", db[i].tp);
+            tal_free(buf);
+            return OPRT_COM_ERROR;
+        }
+        }
+    }
+
+    *out = buf;
+    *out_len = offset;
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief Deserialize a binary TLV record and populate a key-value database.
+ *
+ * Follows kv_deserialize: fields missing from the record are zeroed and
+ * fields of the record not in the database are skipped. A KV_RAW field gets
+ * its len set to the stored length.
+ *
+ * @param[in] in The record written by kv_serialize_tlv.
+ * @param[in] len The length of the record.
+ * @param[in,out] db The key-value database to populate.
+ * @param[in] dbcnt The number of elements in the key-value database.
+ * @return Returns OPRT_OK if the deserialization is successful. Otherwise, it
+ * returns an error code indicating the failure reason.
+ */
+int kv_deserialize_tlv(const uint8_t *in, uint32_t len, kv_db_t *db, const uint32_t dbcnt)
+{
+    int op_ret = OPRT_OK;
+    uint32_t offset = 2;
+    uint32_t cnt = 0;
+    uint32_t i = 0, j = 0;
+
+    if (!kv_is_tlv(in, len)) {
+        return OPRT_INVALID_PARM;
+    }
+    if (KV_TLV_VERSION != in[1]) {
+        PR_ERR("tlv version %d not supported", in[1]);
+        return OPRT_NOT_SUPPORTED;
+    }
+    if (OPRT_OK != __kv_varint_get(in, len, &offset, &cnt)) {
+        op_ret = OPRT_COM_ERROR;
+        goto ERR_EXIT;
+    }
+
+    // fields missing from the record are left zero
+    for (j = 0; j < dbcnt; j++) {
+        memset(db[j].val, 0, db[j].len);
+    }
+
+    for (i = 0; i < cnt; i++) {
+        if (offset + 1 > len || offset + 1 + in[offset] + 1 > len) {
+            op_ret = OPRT_COM_ERROR;
+            goto ERR_EXIT;
+        }
+        uint8_t key_len = in[offset++];
+        const char *key = (const char *)in + offset;
+        offset += key_len;
+        kv_tp_t tp = in[offset++];
+
+        uint32_t val = 0;
+        if (KV_BOOL == tp) {
+            if (offset >= len) {
+                op_ret = OPRT_COM_ERROR;
+                goto ERR_EXIT;
+            }
+            val = in[offset++];
+        } else if (tp <= KV_RAW) {
+            if (OPRT_OK != __kv_varint_get(in, len, &offset, &val) ||
+                ((tp == KV_STRING || tp == KV_RAW) && val > len - offset)) {
+                op_ret = OPRT_COM_ERROR;
+                goto ERR_EXIT;
+            }
+        } else {
+            PR_ERR("type invalid %d", tp);
+            op_ret = OPRT_COM_ERROR;
+            goto ERR_EXIT;
+        }
+        const uint8_t *data = in + offset;
+        if (tp == KV_STRING || tp == KV_RAW) {
+            offset += val;
+        }
+
+        // fields are usually stored in db order, try the next one first
+        for (j = 0; j < dbcnt; j++) {
+            kv_db_t *item = &db[(i + j) % dbcnt];
+            if (key_len == strlen(item->key) && 0 == memcmp(item->key, key, key_len)) {
+                break;
+            }
+        }
+        if (j == dbcnt) {
+            continue;
+        }
+        j = (i + j) % dbcnt;
+
+        if (db[j].tp <= KV_INT && tp > KV_INT) {
+            op_ret = OPRT_CJSON_GET_ERR;
+            goto ERR_EXIT;
+        } else if (db[j].tp == KV_BOOL && tp != KV_BOOL) {
+            op_ret = OPRT_CJSON_GET_ERR;
+            goto ERR_EXIT;
+        } else if ((db[j].tp == KV_STRING || db[j].tp == KV_RAW) && tp != KV_STRING && tp != KV_RAW) {
+            op_ret = OPRT_CJSON_GET_ERR;
+            goto ERR_EXIT;
+        }
+
+        switch (db[j].tp) {
+        case KV_CHAR:
+        case KV_BYTE:
+        case KV_SHORT:
+        case KV_USHORT:
+        case KV_INT: {
+            op_ret = __kv_db_set_int(&db[j], (int32_t)((val >> 1) ^ (0 - (val & 1))));
+            if (OPRT_OK != op_ret) {
+                goto ERR_EXIT;
+            }
+        } break;
+
+        case KV_BOOL: {
+            *((BOOL_T *)db[j].val) = val ? 1 : 0;
+        } break;
+
+        case KV_STRING: {
+            if (db[j].len < val + 1) {
+                op_ret = OPRT_COM_ERROR;
+                goto ERR_EXIT;
+            }
+            memcpy(db[j].val, data, val);
+            ((char *)db[j].val)[val] = 0;
+        } break;
+
+        case KV_RAW: {
+            if (db[j].len < val) {
+                op_ret = OPRT_COM_ERROR;
+                goto ERR_EXIT;
+            }
+            memcpy(db[j].val, data, val);
+            db[j].len = val;
+        } break;
+
+        default: {
+            PR_ERR("type invalid %d", db[j].tp);
+            op_ret = OPRT_COM_ERROR;
+            goto ERR_EXIT;
+        }
+        }
+    }
+
+    return OPRT_OK;
+
+ERR_EXIT:
+    PR_ERR("deserial fails %d", op_ret);
+
+    return op_ret;
+}
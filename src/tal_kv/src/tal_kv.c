@@ -16,6 +16,14 @@
  * layer (HAL) for flash operations. This ensures compatibility and optimal
  * performance across different Tuya devices and platforms.
  *
+ * With ENABLE_KV_LOG_ENGINE, tal_kv_set/get/del go to the log-structured
+ * engine in kv_log.c, which keeps all keys in one append-only file. Keys
+ * still stored as per-key files are moved into the log on first read.
+ *
+ * With ENABLE_KV_CACHE, decrypted values are kept in an LRU cache
+ * (kv_cache.c) so repeated reads of the same key skip flash and AES.
+ * tal_kv_get_into reads into a caller buffer without a heap allocation.
+ *
  * @note This file is part of the Tuya SDK and is intended for use in Tuya-based
  * applications. It requires the LittleFS library and Tuya's hardware
  * abstraction libraries for proper functionality.
@@ -35,9 +43,44 @@ static lfs_t lfs;
 static lfs_size_t lfs_flash_addr;
 static tal_kv_cfg_t lfs_kv_cfg;
 static MUTEX_HANDLE lfs_mutex;
+static tal_aes_key_t lfs_aes_key; // keyed once in tal_kv_init
+// one writer at a time, so the cache is updated in the same order as flash and
+// a per-key file moved into the log cannot overwrite a newer set
+static MUTEX_HANDLE kv_write_mutex;
 
 extern int kv_serialize(const kv_db_t *db, const uint32_t dbcnt, char **out, uint32_t *out_len);
 extern int kv_deserialize(const char *in, kv_db_t *db, const uint32_t dbcnt);
+extern BOOL_T kv_is_tlv(const uint8_t *in, uint32_t len);
+extern int kv_serialize_tlv(const kv_db_t *db, const uint32_t dbcnt, uint8_t **out, uint32_t *out_len);
+extern int kv_deserialize_tlv(const uint8_t *in, uint32_t len, kv_db_t *db, const uint32_t dbcnt);
+
+#if defined(ENABLE_KV_SERIALIZE_TLV) && (ENABLE_KV_SERIALIZE_TLV == 1)
+#define KV_FMT_DEFAULT KV_FMT_TLV
+#else
+#define KV_FMT_DEFAULT KV_FMT_JSON
+#endif
+
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+extern int kv_log_init(lfs_t *lfs, MUTEX_HANDLE mutex, const uint8_t *key, const uint8_t *iv);
+extern int kv_log_set(const char *key, const uint8_t *value, size_t length, BOOL_T *is_new);
+extern int kv_log_set_if_absent(const char *key, const uint8_t *value, size_t length, BOOL_T *inserted);
+extern int kv_log_get(const char *key, uint8_t **value, size_t *length);
+extern int kv_log_del(const char *key);
+extern int kv_log_flush(void);
+extern int kv_log_deinit(void);
+extern int kv_log_get_into(const char *key, uint8_t *buf, size_t len, size_t *out_len);
+extern void kv_log_dump(void);
+#endif
+
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+extern int kv_cache_init(void);
+extern int kv_cache_get(const char *key, uint8_t *buf, size_t len, size_t *out_len, uint32_t *gen);
+extern int kv_cache_dup(const char *key, uint8_t **value, size_t *length, uint32_t *gen);
+extern void kv_cache_fill(const char *key, const uint8_t *value, size_t length, uint32_t gen);
+extern void kv_cache_put(const char *key, const uint8_t *value, size_t length);
+extern void kv_cache_clear(void);
+extern void kv_cache_dump(void);
+#endif
 
 /**
  * Reads data from a user-provided block device.
@@ -146,7 +189,19 @@ int tal_kv_init(tal_kv_cfg_t *kv_cfg)
     tal_sha256_ret((const uint8_t *)kv_cfg->key, TAL_LV_KEY_LEN, sha256_ret, 0);
     memcpy(lfs_kv_cfg.key, sha256_ret, TAL_LV_KEY_LEN);
 
-    tal_mutex_create_init(&lfs_mutex);
+    if (NULL == lfs_aes_key.enc) {
+        OPERATE_RET rt = tal_aes_key_init(&lfs_aes_key, (const uint8_t *)lfs_kv_cfg.key, 128);
+        if (OPRT_OK != rt) {
+            PR_ERR("kv aes key init fail %d", rt);
+            return rt;
+        }
+    }
+    if (NULL == lfs_mutex) {
+        tal_mutex_create_init(&lfs_mutex);
+    }
+    if (NULL == kv_write_mutex) {
+        tal_mutex_create_init(&kv_write_mutex);
+    }
 
     TUYA_FLASH_BASE_INFO_T info;
     tkl_flash_get_one_type_info(TUYA_FLASH_TYPE_UF, &info);
@@ -178,32 +233,38 @@ int tal_kv_init(tal_kv_cfg_t *kv_cfg)
         err = lfs_mount(&lfs, &lfs_cfg);
     }
 
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+    if (LFS_ERR_OK == err) {
+        err = kv_log_init(&lfs, lfs_mutex, (const uint8_t *)lfs_kv_cfg.key, (const uint8_t *)lfs_kv_cfg.seed);
+    }
+#endif
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+    if (LFS_ERR_OK == err) {
+        err = kv_cache_init();
+    }
+#endif
+
     return err;
 }
 
 /**
- * @brief Sets a key-value pair in the key-value store.
- *
- * This function sets a key-value pair in the key-value store. The key is a
- * string, the value is a byte array, and the length specifies the number of
- * bytes in the value.
- *
- * @param key The key to set in the key-value store.
- * @param value The value to associate with the key.
- * @param length The length of the value in bytes.
- * @return Returns OPRT_OK if the key-value pair is set successfully, or an
- * error code if an error occurs.
+ * @brief Writes a key to the configured backend.
  */
-int tal_kv_set(const char *key, const uint8_t *value, size_t length)
+static int __kv_set(const char *key, const uint8_t *value, size_t length)
 {
     int result;
-    lfs_file_t file;
-
-    PR_DEBUG("key:%s, len %d", key, length);
 
-    if (NULL == key || NULL == value || 0 == length) {
-        return OPRT_INVALID_PARM;
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+    BOOL_T is_new = FALSE;
+    result = kv_log_set(key, value, length, &is_new);
+    if (OPRT_OK == result && is_new) {
+        // drop a per-key file written before the log engine, it would be stale now
+        tal_mutex_lock(lfs_mutex);
+        lfs_remove(&lfs, key);
+        tal_mutex_unlock(lfs_mutex);
     }
+#else
+    lfs_file_t file;
 
     tal_mutex_lock(lfs_mutex);
     result = lfs_file_open(&lfs, &file, key, LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC);
@@ -212,57 +273,83 @@ int tal_kv_set(const char *key, const uint8_t *value, size_t length)
         PR_ERR("lfs open %s err", key);
         return result;
     }
-    uint8_t *ec_data = NULL;
     uint32_t ec_len = 0;
     uint8_t iv[16];
+    uint8_t *ec_data = tal_malloc(length + 16);
+    if (NULL == ec_data) {
+        lfs_file_close(&lfs, &file);
+        tal_mutex_unlock(lfs_mutex);
+        return OPRT_MALLOC_FAILED;
+    }
+    memcpy(ec_data, value, length);
+    ec_len = tal_pkcs7padding_buffer(ec_data, length);
 
     memcpy(iv, lfs_kv_cfg.seed, 16);
-    result =
-        tal_aes128_cbc_encode((uint8_t *)value, length, (uint8_t *)lfs_kv_cfg.key, iv, &ec_data, (uint32_t *)&ec_len);
+    result = tal_aes_key_crypt_cbc(&lfs_aes_key, SYMMETRY_ENCRYPT, ec_len, iv, ec_data, ec_data);
     if (OPRT_OK != result) {
         lfs_file_close(&lfs, &file);
         tal_mutex_unlock(lfs_mutex);
+        tal_free(ec_data);
         PR_DEBUG("key %s encrypt failed", key);
         return result;
     }
     lfs_file_rewind(&lfs, &file);
     result = lfs_file_write(&lfs, &file, ec_data, ec_len);
     lfs_file_close(&lfs, &file);
-    tal_aes_free_data(ec_data);
+    tal_free(ec_data);
     tal_mutex_unlock(lfs_mutex);
     if (result != ec_len) {
         PR_ERR("kv write fail %d", result);
         return OPRT_KVS_WR_FAIL;
     }
+    result = OPRT_OK;
+#endif
 
-    return OPRT_OK;
+    return result;
 }
 
 /**
- * @brief Retrieves the value associated with the specified key from the
- * key-value store.
- *
- * This function retrieves the value associated with the specified key from the
- * key-value store. The retrieved value is stored in the `value` parameter, and
- * its length is stored in the `length` parameter.
+ * @brief Sets a key-value pair in the key-value store.
  *
- * @param key The key to retrieve the value for.
- * @param value A pointer to a pointer that will store the retrieved value.
- * @param length A pointer to a variable that will store the length of the
- * retrieved value.
+ * This function sets a key-value pair in the key-value store. The key is a
+ * string, the value is a byte array, and the length specifies the number of
+ * bytes in the value.
  *
- * @return 0 if the value was successfully retrieved, or a negative error code
- * if an error occurred.
+ * @param key The key to set in the key-value store.
+ * @param value The value to associate with the key.
+ * @param length The length of the value in bytes.
+ * @return Returns OPRT_OK if the key-value pair is set successfully, or an
+ * error code if an error occurs.
  */
-int tal_kv_get(const char *key, uint8_t **value, size_t *length)
+int tal_kv_set(const char *key, const uint8_t *value, size_t length)
 {
-    int result;
-    lfs_file_t file;
+    PR_DEBUG("key:%s, len %d", key, length);
 
-    if (NULL == key || NULL == value || NULL == length) {
+    if (NULL == key || NULL == value || 0 == length) {
         return OPRT_INVALID_PARM;
     }
 
+    // a concurrent set of the same key must not put its value into the cache
+    // after ours when its flash write came first
+    tal_mutex_lock(kv_write_mutex);
+    int result = __kv_set(key, value, length);
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+    // on failure the stored value is unknown, drop the cached one
+    kv_cache_put(key, OPRT_OK == result ? value : NULL, length);
+#endif
+    tal_mutex_unlock(kv_write_mutex);
+
+    return result;
+}
+
+/**
+ * @brief Reads a key stored as its own littlefs file.
+ */
+static int __lfs_kv_get(const char *key, uint8_t **value, size_t *length)
+{
+    int result;
+    lfs_file_t file;
+
     tal_mutex_lock(lfs_mutex);
     result = lfs_file_open(&lfs, &file, key, LFS_O_RDONLY);
     if (LFS_ERR_OK != result) {
@@ -289,25 +376,228 @@ int tal_kv_get(const char *key, uint8_t **value, size_t *length)
         PR_ERR("kv read error %d", result);
         return OPRT_KVS_RD_FAIL;
     }
-    uint8_t *dec_data = NULL;
-    uint32_t dec_len = 0;
     uint8_t iv[16];
 
+    // decrypt in place, ec_data already has room for the terminator
     memcpy(iv, lfs_kv_cfg.seed, 16);
-    result = tal_aes128_cbc_decode(ec_data, ec_len, (uint8_t *)lfs_kv_cfg.key, iv, &dec_data, (uint32_t *)&dec_len);
-    dec_len = tal_aes_get_actual_length(dec_data, dec_len);
-    tal_free(ec_data);
-    if (OPRT_OK != result || dec_len > ec_len) {
+    result = tal_aes_key_crypt_cbc(&lfs_aes_key, SYMMETRY_DECRYPT, ec_len, iv, ec_data, ec_data);
+    int32_t dec_len = tal_aes_get_actual_length(ec_data, ec_len);
+    if (OPRT_OK != result || dec_len < 0 || dec_len > ec_len) {
+        tal_free(ec_data);
         PR_ERR("key %s decrypt failed %d, %d-%d", key, result, dec_len, ec_len);
         return OPRT_BUFFER_NOT_ENOUGH;
     }
-    *value = dec_data;
+    *value = ec_data;
     *length = (size_t)dec_len;
-    dec_data[dec_len] = 0;
+    ec_data[dec_len] = 0;
 
     return OPRT_OK;
 }
 
+/**
+ * @brief Reads a key stored as its own littlefs file into buf.
+ *
+ * The encrypted file is read straight into buf and decrypted in place when it
+ * fits, otherwise it goes through __lfs_kv_get.
+ */
+static int __lfs_kv_get_into(const char *key, uint8_t *buf, size_t len, size_t *out_len)
+{
+    int result;
+    lfs_file_t file;
+
+    tal_mutex_lock(lfs_mutex);
+    result = lfs_file_open(&lfs, &file, key, LFS_O_RDONLY);
+    if (LFS_ERR_OK != result) {
+        PR_ERR("lfs open %s %d err", key, result);
+        tal_mutex_unlock(lfs_mutex);
+        return result;
+    }
+    uint32_t ec_len = lfs_file_size(&lfs, &file);
+    if (ec_len > len) {
+        lfs_file_close(&lfs, &file);
+        tal_mutex_unlock(lfs_mutex);
+
+        uint8_t *value = NULL;
+        result = __lfs_kv_get(key, &value, out_len);
+        if (OPRT_OK != result) {
+            return result;
+        }
+        if (*out_len > len) {
+            result = OPRT_BUFFER_NOT_ENOUGH;
+        } else {
+            memcpy(buf, value, *out_len + (*out_len < len ? 1 : 0));
+        }
+        tal_free(value);
+        return result;
+    }
+    result = lfs_file_read(&lfs, &file, buf, ec_len);
+    lfs_file_close(&lfs, &file);
+    tal_mutex_unlock(lfs_mutex);
+    if (result <= 0) {
+        PR_ERR("kv read error %d", result);
+        return OPRT_KVS_RD_FAIL;
+    }
+    uint8_t iv[16];
+
+    memcpy(iv, lfs_kv_cfg.seed, 16);
+    result = tal_aes_key_crypt_cbc(&lfs_aes_key, SYMMETRY_DECRYPT, ec_len, iv, buf, buf);
+    int32_t dec_len = tal_aes_get_actual_length(buf, ec_len);
+    if (OPRT_OK != result || dec_len < 0 || dec_len > ec_len) {
+        PR_ERR("key %s decrypt failed %d, %d-%d", key, result, dec_len, ec_len);
+        return OPRT_KVS_RD_FAIL;
+    }
+    *out_len = (size_t)dec_len;
+    if ((size_t)dec_len < len) {
+        buf[dec_len] = 0;
+    }
+
+    return OPRT_OK;
+}
+
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+/**
+ * @brief Moves a value read from a per-key file into the log.
+ *
+ * Runs under kv_write_mutex, and only while the file is still there and the
+ * key is not in the log, so a set or del that came after the file was read
+ * wins. Otherwise the file is left alone and only read until a set drops it.
+ */
+static void __kv_migrate(const char *key, const uint8_t *value, size_t length)
+{
+    struct lfs_info info;
+    BOOL_T inserted = FALSE;
+
+    tal_mutex_lock(kv_write_mutex);
+    tal_mutex_lock(lfs_mutex);
+    int exist = lfs_stat(&lfs, key, &info);
+    tal_mutex_unlock(lfs_mutex);
+    if (LFS_ERR_OK == exist && OPRT_OK == kv_log_set_if_absent(key, value, length, &inserted) && inserted) {
+        tal_mutex_lock(lfs_mutex);
+        lfs_remove(&lfs, key);
+        tal_mutex_unlock(lfs_mutex);
+    }
+    tal_mutex_unlock(kv_write_mutex);
+}
+#endif
+
+/**
+ * @brief Reads a key from the configured backend.
+ */
+static int __kv_get(const char *key, uint8_t **value, size_t *length)
+{
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+    int result = kv_log_get(key, value, length);
+    if (OPRT_NOT_FOUND != result) {
+        return result;
+    }
+
+    // not in the log yet, move the per-key file into it
+    result = __lfs_kv_get(key, value, length);
+    if (OPRT_OK == result) {
+        __kv_migrate(key, *value, *length);
+    }
+    return result;
+#else
+    return __lfs_kv_get(key, value, length);
+#endif
+}
+
+/**
+ * @brief Reads a key from the configured backend into buf.
+ */
+static int __kv_get_into(const char *key, uint8_t *buf, size_t len, size_t *out_len)
+{
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+    int result = kv_log_get_into(key, buf, len, out_len);
+    if (OPRT_NOT_FOUND != result) {
+        return result;
+    }
+
+    // not in the log yet, move the per-key file into it
+    result = __lfs_kv_get_into(key, buf, len, out_len);
+    if (OPRT_OK == result) {
+        __kv_migrate(key, buf, *out_len);
+    }
+    return result;
+#else
+    return __lfs_kv_get_into(key, buf, len, out_len);
+#endif
+}
+
+/**
+ * @brief Retrieves the value associated with the specified key from the
+ * key-value store.
+ *
+ * This function retrieves the value associated with the specified key from the
+ * key-value store. The retrieved value is stored in the `value` parameter, and
+ * its length is stored in the `length` parameter.
+ *
+ * @param key The key to retrieve the value for.
+ * @param value A pointer to a pointer that will store the retrieved value.
+ * @param length A pointer to a variable that will store the length of the
+ * retrieved value.
+ *
+ * @return 0 if the value was successfully retrieved, or a negative error code
+ * if an error occurred.
+ */
+int tal_kv_get(const char *key, uint8_t **value, size_t *length)
+{
+    if (NULL == key || NULL == value || NULL == length) {
+        return OPRT_INVALID_PARM;
+    }
+
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+    uint32_t gen = 0;
+    int result = kv_cache_dup(key, value, length, &gen);
+    if (OPRT_NOT_FOUND != result) {
+        return result;
+    }
+    result = __kv_get(key, value, length);
+    if (OPRT_OK == result) {
+        kv_cache_fill(key, *value, *length, gen);
+    }
+    return result;
+#else
+    return __kv_get(key, value, length);
+#endif
+}
+
+/**
+ * @brief Retrieves the value of a key into a caller-supplied buffer.
+ *
+ * Unlike tal_kv_get, no buffer is allocated for the value: it is copied from
+ * the cache or decrypted in place in buf whenever buf is large enough.
+ *
+ * @param key The key to retrieve the value for.
+ * @param buf The buffer to receive the value.
+ * @param len The size of buf in bytes.
+ * @param out_len Receives the length of the value, also when buf is too small.
+ *
+ * @return OPRT_OK on success, OPRT_BUFFER_NOT_ENOUGH if the value does not fit
+ * in buf, or another error code if an error occurred.
+ */
+int tal_kv_get_into(const char *key, uint8_t *buf, size_t len, size_t *out_len)
+{
+    if (NULL == key || NULL == buf || 0 == len || NULL == out_len) {
+        return OPRT_INVALID_PARM;
+    }
+
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+    uint32_t gen = 0;
+    int result = kv_cache_get(key, buf, len, out_len, &gen);
+    if (OPRT_NOT_FOUND != result) {
+        return result;
+    }
+    result = __kv_get_into(key, buf, len, out_len);
+    if (OPRT_OK == result) {
+        kv_cache_fill(key, buf, *out_len, gen);
+    }
+    return result;
+#else
+    return __kv_get_into(key, buf, len, out_len);
+#endif
+}
+
 /**
  * @brief Deletes the specified key from the TAL Key-Value store.
  *
@@ -321,9 +611,23 @@ int tal_kv_del(const char *key)
 {
     PR_DEBUG("key:%s", key);
 
+    tal_mutex_lock(kv_write_mutex);
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+    int log_result = kv_log_del(key);
+#endif
+
     tal_mutex_lock(lfs_mutex);
     int result = lfs_remove(&lfs, key);
     tal_mutex_unlock(lfs_mutex);
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+    kv_cache_put(key, NULL, 0);
+#endif
+    tal_mutex_unlock(kv_write_mutex);
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+    if (OPRT_OK == log_result) {
+        result = LFS_ERR_OK;
+    }
+#endif
     if (LFS_ERR_OK == result) {
         PR_DEBUG("Deleted successfully");
         return OPRT_OK;
@@ -380,6 +684,14 @@ void tal_kv_cmd(int argc, char *argv[])
         }
     } else if (0 == strcmp("del", argv[1])) {
         tal_kv_del(argv[2]);
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+    } else if (0 == strcmp("log", argv[1])) {
+        kv_log_dump();
+#endif
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+    } else if (0 == strcmp("cache", argv[1])) {
+        kv_cache_dump();
+#endif
     } else if (0 == strcmp("list", argv[1])) {
         lfs_dir_t dir;
         lfs_dir_open(&lfs, &dir, argv[2]);
@@ -405,6 +717,21 @@ void tal_kv_cmd(int argc, char *argv[])
  * error code.
  */
 int tal_kv_serialize_set(const char *key, kv_db_t *db, size_t dbcnt)
+{
+    return tal_kv_serialize_set_fmt(key, db, dbcnt, KV_FMT_DEFAULT);
+}
+
+/**
+ * @brief Serializes and sets key-value data in the given format.
+ *
+ * @param key The key to set the serialized data.
+ * @param db Pointer to the key-value database.
+ * @param dbcnt The number of key-value pairs in the database.
+ * @param fmt KV_FMT_JSON or KV_FMT_TLV.
+ *
+ * @return OPRT_OK on success, or an error code on failure.
+ */
+int tal_kv_serialize_set_fmt(const char *key, kv_db_t *db, size_t dbcnt, kv_fmt_t fmt)
 {
     if (NULL == db || 0 == dbcnt) {
         return OPRT_INVALID_PARM;
@@ -414,12 +741,18 @@ int tal_kv_serialize_set(const char *key, kv_db_t *db, size_t dbcnt)
     uint32_t len = 0;
     int ret = OPRT_OK;
 
-    ret = kv_serialize(db, dbcnt, &buf, &len);
+    if (KV_FMT_TLV == fmt) {
+        ret = kv_serialize_tlv(db, dbcnt, (uint8_t **)&buf, &len);
+    } else {
+        ret = kv_serialize(db, dbcnt, &buf, &len);
+    }
     if (OPRT_OK != ret) {
         PR_ERR("kv_serialize  fail. %d", ret);
         return ret;
     }
-    PR_TRACE("write buf:%s", buf);
+    if (KV_FMT_JSON == fmt) {
+        PR_TRACE("write buf:%s", buf);
+    }
     ret = tal_kv_set(key, (const uint8_t *)buf, len);
     tal_free(buf);
     if (OPRT_OK != ret) {
@@ -458,7 +791,11 @@ int tal_kv_serialize_get(const char *key, kv_db_t *db, size_t dbcnt)
         PR_ERR("kv_get fails %s %d", key, ret);
         return ret;
     }
-    ret = kv_deserialize((char *)buf, db, dbcnt);
+    if (kv_is_tlv(buf, len)) {
+        ret = kv_deserialize_tlv(buf, len, db, dbcnt);
+    } else {
+        ret = kv_deserialize((char *)buf, db, dbcnt);
+    }
     tal_free(buf);
     if (OPRT_OK != ret) {
         PR_ERR("kv_deserialize fail. %d", ret);
@@ -475,4 +812,51 @@ int tal_kv_serialize_get(const char *key, kv_db_t *db, size_t dbcnt)
 lfs_t *tal_lfs_get()
 {
     return &lfs;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Writes pending key-value records to flash.
+ *
+ * The log engine commits writes in batches after a short delay. Call this
+ * before a reboot or power down so the latest writes are not lost. Does
+ * nothing when each key is stored as its own file.
+ *
+ * @return OPRT_OK on success, or an error code on failure.
+ */
+int tal_kv_flush(void)
+{
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+    return kv_log_flush();
+#else
+    return OPRT_OK;
+#endif
+}
+
+/**
+ * @brief Writes pending records to flash and unmounts the store.
+ *
+ * Call this before power down. tal_kv_init mounts the store and loads the
+ * log again, as at boot.
+ *
+ * @return OPRT_OK on success, or an error code on failure.
+ */
+int tal_kv_deinit(void)
+{
+    int result = OPRT_OK;
+
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+    result = kv_log_deinit();
+#endif
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+    kv_cache_clear();
+#endif
+    if (NULL == lfs_mutex) {
+        return result;
+    }
+
+    tal_mutex_lock(lfs_mutex);
+    lfs_unmount(&lfs);
+    tal_mutex_unlock(lfs_mutex);
+
+    return result;
+}
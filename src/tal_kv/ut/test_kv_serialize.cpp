@@ -0,0 +1,278 @@
+/**
+ * @file test_kv_serialize.cpp
+ * @brief unit test of the JSON and TLV formats of tal_kv_serialize_set/get
+ */
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_system.h"
+#include "tal_memory.h"
+#include "tal_kv.h"
+
+extern "C" {
+int kv_serialize(const kv_db_t *db, const uint32_t dbcnt, char **out, uint32_t *out_len);
+int kv_deserialize(const char *in, kv_db_t *db, const uint32_t dbcnt);
+BOOL_T kv_is_tlv(const uint8_t *in, uint32_t len);
+int kv_serialize_tlv(const kv_db_t *db, const uint32_t dbcnt, uint8_t **out, uint32_t *out_len);
+int kv_deserialize_tlv(const uint8_t *in, uint32_t len, kv_db_t *db, const uint32_t dbcnt);
+}
+
+namespace {
+
+// one field of every type, at the edges of their ranges
+struct Record {
+    char c;
+    uint8_t b;
+    int16_t s;
+    uint16_t us;
+    int32_t i;
+    BOOL_T on;
+    char str[24];
+    uint8_t raw[8];
+    kv_db_t db[8];
+
+    Record()
+    {
+        memset(this, 0, sizeof(*this));
+        db[0] = {(char *)"c", KV_CHAR, &c, sizeof(c)};
+        db[1] = {(char *)"b", KV_BYTE, &b, sizeof(b)};
+        db[2] = {(char *)"s", KV_SHORT, &s, sizeof(s)};
+        db[3] = {(char *)"us", KV_USHORT, &us, sizeof(us)};
+        db[4] = {(char *)"i", KV_INT, &i, sizeof(i)};
+        db[5] = {(char *)"on", KV_BOOL, &on, sizeof(on)};
+        db[6] = {(char *)"str", KV_STRING, str, sizeof(str)};
+        db[7] = {(char *)"raw", KV_RAW, raw, sizeof(raw)};
+    }
+
+    void fill()
+    {
+        c = -128;
+        b = 255;
+        s = -32768;
+        us = 65535;
+        i = INT32_MIN;
+        on = TRUE;
+        strcpy(str, "tlv string");
+        const uint8_t bytes[] = {0x00, 0xB5, 0x01, 0x7B, 0xFF, 0x80, 0x7F, 0x22};
+        memcpy(raw, bytes, sizeof(raw));
+    }
+
+    void expect_eq(const Record &other) const
+    {
+        EXPECT_EQ(c, other.c);
+        EXPECT_EQ(b, other.b);
+        EXPECT_EQ(s, other.s);
+        EXPECT_EQ(us, other.us);
+        EXPECT_EQ(i, other.i);
+        EXPECT_EQ(on, other.on);
+        EXPECT_STREQ(str, other.str);
+        EXPECT_EQ(0, memcmp(raw, other.raw, sizeof(raw)));
+    }
+};
+
+std::vector<uint8_t> tlv_of(const kv_db_t *db, uint32_t dbcnt)
+{
+    uint8_t *out = NULL;
+    uint32_t out_len = 0;
+
+    if (OPRT_OK != kv_serialize_tlv(db, dbcnt, &out, &out_len)) {
+        return {};
+    }
+    std::vector<uint8_t> tlv(out, out + out_len);
+    tal_free(out);
+    return tlv;
+}
+
+class KvSerializeTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        tal_kv_cfg_t cfg = {};
+        memcpy(cfg.seed, "vmlkasdh93dlvlcy", TAL_LV_KEY_LEN);
+        memcpy(cfg.key, "dflfuap134ddlduq", TAL_LV_KEY_LEN);
+        ASSERT_EQ(OPRT_OK, tal_kv_init(&cfg));
+    }
+
+    static void TearDownTestSuite()
+    {
+        tal_kv_deinit();
+    }
+};
+
+} // namespace
+
+TEST_F(KvSerializeTest, TlvRoundTripOfEachType)
+{
+    Record in, out;
+
+    in.fill();
+    std::vector<uint8_t> tlv = tlv_of(in.db, 8);
+    ASSERT_FALSE(tlv.empty());
+    ASSERT_TRUE(kv_is_tlv(tlv.data(), tlv.size()));
+
+    ASSERT_EQ(OPRT_OK, kv_deserialize_tlv(tlv.data(), tlv.size(), out.db, 8));
+    in.expect_eq(out);
+    EXPECT_EQ(sizeof(in.raw), out.db[7].len);
+
+    // the other end of each range
+    in.c = 127;
+    in.b = 0;
+    in.s = 32767;
+    in.us = 0;
+    in.i = INT32_MAX;
+    in.on = FALSE;
+    in.str[0] = '\0';
+    tlv = tlv_of(in.db, 8);
+    ASSERT_EQ(OPRT_OK, kv_deserialize_tlv(tlv.data(), tlv.size(), out.db, 8));
+    in.expect_eq(out);
+}
+
+TEST_F(KvSerializeTest, TlvThroughTheStore)
+{
+    Record in, out;
+
+    in.fill();
+    ASSERT_EQ(OPRT_OK, tal_kv_serialize_set_fmt("ut.tlv", in.db, 8, KV_FMT_TLV));
+    ASSERT_EQ(OPRT_OK, tal_kv_serialize_get("ut.tlv", out.db, 8));
+    in.expect_eq(out);
+
+    // a record written as JSON before the switch still reads back
+    in.i = 12345;
+    in.raw[0] = 0xB5;
+    ASSERT_EQ(OPRT_OK, tal_kv_serialize_set_fmt("ut.json", in.db, 8, KV_FMT_JSON));
+    ASSERT_EQ(OPRT_OK, tal_kv_serialize_get("ut.json", out.db, 8));
+    in.expect_eq(out);
+}
+
+TEST_F(KvSerializeTest, TruncatedTlvIsRejected)
+{
+    Record in, out;
+
+    in.fill();
+    std::vector<uint8_t> tlv = tlv_of(in.db, 8);
+    ASSERT_FALSE(tlv.empty());
+
+    // every prefix misses part of the last field, copy it so reads past the end are caught
+    for (size_t len = 0; len < tlv.size(); len++) {
+        std::vector<uint8_t> prefix(tlv.begin(), tlv.begin() + len);
+        EXPECT_NE(OPRT_OK, kv_deserialize_tlv(prefix.data(), prefix.size(), out.db, 8)) << "length " << len;
+    }
+
+    // a varint that never ends
+    std::vector<uint8_t> endless = {0xB5, 0x01, 0x01, 0x01, 'i', KV_INT, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    EXPECT_NE(OPRT_OK, kv_deserialize_tlv(endless.data(), endless.size(), out.db, 8));
+
+    // a string longer than the rest of the record
+    std::vector<uint8_t> overlong = {0xB5, 0x01, 0x01, 0x03, 's', 't', 'r', KV_STRING, 0x10, 'a', 'b'};
+    EXPECT_NE(OPRT_OK, kv_deserialize_tlv(overlong.data(), overlong.size(), out.db, 8));
+}
+
+TEST_F(KvSerializeTest, TlvTypeMismatchIsRejected)
+{
+    Record out;
+    char text[8] = "text";
+    int32_t big = 300;
+    int32_t one = 1;
+
+    // a string stored where an int is expected
+    kv_db_t as_str = {(char *)"i", KV_STRING, text, sizeof(text)};
+    std::vector<uint8_t> tlv = tlv_of(&as_str, 1);
+    EXPECT_EQ(OPRT_CJSON_GET_ERR, kv_deserialize_tlv(tlv.data(), tlv.size(), out.db, 8));
+
+    // an int stored where a bool is expected
+    kv_db_t as_int = {(char *)"on", KV_INT, &one, sizeof(one)};
+    tlv = tlv_of(&as_int, 1);
+    EXPECT_EQ(OPRT_CJSON_GET_ERR, kv_deserialize_tlv(tlv.data(), tlv.size(), out.db, 8));
+
+    // an int out of range of the field
+    kv_db_t too_big = {(char *)"b", KV_INT, &big, sizeof(big)};
+    tlv = tlv_of(&too_big, 1);
+    EXPECT_EQ(OPRT_COM_ERROR, kv_deserialize_tlv(tlv.data(), tlv.size(), out.db, 8));
+
+    // an unknown type
+    std::vector<uint8_t> bad_type = {0xB5, 0x01, 0x01, 0x01, 'i', 0x09, 0x02};
+    EXPECT_EQ(OPRT_COM_ERROR, kv_deserialize_tlv(bad_type.data(), bad_type.size(), out.db, 8));
+}
+
+TEST_F(KvSerializeTest, LegacyTextStartingWithTheMagicIsNotTlv)
+{
+    Record in, out;
+    char *json = NULL;
+    uint32_t json_len = 0;
+
+    in.fill();
+    ASSERT_EQ(OPRT_OK, kv_serialize(in.db, 8, &json, &json_len));
+    EXPECT_FALSE(kv_is_tlv((const uint8_t *)json, json_len));
+    tal_free(json);
+
+    // Latin-1 text whose first byte is 0xB5 ('µ'), as an old writer may have stored
+    const char latin1[] = "\xB5{\"i\":1}";
+    EXPECT_FALSE(kv_is_tlv((const uint8_t *)latin1, strlen(latin1)));
+    const char latin1_word[] = "\xB5sec";
+    EXPECT_FALSE(kv_is_tlv((const uint8_t *)latin1_word, strlen(latin1_word)));
+
+    // such a value fails as JSON instead of being parsed as a record
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.latin1", (const uint8_t *)latin1, strlen(latin1)));
+    EXPECT_NE(OPRT_OK, tal_kv_serialize_get("ut.latin1", out.db, 8));
+
+    // a record of another version is still recognised, and refused
+    std::vector<uint8_t> v2 = {0xB5, 0x02, 0x00};
+    EXPECT_TRUE(kv_is_tlv(v2.data(), v2.size()));
+    EXPECT_EQ(OPRT_NOT_SUPPORTED, kv_deserialize_tlv(v2.data(), v2.size(), out.db, 8));
+}
+
+TEST_F(KvSerializeTest, BenchmarkJsonVsTlv)
+{
+    const int loops = 20000;
+    Record in, out;
+    char *json = NULL;
+    uint8_t *tlv = NULL;
+    uint32_t json_len = 0, tlv_len = 0;
+    int i = 0;
+
+    in.fill();
+
+    SYS_TIME_T start = tal_system_get_millisecond();
+    for (i = 0; i < loops; i++) {
+        ASSERT_EQ(OPRT_OK, kv_serialize(in.db, 8, &json, &json_len));
+        tal_free(json);
+    }
+    SYS_TIME_T json_ser_ms = tal_system_get_millisecond() - start;
+
+    start = tal_system_get_millisecond();
+    for (i = 0; i < loops; i++) {
+        ASSERT_EQ(OPRT_OK, kv_serialize_tlv(in.db, 8, &tlv, &tlv_len));
+        tal_free(tlv);
+    }
+    SYS_TIME_T tlv_ser_ms = tal_system_get_millisecond() - start;
+
+    ASSERT_EQ(OPRT_OK, kv_serialize(in.db, 8, &json, &json_len));
+    ASSERT_EQ(OPRT_OK, kv_serialize_tlv(in.db, 8, &tlv, &tlv_len));
+
+    start = tal_system_get_millisecond();
+    for (i = 0; i < loops; i++) {
+        out.db[7].len = sizeof(out.raw);
+        ASSERT_EQ(OPRT_OK, kv_deserialize(json, out.db, 8));
+    }
+    SYS_TIME_T json_de_ms = tal_system_get_millisecond() - start;
+
+    start = tal_system_get_millisecond();
+    for (i = 0; i < loops; i++) {
+        out.db[7].len = sizeof(out.raw);
+        ASSERT_EQ(OPRT_OK, kv_deserialize_tlv(tlv, tlv_len, out.db, 8));
+    }
+    SYS_TIME_T tlv_de_ms = tal_system_get_millisecond() - start;
+
+    tal_free(json);
+    tal_free(tlv);
+
+    printf("[   INFO   ] %d records of 8 fields: json %u bytes, serialize %llu ms, deserialize %llu ms\n", loops,
+           json_len, (unsigned long long)json_ser_ms, (unsigned long long)json_de_ms);
+    printf("[   INFO   ] tlv %u bytes, serialize %llu ms, deserialize %llu ms\n", tlv_len,
+           (unsigned long long)tlv_ser_ms, (unsigned long long)tlv_de_ms);
+    EXPECT_LT(tlv_len, json_len);
+    EXPECT_LE(tlv_de_ms, json_de_ms + 5);
+}
@@ -0,0 +1,563 @@
+/**
+ * @file test_tal_kv.cpp
+ * @brief unit test of tal_kv
+ */
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "mockcpp/mockcpp.hpp"
+
+#include "tuya_cloud_types.h"
+#include "tal_system.h"
+#include "tal_memory.h"
+#include "tal_mutex.h"
+#include "tal_workq_service.h"
+#include "tal_kv.h"
+#include "tal_hash.h"
+#include "tal_symmetry.h"
+#include "tkl_memory.h"
+
+USING_MOCKCPP_NS
+
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+extern "C" int kv_cache_get(const char *key, uint8_t *buf, size_t len, size_t *out_len, uint32_t *gen);
+#endif
+
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+extern "C" {
+int kv_log_init(lfs_t *lfs, MUTEX_HANDLE mutex, const uint8_t *key, const uint8_t *iv);
+int kv_log_set(const char *key, const uint8_t *value, size_t length, BOOL_T *is_new);
+int kv_log_del(const char *key);
+int kv_log_flush(void);
+int kv_log_deinit(void);
+int user_provided_block_device_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer,
+                                    lfs_size_t size);
+int user_provided_block_device_erase(const struct lfs_config *c, lfs_block_t block);
+}
+#endif
+
+namespace {
+
+const char *s_kv_seed = "vmlkasdh93dlvlcy";
+const char *s_kv_key = "dflfuap134ddlduq";
+
+int kv_init()
+{
+    tal_kv_cfg_t cfg = {};
+    memcpy(cfg.seed, s_kv_seed, TAL_LV_KEY_LEN);
+    memcpy(cfg.key, s_kv_key, TAL_LV_KEY_LEN);
+    return tal_kv_init(&cfg);
+}
+
+class TalKvTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        // commits and compaction of the log engine run on the system workqueue
+        ASSERT_EQ(OPRT_OK, tal_workq_init());
+        ASSERT_EQ(OPRT_OK, kv_init());
+    }
+
+    static void TearDownTestSuite()
+    {
+        // other suites of this binary mount the store again
+        tal_kv_deinit();
+    }
+};
+
+std::atomic<uint32_t> s_alloc_cnt(0);
+
+void *count_malloc(size_t size)
+{
+    s_alloc_cnt++;
+    return tkl_system_malloc(size);
+}
+
+void *count_calloc(size_t nitems, size_t size)
+{
+    s_alloc_cnt++;
+    return tkl_system_calloc(nitems, size);
+}
+
+std::string kv_value(const char *key)
+{
+    uint8_t *value = NULL;
+    size_t length = 0;
+
+    if (OPRT_OK != tal_kv_get(key, &value, &length)) {
+        return "";
+    }
+    std::string out((const char *)value, length);
+    tal_kv_free(value);
+    return out;
+}
+
+} // namespace
+
+TEST_F(TalKvTest, SetThenGet)
+{
+    const char *value = "ut-value";
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.set", (const uint8_t *)value, strlen(value)));
+    EXPECT_EQ(value, kv_value("ut.set"));
+}
+
+TEST_F(TalKvTest, FlushCommitsPendingWrites)
+{
+    char key[16], value[32];
+
+    for (int i = 0; i < 20; i++) {
+        snprintf(key, sizeof(key), "ut.flush%d", i);
+        int len = snprintf(value, sizeof(value), "value-%d", i);
+        ASSERT_EQ(OPRT_OK, tal_kv_set(key, (const uint8_t *)value, len));
+    }
+    // what a reboot path does right before tal_system_reset()
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+
+    for (int i = 0; i < 20; i++) {
+        snprintf(key, sizeof(key), "ut.flush%d", i);
+        snprintf(value, sizeof(value), "value-%d", i);
+        EXPECT_EQ(value, kv_value(key)) << key;
+    }
+}
+
+TEST_F(TalKvTest, DeleteThenFlush)
+{
+    const char *value = "gone";
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.del", (const uint8_t *)value, strlen(value)));
+    ASSERT_EQ(OPRT_OK, tal_kv_del("ut.del"));
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+    EXPECT_EQ("", kv_value("ut.del"));
+}
+
+TEST_F(TalKvTest, GetIntoCallerBuffer)
+{
+    const char *value = "a value that spans more than one aes block";
+    char buf[64];
+    size_t out_len = 0;
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.into", (const uint8_t *)value, strlen(value)));
+
+    memset(buf, 0, sizeof(buf));
+    ASSERT_EQ(OPRT_OK, tal_kv_get_into("ut.into", (uint8_t *)buf, sizeof(buf), &out_len));
+    EXPECT_EQ(strlen(value), out_len);
+    EXPECT_EQ(0, memcmp(buf, value, out_len));
+
+    // cached and uncached reads agree
+    out_len = 0;
+    ASSERT_EQ(OPRT_OK, tal_kv_get_into("ut.into", (uint8_t *)buf, sizeof(buf), &out_len));
+    EXPECT_EQ(strlen(value), out_len);
+    EXPECT_EQ(0, memcmp(buf, value, out_len));
+
+    EXPECT_NE(OPRT_OK, tal_kv_get_into("ut.into.none", (uint8_t *)buf, sizeof(buf), &out_len));
+}
+
+TEST_F(TalKvTest, GetIntoShortBuffer)
+{
+    const char *value = "0123456789abcdefghijklmnopqrstuvwxyz";
+    char buf[8];
+    size_t out_len = 0;
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.short", (const uint8_t *)value, strlen(value)));
+    EXPECT_EQ(OPRT_BUFFER_NOT_ENOUGH, tal_kv_get_into("ut.short", (uint8_t *)buf, sizeof(buf), &out_len));
+    EXPECT_EQ(strlen(value), out_len);
+}
+
+TEST_F(TalKvTest, WriteThroughInvalidation)
+{
+    char buf[32];
+    size_t out_len = 0;
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.wt", (const uint8_t *)"first", 5));
+    ASSERT_EQ(OPRT_OK, tal_kv_get_into("ut.wt", (uint8_t *)buf, sizeof(buf), &out_len));
+    EXPECT_EQ("first", std::string(buf, out_len));
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.wt", (const uint8_t *)"second value", 12));
+    ASSERT_EQ(OPRT_OK, tal_kv_get_into("ut.wt", (uint8_t *)buf, sizeof(buf), &out_len));
+    EXPECT_EQ("second value", std::string(buf, out_len));
+    EXPECT_EQ("second value", kv_value("ut.wt"));
+
+    ASSERT_EQ(OPRT_OK, tal_kv_del("ut.wt"));
+    EXPECT_NE(OPRT_OK, tal_kv_get_into("ut.wt", (uint8_t *)buf, sizeof(buf), &out_len));
+    EXPECT_EQ("", kv_value("ut.wt"));
+}
+
+TEST_F(TalKvTest, BenchGetVsGetInto)
+{
+    const int loops = 2000;
+    char value[64];
+    char buf[sizeof(value) + 16];
+    size_t out_len = 0;
+
+    memset(value, 'v', sizeof(value));
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.bench", (const uint8_t *)value, sizeof(value)));
+
+    // count the heap allocations of each read path
+    MOCKER(tal_malloc).stubs().will(invoke(count_malloc));
+    MOCKER(tal_calloc).stubs().will(invoke(count_calloc));
+
+    s_alloc_cnt = 0;
+    SYS_TIME_T start = tal_system_get_millisecond();
+    for (int i = 0; i < loops; i++) {
+        uint8_t *out = NULL;
+        size_t len = 0;
+        ASSERT_EQ(OPRT_OK, tal_kv_get("ut.bench", &out, &len));
+        tal_kv_free(out);
+    }
+    SYS_TIME_T get_ms = tal_system_get_millisecond() - start;
+    uint32_t get_allocs = s_alloc_cnt.load();
+
+    s_alloc_cnt = 0;
+    start = tal_system_get_millisecond();
+    for (int i = 0; i < loops; i++) {
+        ASSERT_EQ(OPRT_OK, tal_kv_get_into("ut.bench", (uint8_t *)buf, sizeof(buf), &out_len));
+    }
+    SYS_TIME_T into_ms = tal_system_get_millisecond() - start;
+    uint32_t into_allocs = s_alloc_cnt.load();
+
+    GlobalMockObject::verify();
+
+    printf("[   INFO   ] %d reads, tal_kv_get: %u allocs, %llu ms; tal_kv_get_into: %u allocs, %llu ms\n", loops,
+           get_allocs, (unsigned long long)get_ms, into_allocs, (unsigned long long)into_ms);
+    // tal_kv_get returns a new buffer per read, tal_kv_get_into none
+    EXPECT_GE(get_allocs, (uint32_t)loops);
+    EXPECT_LT(into_allocs, get_allocs / 2);
+    EXPECT_LE(into_ms, get_ms + 5);
+}
+
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+
+TEST_F(TalKvTest, CacheIsWrittenThroughAndFilledOnRead)
+{
+    char buf[32];
+    size_t out_len = 0;
+    uint32_t gen = 0;
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.cache", (const uint8_t *)"cached", 6));
+    ASSERT_EQ(OPRT_OK, kv_cache_get("ut.cache", (uint8_t *)buf, sizeof(buf), &out_len, &gen));
+    EXPECT_EQ("cached", std::string(buf, out_len));
+
+    ASSERT_EQ(OPRT_OK, tal_kv_del("ut.cache"));
+    EXPECT_EQ(OPRT_NOT_FOUND, kv_cache_get("ut.cache", (uint8_t *)buf, sizeof(buf), &out_len, &gen));
+
+    // a read after a reboot misses, goes to flash and fills the cache
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.cache", (const uint8_t *)"from flash", 10));
+    ASSERT_EQ(OPRT_OK, tal_kv_deinit());
+    ASSERT_EQ(OPRT_OK, kv_init());
+    EXPECT_EQ(OPRT_NOT_FOUND, kv_cache_get("ut.cache", (uint8_t *)buf, sizeof(buf), &out_len, &gen));
+    ASSERT_EQ(OPRT_OK, tal_kv_get_into("ut.cache", (uint8_t *)buf, sizeof(buf), &out_len));
+    ASSERT_EQ(OPRT_OK, kv_cache_get("ut.cache", (uint8_t *)buf, sizeof(buf), &out_len, &gen));
+    EXPECT_EQ("from flash", std::string(buf, out_len));
+}
+
+TEST_F(TalKvTest, ConcurrentSetsLeaveCacheEqualToFlash)
+{
+    char buf[32];
+    size_t out_len = 0;
+    uint32_t gen = 0;
+
+    for (int round = 0; round < 5; round++) {
+        auto writer = [](const char *prefix) {
+            char value[16];
+            for (int i = 0; i < 100; i++) {
+                int len = snprintf(value, sizeof(value), "%s-%d", prefix, i);
+                tal_kv_set("ut.race", (const uint8_t *)value, len);
+            }
+        };
+        std::thread a(writer, "a");
+        std::thread b(writer, "b");
+        a.join();
+        b.join();
+
+        ASSERT_EQ(OPRT_OK, kv_cache_get("ut.race", (uint8_t *)buf, sizeof(buf), &out_len, &gen));
+        std::string cached(buf, out_len);
+
+        // the cache is dropped on unmount, the next read comes from flash
+        ASSERT_EQ(OPRT_OK, tal_kv_deinit());
+        ASSERT_EQ(OPRT_OK, kv_init());
+        EXPECT_EQ(cached, kv_value("ut.race")) << "round " << round;
+    }
+}
+
+#endif
+
+#if defined(ENABLE_KV_LOG_ENGINE) && (ENABLE_KV_LOG_ENGINE == 1)
+
+#ifndef KV_LOG_COMPACT_SIZE
+#define KV_LOG_COMPACT_SIZE (32 * 1024)
+#endif
+
+namespace {
+
+lfs_soff_t kv_log_file_size()
+{
+    struct lfs_info info;
+
+    if (LFS_ERR_OK != lfs_stat(tal_lfs_get(), "kv.log", &info)) {
+        return -1;
+    }
+    return info.size;
+}
+
+// block device of the flash simulator: counts what littlefs programs and erases
+uint32_t s_prog_bytes = 0;
+uint32_t s_erase_cnt = 0;
+
+int count_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size)
+{
+    s_prog_bytes += size;
+    return user_provided_block_device_prog(c, block, off, buffer, size);
+}
+
+int count_erase(const struct lfs_config *c, lfs_block_t block)
+{
+    s_erase_cnt++;
+    return user_provided_block_device_erase(c, block);
+}
+
+// a per-key file as tal_kv wrote it before the log engine
+void write_legacy(const char *key, const char *value)
+{
+    uint8_t aes_key[32], iv[32], data[64];
+    lfs_file_t file;
+
+    tal_sha256_ret((const uint8_t *)s_kv_key, TAL_LV_KEY_LEN, aes_key, 0);
+    tal_sha256_ret((const uint8_t *)s_kv_seed, TAL_LV_KEY_LEN, iv, 0);
+    size_t len = strlen(value);
+    size_t pad = 16 - len % 16;
+    memcpy(data, value, len);
+    memset(data + len, (int)pad, pad);
+    len += pad;
+    ASSERT_EQ(OPRT_OK, tal_aes128_cbc_encode_raw(data, len, aes_key, iv, data));
+    ASSERT_EQ(LFS_ERR_OK, lfs_file_open(tal_lfs_get(), &file, key, LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC));
+    ASSERT_EQ((lfs_ssize_t)len, lfs_file_write(tal_lfs_get(), &file, data, len));
+    ASSERT_EQ(LFS_ERR_OK, lfs_file_close(tal_lfs_get(), &file));
+}
+
+bool legacy_exists(const char *key)
+{
+    struct lfs_info info;
+    return LFS_ERR_OK == lfs_stat(tal_lfs_get(), key, &info);
+}
+
+// runs a write once the per-key file is read and decrypted, before it is moved into the log
+void (*s_on_legacy_read)(void) = NULL;
+
+int32_t legacy_read_len(uint8_t *dec_data, uint32_t dec_data_len)
+{
+    if (s_on_legacy_read) {
+        void (*write)(void) = s_on_legacy_read;
+        s_on_legacy_read = NULL;
+        write();
+    }
+    uint8_t pad = dec_data[dec_data_len - 1];
+    if (0 == pad || pad > 16 || pad > dec_data_len) {
+        return -1;
+    }
+    return (int32_t)(dec_data_len - pad);
+}
+
+} // namespace
+
+TEST_F(TalKvTest, LegacyFileIsMovedIntoLog)
+{
+    write_legacy("ut.lg.move", "legacy");
+    EXPECT_EQ("legacy", kv_value("ut.lg.move"));
+    EXPECT_FALSE(legacy_exists("ut.lg.move"));
+
+    ASSERT_EQ(OPRT_OK, tal_kv_deinit());
+    ASSERT_EQ(OPRT_OK, kv_init());
+    EXPECT_EQ("legacy", kv_value("ut.lg.move"));
+}
+
+TEST_F(TalKvTest, SetDuringLegacyReadIsKept)
+{
+    write_legacy("ut.lg.set", "legacy");
+    MOCKER(tal_aes_get_actual_length).stubs().will(invoke(legacy_read_len));
+    s_on_legacy_read = [] { ASSERT_EQ(OPRT_OK, tal_kv_set("ut.lg.set", (const uint8_t *)"newer", 5)); };
+
+    // the read came first, the set after it is not overwritten by the migration
+    EXPECT_EQ("legacy", kv_value("ut.lg.set"));
+    GlobalMockObject::verify();
+    EXPECT_EQ("newer", kv_value("ut.lg.set"));
+    EXPECT_FALSE(legacy_exists("ut.lg.set"));
+
+    ASSERT_EQ(OPRT_OK, tal_kv_deinit());
+    ASSERT_EQ(OPRT_OK, kv_init());
+    EXPECT_EQ("newer", kv_value("ut.lg.set"));
+}
+
+TEST_F(TalKvTest, DelDuringLegacyReadIsKept)
+{
+    char buf[32];
+    size_t out_len = 0;
+
+    write_legacy("ut.lg.del", "legacy");
+    MOCKER(tal_aes_get_actual_length).stubs().will(invoke(legacy_read_len));
+    s_on_legacy_read = [] { ASSERT_EQ(OPRT_OK, tal_kv_del("ut.lg.del")); };
+
+    EXPECT_EQ(OPRT_OK, tal_kv_get_into("ut.lg.del", (uint8_t *)buf, sizeof(buf), &out_len));
+    GlobalMockObject::verify();
+    EXPECT_EQ("", kv_value("ut.lg.del"));
+
+    ASSERT_EQ(OPRT_OK, tal_kv_deinit());
+    ASSERT_EQ(OPRT_OK, kv_init());
+    EXPECT_EQ("", kv_value("ut.lg.del"));
+}
+
+TEST_F(TalKvTest, ReloadAfterReboot)
+{
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.rb.a", (const uint8_t *)"old", 3));
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.rb.b", (const uint8_t *)"kept", 4));
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.rb.c", (const uint8_t *)"gone", 4));
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+    // left in the batch, tal_kv_deinit commits it
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.rb.a", (const uint8_t *)"new", 3));
+    ASSERT_EQ(OPRT_OK, tal_kv_del("ut.rb.c"));
+
+    ASSERT_EQ(OPRT_OK, tal_kv_deinit());
+    ASSERT_EQ(OPRT_OK, kv_init());
+
+    EXPECT_EQ("new", kv_value("ut.rb.a"));
+    EXPECT_EQ("kept", kv_value("ut.rb.b"));
+    EXPECT_EQ("", kv_value("ut.rb.c"));
+}
+
+TEST_F(TalKvTest, TornTailRecordIsDropped)
+{
+    lfs_file_t file;
+    // a record head with the right magic whose body never made it to flash
+    const uint8_t torn[] = {0x56, 0x4B, 0x01, 0x07, 0x40, 0x00, 0x00, 0x00, 0xde, 0xad, 0xbe, 0xef, 'u', 't', '.'};
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.torn", (const uint8_t *)"before", 6));
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+    lfs_soff_t size = kv_log_file_size();
+    ASSERT_GT(size, 0);
+
+    ASSERT_EQ(LFS_ERR_OK, lfs_file_open(tal_lfs_get(), &file, "kv.log", LFS_O_WRONLY | LFS_O_APPEND));
+    ASSERT_EQ((lfs_ssize_t)sizeof(torn), lfs_file_write(tal_lfs_get(), &file, torn, sizeof(torn)));
+    ASSERT_EQ(LFS_ERR_OK, lfs_file_close(tal_lfs_get(), &file));
+
+    ASSERT_EQ(OPRT_OK, tal_kv_deinit());
+    ASSERT_EQ(OPRT_OK, kv_init());
+
+    EXPECT_EQ(size, kv_log_file_size());
+    EXPECT_EQ("before", kv_value("ut.torn"));
+
+    // records appended after the truncation survive the next reboot
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.torn", (const uint8_t *)"after", 5));
+    ASSERT_EQ(OPRT_OK, tal_kv_deinit());
+    ASSERT_EQ(OPRT_OK, kv_init());
+    EXPECT_EQ("after", kv_value("ut.torn"));
+}
+
+TEST_F(TalKvTest, CompactionKeepsLiveValues)
+{
+    char value[200];
+    char key[16];
+    int i = 0;
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("ut.cp.keep", (const uint8_t *)"keep", 4));
+    // overwrite a few keys until the log is mostly stale records
+    int writes = 3 * KV_LOG_COMPACT_SIZE / (int)sizeof(value);
+    for (i = 0; i < writes; i++) {
+        snprintf(key, sizeof(key), "ut.cp%d", i % 4);
+        memset(value, 'a' + i % 26, sizeof(value));
+        ASSERT_EQ(OPRT_OK, tal_kv_set(key, (const uint8_t *)value, sizeof(value)));
+    }
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+
+    // compaction runs on the workqueue shortly after the commit
+    for (i = 0; i < 50 && kv_log_file_size() >= KV_LOG_COMPACT_SIZE; i++) {
+        tal_system_sleep(100);
+    }
+    EXPECT_LT(kv_log_file_size(), KV_LOG_COMPACT_SIZE);
+
+    EXPECT_EQ("keep", kv_value("ut.cp.keep"));
+    for (i = writes - 4; i < writes; i++) {
+        snprintf(key, sizeof(key), "ut.cp%d", i % 4);
+        memset(value, 'a' + i % 26, sizeof(value));
+        EXPECT_EQ(std::string(value, sizeof(value)), kv_value(key)) << key;
+    }
+
+    // and the compacted log loads again
+    ASSERT_EQ(OPRT_OK, tal_kv_deinit());
+    ASSERT_EQ(OPRT_OK, kv_init());
+    EXPECT_EQ("keep", kv_value("ut.cp.keep"));
+    i = writes - 1;
+    snprintf(key, sizeof(key), "ut.cp%d", i % 4);
+    memset(value, 'a' + i % 26, sizeof(value));
+    EXPECT_EQ(std::string(value, sizeof(value)), kv_value(key));
+}
+
+TEST_F(TalKvTest, BenchmarkFlashWritesLogVsPerKeyFiles)
+{
+    const int writes = 200;
+    const int keys = 10;
+    const int burst = 8; // writes that fall into one commit window
+    struct lfs_config cfg;
+    lfs_t sim;
+    lfs_file_t file;
+    MUTEX_HANDLE mutex = NULL;
+    uint8_t value[48]; // 32-byte value as stored, aes padded
+    uint8_t aes_key[16] = {0}, iv[16] = {0};
+    char key[16];
+    int i = 0;
+
+    ASSERT_EQ(OPRT_OK, tal_kv_deinit());
+    cfg = *tal_lfs_get()->cfg;
+    cfg.prog = count_prog;
+    cfg.erase = count_erase;
+    ASSERT_EQ(LFS_ERR_OK, lfs_mount(&sim, &cfg));
+    ASSERT_EQ(OPRT_OK, tal_mutex_create_init(&mutex));
+
+    // one littlefs file per key, what tal_kv does without the log engine
+    s_prog_bytes = s_erase_cnt = 0;
+    for (i = 0; i < writes; i++) {
+        snprintf(key, sizeof(key), "ut.fb%d", i % keys);
+        memset(value, i, sizeof(value));
+        ASSERT_EQ(LFS_ERR_OK, lfs_file_open(&sim, &file, key, LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC));
+        ASSERT_EQ((lfs_ssize_t)sizeof(value), lfs_file_write(&sim, &file, value, sizeof(value)));
+        ASSERT_EQ(LFS_ERR_OK, lfs_file_close(&sim, &file));
+    }
+    uint32_t file_prog = s_prog_bytes, file_erase = s_erase_cnt;
+    for (i = 0; i < keys; i++) {
+        snprintf(key, sizeof(key), "ut.fb%d", i);
+        lfs_remove(&sim, key);
+    }
+
+    // the log engine, one commit per burst
+    ASSERT_EQ(OPRT_OK, kv_log_init(&sim, mutex, aes_key, iv));
+    s_prog_bytes = s_erase_cnt = 0;
+    for (i = 0; i < writes; i++) {
+        snprintf(key, sizeof(key), "ut.fb%d", i % keys);
+        memset(value, i, sizeof(value));
+        ASSERT_EQ(OPRT_OK, kv_log_set(key, value, 32, NULL));
+        if (burst - 1 == i % burst) {
+            ASSERT_EQ(OPRT_OK, kv_log_flush());
+        }
+    }
+    ASSERT_EQ(OPRT_OK, kv_log_flush());
+    uint32_t log_prog = s_prog_bytes, log_erase = s_erase_cnt;
+    for (i = 0; i < keys; i++) {
+        snprintf(key, sizeof(key), "ut.fb%d", i);
+        kv_log_del(key);
+    }
+    ASSERT_EQ(OPRT_OK, kv_log_deinit());
+
+    lfs_unmount(&sim);
+    tal_mutex_release(mutex);
+    ASSERT_EQ(OPRT_OK, kv_init());
+
+    printf("[   INFO   ] %d writes of %d keys, per-key files: %u bytes programmed, %u erases\n", writes, keys,
+           file_prog, file_erase);
+    printf("[   INFO   ] log engine, commit every %d writes: %u bytes programmed, %u erases\n", burst, log_prog,
+           log_erase);
+    EXPECT_LT(log_prog, file_prog);
+}
+
+#endif
@@ -358,6 +358,19 @@ OPERATE_RET tal_sha256_mac_update(tal_hash_mac_context_t *hmac_handle, const uin
  * tuya_error_code.h
  */
 OPERATE_RET tal_sha256_mac_finish(tal_hash_mac_context_t *hmac_handle, uint8_t *output);
+/**
+ * @brief This function prepares a sha256 mac context for a new message
+ *                 with the key given to tal_sha256_mac_starts.
+ *
+ * @param[in] hmac_handle: The context to use. This must have been started.
+ *
+ * @note This API is used to mac many messages with one key, call it after
+ *       tal_sha256_mac_finish instead of tal_sha256_mac_starts.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_sha256_mac_reset(tal_hash_mac_context_t *hmac_handle);
 
 /**
  * @brief          This function calculates the SHA-256 MAC
@@ -449,6 +462,19 @@ OPERATE_RET tal_sha1_mac_update(tal_hash_mac_context_t *hmac_handle, const uint8
  * tuya_error_code.h
  */
 OPERATE_RET tal_sha1_mac_finish(tal_hash_mac_context_t *hmac_handle, uint8_t *output);
+/**
+ * @brief This function prepares a sha1 mac context for a new message
+ *                 with the key given to tal_sha1_mac_starts.
+ *
+ * @param[in] hmac_handle: The context to use. This must have been started.
+ *
+ * @note This API is used to mac many messages with one key, call it after
+ *       tal_sha1_mac_finish instead of tal_sha1_mac_starts.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_sha1_mac_reset(tal_hash_mac_context_t *hmac_handle);
 
 /**
  * @brief          This function calculates the SHA-256 MAC
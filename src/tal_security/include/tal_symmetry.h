@@ -37,6 +37,18 @@ typedef enum {
     SYMMETRY_ENCRYPT = 1,
 } TAL_SYMMETRY_CRYPT_MODE;
 
+/**
+ * @brief AES key handle, holds the expanded encryption and decryption keys so
+ * many blocks can be processed with one key without setting it up again.
+ *
+ * Encrypting and decrypting do not modify the handle, one handle can be used
+ * from several threads.
+ */
+typedef struct {
+    TKL_SYMMETRY_HANDLE enc;
+    TKL_SYMMETRY_HANDLE dec;
+} tal_aes_key_t;
+
 /**
  * @brief This function Create&initializes a aes context.
  *
@@ -423,6 +435,59 @@ OPERATE_RET tal_aes_free_data(uint8_t *data);
  */
 OPERATE_RET tal_aes_self_test(int32_t verbose);
 
+/**
+ * @brief This function creates an AES key handle and sets its key.
+ *
+ * @param[out] aes_key: The key handle to initialize.
+ * @param[in] key: The AES key.
+ * @param[in] keybits: The key size in bits, 128, 192 or 256.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_aes_key_init(tal_aes_key_t *aes_key, const uint8_t *key, uint32_t keybits);
+
+/**
+ * @brief This function releases an AES key handle.
+ *
+ * @param[in] aes_key: The key handle to release.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_aes_key_free(tal_aes_key_t *aes_key);
+
+/**
+ * @brief This function performs an AES-ECB operation with a key handle.
+ *
+ * @param[in] aes_key: The key handle.
+ * @param[in] mode: SYMMETRY_ENCRYPT or SYMMETRY_DECRYPT.
+ * @param[in] length: The data length, a multiple of 16.
+ * @param[in] input: The input data.
+ * @param[out] output: The output data, may be the same as input.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_aes_key_crypt_ecb(tal_aes_key_t *aes_key, int32_t mode, size_t length, const uint8_t *input,
+                                  uint8_t *output);
+
+/**
+ * @brief This function performs an AES-CBC operation with a key handle.
+ *
+ * @param[in] aes_key: The key handle.
+ * @param[in] mode: SYMMETRY_ENCRYPT or SYMMETRY_DECRYPT.
+ * @param[in] length: The data length, a multiple of 16.
+ * @param[in,out] iv: The initialization vector, updated like tal_aes_crypt_cbc.
+ * @param[in] input: The input data.
+ * @param[out] output: The output data, may be the same as input.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_aes_key_crypt_cbc(tal_aes_key_t *aes_key, int32_t mode, size_t length, uint8_t iv[16],
+                                  const uint8_t *input, uint8_t *output);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -30,6 +30,7 @@
 #include "tkl_symmetry.h"
 #if !defined(ENABLE_PLATFORM_AES)
 #include "mbedtls/aes.h"
+#include "aes_accel.h"
 #endif
 
 #if !defined(ENABLE_PLATFORM_AES)
@@ -145,6 +146,13 @@ OPERATE_RET  tkl_aes_crypt_ecb( TKL_SYMMETRY_HANDLE ctx,
     if( (length % 16) != 0)
         return OPRT_INVALID_PARM;
 
+#if defined(MBEDTLS_AES_ACCEL_C)
+    if( aes_accel_supported() ){
+        aes_accel_crypt_ecb( (mbedtls_aes_context *)ctx,mode,length,input,output );
+        return OPRT_OK;
+    }
+#endif
+
     for(i = 0;i < length;i += 16){
         if( mbedtls_aes_crypt_ecb( (mbedtls_aes_context *)ctx,mode,input + i,output + i) != 0)
             return OPRT_COM_ERROR;
@@ -195,6 +203,15 @@ OPERATE_RET  tkl_aes_crypt_cbc( TKL_SYMMETRY_HANDLE ctx,
                     const uint8_t *input,
                     uint8_t *output )
 {
+#if defined(MBEDTLS_AES_ACCEL_C)
+    if( aes_accel_supported() ){
+        if( aes_accel_crypt_cbc( (mbedtls_aes_context *)ctx,mode,length,iv,input,output ) != 0)
+            return OPRT_COM_ERROR;
+
+        return OPRT_OK;
+    }
+#endif
+
     if( mbedtls_aes_crypt_cbc( (mbedtls_aes_context *)ctx,mode,length,iv,input,output ) != 0)
         return OPRT_COM_ERROR;
 
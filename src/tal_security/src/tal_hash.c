@@ -574,6 +574,28 @@ exit:
 
     return ret;
 }
+/**
+ * @brief This function prepares a sha256 mac context for a new message
+ *                 with the key given to tal_sha256_mac_starts.
+ *
+ * @param[in] hmac_handle: The context to use. This must have been started.
+ *
+ * @note The padded key is kept in the context, so this only hashes the
+ *       inner pad again instead of processing the key.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_sha256_mac_reset(tal_hash_mac_context_t *hmac_handle)
+{
+    OPERATE_RET ret = OPRT_COM_ERROR;
+
+    if ((ret = tal_sha256_starts_ret(hmac_handle->ctx, 0)) != OPRT_OK) {
+        return ret;
+    }
+
+    return tal_sha256_update_ret(hmac_handle->ctx, hmac_handle->ipad, 64);
+}
 /**
  * @brief          This function calculates the SHA-256 MAC
  *                 checksum of a buffer.
@@ -783,6 +805,28 @@ exit:
 
     return ret;
 }
+/**
+ * @brief This function prepares a sha1 mac context for a new message
+ *                 with the key given to tal_sha1_mac_starts.
+ *
+ * @param[in] hmac_handle: The context to use. This must have been started.
+ *
+ * @note The padded key is kept in the context, so this only hashes the
+ *       inner pad again instead of processing the key.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_sha1_mac_reset(tal_hash_mac_context_t *hmac_handle)
+{
+    OPERATE_RET ret = OPRT_COM_ERROR;
+
+    if ((ret = tal_sha1_starts_ret(hmac_handle->ctx)) != OPRT_OK) {
+        return ret;
+    }
+
+    return tal_sha1_update_ret(hmac_handle->ctx, hmac_handle->ipad, 64);
+}
 /**
  * @brief          This function calculates the SHA-256 MAC
  *                 checksum of a buffer.
@@ -729,6 +729,126 @@ OPERATE_RET tal_aes_free_data(uint8_t *data)
     return OPRT_OK;
 }
 
+/**
+ * @brief This function creates an AES key handle and sets its key.
+ *
+ * Both key schedules are expanded here once, the one-shot helpers above
+ * expand one for every call.
+ *
+ * @param[out] aes_key: The key handle to initialize.
+ * @param[in] key: The AES key.
+ * @param[in] keybits: The key size in bits, 128, 192 or 256.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_aes_key_init(tal_aes_key_t *aes_key, const uint8_t *key, uint32_t keybits)
+{
+    OPERATE_RET ret;
+
+    if (aes_key == NULL || key == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+    memset(aes_key, 0, sizeof(tal_aes_key_t));
+
+    if ((ret = tal_aes_create_init(&aes_key->enc)) != OPRT_OK) {
+        goto exit;
+    }
+
+    if ((ret = tal_aes_setkey_enc(aes_key->enc, (uint8_t *)key, keybits)) != OPRT_OK) {
+        goto exit;
+    }
+
+    if ((ret = tal_aes_create_init(&aes_key->dec)) != OPRT_OK) {
+        goto exit;
+    }
+
+    if ((ret = tal_aes_setkey_dec(aes_key->dec, (uint8_t *)key, keybits)) != OPRT_OK) {
+        goto exit;
+    }
+
+    return OPRT_OK;
+
+exit:
+    tal_aes_key_free(aes_key);
+
+    return (ret);
+}
+
+/**
+ * @brief This function releases an AES key handle.
+ *
+ * @param[in] aes_key: The key handle to release.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_aes_key_free(tal_aes_key_t *aes_key)
+{
+    if (aes_key == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+
+    if (aes_key->enc) {
+        tal_aes_free(aes_key->enc);
+    }
+    if (aes_key->dec) {
+        tal_aes_free(aes_key->dec);
+    }
+    memset(aes_key, 0, sizeof(tal_aes_key_t));
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief This function performs an AES-ECB operation with a key handle.
+ *
+ * @param[in] aes_key: The key handle.
+ * @param[in] mode: SYMMETRY_ENCRYPT or SYMMETRY_DECRYPT.
+ * @param[in] length: The data length, a multiple of 16.
+ * @param[in] input: The input data.
+ * @param[out] output: The output data, may be the same as input.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_aes_key_crypt_ecb(tal_aes_key_t *aes_key, int32_t mode, size_t length, const uint8_t *input,
+                                  uint8_t *output)
+{
+    TKL_SYMMETRY_HANDLE ctx = (SYMMETRY_ENCRYPT == mode) ? aes_key->enc : aes_key->dec;
+
+    if (ctx == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+
+    return tal_aes_crypt_ecb(ctx, mode, length, (uint8_t *)input, output);
+}
+
+/**
+ * @brief This function performs an AES-CBC operation with a key handle.
+ *
+ * @param[in] aes_key: The key handle.
+ * @param[in] mode: SYMMETRY_ENCRYPT or SYMMETRY_DECRYPT.
+ * @param[in] length: The data length, a multiple of 16.
+ * @param[in,out] iv: The initialization vector, updated like tal_aes_crypt_cbc.
+ * @param[in] input: The input data.
+ * @param[out] output: The output data, may be the same as input.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_aes_key_crypt_cbc(tal_aes_key_t *aes_key, int32_t mode, size_t length, uint8_t iv[16],
+                                  const uint8_t *input, uint8_t *output)
+{
+    TKL_SYMMETRY_HANDLE ctx = (SYMMETRY_ENCRYPT == mode) ? aes_key->enc : aes_key->dec;
+
+    if (ctx == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+
+    return tal_aes_crypt_cbc(ctx, mode, length, iv, (uint8_t *)input, output);
+}
+
 #if defined(ENABLE_TAL_SECURITY_SELF_TEST)
 /*
  * AES test vectors from:
@@ -0,0 +1,288 @@
+/**
+ * @file test_tal_crypto_key.cpp
+ * @brief known answers and benchmark of the keyed AES and HMAC handles
+ *
+ * tal_aes_key_* and tal_sha256_mac_reset/tal_sha1_mac_reset must give the
+ * same bytes as the one-shot helpers that set up a key for every call.
+ */
+#include <chrono>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_symmetry.h"
+#include "tal_hash.h"
+
+namespace {
+
+std::vector<uint8_t> unhex(const char *hex)
+{
+    std::vector<uint8_t> out;
+    for (; hex[0] && hex[1]; hex += 2) {
+        out.push_back((uint8_t)strtoul(std::string(hex, 2).c_str(), NULL, 16));
+    }
+    return out;
+}
+
+// cycles on x86, nanoseconds elsewhere
+const char *TICK_UNIT =
+#if defined(__x86_64__) || defined(__i386__)
+    "cycles";
+#else
+    "ns";
+#endif
+
+uint64_t ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+// ticks of one call, the best of a few rounds to skip scheduling noise
+template <typename F> double ticks_per_call(F fn, int calls)
+{
+    double best = 0;
+
+    for (int round = 0; round < 3; round++) {
+        uint64_t start = ticks();
+        for (int i = 0; i < calls; i++) {
+            fn();
+        }
+        double cost = (double)(ticks() - start) / calls;
+        if (0 == round || cost < best) {
+            best = cost;
+        }
+    }
+    return best;
+}
+
+const size_t BENCH_SIZES[] = {16, 64, 256, 1024, 4096};
+
+void print_row(const char *name, size_t size, double keyed, double one_shot)
+{
+    printf("[   INFO   ] %-12s %5zu bytes: keyed %8.1f %s/call %6.2f %s/byte, one-shot %8.1f %s/call %6.2f %s/byte, "
+           "overhead %8.1f %s/call\n",
+           name, size, keyed, TICK_UNIT, keyed / size, TICK_UNIT, one_shot, TICK_UNIT, one_shot / size, TICK_UNIT,
+           one_shot - keyed, TICK_UNIT);
+}
+
+} // namespace
+
+TEST(TalCryptoKey, AesEcbKnownAnswerAndOneShot)
+{
+    // FIPS-197 appendix C.1
+    std::vector<uint8_t> key = unhex("000102030405060708090a0b0c0d0e0f");
+    std::vector<uint8_t> pt = unhex("00112233445566778899aabbccddeeff");
+    std::vector<uint8_t> ct = unhex("69c4e0d86a7b0430d8cdb78070b4c55a");
+    tal_aes_key_t aes_key = {};
+    uint8_t out[16], one_shot[16];
+
+    ASSERT_EQ(OPRT_OK, tal_aes_key_init(&aes_key, key.data(), 128));
+    ASSERT_EQ(OPRT_OK, tal_aes_key_crypt_ecb(&aes_key, SYMMETRY_ENCRYPT, 16, pt.data(), out));
+    EXPECT_EQ(ct, std::vector<uint8_t>(out, out + 16));
+    ASSERT_EQ(OPRT_OK, tal_aes_key_crypt_ecb(&aes_key, SYMMETRY_DECRYPT, 16, ct.data(), out));
+    EXPECT_EQ(pt, std::vector<uint8_t>(out, out + 16));
+
+    // the same handle again and again agrees with a fresh key every call
+    uint8_t block[16];
+    for (int i = 0; i < 64; i++) {
+        memset(block, i * 7, sizeof(block));
+        ASSERT_EQ(OPRT_OK, tal_aes_key_crypt_ecb(&aes_key, SYMMETRY_ENCRYPT, 16, block, out));
+        ASSERT_EQ(OPRT_OK, tal_aes128_ecb_encode_raw(block, 16, one_shot, key.data()));
+        ASSERT_EQ(0, memcmp(out, one_shot, 16)) << i;
+        ASSERT_EQ(OPRT_OK, tal_aes_key_crypt_ecb(&aes_key, SYMMETRY_DECRYPT, 16, out, out));
+        ASSERT_EQ(0, memcmp(out, block, 16)) << i;
+    }
+
+    tal_aes_key_free(&aes_key);
+}
+
+TEST(TalCryptoKey, AesCbcKnownAnswerAndOneShot)
+{
+    // NIST SP 800-38A F.2.1, first two blocks
+    std::vector<uint8_t> key = unhex("2b7e151628aed2a6abf7158809cf4f3c");
+    std::vector<uint8_t> iv0 = unhex("000102030405060708090a0b0c0d0e0f");
+    std::vector<uint8_t> pt = unhex("6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51");
+    std::vector<uint8_t> ct = unhex("7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b2");
+    tal_aes_key_t aes_key = {};
+    uint8_t iv[16];
+    std::vector<uint8_t> out(pt.size());
+
+    ASSERT_EQ(OPRT_OK, tal_aes_key_init(&aes_key, key.data(), 128));
+    memcpy(iv, iv0.data(), 16);
+    ASSERT_EQ(OPRT_OK, tal_aes_key_crypt_cbc(&aes_key, SYMMETRY_ENCRYPT, pt.size(), iv, pt.data(), out.data()));
+    EXPECT_EQ(ct, out);
+    memcpy(iv, iv0.data(), 16);
+    ASSERT_EQ(OPRT_OK, tal_aes_key_crypt_cbc(&aes_key, SYMMETRY_DECRYPT, ct.size(), iv, ct.data(), out.data()));
+    EXPECT_EQ(pt, out);
+
+    // the iv is chained like tal_aes_crypt_cbc, two calls give the same as one
+    memcpy(iv, iv0.data(), 16);
+    ASSERT_EQ(OPRT_OK, tal_aes_key_crypt_cbc(&aes_key, SYMMETRY_ENCRYPT, 16, iv, pt.data(), out.data()));
+    ASSERT_EQ(OPRT_OK, tal_aes_key_crypt_cbc(&aes_key, SYMMETRY_ENCRYPT, 16, iv, pt.data() + 16, out.data() + 16));
+    EXPECT_EQ(ct, out);
+
+    // in place, against the one-shot helper, for many lengths
+    for (size_t len = 16; len <= 512; len += 48) {
+        std::vector<uint8_t> data(len), one_shot(len);
+        for (size_t i = 0; i < len; i++) {
+            data[i] = (uint8_t)(i * 31 + len);
+        }
+        memcpy(iv, iv0.data(), 16);
+        ASSERT_EQ(OPRT_OK, tal_aes128_cbc_encode_raw(data.data(), len, key.data(), iv, one_shot.data()));
+        memcpy(iv, iv0.data(), 16);
+        std::vector<uint8_t> keyed = data;
+        ASSERT_EQ(OPRT_OK, tal_aes_key_crypt_cbc(&aes_key, SYMMETRY_ENCRYPT, len, iv, keyed.data(), keyed.data()));
+        ASSERT_EQ(one_shot, keyed) << len;
+        memcpy(iv, iv0.data(), 16);
+        ASSERT_EQ(OPRT_OK, tal_aes_key_crypt_cbc(&aes_key, SYMMETRY_DECRYPT, len, iv, keyed.data(), keyed.data()));
+        ASSERT_EQ(data, keyed) << len;
+    }
+
+    tal_aes_key_free(&aes_key);
+}
+
+TEST(TalCryptoKey, HmacSha256ResetThenReuse)
+{
+    // RFC 4231 test cases 1 and 2
+    std::vector<uint8_t> key1(20, 0x0b);
+    const char *msg1 = "Hi There";
+    std::vector<uint8_t> mac1 = unhex("b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7");
+    const char *key2 = "Jefe";
+    const char *msg2 = "what do ya want for nothing?";
+    std::vector<uint8_t> mac2 = unhex("5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+    tal_hash_mac_context_t ctx = {};
+    uint8_t out[32], one_shot[32];
+
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_create_init(&ctx));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_starts(&ctx, key1.data(), key1.size()));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_update(&ctx, (const uint8_t *)msg1, strlen(msg1)));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_finish(&ctx, out));
+    EXPECT_EQ(mac1, std::vector<uint8_t>(out, out + 32));
+
+    // a second message with the same key after a reset
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_reset(&ctx));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_update(&ctx, (const uint8_t *)msg1, strlen(msg1)));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_finish(&ctx, out));
+    EXPECT_EQ(mac1, std::vector<uint8_t>(out, out + 32));
+
+    // a reset drops a message that was not finished
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_reset(&ctx));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_update(&ctx, (const uint8_t *)"abandoned", 9));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_reset(&ctx));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_update(&ctx, (const uint8_t *)msg1, strlen(msg1)));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_finish(&ctx, out));
+    EXPECT_EQ(mac1, std::vector<uint8_t>(out, out + 32));
+
+    // rekeyed with starts, then reset again
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_starts(&ctx, (const uint8_t *)key2, strlen(key2)));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_update(&ctx, (const uint8_t *)msg2, strlen(msg2)));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_finish(&ctx, out));
+    EXPECT_EQ(mac2, std::vector<uint8_t>(out, out + 32));
+
+    // many messages on one context agree with the one-shot helper
+    for (size_t len = 0; len < 300; len += 37) {
+        std::vector<uint8_t> msg(len, (uint8_t)len);
+        ASSERT_EQ(OPRT_OK, tal_sha256_mac_reset(&ctx));
+        ASSERT_EQ(OPRT_OK, tal_sha256_mac_update(&ctx, msg.data(), msg.size()));
+        ASSERT_EQ(OPRT_OK, tal_sha256_mac_finish(&ctx, out));
+        ASSERT_EQ(OPRT_OK, tal_sha256_mac((const uint8_t *)key2, strlen(key2), msg.data(), msg.size(), one_shot));
+        ASSERT_EQ(0, memcmp(out, one_shot, 32)) << len;
+    }
+
+    tal_sha256_mac_free(&ctx);
+}
+
+TEST(TalCryptoKey, HmacSha1ResetThenReuse)
+{
+    // RFC 2202 test cases 1 and 2
+    std::vector<uint8_t> key1(20, 0x0b);
+    const char *msg1 = "Hi There";
+    std::vector<uint8_t> mac1 = unhex("b617318655057264e28bc0b6fb378c8ef146be00");
+    const char *key2 = "Jefe";
+    const char *msg2 = "what do ya want for nothing?";
+    std::vector<uint8_t> mac2 = unhex("effcdf6ae5eb2fa2d27416d5f184df9c259a7c79");
+    tal_hash_mac_context_t ctx = {};
+    uint8_t out[20], one_shot[20];
+
+    ASSERT_EQ(OPRT_OK, tal_sha1_mac_create_init(&ctx));
+    ASSERT_EQ(OPRT_OK, tal_sha1_mac_starts(&ctx, key1.data(), key1.size()));
+    ASSERT_EQ(OPRT_OK, tal_sha1_mac_update(&ctx, (const uint8_t *)msg1, strlen(msg1)));
+    ASSERT_EQ(OPRT_OK, tal_sha1_mac_finish(&ctx, out));
+    EXPECT_EQ(mac1, std::vector<uint8_t>(out, out + 20));
+
+    ASSERT_EQ(OPRT_OK, tal_sha1_mac_reset(&ctx));
+    ASSERT_EQ(OPRT_OK, tal_sha1_mac_update(&ctx, (const uint8_t *)"abandoned", 9));
+    ASSERT_EQ(OPRT_OK, tal_sha1_mac_reset(&ctx));
+    ASSERT_EQ(OPRT_OK, tal_sha1_mac_update(&ctx, (const uint8_t *)msg1, strlen(msg1)));
+    ASSERT_EQ(OPRT_OK, tal_sha1_mac_finish(&ctx, out));
+    EXPECT_EQ(mac1, std::vector<uint8_t>(out, out + 20));
+
+    ASSERT_EQ(OPRT_OK, tal_sha1_mac_starts(&ctx, (const uint8_t *)key2, strlen(key2)));
+    ASSERT_EQ(OPRT_OK, tal_sha1_mac_update(&ctx, (const uint8_t *)msg2, strlen(msg2)));
+    ASSERT_EQ(OPRT_OK, tal_sha1_mac_finish(&ctx, out));
+    EXPECT_EQ(mac2, std::vector<uint8_t>(out, out + 20));
+
+    for (size_t len = 0; len < 300; len += 37) {
+        std::vector<uint8_t> msg(len, (uint8_t)len);
+        ASSERT_EQ(OPRT_OK, tal_sha1_mac_reset(&ctx));
+        ASSERT_EQ(OPRT_OK, tal_sha1_mac_update(&ctx, msg.data(), msg.size()));
+        ASSERT_EQ(OPRT_OK, tal_sha1_mac_finish(&ctx, out));
+        ASSERT_EQ(OPRT_OK, tal_sha1_mac((const uint8_t *)key2, strlen(key2), msg.data(), msg.size(), one_shot));
+        ASSERT_EQ(0, memcmp(out, one_shot, 20)) << len;
+    }
+
+    tal_sha1_mac_free(&ctx);
+}
+
+TEST(TalCryptoKey, BenchmarkKeyedVsOneShot)
+{
+    uint8_t key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    std::vector<uint8_t> data(4096, 0x5a), out(4096);
+    uint8_t iv[16] = {0}, mac[32];
+    tal_aes_key_t aes_key = {};
+    tal_hash_mac_context_t ctx = {};
+
+    ASSERT_EQ(OPRT_OK, tal_aes_key_init(&aes_key, key, 128));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_create_init(&ctx));
+    ASSERT_EQ(OPRT_OK, tal_sha256_mac_starts(&ctx, key, sizeof(key)));
+
+    for (size_t size : BENCH_SIZES) {
+        int calls = (int)(200000 / size) + 100;
+
+        double keyed = ticks_per_call(
+            [&]() { tal_aes_key_crypt_cbc(&aes_key, SYMMETRY_ENCRYPT, size, iv, data.data(), out.data()); }, calls);
+        double one_shot =
+            ticks_per_call([&]() { tal_aes128_cbc_encode_raw(data.data(), size, key, iv, out.data()); }, calls);
+        print_row("aes-128-cbc", size, keyed, one_shot);
+        EXPECT_LT(keyed, one_shot * 1.2) << size;
+    }
+
+    for (size_t size : BENCH_SIZES) {
+        int calls = (int)(200000 / size) + 100;
+
+        double keyed = ticks_per_call(
+            [&]() {
+                tal_sha256_mac_reset(&ctx);
+                tal_sha256_mac_update(&ctx, data.data(), size);
+                tal_sha256_mac_finish(&ctx, mac);
+            },
+            calls);
+        double one_shot = ticks_per_call([&]() { tal_sha256_mac(key, sizeof(key), data.data(), size, mac); }, calls);
+        print_row("hmac-sha256", size, keyed, one_shot);
+        EXPECT_LT(keyed, one_shot * 1.2) << size;
+    }
+
+    tal_sha256_mac_free(&ctx);
+    tal_aes_key_free(&aes_key);
+}
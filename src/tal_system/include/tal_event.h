@@ -50,6 +50,14 @@ extern "C" {
  */
 #define EVENT_DESC_MAX_LEN (32)
 
+#ifndef EVENT_HASH_BUCKET_NUM
+#define EVENT_HASH_BUCKET_NUM (32) // bucket number of the event name index, must be power of 2
+#endif
+
+#ifndef EVENT_ASYNC_QUEUE_LEN
+#define EVENT_ASYNC_QUEUE_LEN (32) // max pending events of async publish
+#endif
+
 /**
  * @brief subscriber type
  *
@@ -77,6 +85,8 @@ typedef struct {
  */
 typedef int (*EVENT_SUBSCRIBE_CB)(void *data);
 
+typedef void *EVENT_HANDLE; // interned event, valid for the whole life of the system
+
 /**
  * @brief the subscirbe node
  *
@@ -97,8 +107,12 @@ typedef struct {
     MUTEX_HANDLE mutex; // mutex, protection the event publish and subscribe
 
     char name[EVENT_NAME_MAX_LEN + 1];    // name, the event name
+    uint32_t hash;                        // hash of the name, used to find the event quickly
     struct tuya_list_head node;           // list node, used to attach to the event manage module
+    struct tuya_list_head hash_node;      // list node, used to attach to the hash bucket
     struct tuya_list_head subscribe_root; // subscibe root, used to manage the subscriber
+    struct tuya_list_head dispatch_root;  // dispatches calling subscribers, unsubscribe waits for them
+    uint32_t dispatch_seq;                // sequence of the last dispatch started
 } EVENT_NODE_T;
 
 /**
@@ -112,6 +126,7 @@ typedef struct {
     struct tuya_list_head event_root;          // event root, used to manage the event
     struct tuya_list_head free_subscribe_root; // free subscriber list, used to manage the
                                                // subscribe which not found the event
+    struct tuya_list_head hash_root[EVENT_HASH_BUCKET_NUM]; // name index of the event
 } EVENT_MANAGE_T;
 
 /**
@@ -145,7 +160,8 @@ OPERATE_RET tal_event_publish(const char *name, void *data);
 OPERATE_RET tal_event_subscribe(const char *name, const char *desc, const EVENT_SUBSCRIBE_CB cb, SUBSCRIBE_TYPE_E type);
 
 /**
- * @brief: unsubscribe event
+ * @brief: unsubscribe event, returns after the publishes already calling the
+ * subscriber on other threads are done
  *
  * @param[in] name: event name
  * @param[in] desc: subscribe description
@@ -155,6 +171,51 @@ OPERATE_RET tal_event_subscribe(const char *name, const char *desc, const EVENT_
  */
 OPERATE_RET tal_event_unsubscribe(const char *name, const char *desc, EVENT_SUBSCRIBE_CB cb);
 
+/**
+ * @brief: get the handle of an event, the event is created if not exist
+ *
+ * @param[in] name: event name
+ * @param[out] handle: event handle, valid for the whole life of the system
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_event_handle_get(const char *name, EVENT_HANDLE *handle);
+
+/**
+ * @brief: publish event by handle, skips the name lookup
+ *
+ * @param[in] handle: event handle from tal_event_handle_get
+ * @param[in] data: event data
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_event_publish_by_handle(EVENT_HANDLE handle, void *data);
+
+/**
+ * @brief: publish event asynchronously, subscribers are called in the event
+ * dispatcher thread
+ *
+ * @param[in] name: event name
+ * @param[in] data: event data
+ * @param[in] len: data length to copy, 0 to pass the pointer which must stay
+ * valid until dispatched
+ * @return OPRT_OK on success, OPRT_EXCEED_UPPER_LIMIT if the queue is full.
+ * Others on error, please refer to tuya_error_code.h
+ */
+OPERATE_RET tal_event_publish_async(const char *name, void *data, uint32_t len);
+
+/**
+ * @brief: publish event asynchronously by handle
+ *
+ * @param[in] handle: event handle from tal_event_handle_get
+ * @param[in] data: event data
+ * @param[in] len: data length to copy, 0 to pass the pointer which must stay
+ * valid until dispatched
+ * @return OPRT_OK on success, OPRT_EXCEED_UPPER_LIMIT if the queue is full.
+ * Others on error, please refer to tuya_error_code.h
+ */
+OPERATE_RET tal_event_publish_async_by_handle(EVENT_HANDLE handle, void *data, uint32_t len);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -350,6 +350,25 @@ void tal_log_color_set(const TAL_LOG_LEVEL_E level, TAL_LOG_DISPLAY_MODE_E displ
 OPERATE_RET tal_log_color_print_raw(TAL_LOG_DISPLAY_MODE_E display_mode, TAL_LOG_FONT_COLOR_E font_color,
                                     TAL_LOG_BACKGROUND_COLOR_E background_color, const char *pFmt, ...);
 
+/**
+ * @brief output all log records queued by the asynchronous mode
+ *
+ * @note With ENABLE_LOG_ASYNC, PR_xxx only queue a record and a drain thread
+ * prints it later. Call this before reboot or in a crash handler so the queued
+ * records are not lost. Does nothing in synchronous mode.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_log_async_flush(void);
+
+/**
+ * @brief get the number of log records dropped because the async ring was full
+ *
+ * @return dropped record count, 0 in synchronous mode
+ */
+uint32_t tal_log_async_get_drop_cnt(void);
+
 #ifdef __cplusplus
 }
 #endif /* __TAL_LOG_H__ */
@@ -78,6 +78,19 @@ OPERATE_RET tal_workq_schedule(WORKQ_SERVICE_E service, WORKQUEUE_CB cb, void *d
  */
 OPERATE_RET tal_workq_schedule_instant(WORKQ_SERVICE_E service, WORKQUEUE_CB cb, void *data);
 
+/**
+ * @brief put work task in workqueue with priority
+ *
+ * @param[in] service the workqueue service
+ * @param[in] cb the work callback
+ * @param[in] data the work data
+ * @param[in] prio the priority class of the work
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_workq_schedule_prio(WORKQ_SERVICE_E service, WORKQUEUE_CB cb, void *data, WORK_PRIO_E prio);
+
 /**
  * @brief cancel work task in workqueue
  *
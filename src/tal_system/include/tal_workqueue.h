@@ -33,12 +33,34 @@ typedef enum { LOOP_ONCE, LOOP_CYCLE } LOOP_TYPE;
 typedef void *WORKQUEUE_HANDLE;
 typedef void (*WORKQUEUE_CB)(void *data);
 
+/**
+ * @brief the priority class of work, higher class is dequeued first
+ */
+typedef enum {
+    WORK_PRIO_HIGH = 0,
+    WORK_PRIO_NORMAL,
+    WORK_PRIO_LOW,
+    WORK_PRIO_MAX,
+} WORK_PRIO_E;
+
 typedef struct {
     WORKQUEUE_CB cb;
     void *data;
 } WORK_ITEM_T;
 typedef BOOL_T (*WORKQUEUE_TRAVERSE_CB)(WORK_ITEM_T *item, void *ctx);
 
+typedef struct {
+    uint16_t depth;       // current work number in queue
+    uint16_t max_depth;   // max work number in queue
+    uint16_t delayed_cnt; // started delayed work number
+    uint8_t worker_num;   // worker thread number
+    uint32_t done_cnt;    // finished work number
+    uint64_t total_wait_ms;
+    uint64_t total_run_ms;
+    uint32_t max_wait_ms; // max time from schedule to run
+    uint32_t max_run_ms;  // max time of work callback
+} WORKQUEUE_STAT_T;
+
 /**
  * @brief create and initialize a workqueue which runs in thread context
  *
@@ -52,6 +74,21 @@ typedef BOOL_T (*WORKQUEUE_TRAVERSE_CB)(WORK_ITEM_T *item, void *ctx);
  */
 OPERATE_RET tal_workqueue_create(const uint16_t queue_len, THREAD_CFG_T *thread_cfg, WORKQUEUE_HANDLE *handle);
 
+/**
+ * @brief create and initialize a workqueue served by several worker threads
+ *
+ * @param[in] queue_len the maximum number of items that the workqueue can
+ * contain
+ * @param[in] worker_num the number of worker threads
+ * @param[in] thread_cfg thread param of every worker
+ * @param[out] handle the workqueue handle
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_workqueue_create_pool(const uint16_t queue_len, const uint8_t worker_num, THREAD_CFG_T *thread_cfg,
+                                      WORKQUEUE_HANDLE *handle);
+
 /**
  * @brief put work task in workqueue
  *
@@ -76,6 +113,20 @@ OPERATE_RET tal_workqueue_schedule(WORKQUEUE_HANDLE handle, WORKQUEUE_CB cb, voi
  */
 OPERATE_RET tal_workqueue_schedule_instant(WORKQUEUE_HANDLE handle, WORKQUEUE_CB cb, void *data);
 
+/**
+ * @brief put work task in workqueue with priority, higher priority will be
+ * dequeued first
+ *
+ * @param[in] handle the workqueue handle
+ * @param[in] cb the work callback
+ * @param[in] data the work data
+ * @param[in] prio the priority class of the work
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_workqueue_schedule_prio(WORKQUEUE_HANDLE handle, WORKQUEUE_CB cb, void *data, WORK_PRIO_E prio);
+
 /**
  * @brief cancel work task in workqueue
  *
@@ -109,6 +160,17 @@ OPERATE_RET tal_workqueue_traverse(WORKQUEUE_HANDLE handle, WORKQUEUE_TRAVERSE_C
  */
 uint16_t tal_workqueue_get_num(WORKQUEUE_HANDLE handle);
 
+/**
+ * @brief get the statistics of the workqueue
+ *
+ * @param[in] handle the workqueue handle
+ * @param[out] stat the statistics
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_workqueue_get_stat(WORKQUEUE_HANDLE handle, WORKQUEUE_STAT_T *stat);
+
 /**
  * @brief release the workqueue
  *
@@ -124,10 +186,20 @@ OPERATE_RET tal_workqueue_release(WORKQUEUE_HANDLE handle);
  *
  * @param[in] handle the workqueue handle
  *
- * @return thread handle
+ * @return thread handle of the first worker
  */
 THREAD_HANDLE tal_workqueue_get_thread(WORKQUEUE_HANDLE handle);
 
+/**
+ * @brief get thread handle of one worker of the workqueue
+ *
+ * @param[in] handle the workqueue handle
+ * @param[in] index the worker index, from 0
+ *
+ * @return thread handle, NULL if index is past the last worker
+ */
+THREAD_HANDLE tal_workqueue_get_worker(WORKQUEUE_HANDLE handle, uint8_t index);
+
 typedef void *DELAYED_WORK_HANDLE;
 
 /**
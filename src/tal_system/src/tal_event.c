@@ -19,6 +19,8 @@
  * - Event node creation and initialization
  * - Subscription management (addition, deletion, retrieval)
  * - Event dispatching to subscribed listeners
+ * - Hashed event name index and handle based publishing
+ * - Asynchronous publishing through a dispatcher thread
  * - Thread-safe operations through mutex locking
  * - Debugging utilities for event and subscription dumping
  *
@@ -33,8 +35,37 @@
 #include "tuya_cloud_types.h"
 #include "tal_event.h"
 #include "tal_api.h"
+#include "tkl_thread.h"
+#include "mix_method.h"
+
+#ifndef STACK_SIZE_EVENT_ASYNC
+#define STACK_SIZE_EVENT_ASYNC (4 * 1024)
+#endif
+
+// subscribers of one publish kept on the stack, more are allocated
+#define EVENT_DISPATCH_LOCAL_NUM 8
+
+typedef struct {
+    EVENT_NODE_T *event;
+    void *data;
+    BOOL_T copied; // data is a copy owned by the dispatcher
+} EVENT_ASYNC_ITEM_T;
+
+// a dispatch calling subscribers, kept on its stack
+typedef struct {
+    struct tuya_list_head node;
+    TKL_THREAD_HANDLE thread;
+    uint32_t seq;
+} EVENT_DISPATCH_T;
+
+typedef struct {
+    QUEUE_HANDLE queue;
+    THREAD_HANDLE thread;
+    uint32_t drop_cnt;
+} EVENT_ASYNC_T;
 
 static EVENT_MANAGE_T g_event_manager = {0};
+static EVENT_ASYNC_T g_event_async = {0};
 
 BOOL_T _event_name_is_valid(const char *name)
 {
@@ -62,6 +93,24 @@ BOOL_T _event_desc_is_valid(const char *desc)
     return TRUE;
 }
 
+EVENT_NODE_T *_event_node_get(const char *name)
+{
+    // try to get event from the name index
+    EVENT_NODE_T *entry = NULL;
+    struct tuya_list_head *pos = NULL;
+    uint32_t hash = tuya_fnv1a32(name, strlen(name));
+    tuya_list_for_each(pos, &g_event_manager.hash_root[hash & (EVENT_HASH_BUCKET_NUM - 1)])
+    {
+        // find by hash first, then by name
+        entry = tuya_list_entry(pos, EVENT_NODE_T, hash_node);
+        if (entry->hash == hash && 0 == strcmp(entry->name, name)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
 EVENT_NODE_T *_event_node_create_init(const char *name)
 {
     // allocate memory
@@ -72,11 +121,22 @@ EVENT_NODE_T *_event_node_create_init(const char *name)
     // initialze the event node
     memcpy(event->name, name, strlen(name));
     event->name[strlen(name)] = '\0';
+    event->hash = tuya_fnv1a32(event->name, strlen(event->name));
     INIT_LIST_HEAD(&event->subscribe_root);
+    INIT_LIST_HEAD(&event->dispatch_root);
     tal_mutex_create_init(&event->mutex);
 
     tal_mutex_lock(g_event_manager.mutex);
 
+    // the event may be created by others before we get the lock
+    EVENT_NODE_T *exist = _event_node_get(name);
+    if (exist) {
+        tal_mutex_unlock(g_event_manager.mutex);
+        tal_mutex_release(event->mutex);
+        tal_free(event);
+        return exist;
+    }
+
     // need check if there have free subscriber which subscribe this event
     struct tuya_list_head *free_pos = NULL;
     struct tuya_list_head *free_next = NULL;
@@ -98,8 +158,9 @@ EVENT_NODE_T *_event_node_create_init(const char *name)
         }
     }
 
-    // at last, need add this event to event manage root
+    // at last, need add this event to event manage root and name index
     tuya_list_add_tail(&event->node, &g_event_manager.event_root);
+    tuya_list_add_tail(&event->hash_node, &g_event_manager.hash_root[event->hash & (EVENT_HASH_BUCKET_NUM - 1)]);
     g_event_manager.event_cnt++;
 
     tal_mutex_unlock(g_event_manager.mutex);
@@ -107,23 +168,6 @@ EVENT_NODE_T *_event_node_create_init(const char *name)
     return event;
 }
 
-EVENT_NODE_T *_event_node_get(const char *name)
-{
-    // try to get event from event root
-    EVENT_NODE_T *entry = NULL;
-    struct tuya_list_head *pos = NULL;
-    tuya_list_for_each(pos, &g_event_manager.event_root)
-    {
-        // find by name
-        entry = tuya_list_entry(pos, EVENT_NODE_T, node);
-        if (0 == strcmp(entry->name, name)) {
-            return entry;
-        }
-    }
-
-    return NULL;
-}
-
 SUBSCRIBE_NODE_T *_event_node_get_free_subscribe(SUBSCRIBE_NODE_T *subscribe)
 {
     struct tuya_list_head *pos = NULL;
@@ -160,17 +204,37 @@ SUBSCRIBE_NODE_T *_event_node_get_subscribe(EVENT_NODE_T *event, SUBSCRIBE_NODE_
 OPERATE_RET _event_node_dispatch(EVENT_NODE_T *event, void *data)
 {
     OPERATE_RET rt = OPRT_OK;
+    EVENT_SUBSCRIBE_CB cb_local[EVENT_DISPATCH_LOCAL_NUM];
+    EVENT_SUBSCRIBE_CB *cb_list = cb_local;
+    EVENT_DISPATCH_T dispatch = {0};
+    int cb_num = 0, i = 0;
 
-    // dispatch in order
+    // take the callbacks under lock and call them after unlock, so a subscriber can publish,
+    // subscribe or unsubscribe without deadlocking on the event mutex
     struct tuya_list_head *p = NULL;
     struct tuya_list_head *n = NULL;
     SUBSCRIBE_NODE_T *entry = NULL;
+
+    tal_mutex_lock(event->mutex);
+    tuya_list_for_each(p, &event->subscribe_root)
+    {
+        cb_num++;
+    }
+    if (cb_num > EVENT_DISPATCH_LOCAL_NUM) {
+        cb_list = tal_malloc(cb_num * sizeof(EVENT_SUBSCRIBE_CB));
+        if (NULL == cb_list) {
+            tal_mutex_unlock(event->mutex);
+            return OPRT_MALLOC_FAILED;
+        }
+    }
+
+    cb_num = 0;
     tuya_list_for_each_safe(p, n, &event->subscribe_root)
     {
-        // find and call cb one by one
+        // keep the order of the subscribers
         entry = tuya_list_entry(p, SUBSCRIBE_NODE_T, node);
         if (entry->cb) {
-            TUYA_CALL_ERR_LOG(entry->cb(data));
+            cb_list[cb_num++] = entry->cb;
         }
 
         // one-time event should be removed after dispatch
@@ -180,6 +244,23 @@ OPERATE_RET _event_node_dispatch(EVENT_NODE_T *event, void *data)
             entry = NULL;
         }
     }
+    tkl_thread_get_id(&dispatch.thread);
+    dispatch.seq = ++event->dispatch_seq;
+    tuya_list_add_tail(&dispatch.node, &event->dispatch_root);
+    tal_mutex_unlock(event->mutex);
+
+    // find and call cb one by one
+    for (i = 0; i < cb_num; i++) {
+        TUYA_CALL_ERR_LOG(cb_list[i](data));
+    }
+
+    tal_mutex_lock(event->mutex);
+    tuya_list_del(&dispatch.node);
+    tal_mutex_unlock(event->mutex);
+
+    if (cb_list != cb_local) {
+        tal_free(cb_list);
+    }
 
     return rt;
 }
@@ -262,6 +343,29 @@ OPERATE_RET _event_node_del_subscribe(EVENT_NODE_T *event, SUBSCRIBE_NODE_T *sub
     return rt;
 }
 
+BOOL_T _event_node_dispatching(EVENT_NODE_T *event, uint32_t seq)
+{
+    struct tuya_list_head *pos = NULL;
+    EVENT_DISPATCH_T *entry = NULL;
+    TKL_THREAD_HANDLE self = NULL;
+    BOOL_T busy = FALSE;
+
+    tkl_thread_get_id(&self);
+    tal_mutex_lock(event->mutex);
+    tuya_list_for_each(pos, &event->dispatch_root)
+    {
+        // a subscriber unsubscribing from its own callback does not wait for itself
+        entry = tuya_list_entry(pos, EVENT_DISPATCH_T, node);
+        if (entry->thread != self && (int32_t)(seq - entry->seq) >= 0) {
+            busy = TRUE;
+            break;
+        }
+    }
+    tal_mutex_unlock(event->mutex);
+
+    return busy;
+}
+
 #if 0
 int _ty_event_dump()
 {
@@ -337,6 +441,9 @@ OPERATE_RET tal_event_init(void)
 
     INIT_LIST_HEAD(&g_event_manager.event_root);
     INIT_LIST_HEAD(&g_event_manager.free_subscribe_root);
+    for (int i = 0; i < EVENT_HASH_BUCKET_NUM; i++) {
+        INIT_LIST_HEAD(&g_event_manager.hash_root[i]);
+    }
     tal_mutex_create_init(&g_event_manager.mutex);
     g_event_manager.event_cnt = 0;
     g_event_manager.inited = TRUE;
@@ -359,6 +466,11 @@ OPERATE_RET tal_event_init(void)
  * subscribers fail, the function continues dispatching the event but returns a
  * failed status to record the execution status.
  *
+ * Subscribers are called without the event lock held. A subscriber may publish
+ * again, subscribe or unsubscribe, and publishes of one event from different
+ * threads may run their subscribers at the same time. tal_event_unsubscribe
+ * waits for the publishes still calling the removed subscriber.
+ *
  * @param[in] name The name of the event to publish.
  * @param[in] data The data associated with the event.
  * @return The operation result. Returns OPRT_OK on success, or an error code on
@@ -374,7 +486,6 @@ OPERATE_RET tal_event_publish(const char *name, void *data)
         return OPRT_BASE_EVENT_INVALID_EVENT_NAME;
     }
 
-    OPERATE_RET rt = OPRT_OK;
     // try to get event, if not exist, create and init.
     EVENT_NODE_T *event = _event_node_get(name);
     if (!event) {
@@ -382,18 +493,180 @@ OPERATE_RET tal_event_publish(const char *name, void *data)
         TUYA_CHECK_NULL_RETURN(event, OPRT_MALLOC_FAILED);
     }
 
-    // to keep the consistency, dispatch will done in mutex lock
-    tal_mutex_lock(event->mutex);
+    return tal_event_publish_by_handle(event, data);
+}
+
+/**
+ * @brief Gets the handle of an event, creating the event if it does not exist.
+ *
+ * The handle is an interned event which is never released, publishing by
+ * handle skips the name lookup.
+ *
+ * @param[in] name The name of the event.
+ * @param[out] handle The event handle.
+ * @return The operation result. Returns OPRT_OK on success, or an error code on
+ * failure.
+ */
+OPERATE_RET tal_event_handle_get(const char *name, EVENT_HANDLE *handle)
+{
+    if (g_event_manager.inited != TRUE) {
+        tal_event_init();
+    }
+
+    if (!_event_name_is_valid(name)) {
+        return OPRT_BASE_EVENT_INVALID_EVENT_NAME;
+    }
+
+    if (NULL == handle) {
+        return OPRT_INVALID_PARM;
+    }
+
+    EVENT_NODE_T *event = _event_node_get(name);
+    if (!event) {
+        event = _event_node_create_init(name);
+        TUYA_CHECK_NULL_RETURN(event, OPRT_MALLOC_FAILED);
+    }
+
+    *handle = event;
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief Publishes an event by the handle got from tal_event_handle_get.
+ *
+ * @param[in] handle The event handle.
+ * @param[in] data The data associated with the event.
+ * @return The operation result. Returns OPRT_OK on success, or an error code on
+ * failure.
+ */
+OPERATE_RET tal_event_publish_by_handle(EVENT_HANDLE handle, void *data)
+{
+    OPERATE_RET rt = OPRT_OK;
+    EVENT_NODE_T *event = (EVENT_NODE_T *)handle;
+
+    if (NULL == event) {
+        return OPRT_INVALID_PARM;
+    }
+
     // try to dispatch event to all subscribe
     // if one of the subscribe failed, it will continue but will return failed
     // to record the execute status
     TUYA_CALL_ERR_LOG(_event_node_dispatch(event, data));
 
-    tal_mutex_unlock(event->mutex);
+    return rt;
+}
+
+static void _event_async_thread_cb(void *args)
+{
+    EVENT_ASYNC_ITEM_T item;
+
+    while (THREAD_STATE_RUNNING == tal_thread_get_state(g_event_async.thread)) {
+        if (OPRT_OK != tal_queue_fetch(g_event_async.queue, &item, SEM_WAIT_FOREVER)) {
+            continue;
+        }
+
+        tal_event_publish_by_handle(item.event, item.data);
+        if (item.copied) {
+            tal_free(item.data);
+        }
+    }
+}
+
+static OPERATE_RET _event_async_init(void)
+{
+    OPERATE_RET rt = OPRT_OK;
+
+    if (g_event_async.thread) {
+        return OPRT_OK;
+    }
 
+    tal_mutex_lock(g_event_manager.mutex);
+    if (NULL == g_event_async.queue) {
+        TUYA_CALL_ERR_GOTO(tal_queue_create_init(&g_event_async.queue, sizeof(EVENT_ASYNC_ITEM_T),
+                                                 EVENT_ASYNC_QUEUE_LEN),
+                           __EXIT);
+    }
+
+    if (NULL == g_event_async.thread) {
+        THREAD_CFG_T thread_cfg = {
+            .stackDepth = STACK_SIZE_EVENT_ASYNC, .priority = THREAD_PRIO_2, .thrdname = "event_async"};
+        TUYA_CALL_ERR_GOTO(
+            tal_thread_create_and_start(&g_event_async.thread, NULL, NULL, _event_async_thread_cb, NULL, &thread_cfg),
+            __EXIT);
+    }
+
+__EXIT:
+    tal_mutex_unlock(g_event_manager.mutex);
     return rt;
 }
 
+/**
+ * @brief Publishes an event asynchronously by the handle.
+ *
+ * The event is queued and dispatched to subscribers in the event dispatcher
+ * thread, the publisher is never blocked by subscribers. If len is not 0 the
+ * data is copied, otherwise the data pointer is passed to subscribers as it
+ * is and must stay valid until dispatched.
+ *
+ * @param[in] handle The event handle.
+ * @param[in] data The data associated with the event.
+ * @param[in] len The data length to copy, 0 to pass the pointer only.
+ * @return The operation result. Returns OPRT_EXCEED_UPPER_LIMIT if the queue is
+ * full.
+ */
+OPERATE_RET tal_event_publish_async_by_handle(EVENT_HANDLE handle, void *data, uint32_t len)
+{
+    OPERATE_RET rt = OPRT_OK;
+    EVENT_ASYNC_ITEM_T item = {0};
+
+    if (NULL == handle || (len && NULL == data)) {
+        return OPRT_INVALID_PARM;
+    }
+
+    TUYA_CALL_ERR_RETURN(_event_async_init());
+
+    item.event = (EVENT_NODE_T *)handle;
+    item.data = data;
+    if (len) {
+        item.data = tal_malloc(len);
+        TUYA_CHECK_NULL_RETURN(item.data, OPRT_MALLOC_FAILED);
+        memcpy(item.data, data, len);
+        item.copied = TRUE;
+    }
+
+    // never wait, the publisher may be a subscriber running in the dispatcher
+    if (OPRT_OK != tal_queue_post(g_event_async.queue, &item, 0)) {
+        if (item.copied) {
+            tal_free(item.data);
+        }
+        g_event_async.drop_cnt++;
+        PR_WARN("event %s async queue full, drop:%d", item.event->name, g_event_async.drop_cnt);
+        return OPRT_EXCEED_UPPER_LIMIT;
+    }
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief Publishes an event asynchronously by the name.
+ *
+ * @param[in] name The name of the event to publish.
+ * @param[in] data The data associated with the event.
+ * @param[in] len The data length to copy, 0 to pass the pointer only.
+ * @return The operation result. Returns OPRT_OK on success, or an error code on
+ * failure.
+ */
+OPERATE_RET tal_event_publish_async(const char *name, void *data, uint32_t len)
+{
+    OPERATE_RET rt = OPRT_OK;
+    EVENT_HANDLE handle = NULL;
+
+    TUYA_CALL_ERR_RETURN(tal_event_handle_get(name, &handle));
+
+    return tal_event_publish_async_by_handle(handle, data, len);
+}
+
 /**
  * @brief Subscribes to an event.
  *
@@ -457,6 +730,9 @@ OPERATE_RET tal_event_subscribe(const char *name, const char *desc, const EVENT_
  * description and name are valid before proceeding with the unsubscribe
  * operation. If the event is found, it is removed from the subscribe list. If
  * the event is not found, the subscription is removed from the free list.
+ * Publishes on other threads which already took the subscriber are waited for,
+ * so the callback is not called once this returns. It must not be called while
+ * holding a lock the subscriber takes.
  *
  * @param[in] name The name of the event to unsubscribe from.
  * @param[in] desc The description of the event to unsubscribe from.
@@ -497,7 +773,14 @@ OPERATE_RET tal_event_unsubscribe(const char *name, const char *desc, EVENT_SUBS
         // if found the event, del from the subscribe list
         tal_mutex_lock(event->mutex);
         TUYA_CALL_ERR_LOG(_event_node_del_subscribe(event, &subscribe));
+        uint32_t seq = event->dispatch_seq;
         tal_mutex_unlock(event->mutex);
+
+        // publishes started before the removal may still be calling the subscriber,
+        // later ones no longer see it
+        while (_event_node_dispatching(event, seq)) {
+            tal_system_sleep(1);
+        }
     }
 
     return rt;
@@ -13,6 +13,9 @@
  * - Configurable log levels ranging from debug to critical errors.
  * - Support for multiple log output destinations through callback registration.
  * - Thread-safe log message output using mutexes.
+ * - Optional asynchronous mode: callers store a binary record (format pointer,
+ *   raw args, tick, level) into a lock-free ring, and a drain thread formats it
+ *   and writes it to the output terminals.
  * - Integration with Tuya's IoT SDK for memory management and system utilities.
  *
  * The logging system is implemented using a linked list to manage output
@@ -38,6 +41,12 @@
 #include "tal_system.h"
 #include "tal_time_service.h"
 #include "tal_memory.h"
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+#include <stddef.h>
+#include <stdint.h>
+#include "tal_semaphore.h"
+#include "tal_thread.h"
+#endif
 
 /***********************************************************
 *************************micro define***********************
@@ -62,6 +71,85 @@ typedef struct {
     LOG_TEXT_STYLE_S style[LOG_LEVEL_MAX + 1];
 } LOG_COLOR_S;
 
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+#ifndef LOG_ASYNC_RECORD_NUM
+#define LOG_ASYNC_RECORD_NUM 64
+#endif
+
+#ifndef LOG_ASYNC_ARG_SIZE
+#define LOG_ASYNC_ARG_SIZE 128
+#endif
+
+#ifndef STACK_SIZE_LOG_ASYNC
+#define STACK_SIZE_LOG_ASYNC (4 * 1024)
+#endif
+
+#if (LOG_ASYNC_RECORD_NUM & (LOG_ASYNC_RECORD_NUM - 1)) != 0
+#error "LOG_ASYNC_RECORD_NUM must be a power of 2"
+#endif
+
+// drain thread wakes up at least this often even if no producer posts
+#define LOG_ASYNC_IDLE_MS 1000
+
+// record body is preformatted text, not packed args
+#define LOG_REC_TEXT 0x01
+
+typedef uint8_t LOG_ARG_TYPE_E;
+#define LOG_ARG_NONE    0
+#define LOG_ARG_BAD     1
+#define LOG_ARG_INT     2
+#define LOG_ARG_LONG    3
+#define LOG_ARG_LLONG   4
+#define LOG_ARG_SIZE    5
+#define LOG_ARG_PTRDIFF 6
+#define LOG_ARG_INTMAX  7
+#define LOG_ARG_DOUBLE  8
+#define LOG_ARG_LDOUBLE 9
+#define LOG_ARG_PTR     10
+#define LOG_ARG_STR     11
+
+typedef struct {
+    const char *lit; // literal text in front of the conversion
+    uint16_t lit_len;
+    LOG_ARG_TYPE_E type;
+    char conv;
+    BOOL_T star_width;
+    BOOL_T star_prec;
+    int prec;          // literal precision, -1 if none
+    const char *start; // '%' of the conversion
+    const char *end;   // one past the conversion character
+} LOG_FMT_SPEC_T;
+
+typedef struct {
+    uint32_t seq; // ring sequence, see __log_async_reserve
+    uint8_t level;
+    uint8_t flags;
+    uint16_t arg_len;
+    uint16_t fmt_len; // the format is copied in front of the packed args, it may not outlive the call
+    uint32_t line;
+    SYS_TIME_T tick;
+    const char *file;
+    uint8_t args[LOG_ASYNC_ARG_SIZE];
+} LOG_ASYNC_REC_T;
+
+typedef struct {
+    uint32_t enq_pos; // shared by producers
+    uint32_t deq_pos; // moved only by the consumer holding drain_mutex
+    uint32_t waiting;
+    uint32_t drop_cnt;
+    uint32_t drop_reported;
+
+    TIME_T tm_sec;
+    POSIX_TM_S tm;
+
+    SEM_HANDLE sem;
+    MUTEX_HANDLE drain_mutex;
+    THREAD_HANDLE thread;
+
+    LOG_ASYNC_REC_T rec[LOG_ASYNC_RECORD_NUM];
+} LOG_ASYNC_T;
+#endif
+
 typedef struct {
     LOG_LEVEL curLogLevel;
     LIST_HEAD listHead;
@@ -73,6 +161,10 @@ typedef struct {
     int log_buf_len;
     BOOL_T ms_level;
     char *log_buf;
+
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    LOG_ASYNC_T *async;
+#endif
 } LOG_MANAGE, *P_LOG_MANAGE;
 
 #define DEF_OUTPUT_NAME "def_output"
@@ -94,6 +186,745 @@ const LOG_TEXT_STYLE_S sDefaultStyle[LOG_LEVEL_MAX + 1] = {
 /***********************************************************
 *************************function define********************
 ***********************************************************/
+void __output_logManage_buf(void)
+{
+    P_LIST_HEAD pPos;
+    LOG_OUT_NODE_S *output_node;
+    tuya_list_for_each(pPos, &(pLogManage->log_list))
+    {
+        output_node = tuya_list_entry(pPos, LOG_OUT_NODE_S, node);
+        if (output_node->out_term) {
+            output_node->out_term(pLogManage->log_buf);
+        }
+    }
+}
+
+static int tal_log_strrchr(char *str, char ch)
+{
+    char *ta;
+
+    ta = strrchr(str, ch);
+    if (ta) {
+        return (int)(ta - str);
+    }
+
+    return -1;
+}
+
+static const char *__log_file_basename(const char *pFile)
+{
+    int pos = 0;
+
+    if (NULL == pFile) {
+        return "Null";
+    }
+
+    pos = tal_log_strrchr((char *)pFile, '/');
+    if (pos < 0) {
+        pos = tal_log_strrchr((char *)pFile, '\\');
+    }
+
+    return (pos >= 0) ? pFile + pos + 1 : pFile;
+}
+
+/**
+ * @brief format color, time, level and file:line of one log line into log_buf
+ *
+ * @param[in] logLevel log level
+ * @param[in] filename file name without path
+ * @param[in] line line number
+ * @param[in] tm local time of the log, NULL means now
+ * @param[in] ms millisecond part of the log time
+ *
+ * @return length of the head, or -1 on error
+ */
+static int __log_format_head(LOG_LEVEL logLevel, const char *filename, uint32_t line, POSIX_TM_S *tm, uint32_t ms)
+{
+    int len = 0;
+    int cnt = 0;
+    POSIX_TM_S tm_now;
+    const char *pTmpModuleName = "ty";
+
+    // color prefix
+    if (pLogManage->log_color.enable_color) {
+        cnt = snprintf(pLogManage->log_buf, pLogManage->log_buf_len, "\033[%d;%d;%dm",
+                       pLogManage->log_color.style[logLevel].display_mode,
+                       pLogManage->log_color.style[logLevel].font_color,
+                       pLogManage->log_color.style[logLevel].background_color);
+        if (cnt <= 0) {
+            return -1;
+        }
+        len += cnt;
+    }
+
+    if (NULL == tm) {
+        memset(&tm_now, 0, sizeof(tm_now));
+        if (pLogManage->ms_level == FALSE) {
+            tal_time_get_local_time_custom(0, &tm_now);
+        } else {
+            SYS_TICK_T time_ms = tal_time_get_posix_ms();
+            ms = (uint32_t)(time_ms % 1000);
+            tal_time_get_local_time_custom((TIME_T)(time_ms / 1000), &tm_now);
+        }
+        tm = &tm_now;
+    }
+
+    if (pLogManage->ms_level == FALSE) {
+        cnt = snprintf(pLogManage->log_buf + len, pLogManage->log_buf_len - len,
+                       "[%02d-%02d %02d:%02d:%02d %s %s][%s:%" PRIu32 "] ", tm->tm_mon + 1, tm->tm_mday, tm->tm_hour,
+                       tm->tm_min, tm->tm_sec, pTmpModuleName, sLevelStr[logLevel], filename, line);
+    } else {
+        cnt = snprintf(pLogManage->log_buf + len, pLogManage->log_buf_len - len,
+                       "[%02d-%02d %02d:%02d:%02d:%" PRIu32 " %s %s][%s:%" PRIu32 "] ", tm->tm_mon + 1, tm->tm_mday,
+                       tm->tm_hour, tm->tm_min, tm->tm_sec, ms, pTmpModuleName, sLevelStr[logLevel], filename, line);
+    }
+    if (cnt <= 0) {
+        return -1;
+    }
+
+    return len + cnt;
+}
+
+/**
+ * @brief append color reset and line break to log_buf and terminate it
+ *
+ * @param[in] len length of the content already in log_buf
+ *
+ * @return length of the whole line, or -1 on error
+ */
+static int __log_format_tail(int len)
+{
+    int cnt = 0;
+
+    char *p_suffix = (pLogManage->log_color.enable_color) ? "\033[0m\r\n" : "\r\n";
+    if (len > (int)(pLogManage->log_buf_len - strlen(p_suffix) - 1)) { // 1 -> "\0"
+        len = pLogManage->log_buf_len - strlen(p_suffix) - 1;
+    }
+    cnt = snprintf(pLogManage->log_buf + len, pLogManage->log_buf_len - len, "%s", p_suffix);
+    if (cnt <= 0) {
+        return -1;
+    }
+    len += cnt;
+    pLogManage->log_buf[len] = '\0';
+
+    return len;
+}
+
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+/**
+ * @brief parse one conversion of a printf format
+ *
+ * Scans from *pp, stops at the next conversion and reports the literal text
+ * in front of it. Both the producer (packing args) and the drain thread
+ * (unpacking args) walk the format with this, so they always agree on the
+ * record layout.
+ *
+ * @param[in,out] pp format cursor, moved behind the parsed conversion
+ * @param[out] spec parsed conversion
+ *
+ * @return TRUE if a conversion or literal text was found, FALSE at end of format
+ */
+static BOOL_T __log_fmt_next(const char **pp, LOG_FMT_SPEC_T *spec)
+{
+    const char *p = *pp;
+    int lng = 0;
+
+    memset(spec, 0, sizeof(LOG_FMT_SPEC_T));
+    spec->lit = p;
+    while (*p && *p != '%') {
+        p++;
+    }
+    spec->lit_len = (uint16_t)(p - spec->lit);
+    if ('\0' == *p) {
+        *pp = p;
+        spec->type = LOG_ARG_NONE;
+        return (spec->lit_len > 0);
+    }
+
+    spec->start = p++;
+    if ('%' == *p) {
+        // "%%" is kept as literal text of length 1
+        spec->lit_len++;
+        spec->start = NULL;
+        spec->type = LOG_ARG_NONE;
+        *pp = p + 1;
+        return TRUE;
+    }
+
+    while (*p && strchr("-+ #0", *p)) {
+        p++;
+    }
+    if ('*' == *p) {
+        spec->star_width = TRUE;
+        p++;
+    } else {
+        while (isdigit((unsigned char)*p)) {
+            p++;
+        }
+    }
+    spec->prec = -1;
+    if ('.' == *p) {
+        p++;
+        if ('*' == *p) {
+            spec->star_prec = TRUE;
+            p++;
+        } else {
+            spec->prec = 0;
+            while (isdigit((unsigned char)*p)) {
+                spec->prec = spec->prec * 10 + (*p - '0');
+                p++;
+            }
+        }
+    }
+
+    switch (*p) {
+    case 'h':
+        p += ('h' == p[1]) ? 2 : 1;
+        break;
+    case 'l':
+        lng = ('l' == p[1]) ? 2 : 1;
+        p += lng;
+        break;
+    case 'z':
+        lng = 'z';
+        p++;
+        break;
+    case 't':
+        lng = 't';
+        p++;
+        break;
+    case 'j':
+        lng = 'j';
+        p++;
+        break;
+    case 'L':
+        lng = 'L';
+        p++;
+        break;
+    default:
+        break;
+    }
+
+    spec->conv = *p;
+    switch (*p) {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+        spec->type = (1 == lng)     ? LOG_ARG_LONG
+                     : (2 == lng)   ? LOG_ARG_LLONG
+                     : ('z' == lng) ? LOG_ARG_SIZE
+                     : ('t' == lng) ? LOG_ARG_PTRDIFF
+                     : ('j' == lng) ? LOG_ARG_INTMAX
+                                    : LOG_ARG_INT;
+        break;
+    case 'c':
+        spec->type = (0 == lng) ? LOG_ARG_INT : LOG_ARG_BAD;
+        break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        spec->type = ('L' == lng) ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+        break;
+    case 'p':
+        spec->type = LOG_ARG_PTR;
+        break;
+    case 's':
+        spec->type = (0 == lng) ? LOG_ARG_STR : LOG_ARG_BAD;
+        break;
+    default:
+        // %n, wide chars and unknown conversions are not recorded
+        spec->type = LOG_ARG_BAD;
+        break;
+    }
+    if ('\0' == *p) {
+        spec->type = LOG_ARG_BAD;
+        *pp = p;
+        return TRUE;
+    }
+    spec->end = ++p;
+    *pp = p;
+
+    return TRUE;
+}
+
+#define __LOG_ARG_PUT(type, value)                                                                                     \
+    do {                                                                                                               \
+        type __v = (value);                                                                                            \
+        if (len + sizeof(type) > size) {                                                                               \
+            return -1;                                                                                                 \
+        }                                                                                                              \
+        memcpy(buf + len, &__v, sizeof(type));                                                                         \
+        len += sizeof(type);                                                                                           \
+    } while (0)
+
+#define __LOG_ARG_GET(type, value)                                                                                     \
+    do {                                                                                                               \
+        if (pos + sizeof(type) > size) {                                                                               \
+            return -1;                                                                                                 \
+        }                                                                                                              \
+        memcpy(&(value), buf + pos, sizeof(type));                                                                     \
+        pos += sizeof(type);                                                                                           \
+    } while (0)
+
+/**
+ * @brief copy the raw args of a log call into a record
+ *
+ * Only scalars are copied; "%s" args are copied inline including the
+ * terminator (bounded by the precision if there is one) because the caller's
+ * buffer is gone by the time the drain thread formats the record.
+ *
+ * @return length of the packed args, or -1 if the args do not fit or the
+ * format has a conversion that can not be recorded
+ */
+static int __log_async_pack(uint8_t *buf, uint32_t size, const char *fmt, va_list ap)
+{
+    uint32_t len = 0;
+    LOG_FMT_SPEC_T spec;
+    int prec = 0;
+
+    while (__log_fmt_next(&fmt, &spec)) {
+        if (LOG_ARG_NONE == spec.type) {
+            continue;
+        }
+        if (LOG_ARG_BAD == spec.type) {
+            return -1;
+        }
+        if (spec.star_width) {
+            __LOG_ARG_PUT(int, va_arg(ap, int));
+        }
+        prec = spec.prec;
+        if (spec.star_prec) {
+            prec = va_arg(ap, int);
+            __LOG_ARG_PUT(int, prec);
+        }
+
+        switch (spec.type) {
+        case LOG_ARG_INT:
+            __LOG_ARG_PUT(int, va_arg(ap, int));
+            break;
+        case LOG_ARG_LONG:
+            __LOG_ARG_PUT(long, va_arg(ap, long));
+            break;
+        case LOG_ARG_LLONG:
+            __LOG_ARG_PUT(long long, va_arg(ap, long long));
+            break;
+        case LOG_ARG_SIZE:
+            __LOG_ARG_PUT(size_t, va_arg(ap, size_t));
+            break;
+        case LOG_ARG_PTRDIFF:
+            __LOG_ARG_PUT(ptrdiff_t, va_arg(ap, ptrdiff_t));
+            break;
+        case LOG_ARG_INTMAX:
+            __LOG_ARG_PUT(intmax_t, va_arg(ap, intmax_t));
+            break;
+        case LOG_ARG_DOUBLE:
+            __LOG_ARG_PUT(double, va_arg(ap, double));
+            break;
+        case LOG_ARG_LDOUBLE:
+            __LOG_ARG_PUT(long double, va_arg(ap, long double));
+            break;
+        case LOG_ARG_PTR:
+            __LOG_ARG_PUT(void *, va_arg(ap, void *));
+            break;
+        case LOG_ARG_STR: {
+            const char *str = va_arg(ap, const char *);
+            uint32_t str_len = 0;
+
+            if (NULL == str) {
+                str = "(null)";
+            }
+            while ((prec < 0 || str_len < (uint32_t)prec) && str[str_len]) {
+                str_len++;
+            }
+            // a string longer than the room left is not cut, the call is logged synchronously
+            if (len + str_len + 1 > size) {
+                return -1;
+            }
+            memcpy(buf + len, str, str_len);
+            buf[len + str_len] = '\0';
+            len += str_len + 1;
+        } break;
+        default:
+            return -1;
+        }
+    }
+
+    return (int)len;
+}
+
+/**
+ * @brief format the body of a binary record into log_buf
+ *
+ * @return length of log_buf content, or -1 on error
+ */
+static int __log_async_render(LOG_ASYNC_REC_T *rec, int len)
+{
+    const uint8_t *buf = rec->args;
+    uint32_t size = rec->arg_len;
+    uint32_t pos = rec->fmt_len;
+    const char *fmt = (const char *)rec->args;
+    LOG_FMT_SPEC_T spec;
+    char spec_fmt[32];
+    int width = 0, prec = 0, cnt = 0;
+    char *out = NULL;
+    int room = 0;
+
+    if (rec->flags & LOG_REC_TEXT) {
+        fmt = "%s";
+    }
+
+    while (__log_fmt_next(&fmt, &spec)) {
+        if (len >= pLogManage->log_buf_len) {
+            break;
+        }
+        out = pLogManage->log_buf + len;
+        room = pLogManage->log_buf_len - len;
+
+        if (spec.lit_len) {
+            cnt = (spec.lit_len < room) ? spec.lit_len : room - 1;
+            memcpy(out, spec.lit, cnt);
+            len += cnt;
+            out += cnt;
+            room -= cnt;
+        }
+        if (LOG_ARG_NONE == spec.type) {
+            continue;
+        }
+        if (rec->flags & LOG_REC_TEXT) {
+            cnt = snprintf(out, room, "%s", (const char *)buf);
+            len += (cnt < room) ? cnt : room - 1;
+            continue;
+        }
+
+        // rebuild "%<flags><width>.<prec><len><conv>" with '*' resolved
+        const char *s = spec.start;
+        int n = 0;
+        width = prec = 0;
+        if (spec.star_width) {
+            __LOG_ARG_GET(int, width);
+        }
+        if (spec.star_prec) {
+            __LOG_ARG_GET(int, prec);
+        }
+        while (s < spec.end && n < (int)sizeof(spec_fmt) - 12) {
+            if ('*' == *s) {
+                BOOL_T is_prec = (s > spec.start && '.' == s[-1]);
+                n += snprintf(spec_fmt + n, sizeof(spec_fmt) - n, "%d", is_prec ? prec : width);
+            } else {
+                spec_fmt[n++] = *s;
+            }
+            s++;
+        }
+        spec_fmt[n] = '\0';
+
+        switch (spec.type) {
+        case LOG_ARG_INT: {
+            int v;
+            __LOG_ARG_GET(int, v);
+            cnt = snprintf(out, room, spec_fmt, v);
+        } break;
+        case LOG_ARG_LONG: {
+            long v;
+            __LOG_ARG_GET(long, v);
+            cnt = snprintf(out, room, spec_fmt, v);
+        } break;
+        case LOG_ARG_LLONG: {
+            long long v;
+            __LOG_ARG_GET(long long, v);
+            cnt = snprintf(out, room, spec_fmt, v);
+        } break;
+        case LOG_ARG_SIZE: {
+            size_t v;
+            __LOG_ARG_GET(size_t, v);
+            cnt = snprintf(out, room, spec_fmt, v);
+        } break;
+        case LOG_ARG_PTRDIFF: {
+            ptrdiff_t v;
+            __LOG_ARG_GET(ptrdiff_t, v);
+            cnt = snprintf(out, room, spec_fmt, v);
+        } break;
+        case LOG_ARG_INTMAX: {
+            intmax_t v;
+            __LOG_ARG_GET(intmax_t, v);
+            cnt = snprintf(out, room, spec_fmt, v);
+        } break;
+        case LOG_ARG_DOUBLE: {
+            double v;
+            __LOG_ARG_GET(double, v);
+            cnt = snprintf(out, room, spec_fmt, v);
+        } break;
+        case LOG_ARG_LDOUBLE: {
+            long double v;
+            __LOG_ARG_GET(long double, v);
+            cnt = snprintf(out, room, spec_fmt, v);
+        } break;
+        case LOG_ARG_PTR: {
+            void *v;
+            __LOG_ARG_GET(void *, v);
+            cnt = snprintf(out, room, spec_fmt, v);
+        } break;
+        case LOG_ARG_STR: {
+            const char *v = (const char *)(buf + pos);
+            const char *v_end = memchr(v, '\0', size - pos);
+            if (NULL == v_end) {
+                return -1;
+            }
+            pos += (uint32_t)(v_end - v) + 1;
+            cnt = snprintf(out, room, spec_fmt, v);
+        } break;
+        default:
+            return -1;
+        }
+        if (cnt < 0) {
+            return -1;
+        }
+        len += (cnt < room) ? cnt : room - 1;
+    }
+
+    return len;
+}
+
+/**
+ * @brief reserve one free record of the ring, lock-free for any number of
+ * producers
+ *
+ * @return the record, or NULL if the ring is full
+ */
+static LOG_ASYNC_REC_T *__log_async_reserve(LOG_ASYNC_T *async, uint32_t *ticket)
+{
+    uint32_t pos = __atomic_load_n(&async->enq_pos, __ATOMIC_RELAXED);
+    LOG_ASYNC_REC_T *rec = NULL;
+
+    for (;;) {
+        rec = &async->rec[pos & (LOG_ASYNC_RECORD_NUM - 1)];
+        int32_t diff = (int32_t)(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) - pos);
+        if (0 == diff) {
+            if (__atomic_compare_exchange_n(&async->enq_pos, &pos, pos + 1, TRUE, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                *ticket = pos;
+                return rec;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&async->enq_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief write one log call into the ring and wake the drain thread
+ *
+ * Runs in the context of the logging thread: no mutex, no time conversion
+ * and no formatting unless the format can not be recorded as binary.
+ *
+ * @return OPRT_BUFFER_NOT_ENOUGH if the body does not fit in a record, the
+ * caller logs it synchronously instead of cutting it
+ */
+static OPERATE_RET __log_async_post(LOG_ASYNC_T *async, LOG_LEVEL logLevel, const char *filename, uint32_t line,
+                                    const char *pFmt, va_list ap)
+{
+    uint32_t ticket = 0;
+    int arg_len = -1;
+    uint32_t fmt_len = strlen(pFmt) + 1;
+    uint8_t flags = 0;
+    uint8_t args[LOG_ASYNC_ARG_SIZE];
+    va_list ap_copy;
+
+    // pack before reserving, a reserved record can not be given back
+    if (fmt_len < sizeof(args)) {
+        memcpy(args, pFmt, fmt_len);
+        va_copy(ap_copy, ap);
+        arg_len = __log_async_pack(args + fmt_len, sizeof(args) - fmt_len, pFmt, ap_copy);
+        va_end(ap_copy);
+    }
+    if (arg_len >= 0) {
+        arg_len += fmt_len;
+    } else {
+        fmt_len = 0;
+        // fall back to formatting the body here, the drain thread prints it as text
+        va_copy(ap_copy, ap);
+        arg_len = vsnprintf((char *)args, sizeof(args), pFmt, ap_copy);
+        va_end(ap_copy);
+        if (arg_len < 0) {
+            arg_len = 0;
+            args[0] = '\0';
+        }
+        if (arg_len >= (int)sizeof(args)) {
+            return OPRT_BUFFER_NOT_ENOUGH;
+        }
+        arg_len++;
+        flags |= LOG_REC_TEXT;
+    }
+
+    LOG_ASYNC_REC_T *rec = __log_async_reserve(async, &ticket);
+    if (NULL == rec) {
+        __atomic_add_fetch(&async->drop_cnt, 1, __ATOMIC_RELAXED);
+        return OPRT_EXCEED_UPPER_LIMIT;
+    }
+
+    rec->level = (uint8_t)logLevel;
+    rec->flags = flags;
+    rec->line = line;
+    rec->tick = tal_system_get_millisecond();
+    rec->file = filename;
+    memcpy(rec->args, args, arg_len);
+    rec->arg_len = (uint16_t)arg_len;
+    rec->fmt_len = (uint16_t)fmt_len;
+
+    __atomic_store_n(&rec->seq, ticket + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&async->waiting, 0, __ATOMIC_SEQ_CST)) {
+        tal_semaphore_post(async->sem);
+    }
+
+    return OPRT_OK;
+}
+
+static BOOL_T __log_async_empty(LOG_ASYNC_T *async)
+{
+    uint32_t pos = __atomic_load_n(&async->deq_pos, __ATOMIC_RELAXED);
+    LOG_ASYNC_REC_T *rec = &async->rec[pos & (LOG_ASYNC_RECORD_NUM - 1)];
+
+    return ((int32_t)(__atomic_load_n(&rec->seq, __ATOMIC_SEQ_CST) - (pos + 1)) < 0);
+}
+
+static void __log_async_output(LOG_ASYNC_T *async, LOG_ASYNC_REC_T *rec)
+{
+    int len = 0;
+    uint32_t ms = 0;
+
+    // convert the cached tick to local time, once per second of log time
+    SYS_TICK_T time_ms = tal_time_get_posix_ms() - (SYS_TICK_T)(tal_system_get_millisecond() - rec->tick);
+    TIME_T sec = (TIME_T)(time_ms / 1000);
+    ms = (uint32_t)(time_ms % 1000);
+    if (sec != async->tm_sec) {
+        memset(&async->tm, 0, sizeof(async->tm));
+        tal_time_get_local_time_custom(sec, &async->tm);
+        async->tm_sec = sec;
+    }
+
+    tal_mutex_lock(pLogManage->mutex);
+    len = __log_format_head(rec->level, rec->file, rec->line, &async->tm, ms);
+    if (len > 0) {
+        len = __log_async_render(rec, len);
+    }
+    if (len > 0) {
+        len = __log_format_tail(len);
+    }
+    if (len > 0) {
+        __output_logManage_buf();
+    }
+    tal_mutex_unlock(pLogManage->mutex);
+}
+
+/**
+ * @brief format and output every record in the ring
+ *
+ * The ring has one consumer at a time; drain_mutex makes the drain thread and
+ * callers of tal_log_async_flush take turns.
+ */
+static void __log_async_drain(LOG_ASYNC_T *async)
+{
+    LOG_ASYNC_REC_T *rec = NULL;
+    uint32_t drop_cnt = 0;
+
+    tal_mutex_lock(async->drain_mutex);
+    while (!__log_async_empty(async)) {
+        rec = &async->rec[async->deq_pos & (LOG_ASYNC_RECORD_NUM - 1)];
+        __log_async_output(async, rec);
+        __atomic_store_n(&rec->seq, async->deq_pos + LOG_ASYNC_RECORD_NUM, __ATOMIC_RELEASE);
+        __atomic_store_n(&async->deq_pos, async->deq_pos + 1, __ATOMIC_RELAXED);
+    }
+
+    drop_cnt = __atomic_load_n(&async->drop_cnt, __ATOMIC_RELAXED);
+    if (drop_cnt != async->drop_reported) {
+        tal_mutex_lock(pLogManage->mutex);
+        snprintf(pLogManage->log_buf, pLogManage->log_buf_len, "[log] %" PRIu32 " records dropped\r\n",
+                 drop_cnt - async->drop_reported);
+        __output_logManage_buf();
+        tal_mutex_unlock(pLogManage->mutex);
+        async->drop_reported = drop_cnt;
+    }
+    tal_mutex_unlock(async->drain_mutex);
+}
+
+static void __log_async_thread_cb(void *args)
+{
+    LOG_ASYNC_T *async = (LOG_ASYNC_T *)args;
+
+    while (THREAD_STATE_RUNNING == tal_thread_get_state(async->thread)) {
+        __atomic_store_n(&async->waiting, 1, __ATOMIC_SEQ_CST);
+        if (__log_async_empty(async)) {
+            tal_semaphore_wait(async->sem, LOG_ASYNC_IDLE_MS);
+        }
+        __atomic_store_n(&async->waiting, 0, __ATOMIC_SEQ_CST);
+        __log_async_drain(async);
+    }
+}
+
+static OPERATE_RET __log_async_init(void)
+{
+    OPERATE_RET rt = OPRT_OK;
+    uint32_t i = 0;
+
+    LOG_ASYNC_T *async = (LOG_ASYNC_T *)tal_calloc(1, sizeof(LOG_ASYNC_T));
+    TUYA_CHECK_NULL_RETURN(async, OPRT_MALLOC_FAILED);
+
+    for (i = 0; i < LOG_ASYNC_RECORD_NUM; i++) {
+        async->rec[i].seq = i;
+    }
+    async->tm_sec = (TIME_T)-1;
+
+    TUYA_CALL_ERR_GOTO(tal_semaphore_create_init(&async->sem, 0, 0xFFFF), __ERR);
+    TUYA_CALL_ERR_GOTO(tal_mutex_create_init(&async->drain_mutex), __ERR);
+
+    THREAD_CFG_T thread_cfg = {.stackDepth = STACK_SIZE_LOG_ASYNC, .priority = THREAD_PRIO_3, .thrdname = "log_async"};
+    TUYA_CALL_ERR_GOTO(tal_thread_create_and_start(&async->thread, NULL, NULL, __log_async_thread_cb, async, &thread_cfg),
+                       __ERR);
+    pLogManage->async = async;
+
+    return OPRT_OK;
+
+__ERR:
+    if (async->drain_mutex) {
+        tal_mutex_release(async->drain_mutex);
+    }
+    if (async->sem) {
+        tal_semaphore_release(async->sem);
+    }
+    tal_free(async);
+    return rt;
+}
+
+static void __log_async_deinit(void)
+{
+    LOG_ASYNC_T *async = pLogManage->async;
+    if (NULL == async) {
+        return;
+    }
+
+    tal_thread_delete(async->thread);
+    tal_semaphore_post(async->sem);
+    while (THREAD_STATE_DELETE != tal_thread_get_state(async->thread)) {
+        tal_system_sleep(10);
+    }
+    __log_async_drain(async);
+    pLogManage->async = NULL;
+
+    tal_mutex_release(async->drain_mutex);
+    tal_semaphore_release(async->sem);
+    tal_free(async);
+}
+#endif
+
 /**
  * @brief Initializes the TAL log system.
  *
@@ -134,6 +965,9 @@ OPERATE_RET tal_log_init(const TAL_LOG_LEVEL_E level, const int buf_len, const T
         INIT_LIST_HEAD(&(tmp_log_mng->log_list));
         tmp_log_mng->curLogLevel = level;
         tmp_log_mng->ms_level = FALSE;
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+        tmp_log_mng->async = NULL;
+#endif
         pLogManage = tmp_log_mng;
 
         // set default log style
@@ -146,6 +980,11 @@ OPERATE_RET tal_log_init(const TAL_LOG_LEVEL_E level, const int buf_len, const T
             tal_free(tmp_log_mng);
             return op_ret;
         }
+
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+        // keep logging synchronously if the drain thread can not be started
+        __log_async_init();
+#endif
     } else {
         pLogManage->curLogLevel = level;
     }
@@ -153,19 +992,6 @@ OPERATE_RET tal_log_init(const TAL_LOG_LEVEL_E level, const int buf_len, const T
     return OPRT_OK;
 }
 
-void __output_logManage_buf(void)
-{
-    P_LIST_HEAD pPos;
-    LOG_OUT_NODE_S *output_node;
-    tuya_list_for_each(pPos, &(pLogManage->log_list))
-    {
-        output_node = tuya_list_entry(pPos, LOG_OUT_NODE_S, node);
-        if (output_node->out_term) {
-            output_node->out_term(pLogManage->log_buf);
-        }
-    }
-}
-
 OPERATE_RET __find_out_term_node(const char *name, LOG_OUT_NODE_S **node)
 {
     P_LIST_HEAD pPos;
@@ -228,18 +1054,6 @@ OPERATE_RET tal_log_add_output_term(const char *name, const TAL_LOG_OUTPUT_CB te
     return OPRT_OK;
 }
 
-static int tal_log_strrchr(char *str, char ch)
-{
-    char *ta;
-
-    ta = strrchr(str, ch);
-    if (ta) {
-        return (int)(ta - str);
-    }
-
-    return -1;
-}
-
 /**
  * @brief Deletes a log output terminal with the specified name.
  *
@@ -380,75 +1194,33 @@ OPERATE_RET PrintLogV(LOG_LEVEL logLevel, char *pFile, uint32_t line, const char
     if (logLevel > tmpLogLevel) {
         return OPRT_BASE_LOG_MNG_PRINT_LOG_LEVEL_HIGHER;
     }
-    const char *pTmpModuleName = "ty";
-    const char *pTmpFilename = NULL;
+    const char *pTmpFilename = __log_file_basename(pFile);
 
-    if (NULL == pFile) {
-        pTmpFilename = "Null";
-    } else {
-        int pos = 0;
-        pTmpFilename = pFile;
-        pos = tal_log_strrchr((char *)pFile, '/');
-        if (pos < 0) {
-            pos = tal_log_strrchr((char *)pFile, '\\');
-            if (pos >= 0) {
-                pTmpFilename = pFile + pos + 1;
-            }
-        } else {
-            pTmpFilename = pFile + pos + 1;
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    if (pLogManage->async) {
+        OPERATE_RET rt = __log_async_post(pLogManage->async, logLevel, pTmpFilename, line, pFmt, ap);
+        if (OPRT_BUFFER_NOT_ENOUGH != rt) {
+            return rt;
         }
+        // too long for a record, print what is queued before it and format it here
+        __log_async_drain(pLogManage->async);
     }
-    tal_mutex_lock(pLogManage->mutex);
+#endif
 
-    // color prefix
-    if (pLogManage->log_color.enable_color) {
-        cnt = snprintf(pLogManage->log_buf, pLogManage->log_buf_len, "\033[%d;%d;%dm",
-                       pLogManage->log_color.style[logLevel].display_mode,
-                       pLogManage->log_color.style[logLevel].font_color,
-                       pLogManage->log_color.style[logLevel].background_color);
-        if (cnt <= 0) {
-            goto ERR_EXIT;
-        }
-        len += cnt;
-    }
-
-    POSIX_TM_S tm;
-    memset(&tm, 0, sizeof(tm));
+    tal_mutex_lock(pLogManage->mutex);
 
-    if (pLogManage->ms_level == FALSE) {
-        tal_time_get_local_time_custom(0, &tm);
-        cnt = snprintf(pLogManage->log_buf + len, pLogManage->log_buf_len - len,
-                       "[%02d-%02d %02d:%02d:%02d %s %s][%s:%" PRIu32 "] ", tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
-                       tm.tm_min, tm.tm_sec, pTmpModuleName, sLevelStr[logLevel], pTmpFilename, line);
-    } else {
-        SYS_TICK_T time_ms = tal_time_get_posix_ms();
-        TIME_T sec = (TIME_T)(time_ms / 1000);
-        uint32_t ms = (uint32_t)(time_ms % 1000);
-        tal_time_get_local_time_custom(sec, &tm);
-        cnt = snprintf(pLogManage->log_buf + len, pLogManage->log_buf_len - len,
-                       "[%02d-%02d %02d:%02d:%02d:%" PRIu32 " %s %s][%s:%" PRIu32 "] ", tm.tm_mon + 1, tm.tm_mday,
-                       tm.tm_hour, tm.tm_min, tm.tm_sec, ms, pTmpModuleName, sLevelStr[logLevel], pTmpFilename, line);
-    }
-    if (cnt <= 0) {
+    len = __log_format_head(logLevel, pTmpFilename, line, NULL, 0);
+    if (len <= 0) {
         goto ERR_EXIT;
     }
-    len += cnt;
     cnt = vsnprintf(pLogManage->log_buf + len, pLogManage->log_buf_len - len, pFmt, ap);
     if (cnt <= 0) {
         goto ERR_EXIT;
     }
     len += cnt;
-
-    char *p_suffix = (pLogManage->log_color.enable_color) ? "\033[0m\r\n" : "\r\n";
-    if (len > (int)(pLogManage->log_buf_len - strlen(p_suffix) - 1)) { // 1 -> "\0"
-        len = pLogManage->log_buf_len - strlen(p_suffix) - 1;
-    }
-    cnt = snprintf(pLogManage->log_buf + len, pLogManage->log_buf_len - len, "%s", p_suffix);
-    if (cnt <= 0) {
+    if (__log_format_tail(len) <= 0) {
         goto ERR_EXIT;
     }
-    len += cnt;
-    pLogManage->log_buf[len] = '\0';
 
     __output_logManage_buf();
     tal_mutex_unlock(pLogManage->mutex);
@@ -524,6 +1296,12 @@ OPERATE_RET tal_log_print_raw(const char *pFmt, ...)
     OPERATE_RET opRet = 0;
     va_list ap;
 
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    // raw output is not queued, print what is queued before it to keep the order
+    if (pLogManage->async) {
+        __log_async_drain(pLogManage->async);
+    }
+#endif
     tal_mutex_lock(pLogManage->mutex);
     va_start(ap, pFmt);
     opRet = __PrintLogVRaw(pFmt, ap);
@@ -547,9 +1325,13 @@ void tal_log_release(void)
         return;
     }
 
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    __log_async_deinit();
+#endif
+
     while (!tuya_list_empty(&(pLogManage->log_list))) {
         LOG_OUT_NODE_S *log_out_nd = NULL;
-        log_out_nd = tuya_list_entry(&(pLogManage->log_list.next), LOG_OUT_NODE_S, node);
+        log_out_nd = tuya_list_entry(pLogManage->log_list.next, LOG_OUT_NODE_S, node);
         tuya_list_del(&(log_out_nd->node));
         if (log_out_nd->name) {
             tal_free(log_out_nd->name);
@@ -696,6 +1478,12 @@ OPERATE_RET tal_log_color_print_raw(TAL_LOG_DISPLAY_MODE_E display_mode, TAL_LOG
         return OPRT_INVALID_PARM;
     }
 
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    // raw output is not queued, print what is queued before it to keep the order
+    if (pLogManage->async) {
+        __log_async_drain(pLogManage->async);
+    }
+#endif
     tal_mutex_lock(pLogManage->mutex);
     va_start(ap, pFmt);
     if (pLogManage->log_color.enable_color) {
@@ -737,3 +1525,44 @@ __EXIT:
 
     return opRet;
 }
+
+/**
+ * @brief Outputs every log record queued by the asynchronous mode.
+ *
+ * Formats and writes the queued records in the context of the caller. It is
+ * meant for paths that must not lose logs, such as before a reboot or in a
+ * crash handler. Does nothing if the asynchronous mode is not running.
+ *
+ * @return OPRT_OK on success, OPRT_INVALID_PARM if the log is not initialized.
+ */
+OPERATE_RET tal_log_async_flush(void)
+{
+    if (NULL == pLogManage) {
+        return OPRT_INVALID_PARM;
+    }
+
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    if (pLogManage->async) {
+        __log_async_drain(pLogManage->async);
+    }
+#endif
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief Gets the number of log records dropped because the ring was full.
+ *
+ * @return The number of dropped records since init, 0 if the asynchronous mode
+ * is not running.
+ */
+uint32_t tal_log_async_get_drop_cnt(void)
+{
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    if (pLogManage && pLogManage->async) {
+        return __atomic_load_n(&pLogManage->async->drop_cnt, __ATOMIC_RELAXED);
+    }
+#endif
+
+    return 0;
+}
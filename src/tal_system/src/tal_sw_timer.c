@@ -12,8 +12,47 @@
 #define STACK_SIZE_TIMERQ (4 * 1024)
 #endif
 
+#if defined(ENABLE_SW_TIMER_WHEEL) && (ENABLE_SW_TIMER_WHEEL == 1)
+#define SW_TIMER_USE_WHEEL 1
+#else
+#define SW_TIMER_USE_WHEEL 0
+#endif
+
+#ifndef SW_TIMER_WHEEL_TICK_MS
+#define SW_TIMER_WHEEL_TICK_MS 1
+#endif
+
+#ifndef SW_TIMER_EXEC_THREAD_NUM
+#define SW_TIMER_EXEC_THREAD_NUM 0
+#endif
+
+#ifndef STACK_SIZE_TIMER_EXEC
+#define STACK_SIZE_TIMER_EXEC (4 * 1024)
+#endif
+
+#define TIMER_EXEC_SEM_MAX 0xFFFF
+
+#if SW_TIMER_USE_WHEEL
+// hashed hierarchical timing wheel, every level has 64 slots
+#define TW_LEVEL_BITS 6
+#define TW_LEVEL_SIZE (1 << TW_LEVEL_BITS)
+#define TW_LEVEL_MASK (TW_LEVEL_SIZE - 1)
+#define TW_LEVEL_NUM  5
+#define TW_MAX_TICKS  ((1ULL << (TW_LEVEL_BITS * TW_LEVEL_NUM)) - 1)
+
+#define TW_MS_TO_TICK(ms)        (((ms) + SW_TIMER_WHEEL_TICK_MS - 1) / SW_TIMER_WHEEL_TICK_MS)
+#define TW_LEVEL_INDEX(tick, lv) (((tick) >> ((lv) * TW_LEVEL_BITS)) & TW_LEVEL_MASK)
+
+typedef struct {
+    LIST_HEAD slot[TW_LEVEL_NUM][TW_LEVEL_SIZE];
+    LIST_HEAD list_expired; // triggered or overdue timers, run on next dispatch
+    uint64_t cur_tick;      // next tick to be processed
+} TIMER_WHEEL_T;
+#endif
+
 typedef struct {
     LIST_HEAD node;
+    LIST_HEAD exec_node; // pending in callback executor
 
     TAL_TIMER_CB cb;
     void *data;
@@ -23,10 +62,20 @@ typedef struct {
     BOOL_T is_running;
     TIMER_ID timer_id;
     TIMER_TYPE type;
+
+#if SW_TIMER_EXEC_THREAD_NUM > 0
+    BOOL_T in_exec;    // callback is running on an executor
+    BOOL_T exec_again; // expired again while in_exec, queue it when the callback returns
+    BOOL_T deleted;    // deleted while in_exec, freed by the executor
+#endif
 } TIMER_T;
 
 typedef struct {
+#if SW_TIMER_USE_WHEEL
+    TIMER_WHEEL_T wheel;
+#else
     LIST_HEAD list_active;
+#endif
     LIST_HEAD list_standby;
     MUTEX_HANDLE mutex;
     uint16_t total_cnt;
@@ -36,10 +85,210 @@ typedef struct {
     THREAD_HANDLE thread;
     SEM_HANDLE sem;
     TAL_TIMER_CB last_cb; // used to debug which cb is blocked
+
+#if SW_TIMER_EXEC_THREAD_NUM > 0
+    LIST_HEAD list_exec;
+    SEM_HANDLE exec_sem;
+    THREAD_HANDLE exec_thread[SW_TIMER_EXEC_THREAD_NUM];
+#endif
 } SW_TIMER_MGR_T;
 
 static SW_TIMER_MGR_T s_timer_mgr;
 
+static uint64_t __timer_now_ms(void)
+{
+    TIME_S nowSecTime = 0;
+    TIME_MS nowMsTime = 0;
+
+    tal_time_get_system_time(&nowSecTime, &nowMsTime);
+
+    return (uint64_t)nowSecTime * 1000 + (uint64_t)nowMsTime;
+}
+
+#if SW_TIMER_USE_WHEEL
+static void __wheel_init(TIMER_WHEEL_T *wheel)
+{
+    int lv = 0, i = 0;
+
+    for (lv = 0; lv < TW_LEVEL_NUM; lv++) {
+        for (i = 0; i < TW_LEVEL_SIZE; i++) {
+            INIT_LIST_HEAD(&(wheel->slot[lv][i]));
+        }
+    }
+    INIT_LIST_HEAD(&(wheel->list_expired));
+    wheel->cur_tick = __timer_now_ms() / SW_TIMER_WHEEL_TICK_MS;
+}
+
+static void __wheel_add(TIMER_WHEEL_T *wheel, TIMER_T *timer)
+{
+    uint64_t expires = TW_MS_TO_TICK(timer->expire_time);
+    uint64_t delta = 0;
+    int lv = 0;
+
+    if (expires < wheel->cur_tick) {
+        tuya_list_add_tail(&(timer->node), &(wheel->list_expired));
+        return;
+    }
+
+    delta = expires - wheel->cur_tick;
+    if (delta > TW_MAX_TICKS) {
+        // far timers park on the top level and get re-cascaded
+        delta = TW_MAX_TICKS;
+        expires = wheel->cur_tick + delta;
+    }
+
+    for (lv = 0; lv < TW_LEVEL_NUM - 1; lv++) {
+        if (delta < (1ULL << ((lv + 1) * TW_LEVEL_BITS))) {
+            break;
+        }
+    }
+
+    tuya_list_add_tail(&(timer->node), &(wheel->slot[lv][TW_LEVEL_INDEX(expires, lv)]));
+}
+
+static BOOL_T __wheel_cascade(TIMER_WHEEL_T *wheel, int lv)
+{
+    int index = TW_LEVEL_INDEX(wheel->cur_tick, lv);
+    LIST_HEAD list_tmp;
+    struct tuya_list_head *p = NULL, *n = NULL;
+
+    INIT_LIST_HEAD(&list_tmp);
+    tuya_list_splice(&(wheel->slot[lv][index]), &list_tmp);
+    INIT_LIST_HEAD(&(wheel->slot[lv][index]));
+
+    tuya_list_for_each_safe(p, n, &list_tmp)
+    {
+        __wheel_add(wheel, tuya_list_entry(p, TIMER_T, node));
+    }
+
+    return (0 == index);
+}
+
+static void __wheel_splice_tail(P_LIST_HEAD list, P_LIST_HEAD head)
+{
+    if (tuya_list_empty(list)) {
+        return;
+    }
+
+    list->next->prev = head->prev;
+    head->prev->next = list->next;
+    list->prev->next = head;
+    head->prev = list->prev;
+    INIT_LIST_HEAD(list);
+}
+
+/**
+ * @brief move all timers expired until now_tick to work list
+ */
+static void __wheel_collect(TIMER_WHEEL_T *wheel, uint64_t now_tick, P_LIST_HEAD work_list)
+{
+    int index = 0, lv = 0;
+
+    __wheel_splice_tail(&(wheel->list_expired), work_list);
+
+    while (wheel->cur_tick <= now_tick) {
+        index = TW_LEVEL_INDEX(wheel->cur_tick, 0);
+        if (0 == index) {
+            for (lv = 1; lv < TW_LEVEL_NUM; lv++) {
+                if (!__wheel_cascade(wheel, lv)) {
+                    break;
+                }
+            }
+        }
+
+        // keep expire order, earlier ticks are already at the front
+        __wheel_splice_tail(&(wheel->slot[0][index]), work_list);
+
+        wheel->cur_tick++;
+    }
+}
+
+/**
+ * @brief get the earliest expire tick of the timers in the first non-empty slot of a level
+ *
+ * @return TW_MAX_TICKS added to cur_tick if the level is empty
+ */
+static uint64_t __wheel_level_next(TIMER_WHEEL_T *wheel, int lv)
+{
+    int cur = TW_LEVEL_INDEX(wheel->cur_tick, lv);
+    int i = 0, index = 0;
+    uint64_t next = wheel->cur_tick + TW_MAX_TICKS;
+    uint64_t expires = 0;
+    struct tuya_list_head *p = NULL;
+
+    // the current slot of an upper level was cascaded on entry, timers in it are one revolution away
+    for (i = 1; i <= TW_LEVEL_SIZE; i++) {
+        index = (cur + i) & TW_LEVEL_MASK;
+        if (tuya_list_empty(&(wheel->slot[lv][index]))) {
+            continue;
+        }
+
+        tuya_list_for_each(p, &(wheel->slot[lv][index]))
+        {
+            expires = TW_MS_TO_TICK(tuya_list_entry(p, TIMER_T, node)->expire_time);
+            if (expires < next) {
+                next = expires;
+            }
+        }
+        break;
+    }
+
+    return next;
+}
+
+/**
+ * @brief get ms to sleep until the earliest timer expires
+ */
+static SYS_TIME_T __wheel_next_expired(TIMER_WHEEL_T *wheel, uint64_t nowMS)
+{
+    uint64_t tick = wheel->cur_tick;
+    uint64_t next = 0, expires = 0;
+    uint64_t expire_ms = 0;
+    int lv = 0;
+
+    if (!tuya_list_empty(&(wheel->list_expired))) {
+        return 0;
+    }
+
+    // level 0 holds exact ticks, its slots may wrap past the next cascade
+    next = tick + TW_MAX_TICKS;
+    for (; tick < wheel->cur_tick + TW_LEVEL_SIZE; tick++) {
+        if (!tuya_list_empty(&(wheel->slot[0][TW_LEVEL_INDEX(tick, 0)]))) {
+            next = tick;
+            break;
+        }
+    }
+
+    // a timer on an upper level can still expire before a wrapped level 0 timer
+    for (lv = 1; lv < TW_LEVEL_NUM; lv++) {
+        expires = __wheel_level_next(wheel, lv);
+        if (expires < next) {
+            next = expires;
+        }
+    }
+
+    expire_ms = next * SW_TIMER_WHEEL_TICK_MS;
+
+    return (expire_ms > nowMS) ? (SYS_TIME_T)(expire_ms - nowMS) : 0;
+}
+
+static void __timer_attach(TIMER_T *timer)
+{
+    uint64_t now_tick = 0;
+
+    tuya_list_del(&(timer->node));
+
+    // the wheel has been idle, jump over the ticks without timers
+    if (s_timer_mgr.running_cnt <= 1) {
+        now_tick = __timer_now_ms() / SW_TIMER_WHEEL_TICK_MS;
+        if (now_tick > s_timer_mgr.wheel.cur_tick) {
+            s_timer_mgr.wheel.cur_tick = now_tick;
+        }
+    }
+
+    __wheel_add(&(s_timer_mgr.wheel), timer);
+}
+#else
 static void __timer_attach(TIMER_T *timer)
 {
     tuya_list_del(&(timer->node));
@@ -64,14 +313,123 @@ static void __timer_attach(TIMER_T *timer)
         }
     }
 }
+#endif
 
-static void __timer_dump(void)
+#if SW_TIMER_EXEC_THREAD_NUM > 0
+static void __timer_exec_thread_cb(void *data)
+{
+    THREAD_HANDLE *thread = (THREAD_HANDLE *)data;
+    TIMER_T *timer = NULL;
+    TAL_TIMER_CB timer_cb = NULL;
+    TIMER_ID timer_id = NULL;
+    void *timer_data = NULL;
+
+    while (THREAD_STATE_RUNNING == tal_thread_get_state(*thread)) {
+        tal_semaphore_wait(s_timer_mgr.exec_sem, SEM_WAIT_FOREVER);
+
+        for (;;) {
+            tal_mutex_lock(s_timer_mgr.mutex);
+            if (tuya_list_empty(&(s_timer_mgr.list_exec))) {
+                tal_mutex_unlock(s_timer_mgr.mutex);
+                break;
+            }
+            timer = tuya_list_entry(s_timer_mgr.list_exec.next, TIMER_T, exec_node);
+            tuya_list_del_init(&(timer->exec_node));
+            timer->in_exec = TRUE;
+            timer_cb = timer->cb;
+            timer_id = timer->timer_id;
+            timer_data = timer->data;
+            tal_mutex_unlock(s_timer_mgr.mutex);
+
+            timer_cb(timer_id, timer_data);
+
+            tal_mutex_lock(s_timer_mgr.mutex);
+            timer->in_exec = FALSE;
+            if (timer->deleted) {
+                tal_mutex_unlock(s_timer_mgr.mutex);
+                tal_free(timer);
+                continue;
+            }
+            // expirations during the callback are coalesced into one more run
+            if (timer->exec_again) {
+                timer->exec_again = FALSE;
+                tuya_list_add_tail(&(timer->exec_node), &(s_timer_mgr.list_exec));
+            }
+            tal_mutex_unlock(s_timer_mgr.mutex);
+        }
+    }
+}
+
+static OPERATE_RET __timer_exec_init(void)
+{
+    OPERATE_RET op_ret = OPRT_OK;
+    int i = 0;
+
+    INIT_LIST_HEAD(&(s_timer_mgr.list_exec));
+    op_ret = tal_semaphore_create_init(&s_timer_mgr.exec_sem, 0, TIMER_EXEC_SEM_MAX);
+    if (OPRT_OK != op_ret) {
+        return op_ret;
+    }
+
+    THREAD_CFG_T thread_cfg = {.stackDepth = STACK_SIZE_TIMER_EXEC, .priority = THREAD_PRIO_1, .thrdname = "sys_timer_exec"};
+
+    for (i = 0; i < SW_TIMER_EXEC_THREAD_NUM; i++) {
+        op_ret = tal_thread_create_and_start(&s_timer_mgr.exec_thread[i], NULL, NULL, __timer_exec_thread_cb,
+                                             &s_timer_mgr.exec_thread[i], &thread_cfg);
+        if (OPRT_OK != op_ret) {
+            PR_ERR("create timer exec thread %d fail:%d", i, op_ret);
+            return op_ret;
+        }
+    }
+
+    return OPRT_OK;
+}
+#endif
+
+/**
+ * @brief hand an expired timer to callback executor, mutex must be held
+ *
+ * @return TRUE if the callback was queued, FALSE if the caller should run it
+ */
+static BOOL_T __timer_exec_post(TIMER_T *timer)
+{
+#if SW_TIMER_EXEC_THREAD_NUM > 0
+    // a callback never runs concurrently with itself, nor is it queued twice
+    if (timer->in_exec) {
+        timer->exec_again = TRUE;
+    } else if (tuya_list_empty(&(timer->exec_node))) {
+        tuya_list_add_tail(&(timer->exec_node), &(s_timer_mgr.list_exec));
+        tal_semaphore_post(s_timer_mgr.exec_sem);
+    }
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+static void __timer_dump_list(P_LIST_HEAD list)
 {
     struct tuya_list_head *p = NULL;
     TIMER_T *timer = NULL;
     TAL_TIMER_CB *cb = NULL;
     TIMER_ID *timer_id = NULL;
 
+    tuya_list_for_each(p, list)
+    {
+        timer = tuya_list_entry(p, TIMER_T, node);
+        cb = &(timer->cb);
+        if (timer->data) {
+            timer_id = timer->data;
+            if (*timer_id == timer->timer_id) {
+                cb = (TAL_TIMER_CB *)((char *)timer->data + sizeof(TIMER_ID));
+            }
+        }
+        PR_NOTICE("%08x %d %d %p", timer->timer_id, timer->type, timer->interval, *cb);
+    }
+}
+
+static void __timer_dump(void)
+{
     TIME_S nowSecTime = 0;
     TIME_MS nowMsTime = 0;
 
@@ -86,40 +444,94 @@ static void __timer_dump(void)
     tal_mutex_lock(s_timer_mgr.mutex);
 
     PR_NOTICE("running timers count:%d", s_timer_mgr.running_cnt);
-    tuya_list_for_each(p, &(s_timer_mgr.list_active))
-    {
-        timer = tuya_list_entry(p, TIMER_T, node);
-        cb = &(timer->cb);
-        if (timer->data) {
-            timer_id = timer->data;
-            if (*timer_id == timer->timer_id) {
-                cb = (TAL_TIMER_CB *)((char *)timer->data + sizeof(TIMER_ID));
-            }
+#if SW_TIMER_USE_WHEEL
+    int lv = 0, i = 0;
+    __timer_dump_list(&(s_timer_mgr.wheel.list_expired));
+    for (lv = 0; lv < TW_LEVEL_NUM; lv++) {
+        for (i = 0; i < TW_LEVEL_SIZE; i++) {
+            __timer_dump_list(&(s_timer_mgr.wheel.slot[lv][i]));
         }
-        PR_NOTICE("%08x %d %d %p", timer->timer_id, timer->type, timer->interval, *cb);
     }
+#else
+    __timer_dump_list(&(s_timer_mgr.list_active));
+#endif
 
     PR_NOTICE("standby timers count:%d", s_timer_mgr.total_cnt - s_timer_mgr.running_cnt);
-    tuya_list_for_each(p, &(s_timer_mgr.list_standby))
-    {
-        timer = tuya_list_entry(p, TIMER_T, node);
-        cb = &(timer->cb);
-        if (timer->data) {
-            timer_id = timer->data;
-            if (*timer_id == timer->timer_id) {
-                cb = (TAL_TIMER_CB *)((char *)timer->data + sizeof(TIMER_ID));
-            }
+    __timer_dump_list(&(s_timer_mgr.list_standby));
+
+    tal_mutex_unlock(s_timer_mgr.mutex);
+}
+
+/**
+ * @brief update an expired timer, mutex must be held
+ *
+ * @return the callback to run in timer thread, NULL if nothing to run
+ */
+static TAL_TIMER_CB __timer_expire(TIMER_T *timer, uint64_t nowMS)
+{
+    if (TAL_TIMER_ONCE == timer->type) {
+        timer->is_running = FALSE;
+        s_timer_mgr.running_cnt--;
+        tuya_list_del(&(timer->node));
+        tuya_list_add_tail(&(timer->node), &(s_timer_mgr.list_standby));
+    } else {
+        timer->expire_time = nowMS + timer->interval;
+        __timer_attach(timer);
+    }
+
+    if (__timer_exec_post(timer)) {
+        return NULL;
+    }
+
+    return timer->cb;
+}
+
+#if SW_TIMER_USE_WHEEL
+static void __timer_dispatch(SYS_TIME_T *next_expired)
+{
+    uint64_t nowMS = 0;
+    TIMER_T *timer = NULL;
+    TAL_TIMER_CB timer_cb = NULL;
+    TIMER_ID timer_id = NULL;
+    void *timer_data = NULL;
+    LIST_HEAD work_list;
+
+    INIT_LIST_HEAD(&work_list);
+
+    nowMS = __timer_now_ms();
+
+    tal_mutex_lock(s_timer_mgr.mutex);
+    __wheel_collect(&(s_timer_mgr.wheel), nowMS / SW_TIMER_WHEEL_TICK_MS, &work_list);
+
+    // timers in work list can still be stopped or restarted by callbacks
+    while (!tuya_list_empty(&work_list)) {
+        timer = tuya_list_entry(work_list.next, TIMER_T, node);
+        timer_cb = __timer_expire(timer, nowMS);
+        if (NULL == timer_cb) {
+            continue;
         }
-        PR_NOTICE("%08x %d %d %p", timer->timer_id, timer->type, timer->interval, *cb);
+
+        timer_id = timer->timer_id;
+        timer_data = timer->data;
+        tal_mutex_unlock(s_timer_mgr.mutex);
+
+        s_timer_mgr.last_cb = timer_cb;
+        timer_cb(timer_id, timer_data);
+        s_timer_mgr.last_cb = NULL;
+
+        tal_mutex_lock(s_timer_mgr.mutex);
     }
 
+    if (0 == s_timer_mgr.running_cnt) {
+        *next_expired = SEM_WAIT_FOREVER;
+    } else {
+        *next_expired = __wheel_next_expired(&(s_timer_mgr.wheel), __timer_now_ms());
+    }
     tal_mutex_unlock(s_timer_mgr.mutex);
 }
-
+#else
 static void __timer_dispatch(SYS_TIME_T *next_expired)
 {
-    TIME_S nowSecTime = 0;
-    TIME_MS nowMsTime = 0;
     uint64_t nowMS = 0;
     TIMER_T *timer = NULL;
     TAL_TIMER_CB timer_cb = NULL;
@@ -128,8 +540,7 @@ static void __timer_dispatch(SYS_TIME_T *next_expired)
     *next_expired = SEM_WAIT_FOREVER;
 
     do {
-        tal_time_get_system_time(&nowSecTime, &nowMsTime);
-        nowMS = (uint64_t)nowSecTime * 1000 + (uint64_t)nowMsTime;
+        nowMS = __timer_now_ms();
 
         tal_mutex_lock(s_timer_mgr.mutex);
 
@@ -142,17 +553,7 @@ static void __timer_dispatch(SYS_TIME_T *next_expired)
                 p = &(s_timer_mgr.list_active);
                 *next_expired = timer->expire_time - nowMS;
             } else {
-                timer_cb = timer->cb;
-
-                if (TAL_TIMER_ONCE == timer->type) {
-                    timer->is_running = FALSE;
-                    s_timer_mgr.running_cnt--;
-                    tuya_list_del(&(timer->node));
-                    tuya_list_add_tail(&(timer->node), &(s_timer_mgr.list_standby));
-                } else {
-                    timer->expire_time = nowMS + timer->interval;
-                    __timer_attach(timer);
-                }
+                timer_cb = __timer_expire(timer, nowMS);
             }
 
             break;
@@ -168,6 +569,7 @@ static void __timer_dispatch(SYS_TIME_T *next_expired)
         }
     } while (p != &(s_timer_mgr.list_active));
 }
+#endif
 
 static void __timer_thread_cb(void *data)
 {
@@ -201,9 +603,20 @@ OPERATE_RET tal_sw_timer_init(void)
     tal_mutex_create_init(&s_timer_mgr.mutex);
     tal_semaphore_create_init(&s_timer_mgr.sem, 0, 2);
 
+#if SW_TIMER_USE_WHEEL
+    __wheel_init(&(s_timer_mgr.wheel));
+#else
     INIT_LIST_HEAD(&(s_timer_mgr.list_active));
+#endif
     INIT_LIST_HEAD(&(s_timer_mgr.list_standby));
 
+#if SW_TIMER_EXEC_THREAD_NUM > 0
+    op_ret = __timer_exec_init();
+    if (OPRT_OK != op_ret) {
+        return op_ret;
+    }
+#endif
+
     THREAD_CFG_T thread_cfg = {.stackDepth = STACK_SIZE_TIMERQ, .priority = THREAD_PRIO_0, .thrdname = "sys_timer"};
 
     op_ret = tal_thread_create_and_start(&s_timer_mgr.thread, NULL, NULL, __timer_thread_cb, NULL, &thread_cfg);
@@ -240,6 +653,7 @@ OPERATE_RET tal_sw_timer_create(TAL_TIMER_CB func, void *arg, TIMER_ID *timer_id
     timer->cb = func;
     timer->data = arg;
     timer->timer_id = (TIMER_ID)timer;
+    INIT_LIST_HEAD(&(timer->exec_node));
 
     tal_mutex_lock(s_timer_mgr.mutex);
     s_timer_mgr.total_cnt++;
@@ -271,13 +685,25 @@ OPERATE_RET tal_sw_timer_delete(TIMER_ID timer_id)
 
     tal_mutex_lock(s_timer_mgr.mutex);
     tuya_list_del(&(timer->node));
+    tuya_list_del_init(&(timer->exec_node));
     s_timer_mgr.total_cnt--;
     if (timer->is_running) {
         s_timer_mgr.running_cnt--;
     }
+#if SW_TIMER_EXEC_THREAD_NUM > 0
+    // the executor running the callback frees the timer when it returns
+    if (timer->in_exec) {
+        timer->is_running = FALSE;
+        timer->exec_again = FALSE;
+        timer->deleted = TRUE;
+        timer = NULL;
+    }
+#endif
     tal_mutex_unlock(s_timer_mgr.mutex);
     tal_semaphore_post(s_timer_mgr.sem);
-    tal_free(timer);
+    if (timer) {
+        tal_free(timer);
+    }
 
     return OPRT_OK;
 }
@@ -442,8 +868,12 @@ OPERATE_RET tal_sw_timer_trigger(TIMER_ID timer_id)
     tal_mutex_lock(s_timer_mgr.mutex);
     timer->expire_time = 0;
     if (timer->is_running) {
+#if SW_TIMER_USE_WHEEL
+        __timer_attach(timer);
+#else
         tuya_list_del(&(timer->node));
         tuya_list_add(&(timer->node), &(s_timer_mgr.list_active));
+#endif
     }
     tal_mutex_unlock(s_timer_mgr.mutex);
     tal_semaphore_post(s_timer_mgr.sem);
@@ -49,6 +49,14 @@
 #define STACK_SIZE_MSG_QUEUE (4 * 1024)
 #endif
 
+#ifndef THREAD_NUM_WORK_QUEUE
+#define THREAD_NUM_WORK_QUEUE 1
+#endif
+
+#ifndef THREAD_NUM_MSG_QUEUE
+#define THREAD_NUM_MSG_QUEUE 1
+#endif
+
 static WORKQUEUE_HANDLE wq_system;
 static WORKQUEUE_HANDLE wq_highpri;
 
@@ -73,7 +81,8 @@ OPERATE_RET tal_workq_init(void)
     thread_cfg.stackDepth += 1024;
 #endif
     thread_cfg.thrdname = "wq_system";
-    TUYA_CALL_ERR_GOTO(tal_workqueue_create(MAX_NODE_NUM_WORK_QUEUE, &thread_cfg, &wq_system), ERR_EXIT);
+    TUYA_CALL_ERR_GOTO(
+        tal_workqueue_create_pool(MAX_NODE_NUM_WORK_QUEUE, THREAD_NUM_WORK_QUEUE, &thread_cfg, &wq_system), ERR_EXIT);
 
     thread_cfg.priority = THREAD_PRIO_1;
     thread_cfg.stackDepth = STACK_SIZE_MSG_QUEUE;
@@ -81,7 +90,8 @@ OPERATE_RET tal_workq_init(void)
     thread_cfg.stackDepth += 1024;
 #endif
     thread_cfg.thrdname = "wq_highpri";
-    TUYA_CALL_ERR_GOTO(tal_workqueue_create(MAX_NODE_NUM_MSG_QUEUE, &thread_cfg, &wq_highpri), ERR_EXIT);
+    TUYA_CALL_ERR_GOTO(
+        tal_workqueue_create_pool(MAX_NODE_NUM_MSG_QUEUE, THREAD_NUM_MSG_QUEUE, &thread_cfg, &wq_highpri), ERR_EXIT);
 
     return OPRT_OK;
 
@@ -151,6 +161,22 @@ OPERATE_RET tal_workq_schedule_instant(WORKQ_SERVICE_E service, WORKQUEUE_CB cb,
     return tal_workqueue_schedule_instant(tal_workq_get_handle(service), cb, data);
 }
 
+/**
+ * @brief put work task in workqueue with priority
+ *
+ * @param[in] service the workqueue service
+ * @param[in] cb the work callback
+ * @param[in] data the work data
+ * @param[in] prio the priority class of the work
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_workq_schedule_prio(WORKQ_SERVICE_E service, WORKQUEUE_CB cb, void *data, WORK_PRIO_E prio)
+{
+    return tal_workqueue_schedule_prio(tal_workq_get_handle(service), cb, data, prio);
+}
+
 /**
  * @brief cancel work task in workqueue
  *
@@ -189,9 +215,23 @@ static BOOL_T _dump_cb(WORK_ITEM_T *item, void *ctx)
 
 void tal_workq_dump(WORKQ_SERVICE_E service)
 {
+    WORKQUEUE_STAT_T stat = {0};
+
     PR_NOTICE("---------workq-%d dump begin---------", service);
+    if (OPRT_OK == tal_workqueue_get_stat(tal_workq_get_handle(service), &stat)) {
+        PR_NOTICE("workers:%d depth:%d max:%d delayed:%d done:%u", stat.worker_num, stat.depth, stat.max_depth,
+                  stat.delayed_cnt, stat.done_cnt);
+        if (stat.done_cnt) {
+            PR_NOTICE("wait avg:%u max:%u, run avg:%u max:%u (ms)", (uint32_t)(stat.total_wait_ms / stat.done_cnt),
+                      stat.max_wait_ms, (uint32_t)(stat.total_run_ms / stat.done_cnt), stat.max_run_ms);
+        }
+    }
     tal_workqueue_traverse(tal_workq_get_handle(service), _dump_cb, NULL);
-    tal_thread_diagnose(tal_workqueue_get_thread(tal_workq_get_handle(service)));
+    // logs the callback each worker is running
+    tal_workqueue_get_num(tal_workq_get_handle(service));
+    for (uint8_t i = 0; i < stat.worker_num; i++) {
+        tal_thread_diagnose(tal_workqueue_get_worker(tal_workq_get_handle(service), i));
+    }
     PR_NOTICE("---------workq-%d dump end---------", service);
 }
 
@@ -16,6 +16,11 @@
  * - Implementation of the work queue thread callback for task execution.
  * - Synchronization mechanisms to ensure thread-safe operation and task
  * execution.
+ * - Worker pool with per-item priority classes.
+ * - Delayed work kept in a min-heap ordered by deadline, served by the workers
+ * themselves without software timers. A worker going busy hands the wait for
+ * the next deadline to an idle worker.
+ * - Queue depth, wait time and run time statistics.
  *
  * The implementation leverages Tuya's infrastructure components, such as
  * queues, threads, and semaphores, to provide a robust and efficient work queue
@@ -31,70 +36,303 @@
  *
  */
 
-#include "tuya_queue.h"
+#include "tuya_list.h"
 #include "tal_log.h"
+#include "tal_mutex.h"
 #include "tal_memory.h"
 #include "tal_thread.h"
 #include "tal_system.h"
 #include "tal_semaphore.h"
 #include "tal_workqueue.h"
-#include "tal_sw_timer.h"
+
+#define WORKQUEUE_SEM_MAX        0xFFFF
+#define DELAYED_HEAP_INIT_SIZE   8
+#define DELAYED_WORK_NOT_IN_HEAP (-1)
+
+typedef struct {
+    LIST_HEAD node;
+    WORK_ITEM_T item;
+    SYS_TIME_T enqueue_time;
+} WORK_NODE_T;
+
+struct TAL_WORKQUEUE;
 
 typedef struct {
-    TUYA_QUEUE_HANDLE queue;
+    struct TAL_WORKQUEUE *workqueue;
     THREAD_HANDLE thread;
-    SEM_HANDLE sem;
     WORKQUEUE_CB last_cb; // used to debug which cb is blocked
+} WORKQUEUE_WORKER_T;
+
+typedef struct {
+    WORKQUEUE_CB cb;
+    void *data;
+    struct TAL_WORKQUEUE *workqueue;
+
+    TIME_MS interval;
+    LOOP_TYPE type;
+    SYS_TIME_T deadline;
+    int heap_index;
+} DELAYED_WORK_T;
+
+typedef struct TAL_WORKQUEUE {
+    MUTEX_HANDLE mutex;
+    SEM_HANDLE sem;
+    LIST_HEAD list_ready[WORK_PRIO_MAX];
+    uint16_t queue_len;
+    uint16_t queue_used;
+
+    DELAYED_WORK_T **heap; // min-heap of delayed work ordered by deadline
+    uint16_t heap_size;
+    uint16_t heap_cnt;
+
+    uint8_t worker_num;
+    uint8_t idle_num; // workers waiting on sem, one of them keeps the delayed work on time
+    WORKQUEUE_WORKER_T *workers;
+
+    WORKQUEUE_STAT_T stat;
 } TAL_WORKQUEUE_T;
 
-static void __work_thread_cb(void *data)
+/***********************************************************
+***********************delayed work heap********************
+***********************************************************/
+static void __heap_set(TAL_WORKQUEUE_T *workqueue, int index, DELAYED_WORK_T *work)
 {
-    OPERATE_RET op_ret = OPRT_OK;
-    TAL_WORKQUEUE_T *workqueue = (TAL_WORKQUEUE_T *)data;
-    WORK_ITEM_T work_item = {0};
+    workqueue->heap[index] = work;
+    work->heap_index = index;
+}
 
-    while (THREAD_STATE_RUNNING == tal_thread_get_state(workqueue->thread)) {
-        op_ret = tal_semaphore_wait(workqueue->sem, SEM_WAIT_FOREVER);
-        if (OPRT_OK != op_ret) {
-            tal_system_sleep(10);
-            continue;
+static void __heap_sift_up(TAL_WORKQUEUE_T *workqueue, int index)
+{
+    DELAYED_WORK_T *work = workqueue->heap[index];
+    int parent = 0;
+
+    while (index > 0) {
+        parent = (index - 1) / 2;
+        if (workqueue->heap[parent]->deadline <= work->deadline) {
+            break;
         }
+        __heap_set(workqueue, index, workqueue->heap[parent]);
+        index = parent;
+    }
+    __heap_set(workqueue, index, work);
+}
 
-        op_ret = tuya_queue_output(workqueue->queue, &work_item);
-        if (OPRT_OK != op_ret) {
-            tal_system_sleep(10);
-            continue;
+static void __heap_sift_down(TAL_WORKQUEUE_T *workqueue, int index)
+{
+    DELAYED_WORK_T *work = workqueue->heap[index];
+    int child = 0;
+
+    for (;;) {
+        child = 2 * index + 1;
+        if (child >= workqueue->heap_cnt) {
+            break;
+        }
+        if ((child + 1 < workqueue->heap_cnt) &&
+            (workqueue->heap[child + 1]->deadline < workqueue->heap[child]->deadline)) {
+            child++;
         }
+        if (work->deadline <= workqueue->heap[child]->deadline) {
+            break;
+        }
+        __heap_set(workqueue, index, workqueue->heap[child]);
+        index = child;
+    }
+    __heap_set(workqueue, index, work);
+}
 
-        if (work_item.cb) {
-            workqueue->last_cb = work_item.cb;
-            work_item.cb(work_item.data);
-            workqueue->last_cb = NULL;
+static OPERATE_RET __heap_push(TAL_WORKQUEUE_T *workqueue, DELAYED_WORK_T *work)
+{
+    if (workqueue->heap_cnt >= workqueue->heap_size) {
+        uint16_t new_size = workqueue->heap_size ? workqueue->heap_size * 2 : DELAYED_HEAP_INIT_SIZE;
+        DELAYED_WORK_T **new_heap = (DELAYED_WORK_T **)tal_malloc(new_size * sizeof(DELAYED_WORK_T *));
+        if (NULL == new_heap) {
+            return OPRT_MALLOC_FAILED;
+        }
+        if (workqueue->heap) {
+            memcpy(new_heap, workqueue->heap, workqueue->heap_cnt * sizeof(DELAYED_WORK_T *));
+            tal_free(workqueue->heap);
         }
+        workqueue->heap = new_heap;
+        workqueue->heap_size = new_size;
     }
+
+    workqueue->heap[workqueue->heap_cnt] = work;
+    __heap_sift_up(workqueue, workqueue->heap_cnt++);
+
+    return OPRT_OK;
 }
 
-static BOOL_T __work_cancel_traverse(void *item, void *ctx)
+static void __heap_remove(TAL_WORKQUEUE_T *workqueue, DELAYED_WORK_T *work)
 {
-    BOOL_T is_same = FALSE;
-    WORK_ITEM_T *src = (WORK_ITEM_T *)item;
-    WORK_ITEM_T *dst = (WORK_ITEM_T *)ctx;
+    int index = work->heap_index;
 
-    if (src && dst) {
-        if (dst->cb && (dst->cb == src->cb)) {
-            is_same = TRUE;
-        }
+    if (DELAYED_WORK_NOT_IN_HEAP == index) {
+        return;
+    }
+
+    work->heap_index = DELAYED_WORK_NOT_IN_HEAP;
+    workqueue->heap_cnt--;
+    if (index == workqueue->heap_cnt) {
+        return;
+    }
 
-        if (dst->data && (dst->data == src->data)) {
-            is_same = TRUE;
+    __heap_set(workqueue, index, workqueue->heap[workqueue->heap_cnt]);
+    if ((index > 0) && (workqueue->heap[(index - 1) / 2]->deadline > workqueue->heap[index]->deadline)) {
+        __heap_sift_up(workqueue, index);
+    } else {
+        __heap_sift_down(workqueue, index);
+    }
+}
+
+/***********************************************************
+***********************work queue***************************
+***********************************************************/
+static OPERATE_RET __work_enqueue(TAL_WORKQUEUE_T *workqueue, WORKQUEUE_CB cb, void *data, WORK_PRIO_E prio,
+                                  BOOL_T to_front)
+{
+    WORK_NODE_T *work_node = (WORK_NODE_T *)tal_malloc(sizeof(WORK_NODE_T));
+    if (NULL == work_node) {
+        return OPRT_MALLOC_FAILED;
+    }
+
+    work_node->item.cb = cb;
+    work_node->item.data = data;
+    work_node->enqueue_time = tal_system_get_millisecond();
+
+    tal_mutex_lock(workqueue->mutex);
+    if (workqueue->queue_used >= workqueue->queue_len) {
+        tal_mutex_unlock(workqueue->mutex);
+        tal_free(work_node);
+        return OPRT_EXCEED_UPPER_LIMIT;
+    }
+
+    if (to_front) {
+        tuya_list_add(&(work_node->node), &(workqueue->list_ready[prio]));
+    } else {
+        tuya_list_add_tail(&(work_node->node), &(workqueue->list_ready[prio]));
+    }
+    workqueue->queue_used++;
+    if (workqueue->queue_used > workqueue->stat.max_depth) {
+        workqueue->stat.max_depth = workqueue->queue_used;
+    }
+    tal_mutex_unlock(workqueue->mutex);
+
+    return tal_semaphore_post(workqueue->sem);
+}
+
+static WORK_NODE_T *__work_dequeue(TAL_WORKQUEUE_T *workqueue)
+{
+    WORK_NODE_T *work_node = NULL;
+    int prio = 0;
+
+    for (prio = 0; prio < WORK_PRIO_MAX; prio++) {
+        if (!tuya_list_empty(&(workqueue->list_ready[prio]))) {
+            work_node = tuya_list_entry(workqueue->list_ready[prio].next, WORK_NODE_T, node);
+            tuya_list_del(&(work_node->node));
+            workqueue->queue_used--;
+            break;
         }
     }
 
-    if (is_same) {
-        src->cb = NULL; // stop exe
+    return work_node;
+}
+
+/**
+ * @brief move due delayed work to ready list, mutex must be held
+ *
+ * @return ms to wait for the next delayed work
+ */
+static uint32_t __delayed_work_promote(TAL_WORKQUEUE_T *workqueue)
+{
+    SYS_TIME_T now = tal_system_get_millisecond();
+    DELAYED_WORK_T *work = NULL;
+    WORK_NODE_T *work_node = NULL;
+
+    while (workqueue->heap_cnt) {
+        work = workqueue->heap[0];
+        if (work->deadline > now) {
+            return (uint32_t)(work->deadline - now);
+        }
+
+        __heap_remove(workqueue, work);
+        if (LOOP_CYCLE == work->type) {
+            work->deadline = now + work->interval;
+            __heap_push(workqueue, work);
+        }
+
+        // same as schedule, fail if the work queue is full
+        if (workqueue->queue_used >= workqueue->queue_len) {
+            PR_WARN("workqueue full, delayed work %p dropped", work->cb);
+            continue;
+        }
+        work_node = (WORK_NODE_T *)tal_malloc(sizeof(WORK_NODE_T));
+        if (NULL == work_node) {
+            continue;
+        }
+        work_node->item.cb = work->cb;
+        work_node->item.data = work->data;
+        work_node->enqueue_time = now;
+        tuya_list_add_tail(&(work_node->node), &(workqueue->list_ready[WORK_PRIO_NORMAL]));
+        workqueue->queue_used++;
+        tal_semaphore_post(workqueue->sem);
     }
 
-    return TRUE;
+    return SEM_WAIT_FOREVER;
+}
+
+static void __work_thread_cb(void *data)
+{
+    WORKQUEUE_WORKER_T *worker = (WORKQUEUE_WORKER_T *)data;
+    TAL_WORKQUEUE_T *workqueue = worker->workqueue;
+    WORK_NODE_T *work_node = NULL;
+    uint32_t timeout = SEM_WAIT_FOREVER;
+    SYS_TIME_T start_time = 0, end_time = 0;
+
+    while (THREAD_STATE_RUNNING == tal_thread_get_state(worker->thread)) {
+        // the wait is taken from the heap right before waiting, the work run since then may have
+        // used part of it or started new delayed work
+        tal_mutex_lock(workqueue->mutex);
+        timeout = __delayed_work_promote(workqueue);
+        workqueue->idle_num++;
+        tal_mutex_unlock(workqueue->mutex);
+
+        tal_semaphore_wait(workqueue->sem, timeout);
+
+        tal_mutex_lock(workqueue->mutex);
+        workqueue->idle_num--;
+        __delayed_work_promote(workqueue);
+        work_node = __work_dequeue(workqueue);
+        // this worker is going busy, wake an idle one to wait for the next delayed work
+        if (work_node && workqueue->heap_cnt && workqueue->idle_num) {
+            tal_semaphore_post(workqueue->sem);
+        }
+        tal_mutex_unlock(workqueue->mutex);
+
+        if (NULL == work_node) {
+            continue;
+        }
+
+        if (work_node->item.cb) {
+            start_time = tal_system_get_millisecond();
+            worker->last_cb = work_node->item.cb;
+            work_node->item.cb(work_node->item.data);
+            worker->last_cb = NULL;
+            end_time = tal_system_get_millisecond();
+
+            tal_mutex_lock(workqueue->mutex);
+            workqueue->stat.done_cnt++;
+            workqueue->stat.total_wait_ms += start_time - work_node->enqueue_time;
+            workqueue->stat.total_run_ms += end_time - start_time;
+            if (start_time - work_node->enqueue_time > workqueue->stat.max_wait_ms) {
+                workqueue->stat.max_wait_ms = start_time - work_node->enqueue_time;
+            }
+            if (end_time - start_time > workqueue->stat.max_run_ms) {
+                workqueue->stat.max_run_ms = end_time - start_time;
+            }
+            tal_mutex_unlock(workqueue->mutex);
+        }
+        tal_free(work_node);
+    }
 }
 
 /**
@@ -109,37 +347,69 @@ static BOOL_T __work_cancel_traverse(void *item, void *ctx)
  * tuya_error_code.h
  */
 OPERATE_RET tal_workqueue_create(const uint16_t queue_len, THREAD_CFG_T *thread_cfg, WORKQUEUE_HANDLE *handle)
+{
+    return tal_workqueue_create_pool(queue_len, 1, thread_cfg, handle);
+}
+
+/**
+ * @brief create and initialize a workqueue served by several worker threads
+ *
+ * @param[in] queue_len the maximum number of items that the workqueue can
+ * contain
+ * @param[in] worker_num the number of worker threads
+ * @param[in] thread_cfg thread param of every worker
+ * @param[out] handle the workqueue handle
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_workqueue_create_pool(const uint16_t queue_len, const uint8_t worker_num, THREAD_CFG_T *thread_cfg,
+                                      WORKQUEUE_HANDLE *handle)
 {
     OPERATE_RET op_ret = OPRT_OK;
     TAL_WORKQUEUE_T *workqueue = NULL;
+    int i = 0;
 
-    if ((0 == queue_len) || (NULL == thread_cfg) || (NULL == handle)) {
+    if ((0 == queue_len) || (0 == worker_num) || (NULL == thread_cfg) || (NULL == handle)) {
         return OPRT_INVALID_PARM;
     }
 
-    workqueue = (TAL_WORKQUEUE_T *)tal_calloc(1, sizeof(TAL_WORKQUEUE_T));
+    workqueue = (TAL_WORKQUEUE_T *)tal_calloc(1, sizeof(TAL_WORKQUEUE_T) + worker_num * sizeof(WORKQUEUE_WORKER_T));
     if (NULL == workqueue) {
         return OPRT_MALLOC_FAILED;
     }
 
-    op_ret = tuya_queue_create(queue_len, sizeof(WORK_ITEM_T), &workqueue->queue);
+    for (i = 0; i < WORK_PRIO_MAX; i++) {
+        INIT_LIST_HEAD(&(workqueue->list_ready[i]));
+    }
+    workqueue->queue_len = queue_len;
+    workqueue->workers = (WORKQUEUE_WORKER_T *)(workqueue + 1);
+
+    op_ret = tal_mutex_create_init(&workqueue->mutex);
     if (OPRT_OK != op_ret) {
         tal_free(workqueue);
         return op_ret;
     }
 
-    op_ret = tal_semaphore_create_init(&workqueue->sem, 0, queue_len);
+    op_ret = tal_semaphore_create_init(&workqueue->sem, 0, WORKQUEUE_SEM_MAX);
     if (OPRT_OK != op_ret) {
-        tuya_queue_release(workqueue->queue);
+        tal_mutex_release(workqueue->mutex);
         tal_free(workqueue);
         return op_ret;
     }
 
-    op_ret = tal_thread_create_and_start(&workqueue->thread, NULL, NULL, __work_thread_cb, workqueue, thread_cfg);
+    for (i = 0; i < worker_num; i++) {
+        workqueue->workers[i].workqueue = workqueue;
+        op_ret = tal_thread_create_and_start(&workqueue->workers[i].thread, NULL, NULL, __work_thread_cb,
+                                             &workqueue->workers[i], thread_cfg);
+        if (OPRT_OK != op_ret) {
+            break;
+        }
+        workqueue->worker_num++;
+    }
+
     if (OPRT_OK != op_ret) {
-        tal_semaphore_release(workqueue->sem);
-        tuya_queue_release(workqueue->queue);
-        tal_free(workqueue);
+        tal_workqueue_release(workqueue);
     } else {
         *handle = workqueue;
     }
@@ -159,21 +429,28 @@ OPERATE_RET tal_workqueue_create(const uint16_t queue_len, THREAD_CFG_T *thread_
  */
 OPERATE_RET tal_workqueue_schedule(WORKQUEUE_HANDLE handle, WORKQUEUE_CB cb, void *data)
 {
-    OPERATE_RET op_ret = OPRT_OK;
+    return tal_workqueue_schedule_prio(handle, cb, data, WORK_PRIO_NORMAL);
+}
 
-    if ((NULL == handle) || (NULL == cb)) {
+/**
+ * @brief put work task in workqueue with priority, higher priority will be
+ * dequeued first
+ *
+ * @param[in] handle the workqueue handle
+ * @param[in] cb the work callback
+ * @param[in] data the work data
+ * @param[in] prio the priority class of the work
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_workqueue_schedule_prio(WORKQUEUE_HANDLE handle, WORKQUEUE_CB cb, void *data, WORK_PRIO_E prio)
+{
+    if ((NULL == handle) || (NULL == cb) || (prio >= WORK_PRIO_MAX)) {
         return OPRT_INVALID_PARM;
     }
 
-    TAL_WORKQUEUE_T *workqueue = (TAL_WORKQUEUE_T *)handle;
-    WORK_ITEM_T work_item = {.cb = cb, .data = data};
-
-    op_ret = tuya_queue_input(workqueue->queue, &work_item);
-    if (OPRT_OK == op_ret) {
-        op_ret = tal_semaphore_post(workqueue->sem);
-    }
-
-    return op_ret;
+    return __work_enqueue((TAL_WORKQUEUE_T *)handle, cb, data, prio, FALSE);
 }
 
 /**
@@ -188,21 +465,11 @@ OPERATE_RET tal_workqueue_schedule(WORKQUEUE_HANDLE handle, WORKQUEUE_CB cb, voi
  */
 OPERATE_RET tal_workqueue_schedule_instant(WORKQUEUE_HANDLE handle, WORKQUEUE_CB cb, void *data)
 {
-    OPERATE_RET op_ret = OPRT_OK;
-
     if ((NULL == handle) || (NULL == cb)) {
         return OPRT_INVALID_PARM;
     }
 
-    TAL_WORKQUEUE_T *workqueue = (TAL_WORKQUEUE_T *)handle;
-    WORK_ITEM_T work_item = {.cb = cb, .data = data};
-
-    op_ret = tuya_queue_input_instant(workqueue->queue, &work_item);
-    if (OPRT_OK == op_ret) {
-        op_ret = tal_semaphore_post(workqueue->sem);
-    }
-
-    return op_ret;
+    return __work_enqueue((TAL_WORKQUEUE_T *)handle, cb, data, WORK_PRIO_HIGH, TRUE);
 }
 
 /**
@@ -222,9 +489,25 @@ OPERATE_RET tal_workqueue_cancel(WORKQUEUE_HANDLE handle, WORKQUEUE_CB cb, void
     }
 
     TAL_WORKQUEUE_T *workqueue = (TAL_WORKQUEUE_T *)handle;
-    WORK_ITEM_T work_item = {.cb = cb, .data = data};
+    struct tuya_list_head *p = NULL, *n = NULL;
+    WORK_NODE_T *work_node = NULL;
+    int prio = 0;
+
+    tal_mutex_lock(workqueue->mutex);
+    for (prio = 0; prio < WORK_PRIO_MAX; prio++) {
+        tuya_list_for_each_safe(p, n, &(workqueue->list_ready[prio]))
+        {
+            work_node = tuya_list_entry(p, WORK_NODE_T, node);
+            if ((cb && (cb == work_node->item.cb)) || (data && (data == work_node->item.data))) {
+                tuya_list_del(&(work_node->node));
+                workqueue->queue_used--;
+                tal_free(work_node);
+            }
+        }
+    }
+    tal_mutex_unlock(workqueue->mutex);
 
-    return tuya_queue_traverse(workqueue->queue, __work_cancel_traverse, &work_item);
+    return OPRT_OK;
 }
 
 /**
@@ -244,7 +527,22 @@ OPERATE_RET tal_workqueue_traverse(WORKQUEUE_HANDLE handle, WORKQUEUE_TRAVERSE_C
     }
 
     TAL_WORKQUEUE_T *workqueue = (TAL_WORKQUEUE_T *)handle;
-    return tuya_queue_traverse(workqueue->queue, (TRAVERSE_CB)cb, ctx);
+    struct tuya_list_head *p = NULL;
+    int prio = 0;
+
+    tal_mutex_lock(workqueue->mutex);
+    for (prio = 0; prio < WORK_PRIO_MAX; prio++) {
+        tuya_list_for_each(p, &(workqueue->list_ready[prio]))
+        {
+            if (!cb(&(tuya_list_entry(p, WORK_NODE_T, node)->item), ctx)) {
+                tal_mutex_unlock(workqueue->mutex);
+                return OPRT_OK;
+            }
+        }
+    }
+    tal_mutex_unlock(workqueue->mutex);
+
+    return OPRT_OK;
 }
 
 /**
@@ -261,12 +559,42 @@ uint16_t tal_workqueue_get_num(WORKQUEUE_HANDLE handle)
     }
 
     TAL_WORKQUEUE_T *workqueue = (TAL_WORKQUEUE_T *)handle;
+    int i = 0;
+
+    for (i = 0; i < workqueue->worker_num; i++) {
+        if (workqueue->workers[i].last_cb) {
+            PR_NOTICE("%p:last_cb %p", workqueue->workers[i].thread, workqueue->workers[i].last_cb);
+        }
+    }
+
+    return workqueue->queue_used;
+}
 
-    if (workqueue->last_cb) {
-        PR_NOTICE("%p:last_cb %p", workqueue->thread, workqueue->last_cb);
+/**
+ * @brief get the statistics of the workqueue
+ *
+ * @param[in] handle the workqueue handle
+ * @param[out] stat the statistics
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_workqueue_get_stat(WORKQUEUE_HANDLE handle, WORKQUEUE_STAT_T *stat)
+{
+    if (NULL == handle || NULL == stat) {
+        return OPRT_INVALID_PARM;
     }
 
-    return tuya_queue_get_used_num(workqueue->queue);
+    TAL_WORKQUEUE_T *workqueue = (TAL_WORKQUEUE_T *)handle;
+
+    tal_mutex_lock(workqueue->mutex);
+    *stat = workqueue->stat;
+    stat->depth = workqueue->queue_used;
+    stat->delayed_cnt = workqueue->heap_cnt;
+    stat->worker_num = workqueue->worker_num;
+    tal_mutex_unlock(workqueue->mutex);
+
+    return OPRT_OK;
 }
 
 /**
@@ -286,23 +614,38 @@ OPERATE_RET tal_workqueue_release(WORKQUEUE_HANDLE handle)
     OPERATE_RET op_ret = OPRT_OK;
     uint32_t count = 1;
     TAL_WORKQUEUE_T *workqueue = (TAL_WORKQUEUE_T *)handle;
+    WORK_NODE_T *work_node = NULL;
+    int i = 0;
 
-    op_ret = tal_thread_delete(workqueue->thread);
-    if (OPRT_OK != op_ret) {
-        return op_ret;
+    for (i = 0; i < workqueue->worker_num; i++) {
+        op_ret = tal_thread_delete(workqueue->workers[i].thread);
+        if (OPRT_OK != op_ret) {
+            return op_ret;
+        }
+        tal_semaphore_post(workqueue->sem);
     }
 
-    tal_semaphore_post(workqueue->sem);
-
-    while (THREAD_STATE_DELETE != tal_thread_get_state(workqueue->thread)) {
-        tal_system_sleep(10);
-        if ((count++) % 500 == 0) {
-            PR_NOTICE("%p still running", workqueue->thread);
+    for (i = 0; i < workqueue->worker_num; i++) {
+        while (THREAD_STATE_DELETE != tal_thread_get_state(workqueue->workers[i].thread)) {
+            tal_system_sleep(10);
+            if ((count++) % 500 == 0) {
+                PR_NOTICE("%p still running", workqueue->workers[i].thread);
+            }
         }
     }
 
-    tuya_queue_release(workqueue->queue);
+    while (NULL != (work_node = __work_dequeue(workqueue))) {
+        tal_free(work_node);
+    }
+    while (workqueue->heap_cnt) {
+        __heap_remove(workqueue, workqueue->heap[0]);
+    }
+    if (workqueue->heap) {
+        tal_free(workqueue->heap);
+    }
+
     tal_semaphore_release(workqueue->sem);
+    tal_mutex_release(workqueue->mutex);
     tal_free(workqueue);
 
     return OPRT_OK;
@@ -313,30 +656,29 @@ OPERATE_RET tal_workqueue_release(WORKQUEUE_HANDLE handle)
  *
  * @param[in] handle the workqueue handle
  *
- * @return thread handle
+ * @return thread handle of the first worker
  */
 THREAD_HANDLE tal_workqueue_get_thread(WORKQUEUE_HANDLE handle)
+{
+    return tal_workqueue_get_worker(handle, 0);
+}
+
+/**
+ * @brief get thread handle of one worker of the workqueue
+ *
+ * @param[in] handle the workqueue handle
+ * @param[in] index the worker index, from 0
+ *
+ * @return thread handle, NULL if index is past the last worker
+ */
+THREAD_HANDLE tal_workqueue_get_worker(WORKQUEUE_HANDLE handle, uint8_t index)
 {
     if (NULL == handle) {
         return NULL;
     }
 
     TAL_WORKQUEUE_T *workqueue = (TAL_WORKQUEUE_T *)handle;
-    return workqueue->thread;
-}
-
-typedef struct {
-    TIMER_ID timer;
-    WORKQUEUE_CB cb;
-    void *data;
-    WORKQUEUE_HANDLE handle;
-} DELAYED_WORK_T;
-
-void __delayed_work_cb(TIMER_ID timer_id, void *arg)
-{
-    DELAYED_WORK_T *p_delayed_work = (DELAYED_WORK_T *)arg;
-
-    tal_workqueue_schedule(p_delayed_work->handle, p_delayed_work->cb, p_delayed_work->data);
+    return (index < workqueue->worker_num) ? workqueue->workers[index].thread : NULL;
 }
 
 /**
@@ -353,8 +695,6 @@ void __delayed_work_cb(TIMER_ID timer_id, void *arg)
 OPERATE_RET tal_workqueue_init_delayed(WORKQUEUE_HANDLE handle, WORKQUEUE_CB cb, void *data,
                                        DELAYED_WORK_HANDLE *delayed_work)
 {
-    OPERATE_RET op_ret = OPRT_OK;
-
     if (NULL == handle || NULL == delayed_work) {
         return OPRT_INVALID_PARM;
     }
@@ -366,13 +706,8 @@ OPERATE_RET tal_workqueue_init_delayed(WORKQUEUE_HANDLE handle, WORKQUEUE_CB cb,
 
     p_delayed_work->data = data;
     p_delayed_work->cb = cb;
-    p_delayed_work->handle = handle;
-
-    op_ret = tal_sw_timer_create(__delayed_work_cb, p_delayed_work, &p_delayed_work->timer);
-    if (OPRT_OK != op_ret) {
-        tal_free(p_delayed_work);
-        return OPRT_COM_ERROR;
-    }
+    p_delayed_work->workqueue = (TAL_WORKQUEUE_T *)handle;
+    p_delayed_work->heap_index = DELAYED_WORK_NOT_IN_HEAP;
 
     *delayed_work = (DELAYED_WORK_HANDLE)p_delayed_work;
 
@@ -395,9 +730,25 @@ OPERATE_RET tal_workqueue_start_delayed(DELAYED_WORK_HANDLE delayed_work, TIME_M
         return OPRT_INVALID_PARM;
     }
 
+    OPERATE_RET op_ret = OPRT_OK;
     DELAYED_WORK_T *p_delayed_work = (DELAYED_WORK_T *)delayed_work;
+    TAL_WORKQUEUE_T *workqueue = p_delayed_work->workqueue;
+
+    tal_mutex_lock(workqueue->mutex);
+    __heap_remove(workqueue, p_delayed_work);
+    // keep the last interval if 0, same as sw timer
+    if (interval) {
+        p_delayed_work->interval = interval;
+    }
+    p_delayed_work->type = type;
+    p_delayed_work->deadline = tal_system_get_millisecond() + p_delayed_work->interval;
+    op_ret = __heap_push(workqueue, p_delayed_work);
+    tal_mutex_unlock(workqueue->mutex);
+
+    // wake up one worker to recalculate the wait time
+    tal_semaphore_post(workqueue->sem);
 
-    return tal_sw_timer_start(p_delayed_work->timer, interval, type);
+    return op_ret;
 }
 
 /**
@@ -416,7 +767,11 @@ OPERATE_RET tal_workqueue_stop_delayed(DELAYED_WORK_HANDLE delayed_work)
 
     DELAYED_WORK_T *p_delayed_work = (DELAYED_WORK_T *)delayed_work;
 
-    return tal_sw_timer_stop(p_delayed_work->timer);
+    tal_mutex_lock(p_delayed_work->workqueue->mutex);
+    __heap_remove(p_delayed_work->workqueue, p_delayed_work);
+    tal_mutex_unlock(p_delayed_work->workqueue->mutex);
+
+    return OPRT_OK;
 }
 
 /**
@@ -435,8 +790,8 @@ OPERATE_RET tal_workqueue_cancel_delayed(DELAYED_WORK_HANDLE delayed_work)
 
     DELAYED_WORK_T *p_delayed_work = (DELAYED_WORK_T *)delayed_work;
 
-    tal_sw_timer_delete(p_delayed_work->timer);
-    tal_workqueue_cancel(p_delayed_work->handle, p_delayed_work->cb, p_delayed_work->data);
+    tal_workqueue_stop_delayed(p_delayed_work);
+    tal_workqueue_cancel(p_delayed_work->workqueue, p_delayed_work->cb, p_delayed_work->data);
 
     tal_free(p_delayed_work);
 
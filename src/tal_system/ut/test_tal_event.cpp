@@ -0,0 +1,239 @@
+/**
+ * @file test_tal_event.cpp
+ * @brief unit test of tal_event
+ */
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_system.h"
+#include "tal_event.h"
+
+namespace {
+
+std::atomic<int> s_cnt_a, s_cnt_b;
+
+int cross_a_cb(void *data)
+{
+    s_cnt_a++;
+    tal_system_sleep(20);
+    return tal_event_publish("ut.cross.b", NULL);
+}
+
+int cross_b_cb(void *data)
+{
+    s_cnt_b++;
+    tal_system_sleep(20);
+    return (s_cnt_b > 1) ? OPRT_OK : tal_event_publish("ut.cross.a", NULL);
+}
+
+int cross_a_tail_cb(void *data)
+{
+    return OPRT_OK;
+}
+
+std::atomic<int> s_self_cnt;
+
+int self_unsubscribe_cb(void *data)
+{
+    s_self_cnt++;
+    return tal_event_unsubscribe("ut.self", "self", self_unsubscribe_cb);
+}
+
+std::atomic<int> s_nested_depth, s_nested_cnt;
+
+int nested_cb(void *data)
+{
+    s_nested_cnt++;
+    if (++s_nested_depth < 3) {
+        tal_event_publish("ut.nested", NULL);
+    }
+    return OPRT_OK;
+}
+
+std::atomic<int> s_async_sum, s_async_cnt;
+
+int async_cb(void *data)
+{
+    s_async_sum += *(int *)data;
+    s_async_cnt++;
+    // republish from the dispatcher thread, both ways
+    if (*(int *)data == 1) {
+        int value = 10;
+        tal_event_publish_async("ut.async", &value, sizeof(value));
+        value = 100;
+        tal_event_publish("ut.async", &value);
+    }
+    return OPRT_OK;
+}
+
+std::atomic<int> s_order[3], s_order_seq;
+
+int order_cb0(void *data)
+{
+    s_order[0] = s_order_seq++;
+    return OPRT_OK;
+}
+
+int order_cb1(void *data)
+{
+    s_order[1] = s_order_seq++;
+    return OPRT_OK;
+}
+
+int order_emergency_cb(void *data)
+{
+    s_order[2] = s_order_seq++;
+    return OPRT_OK;
+}
+
+std::atomic<bool> s_slow_inside, s_slow_done;
+
+int slow_cb(void *data)
+{
+    s_slow_inside = true;
+    tal_system_sleep(100);
+    s_slow_done = true;
+    return OPRT_OK;
+}
+
+} // namespace
+
+TEST(TalEvent, CrossPublishFromSubscribersDoesNotDeadlock)
+{
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.cross.a", "a", cross_a_cb, SUBSCRIBE_TYPE_NORMAL));
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.cross.b", "b", cross_b_cb, SUBSCRIBE_TYPE_NORMAL));
+
+    // each thread holds one event while its subscriber publishes the other one
+    auto pub_a = std::async(std::launch::async, [] { return tal_event_publish("ut.cross.a", NULL); });
+    auto pub_b = std::async(std::launch::async, [] { return tal_event_publish("ut.cross.b", NULL); });
+
+    ASSERT_EQ(std::future_status::ready, pub_a.wait_for(std::chrono::seconds(2)));
+    ASSERT_EQ(std::future_status::ready, pub_b.wait_for(std::chrono::seconds(2)));
+    EXPECT_GE(s_cnt_a.load(), 1);
+    EXPECT_GE(s_cnt_b.load(), 2);
+}
+
+TEST(TalEvent, NestedPublishOfSameEvent)
+{
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.nested", "nested", nested_cb, SUBSCRIBE_TYPE_NORMAL));
+
+    auto pub = std::async(std::launch::async, [] { return tal_event_publish("ut.nested", NULL); });
+    ASSERT_EQ(std::future_status::ready, pub.wait_for(std::chrono::seconds(2)));
+    EXPECT_EQ(3, s_nested_cnt.load());
+}
+
+TEST(TalEvent, UnsubscribeInsideCallback)
+{
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.self", "self", self_unsubscribe_cb, SUBSCRIBE_TYPE_NORMAL));
+
+    EXPECT_EQ(OPRT_OK, tal_event_publish("ut.self", NULL));
+    EXPECT_EQ(OPRT_OK, tal_event_publish("ut.self", NULL));
+    EXPECT_EQ(1, s_self_cnt.load());
+}
+
+TEST(TalEvent, UnsubscribeWaitsForRunningCallback)
+{
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.slow", "slow", slow_cb, SUBSCRIBE_TYPE_NORMAL));
+
+    auto pub = std::async(std::launch::async, [] { return tal_event_publish("ut.slow", NULL); });
+    while (!s_slow_inside) {
+        tal_system_sleep(1);
+    }
+    // the publish on the other thread is inside the callback
+    EXPECT_EQ(OPRT_OK, tal_event_unsubscribe("ut.slow", "slow", slow_cb));
+    EXPECT_TRUE(s_slow_done.load());
+    ASSERT_EQ(std::future_status::ready, pub.wait_for(std::chrono::seconds(2)));
+
+    s_slow_done = false;
+    EXPECT_EQ(OPRT_OK, tal_event_publish("ut.slow", NULL));
+    EXPECT_FALSE(s_slow_done.load());
+}
+
+TEST(TalEvent, SubscriberOrderAndHandle)
+{
+    EVENT_HANDLE handle = NULL, again = NULL;
+
+    // subscribed before the event exists, then the event is interned
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.order", "cb0", order_cb0, SUBSCRIBE_TYPE_NORMAL));
+    ASSERT_EQ(OPRT_OK, tal_event_handle_get("ut.order", &handle));
+    ASSERT_EQ(OPRT_OK, tal_event_handle_get("ut.order", &again));
+    EXPECT_EQ(handle, again);
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.order", "cb1", order_cb1, SUBSCRIBE_TYPE_NORMAL));
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.order", "emergency", order_emergency_cb, SUBSCRIBE_TYPE_EMERGENCY));
+
+    EXPECT_EQ(OPRT_OK, tal_event_publish_by_handle(handle, NULL));
+    EXPECT_EQ(0, s_order[2].load());
+    EXPECT_EQ(1, s_order[0].load());
+    EXPECT_EQ(2, s_order[1].load());
+}
+
+TEST(TalEvent, AsyncPublishCopiesDataAndAllowsRepublish)
+{
+    int value = 1;
+
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.async", "async", async_cb, SUBSCRIBE_TYPE_NORMAL));
+    ASSERT_EQ(OPRT_OK, tal_event_publish_async("ut.async", &value, sizeof(value)));
+    value = 0; // the queued event holds its own copy
+
+    for (int i = 0; i < 100 && s_async_cnt < 3; i++) {
+        tal_system_sleep(10);
+    }
+    EXPECT_EQ(3, s_async_cnt.load());
+    EXPECT_EQ(111, s_async_sum.load());
+}
+
+namespace {
+
+std::atomic<int> s_bench_cnt;
+
+int bench_cb(void *data)
+{
+    s_bench_cnt++;
+    return OPRT_OK;
+}
+
+} // namespace
+
+TEST(TalEvent, PublishThroughput)
+{
+    const int name_num = 256, sub_num = 4, rounds = 200;
+    char name[EVENT_NAME_MAX_LEN + 1];
+    char desc[EVENT_DESC_MAX_LEN + 1];
+    static EVENT_HANDLE handle[name_num];
+
+    for (int i = 0; i < name_num; i++) {
+        snprintf(name, sizeof(name), "ut.bench.%d", i);
+        for (int j = 0; j < sub_num; j++) {
+            snprintf(desc, sizeof(desc), "bench%d", j);
+            ASSERT_EQ(OPRT_OK, tal_event_subscribe(name, desc, bench_cb, SUBSCRIBE_TYPE_NORMAL));
+        }
+        ASSERT_EQ(OPRT_OK, tal_event_handle_get(name, &handle[i]));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < name_num; i++) {
+            snprintf(name, sizeof(name), "ut.bench.%d", i);
+            tal_event_publish(name, NULL);
+        }
+    }
+    auto by_name = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < name_num; i++) {
+            tal_event_publish_by_handle(handle[i], NULL);
+        }
+    }
+    auto by_handle = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(2 * rounds * name_num * sub_num, s_bench_cnt.load());
+    printf("[bench] %d events x %d subscribers: publish by name %.0f ns, by handle %.0f ns\n", name_num, sub_num,
+           std::chrono::duration<double, std::nano>(by_name).count() / (rounds * name_num),
+           std::chrono::duration<double, std::nano>(by_handle).count() / (rounds * name_num));
+}
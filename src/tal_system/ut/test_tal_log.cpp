@@ -0,0 +1,184 @@
+/**
+ * @file test_tal_log.cpp
+ * @brief unit test of tal_log, in synchronous and asynchronous mode
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_log.h"
+
+namespace {
+
+std::mutex s_lines_lock;
+std::vector<std::string> s_lines;
+
+// set by the benchmark: lines are not kept and cost this long per byte, like a UART
+std::atomic<int> s_output_ns_per_byte{0};
+std::atomic<int> s_output_lines{0};
+
+void capture_output(const char *str)
+{
+    if (s_output_ns_per_byte) {
+        auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(strlen(str) * s_output_ns_per_byte);
+        while (std::chrono::steady_clock::now() < until) {
+        }
+        s_output_lines++;
+        return;
+    }
+    std::lock_guard<std::mutex> guard(s_lines_lock);
+    s_lines.push_back(str);
+}
+
+// body of a log line, after the "[file:line] " head and without the line ending
+std::string body_of(const std::string &line)
+{
+    size_t pos = line.find("] ");
+    std::string body = (std::string::npos == pos) ? line : line.substr(pos + 2);
+    while (!body.empty() && ('\r' == body.back() || '\n' == body.back())) {
+        body.pop_back();
+    }
+    return body;
+}
+
+std::vector<std::string> take_bodies()
+{
+    std::vector<std::string> bodies;
+
+    tal_log_async_flush();
+    std::lock_guard<std::mutex> guard(s_lines_lock);
+    for (auto &line : s_lines) {
+        bodies.push_back(body_of(line));
+    }
+    s_lines.clear();
+    return bodies;
+}
+
+} // namespace
+
+class TalLogTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        ASSERT_EQ(OPRT_OK, tal_log_init(TAL_LOG_LEVEL_DEBUG, 1024, capture_output));
+        tal_log_color_enable_set(FALSE);
+    }
+
+    static void TearDownTestSuite()
+    {
+        tal_log_release();
+    }
+
+    void SetUp() override
+    {
+        take_bodies();
+    }
+};
+
+TEST_F(TalLogTest, FormatsScalarsAndStrings)
+{
+    char not_terminated[5] = {'a', 'b', 'c', 'd', 'e'};
+
+    PR_DEBUG("int %d %5u %-3x| %lld %zu %c %%", -5, 7u, 255, -1234567890123LL, (size_t)42, 'Z');
+    PR_DEBUG("dbl %.3f %*d|%-*.*s|", 3.14159, 6, 12, 8, 3, "hello");
+    PR_DEBUG("prec %.*s %.2s %s", 3, not_terminated, not_terminated, "tail");
+
+    std::vector<std::string> expect = {
+        "int -5     7 ff | -1234567890123 42 Z %",
+        "dbl 3.142     12|hel     |",
+        "prec abc ab tail",
+    };
+    EXPECT_EQ(expect, take_bodies());
+}
+
+TEST_F(TalLogTest, LongMessageIsNotTruncated)
+{
+    std::string long_arg(300, 'x');
+    long_arg += "END";
+
+    PR_DEBUG("before");
+    PR_DEBUG("long %s", long_arg.c_str());
+    PR_DEBUG("after %d", 1);
+
+    std::vector<std::string> bodies = take_bodies();
+    ASSERT_EQ(3u, bodies.size());
+    EXPECT_EQ("before", bodies[0]);
+    EXPECT_EQ("long " + long_arg, bodies[1]);
+    EXPECT_EQ("after 1", bodies[2]);
+}
+
+TEST_F(TalLogTest, LongTextFallbackIsNotTruncated)
+{
+    // %ls can not be recorded as binary and is formatted by the caller
+    std::string pad(200, 'y');
+
+    PR_DEBUG("wide %ls %s", L"w", pad.c_str());
+
+    std::vector<std::string> bodies = take_bodies();
+    ASSERT_EQ(1u, bodies.size());
+    EXPECT_EQ("wide w " + pad, bodies[0]);
+}
+
+TEST_F(TalLogTest, RawOutputKeepsOrder)
+{
+    PR_DEBUG("queued");
+    tal_log_print_raw("raw\r\n");
+
+    std::vector<std::string> bodies = take_bodies();
+    ASSERT_EQ(2u, bodies.size());
+    EXPECT_EQ("queued", bodies[0]);
+    EXPECT_EQ("raw", bodies[1]);
+}
+
+TEST_F(TalLogTest, FormatMayBeReusedAfterTheCall)
+{
+    char fmt[32];
+
+    // a format built at run time, its buffer is changed before the line is printed
+    snprintf(fmt, sizeof(fmt), "value %s %%d", "of");
+    PR_DEBUG(fmt, 1);
+    memset(fmt, 'X', sizeof(fmt) - 1);
+    snprintf(fmt, sizeof(fmt), "other %%s");
+    PR_DEBUG(fmt, "two");
+
+    std::vector<std::string> expect = {"value of 1", "other two"};
+    EXPECT_EQ(expect, take_bodies());
+}
+
+TEST_F(TalLogTest, BenchmarkCallerLatency)
+{
+    // 1 us per byte is a UART at about 10 Mbit/s, a record too long for the ring is printed by the caller
+    const int count = 2000;
+    std::string short_arg = "idle";
+    std::string long_arg(300, 's');
+
+    s_output_ns_per_byte = 1000;
+    for (const std::string *arg : {&short_arg, &long_arg}) {
+        std::vector<double> us;
+        uint32_t drops = tal_log_async_get_drop_cnt();
+        s_output_lines = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) {
+            auto begin = std::chrono::steady_clock::now();
+            PR_DEBUG("sensor %d value %.2f state %s", i, i * 0.5, arg->c_str());
+            us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+        }
+        double call_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        tal_log_async_flush();
+        double all_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::sort(us.begin(), us.end());
+        printf("[   INFO   ] %s arg: %d lines, caller p50 %.1f us p99 %.1f us, %.0f calls/s, %.0f lines/s printed, "
+               "%u dropped\n",
+               arg == &short_arg ? "short" : "long", count, us[count / 2], us[count * 99 / 100], count * 1e3 / call_ms,
+               s_output_lines * 1e3 / all_ms, tal_log_async_get_drop_cnt() - drops);
+    }
+    s_output_ns_per_byte = 0;
+}
@@ -0,0 +1,212 @@
+/**
+ * @file test_tal_sw_timer.cpp
+ * @brief unit test of tal_sw_timer
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <mutex>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_system.h"
+#include "tal_sw_timer.h"
+
+namespace {
+
+struct ReentryCtx {
+    std::atomic<int> inside{0};
+    std::atomic<int> max_inside{0};
+    std::atomic<int> runs{0};
+};
+
+void slow_periodic_cb(TIMER_ID timer_id, void *arg)
+{
+    ReentryCtx *ctx = (ReentryCtx *)arg;
+    int now = ++ctx->inside;
+    int old = ctx->max_inside.load();
+    while (now > old && !ctx->max_inside.compare_exchange_weak(old, now)) {
+    }
+    tal_system_sleep(30);
+    ctx->runs++;
+    ctx->inside--;
+}
+
+struct OrderCtx {
+    std::mutex lock;
+    std::vector<int> order;
+    int tag;
+};
+
+OrderCtx *s_order_ctx;
+
+void order_cb(TIMER_ID timer_id, void *arg)
+{
+    std::lock_guard<std::mutex> guard(s_order_ctx->lock);
+    s_order_ctx->order.push_back((int)(intptr_t)arg);
+}
+
+std::atomic<SYS_TIME_T> s_fired_ms;
+
+void fired_cb(TIMER_ID timer_id, void *arg)
+{
+    s_fired_ms = tal_system_get_millisecond();
+}
+
+std::atomic<int> s_self_delete_runs;
+
+void self_delete_cb(TIMER_ID timer_id, void *arg)
+{
+    s_self_delete_runs++;
+    tal_sw_timer_delete(timer_id);
+}
+
+// one of the benchmark timers, the deadline is set when it is started
+struct BenchTimer {
+    TIMER_ID id = NULL;
+    std::atomic<SYS_TIME_T> deadline{0};
+    std::atomic<SYS_TIME_T> fired{0};
+};
+
+std::atomic<int> s_bench_fired;
+
+void bench_cb(TIMER_ID timer_id, void *arg)
+{
+    BenchTimer *timer = (BenchTimer *)arg;
+    timer->fired = tal_system_get_millisecond();
+    s_bench_fired++;
+}
+
+double percentile(std::vector<double> &samples, int pct)
+{
+    std::sort(samples.begin(), samples.end());
+    return samples[(samples.size() - 1) * pct / 100];
+}
+
+} // namespace
+
+class SwTimerTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        ASSERT_EQ(OPRT_OK, tal_sw_timer_init());
+    }
+};
+
+TEST_F(SwTimerTest, PeriodicCallbackNeverRunsConcurrently)
+{
+    ReentryCtx ctx;
+    TIMER_ID timer_id = NULL;
+
+    ASSERT_EQ(OPRT_OK, tal_sw_timer_create(slow_periodic_cb, &ctx, &timer_id));
+    ASSERT_EQ(OPRT_OK, tal_sw_timer_start(timer_id, 5, TAL_TIMER_CYCLE));
+    tal_system_sleep(300);
+    tal_sw_timer_stop(timer_id);
+    tal_system_sleep(100);
+
+    EXPECT_GT(ctx.runs.load(), 2);
+    EXPECT_EQ(1, ctx.max_inside.load());
+    EXPECT_EQ(OPRT_OK, tal_sw_timer_delete(timer_id));
+}
+
+TEST_F(SwTimerTest, DeleteFromOwnCallback)
+{
+    TIMER_ID timer_id = NULL;
+
+    s_self_delete_runs = 0;
+    ASSERT_EQ(OPRT_OK, tal_sw_timer_create(self_delete_cb, NULL, &timer_id));
+    ASSERT_EQ(OPRT_OK, tal_sw_timer_start(timer_id, 5, TAL_TIMER_CYCLE));
+    tal_system_sleep(100);
+
+    EXPECT_EQ(1, s_self_delete_runs.load());
+}
+
+TEST_F(SwTimerTest, OnceTimersExpireInOrder)
+{
+    const int intervals[] = {50, 10, 120, 30, 70};
+    TIMER_ID timer_id[5] = {NULL};
+    OrderCtx ctx;
+    int i = 0;
+
+    s_order_ctx = &ctx;
+    for (i = 0; i < 5; i++) {
+        ASSERT_EQ(OPRT_OK, tal_sw_timer_create(order_cb, (void *)(intptr_t)intervals[i], &timer_id[i]));
+        ASSERT_EQ(OPRT_OK, tal_sw_timer_start(timer_id[i], intervals[i], TAL_TIMER_ONCE));
+    }
+    tal_system_sleep(250);
+
+    std::vector<int> expect = {10, 30, 50, 70, 120};
+    EXPECT_EQ(expect, ctx.order);
+    for (i = 0; i < 5; i++) {
+        EXPECT_FALSE(tal_sw_timer_is_running(timer_id[i]));
+        tal_sw_timer_delete(timer_id[i]);
+    }
+}
+
+TEST_F(SwTimerTest, LongTimerFiresOnTime)
+{
+    TIMER_ID timer_id = NULL;
+    SYS_TIME_T start = 0;
+
+    // longer than one revolution of the lowest wheel level
+    s_fired_ms = 0;
+    ASSERT_EQ(OPRT_OK, tal_sw_timer_create(fired_cb, NULL, &timer_id));
+    start = tal_system_get_millisecond();
+    ASSERT_EQ(OPRT_OK, tal_sw_timer_start(timer_id, 300, TAL_TIMER_ONCE));
+    tal_system_sleep(450);
+
+    ASSERT_NE(0u, s_fired_ms.load());
+    EXPECT_GE(s_fired_ms.load() - start, 300u);
+    EXPECT_LT(s_fired_ms.load() - start, 400u);
+    tal_sw_timer_delete(timer_id);
+}
+
+TEST_F(SwTimerTest, Benchmark10kTimers)
+{
+    const int count = 10000;
+    std::vector<BenchTimer> timers(count);
+    std::vector<double> start_us, stop_us, late_ms;
+    int i = 0;
+
+    for (i = 0; i < count; i++) {
+        ASSERT_EQ(OPRT_OK, tal_sw_timer_create(bench_cb, &timers[i], &timers[i].id));
+    }
+
+    // start all of them spread over 0.5 - 2 s, then stop every other one
+    s_bench_fired = 0;
+    for (i = 0; i < count; i++) {
+        TIME_MS interval = 500 + (i * 7919) % 1500;
+        timers[i].deadline = tal_system_get_millisecond() + interval;
+        auto begin = std::chrono::steady_clock::now();
+        ASSERT_EQ(OPRT_OK, tal_sw_timer_start(timers[i].id, interval, TAL_TIMER_ONCE));
+        start_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+    }
+    for (i = 0; i < count; i += 2) {
+        auto begin = std::chrono::steady_clock::now();
+        tal_sw_timer_stop(timers[i].id);
+        stop_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+    }
+
+    SYS_TIME_T until = tal_system_get_millisecond() + 3000;
+    while (s_bench_fired < count / 2 && tal_system_get_millisecond() < until) {
+        tal_system_sleep(50);
+    }
+    EXPECT_EQ(count / 2, s_bench_fired.load());
+
+    for (i = 0; i < count; i++) {
+        if (i % 2) {
+            ASSERT_NE(0u, timers[i].fired.load());
+            late_ms.push_back((double)timers[i].fired.load() - (double)timers[i].deadline.load());
+        } else {
+            EXPECT_EQ(0u, timers[i].fired.load());
+        }
+        tal_sw_timer_delete(timers[i].id);
+    }
+
+    printf("[   INFO   ] %d timers: start p50 %.2f us p99 %.2f us, stop p50 %.2f us p99 %.2f us\n", count,
+           percentile(start_us, 50), percentile(start_us, 99), percentile(stop_us, 50), percentile(stop_us, 99));
+    printf("[   INFO   ] expiry late p50 %.0f ms, p99 %.0f ms, max %.0f ms\n", percentile(late_ms, 50),
+           percentile(late_ms, 99), percentile(late_ms, 100));
+}
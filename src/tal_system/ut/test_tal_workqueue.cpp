@@ -0,0 +1,148 @@
+/**
+ * @file test_tal_workqueue.cpp
+ * @brief unit test of tal_workqueue
+ */
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_system.h"
+#include "tal_workqueue.h"
+
+namespace {
+
+THREAD_CFG_T s_thread_cfg = {.stackDepth = 4096, .priority = THREAD_PRIO_2, .thrdname = (char *)"ut_workq"};
+
+std::atomic<SYS_TIME_T> s_delayed_run;
+
+void delayed_cb(void *data)
+{
+    s_delayed_run = tal_system_get_millisecond();
+}
+
+std::mutex s_order_lock;
+std::vector<int> s_order;
+
+void order_cb(void *data)
+{
+    std::lock_guard<std::mutex> guard(s_order_lock);
+    s_order.push_back((int)(intptr_t)data);
+}
+
+void block_cb(void *data)
+{
+    tal_system_sleep((uint32_t)(intptr_t)data);
+}
+
+} // namespace
+
+TEST(TalWorkqueue, DelayedWorkRunsOnTimeWhileAWorkerIsBusy)
+{
+    WORKQUEUE_HANDLE workqueue = NULL;
+    DELAYED_WORK_HANDLE delayed = NULL;
+    SYS_TIME_T start = 0;
+    int i = 0;
+
+    // the busy item may be taken by the worker waiting for the deadline or by the idle one, try both ways
+    for (i = 0; i < 6; i++) {
+        ASSERT_EQ(OPRT_OK, tal_workqueue_create_pool(8, 2, &s_thread_cfg, &workqueue));
+        ASSERT_EQ(OPRT_OK, tal_workqueue_init_delayed(workqueue, delayed_cb, NULL, &delayed));
+
+        s_delayed_run = 0;
+        start = tal_system_get_millisecond();
+        ASSERT_EQ(OPRT_OK, tal_workqueue_start_delayed(delayed, 60, LOOP_ONCE));
+        tal_system_sleep(10);
+        ASSERT_EQ(OPRT_OK, tal_workqueue_schedule(workqueue, block_cb, (void *)200));
+        tal_system_sleep(120);
+
+        ASSERT_NE(0u, s_delayed_run.load()) << "round " << i;
+        EXPECT_LT(s_delayed_run.load() - start, 100u) << "round " << i;
+
+        tal_system_sleep(150);
+        tal_workqueue_cancel_delayed(delayed);
+        tal_workqueue_release(workqueue);
+    }
+}
+
+TEST(TalWorkqueue, PriorityClassesAreServedInOrder)
+{
+    WORKQUEUE_HANDLE workqueue = NULL;
+
+    ASSERT_EQ(OPRT_OK, tal_workqueue_create(8, &s_thread_cfg, &workqueue));
+
+    // hold the only worker while the items are queued
+    ASSERT_EQ(OPRT_OK, tal_workqueue_schedule(workqueue, block_cb, (void *)50));
+    tal_system_sleep(10);
+    ASSERT_EQ(OPRT_OK, tal_workqueue_schedule_prio(workqueue, order_cb, (void *)3, WORK_PRIO_LOW));
+    ASSERT_EQ(OPRT_OK, tal_workqueue_schedule(workqueue, order_cb, (void *)2));
+    ASSERT_EQ(OPRT_OK, tal_workqueue_schedule_prio(workqueue, order_cb, (void *)1, WORK_PRIO_HIGH));
+    ASSERT_EQ(OPRT_OK, tal_workqueue_schedule_instant(workqueue, order_cb, (void *)0));
+    tal_system_sleep(150);
+
+    std::vector<int> expect = {0, 1, 2, 3};
+    EXPECT_EQ(expect, s_order);
+
+    WORKQUEUE_STAT_T stat;
+    ASSERT_EQ(OPRT_OK, tal_workqueue_get_stat(workqueue, &stat));
+    EXPECT_EQ(5u, stat.done_cnt);
+    EXPECT_EQ(0u, stat.depth);
+    tal_workqueue_release(workqueue);
+}
+
+TEST(TalWorkqueue, FullQueueRejects)
+{
+    WORKQUEUE_HANDLE workqueue = NULL;
+
+    ASSERT_EQ(OPRT_OK, tal_workqueue_create(2, &s_thread_cfg, &workqueue));
+    ASSERT_EQ(OPRT_OK, tal_workqueue_schedule(workqueue, block_cb, (void *)50));
+    tal_system_sleep(10);
+    EXPECT_EQ(OPRT_OK, tal_workqueue_schedule(workqueue, block_cb, (void *)1));
+    EXPECT_EQ(OPRT_OK, tal_workqueue_schedule(workqueue, block_cb, (void *)1));
+    EXPECT_EQ(OPRT_EXCEED_UPPER_LIMIT, tal_workqueue_schedule(workqueue, block_cb, (void *)1));
+    tal_system_sleep(100);
+    tal_workqueue_release(workqueue);
+}
+
+TEST(TalWorkqueue, DelayedWorkOnTimeAfterWorkOnTheOnlyWorker)
+{
+    WORKQUEUE_HANDLE workqueue = NULL;
+    DELAYED_WORK_HANDLE delayed = NULL;
+    SYS_TIME_T start = 0;
+
+    // the worker runs an item between computing the wait and waiting for the deadline
+    ASSERT_EQ(OPRT_OK, tal_workqueue_create(8, &s_thread_cfg, &workqueue));
+    ASSERT_EQ(OPRT_OK, tal_workqueue_init_delayed(workqueue, delayed_cb, NULL, &delayed));
+
+    s_delayed_run = 0;
+    start = tal_system_get_millisecond();
+    ASSERT_EQ(OPRT_OK, tal_workqueue_start_delayed(delayed, 100, LOOP_ONCE));
+    tal_system_sleep(5);
+    ASSERT_EQ(OPRT_OK, tal_workqueue_schedule(workqueue, block_cb, (void *)60));
+    tal_system_sleep(200);
+
+    ASSERT_NE(0u, s_delayed_run.load());
+    EXPECT_GE(s_delayed_run.load() - start, 100u);
+    EXPECT_LT(s_delayed_run.load() - start, 130u);
+
+    tal_workqueue_cancel_delayed(delayed);
+    tal_workqueue_release(workqueue);
+}
+
+TEST(TalWorkqueue, EveryWorkerIsReachable)
+{
+    WORKQUEUE_HANDLE workqueue = NULL;
+
+    ASSERT_EQ(OPRT_OK, tal_workqueue_create_pool(4, 3, &s_thread_cfg, &workqueue));
+    EXPECT_EQ(tal_workqueue_get_worker(workqueue, 0), tal_workqueue_get_thread(workqueue));
+    for (uint8_t i = 0; i < 3; i++) {
+        EXPECT_NE(nullptr, tal_workqueue_get_worker(workqueue, i));
+        for (uint8_t j = 0; j < i; j++) {
+            EXPECT_NE(tal_workqueue_get_worker(workqueue, j), tal_workqueue_get_worker(workqueue, i));
+        }
+    }
+    EXPECT_EQ(nullptr, tal_workqueue_get_worker(workqueue, 3));
+    tal_workqueue_release(workqueue);
+}
@@ -10,7 +10,8 @@
  *
  * Key features include:
  * - AI session management with configurable maximum session limit
- * - Asynchronous task scheduling with configurable delay
+ * - Send channels scheduled when their producer signals a chunk ready, with
+ *   weighted round robin across the streams and a bounded backlog per stream
  * - Thread-safe operations using mutex and event mechanisms
  * - Integration with Tuya AI client and protocol layers
  *
@@ -92,7 +93,9 @@ typedef struct {
 } AI_BIZ_HEAD_INFO_T;
 
 /**
- * @brief get biz data to send
+ * @brief get biz data to send, called by the biz thread for each chunk
+ * signalled with tuya_ai_biz_send_ready, or every AI_BIZ_TASK_DELAY ms for a
+ * channel that never signals one
  *
  * @param[out] attr attribute
  * @param[out] head data head
@@ -222,6 +225,22 @@ OPERATE_RET tuya_ai_send_biz_pkt(uint16_t id, AI_BIZ_ATTR_INFO_T *attr, AI_PACKE
 OPERATE_RET tuya_ai_send_biz_pkt_custom(uint16_t id, AI_BIZ_ATTR_INFO_T *attr, AI_PACKET_PT type,
                                         AI_BIZ_HEAD_INFO_T *head, char *payload, AI_PACKET_WRITER_T *writer);
 
+/**
+ * @brief signal that a chunk of a send channel is ready, the biz thread wakes
+ * and gets it with the get_cb of the channel
+ *
+ * While several channels have chunks ready they are sent in weighted round
+ * robin, audio 4, video and image 2, others 1, so audio goes first without
+ * starving the rest. A channel signalled once is no longer polled.
+ *
+ * @param[in] id send channel id
+ *
+ * @return OPRT_OK on success, OPRT_EXCEED_UPPER_LIMIT if AI_BIZ_SEND_READY_MAX
+ * chunks of the channel are already waiting, the producer is to hold or drop
+ * the chunk, OPRT_NOT_FOUND if no session has the channel
+ */
+OPERATE_RET tuya_ai_biz_send_ready(uint16_t id);
+
 /**
  * @brief get send id
  *
@@ -719,7 +719,8 @@ OPERATE_RET tuya_ai_parse_conn_close(char *de_buf, uint32_t attr_len);
 OPERATE_RET tuya_ai_pong(char *data, uint32_t len);
 
 /**
- * @brief pkt data free
+ * @brief pkt data free, the data of tuya_ai_basic_pkt_read is to be freed
+ * with it only, it may be in a pooled buffer
  *
  * @param[in] data data buffer
  */
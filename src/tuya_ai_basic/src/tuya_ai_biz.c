@@ -10,7 +10,8 @@
  *
  * Key features include:
  * - AI session management with configurable maximum session limit
- * - Asynchronous task scheduling with configurable delay
+ * - Send channels scheduled when their producer signals a chunk ready, with
+ *   weighted round robin across the streams and a bounded backlog per stream
  * - Thread-safe operations using mutex and event mechanisms
  * - Integration with Tuya AI client and protocol layers
  *
@@ -25,6 +26,7 @@
 #include "tal_system.h"
 #include "tal_thread.h"
 #include "tal_mutex.h"
+#include "tal_semaphore.h"
 #include "uni_random.h"
 #include "tal_log.h"
 #include "tal_memory.h"
@@ -40,10 +42,30 @@
 #ifndef AI_BIZ_TASK_DELAY
 #define AI_BIZ_TASK_DELAY 10
 #endif
+#ifndef AI_BIZ_SEND_READY_MAX
+#define AI_BIZ_SEND_READY_MAX 8
+#endif
+
+// share of the sends a stream gets while others are ready too
+#define AI_BIZ_WEIGHT_AUDIO 4
+#define AI_BIZ_WEIGHT_VIDEO 2
+#define AI_BIZ_WEIGHT_OTHER 1
+
+#define AI_BIZ_SEND_CHAN_NUM (AI_MAX_SESSION_ID_NUM * AI_SESSION_MAX_NUM)
+
+typedef struct {
+    uint16_t ready;  // chunks signalled and not got yet
+    int16_t weight;  // current weight of the weighted round robin
+    BOOL_T signaled; // the producer uses tuya_ai_biz_send_ready, it is not polled
+} AI_BIZ_SEND_STATE_T;
 
 typedef struct {
     char id[AI_UUID_V4_LEN];
     AI_SESSION_CFG_T cfg;
+    AI_BIZ_SEND_STATE_T send_st[AI_MAX_SESSION_ID_NUM];
+    uint8_t busy;    // chunks being got or freed outside the mutex, the slot is kept until they end
+    uint8_t waiters; // deleters waiting on the idle_sem of the slot for the session to go idle
+    BOOL_T closing;  // deleted while busy, no more chunks are got
 } AI_SESSION_T;
 
 typedef struct {
@@ -56,7 +78,9 @@ typedef struct {
     THREAD_HANDLE thread;
     BOOL_T terminate;
     MUTEX_HANDLE mutex;
+    SEM_HANDLE ready_sem; // posted for each chunk signalled ready
     AI_SESSION_T session[AI_SESSION_MAX_NUM];
+    SEM_HANDLE idle_sem[AI_SESSION_MAX_NUM]; // per slot, posted for each waiter once its closing session goes idle
     AI_BIZ_RECV_CB cb;
     AI_BASIC_BIZ_MONITOR_T *monitor;
 } AI_BASIC_BIZ_T;
@@ -242,52 +266,189 @@ OPERATE_RET tuya_ai_send_biz_pkt_custom(uint16_t id, AI_BIZ_ATTR_INFO_T *attr, A
     return rt;
 }
 
-static void __ai_biz_thread_cb(void *args)
+static int16_t __ai_biz_send_weight(AI_PACKET_PT type)
+{
+    if (type == AI_PT_AUDIO) {
+        return AI_BIZ_WEIGHT_AUDIO;
+    } else if ((type == AI_PT_VIDEO) || (type == AI_PT_IMAGE)) {
+        return AI_BIZ_WEIGHT_VIDEO;
+    }
+    return AI_BIZ_WEIGHT_OTHER;
+}
+
+// first channel of the sessions with the send id, the one its chunks are counted on
+static OPERATE_RET __ai_biz_find_send(uint16_t id, AI_SESSION_T **session, uint32_t *sidx)
+{
+    uint32_t idx = 0, kdx = 0;
+    for (idx = 0; idx < AI_SESSION_MAX_NUM; idx++) {
+        if ((ai_basic_biz->session[idx].id[0] != 0) && !ai_basic_biz->session[idx].closing) {
+            for (kdx = 0; kdx < ai_basic_biz->session[idx].cfg.send_num; kdx++) {
+                if (ai_basic_biz->session[idx].cfg.send[kdx].id == id) {
+                    *session = &ai_basic_biz->session[idx];
+                    *sidx = kdx;
+                    return OPRT_OK;
+                }
+            }
+        }
+    }
+    return OPRT_NOT_FOUND;
+}
+
+// end a chunk counted in session->busy, a session deleted meanwhile is cleared by
+// its last chunk, or handed to the deleters waiting for it
+static void __ai_biz_send_done(AI_SESSION_T *session)
+{
+    tal_mutex_lock(ai_basic_biz->mutex);
+    session->busy--;
+    if ((session->busy == 0) && session->closing) {
+        if (session->waiters) {
+            for (; session->waiters; session->waiters--) {
+                tal_semaphore_post(ai_basic_biz->idle_sem[session - ai_basic_biz->session]);
+            }
+        } else {
+            memset(session, 0, sizeof(AI_SESSION_T));
+        }
+    }
+    tal_mutex_unlock(ai_basic_biz->mutex);
+}
+
+// get_cb and free_cb run outside the mutex, the caller counted the chunk in session->busy
+static void __ai_biz_send_chunk(AI_SESSION_T *session, AI_BIZ_SEND_DATA_T *send)
+{
+    AI_BIZ_ATTR_INFO_T attr = {0};
+    AI_BIZ_HEAD_INFO_T head = {0};
+    char *payload = NULL;
+
+    tal_mutex_lock(ai_basic_biz->mutex);
+    BOOL_T closing = session->closing;
+    tal_mutex_unlock(ai_basic_biz->mutex);
+    if (!closing && (OPRT_OK == send->get_cb(&attr, &head, &payload))) {
+        tuya_ai_send_biz_pkt(send->id, &attr, send->type, &head, payload);
+        if (send->free_cb) {
+            send->free_cb(payload);
+        }
+    }
+    __ai_biz_send_done(session);
+}
+
+// send one ready chunk, by smooth weighted round robin: each ready channel
+// gains its weight, the heaviest is sent and loses the sum of the weights,
+// ties go to the higher weight so audio leads video and video leads text
+static OPERATE_RET __ai_biz_send_next(void)
+{
+    uint32_t idx = 0, sidx = 0;
+    int16_t sum = 0;
+    AI_SESSION_T *best_session = NULL;
+    uint32_t best_sidx = 0;
+    int16_t best_weight = 0;
+
+    tal_mutex_lock(ai_basic_biz->mutex);
+    for (idx = 0; idx < AI_SESSION_MAX_NUM; idx++) {
+        AI_SESSION_T *session = &ai_basic_biz->session[idx];
+        if ((session->id[0] == 0) || session->closing) {
+            continue;
+        }
+        for (sidx = 0; sidx < session->cfg.send_num; sidx++) {
+            AI_BIZ_SEND_STATE_T *st = &session->send_st[sidx];
+            if (st->ready == 0) {
+                continue;
+            }
+            int16_t weight = __ai_biz_send_weight(session->cfg.send[sidx].type);
+            st->weight += weight;
+            sum += weight;
+            if ((NULL == best_session) || (st->weight > best_session->send_st[best_sidx].weight) ||
+                ((st->weight == best_session->send_st[best_sidx].weight) && (weight > best_weight))) {
+                best_session = session;
+                best_sidx = sidx;
+                best_weight = weight;
+            }
+        }
+    }
+    if (NULL == best_session) {
+        tal_mutex_unlock(ai_basic_biz->mutex);
+        return OPRT_NOT_FOUND;
+    }
+    AI_BIZ_SEND_STATE_T *st = &best_session->send_st[best_sidx];
+    st->weight -= sum;
+    st->ready--;
+    if (st->ready == 0) {
+        st->weight = 0;
+    }
+    AI_BIZ_SEND_DATA_T send = best_session->cfg.send[best_sidx];
+    if (send.get_cb) {
+        best_session->busy++;
+    }
+    tal_mutex_unlock(ai_basic_biz->mutex);
+
+    if (send.get_cb) {
+        __ai_biz_send_chunk(best_session, &send);
+    }
+    return OPRT_OK;
+}
+
+// ask the channels that never signalled a chunk ready, as they were before
+static uint8_t __ai_biz_poll_send(void)
 {
-    OPERATE_RET rt = OPRT_OK;
     uint32_t idx = 0, sidx = 0, kdx = 0;
+    AI_BIZ_SEND_DATA_T polled[AI_BIZ_SEND_CHAN_NUM];
+    AI_SESSION_T *polled_session[AI_BIZ_SEND_CHAN_NUM];
+    uint32_t polled_count = 0;
+
+    tal_mutex_lock(ai_basic_biz->mutex);
+    for (idx = 0; idx < AI_SESSION_MAX_NUM; idx++) {
+        AI_SESSION_T *session = &ai_basic_biz->session[idx];
+        if ((session->id[0] == 0) || session->closing) {
+            continue;
+        }
+        for (sidx = 0; sidx < session->cfg.send_num; sidx++) {
+            AI_BIZ_SEND_DATA_T *send = &session->cfg.send[sidx];
+            if ((NULL == send->get_cb) || session->send_st[sidx].signaled) {
+                continue;
+            }
+            for (kdx = 0; kdx < polled_count; kdx++) {
+                if (polled[kdx].id == send->id) {
+                    break;
+                }
+            }
+            if (kdx == polled_count) {
+                session->busy++;
+                polled_session[polled_count] = session;
+                polled[polled_count++] = *send;
+            }
+        }
+    }
+    tal_mutex_unlock(ai_basic_biz->mutex);
+
+    for (kdx = 0; kdx < polled_count; kdx++) {
+        __ai_biz_send_chunk(polled_session[kdx], &polled[kdx]);
+    }
+    return (polled_count > 0);
+}
+
+static void __ai_biz_thread_cb(void *args)
+{
+    uint8_t poll = false;
+    SYS_TIME_T poll_at = 0;
     while (!ai_basic_biz->terminate && tal_thread_get_state(ai_basic_biz->thread) == THREAD_STATE_RUNNING) {
         if (!tuya_ai_client_is_ready()) {
             tal_system_sleep(200);
             continue;
         }
-        tal_mutex_lock(ai_basic_biz->mutex);
-        uint16_t sent_ids[AI_MAX_SESSION_ID_NUM * AI_SESSION_MAX_NUM] = {0};
-        uint32_t sent_ids_count = 0;
-        for (idx = 0; idx < AI_SESSION_MAX_NUM; idx++) {
-            if (ai_basic_biz->session[idx].id[0] != 0) {
-                AI_SESSION_T *session = &ai_basic_biz->session[idx];
-                for (sidx = 0; sidx < session->cfg.send_num; sidx++) {
-                    uint16_t send_id = session->cfg.send[sidx].id;
-                    uint8_t already_sent = false;
-                    for (kdx = 0; kdx < sent_ids_count; kdx++) {
-                        if (sent_ids[kdx] == send_id) {
-                            already_sent = true;
-                            break;
-                        }
-                    }
-                    if (!already_sent) {
-                        sent_ids[sent_ids_count++] = send_id;
-                        AI_BIZ_SEND_DATA_T *send = &session->cfg.send[sidx];
-                        if (send->get_cb) {
-                            AI_BIZ_ATTR_INFO_T attr = {0};
-                            AI_BIZ_HEAD_INFO_T head = {0};
-                            char *payload = NULL;
-                            rt = send->get_cb(&attr, &head, &payload);
-                            if (rt != OPRT_OK) {
-                                continue;
-                            }
-                            tuya_ai_send_biz_pkt(send->id, &attr, send->type, &head, payload);
-                            if (send->free_cb) {
-                                send->free_cb(payload);
-                            }
-                        }
-                    }
-                }
-            }
+        // polled channels are asked every AI_BIZ_TASK_DELAY, however often signalled chunks wake the thread
+        SYS_TIME_T now = tal_system_get_millisecond();
+        if (now >= poll_at) {
+            poll = __ai_biz_poll_send();
+            poll_at = now + AI_BIZ_TASK_DELAY;
+        }
+        uint32_t timeout = SEM_WAIT_FOREVER;
+        if (poll) {
+            now = tal_system_get_millisecond();
+            timeout = (poll_at > now) ? (uint32_t)(poll_at - now) : 1;
+        }
+        // one chunk per post, so the semaphore keeps counting the chunks not sent yet
+        if ((OPRT_OK == tal_semaphore_wait(ai_basic_biz->ready_sem, timeout)) && !ai_basic_biz->terminate) {
+            __ai_biz_send_next();
         }
-        tal_mutex_unlock(ai_basic_biz->mutex);
-        tal_system_sleep(AI_BIZ_TASK_DELAY);
     }
 
     PR_NOTICE("ai biz thread exit");
@@ -343,6 +504,16 @@ static void __ai_biz_deinit(void)
             tal_mutex_release(ai_basic_biz->mutex);
             ai_basic_biz->mutex = NULL;
         }
+        if (ai_basic_biz->ready_sem) {
+            tal_semaphore_release(ai_basic_biz->ready_sem);
+            ai_basic_biz->ready_sem = NULL;
+        }
+        for (uint32_t idx = 0; idx < AI_SESSION_MAX_NUM; idx++) {
+            if (ai_basic_biz->idle_sem[idx]) {
+                tal_semaphore_release(ai_basic_biz->idle_sem[idx]);
+                ai_basic_biz->idle_sem[idx] = NULL;
+            }
+        }
         OS_FREE(ai_basic_biz);
         ai_basic_biz = NULL;
     }
@@ -727,13 +898,33 @@ static OPERATE_RET __ai_biz_session_destory(AI_SESSION_ID id, AI_STATUS_CODE cod
     }
 
     PR_NOTICE("del sessoion id:%s", id);
+    // a get_cb or free_cb deleting its own session cannot wait, its chunk clears the slot when it ends
+    BOOL_T in_biz_thread = FALSE;
+    if (ai_basic_biz->thread) {
+        tal_thread_is_self(ai_basic_biz->thread, &in_biz_thread);
+    }
     tal_mutex_lock(ai_basic_biz->mutex);
     for (idx = 0; idx < AI_SESSION_MAX_NUM; idx++) {
-        if (ai_basic_biz->session[idx].id[0] != 0 && !strcmp(ai_basic_biz->session[idx].id, id)) {
-            memset(&ai_basic_biz->session[idx], 0, sizeof(AI_SESSION_T));
+        AI_SESSION_T *session = &ai_basic_biz->session[idx];
+        if (session->id[0] == 0 || strcmp(session->id, id)) {
+            continue;
+        }
+        if (session->busy == 0) {
+            memset(session, 0, sizeof(AI_SESSION_T));
             AI_PROTO_D("del session idx:%d", idx);
             break;
         }
+        session->closing = TRUE;
+        if (in_biz_thread) {
+            AI_PROTO_D("del busy session idx:%d", idx);
+            break;
+        }
+        // wait for the chunk in flight, then look the session up again from the first slot
+        session->waiters++;
+        tal_mutex_unlock(ai_basic_biz->mutex);
+        tal_semaphore_wait(ai_basic_biz->idle_sem[idx], SEM_WAIT_FOREVER);
+        tal_mutex_lock(ai_basic_biz->mutex);
+        idx = (uint32_t)-1; // the loop increment wraps it to 0
     }
     tal_mutex_unlock(ai_basic_biz->mutex);
     if (idx == AI_SESSION_MAX_NUM) {
@@ -893,7 +1084,12 @@ static OPERATE_RET __ai_clt_close_evt(void *data)
         if (ai_basic_biz->session[idx].id[0] != 0) {
             PR_NOTICE("close session id:%s", ai_basic_biz->session[idx].id);
             tal_event_publish(EVENT_AI_SESSION_CLOSE, ai_basic_biz->session[idx].id);
-            memset(&ai_basic_biz->session[idx], 0, sizeof(AI_SESSION_T));
+            // a closing session is cleared by its last chunk or by its deleter, never here
+            if (ai_basic_biz->session[idx].busy || ai_basic_biz->session[idx].closing) {
+                ai_basic_biz->session[idx].closing = TRUE;
+            } else {
+                memset(&ai_basic_biz->session[idx], 0, sizeof(AI_SESSION_T));
+            }
         }
     }
     tal_mutex_unlock(ai_basic_biz->mutex);
@@ -910,6 +1106,12 @@ static OPERATE_RET __ai_clt_run_evt(void *data)
         memset(ai_basic_biz, 0, sizeof(AI_BASIC_BIZ_T));
         ai_basic_biz->monitor = &ai_monitor;
         TUYA_CALL_ERR_GOTO(tal_mutex_create_init(&ai_basic_biz->mutex), EXIT);
+        TUYA_CALL_ERR_GOTO(tal_semaphore_create_init(&ai_basic_biz->ready_sem, 0,
+                                                     AI_BIZ_SEND_CHAN_NUM * AI_BIZ_SEND_READY_MAX),
+                           EXIT);
+        for (uint32_t idx = 0; idx < AI_SESSION_MAX_NUM; idx++) {
+            TUYA_CALL_ERR_GOTO(tal_semaphore_create_init(&ai_basic_biz->idle_sem[idx], 0, 0xFF), EXIT);
+        }
         tuya_ai_client_reg_cb(__ai_biz_recv_handle);
         PR_NOTICE("ai biz init success");
     }
@@ -934,11 +1136,22 @@ void tuya_ai_biz_deinit(void)
     if (ai_basic_biz) {
         if (ai_basic_biz->thread) {
             ai_basic_biz->terminate = TRUE;
+            tal_semaphore_post(ai_basic_biz->ready_sem);
         } else {
             if (ai_basic_biz->mutex) {
                 tal_mutex_release(ai_basic_biz->mutex);
                 ai_basic_biz->mutex = NULL;
             }
+            if (ai_basic_biz->ready_sem) {
+                tal_semaphore_release(ai_basic_biz->ready_sem);
+                ai_basic_biz->ready_sem = NULL;
+            }
+            for (uint32_t idx = 0; idx < AI_SESSION_MAX_NUM; idx++) {
+                if (ai_basic_biz->idle_sem[idx]) {
+                    tal_semaphore_release(ai_basic_biz->idle_sem[idx]);
+                    ai_basic_biz->idle_sem[idx] = NULL;
+                }
+            }
             OS_FREE(ai_basic_biz);
             ai_basic_biz = NULL;
         }
@@ -1023,6 +1236,10 @@ OPERATE_RET tuya_ai_biz_crt_session(uint32_t bizCode, AI_SESSION_CFG_T *cfg, uin
         __ai_biz_create_task();
     }
     tal_mutex_unlock(ai_basic_biz->mutex);
+    // a thread waiting for signalled chunks only starts polling the new channels once woken
+    if (ai_basic_biz->ready_sem && (idx < AI_SESSION_MAX_NUM)) {
+        tal_semaphore_post(ai_basic_biz->ready_sem);
+    }
 
     if (idx == AI_SESSION_MAX_NUM) {
         PR_ERR("session num is full");
@@ -1037,6 +1254,36 @@ OPERATE_RET tuya_ai_biz_del_session(AI_SESSION_ID id, AI_STATUS_CODE code)
     return __ai_biz_session_destory(id, code, true);
 }
 
+OPERATE_RET tuya_ai_biz_send_ready(uint16_t id)
+{
+    OPERATE_RET rt = OPRT_OK;
+    AI_SESSION_T *session = NULL;
+    uint32_t sidx = 0;
+
+    if (ai_basic_biz == NULL) {
+        PR_ERR("ai biz is null");
+        return OPRT_COM_ERROR;
+    }
+
+    tal_mutex_lock(ai_basic_biz->mutex);
+    rt = __ai_biz_find_send(id, &session, &sidx);
+    if (OPRT_OK == rt) {
+        AI_BIZ_SEND_STATE_T *st = &session->send_st[sidx];
+        st->signaled = TRUE;
+        if (st->ready >= AI_BIZ_SEND_READY_MAX) {
+            rt = OPRT_EXCEED_UPPER_LIMIT;
+        } else {
+            st->ready++;
+        }
+    }
+    tal_mutex_unlock(ai_basic_biz->mutex);
+
+    if (OPRT_OK == rt) {
+        tal_semaphore_post(ai_basic_biz->ready_sem);
+    }
+    return rt;
+}
+
 int tuya_ai_biz_get_send_id(void)
 {
     static int odd_number = 1;
@@ -45,6 +45,8 @@
 #define AI_ATOP_THING_CONFIG_INFO "thing.aigc.basic.server.config.info"
 #define AI_ADD_PKT_LEN            128
 #define AI_DEFAULT_BIZ_TAG        0
+// the sign covers the first and the last bytes of a packet
+#define AI_SIGN_EDGE_LEN          32
 
 #ifndef AI_READ_SOCKET_BUF_SIZE
 #define AI_READ_SOCKET_BUF_SIZE 0
@@ -53,6 +55,13 @@
 #define AI_WRITE_SOCKET_BUF_SIZE 0
 #endif
 
+#ifndef AI_PKT_POOL_NUM
+#define AI_PKT_POOL_NUM 1
+#endif
+// a pooled buffer holds a whole packet, it is sent or received, encrypted or
+// decrypted in place, AI_ADD_PKT_LEN is headroom for the padding and the tag
+#define AI_PKT_BUF_LEN (AI_MAX_FRAGMENT_LENGTH + 2 * AI_ADD_PKT_LEN)
+
 /**
  *
  * packet: AI_PACKET_HEAD_T+(iv)+len+payload+sign
@@ -64,6 +73,7 @@
 typedef struct {
     AI_FRAG_FLAG frag_flag;
     uint32_t offset;
+    uint32_t size; // allocated length of data
     char *data;
 } AI_RECV_FRAG_MNG_T;
 
@@ -89,11 +99,29 @@ typedef struct {
     AI_RECV_FRAG_MNG_T recv_frag_mng;
     AI_SEND_FRAG_MNG_T send_frag_mng[2]; // 0:image,1:file
     bool frag_flag;
-    char recv_buf[AI_MAX_FRAGMENT_LENGTH + AI_ADD_PKT_LEN];
+    // keyed once per generated key, send and recv sign on different threads
+    tal_hash_mac_context_t sign_tx;
+    tal_hash_mac_context_t sign_rx;
+#if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL3)
+    tal_aes_key_t aes_key;
+#elif (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL4)
+    cipher_gcm_key_t gcm_enc;
+    cipher_gcm_key_t gcm_dec;
+#endif
 } AI_BASIC_PROTO_T;
 
 static AI_BASIC_PROTO_T *ai_basic_proto = NULL;
 
+// the pool outlives the proto while one of its buffers is held, a received
+// payload may be freed after tuya_ai_basic_disconnect
+typedef struct {
+    uint32_t used; // bit n set while buf[n] is in use
+    bool retired;  // the proto was deinited, the last buffer put frees the pool
+    char buf[AI_PKT_POOL_NUM][AI_PKT_BUF_LEN];
+} AI_PKT_POOL_T;
+static MUTEX_HANDLE ai_pkt_pool_mutex = NULL;
+static AI_PKT_POOL_T *ai_pkt_pool = NULL;
+
 static void __ai_atop_cfg_free(void)
 {
     uint32_t idx = 0;
@@ -173,9 +201,60 @@ static OPERATE_RET __ai_generate_sign_key()
     return rt;
 }
 
-static char *__ai_get_sign_key(void)
+static OPERATE_RET __ai_crypt_ctx_rekey(void)
+{
+    OPERATE_RET rt = OPRT_OK;
+
+    TUYA_CALL_ERR_RETURN(
+        tal_sha256_mac_starts(&ai_basic_proto->sign_tx, (uint8_t *)ai_basic_proto->sign_key, AI_KEY_LEN));
+    TUYA_CALL_ERR_RETURN(
+        tal_sha256_mac_starts(&ai_basic_proto->sign_rx, (uint8_t *)ai_basic_proto->sign_key, AI_KEY_LEN));
+#if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL3)
+    TUYA_CALL_ERR_RETURN(
+        tal_aes_setkey_enc(ai_basic_proto->aes_key.enc, (uint8_t *)ai_basic_proto->crypt_key, AI_KEY_LEN * 8));
+    TUYA_CALL_ERR_RETURN(
+        tal_aes_setkey_dec(ai_basic_proto->aes_key.dec, (uint8_t *)ai_basic_proto->crypt_key, AI_KEY_LEN * 8));
+#elif (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL4)
+    TUYA_CALL_ERR_RETURN(
+        mbedtls_gcm_key_setup_wrapper(&ai_basic_proto->gcm_enc, (uint8_t *)ai_basic_proto->crypt_key, AI_KEY_LEN));
+    TUYA_CALL_ERR_RETURN(
+        mbedtls_gcm_key_setup_wrapper(&ai_basic_proto->gcm_dec, (uint8_t *)ai_basic_proto->crypt_key, AI_KEY_LEN));
+#endif
+
+    return rt;
+}
+
+static OPERATE_RET __ai_crypt_ctx_init(void)
 {
-    return ai_basic_proto->sign_key;
+    OPERATE_RET rt = OPRT_OK;
+
+    TUYA_CALL_ERR_RETURN(tal_sha256_mac_create_init(&ai_basic_proto->sign_tx));
+    TUYA_CALL_ERR_RETURN(tal_sha256_mac_create_init(&ai_basic_proto->sign_rx));
+#if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL3)
+    TUYA_CALL_ERR_RETURN(
+        tal_aes_key_init(&ai_basic_proto->aes_key, (uint8_t *)ai_basic_proto->crypt_key, AI_KEY_LEN * 8));
+#elif (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL4)
+    mbedtls_gcm_key_init_wrapper(&ai_basic_proto->gcm_enc);
+    mbedtls_gcm_key_init_wrapper(&ai_basic_proto->gcm_dec);
+#endif
+
+    return __ai_crypt_ctx_rekey();
+}
+
+static void __ai_crypt_ctx_deinit(void)
+{
+    if (ai_basic_proto->sign_tx.ctx) {
+        tal_sha256_mac_free(&ai_basic_proto->sign_tx);
+    }
+    if (ai_basic_proto->sign_rx.ctx) {
+        tal_sha256_mac_free(&ai_basic_proto->sign_rx);
+    }
+#if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL3)
+    tal_aes_key_free(&ai_basic_proto->aes_key);
+#elif (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL4)
+    mbedtls_gcm_key_free_wrapper(&ai_basic_proto->gcm_enc);
+    mbedtls_gcm_key_free_wrapper(&ai_basic_proto->gcm_dec);
+#endif
 }
 
 static AI_PACKET_SL __ai_get_sl(AI_SEND_PACKET_T *info, uint8_t is_decrypt)
@@ -195,6 +274,50 @@ static AI_PACKET_SL __ai_get_sl(AI_SEND_PACKET_T *info, uint8_t is_decrypt)
     }
 }
 
+static OPERATE_RET __ai_pkt_pool_init(void)
+{
+    OPERATE_RET rt = OPRT_OK;
+    // created once, buffers may be put back after the proto is gone
+    if (NULL == ai_pkt_pool_mutex) {
+        TUYA_CALL_ERR_RETURN(tal_mutex_create_init(&ai_pkt_pool_mutex));
+    }
+    tal_mutex_lock(ai_pkt_pool_mutex);
+    if (NULL == ai_pkt_pool) {
+        ai_pkt_pool = OS_MALLOC(sizeof(AI_PKT_POOL_T));
+        if (ai_pkt_pool) {
+            memset(ai_pkt_pool, 0, sizeof(AI_PKT_POOL_T));
+        } else {
+            rt = OPRT_MALLOC_FAILED;
+        }
+    } else {
+        // still held by a payload of the previous proto, taken over as it is
+        ai_pkt_pool->retired = FALSE;
+    }
+    tal_mutex_unlock(ai_pkt_pool_mutex);
+    return rt;
+}
+
+static void __ai_pkt_pool_deinit(void)
+{
+    AI_PKT_POOL_T *pool = NULL;
+    if (NULL == ai_pkt_pool_mutex) {
+        return;
+    }
+    tal_mutex_lock(ai_pkt_pool_mutex);
+    if (ai_pkt_pool) {
+        if (0 == ai_pkt_pool->used) {
+            pool = ai_pkt_pool;
+            ai_pkt_pool = NULL;
+        } else {
+            ai_pkt_pool->retired = TRUE;
+        }
+    }
+    tal_mutex_unlock(ai_pkt_pool_mutex);
+    if (pool) {
+        OS_FREE(pool);
+    }
+}
+
 static void __ai_basic_proto_deinit(void)
 {
     if (ai_basic_proto) {
@@ -207,6 +330,8 @@ static void __ai_basic_proto_deinit(void)
             tal_mutex_release(ai_basic_proto->mutex);
             ai_basic_proto->mutex = NULL;
         }
+        __ai_pkt_pool_deinit();
+        __ai_crypt_ctx_deinit();
         __ai_atop_cfg_free();
         if (ai_basic_proto->connection_id) {
             OS_FREE(ai_basic_proto->connection_id);
@@ -218,8 +343,10 @@ static void __ai_basic_proto_deinit(void)
     return;
 }
 
-static void __ai_basic_proto_reinit(void)
+static OPERATE_RET __ai_basic_proto_reinit(void)
 {
+    OPERATE_RET rt = OPRT_OK;
+
     tal_mutex_lock(ai_basic_proto->mutex);
     if (ai_basic_proto->transporter) {
         tuya_transporter_close(ai_basic_proto->transporter);
@@ -231,34 +358,45 @@ static void __ai_basic_proto_reinit(void)
         OS_FREE(ai_basic_proto->connection_id);
         ai_basic_proto->connection_id = NULL;
     }
-    __ai_generate_crypt_key();
-    __ai_generate_sign_key();
+    rt = __ai_generate_crypt_key();
+    if (OPRT_OK == rt) {
+        rt = __ai_generate_sign_key();
+    }
+    if (OPRT_OK == rt) {
+        // with stale sign and cipher contexts every packet would fail to verify
+        rt = __ai_crypt_ctx_rekey();
+    }
     ai_basic_proto->connected = FALSE;
     ai_basic_proto->sequence_in = 0;
     ai_basic_proto->sequence_out = 1;
-    memset(ai_basic_proto->recv_buf, 0, sizeof(ai_basic_proto->recv_buf));
     memset(ai_basic_proto->encrypt_iv, 0, AI_IV_LEN);
     uni_random_string(ai_basic_proto->encrypt_iv, AI_IV_LEN);
     ai_basic_proto->sl = AI_PACKET_SECURITY_LEVEL;
     memset(ai_basic_proto->decrypt_iv, 0, AI_IV_LEN);
     memset(&ai_basic_proto->recv_frag_mng, 0, sizeof(ai_basic_proto->recv_frag_mng));
     tal_mutex_unlock(ai_basic_proto->mutex);
+    if (OPRT_OK != rt) {
+        PR_ERR("ai proto reinit failed, rt:%d", rt);
+        return rt;
+    }
     PR_NOTICE("ai proto reinit success");
-    return;
+    return OPRT_OK;
 }
 
 static OPERATE_RET __ai_basic_proto_init(void)
 {
     OPERATE_RET rt = OPRT_OK;
     if (ai_basic_proto) {
-        __ai_basic_proto_reinit();
+        rt = __ai_basic_proto_reinit();
     } else {
         ai_basic_proto = OS_MALLOC(sizeof(AI_BASIC_PROTO_T));
         TUYA_CHECK_NULL_RETURN(ai_basic_proto, OPRT_MALLOC_FAILED);
         memset(ai_basic_proto, 0, sizeof(AI_BASIC_PROTO_T));
         TUYA_CALL_ERR_GOTO(__ai_generate_crypt_key(), EXIT);
         TUYA_CALL_ERR_GOTO(__ai_generate_sign_key(), EXIT);
+        TUYA_CALL_ERR_GOTO(__ai_crypt_ctx_init(), EXIT);
         TUYA_CALL_ERR_GOTO(tal_mutex_create_init(&ai_basic_proto->mutex), EXIT);
+        TUYA_CALL_ERR_GOTO(__ai_pkt_pool_init(), EXIT);
         ai_basic_proto->sequence_out = 1;
         uni_random_string(ai_basic_proto->encrypt_iv, AI_IV_LEN);
         ai_basic_proto->sl = AI_PACKET_SECURITY_LEVEL;
@@ -272,6 +410,67 @@ EXIT:
     return OPRT_COM_ERROR;
 }
 
+// the pool is not freed nor replaced while buf is held from it
+static bool __ai_pkt_buf_is_pooled(char *buf)
+{
+    if (NULL == ai_pkt_pool) {
+        return FALSE;
+    }
+    char *pool = ai_pkt_pool->buf[0];
+    return (buf >= pool) && (buf < pool + sizeof(ai_pkt_pool->buf));
+}
+
+// take a free buffer of the pool, allocated if len does not fit in one or all
+// of them are in use
+static char *__ai_pkt_buf_get(uint32_t len)
+{
+    char *buf = NULL;
+    uint32_t idx = 0;
+    if (len <= AI_PKT_BUF_LEN) {
+        tal_mutex_lock(ai_pkt_pool_mutex);
+        if (ai_pkt_pool && !ai_pkt_pool->retired) {
+            for (idx = 0; idx < AI_PKT_POOL_NUM; idx++) {
+                if (!(ai_pkt_pool->used & (1U << idx))) {
+                    ai_pkt_pool->used |= (1U << idx);
+                    buf = ai_pkt_pool->buf[idx];
+                    break;
+                }
+            }
+        }
+        tal_mutex_unlock(ai_pkt_pool_mutex);
+    }
+    if (buf) {
+        return buf;
+    }
+    AI_PROTO_D("pkt pool empty, malloc len:%d", len);
+    return OS_MALLOC(len);
+}
+
+// buf may point anywhere in a pooled buffer
+static void __ai_pkt_buf_put(char *buf)
+{
+    AI_PKT_POOL_T *pool = NULL;
+    if (NULL == buf) {
+        return;
+    }
+    tal_mutex_lock(ai_pkt_pool_mutex);
+    if (!__ai_pkt_buf_is_pooled(buf)) {
+        tal_mutex_unlock(ai_pkt_pool_mutex);
+        OS_FREE(buf);
+        return;
+    }
+    uint32_t idx = (buf - ai_pkt_pool->buf[0]) / AI_PKT_BUF_LEN;
+    ai_pkt_pool->used &= ~(1U << idx);
+    if (ai_pkt_pool->retired && (0 == ai_pkt_pool->used)) {
+        pool = ai_pkt_pool;
+        ai_pkt_pool = NULL;
+    }
+    tal_mutex_unlock(ai_pkt_pool_mutex);
+    if (pool) {
+        OS_FREE(pool);
+    }
+}
+
 OPERATE_RET tuya_ai_basic_atop_req(void)
 {
     OPERATE_RET rt = OPRT_OK;
@@ -438,17 +637,15 @@ static uint32_t __ai_get_payload_len(char *buf)
     return packet_len - AI_SIGN_LEN;
 }
 
-static OPERATE_RET __ai_packet_sign(char *buf, uint8_t *signature)
+static OPERATE_RET __ai_packet_sign(tal_hash_mac_context_t *mac, char *buf, uint8_t *signature)
 {
     OPERATE_RET rt = OPRT_OK;
-    char *sign_key = __ai_get_sign_key();
-    TUYA_CHECK_NULL_RETURN(sign_key, OPRT_COM_ERROR);
 
     uint32_t head_len = __ai_get_head_len(buf);
     uint32_t payload_len = __ai_get_payload_len(buf);
 
     // transport first 32 byte and packet last 32 byte, if less than 64 byte,use all packet
-    uint8_t sign_data[64] = {0};
+    uint8_t sign_data[2 * AI_SIGN_EDGE_LEN] = {0};
     uint32_t sign_len = 0;
 
     AI_PROTO_D("start sign head_len:%d, payload_len:%d", head_len, payload_len);
@@ -456,15 +653,21 @@ static OPERATE_RET __ai_packet_sign(char *buf, uint8_t *signature)
         memcpy(sign_data, buf, head_len + payload_len);
         sign_len = head_len + payload_len;
     } else {
-        memcpy(sign_data, buf, 32);
+        memcpy(sign_data, buf, AI_SIGN_EDGE_LEN);
         char *payload = buf + head_len;
-        uint32_t offset = (payload_len > 32) ? payload_len - 32 : 0;
-        uint32_t copy_len = (payload_len > 32) ? 32 : payload_len;
-        memcpy(sign_data + 32, payload + offset, copy_len);
+        uint32_t offset = (payload_len > AI_SIGN_EDGE_LEN) ? payload_len - AI_SIGN_EDGE_LEN : 0;
+        uint32_t copy_len = (payload_len > AI_SIGN_EDGE_LEN) ? AI_SIGN_EDGE_LEN : payload_len;
+        memcpy(sign_data + AI_SIGN_EDGE_LEN, payload + offset, copy_len);
         sign_len = sizeof(sign_data);
     }
 
-    rt = tal_sha256_mac((uint8_t *)sign_key, AI_KEY_LEN, (uint8_t *)sign_data, sign_len, signature);
+    rt = tal_sha256_mac_reset(mac);
+    if (OPRT_OK == rt) {
+        rt = tal_sha256_mac_update(mac, sign_data, sign_len);
+    }
+    if (OPRT_OK == rt) {
+        rt = tal_sha256_mac_finish(mac, signature);
+    }
     if (OPRT_OK != rt) {
         PR_ERR("sign packet failed, rt:%d", rt);
     }
@@ -556,7 +759,8 @@ static int __ai_encrypt_add_pkcs(char *p, uint32_t len)
     return (len + cz);
 }
 
-static OPERATE_RET __ai_encrypt_packet(AI_SEND_PACKET_T *info, char *data, uint32_t len, char *output, uint32_t *en_len)
+// data is encrypted in place, it has room after len for the padding and the tag
+static OPERATE_RET __ai_encrypt_packet(AI_SEND_PACKET_T *info, char *data, uint32_t len, uint32_t *en_len)
 {
     OPERATE_RET rt = OPRT_OK;
     int data_out_len = 0;
@@ -566,11 +770,10 @@ static OPERATE_RET __ai_encrypt_packet(AI_SEND_PACKET_T *info, char *data, uint3
     AI_PACKET_SL sl = __ai_get_sl(info, false);
     if (sl == AI_PACKET_SL2) {
 #if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL2)
-        memcpy(output, data, len);
-        data_out_len = __ai_encrypt_add_pkcs(output, len);
+        data_out_len = __ai_encrypt_add_pkcs(data, len);
         char nonce[12] = {0};
         memcpy(nonce, ai_basic_proto->encrypt_iv, sizeof(nonce));
-        rt = mbedtls_chacha20_crypt((uint8_t *)key, (uint8_t *)nonce, 0, len, (uint8_t *)data, (uint8_t *)output);
+        rt = mbedtls_chacha20_crypt((uint8_t *)key, (uint8_t *)nonce, 0, len, (uint8_t *)data, (uint8_t *)data);
         if (OPRT_OK != rt) {
             PR_ERR("chacha20_crypt error:%d", rt);
             return rt;
@@ -579,10 +782,9 @@ static OPERATE_RET __ai_encrypt_packet(AI_SEND_PACKET_T *info, char *data, uint3
 #endif
     } else if (sl == AI_PACKET_SL3) {
 #if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL3)
-        memcpy(output, data, len);
-        data_out_len = tal_pkcs7padding_buffer((uint8_t *)output, len);
-        rt = tal_aes256_cbc_encode_raw((uint8_t *)output, data_out_len, (uint8_t *)key,
-                                       (uint8_t *)ai_basic_proto->encrypt_iv, (uint8_t *)output);
+        data_out_len = tal_pkcs7padding_buffer((uint8_t *)data, len);
+        rt = tal_aes_key_crypt_cbc(&ai_basic_proto->aes_key, SYMMETRY_ENCRYPT, data_out_len,
+                                   (uint8_t *)ai_basic_proto->encrypt_iv, (uint8_t *)data, (uint8_t *)data);
         if (OPRT_OK != rt) {
             PR_ERR("aes128_cbc_encode error:%d", rt);
             return rt;
@@ -591,9 +793,8 @@ static OPERATE_RET __ai_encrypt_packet(AI_SEND_PACKET_T *info, char *data, uint3
 #endif
     } else if (sl == AI_PACKET_SL4) {
 #if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL4)
-        uint8_t tag[AI_GCM_TAG_LEN] = {0};
-        memcpy(output, data, len);
-        data_out_len = __ai_encrypt_add_pkcs(output, len);
+        size_t out_len = 0;
+        data_out_len = __ai_encrypt_add_pkcs(data, len);
 
         const cipher_params_t en_input = {
             .cipher_type = MBEDTLS_CIPHER_AES_256_GCM,
@@ -603,20 +804,20 @@ static OPERATE_RET __ai_encrypt_packet(AI_SEND_PACKET_T *info, char *data, uint3
             .nonce_len = AI_IV_LEN,
             .ad = NULL,
             .ad_len = 0,
-            .data = (uint8_t *)output,
+            .data = (uint8_t *)data,
             .data_len = data_out_len,
         };
-        rt = mbedtls_cipher_auth_encrypt_wrapper(&en_input, (uint8_t *)output, (size_t *)en_len, tag, sizeof(tag));
+        // the tag goes right after the cipher text
+        rt = mbedtls_gcm_key_encrypt_wrapper(&ai_basic_proto->gcm_enc, &en_input, (uint8_t *)data, &out_len,
+                                             (uint8_t *)data + data_out_len, AI_GCM_TAG_LEN);
         if (rt != OPRT_OK) {
             PR_ERR("aes128_gcm_encode error:%x", rt);
         }
-        memcpy(output + *en_len, tag, sizeof(tag));
-        *en_len += sizeof(tag);
-        // tuya_debug_hex_dump("encrypt_data", 64, (uint8_t *)output, *en_len);
+        *en_len = out_len + AI_GCM_TAG_LEN;
+        // tuya_debug_hex_dump("encrypt_data", 64, (uint8_t *)data, *en_len);
 #endif
     } else if (sl == AI_PACKET_SL0) {
         AI_PROTO_D("sl:%d do not need crypt", sl);
-        memcpy(output, data, len);
         *en_len = len;
     } else {
         PR_ERR("sl:%d err", sl);
@@ -626,33 +827,40 @@ static OPERATE_RET __ai_encrypt_packet(AI_SEND_PACKET_T *info, char *data, uint3
     return rt;
 }
 
-static OPERATE_RET __ai_decrypt_packet(char *data, uint32_t len, char *output, uint32_t *de_len)
+// data is decrypted in place
+static OPERATE_RET __ai_decrypt_packet(char *data, uint32_t len, uint32_t *de_len)
 {
     OPERATE_RET rt = OPRT_OK;
     char *key = __ai_get_crypt_key();
     TUYA_CHECK_NULL_RETURN(key, OPRT_COM_ERROR);
 
     AI_PACKET_SL sl = __ai_get_sl(NULL, true);
+    // an encrypted payload ends with its padding, and with SL4 the tag after it
+    if ((sl != AI_PACKET_SL0) && (len <= ((sl == AI_PACKET_SL4) ? AI_GCM_TAG_LEN : 0))) {
+        PR_ERR("decrypt len too short:%u, sl:%d", len, sl);
+        return OPRT_INVALID_PARM;
+    }
+
     if (sl == AI_PACKET_SL2) {
 #if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL2)
         char nonce[12] = {0};
         memcpy(nonce, ai_basic_proto->decrypt_iv, sizeof(nonce));
-        rt = mbedtls_chacha20_crypt((uint8_t *)key, (uint8_t *)nonce, 0, len, (uint8_t *)data, (uint8_t *)output);
+        rt = mbedtls_chacha20_crypt((uint8_t *)key, (uint8_t *)nonce, 0, len, (uint8_t *)data, (uint8_t *)data);
         if (OPRT_OK != rt) {
             PR_ERR("chacha20_crypt error:%d", rt);
             return rt;
         }
-        *de_len = len - output[len - 1];
+        *de_len = len - data[len - 1];
 #endif
     } else if (sl == AI_PACKET_SL3) {
 #if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL3)
-        rt = tal_aes256_cbc_decode_raw((uint8_t *)data, len, (uint8_t *)key, (uint8_t *)ai_basic_proto->decrypt_iv,
-                                       (uint8_t *)output);
+        rt = tal_aes_key_crypt_cbc(&ai_basic_proto->aes_key, SYMMETRY_DECRYPT, len,
+                                   (uint8_t *)ai_basic_proto->decrypt_iv, (uint8_t *)data, (uint8_t *)data);
         if (OPRT_OK != rt) {
             PR_ERR("aes128_cbc_decode error:%d", rt);
             return rt;
         }
-        *de_len = len - output[len - 1];
+        *de_len = len - data[len - 1];
 #endif
     } else if (sl == AI_PACKET_SL4) {
 #if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL4)
@@ -660,6 +868,7 @@ static OPERATE_RET __ai_decrypt_packet(char *data, uint32_t len, char *output, u
         // tuya_debug_hex_dump("decrypt_key", 64, (uint8_t *)key, AI_KEY_LEN);
         // tuya_debug_hex_dump("decrypt_iv", 64, (uint8_t *)ai_basic_proto->decrypt_iv, AI_IV_LEN);
         // tuya_debug_hex_dump("decrypt_tag", 64, (uint8_t *)(data + len - AI_GCM_TAG_LEN), AI_GCM_TAG_LEN);
+        size_t out_len = 0;
         const cipher_params_t de_input = {
             .cipher_type = MBEDTLS_CIPHER_AES_256_GCM,
             .key = (unsigned char *)key,
@@ -672,17 +881,16 @@ static OPERATE_RET __ai_decrypt_packet(char *data, uint32_t len, char *output, u
             .data_len = len - AI_GCM_TAG_LEN,
         };
 
-        rt = mbedtls_cipher_auth_decrypt_wrapper(&de_input, (uint8_t *)output, (size_t *)de_len,
-                                                 (uint8_t *)(data + len - AI_GCM_TAG_LEN), AI_GCM_TAG_LEN);
+        rt = mbedtls_gcm_key_decrypt_wrapper(&ai_basic_proto->gcm_dec, &de_input, (uint8_t *)data, &out_len,
+                                             (uint8_t *)(data + len - AI_GCM_TAG_LEN), AI_GCM_TAG_LEN);
         if (rt != OPRT_OK) {
             PR_ERR("aes128_gcm_decode error:%x", rt);
             return rt;
         }
-        *de_len = *de_len - output[*de_len - 1];
+        *de_len = out_len - data[out_len - 1];
 #endif
     } else if (sl == AI_PACKET_SL0) {
         AI_PROTO_D("sl:%d do not need crypt ", sl);
-        memcpy(output, data, len);
         *de_len = len;
     } else {
         AI_PROTO_D("sl:%d err", sl);
@@ -692,8 +900,11 @@ static OPERATE_RET __ai_decrypt_packet(char *data, uint32_t len, char *output, u
     return rt;
 }
 
+// the payload is built and encrypted in place in payload_buf, with ref_data
+// only the first and last AI_SIGN_EDGE_LEN bytes of the data that the sign
+// covers are copied, the data is then written from info->data
 static OPERATE_RET __ai_pack_payload(AI_SEND_PACKET_T *info, char *payload_buf, uint32_t *payload_len,
-                                     AI_FRAG_FLAG frag, uint32_t origin_len)
+                                     AI_FRAG_FLAG frag, uint32_t origin_len, bool ref_data)
 {
     OPERATE_RET rt = OPRT_OK;
     uint32_t idx = 0, attr_len = 0, packet_len = 0;
@@ -701,9 +912,7 @@ static OPERATE_RET __ai_pack_payload(AI_SEND_PACKET_T *info, char *payload_buf,
     TUYA_CHECK_NULL_RETURN(info, OPRT_INVALID_PARM);
     packet_len = __ai_get_send_payload_len(info, frag);
 
-    char *buf = OS_MALLOC(packet_len);
-    TUYA_CHECK_NULL_RETURN(buf, OPRT_MALLOC_FAILED);
-    memset(buf, 0, packet_len);
+    char *buf = payload_buf;
 
     if (tuya_ai_is_need_attr(frag)) {
         AI_PAYLOAD_HEAD_T payload_head = {0};
@@ -744,7 +953,6 @@ static OPERATE_RET __ai_pack_payload(AI_SEND_PACKET_T *info, char *payload_buf,
                     memcpy(buf + offset, info->attrs[idx]->value.str, attr_idx_len);
                 } else {
                     PR_ERR("unknow payload type:%d", payload_type);
-                    OS_FREE(buf);
                     return OPRT_COM_ERROR;
                 }
                 offset += attr_idx_len;
@@ -758,17 +966,26 @@ static OPERATE_RET __ai_pack_payload(AI_SEND_PACKET_T *info, char *payload_buf,
         offset += sizeof(info->len);
     }
 
-    memcpy(buf + offset, info->data, info->len);
+    if (ref_data) {
+        memcpy(buf + offset, info->data, AI_SIGN_EDGE_LEN);
+        memcpy(buf + offset + info->len - AI_SIGN_EDGE_LEN, info->data + info->len - AI_SIGN_EDGE_LEN,
+               AI_SIGN_EDGE_LEN);
+    } else {
+        memcpy(buf + offset, info->data, info->len);
+    }
     offset += info->len;
     AI_PROTO_D("payload len:%d, offset:%d", packet_len, offset);
 
+    if (offset < packet_len) {
+        memset(buf + offset, 0, packet_len - offset);
+    }
+
     // tuya_debug_hex_dump("payload_uncrypt", 64, (uint8_t *)buf, packet_len);
-    rt = __ai_encrypt_packet(info, buf, packet_len, payload_buf, payload_len);
+    rt = __ai_encrypt_packet(info, buf, packet_len, payload_len);
     if (OPRT_OK != rt) {
         PR_ERR("encrypt packet failed, rt:%d", rt);
     }
 
-    OS_FREE(buf);
     return rt;
 }
 
@@ -904,9 +1121,8 @@ static OPERATE_RET __ai_packet_write(AI_SEND_PACKET_T *info, AI_FRAG_FLAG frag,
         PR_ERR("send packet too long, len: %d", uncrypt_len);
         return OPRT_COM_ERROR;
     }
-    char *send_pkt_buf = OS_MALLOC(uncrypt_len);
+    char *send_pkt_buf = __ai_pkt_buf_get(uncrypt_len);
     TUYA_CHECK_NULL_RETURN(send_pkt_buf, OPRT_MALLOC_FAILED);
-    memset(send_pkt_buf, 0, uncrypt_len);
 
     uint32_t head_len = sizeof(AI_PACKET_HEAD_T);
 
@@ -930,7 +1146,10 @@ static OPERATE_RET __ai_packet_write(AI_SEND_PACKET_T *info, AI_FRAG_FLAG frag,
 
     offset += sizeof(uint32_t);
 
-    rt = __ai_pack_payload(info, send_pkt_buf + offset, &payload_len, frag, origin_len);
+    // SL0 data is not encrypted, it is written from info->data instead of
+    // being copied, the encrypted levels need it in the buffer
+    bool ref_data = (AI_PACKET_SL0 == sl) && (info->len > 2 * AI_SIGN_EDGE_LEN) && ai_basic_proto->transporter;
+    rt = __ai_pack_payload(info, send_pkt_buf + offset, &payload_len, frag, origin_len, ref_data);
     if (OPRT_OK != rt) {
         goto EXIT;
     }
@@ -938,7 +1157,7 @@ static OPERATE_RET __ai_packet_write(AI_SEND_PACKET_T *info, AI_FRAG_FLAG frag,
 
     memcpy(send_pkt_buf + length_field_offset, &length, sizeof(length));
 
-    rt = __ai_packet_sign(send_pkt_buf, signature);
+    rt = __ai_packet_sign(&ai_basic_proto->sign_tx, send_pkt_buf, signature);
     if (OPRT_OK != rt) {
         goto EXIT;
     }
@@ -949,7 +1168,21 @@ static OPERATE_RET __ai_packet_write(AI_SEND_PACKET_T *info, AI_FRAG_FLAG frag,
     AI_PROTO_D("send packet len:%d", payload_len + AI_SIGN_LEN);
     AI_PROTO_D("send payload len:%d", payload_len);
     AI_PROTO_D("send total len:%d, send_len:%d", offset, uncrypt_len);
-    if (ai_basic_proto->transporter) {
+    if (ref_data) {
+        uint32_t data_offset = offset - AI_SIGN_LEN - info->len;
+        tuya_transporter_iovec_t iov[] = {
+            {.buf = (const uint8_t *)send_pkt_buf, .len = data_offset},
+            {.buf = (const uint8_t *)info->data, .len = info->len},
+            {.buf = (const uint8_t *)send_pkt_buf + data_offset + info->len, .len = AI_SIGN_LEN},
+        };
+        rt = tuya_transporter_writev(ai_basic_proto->transporter, iov, sizeof(iov) / sizeof(iov[0]), 0);
+        if (rt != offset) {
+            PR_ERR("send to cloud failed, rt:%d, len:%d", rt, offset);
+            goto EXIT;
+        } else {
+            rt = OPRT_OK;
+        }
+    } else if (ai_basic_proto->transporter) {
         rt = tuya_transporter_write(ai_basic_proto->transporter, (uint8_t *)send_pkt_buf, offset, 0);
         if (rt != offset) {
             PR_ERR("send to cloud failed, rt:%d, len:%d", rt, offset);
@@ -960,7 +1193,7 @@ static OPERATE_RET __ai_packet_write(AI_SEND_PACKET_T *info, AI_FRAG_FLAG frag,
     }
 
 EXIT:
-    OS_FREE(send_pkt_buf);
+    __ai_pkt_buf_put(send_pkt_buf);
     return rt;
 }
 
@@ -1491,12 +1724,13 @@ static int __ai_baisc_read_pkt_head(char *recv_buf)
 
 void tuya_ai_basic_pkt_free(char *data)
 {
-    if (data == ai_basic_proto->recv_frag_mng.data) {
+    // a payload may outlive the proto, it is then an allocated or pooled one
+    if (ai_basic_proto && (data == ai_basic_proto->recv_frag_mng.data)) {
         OS_FREE(data);
         ai_basic_proto->recv_frag_mng.data = NULL;
         memset(&ai_basic_proto->recv_frag_mng, 0, sizeof(AI_RECV_FRAG_MNG_T));
     } else {
-        OS_FREE(data);
+        __ai_pkt_buf_put(data);
     }
 }
 
@@ -1519,10 +1753,12 @@ OPERATE_RET tuya_ai_basic_pkt_read(char **out, uint32_t *out_len, AI_FRAG_FLAG *
     uint8_t calc_sign[AI_SIGN_LEN] = {0};
     uint8_t packet_sign[AI_SIGN_LEN] = {0};
     char *decrypt_buf = NULL;
-    char *recv_buf = ai_basic_proto->recv_buf;
-    TUYA_CHECK_NULL_RETURN(recv_buf, OPRT_COM_ERROR);
+    // the packet is read and decrypted in place, the payload is handed out
+    // in the same buffer and back to the pool through tuya_ai_basic_pkt_free
+    char *recv_buf = __ai_pkt_buf_get(AI_PKT_BUF_LEN);
+    TUYA_CHECK_NULL_RETURN(recv_buf, OPRT_MALLOC_FAILED);
 
-    memset(recv_buf, 0, sizeof(ai_basic_proto->recv_buf));
+    memset(recv_buf, 0, sizeof(AI_PACKET_HEAD_T) + AI_IV_LEN + sizeof(uint32_t));
     AI_PROTO_D("recv packet ing");
     int recv_len = __ai_baisc_read_pkt_head(recv_buf);
     if (recv_len <= 0) {
@@ -1542,7 +1778,7 @@ OPERATE_RET tuya_ai_basic_pkt_read(char **out, uint32_t *out_len, AI_FRAG_FLAG *
     AI_PROTO_D("recv head len:%d", head_len);
     AI_PROTO_D("recv packet len:%d", packet_len);
 
-    if (packet_len + head_len > sizeof(ai_basic_proto->recv_buf)) {
+    if (packet_len + head_len > AI_PKT_BUF_LEN - AI_ADD_PKT_LEN) {
         PR_ERR("recv packet too long, pkt len:%u, head len:%u", packet_len, head_len);
         recv_len = OPRT_RESOURCE_NOT_READY;
         goto EXIT;
@@ -1575,7 +1811,7 @@ OPERATE_RET tuya_ai_basic_pkt_read(char **out, uint32_t *out_len, AI_FRAG_FLAG *
         offset += recv_len;
     }
 
-    rt = __ai_packet_sign(recv_buf, calc_sign);
+    rt = __ai_packet_sign(&ai_basic_proto->sign_rx, recv_buf, calc_sign);
     if (OPRT_OK != rt) {
         PR_ERR("packet sign failed, rt:%d", rt);
         goto EXIT;
@@ -1594,14 +1830,24 @@ OPERATE_RET tuya_ai_basic_pkt_read(char **out, uint32_t *out_len, AI_FRAG_FLAG *
     }
 
     uint32_t decrypt_len = 0;
-    decrypt_buf = OS_MALLOC(packet_len + head_len + AI_ADD_PKT_LEN);
-    TUYA_CHECK_NULL_RETURN(decrypt_buf, OPRT_MALLOC_FAILED);
-    memset(decrypt_buf, 0, packet_len + head_len + AI_ADD_PKT_LEN);
-    rt = __ai_decrypt_packet(payload, payload_len, decrypt_buf, &decrypt_len);
+    rt = __ai_decrypt_packet(payload, payload_len, &decrypt_len);
     if (OPRT_OK != rt) {
         PR_ERR("decrypt packet failed, rt:%d", rt);
         goto EXIT;
     }
+    if (decrypt_len > payload_len) {
+        PR_ERR("decrypt len error, decrypt len:%u, payload len:%u", decrypt_len, payload_len);
+        recv_len = OPRT_COM_ERROR;
+        goto EXIT;
+    }
+    decrypt_buf = payload;
+    if (!__ai_pkt_buf_is_pooled(recv_buf)) {
+        // an allocated buffer is freed from its start
+        memmove(recv_buf, payload, decrypt_len);
+        decrypt_buf = recv_buf;
+    }
+    // the payload was followed by zeros when it was decrypted in a new buffer
+    memset(decrypt_buf + decrypt_len, 0, AI_ADD_PKT_LEN);
     AI_PROTO_D("decrypt len:%d", decrypt_len);
     AI_PROTO_D("frag flag:%d, sdk frag flag:%d", head->frag_flag, __ai_basic_get_frag_flag());
 
@@ -1615,6 +1861,17 @@ OPERATE_RET tuya_ai_basic_pkt_read(char **out, uint32_t *out_len, AI_FRAG_FLAG *
             }
         }
 
+        // a continued fragment goes after the started ones, within the origin length
+        if ((current_frag_flag == AI_PACKET_FRAG_ING) || (current_frag_flag == AI_PACKET_FRAG_END)) {
+            if ((NULL == ai_basic_proto->recv_frag_mng.data) ||
+                (decrypt_len > ai_basic_proto->recv_frag_mng.size - ai_basic_proto->recv_frag_mng.offset)) {
+                PR_ERR("recv frag packet out of order or too long, len:%d, offset:%d, size:%d", decrypt_len,
+                       ai_basic_proto->recv_frag_mng.offset, ai_basic_proto->recv_frag_mng.size);
+                recv_len = OPRT_COM_ERROR;
+                goto EXIT;
+            }
+        }
+
         AI_PROTO_D("frag flag:%d", head->frag_flag);
         AI_PROTO_D("frag mng info, flag:%d, offset:%d", ai_basic_proto->recv_frag_mng.frag_flag,
                    ai_basic_proto->recv_frag_mng.offset);
@@ -1648,11 +1905,13 @@ OPERATE_RET tuya_ai_basic_pkt_read(char **out, uint32_t *out_len, AI_FRAG_FLAG *
                 PR_ERR("malloc origin data failed len:%d", decrypt_len);
                 goto EXIT;
             }
+            ai_basic_proto->recv_frag_mng.size = frag_total_len;
             AI_PROTO_D("malloc recv_frag_mng data addr %p", ai_basic_proto->recv_frag_mng.data);
             memset(ai_basic_proto->recv_frag_mng.data, 0, frag_total_len);
             memcpy(ai_basic_proto->recv_frag_mng.data, decrypt_buf, decrypt_len);
             ai_basic_proto->recv_frag_mng.offset = decrypt_len;
-            OS_FREE(decrypt_buf);
+            __ai_pkt_buf_put(recv_buf);
+            recv_buf = NULL;
             decrypt_buf = NULL;
             rt = tuya_ai_basic_pkt_read(out, out_len, out_frag);
             if (rt != OPRT_OK) {
@@ -1663,7 +1922,8 @@ OPERATE_RET tuya_ai_basic_pkt_read(char **out, uint32_t *out_len, AI_FRAG_FLAG *
             memcpy(ai_basic_proto->recv_frag_mng.data + ai_basic_proto->recv_frag_mng.offset, decrypt_buf, decrypt_len);
             ai_basic_proto->recv_frag_mng.frag_flag = current_frag_flag;
             ai_basic_proto->recv_frag_mng.offset += decrypt_len;
-            OS_FREE(decrypt_buf);
+            __ai_pkt_buf_put(recv_buf);
+            recv_buf = NULL;
             decrypt_buf = NULL;
             rt = tuya_ai_basic_pkt_read(out, out_len, out_frag);
             if (rt != OPRT_OK) {
@@ -1674,7 +1934,8 @@ OPERATE_RET tuya_ai_basic_pkt_read(char **out, uint32_t *out_len, AI_FRAG_FLAG *
             memcpy(ai_basic_proto->recv_frag_mng.data + ai_basic_proto->recv_frag_mng.offset, decrypt_buf, decrypt_len);
             ai_basic_proto->recv_frag_mng.frag_flag = current_frag_flag;
             ai_basic_proto->recv_frag_mng.offset += decrypt_len;
-            OS_FREE(decrypt_buf);
+            __ai_pkt_buf_put(recv_buf);
+            recv_buf = NULL;
             decrypt_buf = NULL;
             *out = ai_basic_proto->recv_frag_mng.data;
             *out_len = ai_basic_proto->recv_frag_mng.offset;
@@ -1683,19 +1944,21 @@ OPERATE_RET tuya_ai_basic_pkt_read(char **out, uint32_t *out_len, AI_FRAG_FLAG *
             *out = decrypt_buf;
             *out_len = decrypt_len;
             *out_frag = AI_PACKET_NO_FRAG;
+            recv_buf = NULL;
         }
     } else {
         *out = decrypt_buf;
         *out_len = decrypt_len;
         *out_frag = head->frag_flag;
+        recv_buf = NULL;
     }
     AI_PROTO_D("recv packet len:%d", *out_len);
     return rt;
 
 EXIT:
-    if (decrypt_buf) {
-        OS_FREE(decrypt_buf);
-        decrypt_buf = NULL;
+    if (recv_buf) {
+        __ai_pkt_buf_put(recv_buf);
+        recv_buf = NULL;
     }
     if (ai_basic_proto->recv_frag_mng.data) {
         OS_FREE(ai_basic_proto->recv_frag_mng.data);
@@ -1823,7 +2086,7 @@ OPERATE_RET tuya_ai_auth_resp(void)
     AI_PAYLOAD_HEAD_T *packet = (AI_PAYLOAD_HEAD_T *)de_buf;
     if (packet->attribute_flag != AI_HAS_ATTR) {
         PR_ERR("auth resp packet has no attribute");
-        OS_FREE(de_buf);
+        tuya_ai_basic_pkt_free(de_buf);
         return OPRT_COM_ERROR;
     }
 
@@ -1839,7 +2102,7 @@ OPERATE_RET tuya_ai_auth_resp(void)
         PR_ERR("auth resp packet type error %d", packet->type);
         rt = OPRT_COM_ERROR;
     }
-    OS_FREE(de_buf);
+    tuya_ai_basic_pkt_free(de_buf);
     return rt;
 }
 
@@ -0,0 +1,488 @@
+/**
+ * @file test_tuya_ai_biz.cpp
+ * @brief unit test and benchmark of the AI biz send scheduler, the real send
+ * thread driving channels whose chunks are queued by the test
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mockcpp/mockcpp.hpp"
+
+#include "tuya_cloud_types.h"
+#include "tal_event.h"
+#include "tuya_ai_client.h"
+#include "tuya_ai_protocol.h"
+#include "tuya_ai_biz.h"
+
+USING_MOCKCPP_NS
+
+// same as tuya_ai_biz.c
+#ifndef AI_BIZ_SEND_READY_MAX
+#define AI_BIZ_SEND_READY_MAX 8
+#endif
+
+namespace {
+
+typedef std::chrono::steady_clock::time_point TIME_POINT_T;
+
+// a send channel, its get_cb hands out the chunks queued by the test
+struct Chan {
+    char tag;
+    int queued;
+    int got;
+    int freed;
+    bool hold;         // the next get blocks until hold is cleared
+    bool held;         // a get is blocked
+    bool del_self;     // the next get deletes its own session
+    OPERATE_RET del_rt;
+    TIME_POINT_T got_at;
+};
+
+const int CHAN_NUM = 5;
+Chan s_chan[CHAN_NUM];
+char s_chan_sid[CHAN_NUM][AI_UUID_V4_LEN];
+std::mutex s_mu;
+std::condition_variable s_cv;
+std::string s_order;
+char s_payload[16];
+
+EVENT_SUBSCRIBE_CB s_run_cb = NULL;
+int s_uuid_cnt = 0;
+std::atomic<uint32_t> s_loops(0);
+
+template <int N> OPERATE_RET get_chan(AI_BIZ_ATTR_INFO_T *attr, AI_BIZ_HEAD_INFO_T *head, char **data)
+{
+    std::unique_lock<std::mutex> lk(s_mu);
+    Chan &c = s_chan[N];
+    if (c.queued == 0) {
+        return OPRT_RESOURCE_NOT_READY;
+    }
+    if (c.hold) {
+        c.held = true;
+        s_cv.notify_all();
+        s_cv.wait(lk, [&] { return !c.hold; });
+        c.held = false;
+    }
+    c.queued--;
+    c.got++;
+    c.got_at = std::chrono::steady_clock::now();
+    s_order += c.tag;
+    s_cv.notify_all();
+    head->len = sizeof(s_payload);
+    *data = s_payload;
+    if (c.del_self) {
+        c.del_self = false;
+        lk.unlock();
+        OPERATE_RET rt = tuya_ai_biz_del_session(s_chan_sid[N], AI_CODE_OK);
+        lk.lock();
+        c.del_rt = rt;
+    }
+    return OPRT_OK;
+}
+
+template <int N> void free_chan(char *data)
+{
+    std::lock_guard<std::mutex> lk(s_mu);
+    s_chan[N].freed++;
+    s_cv.notify_all();
+}
+
+uint16_t chan_id(int n)
+{
+    return (uint16_t)(101 + 2 * n);
+}
+
+AI_BIZ_SEND_DATA_T chan_send(int n, AI_PACKET_PT type)
+{
+    static const AI_BIZ_SEND_GET_CB gets[CHAN_NUM] = {get_chan<0>, get_chan<1>, get_chan<2>, get_chan<3>,
+                                                       get_chan<4>};
+    static const AI_BIZ_SEND_FREE_CB frees[CHAN_NUM] = {free_chan<0>, free_chan<1>, free_chan<2>, free_chan<3>,
+                                                         free_chan<4>};
+    AI_BIZ_SEND_DATA_T send = {};
+    send.type = type;
+    send.id = chan_id(n);
+    send.get_cb = gets[n];
+    send.free_cb = frees[n];
+    return send;
+}
+
+// a session of the given channels, each channel belongs to one session
+OPERATE_RET crt_session(std::vector<std::pair<int, AI_PACKET_PT>> chans, char *sid)
+{
+    AI_SESSION_CFG_T cfg = {};
+    for (auto &chan : chans) {
+        cfg.send[cfg.send_num++] = chan_send(chan.first, chan.second);
+    }
+    OPERATE_RET rt = tuya_ai_biz_crt_session(1, &cfg, NULL, 0, sid);
+    for (auto &chan : chans) {
+        memcpy(s_chan_sid[chan.first], sid, AI_UUID_V4_LEN);
+    }
+    return rt;
+}
+
+void queue(int n, int count)
+{
+    std::lock_guard<std::mutex> lk(s_mu);
+    s_chan[n].queued += count;
+}
+
+template <typename PRED> bool wait_for(PRED pred, int ms = 2000)
+{
+    std::unique_lock<std::mutex> lk(s_mu);
+    return s_cv.wait_for(lk, std::chrono::milliseconds(ms), pred);
+}
+
+void release(int n)
+{
+    std::lock_guard<std::mutex> lk(s_mu);
+    s_chan[n].hold = false;
+    s_cv.notify_all();
+}
+
+OPERATE_RET stub_subscribe(const char *name, const char *desc, const EVENT_SUBSCRIBE_CB cb, SUBSCRIBE_TYPE_E type)
+{
+    if (!strcmp(name, EVENT_AI_CLIENT_RUN)) {
+        s_run_cb = cb;
+    }
+    return OPRT_OK;
+}
+
+OPERATE_RET stub_unsubscribe(const char *name, const char *desc, EVENT_SUBSCRIBE_CB cb)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET stub_publish(const char *name, void *data)
+{
+    return OPRT_OK;
+}
+
+void stub_reg_cb(AI_BASIC_DATA_HANDLE cb)
+{
+}
+
+// called once per turn of the send thread
+uint8_t stub_is_ready(void)
+{
+    s_loops++;
+    return true;
+}
+
+void stub_start_ping(void)
+{
+}
+
+OPERATE_RET stub_uuid(char *uuid_str)
+{
+    snprintf(uuid_str, AI_UUID_V4_LEN, "ut-session-%d", ++s_uuid_cnt);
+    return OPRT_OK;
+}
+
+OPERATE_RET stub_session_new(AI_SESSION_NEW_ATTR_T *session, char *data, uint32_t len)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET stub_session_close(char *session_id, AI_STATUS_CODE code)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET stub_audio(AI_AUDIO_ATTR_T *audio, char *data, uint32_t len, uint32_t total_len,
+                       AI_PACKET_WRITER_T *writer)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET stub_video(AI_VIDEO_ATTR_T *video, char *data, uint32_t len, uint32_t total_len,
+                       AI_PACKET_WRITER_T *writer)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET stub_text(AI_TEXT_ATTR_T *text, char *data, uint32_t len, uint32_t total_len,
+                      AI_PACKET_WRITER_T *writer)
+{
+    return OPRT_OK;
+}
+
+} // namespace
+
+// one biz and its send thread for the suite, each test deletes its sessions
+class AiBizTest : public ::testing::Test {
+  protected:
+    char blocker_sid[AI_UUID_V4_LEN] = {0};
+
+    static void SetUpTestSuite()
+    {
+        MOCKER(tal_event_subscribe).stubs().will(invoke(stub_subscribe));
+        MOCKER(tal_event_unsubscribe).stubs().will(invoke(stub_unsubscribe));
+        MOCKER(tal_event_publish).stubs().will(invoke(stub_publish));
+        MOCKER(tuya_ai_client_reg_cb).stubs().will(invoke(stub_reg_cb));
+        MOCKER(tuya_ai_client_is_ready).stubs().will(invoke(stub_is_ready));
+        MOCKER(tuya_ai_client_start_ping).stubs().will(invoke(stub_start_ping));
+        MOCKER(tuya_ai_basic_uuid_v4).stubs().will(invoke(stub_uuid));
+        MOCKER(tuya_ai_basic_session_new).stubs().will(invoke(stub_session_new));
+        MOCKER(tuya_ai_basic_session_close).stubs().will(invoke(stub_session_close));
+        MOCKER(tuya_ai_basic_audio).stubs().will(invoke(stub_audio));
+        MOCKER(tuya_ai_basic_video).stubs().will(invoke(stub_video));
+        MOCKER(tuya_ai_basic_text).stubs().will(invoke(stub_text));
+
+        tuya_ai_biz_init();
+        ASSERT_TRUE(s_run_cb != NULL);
+        ASSERT_EQ(OPRT_OK, s_run_cb(NULL));
+    }
+
+    static void TearDownTestSuite()
+    {
+        tuya_ai_biz_deinit();
+        // the send thread leaves on its next turn, before the stubs go
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        GlobalMockObject::verify();
+    }
+
+    void SetUp() override
+    {
+        std::lock_guard<std::mutex> lk(s_mu);
+        for (int n = 0; n < CHAN_NUM; n++) {
+            s_chan[n] = Chan();
+            s_chan[n].tag = "AVTBX"[n];
+        }
+        s_order.clear();
+    }
+
+    void TearDown() override
+    {
+        // a failed test may leave the send thread held
+        for (int n = 0; n < CHAN_NUM; n++) {
+            release(n);
+        }
+        if (blocker_sid[0]) {
+            tuya_ai_biz_del_session(blocker_sid, AI_CODE_OK);
+        }
+    }
+
+    // a polled channel in a session of its own, whose get holds the send thread until release(4)
+    void hold_send_thread()
+    {
+        ASSERT_EQ(OPRT_OK, crt_session({{4, AI_PT_TEXT}}, blocker_sid));
+        {
+            std::lock_guard<std::mutex> lk(s_mu);
+            s_chan[4].hold = true;
+            s_chan[4].queued = 1;
+        }
+        ASSERT_TRUE(wait_for([] { return s_chan[4].held; }));
+    }
+};
+
+TEST_F(AiBizTest, WeightedOrder)
+{
+    char sid[AI_UUID_V4_LEN] = {0};
+
+    // the channels only exist once the thread is held, so none of them is polled
+    hold_send_thread();
+    ASSERT_EQ(OPRT_OK, crt_session({{0, AI_PT_AUDIO}, {1, AI_PT_VIDEO}, {2, AI_PT_TEXT}}, sid));
+    for (int n = 0; n < 3; n++) {
+        queue(n, AI_BIZ_SEND_READY_MAX);
+        for (int i = 0; i < AI_BIZ_SEND_READY_MAX; i++) {
+            ASSERT_EQ(OPRT_OK, tuya_ai_biz_send_ready(chan_id(n)));
+        }
+    }
+    release(4);
+    ASSERT_TRUE(wait_for([] { return s_order.size() == 1 + 3 * AI_BIZ_SEND_READY_MAX; }));
+
+    // audio 4, video 2, text 1: a round of seven, audio leading
+    std::string order = s_order.substr(1);
+    EXPECT_EQ("AVATAVA", order.substr(0, 7));
+    EXPECT_EQ(AI_BIZ_SEND_READY_MAX, (int)std::count(order.begin(), order.end(), 'T'));
+    EXPECT_EQ(AI_BIZ_SEND_READY_MAX, s_chan[0].freed);
+    EXPECT_EQ(AI_BIZ_SEND_READY_MAX, s_chan[2].freed);
+    EXPECT_EQ(OPRT_OK, tuya_ai_biz_del_session(sid, AI_CODE_OK));
+}
+
+TEST_F(AiBizTest, ReadyBacklogIsBounded)
+{
+    char sid[AI_UUID_V4_LEN] = {0};
+    uint16_t id = chan_id(0);
+
+    hold_send_thread();
+    ASSERT_EQ(OPRT_OK, crt_session({{0, AI_PT_AUDIO}}, sid));
+    queue(0, AI_BIZ_SEND_READY_MAX);
+    for (int i = 0; i < AI_BIZ_SEND_READY_MAX; i++) {
+        ASSERT_EQ(OPRT_OK, tuya_ai_biz_send_ready(id)) << i;
+    }
+    EXPECT_EQ(OPRT_EXCEED_UPPER_LIMIT, tuya_ai_biz_send_ready(id));
+    EXPECT_EQ(OPRT_NOT_FOUND, tuya_ai_biz_send_ready(999));
+
+    // the producer keeps the refused chunk and signals it once the backlog drains
+    release(4);
+    ASSERT_TRUE(wait_for([] { return s_chan[0].got == AI_BIZ_SEND_READY_MAX; }));
+    queue(0, 1);
+    EXPECT_EQ(OPRT_OK, tuya_ai_biz_send_ready(id));
+    EXPECT_TRUE(wait_for([] { return s_chan[0].got == AI_BIZ_SEND_READY_MAX + 1; }));
+    EXPECT_EQ(OPRT_OK, tuya_ai_biz_del_session(sid, AI_CODE_OK));
+}
+
+TEST_F(AiBizTest, DeleteWaitsForChunkInFlight)
+{
+    char sid[AI_UUID_V4_LEN] = {0};
+    uint16_t id = chan_id(0);
+    std::atomic<bool> deleted(false);
+    int freed_at_delete = -1;
+
+    ASSERT_EQ(OPRT_OK, crt_session({{0, AI_PT_AUDIO}}, sid));
+    {
+        std::lock_guard<std::mutex> lk(s_mu);
+        s_chan[0].hold = true;
+        s_chan[0].queued = 2;
+    }
+    ASSERT_EQ(OPRT_OK, tuya_ai_biz_send_ready(id));
+    ASSERT_TRUE(wait_for([] { return s_chan[0].held; }));
+
+    std::thread deleter([&] {
+        EXPECT_EQ(OPRT_OK, tuya_ai_biz_del_session(sid, AI_CODE_OK));
+        std::lock_guard<std::mutex> lk(s_mu);
+        freed_at_delete = s_chan[0].freed;
+        deleted = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(deleted.load());
+    // the session is closing, no more chunks are signalled on it
+    EXPECT_EQ(OPRT_NOT_FOUND, tuya_ai_biz_send_ready(id));
+
+    release(0);
+    deleter.join();
+    EXPECT_EQ(1, freed_at_delete);
+    EXPECT_TRUE(NULL == tuya_ai_biz_get_session_cfg(sid));
+
+    // the chunk still queued is never got
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(1, s_chan[0].got);
+}
+
+TEST_F(AiBizTest, ConcurrentDeletesOfBusySessions)
+{
+    char sid_a[AI_UUID_V4_LEN] = {0};
+    char sid_b[AI_UUID_V4_LEN] = {0};
+    std::atomic<int> deleted(0);
+
+    // both polled channels are taken in the same poll round, so both sessions are busy
+    hold_send_thread();
+    ASSERT_EQ(OPRT_OK, crt_session({{0, AI_PT_AUDIO}}, sid_a));
+    ASSERT_EQ(OPRT_OK, crt_session({{1, AI_PT_VIDEO}}, sid_b));
+    {
+        std::lock_guard<std::mutex> lk(s_mu);
+        s_chan[0].hold = true;
+        s_chan[0].queued = 1;
+        s_chan[1].queued = 1;
+    }
+    release(4);
+    ASSERT_TRUE(wait_for([] { return s_chan[0].held; }));
+
+    std::thread deleter_a([&] {
+        EXPECT_EQ(OPRT_OK, tuya_ai_biz_del_session(sid_a, AI_CODE_OK));
+        deleted++;
+    });
+    std::thread deleter_b([&] {
+        EXPECT_EQ(OPRT_OK, tuya_ai_biz_del_session(sid_b, AI_CODE_OK));
+        deleted++;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(0, deleted.load());
+
+    // the chunk of A ends, the one of B is skipped as its session is closing
+    release(0);
+    for (int i = 0; (i < 200) && (deleted.load() < 2); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(2, deleted.load());
+    if (deleted.load() < 2) {
+        deleter_a.detach();
+        deleter_b.detach();
+        return;
+    }
+    deleter_a.join();
+    deleter_b.join();
+    EXPECT_EQ(1, s_chan[0].got);
+    EXPECT_EQ(0, s_chan[1].got);
+    EXPECT_TRUE(NULL == tuya_ai_biz_get_session_cfg(sid_a));
+    EXPECT_TRUE(NULL == tuya_ai_biz_get_session_cfg(sid_b));
+}
+
+TEST_F(AiBizTest, DeleteFromOwnGetCb)
+{
+    char sid[AI_UUID_V4_LEN] = {0};
+    char next_sid[AI_UUID_V4_LEN] = {0};
+    uint16_t id = chan_id(0);
+
+    ASSERT_EQ(OPRT_OK, crt_session({{0, AI_PT_AUDIO}}, sid));
+    {
+        std::lock_guard<std::mutex> lk(s_mu);
+        s_chan[0].del_self = true;
+        s_chan[0].queued = 1;
+    }
+    ASSERT_EQ(OPRT_OK, tuya_ai_biz_send_ready(id));
+    ASSERT_TRUE(wait_for([] { return s_chan[0].freed == 1; }));
+    EXPECT_EQ(OPRT_OK, s_chan[0].del_rt);
+
+    // the slot is cleared once the chunk ends, and can be used again
+    for (int i = 0; (i < 50) && (NULL != tuya_ai_biz_get_session_cfg(sid)); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_TRUE(NULL == tuya_ai_biz_get_session_cfg(sid));
+    ASSERT_EQ(OPRT_OK, crt_session({{0, AI_PT_AUDIO}}, next_sid));
+    EXPECT_TRUE(NULL != tuya_ai_biz_get_session_cfg(next_sid));
+    EXPECT_EQ(OPRT_OK, tuya_ai_biz_del_session(next_sid, AI_CODE_OK));
+}
+
+TEST_F(AiBizTest, BenchmarkLatencyAndIdleWakeups)
+{
+    const int loops = 200;
+
+    for (int polled = 0; polled < 2; polled++) {
+        char sid[AI_UUID_V4_LEN] = {0};
+        uint16_t id = chan_id(0);
+        std::vector<double> us;
+
+        ASSERT_EQ(OPRT_OK, crt_session({{0, AI_PT_AUDIO}}, sid));
+        if (!polled) {
+            // signalled from the first chunk on, so it is never polled
+            queue(0, 1);
+            ASSERT_EQ(OPRT_OK, tuya_ai_biz_send_ready(id));
+            ASSERT_TRUE(wait_for([] { return s_chan[0].got == 1; }));
+        }
+        for (int i = 0; i < loops; i++) {
+            int got = s_chan[0].got;
+            TIME_POINT_T start = std::chrono::steady_clock::now();
+            queue(0, 1);
+            if (!polled) {
+                ASSERT_EQ(OPRT_OK, tuya_ai_biz_send_ready(id));
+            }
+            ASSERT_TRUE(wait_for([&] { return s_chan[0].got == got + 1; })) << i;
+            us.push_back(std::chrono::duration<double, std::micro>(s_chan[0].got_at - start).count());
+        }
+
+        // nothing queued, count the turns of the send thread
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        uint32_t loops_before = s_loops.load();
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        uint32_t idle_wakeups = s_loops.load() - loops_before;
+
+        std::sort(us.begin(), us.end());
+        printf("[   INFO   ] ai biz %s: %d chunks, p50 %.0f us, p99 %.0f us, %.0f idle wakeups/s\n",
+               polled ? "polled   " : "signalled", loops, us[us.size() / 2], us[us.size() * 99 / 100],
+               idle_wakeups * 2.0);
+        if (!polled) {
+            EXPECT_LE(idle_wakeups, 1u);
+        }
+        EXPECT_EQ(OPRT_OK, tuya_ai_biz_del_session(sid, AI_CODE_OK));
+        SetUp();
+    }
+}
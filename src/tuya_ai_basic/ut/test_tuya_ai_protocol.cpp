@@ -0,0 +1,532 @@
+/**
+ * @file test_tuya_ai_protocol.cpp
+ * @brief unit test and benchmark of the AI packet read and send paths, over
+ * an in-memory transporter and a peer that signs and encrypts as the cloud
+ */
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mockcpp/mockcpp.hpp"
+
+#include "tuya_cloud_types.h"
+#include "tal_memory.h"
+#include "tal_time_service.h"
+#include "tkl_memory.h"
+#include "uni_random.h"
+#include "cJSON.h"
+#include "mbedtls/gcm.h"
+#include "mbedtls/hkdf.h"
+#include "mbedtls/md.h"
+#include "atop_base.h"
+#include "tuya_iot.h"
+#include "tuya_transporter.h"
+#include "tuya_ai_protocol.h"
+
+USING_MOCKCPP_NS
+
+// same as tuya_ai_protocol.c
+#ifndef AI_PKT_POOL_NUM
+#define AI_PKT_POOL_NUM 1
+#endif
+#define AI_PKT_BUF_LEN    (AI_MAX_FRAGMENT_LENGTH + 2 * 128)
+#define AI_SIGN_EDGE_LEN  32
+
+namespace {
+
+const char *s_localkey = "ai0test1key2abcd";
+tuya_iot_client_t s_client;
+int s_random_calls = 0;
+
+// the bytes written by the device are read back by it, as if the cloud echoed them
+std::string s_wire;
+size_t s_wire_pos = 0;
+
+std::atomic<uint32_t> s_alloc_cnt(0);
+std::atomic<uint32_t> s_buf_alloc_cnt(0);
+std::atomic<uint32_t> s_free_cnt(0);
+
+tuya_iot_client_t *stub_client_get(void)
+{
+    return &s_client;
+}
+
+// the salts of the crypt and sign keys and the iv, one fill per call
+int stub_random_string(char *dst, int size)
+{
+    memset(dst, 0x11 * (++s_random_calls), size);
+    return OPRT_OK;
+}
+
+TIME_T stub_posix(void)
+{
+    return 1700000000;
+}
+
+int stub_atop_request(const atop_base_request_t *request, atop_base_response_t *response)
+{
+    response->success = true;
+    response->result = cJSON_Parse("{\"tcpport\":443,\"username\":\"u\",\"credential\":\"c\",\"hosts\":[\"127.0.0.1\"],"
+                                   "\"expire\":3600,\"bizCode\":1,\"clientId\":\"id\",\"derivedAlgorithm\":\"a\","
+                                   "\"derivedIv\":\"iv\"}");
+    return OPRT_OK;
+}
+
+OPERATE_RET stub_connect(tuya_transporter_t t, const char *host, int port, int timeout_ms)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET stub_close(tuya_transporter_t t)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET stub_write(tuya_transporter_t t, uint8_t *buf, int len, int timeout_ms)
+{
+    s_wire.append((const char *)buf, len);
+    return len;
+}
+
+OPERATE_RET stub_writev(tuya_transporter_t t, const tuya_transporter_iovec_t *iov, int iovcnt, int timeout_ms)
+{
+    int total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        s_wire.append((const char *)iov[i].buf, iov[i].len);
+        total += iov[i].len;
+    }
+    return total;
+}
+
+OPERATE_RET stub_read(tuya_transporter_t t, uint8_t *buf, int len, int timeout_ms)
+{
+    int left = (int)(s_wire.size() - s_wire_pos);
+    if (left <= 0) {
+        return OPRT_RESOURCE_NOT_READY;
+    }
+    // hand out a packet in pieces as a socket does
+    int n = len < left ? len : left;
+    n = n > 1500 ? 1500 : n;
+    memcpy(buf, s_wire.data() + s_wire_pos, n);
+    s_wire_pos += n;
+    return n;
+}
+
+void *count_malloc(size_t size)
+{
+    s_alloc_cnt++;
+    if (size >= AI_PKT_BUF_LEN) {
+        s_buf_alloc_cnt++;
+    }
+    return tkl_system_malloc(size);
+}
+
+void count_free(void *ptr)
+{
+    if (ptr) {
+        s_free_cnt++;
+    }
+    tkl_system_free(ptr);
+}
+
+// signs and encrypts packets as the cloud does, with the keys the device derives
+class Peer {
+  public:
+    uint8_t crypt_key[AI_KEY_LEN];
+    uint8_t sign_key[AI_KEY_LEN];
+    uint8_t iv[AI_IV_LEN];
+    uint16_t sequence = 0;
+
+    Peer()
+    {
+        // the salts of the first two fills, the iv of the third
+        uint8_t salt[AI_RANDOM_LEN];
+        const mbedtls_md_info_t *md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+        memset(salt, 0x11, sizeof(salt));
+        mbedtls_hkdf(md, salt, sizeof(salt), (const uint8_t *)s_localkey, strlen(s_localkey), NULL, 0, crypt_key,
+                     AI_KEY_LEN);
+        memset(salt, 0x22, sizeof(salt));
+        mbedtls_hkdf(md, salt, sizeof(salt), (const uint8_t *)s_localkey, strlen(s_localkey), NULL, 0, sign_key,
+                     AI_KEY_LEN);
+        memset(iv, 0x33, sizeof(iv));
+    }
+
+    // pkcs padding, then the cipher text and the tag
+    std::string seal(std::string plain, bool pad = true)
+    {
+        if (pad) {
+            size_t cz = 16 - plain.size() % 16;
+            plain.append(cz, (char)cz);
+        }
+        std::string out(plain.size() + AI_GCM_TAG_LEN, '\0');
+        mbedtls_gcm_context gcm;
+        mbedtls_gcm_init(&gcm);
+        mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, crypt_key, AI_KEY_LEN * 8);
+        mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, plain.size(), iv, AI_IV_LEN, NULL, 0,
+                                  (const uint8_t *)plain.data(), (uint8_t *)&out[0], AI_GCM_TAG_LEN,
+                                  (uint8_t *)&out[plain.size()]);
+        mbedtls_gcm_free(&gcm);
+        return out;
+    }
+
+    // payload as it goes on the wire, the sign is computed as the device does
+    std::string packet(AI_FRAG_FLAG frag, const std::string &payload, bool with_iv = true)
+    {
+        AI_PACKET_HEAD_T head = {};
+        head.version = 0x01;
+        head.sequence = htons(++sequence);
+        head.iv_flag = with_iv;
+        head.security_level = AI_PACKET_SL4;
+        head.frag_flag = frag;
+
+        std::string pkt((const char *)&head, sizeof(head));
+        if (with_iv) {
+            pkt.append((const char *)iv, AI_IV_LEN);
+        }
+        uint32_t len = htonl(payload.size() + AI_SIGN_LEN);
+        pkt.append((const char *)&len, sizeof(len));
+        size_t head_len = pkt.size();
+        pkt += payload;
+
+        uint8_t sign_data[2 * AI_SIGN_EDGE_LEN] = {0};
+        size_t sign_len = sizeof(sign_data);
+        if (pkt.size() <= sizeof(sign_data)) {
+            memcpy(sign_data, pkt.data(), pkt.size());
+            sign_len = pkt.size();
+        } else {
+            memcpy(sign_data, pkt.data(), AI_SIGN_EDGE_LEN);
+            size_t copy_len = payload.size() > AI_SIGN_EDGE_LEN ? AI_SIGN_EDGE_LEN : payload.size();
+            memcpy(sign_data + AI_SIGN_EDGE_LEN, pkt.data() + head_len + payload.size() - copy_len, copy_len);
+        }
+        uint8_t sign[AI_SIGN_LEN];
+        mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), sign_key, AI_KEY_LEN, sign_data, sign_len,
+                        sign);
+        pkt.append((const char *)sign, sizeof(sign));
+        return pkt;
+    }
+
+    // payload head, origin length and data of a whole or a first fragment
+    static std::string plain(const std::string &data, uint32_t origin_len)
+    {
+        AI_PAYLOAD_HEAD_T head = {};
+        head.attribute_flag = AI_NO_ATTR;
+        head.type = AI_PT_TEXT;
+        uint32_t len = htonl(origin_len);
+        return std::string((const char *)&head, sizeof(head)) + std::string((const char *)&len, sizeof(len)) + data;
+    }
+};
+
+std::string pattern(size_t len, int seed)
+{
+    std::string s(len, '\0');
+    for (size_t i = 0; i < len; i++) {
+        s[i] = (char)(i * 31 + seed);
+    }
+    return s;
+}
+
+// the data of a whole packet, after its payload head and origin length
+std::string data_of(const char *out, uint32_t out_len)
+{
+    size_t skip = sizeof(AI_PAYLOAD_HEAD_T) + sizeof(uint32_t);
+    return out_len < skip ? std::string() : std::string(out + skip, out_len - skip);
+}
+
+OPERATE_RET send_text(const std::string &data)
+{
+    AI_SEND_PACKET_T pkt = {};
+    pkt.type = AI_PT_TEXT;
+    pkt.data = (char *)data.data();
+    pkt.len = data.size();
+    pkt.total_len = data.size();
+    return tuya_ai_basic_pkt_send(&pkt);
+}
+
+OPERATE_RET read_packet(char **out, uint32_t *out_len)
+{
+    AI_FRAG_FLAG frag = AI_PACKET_NO_FRAG;
+    *out = NULL;
+    *out_len = 0;
+    return tuya_ai_basic_pkt_read(out, out_len, &frag);
+}
+
+void proto_up()
+{
+    s_random_calls = 0;
+    ASSERT_EQ(OPRT_OK, tuya_ai_basic_atop_req());
+    ASSERT_EQ(OPRT_OK, tuya_ai_basic_connect());
+}
+
+class AiProtocolTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        memset(&s_client, 0, sizeof(s_client));
+        strcpy(s_client.activate.localkey, s_localkey);
+        s_wire.clear();
+        s_wire_pos = 0;
+
+        MOCKER(tuya_iot_client_get).stubs().will(invoke(stub_client_get));
+        MOCKER(uni_random_string).stubs().will(invoke(stub_random_string));
+        MOCKER(tal_time_get_posix).stubs().will(invoke(stub_posix));
+        MOCKER(atop_base_request).stubs().will(invoke(stub_atop_request));
+        MOCKER(tuya_transporter_connect).stubs().will(invoke(stub_connect));
+        MOCKER(tuya_transporter_close).stubs().will(invoke(stub_close));
+        MOCKER(tuya_transporter_write).stubs().will(invoke(stub_write));
+        MOCKER(tuya_transporter_writev).stubs().will(invoke(stub_writev));
+        MOCKER(tuya_transporter_read).stubs().will(invoke(stub_read));
+        proto_up();
+    }
+
+    void TearDown() override
+    {
+        tuya_ai_basic_disconnect();
+        GlobalMockObject::verify();
+    }
+
+    // a crafted packet is read as the only thing on the wire
+    OPERATE_RET read_crafted(const std::string &pkt, char **out, uint32_t *out_len)
+    {
+        s_wire = pkt;
+        s_wire_pos = 0;
+        return read_packet(out, out_len);
+    }
+
+    // a whole packet from the peer still reads after a refused one
+    void expect_readable(Peer &peer)
+    {
+        char *out = NULL;
+        uint32_t out_len = 0;
+        std::string data = pattern(40, 7);
+        ASSERT_EQ(OPRT_OK,
+                  read_crafted(peer.packet(AI_PACKET_NO_FRAG, peer.seal(Peer::plain(data, data.size()))), &out, &out_len));
+        EXPECT_EQ(data, data_of(out, out_len));
+        tuya_ai_basic_pkt_free(out);
+    }
+};
+
+} // namespace
+
+TEST_F(AiProtocolTest, LoopbackRoundTrip)
+{
+    for (size_t len : {1, 31, 32, 64, 65, 1000, 4000}) {
+        std::string data = pattern(len, (int)len);
+        char *out = NULL;
+        uint32_t out_len = 0;
+
+        ASSERT_EQ(OPRT_OK, send_text(data));
+        ASSERT_EQ(OPRT_OK, read_packet(&out, &out_len)) << len;
+        EXPECT_EQ(AI_PT_TEXT, tuya_ai_basic_get_pkt_type(out));
+        EXPECT_EQ(data, data_of(out, out_len)) << len;
+        tuya_ai_basic_pkt_free(out);
+    }
+    EXPECT_EQ(s_wire.size(), s_wire_pos);
+}
+
+TEST_F(AiProtocolTest, FragmentsAreReassembled)
+{
+    std::string data = pattern(2 * AI_MAX_FRAGMENT_LENGTH + 100, 3);
+    char *out = NULL;
+    uint32_t out_len = 0;
+
+    ASSERT_EQ(OPRT_OK, send_text(data));
+    ASSERT_EQ(OPRT_OK, read_packet(&out, &out_len));
+    EXPECT_EQ(data, data_of(out, out_len));
+    tuya_ai_basic_pkt_free(out);
+    EXPECT_EQ(s_wire.size(), s_wire_pos);
+}
+
+TEST_F(AiProtocolTest, ShortAndTaglessPayloadsAreRefused)
+{
+    Peer peer;
+
+    // nothing, less than a block, and a tag with no cipher text before it
+    for (size_t len : {0, 5, AI_GCM_TAG_LEN}) {
+        char *out = NULL;
+        uint32_t out_len = 0;
+        EXPECT_NE(OPRT_OK, read_crafted(peer.packet(AI_PACKET_NO_FRAG, pattern(len, 1)), &out, &out_len)) << len;
+        EXPECT_EQ(nullptr, out);
+        expect_readable(peer);
+    }
+}
+
+TEST_F(AiProtocolTest, PaddedEmptyPayload)
+{
+    Peer peer;
+    char *out = NULL;
+    uint32_t out_len = 0;
+
+    // a block of padding alone decrypts to nothing, it is handed out empty
+    ASSERT_EQ(OPRT_OK, read_crafted(peer.packet(AI_PACKET_NO_FRAG, peer.seal(std::string(16, (char)16), false)), &out,
+                                    &out_len));
+    EXPECT_EQ(0u, out_len);
+    tuya_ai_basic_pkt_free(out);
+    expect_readable(peer);
+
+    // a padding longer than the block is refused
+    out = NULL;
+    std::string bad = std::string(15, 'x') + (char)0x40;
+    EXPECT_NE(OPRT_OK, read_crafted(peer.packet(AI_PACKET_NO_FRAG, peer.seal(bad, false)), &out, &out_len));
+    EXPECT_EQ(nullptr, out);
+    expect_readable(peer);
+}
+
+TEST_F(AiProtocolTest, OrphanFragmentsAreRefused)
+{
+    Peer peer;
+    char *out = NULL;
+    uint32_t out_len = 0;
+
+    // the iv of the continued fragments is the one of the last whole packet
+    expect_readable(peer);
+    for (AI_FRAG_FLAG frag : {AI_PACKET_FRAG_ING, AI_PACKET_FRAG_END}) {
+        EXPECT_NE(OPRT_OK, read_crafted(peer.packet(frag, peer.seal(pattern(100, 2)), false), &out, &out_len)) << frag;
+        EXPECT_EQ(nullptr, out);
+        expect_readable(peer);
+    }
+}
+
+TEST_F(AiProtocolTest, OversizedFragmentIsRefused)
+{
+    Peer peer;
+    char *out = NULL;
+    uint32_t out_len = 0;
+
+    // 10 of 20 bytes come first, the next fragment has 200
+    std::string start = peer.packet(AI_PACKET_FRAG_START, peer.seal(Peer::plain(pattern(10, 4), 20)));
+    std::string more = peer.packet(AI_PACKET_FRAG_ING, peer.seal(pattern(200, 5)), false);
+    EXPECT_NE(OPRT_OK, read_crafted(start + more, &out, &out_len));
+    EXPECT_EQ(nullptr, out);
+
+    // the started message is dropped, a fragment after it is an orphan
+    expect_readable(peer);
+    EXPECT_NE(OPRT_OK, read_crafted(peer.packet(AI_PACKET_FRAG_END, peer.seal(pattern(10, 6)), false), &out, &out_len));
+    expect_readable(peer);
+
+    // one that fits is reassembled
+    start = peer.packet(AI_PACKET_FRAG_START, peer.seal(Peer::plain(pattern(10, 4), 20)));
+    std::string end = peer.packet(AI_PACKET_FRAG_END, peer.seal(pattern(10, 5)), false);
+    ASSERT_EQ(OPRT_OK, read_crafted(start + end, &out, &out_len));
+    EXPECT_EQ(pattern(10, 4) + pattern(10, 5), data_of(out, out_len));
+    tuya_ai_basic_pkt_free(out);
+}
+
+TEST_F(AiProtocolTest, ExhaustedPoolFallsBackToMalloc)
+{
+    std::vector<char *> held;
+    char *out = NULL;
+    uint32_t out_len = 0;
+
+    MOCKER(tal_malloc).stubs().will(invoke(count_malloc));
+    s_buf_alloc_cnt = 0;
+
+    // each payload held keeps its buffer out of the pool
+    for (int i = 0; i < AI_PKT_POOL_NUM; i++) {
+        ASSERT_EQ(OPRT_OK, send_text(pattern(100, i)));
+        ASSERT_EQ(OPRT_OK, read_packet(&out, &out_len));
+        held.push_back(out);
+    }
+    EXPECT_EQ(0u, s_buf_alloc_cnt.load());
+
+    // the next is read in an allocated buffer, its payload moved to the start
+    ASSERT_EQ(OPRT_OK, send_text(pattern(100, 9)));
+    ASSERT_EQ(OPRT_OK, read_packet(&out, &out_len));
+    EXPECT_EQ(1u, s_buf_alloc_cnt.load());
+    EXPECT_EQ(pattern(100, 9), data_of(out, out_len));
+    tuya_ai_basic_pkt_free(out);
+
+    for (size_t i = 0; i < held.size(); i++) {
+        EXPECT_EQ(pattern(100, (int)i), data_of(held[i], 100 + 5));
+        tuya_ai_basic_pkt_free(held[i]);
+    }
+
+    // all back in the pool
+    s_buf_alloc_cnt = 0;
+    ASSERT_EQ(OPRT_OK, send_text(pattern(100, 8)));
+    ASSERT_EQ(OPRT_OK, read_packet(&out, &out_len));
+    EXPECT_EQ(0u, s_buf_alloc_cnt.load());
+    tuya_ai_basic_pkt_free(out);
+}
+
+TEST_F(AiProtocolTest, PayloadOutlivesDisconnect)
+{
+    char *out = NULL;
+    uint32_t out_len = 0;
+
+    MOCKER(tal_malloc).stubs().will(invoke(count_malloc));
+    MOCKER(tal_free).stubs().will(invoke(count_free));
+
+    // the pool goes with the last buffer put back
+    ASSERT_EQ(OPRT_OK, send_text(pattern(100, 1)));
+    ASSERT_EQ(OPRT_OK, read_packet(&out, &out_len));
+    tuya_ai_basic_disconnect();
+    EXPECT_EQ(pattern(100, 1), data_of(out, out_len));
+    s_free_cnt = 0;
+    tuya_ai_basic_pkt_free(out);
+    EXPECT_EQ(1u, s_free_cnt.load());
+
+    // or is taken over by the next proto
+    proto_up();
+    ASSERT_EQ(OPRT_OK, send_text(pattern(100, 2)));
+    ASSERT_EQ(OPRT_OK, read_packet(&out, &out_len));
+    tuya_ai_basic_disconnect();
+    s_buf_alloc_cnt = 0;
+    proto_up();
+    EXPECT_EQ(0u, s_buf_alloc_cnt.load());
+    EXPECT_EQ(pattern(100, 2), data_of(out, out_len));
+    s_free_cnt = 0;
+    tuya_ai_basic_pkt_free(out);
+    EXPECT_EQ(0u, s_free_cnt.load());
+
+    ASSERT_EQ(OPRT_OK, send_text(pattern(100, 3)));
+    ASSERT_EQ(OPRT_OK, read_packet(&out, &out_len));
+    EXPECT_EQ(0u, s_buf_alloc_cnt.load());
+    tuya_ai_basic_pkt_free(out);
+}
+
+TEST_F(AiProtocolTest, BenchmarkSendRead)
+{
+    const int loops = 2000;
+    std::vector<char *> held;
+    char *out = NULL;
+    uint32_t out_len = 0;
+
+    MOCKER(tal_malloc).stubs().will(invoke(count_malloc));
+
+    for (int exhausted = 0; exhausted < 2; exhausted++) {
+        if (exhausted) {
+            for (int i = 0; i < AI_PKT_POOL_NUM; i++) {
+                ASSERT_EQ(OPRT_OK, send_text(pattern(16, i)));
+                ASSERT_EQ(OPRT_OK, read_packet(&out, &out_len));
+                held.push_back(out);
+            }
+        }
+        for (size_t size : {64, 1024, 4096}) {
+            std::string data = pattern(size, (int)size);
+            s_alloc_cnt = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < loops; i++) {
+                // the wire is drained, keep it from growing
+                s_wire.clear();
+                s_wire_pos = 0;
+                ASSERT_EQ(OPRT_OK, send_text(data));
+                ASSERT_EQ(OPRT_OK, read_packet(&out, &out_len));
+                tuya_ai_basic_pkt_free(out);
+            }
+            double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            printf("[   INFO   ] ai proto %s %5zu bytes: %9.0f packets/s, %9.0f allocs/s, %.2f allocs/packet\n",
+                   exhausted ? "pool exhausted" : "pooled        ", size, loops / secs, s_alloc_cnt.load() / secs,
+                   (double)s_alloc_cnt.load() / loops);
+            if (!exhausted) {
+                EXPECT_EQ(0u, s_alloc_cnt.load()) << size;
+            }
+        }
+    }
+    for (char *buf : held) {
+        tuya_ai_basic_pkt_free(buf);
+    }
+}
@@ -22,6 +22,7 @@
 #include <strings.h>
 #include <inttypes.h>
 #include "atop_base.h"
+#include "atop_cache.h"
 #include "tuya_config_defaults.h"
 #include "tal_log.h"
 #include "tuya_endpoint.h"
@@ -40,11 +41,22 @@
 #define AES_GCM128_NONCE_LEN        12
 #define AES_GCM128_TAG_LEN          16
 
+#if defined(ENABLE_ATOP_BATCH) && (ENABLE_ATOP_BATCH == 1)
+// experimental, the name and the format of the batch api are not documented ones
+#define ATOP_BATCH_API     "tuya.device.batch.invoke"
+#define ATOP_BATCH_VERSION "1.0"
+#endif
+
 typedef struct {
     char *key;
     char *value;
 } url_param_t;
 
+#if defined(ENABLE_ATOP_BATCH) && (ENABLE_ATOP_BATCH == 1)
+// cleared when the cloud does not answer the batch api, the calls are then sent one by one
+static bool sg_batch_supported = true;
+#endif
+
 static int atop_url_params_sign(const char *key, url_param_t *params, int param_num, uint8_t *out, size_t *olen)
 {
     int rt = OPRT_OK;
@@ -164,6 +176,7 @@ static int atop_request_data_encode(const char *key, const uint8_t *input, int i
                                               encrypted_buffer + AES_GCM128_NONCE_LEN + ilen, AES_GCM128_TAG_LEN);
     if (ret != OPRT_OK) {
         PR_ERR("mbedtls_cipher_auth_encrypt_wrapper:0x%x", ret);
+        tal_free(encrypted_buffer);
         return ret;
     }
 
@@ -195,7 +208,8 @@ static int atop_request_data_encode(const char *key, const uint8_t *input, int i
 
 static int atop_response_result_decrpyt(const char *key, const uint8_t *input, int ilen, uint8_t *output, size_t *olen)
 {
-    if (key == NULL || input == NULL || ilen == 0 || output == NULL || olen == NULL) {
+    if (key == NULL || input == NULL || ilen < AES_GCM128_NONCE_LEN + AES_GCM128_TAG_LEN || output == NULL ||
+        olen == NULL) {
         return OPRT_INVALID_PARM;
     }
 
@@ -232,9 +246,11 @@ static int atop_response_data_decode(const char *key, const uint8_t *input, size
         return OPRT_CJSON_PARSE_ERR;
     }
 
+    // a plaintext response has no result or carries it as JSON
     cJSON *item = cJSON_GetObjectItem(root, "result");
-    if (NULL == item) {
+    if (!cJSON_IsString(item) || NULL == item->valuestring) {
         PR_ERR("no result");
+        cJSON_Delete(root);
         return OPRT_CJSON_GET_ERR;
     }
 
@@ -246,6 +262,10 @@ static int atop_response_data_decode(const char *key, const uint8_t *input, size
     // base64 decode buffer
     size_t b64buffer_len = value_length * 3 / 4;
     uint8_t *b64buffer = tal_malloc(b64buffer_len);
+    if (NULL == b64buffer) {
+        cJSON_Delete(root);
+        return OPRT_MALLOC_FAILED;
+    }
     size_t b64buffer_olen = 0;
 
     // base64 decode
@@ -269,30 +289,13 @@ static int atop_response_data_decode(const char *key, const uint8_t *input, size
     return rt;
 }
 
-static int atop_response_result_parse_cjson(const uint8_t *input, size_t ilen, atop_base_response_t *response)
+static int atop_response_result_parse_object(cJSON *root, atop_base_response_t *response)
 {
     int rt = OPRT_OK;
 
-    if (NULL == input || NULL == response) {
-        PR_ERR("param error");
-        return OPRT_INVALID_PARM;
-    }
-
-    if (input[ilen] != '\0') {
-        PR_ERR("string length error ilen:%d, stlen:%d", ilen, strlen((char *)input));
-    }
-
-    // json parse
-    cJSON *root = cJSON_Parse((const char *)input);
-    if (NULL == root) {
-        PR_ERR("Json parse error");
-        return OPRT_CJSON_PARSE_ERR;
-    }
-
     // verify success key
     if (!cJSON_HasObjectItem(root, "success")) {
         PR_ERR("not found json success key");
-        cJSON_Delete(root);
         return OPRT_CJSON_GET_ERR;
     }
 
@@ -305,7 +308,6 @@ static int atop_response_result_parse_cjson(const uint8_t *input, size_t ilen, a
     if (cJSON_GetObjectItem(root, "success")->type == cJSON_True) {
         response->success = true;
         response->result = cJSON_DetachItemFromObject(root, "result");
-        cJSON_Delete(root);
         return OPRT_OK;
     }
 
@@ -320,7 +322,6 @@ static int atop_response_result_parse_cjson(const uint8_t *input, size_t ilen, a
     }
 
     if (cJSON_GetObjectItem(root, "errorCode") == NULL) {
-        cJSON_Delete(root);
         return OPRT_COM_ERROR;
     }
 
@@ -330,32 +331,40 @@ static int atop_response_result_parse_cjson(const uint8_t *input, size_t ilen, a
         rt = OPRT_LINK_CORE_HTTP_GW_NOT_EXIST;
     }
 
-    // free cJSON object
-    cJSON_Delete(root);
     return rt;
 }
 
-/**
- * Sends a request to the Tuya cloud service.
- *
- * This function sends a request to the Tuya cloud service using the provided
- * request parameters.
- *
- * @param request The request parameters for the Tuya cloud service.
- * @param response The response structure to store the response from the Tuya
- * cloud service.
- * @return Returns an integer value indicating the status of the request:
- *         - OPRT_OK: The request was successful.
- *         - OPRT_INVALID_PARM: Invalid parameters were provided.
- *         - OPRT_MALLOC_FAILED: Memory allocation failed.
- *         - OPRT_LINK_CORE_HTTP_CLIENT_SEND_ERROR: Error occurred while sending
- * the HTTP request.
- */
-int atop_base_request(const atop_base_request_t *request, atop_base_response_t *response)
+static int atop_response_result_parse_cjson(const uint8_t *input, size_t ilen, atop_base_response_t *response)
 {
-    if (NULL == request || NULL == response) {
+    int rt = OPRT_OK;
+
+    if (NULL == input || NULL == response) {
+        PR_ERR("param error");
         return OPRT_INVALID_PARM;
     }
+
+    if (input[ilen] != '\0') {
+        PR_ERR("string length error ilen:%d, stlen:%d", ilen, strlen((char *)input));
+    }
+
+    // json parse
+    cJSON *root = cJSON_Parse((const char *)input);
+    if (NULL == root) {
+        PR_ERR("Json parse error");
+        return OPRT_CJSON_PARSE_ERR;
+    }
+
+    rt = atop_response_result_parse_object(root, response);
+
+    // free cJSON object
+    cJSON_Delete(root);
+    return rt;
+}
+
+// sign and encrypt the request, post it and decrypt the response, the
+// plaintext is null terminated and to be freed with tal_free
+static int atop_base_request_exchange(const atop_base_request_t *request, uint8_t **plain, size_t *plain_len)
+{
     if (request->path == NULL || request->key == NULL || request->api == NULL || request->path[0] == '\0' ||
         request->key[0] == '\0' || request->api[0] == '\0') {
         return OPRT_INVALID_PARM;
@@ -367,9 +376,6 @@ int atop_base_request(const atop_base_request_t *request, atop_base_response_t *
     int rt = OPRT_OK;
     http_client_status_t http_status;
 
-    /* user data */
-    response->user_data = (void *)request->user_data;
-
     /* params fill */
     url_param_t params[6];
     int idx = 0;
@@ -413,7 +419,7 @@ int atop_base_request(const atop_base_request_t *request, atop_base_response_t *
         tal_free(path_buffer);
         return OPRT_BUFFER_NOT_ENOUGH;
     }
-    
+
     PR_DEBUG("TUYA_HTTPS_ATOP_URL: %s", path_buffer);
 
     /* param encode */
@@ -491,7 +497,7 @@ int atop_base_request(const atop_base_request_t *request, atop_base_response_t *
     }
 
     size_t result_buffer_length = 0;
-    uint8_t *result_buffer = tal_calloc(1, http_response.body_length);
+    uint8_t *result_buffer = tal_calloc(1, http_response.body_length + 1);
     if (NULL == result_buffer) {
         PR_ERR("result_buffer malloc fail");
         http_client_free(&http_response);
@@ -501,18 +507,289 @@ int atop_base_request(const atop_base_request_t *request, atop_base_response_t *
     /* Decoded response data */
     rt = atop_response_data_decode(request->key, http_response.body, http_response.body_length, result_buffer,
                                    &result_buffer_length);
+    if (OPRT_OK != rt) {
+        PR_NOTICE("atop_response_decode error:%d, try parse the plaintext data.", rt);
+        memcpy(result_buffer, http_response.body, http_response.body_length);
+        result_buffer_length = http_response.body_length;
+    }
+    result_buffer[result_buffer_length] = '\0';
+    http_client_free(&http_response);
+
+    *plain = result_buffer;
+    *plain_len = result_buffer_length;
+    return OPRT_OK;
+}
+
+// send the request, a successful response is stored with ticket
+static int atop_base_request_send(const atop_base_request_t *request, atop_base_response_t *response,
+                                  atop_cache_ticket_t *ticket)
+{
+    if (NULL == request || NULL == response) {
+        return OPRT_INVALID_PARM;
+    }
+
+    /* user data */
+    response->user_data = (void *)request->user_data;
+
+    uint8_t *plain = NULL;
+    size_t plain_len = 0;
+    int rt = atop_base_request_exchange(request, &plain, &plain_len);
+    if (OPRT_OK != rt) {
+        return rt;
+    }
 
+    rt = atop_response_result_parse_cjson(plain, plain_len, response);
+#if defined(ENABLE_ATOP_CACHE) && (ENABLE_ATOP_CACHE == 1)
+    if (OPRT_OK == rt && response->success) {
+        atop_cache_put(ticket, plain, plain_len);
+    }
+#else
+    (void)ticket;
+#endif
+    tal_free(plain);
+
+    return rt;
+}
+
+/**
+ * Sends a request to the Tuya cloud service.
+ *
+ * This function sends a request to the Tuya cloud service using the provided
+ * request parameters. A request with a cache_ttl is answered from the cache
+ * while a successful response to it is less than cache_ttl seconds old.
+ *
+ * @param request The request parameters for the Tuya cloud service.
+ * @param response The response structure to store the response from the Tuya
+ * cloud service.
+ * @return Returns an integer value indicating the status of the request:
+ *         - OPRT_OK: The request was successful.
+ *         - OPRT_INVALID_PARM: Invalid parameters were provided.
+ *         - OPRT_MALLOC_FAILED: Memory allocation failed.
+ *         - OPRT_LINK_CORE_HTTP_CLIENT_SEND_ERROR: Error occurred while sending
+ * the HTTP request.
+ */
+int atop_base_request(const atop_base_request_t *request, atop_base_response_t *response)
+{
+#if defined(ENABLE_ATOP_CACHE) && (ENABLE_ATOP_CACHE == 1)
+    int rt = OPRT_OK;
+    atop_cache_ticket_t ticket = {.slot = -1};
+
+    if (request && response && request->cache_ttl) {
+        uint8_t *cached = NULL;
+        size_t cached_len = 0;
+        if (OPRT_OK == atop_cache_get(&(const atop_cache_key_t){.api = request->api,
+                                                                .version = request->version,
+                                                                .id = request->devid,
+                                                                .params = request->data,
+                                                                .params_len = request->datalen,
+                                                                .ttl = request->cache_ttl,
+                                                                .persist = request->cache_persist},
+                                      &ticket, &cached, &cached_len)) {
+            PR_DEBUG("atop %s answered from cache", request->api);
+            response->user_data = (void *)request->user_data;
+            rt = atop_response_result_parse_cjson(cached, cached_len, response);
+            tal_free(cached);
+            return rt;
+        }
+    }
+
+    rt = atop_base_request_send(request, response, &ticket);
+    atop_cache_release(&ticket);
+
+    return rt;
+#else
+    return atop_base_request_send(request, response, NULL);
+#endif
+}
+
+#if defined(ENABLE_ATOP_BATCH) && (ENABLE_ATOP_BATCH == 1)
+// length of the params of a call without the terminating null some callers count in datalen
+static size_t atop_batch_data_len(const atop_base_batch_call_t *call)
+{
+    size_t len = call->datalen;
+    while (len > 0 && ((const char *)call->data)[len - 1] == '\0') {
+        len--;
+    }
+    return len;
+}
+
+// {"apis":[{"a":api,"v":version,"data":params},...],"t":timestamp}
+static char *atop_batch_body_make(const atop_base_batch_call_t *calls, int count, uint32_t timestamp, size_t *olen)
+{
+    size_t size = sizeof("{\"apis\":[],\"t\":4294967295}");
+    int i;
+
+    for (i = 0; i < count; i++) {
+        size += sizeof(",{\"a\":\"\",\"v\":\"\",\"data\":}") + strlen(calls[i].api) + atop_batch_data_len(&calls[i]);
+        size += calls[i].version ? strlen(calls[i].version) : 0;
+    }
+
+    char *body = tal_malloc(size);
+    if (NULL == body) {
+        return NULL;
+    }
+
+    size_t len = snprintf(body, size, "{\"apis\":[");
+    for (i = 0; i < count; i++) {
+        len += snprintf(body + len, size - len, "%s{\"a\":\"%s\"", i ? "," : "", calls[i].api);
+        if (calls[i].version) {
+            len += snprintf(body + len, size - len, ",\"v\":\"%s\"", calls[i].version);
+        }
+        if (calls[i].data) {
+            len += snprintf(body + len, size - len, ",\"data\":%.*s", (int)atop_batch_data_len(&calls[i]),
+                            (const char *)calls[i].data);
+        }
+        len += snprintf(body + len, size - len, "}");
+    }
+    len += snprintf(body + len, size - len, "],\"t\":%" PRIu32 "}", timestamp);
+
+    *olen = len;
+    return body;
+}
+#endif
+
+static void atop_batch_call_done(const atop_base_batch_call_t *call, atop_base_response_t *response)
+{
+    if (call->cb) {
+        call->cb(response, call->user_data);
+    }
+    atop_base_response_free(response);
+}
+
+// send the calls one by one, all_success tells whether the cloud accepted each of them
+static int atop_batch_request_each(const atop_base_request_t *request, const atop_base_batch_call_t *calls,
+                                   int count, bool *all_success)
+{
+    int rt = OPRT_OK;
+    int i;
+
+    if (all_success) {
+        *all_success = true;
+    }
+
+    for (i = 0; i < count; i++) {
+        atop_base_request_t each = *request;
+        each.api = calls[i].api;
+        each.version = calls[i].version;
+        each.data = (void *)calls[i].data;
+        each.datalen = calls[i].datalen;
+        each.user_data = calls[i].user_data;
+
+        atop_base_response_t response = {0};
+        int ret = atop_base_request(&each, &response);
+        if (OPRT_OK != ret) {
+            PR_ERR("atop %s error:%d", calls[i].api, ret);
+            rt = ret;
+        }
+        if (all_success && (OPRT_OK != ret || !response.success)) {
+            *all_success = false;
+        }
+        atop_batch_call_done(&calls[i], &response);
+    }
+
+    return rt;
+}
+
+/**
+ * @brief Sends several ATOP calls in one request.
+ *
+ * The calls are packed in a single body of the batch api, encrypted and
+ * signed once, and the combined response is parsed in one pass. When the
+ * cloud does not answer the batch api, the calls of this and of the later
+ * batches are sent one by one with atop_base_request. Without
+ * ENABLE_ATOP_BATCH they are always sent one by one.
+ *
+ * @param request The path, key, devid, uuid and timestamp shared by the
+ * calls, its api, version and data are not used.
+ * @param calls The calls, each callback is called once with the response to
+ * its call, success is false if the call failed.
+ * @param count The number of calls.
+ * @return OPRT_OK if the request was answered, others if it was not sent or
+ * not answered, the calls then fail.
+ */
+int atop_base_batch_request(const atop_base_request_t *request, const atop_base_batch_call_t *calls, int count)
+{
+    if (NULL == request || NULL == calls || count <= 0) {
+        return OPRT_INVALID_PARM;
+    }
+
+#if defined(ENABLE_ATOP_BATCH) && (ENABLE_ATOP_BATCH == 1)
+    if (count == 1 || !sg_batch_supported) {
+        return atop_batch_request_each(request, calls, count, NULL);
+    }
+
+    int rt = OPRT_OK;
+    int i = 0;
+
+    size_t body_len = 0;
+    char *body = atop_batch_body_make(calls, count, request->timestamp, &body_len);
+    if (NULL == body) {
+        PR_ERR("batch body malloc fail");
+        return OPRT_MALLOC_FAILED;
+    }
+    PR_DEBUG("POST JSON:%s", body);
+
+    atop_base_request_t batch = *request;
+    batch.api = ATOP_BATCH_API;
+    batch.version = ATOP_BATCH_VERSION;
+    batch.data = body;
+    batch.datalen = body_len;
+
+    uint8_t *plain = NULL;
+    size_t plain_len = 0;
+    rt = atop_base_request_exchange(&batch, &plain, &plain_len);
+    tal_free(body);
+
+    cJSON *root = NULL;
+    atop_base_response_t outer = {0};
     if (OPRT_OK == rt) {
-        rt = atop_response_result_parse_cjson(result_buffer, result_buffer_length, response);
+        root = cJSON_Parse((const char *)plain);
+        rt = root ? atop_response_result_parse_object(root, &outer) : OPRT_CJSON_PARSE_ERR;
+    }
+
+    if (OPRT_OK == rt && outer.success && cJSON_IsArray(outer.result) &&
+        cJSON_GetArraySize(outer.result) == count) {
+        cJSON *item = NULL;
+        cJSON_ArrayForEach(item, outer.result)
+        {
+            atop_base_response_t response = {.t = outer.t, .user_data = calls[i].user_data};
+            if (!cJSON_IsObject(item) || OPRT_OK != atop_response_result_parse_object(item, &response)) {
+                PR_ERR("atop %s error in batch", calls[i].api);
+            }
+            atop_batch_call_done(&calls[i++], &response);
+        }
+    } else if (plain && !outer.success) {
+        /* The cloud refused the batch, the calls are sent one by one. The
+         * batch api is only given up when each of them was then accepted, a
+         * refusal that also fails them, such as a device the cloud no longer
+         * knows, says nothing about the batch api. */
+        bool all_success = false;
+        rt = atop_batch_request_each(request, calls, count, &all_success);
+        if (all_success) {
+            PR_NOTICE("atop batch not supported, the calls are sent one by one");
+            sg_batch_supported = false;
+        }
     } else {
-        PR_NOTICE("atop_response_decode error:%d, try parse the plaintext data.", rt);
-        rt = atop_response_result_parse_cjson(http_response.body, http_response.body_length, response);
+        PR_ERR("atop batch error:%d", rt);
+        rt = (OPRT_OK == rt) ? OPRT_CJSON_GET_ERR : rt;
+        for (i = 0; i < count; i++) {
+            atop_base_response_t response = {.user_data = calls[i].user_data};
+            atop_batch_call_done(&calls[i], &response);
+        }
     }
 
-    http_client_free(&http_response);
-    tal_free(result_buffer);
+    if (outer.result) {
+        cJSON_Delete(outer.result);
+    }
+    if (root) {
+        cJSON_Delete(root);
+    }
+    tal_free(plain);
 
     return rt;
+#else
+    return atop_batch_request_each(request, calls, count, NULL);
+#endif
 }
 
 /**
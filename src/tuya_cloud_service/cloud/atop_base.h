@@ -38,6 +38,8 @@ typedef struct {
     void *data;
     size_t datalen;
     const void *user_data;
+    uint32_t cache_ttl; // seconds a successful response is answered from the cache, 0 not cached
+    bool cache_persist; // also keep the cached response through a reboot
 } atop_base_request_t;
 
 typedef struct {
@@ -49,6 +51,21 @@ typedef struct {
     size_t raw_data_len;
 } atop_base_response_t;
 
+typedef void (*atop_base_response_cb_t)(atop_base_response_t *response, void *user_data);
+
+/**
+ * @brief one call of a batch request, the response is freed once cb returns,
+ * cb takes the result by setting response->result to NULL
+ */
+typedef struct {
+    const char *api;
+    const char *version;
+    const void *data; // JSON params of the call
+    size_t datalen;
+    atop_base_response_cb_t cb;
+    void *user_data;
+} atop_base_batch_call_t;
+
 /**
  * @brief Sends a request to the atop base service.
  *
@@ -66,6 +83,26 @@ typedef struct {
  */
 int atop_base_request(const atop_base_request_t *request, atop_base_response_t *response);
 
+/**
+ * @brief Sends several calls sharing the device and key of request in a
+ * single ATOP request.
+ *
+ * The calls are packed in one encrypted body and each callback is called
+ * with the response to its call. If the cloud does not answer the batch, or
+ * without ENABLE_ATOP_BATCH, the calls are sent one by one.
+ *
+ * ENABLE_ATOP_BATCH is experimental and off by default, the batch api name
+ * and its wire format are not a documented cloud api.
+ *
+ * @param request Pointer to the `atop_base_request_t` structure giving the
+ * path, key, devid, uuid and timestamp of the calls.
+ * @param calls The calls to make, in order.
+ * @param count The number of calls.
+ * @return Returns OPRT_OK if the request was answered, others if it was not,
+ * the calls then fail.
+ */
+int atop_base_batch_request(const atop_base_request_t *request, const atop_base_batch_call_t *calls, int count);
+
 /**
  * @brief Frees the memory allocated for an atop_base_response_t object.
  *
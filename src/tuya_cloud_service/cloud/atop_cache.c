@@ -0,0 +1,618 @@
+/**
+ * @file atop_cache.c
+ * @brief TTL cache of the responses of the cloud query APIs.
+ *
+ * The cache is ATOP_CACHE_NUM slots, each holding the MD5 of a request and
+ * its response. A miss takes the slot of the request at once and marks it
+ * fetching, the same request made meanwhile finds that slot and waits on its
+ * semaphore until the fetcher stores the response or gives up, at most
+ * ATOP_CACHE_WAIT_MS. A new request takes an empty slot, else an expired
+ * one, else the least recently used one that no fetch or waiter holds.
+ *
+ * A persisted response is also the tal_kv record "atc.<slot>" holding the
+ * MD5, the posix time it expires at and the response. The records are loaded
+ * by atop_cache_init, their monotonic expiry is only known once the time is
+ * synced, a loaded response is not used before. The records are written and
+ * deleted under kv_mutex without the cache mutex, so a lookup never waits for
+ * the flash.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include "tuya_config_defaults.h"
+#include "tuya_error_code.h"
+#include "tal_api.h"
+#include "cJSON.h"
+#include "atop_cache.h"
+
+#if defined(ENABLE_ATOP_CACHE) && (ENABLE_ATOP_CACHE == 1)
+
+/***********************************************************
+*************************micro define***********************
+***********************************************************/
+#ifndef ATOP_CACHE_NUM
+#define ATOP_CACHE_NUM 8
+#endif
+
+#if ATOP_CACHE_NUM > 32
+#error "ATOP_CACHE_NUM must not exceed 32"
+#endif
+
+#ifndef ATOP_CACHE_MAX_LEN
+#define ATOP_CACHE_MAX_LEN 4096
+#endif
+
+// longest wait for the fetch of the same request, the waiter makes its own after it
+#define ATOP_CACHE_WAIT_MS (HTTP_TIMEOUT_MS_DEFAULT * 2)
+#define ATOP_CACHE_WAITER_MAX 32
+
+#define ATOP_CACHE_DIGEST_LEN 16
+
+#define ATOP_CACHE_KEY     "atc.%u"
+#define ATOP_CACHE_KEY_LEN 16
+// bitmap of the slots with a record, so init does not probe the others
+#define ATOP_CACHE_MAP_KEY "atc.map"
+
+// record: digest, expiry posix time (4, little endian), response
+#define ATOP_CACHE_RECORD_HEAD (ATOP_CACHE_DIGEST_LEN + 4)
+
+typedef struct {
+    uint8_t digest[ATOP_CACHE_DIGEST_LEN];
+    uint8_t *data; // NULL while empty or fetching
+    size_t len;
+    SYS_TIME_T expire;   // 0 until the expiry of a loaded response is known
+    TIME_T expire_posix; // expiry of a loaded response
+    SYS_TIME_T used;     // last hit, for the eviction
+    bool fetching;
+    uint16_t waiters;
+    uint32_t gen; // bumped when emptied, a record made before is not saved
+    SEM_HANDLE sem;
+} atop_cache_slot_t;
+
+typedef struct {
+    MUTEX_HANDLE mutex;
+    MUTEX_HANDLE kv_mutex; // orders the tal_kv writes, taken before mutex
+    atop_cache_slot_t slot[ATOP_CACHE_NUM];
+    uint32_t persisted; // slots with a record
+    atop_cache_stats_t stats;
+} atop_cache_t;
+
+/***********************************************************
+*************************variable define********************
+***********************************************************/
+static atop_cache_t sg_atop_cache;
+
+/***********************************************************
+*************************function define********************
+***********************************************************/
+static int __member_cmp(const void *a, const void *b)
+{
+    return strcmp((*(cJSON *const *)a)->string, (*(cJSON *const *)b)->string);
+}
+
+// sort the members of the objects by name, at all levels
+static void __json_sort(cJSON *item)
+{
+    cJSON *child = NULL;
+    int num = 0;
+
+    for (child = item->child; child; child = child->next) {
+        __json_sort(child);
+        num++;
+    }
+    if (!cJSON_IsObject(item) || num < 2) {
+        return;
+    }
+
+    cJSON **members = tal_malloc(num * sizeof(cJSON *));
+    if (NULL == members) {
+        return;
+    }
+    num = 0;
+    for (child = item->child; child; child = child->next) {
+        members[num++] = child;
+    }
+    qsort(members, num, sizeof(cJSON *), __member_cmp);
+    for (int i = 0; i < num; i++) {
+        cJSON_DetachItemViaPointer(item, members[i]);
+        cJSON_AddItemToArray(item, members[i]);
+    }
+    tal_free(members);
+}
+
+// MD5 of api, version, id and the params, as sorted JSON without "t" if they are JSON
+static int __key_digest(const atop_cache_key_t *key, uint8_t digest[ATOP_CACHE_DIGEST_LEN])
+{
+    char *params = tal_malloc(key->params_len + 1);
+    if (NULL == params) {
+        return OPRT_MALLOC_FAILED;
+    }
+    if (key->params_len) {
+        memcpy(params, key->params, key->params_len);
+    }
+    params[key->params_len] = '\0';
+
+    char *canonical = NULL;
+    cJSON *root = cJSON_Parse(params);
+    if (root) {
+        if (cJSON_IsObject(root)) {
+            cJSON_DeleteItemFromObjectCaseSensitive(root, "t");
+        }
+        __json_sort(root);
+        canonical = cJSON_PrintUnformatted(root);
+        cJSON_Delete(root);
+    }
+    const char *text = canonical ? canonical : params;
+    size_t text_len = canonical ? strlen(canonical) : key->params_len;
+
+    const char *version = key->version ? key->version : "";
+    const char *id = key->id ? key->id : "";
+    size_t head_len = strlen(key->api) + strlen(version) + strlen(id) + 3;
+    char *buffer = tal_malloc(head_len + text_len + 1);
+    if (NULL == buffer) {
+        cJSON_free(canonical);
+        tal_free(params);
+        return OPRT_MALLOC_FAILED;
+    }
+    snprintf(buffer, head_len + 1, "%s\n%s\n%s\n", key->api, version, id);
+    memcpy(buffer + head_len, text, text_len);
+    tal_md5_ret((const uint8_t *)buffer, head_len + text_len, digest);
+
+    tal_free(buffer);
+    cJSON_free(canonical);
+    tal_free(params);
+
+    return OPRT_OK;
+}
+
+static void __map_save(uint32_t map)
+{
+    tal_kv_set(ATOP_CACHE_MAP_KEY, (const uint8_t *)&map, sizeof(uint32_t));
+}
+
+// copy of the response of slot as a record, made under mutex
+static uint8_t *__record_make(atop_cache_slot_t *slot, size_t *len)
+{
+    *len = ATOP_CACHE_RECORD_HEAD + slot->len;
+
+    uint8_t *record = tal_malloc(*len);
+    if (NULL == record) {
+        return NULL;
+    }
+    memcpy(record, slot->digest, ATOP_CACHE_DIGEST_LEN);
+    record[ATOP_CACHE_DIGEST_LEN] = slot->expire_posix & 0xFF;
+    record[ATOP_CACHE_DIGEST_LEN + 1] = (slot->expire_posix >> 8) & 0xFF;
+    record[ATOP_CACHE_DIGEST_LEN + 2] = (slot->expire_posix >> 16) & 0xFF;
+    record[ATOP_CACHE_DIGEST_LEN + 3] = (slot->expire_posix >> 24) & 0xFF;
+    memcpy(record + ATOP_CACHE_RECORD_HEAD, slot->data, slot->len);
+
+    return record;
+}
+
+// write the record of slot idx, made at gen, unless the slot was emptied since, and free it
+static void __record_save(uint32_t idx, uint32_t gen, uint8_t *record, size_t len)
+{
+    char key[ATOP_CACHE_KEY_LEN];
+    uint32_t map = 0;
+    bool stale = false;
+
+    tal_mutex_lock(sg_atop_cache.kv_mutex);
+    tal_mutex_lock(sg_atop_cache.mutex);
+    stale = sg_atop_cache.slot[idx].gen != gen;
+    tal_mutex_unlock(sg_atop_cache.mutex);
+
+    snprintf(key, sizeof(key), ATOP_CACHE_KEY, (unsigned int)idx);
+    if (!stale && OPRT_OK == tal_kv_set(key, record, len)) {
+        tal_mutex_lock(sg_atop_cache.mutex);
+        if (0 == (sg_atop_cache.persisted & (1u << idx))) {
+            sg_atop_cache.persisted |= 1u << idx;
+            map = sg_atop_cache.persisted;
+        }
+        tal_mutex_unlock(sg_atop_cache.mutex);
+        if (map) {
+            __map_save(map);
+        }
+    }
+    tal_mutex_unlock(sg_atop_cache.kv_mutex);
+    tal_free(record);
+}
+
+static void __record_load(uint32_t idx)
+{
+    char key[ATOP_CACHE_KEY_LEN];
+    atop_cache_slot_t *slot = &sg_atop_cache.slot[idx];
+    uint8_t *record = NULL;
+    size_t len = 0;
+
+    snprintf(key, sizeof(key), ATOP_CACHE_KEY, (unsigned int)idx);
+    if (OPRT_OK != tal_kv_get(key, &record, &len)) {
+        return;
+    }
+    if (len <= ATOP_CACHE_RECORD_HEAD || len - ATOP_CACHE_RECORD_HEAD > ATOP_CACHE_MAX_LEN) {
+        PR_WARN("atop cache record %u broken", (unsigned int)idx);
+        tal_kv_free(record);
+        tal_kv_del(key);
+        return;
+    }
+
+    slot->len = len - ATOP_CACHE_RECORD_HEAD;
+    slot->data = tal_malloc(slot->len + 1);
+    if (slot->data) {
+        memcpy(slot->digest, record, ATOP_CACHE_DIGEST_LEN);
+        slot->expire_posix = record[ATOP_CACHE_DIGEST_LEN] | (record[ATOP_CACHE_DIGEST_LEN + 1] << 8) |
+                             (record[ATOP_CACHE_DIGEST_LEN + 2] << 16) |
+                             ((uint32_t)record[ATOP_CACHE_DIGEST_LEN + 3] << 24);
+        memcpy(slot->data, record + ATOP_CACHE_RECORD_HEAD, slot->len);
+        slot->data[slot->len] = '\0';
+        slot->expire = 0;
+        sg_atop_cache.persisted |= 1u << idx;
+    }
+    tal_kv_free(record);
+}
+
+static void __slot_empty(atop_cache_slot_t *slot)
+{
+    slot->gen++;
+    tal_free(slot->data);
+    slot->data = NULL;
+    slot->len = 0;
+    slot->expire = 0;
+    slot->expire_posix = 0;
+}
+
+// whether the response of slot is still to be used
+static bool __slot_fresh(atop_cache_slot_t *slot, SYS_TIME_T now)
+{
+    if (NULL == slot->data) {
+        return false;
+    }
+    if (0 == slot->expire) {
+        if (OPRT_OK != tal_time_check_time_sync()) {
+            return false;
+        }
+        TIME_T posix = tal_time_get_posix();
+        if (posix >= slot->expire_posix) {
+            return false;
+        }
+        slot->expire = now + (SYS_TIME_T)(slot->expire_posix - posix) * 1000;
+    }
+
+    return now < slot->expire;
+}
+
+static atop_cache_slot_t *__slot_find(const uint8_t digest[ATOP_CACHE_DIGEST_LEN])
+{
+    for (int i = 0; i < ATOP_CACHE_NUM; i++) {
+        atop_cache_slot_t *slot = &sg_atop_cache.slot[i];
+        if ((slot->data || slot->fetching) && 0 == memcmp(slot->digest, digest, ATOP_CACHE_DIGEST_LEN)) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+// slot for a new request: an empty one, else an expired one, else the least recently used
+static atop_cache_slot_t *__slot_evict(SYS_TIME_T now)
+{
+    atop_cache_slot_t *lru = NULL;
+
+    for (int i = 0; i < ATOP_CACHE_NUM; i++) {
+        atop_cache_slot_t *slot = &sg_atop_cache.slot[i];
+        if (slot->fetching || slot->waiters) {
+            continue;
+        }
+        if (NULL == slot->data || (slot->expire && now >= slot->expire)) {
+            return slot;
+        }
+        if (NULL == lru || slot->used < lru->used) {
+            lru = slot;
+        }
+    }
+
+    return lru;
+}
+
+// end the fetch of slot, the waiters look again
+static void __slot_fetched(atop_cache_slot_t *slot)
+{
+    slot->fetching = false;
+    for (uint16_t i = 0; i < slot->waiters; i++) {
+        tal_semaphore_post(slot->sem);
+    }
+}
+
+/**
+ * @brief init the cache and load the responses saved before a reboot
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int atop_cache_init(void)
+{
+    OPERATE_RET rt = OPRT_OK;
+    uint32_t map = 0;
+    size_t len = 0;
+    int i;
+
+    if (sg_atop_cache.mutex) {
+        return OPRT_OK;
+    }
+
+    for (i = 0; i < ATOP_CACHE_NUM; i++) {
+        rt = tal_semaphore_create_init(&sg_atop_cache.slot[i].sem, 0, ATOP_CACHE_WAITER_MAX);
+        if (OPRT_OK != rt) {
+            while (i--) {
+                tal_semaphore_release(sg_atop_cache.slot[i].sem);
+                sg_atop_cache.slot[i].sem = NULL;
+            }
+            return rt;
+        }
+    }
+    rt = tal_mutex_create_init(&sg_atop_cache.kv_mutex);
+    if (OPRT_OK == rt) {
+        rt = tal_mutex_create_init(&sg_atop_cache.mutex);
+        if (OPRT_OK != rt) {
+            tal_mutex_release(sg_atop_cache.kv_mutex);
+            sg_atop_cache.kv_mutex = NULL;
+        }
+    }
+    if (OPRT_OK != rt) {
+        for (i = 0; i < ATOP_CACHE_NUM; i++) {
+            tal_semaphore_release(sg_atop_cache.slot[i].sem);
+            sg_atop_cache.slot[i].sem = NULL;
+        }
+        return rt;
+    }
+
+    if (OPRT_OK != tal_kv_get_into(ATOP_CACHE_MAP_KEY, (uint8_t *)&map, sizeof(map), &len) || len != sizeof(map)) {
+        return OPRT_OK;
+    }
+    for (i = 0; i < ATOP_CACHE_NUM; i++) {
+        if (map & (1u << i)) {
+            __record_load(i);
+        }
+    }
+    if (sg_atop_cache.persisted != map) {
+        __map_save(sg_atop_cache.persisted);
+    }
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief look a response up, waiting for the fetch of the same request if one
+ * is in flight
+ *
+ * @param[in] key request
+ * @param[out] ticket fetch to make on a miss, always to be released
+ * @param[out] data copy of the response on a hit, null terminated, to be
+ * freed with tal_free
+ * @param[out] len length of the response
+ *
+ * @return OPRT_OK on a hit, OPRT_NOT_FOUND if the response is to be fetched
+ */
+int atop_cache_get(const atop_cache_key_t *key, atop_cache_ticket_t *ticket, uint8_t **data, size_t *len)
+{
+    uint8_t digest[ATOP_CACHE_DIGEST_LEN];
+    bool waited = false;
+
+    if (NULL == ticket) {
+        return OPRT_INVALID_PARM;
+    }
+    ticket->slot = -1;
+    if (NULL == sg_atop_cache.mutex || NULL == key || NULL == key->api || 0 == key->ttl || NULL == data ||
+        NULL == len || (NULL == key->params && key->params_len)) {
+        return OPRT_NOT_FOUND;
+    }
+    ticket->ttl = key->ttl;
+    ticket->persist = key->persist;
+    if (OPRT_OK != __key_digest(key, digest)) {
+        return OPRT_NOT_FOUND;
+    }
+
+    SYS_TIME_T deadline = tal_system_get_millisecond() + ATOP_CACHE_WAIT_MS;
+
+    tal_mutex_lock(sg_atop_cache.mutex);
+    for (;;) {
+        SYS_TIME_T now = tal_system_get_millisecond();
+        atop_cache_slot_t *slot = __slot_find(digest);
+
+        if (slot && !slot->fetching && __slot_fresh(slot, now)) {
+            uint8_t *copy = tal_malloc(slot->len + 1);
+            if (copy) {
+                memcpy(copy, slot->data, slot->len);
+                copy[slot->len] = '\0';
+                *data = copy;
+                *len = slot->len;
+                slot->used = now;
+                sg_atop_cache.stats.hits++;
+                if (waited) {
+                    sg_atop_cache.stats.coalesced++;
+                }
+                tal_mutex_unlock(sg_atop_cache.mutex);
+                return OPRT_OK;
+            }
+            break;
+        }
+
+        if (slot && slot->fetching) {
+            if (now >= deadline) {
+                break;
+            }
+            slot->waiters++;
+            tal_mutex_unlock(sg_atop_cache.mutex);
+            tal_semaphore_wait(slot->sem, (uint32_t)(deadline - now));
+            tal_mutex_lock(sg_atop_cache.mutex);
+            slot->waiters--;
+            waited = true;
+            continue;
+        }
+
+        if (NULL == slot) {
+            slot = __slot_evict(now);
+        }
+        if (slot) {
+            __slot_empty(slot);
+            memcpy(slot->digest, digest, ATOP_CACHE_DIGEST_LEN);
+            slot->fetching = true;
+            ticket->slot = slot - sg_atop_cache.slot;
+        }
+        break;
+    }
+    sg_atop_cache.stats.misses++;
+    tal_mutex_unlock(sg_atop_cache.mutex);
+
+    return OPRT_NOT_FOUND;
+}
+
+/**
+ * @brief store the response of a fetch and hand it to the requests waiting
+ * for it, only successful responses are to be stored
+ */
+void atop_cache_put(atop_cache_ticket_t *ticket, const uint8_t *data, size_t len)
+{
+    uint8_t *record = NULL;
+    size_t record_len = 0;
+    uint32_t gen = 0;
+
+    if (NULL == ticket || ticket->slot < 0) {
+        return;
+    }
+
+    tal_mutex_lock(sg_atop_cache.mutex);
+    atop_cache_slot_t *slot = &sg_atop_cache.slot[ticket->slot];
+    if (data && len && len <= ATOP_CACHE_MAX_LEN) {
+        slot->data = tal_malloc(len + 1);
+    }
+    if (slot->data) {
+        SYS_TIME_T now = tal_system_get_millisecond();
+
+        memcpy(slot->data, data, len);
+        slot->data[len] = '\0';
+        slot->len = len;
+        slot->expire = now + (SYS_TIME_T)ticket->ttl * 1000;
+        slot->used = now;
+        sg_atop_cache.stats.stored++;
+        if (ticket->persist && OPRT_OK == tal_time_check_time_sync()) {
+            slot->expire_posix = tal_time_get_posix() + ticket->ttl;
+            record = __record_make(slot, &record_len);
+            gen = slot->gen;
+        }
+    }
+    __slot_fetched(slot);
+    tal_mutex_unlock(sg_atop_cache.mutex);
+    if (record) {
+        __record_save(ticket->slot, gen, record, record_len);
+    }
+    ticket->slot = -1;
+}
+
+/**
+ * @brief end a fetch, the requests waiting for it make their own if nothing
+ * was stored
+ */
+void atop_cache_release(atop_cache_ticket_t *ticket)
+{
+    if (NULL == ticket || ticket->slot < 0) {
+        return;
+    }
+
+    tal_mutex_lock(sg_atop_cache.mutex);
+    __slot_fetched(&sg_atop_cache.slot[ticket->slot]);
+    tal_mutex_unlock(sg_atop_cache.mutex);
+    ticket->slot = -1;
+}
+
+/**
+ * @brief drop the response of key, in RAM and in tal_kv, for one found not to
+ * be usable, the next atop_cache_get of key fetches it again
+ */
+void atop_cache_invalidate(const atop_cache_key_t *key)
+{
+    char name[ATOP_CACHE_KEY_LEN];
+    uint8_t digest[ATOP_CACHE_DIGEST_LEN];
+    uint32_t map = 0;
+    int idx = -1;
+
+    if (NULL == sg_atop_cache.mutex || NULL == key || NULL == key->api || (NULL == key->params && key->params_len)) {
+        return;
+    }
+    if (OPRT_OK != __key_digest(key, digest)) {
+        return;
+    }
+
+    tal_mutex_lock(sg_atop_cache.kv_mutex);
+    tal_mutex_lock(sg_atop_cache.mutex);
+    atop_cache_slot_t *slot = __slot_find(digest);
+    if (slot && !slot->fetching) {
+        __slot_empty(slot);
+        if (sg_atop_cache.persisted & (1u << (slot - sg_atop_cache.slot))) {
+            idx = slot - sg_atop_cache.slot;
+            sg_atop_cache.persisted &= ~(1u << idx);
+            map = sg_atop_cache.persisted;
+        }
+    }
+    tal_mutex_unlock(sg_atop_cache.mutex);
+
+    if (idx >= 0) {
+        snprintf(name, sizeof(name), ATOP_CACHE_KEY, (unsigned int)idx);
+        tal_kv_del(name);
+        __map_save(map);
+    }
+    tal_mutex_unlock(sg_atop_cache.kv_mutex);
+}
+
+/**
+ * @brief drop all the responses, in RAM and in tal_kv
+ */
+void atop_cache_clear(void)
+{
+    char key[ATOP_CACHE_KEY_LEN];
+    uint32_t persisted = 0;
+
+    if (NULL == sg_atop_cache.mutex) {
+        return;
+    }
+
+    tal_mutex_lock(sg_atop_cache.kv_mutex);
+    tal_mutex_lock(sg_atop_cache.mutex);
+    for (int i = 0; i < ATOP_CACHE_NUM; i++) {
+        __slot_empty(&sg_atop_cache.slot[i]);
+    }
+    persisted = sg_atop_cache.persisted;
+    sg_atop_cache.persisted = 0;
+    tal_mutex_unlock(sg_atop_cache.mutex);
+
+    for (int i = 0; i < ATOP_CACHE_NUM; i++) {
+        if (persisted & (1u << i)) {
+            snprintf(key, sizeof(key), ATOP_CACHE_KEY, (unsigned int)i);
+            tal_kv_del(key);
+        }
+    }
+    if (persisted) {
+        tal_kv_del(ATOP_CACHE_MAP_KEY);
+    }
+    tal_mutex_unlock(sg_atop_cache.kv_mutex);
+}
+
+/**
+ * @brief copy the counters
+ */
+void atop_cache_stats(atop_cache_stats_t *stats)
+{
+    if (NULL == stats) {
+        return;
+    }
+    if (NULL == sg_atop_cache.mutex) {
+        memset(stats, 0, sizeof(atop_cache_stats_t));
+        return;
+    }
+
+    tal_mutex_lock(sg_atop_cache.mutex);
+    *stats = sg_atop_cache.stats;
+    tal_mutex_unlock(sg_atop_cache.mutex);
+}
+
+#endif
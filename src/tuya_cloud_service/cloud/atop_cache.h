@@ -0,0 +1,111 @@
+/**
+ * @file atop_cache.h
+ * @brief TTL cache of the responses of the cloud query APIs.
+ *
+ * With ENABLE_ATOP_CACHE, a request that asks for it is answered from a
+ * response cached less than its TTL ago instead of going to the cloud. The
+ * responses are keyed by api, version, device and request params, the params
+ * are compared as JSON with their members sorted and without the top level
+ * "t", so two requests that only differ in their timestamp share a response.
+ *
+ * A request made while the same one is being fetched waits for that fetch
+ * and shares its response. Responses asked to persist are also written
+ * through tal_kv and are used again after a reboot until their TTL is over.
+ *
+ * atop_base_request caches the requests with a cache_ttl, other HTTP query
+ * APIs use atop_cache_get and atop_cache_put around their own request.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef __ATOP_CACHE_H__
+#define __ATOP_CACHE_H__
+
+#include "tuya_cloud_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char *api;
+    const char *version; // NULL if the api has none
+    const char *id;      // device the response is for, NULL if it is the same for all
+    const void *params;
+    size_t params_len;
+    uint32_t ttl;        // seconds the response is used for, 0 not cached
+    bool persist;        // also keep the response through a reboot
+} atop_cache_key_t;
+
+/**
+ * @brief fetch of a response not in the cache, hand it to atop_cache_put and
+ * release it with atop_cache_release
+ */
+typedef struct {
+    int slot; // slot to store the response in, -1 if it is not cached
+    uint32_t ttl;
+    bool persist;
+} atop_cache_ticket_t;
+
+typedef struct {
+    uint32_t hits;      // requests answered from the cache
+    uint32_t coalesced; // requests that waited for the same one in flight, counted in hits too
+    uint32_t misses;    // requests that went to the cloud
+    uint32_t stored;    // responses put in the cache
+} atop_cache_stats_t;
+
+/**
+ * @brief init the cache and load the responses saved before a reboot
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int atop_cache_init(void);
+
+/**
+ * @brief look a response up, waiting for the fetch of the same request if one
+ * is in flight
+ *
+ * @param[in] key request
+ * @param[out] ticket fetch to make on a miss, always to be released
+ * @param[out] data copy of the response on a hit, null terminated, to be
+ * freed with tal_free
+ * @param[out] len length of the response
+ *
+ * @return OPRT_OK on a hit, OPRT_NOT_FOUND if the response is to be fetched
+ */
+int atop_cache_get(const atop_cache_key_t *key, atop_cache_ticket_t *ticket, uint8_t **data, size_t *len);
+
+/**
+ * @brief store the response of a fetch and hand it to the requests waiting
+ * for it, only successful responses are to be stored
+ */
+void atop_cache_put(atop_cache_ticket_t *ticket, const uint8_t *data, size_t len);
+
+/**
+ * @brief end a fetch, the requests waiting for it make their own if nothing
+ * was stored
+ */
+void atop_cache_release(atop_cache_ticket_t *ticket);
+
+/**
+ * @brief drop the response of key, in RAM and in tal_kv, for one found not to
+ * be usable, the next atop_cache_get of key fetches it again
+ */
+void atop_cache_invalidate(const atop_cache_key_t *key);
+
+/**
+ * @brief drop all the responses, in RAM and in tal_kv
+ */
+void atop_cache_clear(void);
+
+/**
+ * @brief copy the counters
+ */
+void atop_cache_stats(atop_cache_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ATOP_CACHE_H__ */
@@ -622,6 +622,82 @@ int atop_service_version_update_v41(const char *id, const char *key, const char
     return rt;
 }
 
+/**
+ * @brief Updates the versions of a device and gets its auto upgrade info.
+ *
+ * Both calls go in one atop_base_batch_request, the callbacks are called with
+ * their responses.
+ *
+ * @param id The device ID.
+ * @param key The device key.
+ * @param versions The new version to be updated.
+ * @param version_cb Callback of the version update.
+ * @param upgrade_cb Callback of the auto upgrade information.
+ * @param user_data User data passed to the callbacks.
+ * @return Returns OPRT_INVALID_PARM if any of the input parameters are NULL.
+ *         Returns OPRT_MALLOC_FAILED if memory allocation fails.
+ *         Returns the result code of the batch request.
+ */
+int atop_service_version_update_upgrade_get(const char *id, const char *key, const char *versions,
+                                            atop_base_response_cb_t version_cb, atop_base_response_cb_t upgrade_cb,
+                                            void *user_data)
+{
+    if (NULL == id || NULL == key || NULL == versions) {
+        return OPRT_INVALID_PARM;
+    }
+
+    int rt = OPRT_OK;
+
+    /* post data */
+    size_t version_len = 0;
+    char *version_buffer = tal_malloc(UPDATE_VERSION_BUFFER_LEN);
+    if (NULL == version_buffer) {
+        PR_ERR("post buffer malloc fail");
+        return OPRT_MALLOC_FAILED;
+    }
+
+    uint32_t timestamp = tal_time_get_posix();
+    version_len = snprintf(version_buffer, UPDATE_VERSION_BUFFER_LEN, "{\"versions\":\"%s\",\"t\":%" PRIu32 "}",
+                           versions, timestamp);
+    PR_DEBUG("POST JSON:%s", version_buffer);
+
+    char upgrade_buffer[48];
+    size_t upgrade_len =
+        snprintf(upgrade_buffer, sizeof(upgrade_buffer), "{\"subId\":null,\"t\":%" PRIu32 "}", timestamp);
+
+    atop_base_batch_call_t calls[] = {
+        {
+            .api = "tuya.device.versions.update",
+            .version = "4.1",
+            .data = version_buffer,
+            .datalen = version_len,
+            .cb = version_cb,
+            .user_data = user_data,
+        },
+        {
+            .api = "tuya.device.upgrade.silent.get",
+            .version = "4.4",
+            .data = upgrade_buffer,
+            .datalen = upgrade_len,
+            .cb = upgrade_cb,
+            .user_data = user_data,
+        },
+    };
+
+    /* ATOP service batch request send */
+    rt = atop_base_batch_request(&(const atop_base_request_t){.devid = id,
+                                                              .key = key,
+                                                              .path = "/d.json",
+                                                              .timestamp = timestamp},
+                                 calls, sizeof(calls) / sizeof(calls[0]));
+    tal_free(version_buffer);
+    if (OPRT_OK != rt) {
+        PR_ERR("atop_base_batch_request error:%d", rt);
+    }
+
+    return rt;
+}
+
 /**
  * @brief Sends a request to put a reset log to the ATOP service.
  *
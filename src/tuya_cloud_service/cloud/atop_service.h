@@ -142,6 +142,22 @@ int atop_service_upgrade_status_update_v41(const char *id, const char *key, int
  */
 int atop_service_version_update_v41(const char *id, const char *key, const char *versions);
 
+/**
+ * @brief Updates the version information of a device and retrieves its auto
+ * upgrade information in one batch request.
+ *
+ * @param id The device ID.
+ * @param key The device key.
+ * @param versions The updated version information.
+ * @param version_cb Called with the response to the version update.
+ * @param upgrade_cb Called with the auto upgrade information.
+ * @param user_data User data passed to the callbacks.
+ * @return OPRT_OK if the request was answered, others on error.
+ */
+int atop_service_version_update_upgrade_get(const char *id, const char *key, const char *versions,
+                                            atop_base_response_cb_t version_cb, atop_base_response_cb_t upgrade_cb,
+                                            void *user_data);
+
 /**
  * @brief Retrieves auto upgrade information for a service.
  *
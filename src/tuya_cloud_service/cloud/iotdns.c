@@ -29,6 +29,7 @@
 #include "http_client_interface.h"
 #include "tuya_register_center.h"
 #include "mix_method.h"
+#include "atop_cache.h"
 
 #define IOTDNS_REQUEST_FMT                                                                                             \
     "{\"config\":[{\"key\":\"httpsSelfUrl\",\"need_ca\":true},{\"key\":"                                               \
@@ -38,6 +39,10 @@
     "{\"config\":[{\"key\":\"httpsSelfUrl\",\"need_ca\":true},{\"key\":"                                               \
     "\"mqttsSelfUrl\",\"need_ca\":true}],\"env\":\"%s\"}"
 
+#define IOTDNS_QUERY_PATH "/device/dns_query"
+// seconds the certs of a host are answered from the cache, also through a reboot
+#define IOTDNS_CERT_CACHE_TTL (24 * 60 * 60)
+
 static int iotdns_response_decode(const uint8_t *input, size_t ilen, tuya_endpoint_t *endport)
 {
     cJSON *root = cJSON_Parse((const char *)input);
@@ -256,7 +261,7 @@ static int iotdns_query_domain_certs_parser(const uint8_t *input, uint8_t **cace
         goto __exit;
     }
     cJSON *ca = cJSON_GetObjectItem(item, "ca");
-    if (item == NULL) {
+    if (NULL == ca || NULL == ca->valuestring) {
         rt = OPRT_CJSON_GET_ERR;
         goto __exit;
     }
@@ -309,14 +314,49 @@ int tuya_iotdns_query_host_certs(char *host, uint16_t port, uint8_t **cacert, ui
 
     http_client_response_t http_response;
 
-    int rt = iotdns_base_request(body_buffer, "/device/dns_query", &http_response);
+#if defined(ENABLE_ATOP_CACHE) && (ENABLE_ATOP_CACHE == 1)
+    atop_cache_ticket_t ticket;
+    uint8_t *cached = NULL;
+    size_t cached_len = 0;
+    const atop_cache_key_t cache_key = {.api = IOTDNS_QUERY_PATH,
+                                        .params = body_buffer,
+                                        .params_len = strlen(body_buffer),
+                                        .ttl = IOTDNS_CERT_CACHE_TTL,
+                                        .persist = true};
+    if (OPRT_OK == atop_cache_get(&cache_key, &ticket, &cached, &cached_len)) {
+        int rt = iotdns_query_domain_certs_parser(cached, cacert, cacert_len);
+        tal_free(cached);
+        if (OPRT_OK == rt) {
+            tal_free(body_buffer);
+            return OPRT_OK;
+        }
+        /* a record saved by an older firmware may not parse, drop it and ask
+         * the cloud with a ticket, so the answer replaces it */
+        PR_WARN("iotdns cached certs parse fail:%d", rt);
+        atop_cache_invalidate(&cache_key);
+        if (OPRT_OK == atop_cache_get(&cache_key, &ticket, &cached, &cached_len)) {
+            /* stored again meanwhile, the cloud is asked anyway */
+            tal_free(cached);
+        }
+    }
+#endif
+
+    int rt = iotdns_base_request(body_buffer, IOTDNS_QUERY_PATH, &http_response);
     tal_free(body_buffer);
     if (OPRT_OK == rt) {
         rt = iotdns_query_domain_certs_parser(http_response.body, cacert, cacert_len);
+#if defined(ENABLE_ATOP_CACHE) && (ENABLE_ATOP_CACHE == 1)
+        if (OPRT_OK == rt) {
+            atop_cache_put(&ticket, http_response.body, http_response.body_length);
+        }
+#endif
         http_client_free(&http_response);
     }
+#if defined(ENABLE_ATOP_CACHE) && (ENABLE_ATOP_CACHE == 1)
+    atop_cache_release(&ticket);
+#endif
 
-    return OPRT_OK;
+    return rt;
 }
 
 /**
@@ -79,51 +79,39 @@ static OPERATE_RET __mqbind_link_activete_cb(void *data)
 
 static void mqtt_bind_activate_token_on(tuya_protocol_event_t *ev)
 {
-    cJSON *data = (cJSON *)(ev->data);
     mqtt_bind_t *mqbind = (mqtt_bind_t *)(ev->user_data);
+    json_scan_value_t token, region, regist_key;
+    tuya_binding_info_t binding;
 
-    if (NULL == cJSON_GetObjectItem(data, "token")) {
+    if (OPRT_OK != json_scan_find(&ev->raw, "token", &token)) {
         PR_ERR("not found token");
         return;
     }
 
-    if (NULL == cJSON_GetObjectItem(data, "region")) {
+    if (OPRT_OK != json_scan_find(&ev->raw, "region", &region)) {
         PR_ERR("not found region");
         return;
     }
 
-    /* get token from cJSON object */
-    char *token = cJSON_GetObjectItem(data, "token")->valuestring;
-    char *region = cJSON_GetObjectItem(data, "region")->valuestring;
-    char *regist_key = "pro"; // online env default
-
-    if (cJSON_GetObjectItem(data, "env")) {
-        regist_key = cJSON_GetObjectItem(data, "env")->valuestring;
-    }
+    memset(&binding, 0, sizeof(tuya_binding_info_t));
 
-    if (strlen(token) > MAX_LENGTH_TOKEN) {
+    /* copy the strings out of the message, a value too long does not fit */
+    if (OPRT_OK != json_scan_string(&token, binding.token, sizeof(binding.token))) {
         PR_ERR("token length error");
         return;
     }
 
-    if (strlen(region) > MAX_LENGTH_REGION) {
+    if (OPRT_OK != json_scan_string(&region, binding.region, sizeof(binding.region))) {
         PR_ERR("region length error");
         return;
     }
 
-    if (strlen(regist_key) > MAX_LENGTH_REGIST) {
+    if (OPRT_OK != json_scan_find(&ev->raw, "env", &regist_key)) {
+        strcpy(binding.regist_key, "pro"); // online env default
+    } else if (OPRT_OK != json_scan_string(&regist_key, binding.regist_key, sizeof(binding.regist_key))) {
         PR_ERR("regist_key length error");
         return;
     }
-    tuya_binding_info_t binding;
-
-    memset(&binding, 0, sizeof(tuya_binding_info_t));
-    strncpy(binding.token, token, sizeof(binding.token) - 1);
-    binding.token[sizeof(binding.token) - 1] = '\0';
-    strncpy(binding.region, region, sizeof(binding.region) - 1);
-    binding.region[sizeof(binding.region) - 1] = '\0';
-    strncpy(binding.regist_key, regist_key, sizeof(binding.regist_key) - 1);
-    binding.regist_key[sizeof(binding.regist_key) - 1] = '\0';
 
     tal_event_unsubscribe(EVENT_LINK_ACTIVATE, "mqbind", __mqbind_link_activete_cb);
     tal_event_publish(EVENT_LINK_ACTIVATE, &binding);
@@ -183,7 +171,8 @@ void mqtt_bind_token_get_thread(void *args)
                 continue;
             }
             /* register token callback */
-            tuya_mqtt_protocol_register(&mqbind->mqctx, PRO_MQ_ACTIVE_TOKEN_ON, mqtt_bind_activate_token_on, mqbind);
+            tuya_mqtt_protocol_register_raw(&mqbind->mqctx, PRO_MQ_ACTIVE_TOKEN_ON, mqtt_bind_activate_token_on,
+                                            mqbind);
             mqbind->state = STATE_MQTT_BIND_CONNECT;
             break;
         }
@@ -0,0 +1,365 @@
+/**
+ * @file mqtt_publish_queue.c
+ * @brief Tracking of the QoS1 publishes the MQTT service waits a PUBACK for.
+ *
+ * A publish is in the deadline heap from mqtt_publish_queue_add until it is
+ * acknowledged or expires, heap_index lets a PUBACK remove it in O(log n).
+ * Until it is sent it is also on the pending FIFO, after that it is in the
+ * msgid hash map. Packet ids are handed out in sequence, so msgid masked by
+ * the bucket count spreads them evenly; the map doubles when it holds more
+ * publishes than buckets.
+ *
+ * Publishes are added from the callers of tuya_mqtt_client_publish_common
+ * and taken out by tuya_mqtt_loop, the mutex only covers the queue and is
+ * never held while a cb or the MQTT client runs.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <string.h>
+
+#include "tuya_error_code.h"
+#include "tal_api.h"
+#include "mqtt_publish_queue.h"
+
+/***********************************************************
+*************************micro define***********************
+***********************************************************/
+#define PUBLISH_QUEUE_SIZE_MIN 8
+
+/***********************************************************
+*************************variable define********************
+***********************************************************/
+static const uint32_t sg_latency_bounds[MQTT_PUBLISH_LATENCY_BUCKETS - 1] = MQTT_PUBLISH_LATENCY_BOUNDS;
+
+/***********************************************************
+*************************function define********************
+***********************************************************/
+static void __heap_set(mqtt_publish_queue_t *queue, uint32_t i, mqtt_publish_handle_t *handle)
+{
+    queue->heap[i] = handle;
+    handle->heap_index = i;
+}
+
+static void __heap_up(mqtt_publish_queue_t *queue, uint32_t i)
+{
+    mqtt_publish_handle_t *handle = queue->heap[i];
+
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (queue->heap[parent]->timeout <= handle->timeout) {
+            break;
+        }
+        __heap_set(queue, i, queue->heap[parent]);
+        i = parent;
+    }
+    __heap_set(queue, i, handle);
+}
+
+static void __heap_down(mqtt_publish_queue_t *queue, uint32_t i)
+{
+    mqtt_publish_handle_t *handle = queue->heap[i];
+
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= queue->heap_size) {
+            break;
+        }
+        if (child + 1 < queue->heap_size && queue->heap[child + 1]->timeout < queue->heap[child]->timeout) {
+            child++;
+        }
+        if (handle->timeout <= queue->heap[child]->timeout) {
+            break;
+        }
+        __heap_set(queue, i, queue->heap[child]);
+        i = child;
+    }
+    __heap_set(queue, i, handle);
+}
+
+static int __heap_push(mqtt_publish_queue_t *queue, mqtt_publish_handle_t *handle)
+{
+    if (queue->heap_size == queue->heap_cap) {
+        uint32_t cap = queue->heap_cap ? queue->heap_cap * 2 : PUBLISH_QUEUE_SIZE_MIN;
+        mqtt_publish_handle_t **heap = tal_malloc(cap * sizeof(mqtt_publish_handle_t *));
+        if (NULL == heap) {
+            return OPRT_MALLOC_FAILED;
+        }
+        if (queue->heap_size) {
+            memcpy(heap, queue->heap, queue->heap_size * sizeof(mqtt_publish_handle_t *));
+        }
+        tal_free(queue->heap);
+        queue->heap = heap;
+        queue->heap_cap = cap;
+    }
+
+    queue->heap[queue->heap_size] = handle;
+    __heap_up(queue, queue->heap_size++);
+
+    return OPRT_OK;
+}
+
+static void __heap_remove(mqtt_publish_queue_t *queue, mqtt_publish_handle_t *handle)
+{
+    uint32_t i = handle->heap_index;
+    mqtt_publish_handle_t *last = queue->heap[--queue->heap_size];
+
+    if (last == handle) {
+        return;
+    }
+
+    __heap_set(queue, i, last);
+    if (i > 0 && queue->heap[(i - 1) / 2]->timeout > last->timeout) {
+        __heap_up(queue, i);
+    } else {
+        __heap_down(queue, i);
+    }
+}
+
+static void __bucket_grow(mqtt_publish_queue_t *queue)
+{
+    uint32_t bucket_num = queue->bucket_num ? queue->bucket_num * 2 : PUBLISH_QUEUE_SIZE_MIN;
+    mqtt_publish_handle_t **bucket = tal_calloc(bucket_num, sizeof(mqtt_publish_handle_t *));
+    uint32_t i;
+
+    // keep the old map if there is no memory, the chains just get longer
+    if (NULL == bucket) {
+        return;
+    }
+
+    for (i = 0; i < queue->bucket_num; i++) {
+        while (queue->bucket[i]) {
+            mqtt_publish_handle_t *handle = queue->bucket[i];
+            queue->bucket[i] = handle->next;
+            handle->next = bucket[handle->msgid & (bucket_num - 1)];
+            bucket[handle->msgid & (bucket_num - 1)] = handle;
+        }
+    }
+
+    tal_free(queue->bucket);
+    queue->bucket = bucket;
+    queue->bucket_num = bucket_num;
+}
+
+static void __bucket_insert(mqtt_publish_queue_t *queue, mqtt_publish_handle_t *handle)
+{
+    mqtt_publish_handle_t **head = NULL;
+
+    if (queue->stats.inflight >= queue->bucket_num) {
+        __bucket_grow(queue);
+    }
+    // bucket_num is not 0, mqtt_publish_queue_init allocated the first map
+    head = &queue->bucket[handle->msgid & (queue->bucket_num - 1)];
+    handle->next = *head;
+    *head = handle;
+    queue->stats.inflight++;
+}
+
+static mqtt_publish_handle_t **__bucket_find(mqtt_publish_queue_t *queue, uint16_t msgid)
+{
+    mqtt_publish_handle_t **pp = &queue->bucket[msgid & (queue->bucket_num - 1)];
+
+    for (; *pp; pp = &(*pp)->next) {
+        if ((*pp)->msgid == msgid) {
+            break;
+        }
+    }
+
+    return pp;
+}
+
+/* unlink from the FIFO or the map, the heap is left to the caller */
+static void __queue_unlink(mqtt_publish_queue_t *queue, mqtt_publish_handle_t *handle)
+{
+    if (0 == handle->msgid) {
+        tuya_list_del(&handle->pending);
+        queue->stats.pending--;
+        return;
+    }
+
+    mqtt_publish_handle_t **pp = __bucket_find(queue, handle->msgid);
+    while (*pp && *pp != handle) {
+        pp = &(*pp)->next;
+    }
+    if (*pp) {
+        *pp = handle->next;
+        queue->stats.inflight--;
+    }
+}
+
+/**
+ * @brief init the queue
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int mqtt_publish_queue_init(mqtt_publish_queue_t *queue)
+{
+    OPERATE_RET rt = OPRT_OK;
+
+    memset(queue, 0, sizeof(mqtt_publish_queue_t));
+    INIT_LIST_HEAD(&queue->pending);
+
+    __bucket_grow(queue);
+    if (0 == queue->bucket_num) {
+        return OPRT_MALLOC_FAILED;
+    }
+
+    TUYA_CALL_ERR_GOTO(tal_mutex_create_init(&queue->mutex), __EXIT);
+
+    return OPRT_OK;
+
+__EXIT:
+    tal_free(queue->bucket);
+    queue->bucket = NULL;
+    queue->bucket_num = 0;
+    return rt;
+}
+
+/**
+ * @brief add a publish, sent if msgid is set, pending otherwise
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int mqtt_publish_queue_add(mqtt_publish_queue_t *queue, mqtt_publish_handle_t *handle)
+{
+    OPERATE_RET rt = OPRT_OK;
+
+    tal_mutex_lock(queue->mutex);
+    rt = __heap_push(queue, handle);
+    if (OPRT_OK == rt) {
+        if (handle->msgid) {
+            __bucket_insert(queue, handle);
+        } else {
+            tuya_list_add_tail(&handle->pending, &queue->pending);
+            queue->stats.pending++;
+        }
+    }
+    tal_mutex_unlock(queue->mutex);
+
+    return rt;
+}
+
+/**
+ * @brief take out the publish acknowledged by msgid
+ *
+ * @return the handle, NULL if msgid is not in flight
+ */
+mqtt_publish_handle_t *mqtt_publish_queue_ack(mqtt_publish_queue_t *queue, uint16_t msgid, SYS_TIME_T now)
+{
+    mqtt_publish_handle_t *handle = NULL;
+    uint32_t i;
+
+    if (0 == msgid) {
+        return NULL;
+    }
+
+    tal_mutex_lock(queue->mutex);
+    mqtt_publish_handle_t **pp = __bucket_find(queue, msgid);
+    handle = *pp;
+    if (handle) {
+        *pp = handle->next;
+        queue->stats.inflight--;
+        __heap_remove(queue, handle);
+
+        queue->stats.ack_cnt++;
+        for (i = 0; i < MQTT_PUBLISH_LATENCY_BUCKETS - 1; i++) {
+            if (now - handle->sent < sg_latency_bounds[i]) {
+                break;
+            }
+        }
+        queue->stats.latency[i]++;
+    }
+    tal_mutex_unlock(queue->mutex);
+
+    return handle;
+}
+
+/**
+ * @brief take out the publish with the earliest deadline if it is not after now
+ *
+ * @return the handle, NULL if no deadline has passed
+ */
+mqtt_publish_handle_t *mqtt_publish_queue_expire(mqtt_publish_queue_t *queue, SYS_TIME_T now)
+{
+    mqtt_publish_handle_t *handle = NULL;
+
+    tal_mutex_lock(queue->mutex);
+    if (queue->heap_size && queue->heap[0]->timeout <= now) {
+        handle = queue->heap[0];
+        __heap_remove(queue, handle);
+        __queue_unlink(queue, handle);
+        queue->stats.timeout_cnt++;
+    }
+    tal_mutex_unlock(queue->mutex);
+
+    return handle;
+}
+
+/**
+ * @brief oldest publish not sent yet, it stays in the queue
+ *
+ * @return the handle, NULL if all publishes are sent
+ */
+mqtt_publish_handle_t *mqtt_publish_queue_pending(mqtt_publish_queue_t *queue)
+{
+    mqtt_publish_handle_t *handle = NULL;
+
+    tal_mutex_lock(queue->mutex);
+    if (!tuya_list_empty(&queue->pending)) {
+        handle = tuya_list_entry(queue->pending.next, mqtt_publish_handle_t, pending);
+    }
+    tal_mutex_unlock(queue->mutex);
+
+    return handle;
+}
+
+/**
+ * @brief record a send of a pending publish, msgid 0 means the send failed
+ */
+void mqtt_publish_queue_sent(mqtt_publish_queue_t *queue, mqtt_publish_handle_t *handle, uint16_t msgid,
+                             SYS_TIME_T now)
+{
+    tal_mutex_lock(queue->mutex);
+    if (handle->attempt++) {
+        queue->stats.retry_cnt++;
+    }
+    if (msgid) {
+        tuya_list_del(&handle->pending);
+        queue->stats.pending--;
+        handle->msgid = msgid;
+        handle->sent = now;
+        __bucket_insert(queue, handle);
+    }
+    tal_mutex_unlock(queue->mutex);
+}
+
+/**
+ * @brief copy the counters
+ */
+void mqtt_publish_queue_stats(mqtt_publish_queue_t *queue, mqtt_publish_stats_t *stats)
+{
+    tal_mutex_lock(queue->mutex);
+    memcpy(stats, &queue->stats, sizeof(mqtt_publish_stats_t));
+    tal_mutex_unlock(queue->mutex);
+}
+
+/**
+ * @brief free every publish without calling its cb, and the queue memory
+ */
+void mqtt_publish_queue_deinit(mqtt_publish_queue_t *queue)
+{
+    uint32_t i;
+
+    for (i = 0; i < queue->heap_size; i++) {
+        tal_free(queue->heap[i]->payload);
+        tal_free(queue->heap[i]);
+    }
+    tal_free(queue->heap);
+    tal_free(queue->bucket);
+    if (queue->mutex) {
+        tal_mutex_release(queue->mutex);
+    }
+    memset(queue, 0, sizeof(mqtt_publish_queue_t));
+    INIT_LIST_HEAD(&queue->pending);
+}
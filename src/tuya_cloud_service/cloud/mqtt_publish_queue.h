@@ -0,0 +1,121 @@
+/**
+ * @file mqtt_publish_queue.h
+ * @brief Tracking of the QoS1 publishes the MQTT service waits a PUBACK for.
+ *
+ * Publishes not sent yet are kept in FIFO order, sent ones in a hash map
+ * keyed by packet id, and all of them in a min-heap ordered by deadline. A
+ * PUBACK, a timeout and a send are each O(1) or O(log n) in the number of
+ * publishes, instead of a walk of every publish.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef __MQTT_PUBLISH_QUEUE_H__
+#define __MQTT_PUBLISH_QUEUE_H__
+
+#include "tuya_cloud_types.h"
+#include "tuya_list.h"
+#include "tal_mutex.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// upper bounds in ms of the ack latency histogram, the last bucket is unbounded
+#define MQTT_PUBLISH_LATENCY_BOUNDS {50, 100, 200, 500, 1000, 2000, 5000}
+#define MQTT_PUBLISH_LATENCY_BUCKETS 8
+
+typedef void (*mqtt_publish_notify_cb_t)(int result, void *user_data);
+
+typedef struct mqtt_publish_handle {
+    struct mqtt_publish_handle *next; // hash chain once sent
+    LIST_HEAD pending;                // FIFO node until sent
+    uint16_t msgid;
+    uint16_t attempt;
+    uint32_t heap_index;
+    SYS_TIME_T timeout; // deadline, ms
+    SYS_TIME_T sent;    // time of the last send, ms
+    char *topic;
+    uint8_t *payload;
+    size_t payload_length;
+    mqtt_publish_notify_cb_t cb;
+    void *user_data;
+} mqtt_publish_handle_t;
+
+typedef struct {
+    uint32_t inflight;    // sent, waiting for the PUBACK
+    uint32_t pending;     // not sent yet
+    uint32_t ack_cnt;     // PUBACK received
+    uint32_t timeout_cnt; // no PUBACK before the deadline
+    uint32_t retry_cnt;   // sends after the first failed one
+    uint32_t latency[MQTT_PUBLISH_LATENCY_BUCKETS]; // send to PUBACK
+} mqtt_publish_stats_t;
+
+typedef struct {
+    MUTEX_HANDLE mutex;
+    LIST_HEAD pending;
+    mqtt_publish_handle_t **bucket; // sent, by msgid
+    uint32_t bucket_num;            // power of two
+    mqtt_publish_handle_t **heap;   // all, by deadline
+    uint32_t heap_size;
+    uint32_t heap_cap;
+    mqtt_publish_stats_t stats;
+} mqtt_publish_queue_t;
+
+/**
+ * @brief init the queue
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int mqtt_publish_queue_init(mqtt_publish_queue_t *queue);
+
+/**
+ * @brief add a publish, sent if msgid is set, pending otherwise
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int mqtt_publish_queue_add(mqtt_publish_queue_t *queue, mqtt_publish_handle_t *handle);
+
+/**
+ * @brief take out the publish acknowledged by msgid
+ *
+ * @return the handle, NULL if msgid is not in flight
+ */
+mqtt_publish_handle_t *mqtt_publish_queue_ack(mqtt_publish_queue_t *queue, uint16_t msgid, SYS_TIME_T now);
+
+/**
+ * @brief take out the publish with the earliest deadline if it is not after now
+ *
+ * @return the handle, NULL if no deadline has passed
+ */
+mqtt_publish_handle_t *mqtt_publish_queue_expire(mqtt_publish_queue_t *queue, SYS_TIME_T now);
+
+/**
+ * @brief oldest publish not sent yet, it stays in the queue
+ *
+ * @return the handle, NULL if all publishes are sent
+ */
+mqtt_publish_handle_t *mqtt_publish_queue_pending(mqtt_publish_queue_t *queue);
+
+/**
+ * @brief record a send of a pending publish, msgid 0 means the send failed
+ */
+void mqtt_publish_queue_sent(mqtt_publish_queue_t *queue, mqtt_publish_handle_t *handle, uint16_t msgid,
+                             SYS_TIME_T now);
+
+/**
+ * @brief copy the counters
+ */
+void mqtt_publish_queue_stats(mqtt_publish_queue_t *queue, mqtt_publish_stats_t *stats);
+
+/**
+ * @brief free every publish without calling its cb, and the queue memory
+ */
+void mqtt_publish_queue_deinit(mqtt_publish_queue_t *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MQTT_PUBLISH_QUEUE_H__ */
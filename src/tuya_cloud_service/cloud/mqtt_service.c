@@ -120,41 +120,24 @@ int tuya_mqtt_subscribe_message_callback_register(tuya_mqtt_context_t *context,
         return OPRT_COM_ERROR;
     }
 
-    /* Repetition filter */
-    mqtt_subscribe_handle_t *target = context->subscribe_list;
-    while (target) {
-        if (!memcmp(target->topic, topic, target->topic_length) && target->cb == cb) {
-            PR_WARN("Repetition:%s", topic);
-            return OPRT_OK;
-        }
-        target = target->next;
-    }
-
-    /* Intser new handle */
-    mqtt_subscribe_handle_t *newtarget = tal_calloc(1, sizeof(mqtt_subscribe_handle_t));
-    if (!newtarget) {
-        PR_ERR("malloc error");
-        return OPRT_MALLOC_FAILED;
+    if (NULL == cb) {
+        cb = on_subscribe_message_default;
     }
 
-    newtarget->topic_length = strlen(topic);
-    newtarget->topic = tal_calloc(1, newtarget->topic_length + 1);
-    if (!newtarget->topic) {
-        tal_free(newtarget);
-        return OPRT_MALLOC_FAILED;
+    /* Repetition filter */
+    if (mqtt_subscribe_index_find(&context->subscribe_index, topic, cb)) {
+        PR_WARN("Repetition:%s", topic);
+        return OPRT_OK;
     }
-    memcpy(newtarget->topic, topic, newtarget->topic_length);
 
-    if (cb) {
-        newtarget->cb = cb;
-    } else {
-        newtarget->cb = on_subscribe_message_default;
-    }
-    newtarget->userdata = userdata;
     /* LOCK */
-    newtarget->next = context->subscribe_list;
-    context->subscribe_list = newtarget;
+    int rt = mqtt_subscribe_index_add(&context->subscribe_index, topic, cb, userdata);
     /* UNLOCK */
+    if (OPRT_OK != rt) {
+        PR_ERR("malloc error");
+        return rt;
+    }
+
     return OPRT_OK;
 }
 
@@ -177,21 +160,8 @@ int tuya_mqtt_subscribe_message_callback_unregister(tuya_mqtt_context_t *context
         return OPRT_INVALID_PARM;
     }
 
-    size_t topic_length = strlen(topic);
-
     /* LOCK */
-    /* Remove object form list */
-    mqtt_subscribe_handle_t **target = &context->subscribe_list;
-    while (*target) {
-        mqtt_subscribe_handle_t *entry = *target;
-        if (entry->topic_length == topic_length && !memcmp(topic, entry->topic, topic_length)) {
-            *target = entry->next;
-            tal_free(entry->topic);
-            tal_free(entry);
-        } else {
-            target = &entry->next;
-        }
-    }
+    mqtt_subscribe_index_remove(&context->subscribe_index, topic);
     /* UNLOCK */
 
     uint16_t msgid = mqtt_client_unsubscribe(context->mqtt_client, topic, MQTT_QOS_1);
@@ -205,22 +175,41 @@ int tuya_mqtt_subscribe_message_callback_unregister(tuya_mqtt_context_t *context
 static void mqtt_subscribe_message_distribute(tuya_mqtt_context_t *context, uint16_t msgid,
                                               const mqtt_client_message_t *msg)
 {
-    const char *topic = msg->topic;
-    size_t topic_length = strlen(msg->topic);
-
     /* LOCK */
-    mqtt_subscribe_handle_t *target = context->subscribe_list;
-    for (; target; target = target->next) {
-        if (target->topic_length == topic_length && !memcmp(topic, target->topic, target->topic_length)) {
-            target->cb(msgid, msg, target->userdata);
-        }
-    }
+    mqtt_subscribe_index_dispatch(&context->subscribe_index, msgid, msg);
     /* UNLOCK */
 }
 
 /* -------------------------------------------------------------------------- */
 /*                       Tuya internal subscribe message                      */
 /* -------------------------------------------------------------------------- */
+/**
+ * @brief Parses the message of a protocol event into a cJSON tree on demand.
+ *
+ * The tree is parsed once per message, kept in event->root_json and
+ * event->data, and freed after the last handler returns.
+ *
+ * @param event The event passed to the protocol handler.
+ * @return The root object, or NULL on error.
+ */
+cJSON *tuya_protocol_event_json(tuya_protocol_event_t *event)
+{
+    if (NULL == event || NULL == event->json) {
+        return NULL;
+    }
+
+    if (NULL == event->root_json) {
+        event->root_json = cJSON_Parse(event->json);
+        if (NULL == event->root_json) {
+            PR_ERR("JSON parse error");
+            return NULL;
+        }
+        event->data = cJSON_GetObjectItem(event->root_json, "data");
+    }
+
+    return event->root_json;
+}
+
 static int tuya_protocol_message_parse_process(tuya_mqtt_context_t *context, const uint8_t *payload, size_t payload_len)
 {
     int ret = OPRT_OK;
@@ -235,49 +224,60 @@ static int tuya_protocol_message_parse_process(tuya_mqtt_context_t *context, con
 
     PR_DEBUG("Data JSON:%s", jsonstr);
 
-    /* json parse */
-    cJSON *root = NULL;
-    cJSON *json = NULL;
-    root = cJSON_Parse((const char *)jsonstr);
-    tal_free(jsonstr);
-    if (NULL == root) {
+    /* scan the top level members in place, the cJSON tree is only built for the handlers needing it */
+    tuya_protocol_event_t event = {0};
+    json_scan_t scan;
+    json_scan_value_t key, value;
+    int protocol_id = -1;
+    bool has_t = false;
+
+    event.json = jsonstr;
+    ret = json_scan_root(jsonstr, strlen(jsonstr), &event.root);
+    if (OPRT_OK == ret) {
+        ret = json_scan_begin(&scan, &event.root);
+    }
+    if (OPRT_OK != ret) {
         PR_ERR("JSON parse error");
+        tal_free(jsonstr);
         return OPRT_CJSON_PARSE_ERR;
     }
+    while (OPRT_OK == json_scan_next(&scan, &key, &value)) {
+        int number = 0;
+        if (json_scan_equal(&key, "protocol")) {
+            json_scan_int(&value, &protocol_id);
+        } else if (json_scan_equal(&key, "t")) {
+            has_t = (OPRT_OK == json_scan_int(&value, &number));
+            event.t = (uint32_t)number;
+        } else if (json_scan_equal(&key, "data")) {
+            event.raw = value;
+        }
+    }
 
     /* JSON key verfiy */
-    if ((NULL == cJSON_GetObjectItem(root, "protocol")) || (NULL == cJSON_GetObjectItem(root, "t")) ||
-        (NULL == cJSON_GetObjectItem(root, "data"))) {
+    if (protocol_id < 0 || !has_t || event.raw.type == JSON_SCAN_INVALID) {
         PR_ERR("param is no correct");
-        cJSON_Delete(root);
-        return OPRT_CJSON_GET_ERR;
-    }
-
-    /* protocol ID */
-    int protocol_id = cJSON_GetObjectItem(root, "protocol")->valueint;
-    json = cJSON_GetObjectItem(root, "data");
-    if (NULL == json) {
-        PR_ERR("get json err");
-        cJSON_Delete(root);
+        tal_free(jsonstr);
         return OPRT_CJSON_GET_ERR;
     }
 
     /* dispatch */
-    tuya_protocol_event_t event;
     event.event_id = protocol_id;
-    event.root_json = root;
-    event.data = cJSON_GetObjectItem(root, "data");
 
     /* LOCK */
-    tuya_protocol_handle_t *target = context->protocol_list;
+    tuya_protocol_handle_t *target = context->protocol_table[protocol_id & (TUYA_MQTT_PROTOCOL_BUCKETS - 1)];
     for (; target; target = target->next) {
-        if (target->id == protocol_id) {
-            event.user_data = target->user_data, target->cb(&event);
+        if (target->id != protocol_id) {
+            continue;
+        }
+        if (!target->raw && NULL == tuya_protocol_event_json(&event)) {
+            break;
         }
+        event.user_data = target->user_data, target->cb(&event);
     }
     /* UNLOCK */
 
-    cJSON_Delete(root);
+    cJSON_Delete(event.root_json);
+    tal_free(jsonstr);
     return OPRT_OK;
 }
 
@@ -342,20 +342,13 @@ static void mqtt_client_puback_cb(void *client, uint16_t msgid, void *userdata)
     tuya_mqtt_context_t *context = (tuya_mqtt_context_t *)userdata;
     PR_DEBUG("PUBACK ID:%d", msgid);
 
-    /* LOCK */
     /* publish async process */
-    mqtt_publish_handle_t **next_handle = &context->publish_list;
-    for (; *next_handle; next_handle = &(*next_handle)->next) {
-        mqtt_publish_handle_t *entry = *next_handle;
-        if (msgid == entry->msgid) {
-            entry->cb(OPRT_OK, entry->user_data);
-            *next_handle = entry->next;
-            tal_free(entry->payload);
-            tal_free(entry);
-            break;
-        }
+    mqtt_publish_handle_t *entry = mqtt_publish_queue_ack(&context->publish_queue, msgid, tal_system_get_millisecond());
+    if (entry) {
+        entry->cb(OPRT_OK, entry->user_data);
+        tal_free(entry->payload);
+        tal_free(entry);
     }
-    /* UNLOCK */
 }
 
 /**
@@ -376,6 +369,12 @@ int tuya_mqtt_init(tuya_mqtt_context_t *context, const tuya_mqtt_config_t *confi
     /* Clean to zero */
     memset(context, 0, sizeof(tuya_mqtt_context_t));
 
+    rt = mqtt_publish_queue_init(&context->publish_queue);
+    if (OPRT_OK != rt) {
+        PR_ERR("mqtt publish queue init error:%d", rt);
+        return rt;
+    }
+
     /* configuration */
     context->user_data = config->user_data;
     context->on_unbind = config->on_unbind;
@@ -516,31 +515,18 @@ int tuya_mqtt_stop(tuya_mqtt_context_t *context)
     return OPRT_OK;
 }
 
-/**
- * @brief Registers a MQTT protocol with the given context.
- *
- * This function registers a MQTT protocol with the specified context. The
- * protocol is identified by the protocol ID. When a message with the registered
- * protocol ID is received, the provided callback function will be called.
- *
- * @param[in] context The MQTT context to register the protocol with.
- * @param[in] protocol_id The ID of the protocol to register.
- * @param[in] cb The callback function to be called when a message with the
- * registered protocol ID is received.
- * @param[in] user_data User data to be passed to the callback function.
- *
- * @return 0 on success, negative error code on failure.
- */
-int tuya_mqtt_protocol_register(tuya_mqtt_context_t *context, uint16_t protocol_id, tuya_protocol_callback_t cb,
-                                void *user_data)
+static int tuya_mqtt_protocol_add(tuya_mqtt_context_t *context, uint16_t protocol_id, tuya_protocol_callback_t cb,
+                                  void *user_data, bool raw)
 {
     if (context == NULL || context->is_inited == false || cb == NULL) {
         return OPRT_INVALID_PARM;
     }
 
+    tuya_protocol_handle_t **bucket = &context->protocol_table[protocol_id & (TUYA_MQTT_PROTOCOL_BUCKETS - 1)];
+
     /* LOCK */
     /* Repetition filter */
-    tuya_protocol_handle_t *target = context->protocol_list;
+    tuya_protocol_handle_t *target = *bucket;
     while (target) {
         if (target->id == protocol_id && target->cb == cb) {
             return OPRT_COM_ERROR;
@@ -555,13 +541,51 @@ int tuya_mqtt_protocol_register(tuya_mqtt_context_t *context, uint16_t protocol_
     new_handle->id = protocol_id;
     new_handle->cb = cb;
     new_handle->user_data = user_data;
-    new_handle->next = context->protocol_list;
-    context->protocol_list = new_handle;
+    new_handle->raw = raw;
+    new_handle->next = *bucket;
+    *bucket = new_handle;
     /* UNLOCK */
 
     return OPRT_OK;
 }
 
+/**
+ * @brief Registers a MQTT protocol with the given context.
+ *
+ * This function registers a MQTT protocol with the specified context. The
+ * protocol is identified by the protocol ID. When a message with the registered
+ * protocol ID is received, the provided callback function will be called.
+ *
+ * @param[in] context The MQTT context to register the protocol with.
+ * @param[in] protocol_id The ID of the protocol to register.
+ * @param[in] cb The callback function to be called when a message with the
+ * registered protocol ID is received.
+ * @param[in] user_data User data to be passed to the callback function.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int tuya_mqtt_protocol_register(tuya_mqtt_context_t *context, uint16_t protocol_id, tuya_protocol_callback_t cb,
+                                void *user_data)
+{
+    return tuya_mqtt_protocol_add(context, protocol_id, cb, user_data, false);
+}
+
+/**
+ * @brief Registers a MQTT protocol handler that reads the message in place.
+ *
+ * @param[in] context Pointer to the MQTT context.
+ * @param[in] protocol_id Protocol ID to register.
+ * @param[in] cb Callback function called with root_json and data left NULL.
+ * @param[in] user_data User data to be passed to the callback function.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int tuya_mqtt_protocol_register_raw(tuya_mqtt_context_t *context, uint16_t protocol_id, tuya_protocol_callback_t cb,
+                                    void *user_data)
+{
+    return tuya_mqtt_protocol_add(context, protocol_id, cb, user_data, true);
+}
+
 /**
  * Unregisters a protocol from the Tuya MQTT service.
  *
@@ -582,7 +606,7 @@ int tuya_mqtt_protocol_unregister(tuya_mqtt_context_t *context, uint16_t protoco
 
     /* LOCK */
     /* Remove object form list */
-    tuya_protocol_handle_t **target = &context->protocol_list;
+    tuya_protocol_handle_t **target = &context->protocol_table[protocol_id & (TUYA_MQTT_PROTOCOL_BUCKETS - 1)];
     while (*target) {
         tuya_protocol_handle_t *entry = *target;
         if (entry->id == protocol_id && entry->cb == cb) {
@@ -615,15 +639,65 @@ int tuya_mqtt_protocol_unregister_all(tuya_mqtt_context_t *context)
     /* LOCK */
     /* Remove object form list */
     tuya_protocol_handle_t *entry = NULL;
-    tuya_protocol_handle_t *target = context->protocol_list;
-    while (target) {
-        entry = target;
-        target = entry->next;
-        tal_free(entry);
+    uint32_t i;
+    for (i = 0; i < TUYA_MQTT_PROTOCOL_BUCKETS; i++) {
+        tuya_protocol_handle_t *target = context->protocol_table[i];
+        while (target) {
+            entry = target;
+            target = entry->next;
+            tal_free(entry);
+        }
+        context->protocol_table[i] = NULL;
     }
     /* UNLOCK */
 
-    context->protocol_list = NULL;
+    return OPRT_OK;
+}
+
+/* payload is a tal_malloc buffer the publish takes over, it is freed here or by the publish queue */
+static int tuya_mqtt_client_publish_buffer(tuya_mqtt_context_t *context, const char *topic, uint8_t *payload,
+                                           size_t payload_length, mqtt_publish_notify_cb_t cb, void *user_data,
+                                           int timeout_ms, bool async)
+{
+    if (topic == NULL || (cb == NULL && async == true)) {
+        tal_free(payload);
+        return OPRT_INVALID_PARM;
+    }
+
+    if (cb == NULL) {
+        uint16_t msgid = mqtt_client_publish(context->mqtt_client, topic, payload, payload_length, MQTT_QOS_0);
+        tal_free(payload);
+        if (msgid <= 0) {
+            return OPRT_COM_ERROR;
+        }
+        return OPRT_OK;
+    }
+
+    mqtt_publish_handle_t *handle = tal_calloc(1, sizeof(mqtt_publish_handle_t));
+    if (NULL == handle) {
+        tal_free(payload);
+        return OPRT_MALLOC_FAILED;
+    }
+    handle->topic = (char *)topic;
+    handle->timeout = tal_system_get_millisecond() + timeout_ms;
+    handle->cb = cb;
+    handle->user_data = user_data;
+    handle->payload = payload;
+    handle->payload_length = payload_length;
+
+    if (async == false) {
+        handle->attempt = 1;
+        handle->sent = tal_system_get_millisecond();
+        handle->msgid = mqtt_client_publish(context->mqtt_client, handle->topic, handle->payload,
+                                            handle->payload_length, MQTT_QOS_1);
+    }
+
+    int rt = mqtt_publish_queue_add(&context->publish_queue, handle);
+    if (OPRT_OK != rt) {
+        tal_free(handle->payload);
+        tal_free(handle);
+        return rt;
+    }
 
     return OPRT_OK;
 }
@@ -659,43 +733,14 @@ int tuya_mqtt_client_publish_common(tuya_mqtt_context_t *context, const char *to
         return OPRT_OK;
     }
 
-    mqtt_publish_handle_t *handle = tal_malloc(sizeof(mqtt_publish_handle_t));
-    TUYA_CHECK_NULL_RETURN(handle, OPRT_MALLOC_FAILED);
-    handle->next = NULL;
-    handle->msgid = 0;
-    handle->topic = (char *)topic;
-    handle->timeout = tal_time_get_posix() + timeout_ms;
-    handle->cb = cb;
-    handle->user_data = user_data;
-    handle->payload_length = payload_length;
+    uint8_t *copy = NULL;
     if (payload_length > 0) {
-        handle->payload = tal_malloc(payload_length);
-        if (handle->payload == NULL) {
-            tal_free(handle);
-            return OPRT_MALLOC_FAILED;
-        }
-        memcpy(handle->payload, payload, payload_length);
-    } else {
-        handle->payload = NULL;
-    }
-
-    if (async == false) {
-        handle->msgid = mqtt_client_publish(context->mqtt_client, handle->topic, handle->payload,
-                                            handle->payload_length, MQTT_QOS_1);
-    }
-
-    if (context->publish_list == NULL) {
-        context->publish_list = handle;
-        return OPRT_OK;
-    }
-
-    mqtt_publish_handle_t *last = context->publish_list;
-    while (last->next != NULL) {
-        last = last->next;
+        copy = tal_malloc(payload_length);
+        TUYA_CHECK_NULL_RETURN(copy, OPRT_MALLOC_FAILED);
+        memcpy(copy, payload, payload_length);
     }
-    last->next = handle;
 
-    return OPRT_OK;
+    return tuya_mqtt_client_publish_buffer(context, topic, copy, payload_length, cb, user_data, timeout_ms, async);
 }
 
 /**
@@ -730,21 +775,23 @@ int tuya_mqtt_protocol_data_publish_with_topic_common(tuya_mqtt_context_t *conte
 
     int ret = OPRT_OK;
 
-    char *buffer = NULL;
+    /* the frame is packed and encrypted in its own buffer, which the publish then keeps */
+    uint32_t size = tuya_pack_protocol_frame_size(DP_CMD_MQ, strlen((const char *)data));
     uint32_t buffer_len = 0;
+    uint8_t *buffer = tal_malloc(size);
+    TUYA_CHECK_NULL_RETURN(buffer, OPRT_MALLOC_FAILED);
 
-    ret = tuya_pack_protocol_data(DP_CMD_MQ, (const char *)data, protocol_id, (uint8_t *)context->signature.cipherkey,
-                                  &buffer, &buffer_len);
+    ret = tuya_pack_protocol_frame(DP_CMD_MQ, (const char *)data, protocol_id,
+                                   (const uint8_t *)context->signature.cipherkey, buffer, size, &buffer_len);
     if (ret != OPRT_OK) {
-        PR_ERR("tuya_pack_protocol_data error:%d", ret);
+        PR_ERR("tuya_pack_protocol_frame error:%d", ret);
+        tal_free(buffer);
         return ret;
     }
 
     /* mqtt client publish */
-    ret = tuya_mqtt_client_publish_common(context, (const char *)topic, (const uint8_t *)buffer, buffer_len, cb,
-                                          user_data, timeout_ms, async);
-    tal_free(buffer);
-    return ret;
+    return tuya_mqtt_client_publish_buffer(context, (const char *)topic, buffer, buffer_len, cb, user_data, timeout_ms,
+                                           async);
 }
 
 /**
@@ -838,8 +885,9 @@ int tuya_mqtt_loop(tuya_mqtt_context_t *context)
         return rt;
     }
 
-    /* reconnect */
-    if (context->is_connected == false) {
+    /* reconnect, not before the backoff delay, the loop keeps running meanwhile */
+    SYS_TIME_T now = tal_system_get_millisecond();
+    if (context->is_connected == false && now >= context->reconnect_at) {
         mqtt_status = mqtt_client_connect(context->mqtt_client);
         if (mqtt_status == MQTT_STATUS_NOT_AUTHORIZED) {
             if (context->on_unbind) {
@@ -848,39 +896,46 @@ int tuya_mqtt_loop(tuya_mqtt_context_t *context)
             return rt;
 
         } else if (mqtt_status != MQTT_STATUS_SUCCESS) {
-            uint16_t nextRetryBackOff = 0U;
+            uint16_t nextRetryBackOff = MQTT_CONNECT_RETRY_MAX_DELAY_MS;
             if (BackoffAlgorithm_GetNextBackoff(&context->backoff_algorithm, rand(), &nextRetryBackOff) ==
                 BackoffAlgorithmSuccess) {
                 PR_WARN("Connection to the MQTT server failed. Retrying "
                         "connection after %hu ms backoff.",
                         (unsigned short)nextRetryBackOff);
-                tal_system_sleep(nextRetryBackOff);
-                return rt;
             }
+            now = tal_system_get_millisecond();
+            context->reconnect_at = now + nextRetryBackOff;
+        } else {
+            BackoffAlgorithm_InitializeParams(&context->backoff_algorithm, MQTT_CONNECT_RETRY_MIN_DELAY_MS,
+                                              MQTT_CONNECT_RETRY_MAX_DELAY_MS, MQTT_CONNECT_RETRY_MAX_ATTEMPTS);
+            now = tal_system_get_millisecond();
+            context->reconnect_at = 0;
         }
-        return rt;
     }
 
-    /* LOCK */
     /* publish async process */
-    mqtt_publish_handle_t **next_handle = &context->publish_list;
-    for (; *next_handle; next_handle = &(*next_handle)->next) {
-        mqtt_publish_handle_t *entry = *next_handle;
-
-        if (entry->timeout <= tal_time_get_posix()) {
-            entry->cb(OPRT_TIMEOUT, entry->user_data);
-            *next_handle = entry->next;
-            tal_free(entry->payload);
-            tal_free(entry);
-            continue;
-        }
+    mqtt_publish_handle_t *entry = NULL;
+    while (NULL != (entry = mqtt_publish_queue_expire(&context->publish_queue, now))) {
+        entry->cb(OPRT_TIMEOUT, entry->user_data);
+        tal_free(entry->payload);
+        tal_free(entry);
+    }
+
+    if (context->is_connected == false) {
+        SYS_TIME_T wait = context->reconnect_at - now;
+        tal_system_sleep(wait < MQTT_RECONNECT_POLL_MS ? wait : MQTT_RECONNECT_POLL_MS);
+        return rt;
+    }
 
-        if (entry->msgid <= 0) {
-            entry->msgid =
-                mqtt_client_publish(context->mqtt_client, entry->topic, entry->payload, entry->payload_length, 1);
+    // stop at the first failed send, the rest would fail the same way
+    while (NULL != (entry = mqtt_publish_queue_pending(&context->publish_queue))) {
+        uint16_t msgid =
+            mqtt_client_publish(context->mqtt_client, entry->topic, entry->payload, entry->payload_length, MQTT_QOS_1);
+        mqtt_publish_queue_sent(&context->publish_queue, entry, msgid, now);
+        if (0 == msgid) {
+            break;
         }
     }
-    /* UNLOCK */
 
     /* yield */
     mqtt_client_yield(context->mqtt_client);
@@ -904,6 +959,8 @@ int tuya_mqtt_destory(tuya_mqtt_context_t *context)
     }
 
     tuya_mqtt_protocol_unregister_all(context);
+    mqtt_subscribe_index_clear(&context->subscribe_index);
+    mqtt_publish_queue_deinit(&context->publish_queue);
     if (context->mqtt_client) {
         mqtt_client_status_t mqtt_status = mqtt_client_deinit(context->mqtt_client);
         mqtt_client_free(context->mqtt_client);
@@ -933,6 +990,23 @@ bool tuya_mqtt_connected(tuya_mqtt_context_t *context)
     return context->is_connected;
 }
 
+/**
+ * @brief Gets the counters of the QoS1 publishes waiting for a PUBACK.
+ *
+ * @param context Pointer to the MQTT context.
+ * @param stats Filled with the counters.
+ * @return Returns 0 on success, or a negative error code on failure.
+ */
+int tuya_mqtt_publish_stats_get(tuya_mqtt_context_t *context, mqtt_publish_stats_t *stats)
+{
+    if (context == NULL || stats == NULL || context->is_inited != true) {
+        return OPRT_INVALID_PARM;
+    }
+
+    mqtt_publish_queue_stats(&context->publish_queue, stats);
+    return OPRT_OK;
+}
+
 /**
  * @brief Reports the progress of an upgrade operation over MQTT.
  *
@@ -30,6 +30,9 @@ extern "C" {
 #include "cJSON.h"
 #include "mqtt_client_interface.h"
 #include "backoff_algorithm.h"
+#include "mqtt_subscribe_index.h"
+#include "mqtt_publish_queue.h"
+#include "tuya_json_scan.h"
 
 // data max len
 #define TUYA_MQTT_CLIENTID_MAXLEN   (32U)
@@ -123,11 +126,18 @@ typedef struct {
     char topic_out[TUYA_MQTT_TOPIC_MAXLEN + 1];
 } tuya_mqtt_access_t;
 
+// protocol handler table size, power of two
+#define TUYA_MQTT_PROTOCOL_BUCKETS (16U)
+
 typedef struct {
     uint16_t event_id;
-    cJSON *root_json;
+    cJSON *root_json; // NULL for raw handlers until tuya_protocol_event_json
     cJSON *data;
     void *user_data;
+    uint32_t t;
+    const char *json;       // decrypted message, valid during the cb
+    json_scan_value_t root; // message object scanned in place
+    json_scan_value_t raw;  // "data" member of root
 } tuya_protocol_event_t;
 
 typedef tuya_protocol_event_t tuya_mqtt_event_t; // compat TODO:remove
@@ -139,38 +149,17 @@ typedef struct tuya_protocol_handle {
     uint16_t id;
     tuya_protocol_callback_t cb;
     void *user_data;
+    bool raw; // called without the cJSON tree
 } tuya_protocol_handle_t;
 
-typedef void (*mqtt_subscribe_message_cb_t)(uint16_t msgid, const mqtt_client_message_t *msg, void *userdata);
-
-typedef struct mqtt_subscribe_handle {
-    struct mqtt_subscribe_handle *next;
-    char *topic;
-    size_t topic_length;
-    mqtt_subscribe_message_cb_t cb;
-    void *userdata;
-} mqtt_subscribe_handle_t;
-
-typedef void (*mqtt_publish_notify_cb_t)(int result, void *user_data);
-
-typedef struct mqtt_publish_handle {
-    struct mqtt_publish_handle *next;
-    uint16_t msgid;
-    int timeout;
-    char *topic;
-    uint8_t *payload;
-    size_t payload_length;
-    mqtt_publish_notify_cb_t cb;
-    void *user_data;
-} mqtt_publish_handle_t;
-
 typedef struct {
     void *mqtt_client;
     tuya_mqtt_access_t signature;
-    tuya_protocol_handle_t *protocol_list;
-    mqtt_subscribe_handle_t *subscribe_list;
-    mqtt_publish_handle_t *publish_list;
+    tuya_protocol_handle_t *protocol_table[TUYA_MQTT_PROTOCOL_BUCKETS]; // by protocol id
+    mqtt_subscribe_index_t subscribe_index;
+    mqtt_publish_queue_t publish_queue;
     BackoffAlgorithmContext_t backoff_algorithm;
+    SYS_TIME_T reconnect_at; // next connect attempt, ms
     uint32_t sequence_in;
     uint32_t sequence_out;
     bool manual_disconnect;
@@ -247,6 +236,19 @@ int tuya_mqtt_destory(tuya_mqtt_context_t *context);
  */
 bool tuya_mqtt_connected(tuya_mqtt_context_t *context);
 
+/**
+ * @brief Gets the counters of the QoS1 publishes waiting for a PUBACK.
+ *
+ * Gives the number of publishes in flight and not sent yet, the PUBACK,
+ * timeout and retry counts, and a histogram of the send to PUBACK latency,
+ * see MQTT_PUBLISH_LATENCY_BOUNDS.
+ *
+ * @param context Pointer to the MQTT context.
+ * @param stats Filled with the counters.
+ * @return Returns 0 on success, or a negative error code on failure.
+ */
+int tuya_mqtt_publish_stats_get(tuya_mqtt_context_t *context, mqtt_publish_stats_t *stats);
+
 /**
  * @brief Registers a MQTT protocol with the given context.
  *
@@ -265,6 +267,37 @@ bool tuya_mqtt_connected(tuya_mqtt_context_t *context);
 int tuya_mqtt_protocol_register(tuya_mqtt_context_t *context, uint16_t protocol_id, tuya_protocol_callback_t cb,
                                 void *user_data);
 
+/**
+ * @brief Registers a MQTT protocol handler that reads the message in place.
+ *
+ * Like tuya_mqtt_protocol_register, but the message is not parsed into a cJSON
+ * tree for this handler: root_json and data are NULL unless another handler of
+ * the same message needed them, and the handler reads event->root and
+ * event->raw with the json_scan_* functions instead. A handler that needs the
+ * tree for some messages only calls tuya_protocol_event_json.
+ *
+ * @param context The MQTT context to register the protocol with.
+ * @param protocol_id The ID of the protocol to register.
+ * @param cb The callback function to be called when a message with the
+ * registered protocol ID is received.
+ * @param user_data User data to be passed to the callback function.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int tuya_mqtt_protocol_register_raw(tuya_mqtt_context_t *context, uint16_t protocol_id, tuya_protocol_callback_t cb,
+                                    void *user_data);
+
+/**
+ * @brief Parses the message of a protocol event into a cJSON tree on demand.
+ *
+ * The tree is parsed once per message, kept in event->root_json and
+ * event->data, and freed after the last handler returns.
+ *
+ * @param event The event passed to the protocol handler.
+ * @return The root object, or NULL on error.
+ */
+cJSON *tuya_protocol_event_json(tuya_protocol_event_t *event);
+
 /**
  * @brief Unregisters a MQTT protocol with the specified protocol ID and
  * callback function.
@@ -0,0 +1,465 @@
+/**
+ * @file mqtt_subscribe_index.c
+ * @brief Topic index used by the MQTT service to find the subscribe handlers
+ * of an inbound publish.
+ *
+ * Exact topics hash into a power-of-two bucket table that doubles when it
+ * holds more topics than buckets, so a publish is one hash and a short chain
+ * walk whatever the number of subscriptions.
+ *
+ * Filters are split on '/' into a trie, one node per level. A publish walks
+ * the trie level by level and only follows the children that are equal to
+ * the level, '+', or '#'. As in MQTT 3.1.1, "a/#" also matches "a" and the
+ * wildcards at the first level do not match topics starting with '$'. A topic
+ * is only treated as a filter when a whole level is "+" or "#", anything else
+ * is compared byte for byte as before.
+ *
+ * Callbacks may subscribe and unsubscribe while they are called. Handles
+ * removed during a dispatch are unlinked but only freed, together with the
+ * trie nodes left empty, when the outermost dispatch returns, so the walk
+ * never steps on freed memory. Tables don't grow during a dispatch either.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <string.h>
+
+#include "tuya_error_code.h"
+#include "tal_api.h"
+#include "mix_method.h"
+#include "mqtt_subscribe_index.h"
+
+/***********************************************************
+*************************micro define***********************
+***********************************************************/
+#define SUBSCRIBE_INDEX_BUCKET_MIN 8
+
+/***********************************************************
+*************************function define********************
+***********************************************************/
+/* returns the start of the next level, NULL if level is the last one */
+static const char *__topic_level(const char *level, const char *end, size_t *level_length)
+{
+    const char *slash = memchr(level, '/', end - level);
+
+    if (NULL == slash) {
+        *level_length = end - level;
+        return NULL;
+    }
+
+    *level_length = slash - level;
+    return slash + 1;
+}
+
+static int __topic_is_filter(const char *topic, size_t length)
+{
+    const char *level = topic;
+    const char *end = topic + length;
+    size_t level_length = 0;
+
+    while (level) {
+        const char *next = __topic_level(level, end, &level_length);
+        if (1 == level_length && ('+' == level[0] || '#' == level[0])) {
+            return 1;
+        }
+        level = next;
+    }
+
+    return 0;
+}
+
+static int __node_is(const mqtt_topic_node_t *node, char wildcard)
+{
+    return 1 == node->level_length && wildcard == node->level[0];
+}
+
+static int __handles_call(mqtt_subscribe_handle_t *handle, uint16_t msgid, const mqtt_client_message_t *msg)
+{
+    mqtt_subscribe_handle_t *next = NULL;
+    int count = 0;
+
+    for (; handle; handle = next) {
+        if (handle->cb) {
+            handle->cb(msgid, msg, handle->userdata);
+            count++;
+        }
+        // removed handles keep their next until the dispatch is over
+        next = handle->next;
+    }
+
+    return count;
+}
+
+static void __handles_free(mqtt_subscribe_handle_t *handle)
+{
+    mqtt_subscribe_handle_t *next = NULL;
+
+    for (; handle; handle = next) {
+        next = handle->next;
+        tal_free(handle->topic);
+        tal_free(handle);
+    }
+}
+
+static int __handles_remove(mqtt_subscribe_index_t *index, mqtt_subscribe_handle_t **pp, const char *topic,
+                            size_t topic_length, uint32_t hash)
+{
+    int count = 0;
+
+    while (*pp) {
+        mqtt_subscribe_handle_t *entry = *pp;
+        if (entry->hash == hash && entry->topic_length == topic_length && !memcmp(topic, entry->topic, topic_length)) {
+            *pp = entry->next;
+            if (index->dispatching) {
+                entry->cb = NULL;
+                entry->retired_next = index->retired;
+                index->retired = entry;
+            } else {
+                tal_free(entry->topic);
+                tal_free(entry);
+            }
+            count++;
+        } else {
+            pp = &entry->next;
+        }
+    }
+
+    return count;
+}
+
+static mqtt_subscribe_handle_t *__handles_find(mqtt_subscribe_handle_t *handle, const char *topic,
+                                               size_t topic_length, uint32_t hash, mqtt_subscribe_message_cb_t cb)
+{
+    for (; handle; handle = handle->next) {
+        if (handle->hash == hash && handle->cb == cb && handle->topic_length == topic_length &&
+            !memcmp(topic, handle->topic, topic_length)) {
+            return handle;
+        }
+    }
+
+    return NULL;
+}
+
+static mqtt_topic_node_t **__node_find(mqtt_topic_node_t **pp, const char *level, size_t level_length)
+{
+    for (; *pp; pp = &(*pp)->sibling) {
+        if ((*pp)->level_length == level_length && !memcmp((*pp)->level, level, level_length)) {
+            break;
+        }
+    }
+
+    return pp;
+}
+
+/* the node a filter ends at, created on the way when create is set */
+static mqtt_topic_node_t *__node_lookup(mqtt_subscribe_index_t *index, const char *topic, size_t topic_length,
+                                        int create)
+{
+    mqtt_topic_node_t **children = &index->wildcard;
+    mqtt_topic_node_t *node = NULL;
+    const char *level = topic;
+    const char *end = topic + topic_length;
+    size_t level_length = 0;
+
+    while (level) {
+        const char *next = __topic_level(level, end, &level_length);
+        mqtt_topic_node_t **pp = __node_find(children, level, level_length);
+        if (NULL == *pp) {
+            if (!create) {
+                return NULL;
+            }
+            *pp = tal_calloc(1, sizeof(mqtt_topic_node_t) + level_length + 1);
+            if (NULL == *pp) {
+                return NULL;
+            }
+            (*pp)->level_length = level_length;
+            memcpy((*pp)->level, level, level_length);
+        }
+        node = *pp;
+        children = &node->child;
+        level = next;
+    }
+
+    return node;
+}
+
+/* free the nodes left without handles or children */
+static void __node_prune(mqtt_topic_node_t **pp)
+{
+    while (*pp) {
+        mqtt_topic_node_t *node = *pp;
+        __node_prune(&node->child);
+        if (NULL == node->child && NULL == node->handles) {
+            *pp = node->sibling;
+            tal_free(node);
+        } else {
+            pp = &node->sibling;
+        }
+    }
+}
+
+static void __node_free(mqtt_topic_node_t *node)
+{
+    mqtt_topic_node_t *sibling = NULL;
+
+    for (; node; node = sibling) {
+        sibling = node->sibling;
+        __node_free(node->child);
+        __handles_free(node->handles);
+        tal_free(node);
+    }
+}
+
+static int __node_match(mqtt_topic_node_t *node, const char *level, const char *end, int first, uint16_t msgid,
+                        const mqtt_client_message_t *msg)
+{
+    size_t level_length = 0;
+    const char *next = __topic_level(level, end, &level_length);
+    int system = first && level_length > 0 && '$' == level[0];
+    mqtt_topic_node_t *child = NULL;
+    int count = 0;
+
+    for (; node; node = node->sibling) {
+        if (__node_is(node, '#')) {
+            if (!system) {
+                count += __handles_call(node->handles, msgid, msg);
+            }
+            continue;
+        }
+        if (__node_is(node, '+') ? system
+                                 : (node->level_length != level_length || memcmp(node->level, level, level_length))) {
+            continue;
+        }
+        if (next) {
+            count += __node_match(node->child, next, end, 0, msgid, msg);
+            continue;
+        }
+        count += __handles_call(node->handles, msgid, msg);
+        // "a/#" matches "a"
+        for (child = node->child; child; child = child->sibling) {
+            if (__node_is(child, '#')) {
+                count += __handles_call(child->handles, msgid, msg);
+            }
+        }
+    }
+
+    return count;
+}
+
+static void __handles_retired_free(mqtt_subscribe_index_t *index)
+{
+    mqtt_subscribe_handle_t *next = NULL;
+
+    for (; index->retired; index->retired = next) {
+        next = index->retired->retired_next;
+        tal_free(index->retired->topic);
+        tal_free(index->retired);
+    }
+    if (index->prune_pending) {
+        index->prune_pending = 0;
+        __node_prune(&index->wildcard);
+    }
+}
+
+static void __bucket_grow(mqtt_subscribe_index_t *index)
+{
+    uint32_t bucket_num = index->bucket_num ? index->bucket_num * 2 : SUBSCRIBE_INDEX_BUCKET_MIN;
+    mqtt_subscribe_handle_t **bucket = tal_calloc(bucket_num, sizeof(mqtt_subscribe_handle_t *));
+    uint32_t i;
+
+    // keep the old table if there is no memory, the chains just get longer
+    if (NULL == bucket) {
+        return;
+    }
+
+    for (i = 0; i < index->bucket_num; i++) {
+        mqtt_subscribe_handle_t *handle = index->bucket[i];
+        mqtt_subscribe_handle_t **tail = NULL;
+        while (handle) {
+            mqtt_subscribe_handle_t *next = handle->next;
+            // keep the newest first order of each topic
+            tail = &bucket[handle->hash & (bucket_num - 1)];
+            while (*tail) {
+                tail = &(*tail)->next;
+            }
+            handle->next = NULL;
+            *tail = handle;
+            handle = next;
+        }
+    }
+
+    tal_free(index->bucket);
+    index->bucket = bucket;
+    index->bucket_num = bucket_num;
+}
+
+/**
+ * @brief find the handle registered for topic and cb
+ *
+ * @return the handle, NULL if there is none
+ */
+mqtt_subscribe_handle_t *mqtt_subscribe_index_find(mqtt_subscribe_index_t *index, const char *topic,
+                                                   mqtt_subscribe_message_cb_t cb)
+{
+    size_t topic_length = strlen(topic);
+    uint32_t hash = tuya_fnv1a32(topic, topic_length);
+
+    if (__topic_is_filter(topic, topic_length)) {
+        mqtt_topic_node_t *node = __node_lookup(index, topic, topic_length, 0);
+        return node ? __handles_find(node->handles, topic, topic_length, hash, cb) : NULL;
+    }
+
+    if (0 == index->bucket_num) {
+        return NULL;
+    }
+
+    return __handles_find(index->bucket[hash & (index->bucket_num - 1)], topic, topic_length, hash, cb);
+}
+
+/**
+ * @brief add a handle for topic, topic may be a filter with '+' or '#'
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int mqtt_subscribe_index_add(mqtt_subscribe_index_t *index, const char *topic, mqtt_subscribe_message_cb_t cb,
+                             void *userdata)
+{
+    mqtt_subscribe_handle_t **head = NULL;
+
+    mqtt_subscribe_handle_t *handle = tal_calloc(1, sizeof(mqtt_subscribe_handle_t));
+    if (NULL == handle) {
+        return OPRT_MALLOC_FAILED;
+    }
+
+    handle->topic_length = strlen(topic);
+    handle->topic = tal_calloc(1, handle->topic_length + 1);
+    if (NULL == handle->topic) {
+        tal_free(handle);
+        return OPRT_MALLOC_FAILED;
+    }
+    memcpy(handle->topic, topic, handle->topic_length);
+    handle->hash = tuya_fnv1a32(topic, handle->topic_length);
+    handle->cb = cb;
+    handle->userdata = userdata;
+
+    if (__topic_is_filter(topic, handle->topic_length)) {
+        mqtt_topic_node_t *node = __node_lookup(index, topic, handle->topic_length, 1);
+        if (NULL == node) {
+            if (index->dispatching) {
+                index->prune_pending = 1;
+            } else {
+                __node_prune(&index->wildcard);
+            }
+            __handles_free(handle);
+            return OPRT_MALLOC_FAILED;
+        }
+        head = &node->handles;
+    } else {
+        // growing relinks the chains a dispatch may be walking
+        if (index->count >= index->bucket_num && (0 == index->dispatching || 0 == index->bucket_num)) {
+            __bucket_grow(index);
+        }
+        if (0 == index->bucket_num) {
+            __handles_free(handle);
+            return OPRT_MALLOC_FAILED;
+        }
+        head = &index->bucket[handle->hash & (index->bucket_num - 1)];
+        index->count++;
+    }
+
+    handle->next = *head;
+    *head = handle;
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief remove every handle registered for topic
+ *
+ * @return the number of handles removed
+ */
+int mqtt_subscribe_index_remove(mqtt_subscribe_index_t *index, const char *topic)
+{
+    size_t topic_length = strlen(topic);
+    uint32_t hash = tuya_fnv1a32(topic, topic_length);
+    int count = 0;
+
+    if (__topic_is_filter(topic, topic_length)) {
+        mqtt_topic_node_t *node = __node_lookup(index, topic, topic_length, 0);
+        if (node) {
+            count = __handles_remove(index, &node->handles, topic, topic_length, hash);
+            if (index->dispatching) {
+                index->prune_pending = 1;
+            } else {
+                __node_prune(&index->wildcard);
+            }
+        }
+        return count;
+    }
+
+    if (0 == index->bucket_num) {
+        return 0;
+    }
+
+    count = __handles_remove(index, &index->bucket[hash & (index->bucket_num - 1)], topic, topic_length, hash);
+    index->count -= count;
+
+    return count;
+}
+
+/**
+ * @brief call the cb of every handle whose topic or filter matches msg->topic
+ *
+ * @return the number of handles called
+ */
+int mqtt_subscribe_index_dispatch(mqtt_subscribe_index_t *index, uint16_t msgid, const mqtt_client_message_t *msg)
+{
+    size_t topic_length = strlen(msg->topic);
+    uint32_t hash = tuya_fnv1a32(msg->topic, topic_length);
+    mqtt_subscribe_handle_t *handle = NULL;
+    mqtt_subscribe_handle_t *next = NULL;
+    int count = 0;
+
+    index->dispatching++;
+
+    if (index->bucket_num) {
+        handle = index->bucket[hash & (index->bucket_num - 1)];
+        for (; handle; handle = next) {
+            if (handle->cb && handle->hash == hash && handle->topic_length == topic_length &&
+                !memcmp(msg->topic, handle->topic, topic_length)) {
+                handle->cb(msgid, msg, handle->userdata);
+                count++;
+            }
+            next = handle->next;
+        }
+    }
+
+    if (index->wildcard) {
+        count += __node_match(index->wildcard, msg->topic, msg->topic + topic_length, 1, msgid, msg);
+    }
+
+    if (0 == --index->dispatching) {
+        __handles_retired_free(index);
+    }
+
+    return count;
+}
+
+/**
+ * @brief remove all handles and free the index memory
+ */
+void mqtt_subscribe_index_clear(mqtt_subscribe_index_t *index)
+{
+    uint32_t i;
+
+    for (i = 0; i < index->bucket_num; i++) {
+        __handles_free(index->bucket[i]);
+    }
+    tal_free(index->bucket);
+    __node_free(index->wildcard);
+    index->dispatching = 0;
+    index->prune_pending = 0;
+    __handles_retired_free(index);
+    memset(index, 0, sizeof(mqtt_subscribe_index_t));
+}
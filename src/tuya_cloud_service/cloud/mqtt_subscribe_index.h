@@ -0,0 +1,97 @@
+/**
+ * @file mqtt_subscribe_index.h
+ * @brief Topic index used by the MQTT service to find the subscribe handlers
+ * of an inbound publish.
+ *
+ * Exact topics are kept in a hash table that grows with the number of
+ * subscriptions. Topic filters with the '+' or '#' wildcards are kept in a
+ * trie of topic levels, so a publish is matched against each level once
+ * instead of against every filter.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef __MQTT_SUBSCRIBE_INDEX_H__
+#define __MQTT_SUBSCRIBE_INDEX_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mqtt_client_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*mqtt_subscribe_message_cb_t)(uint16_t msgid, const mqtt_client_message_t *msg, void *userdata);
+
+typedef struct mqtt_subscribe_handle {
+    struct mqtt_subscribe_handle *next;
+    char *topic;
+    size_t topic_length;
+    uint32_t hash;
+    mqtt_subscribe_message_cb_t cb; // NULL once removed during a dispatch
+    void *userdata;
+    struct mqtt_subscribe_handle *retired_next;
+} mqtt_subscribe_handle_t;
+
+typedef struct mqtt_topic_node {
+    struct mqtt_topic_node *sibling;
+    struct mqtt_topic_node *child;
+    mqtt_subscribe_handle_t *handles; // filters ending at this level
+    size_t level_length;
+    char level[0];
+} mqtt_topic_node_t;
+
+typedef struct {
+    mqtt_subscribe_handle_t **bucket; // exact topics
+    uint32_t bucket_num;              // power of two
+    uint32_t count;
+    mqtt_topic_node_t *wildcard; // first level of the wildcard filters
+    // a callback may unsubscribe during dispatch, the memory it would free is
+    // kept until the outermost dispatch returns
+    uint32_t dispatching;
+    mqtt_subscribe_handle_t *retired;
+    int prune_pending;
+} mqtt_subscribe_index_t;
+
+/**
+ * @brief find the handle registered for topic and cb
+ *
+ * @return the handle, NULL if there is none
+ */
+mqtt_subscribe_handle_t *mqtt_subscribe_index_find(mqtt_subscribe_index_t *index, const char *topic,
+                                                   mqtt_subscribe_message_cb_t cb);
+
+/**
+ * @brief add a handle for topic, topic may be a filter with '+' or '#'
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int mqtt_subscribe_index_add(mqtt_subscribe_index_t *index, const char *topic, mqtt_subscribe_message_cb_t cb,
+                             void *userdata);
+
+/**
+ * @brief remove every handle registered for topic
+ *
+ * @return the number of handles removed
+ */
+int mqtt_subscribe_index_remove(mqtt_subscribe_index_t *index, const char *topic);
+
+/**
+ * @brief call the cb of every handle whose topic or filter matches msg->topic
+ *
+ * @return the number of handles called
+ */
+int mqtt_subscribe_index_dispatch(mqtt_subscribe_index_t *index, uint16_t msgid, const mqtt_client_message_t *msg);
+
+/**
+ * @brief remove all handles and free the index memory
+ */
+void mqtt_subscribe_index_clear(mqtt_subscribe_index_t *index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MQTT_SUBSCRIBE_INDEX_H__ */
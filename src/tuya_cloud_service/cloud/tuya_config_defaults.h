@@ -76,6 +76,21 @@
 #define MQTT_CONNECT_RETRY_MIN_DELAY_MS (1000U)
 #endif
 
+/**
+ * @brief The longest tuya_mqtt_loop waits while disconnected, publish
+ * timeouts and the caller's other work run at least this often.
+ */
+#ifndef MQTT_RECONNECT_POLL_MS
+#define MQTT_RECONNECT_POLL_MS (100U)
+#endif
+
+/**
+ * @brief PUBACK timeout of the reports sent from the offline queue.
+ */
+#ifndef MQTT_OFFLINE_REPORT_TIMEOUT_MS
+#define MQTT_OFFLINE_REPORT_TIMEOUT_MS (5000U)
+#endif
+
 /**
  * @brief MQTT BIND TLS timeout config.
  */
@@ -31,6 +31,10 @@
 #include "tuya_tls.h"
 #include "netmgr.h"
 #include "tuya_health.h"
+#include "tuya_offline_queue.h"
+#include "tuya_dp_sched.h"
+#include "atop_cache.h"
+#include "tuya_protocol.h"
 typedef enum {
     STATE_IDLE,
     STATE_START,
@@ -54,6 +58,14 @@ typedef enum {
 
 static tuya_iot_client_t *s_iot_client_solo;
 
+static int version_info_changed(tuya_iot_client_t *client, char **out, size_t *olen);
+static int version_info_save(tuya_iot_client_t *client, const char *version_buffer, size_t version_len);
+
+#if defined(ENABLE_MQTT_OFFLINE_QUEUE) && (ENABLE_MQTT_OFFLINE_QUEUE == 1)
+static int tuya_iot_offline_report_send(const char *dps, const char *time, mqtt_publish_notify_cb_t cb,
+                                        void *user_data);
+#endif
+
 /* -------------------------------------------------------------------------- */
 /*                          Internal utils functions                          */
 /* -------------------------------------------------------------------------- */
@@ -288,20 +300,22 @@ static void mqtt_service_dp_receive_on(tuya_protocol_event_t *ev)
 static void mqtt_service_reset_cmd_on(tuya_protocol_event_t *ev)
 {
     tuya_iot_client_t *client = ev->user_data;
-    cJSON *data = (cJSON *)(ev->data);
+    json_scan_value_t value;
+    char gwid[MAX_LENGTH_DEVICE_ID + 1] = {0};
 
-    if (NULL == cJSON_GetObjectItem(data, "gwId")) {
+    if (OPRT_OK != json_scan_find(&ev->raw, "gwId", &value)) {
         PR_ERR("not found gwId");
+    } else {
+        json_scan_string(&value, gwid, sizeof(gwid));
     }
 
-    PR_WARN("Reset id:%s", cJSON_GetObjectItem(data, "gwId")->valuestring);
+    PR_WARN("Reset id:%s", gwid);
 
     /* DP event send */
     client->event.id = TUYA_EVENT_RESET;
     client->event.type = TUYA_DATE_TYPE_INTEGER;
 
-    if (cJSON_GetObjectItem(ev->root_json, "type") &&
-        strcmp(cJSON_GetObjectItem(ev->root_json, "type")->valuestring, "reset_factory") == 0) {
+    if (OPRT_OK == json_scan_find(&ev->root, "type", &value) && json_scan_equal(&value, "reset_factory")) {
         PR_DEBUG("cmd is reset factory, ungister");
         client->event.value.asInteger = TUYA_RESET_TYPE_REMOTE_FACTORY;
     } else {
@@ -367,11 +381,11 @@ static void matop_app_notify_upgrade_info_on(atop_base_response_t *response, voi
 static void mqtt_service_upgrade_notify_on(tuya_mqtt_event_t *ev)
 {
     tuya_iot_client_t *client = ev->user_data;
-    cJSON *data = (cJSON *)(ev->data);
+    json_scan_value_t value;
     int ota_channel = 0;
 
-    if (cJSON_GetObjectItem(data, "firmwareType")) {
-        ota_channel = cJSON_GetObjectItem(data, "firmwareType")->valueint;
+    if (OPRT_OK == json_scan_find(&ev->raw, "firmwareType", &value)) {
+        json_scan_int(&value, &ota_channel);
     }
 
     int rt = matop_service_upgrade_info_get(&client->matop, ota_channel, matop_app_notify_upgrade_info_on, client);
@@ -389,6 +403,16 @@ static void mqtt_client_connected_on(void *context, void *user_data)
     matop_serice_init(&client->matop,
                       &(const matop_config_t){.mqctx = &client->mqctx, .devid = client->activate.devid});
 
+#if defined(ENABLE_ATOP_BATCH) && (ENABLE_ATOP_BATCH == 1)
+    /* Upgrade info got in the startup batch, the next auto check is a full interval away */
+    if (client->startup_upgrade.success) {
+        matop_upgrade_info_on(&client->startup_upgrade, client);
+        atop_base_response_free(&client->startup_upgrade);
+        memset(&client->startup_upgrade, 0, sizeof(client->startup_upgrade));
+        tal_sw_timer_start(client->check_upgrade_timer, AUTO_UPGRADE_CHECK_INTERVAL, TAL_TIMER_ONCE);
+    }
+#endif
+
     /* Auto check upgrade timer start */
     if (tal_sw_timer_is_running(client->check_upgrade_timer) == false) {
         tal_sw_timer_start(client->check_upgrade_timer, 1000 * 1, TAL_TIMER_ONCE);
@@ -463,12 +487,57 @@ static void mqtt_rtc_req_notify_cb(tuya_protocol_event_t *ev)
 /*                       Internal machine state process                       */
 /* -------------------------------------------------------------------------- */
 
+#if defined(ENABLE_ATOP_BATCH) && (ENABLE_ATOP_BATCH == 1)
+static void startup_version_update_on(atop_base_response_t *response, void *user_data)
+{
+    tuya_iot_client_t *client = (tuya_iot_client_t *)user_data;
+    client->startup_version_updated = response->success;
+}
+
+static void startup_upgrade_info_on(atop_base_response_t *response, void *user_data)
+{
+    tuya_iot_client_t *client = (tuya_iot_client_t *)user_data;
+
+    /* handled once MQTT is connected */
+    client->startup_upgrade = *response;
+    response->result = NULL;
+}
+
+/* Update the client version and check the upgrade in one request, the
+ * upgrade check only comes along when there is a version to update */
+static int startup_batch_sync(tuya_iot_client_t *client)
+{
+    char *version_buffer = NULL;
+    size_t version_len = 0;
+    int rt = version_info_changed(client, &version_buffer, &version_len);
+    if (OPRT_OK != rt || NULL == version_buffer) {
+        return rt;
+    }
+
+    client->startup_version_updated = false;
+    rt = atop_service_version_update_upgrade_get(client->activate.devid, client->activate.seckey, version_buffer,
+                                                 startup_version_update_on, startup_upgrade_info_on, client);
+    if (OPRT_OK == rt && client->startup_version_updated) {
+        rt = version_info_save(client, version_buffer, version_len);
+    }
+    tal_free(version_buffer);
+
+    return rt;
+}
+#endif
+
 static int run_state_startup_update(tuya_iot_client_t *client)
 {
     int rt = OPRT_OK;
 
     /* Update client version */
+#if defined(ENABLE_ATOP_BATCH) && (ENABLE_ATOP_BATCH == 1)
+    atop_base_response_free(&client->startup_upgrade);
+    memset(&client->startup_upgrade, 0, sizeof(client->startup_upgrade));
+    startup_batch_sync(client);
+#else
     tuya_iot_version_update_sync(client);
+#endif
 
     /* MQTT Client Init */
     const tuya_endpoint_t *endpoint = tuya_endpoint_get();
@@ -500,9 +569,9 @@ static int run_state_mqtt_connect_start(tuya_iot_client_t *client)
 
     /* callback register */
     tuya_mqtt_protocol_register(&client->mqctx, PRO_CMD, mqtt_service_dp_receive_on, client);
-    tuya_mqtt_protocol_register(&client->mqctx, PRO_GW_RESET, mqtt_service_reset_cmd_on, client);
-    tuya_mqtt_protocol_register(&client->mqctx, PRO_UPGD_REQ, mqtt_service_upgrade_notify_on, client);
-    tuya_mqtt_protocol_register(&client->mqctx, PRO_MQ_DPCACHE_NOTIFY, mqtt_atop_dp_cache_notify_cb, client);
+    tuya_mqtt_protocol_register_raw(&client->mqctx, PRO_GW_RESET, mqtt_service_reset_cmd_on, client);
+    tuya_mqtt_protocol_register_raw(&client->mqctx, PRO_UPGD_REQ, mqtt_service_upgrade_notify_on, client);
+    tuya_mqtt_protocol_register_raw(&client->mqctx, PRO_MQ_DPCACHE_NOTIFY, mqtt_atop_dp_cache_notify_cb, client);
     tuya_mqtt_protocol_register(&client->mqctx, PRO_RTC_REQ, mqtt_rtc_req_notify_cb, client);
     
     return rt;
@@ -532,6 +601,10 @@ static int run_state_reset(tuya_iot_client_t *client)
     tal_kv_set((const char *)devid_key, (const uint8_t *)client->activate.devid, strlen(client->activate.devid));
 
     tal_event_publish(EVENT_RESET, client);
+#if defined(ENABLE_MQTT_OFFLINE_QUEUE) && (ENABLE_MQTT_OFFLINE_QUEUE == 1)
+    /* Reports of the old binding must not reach the next one */
+    tuya_offline_queue_clear();
+#endif
     /* Clean client local data */
     return tuya_iot_activated_data_remove(client);
 }
@@ -584,6 +657,7 @@ int tuya_iot_init(tuya_iot_client_t *client, const tuya_iot_config_t *config)
     }
     /* Software timer Init */
     tuya_tls_init();
+    tuya_protocol_init();
     tuya_register_center_init();
     /* Load Tuya cloud endpoint config */
     tuya_endpoint_init();
@@ -605,6 +679,25 @@ int tuya_iot_init(tuya_iot_client_t *client, const tuya_iot_config_t *config)
 
     tuya_health_monitor_init();
 
+#if defined(ENABLE_MQTT_OFFLINE_QUEUE) && (ENABLE_MQTT_OFFLINE_QUEUE == 1)
+    ret = tuya_offline_queue_init();
+    if (OPRT_OK != ret) {
+        PR_ERR("offline queue init error:%d", ret);
+    }
+#endif
+
+    ret = tuya_iot_dp_init();
+    if (OPRT_OK != ret) {
+        PR_ERR("dp init error:%d", ret);
+    }
+
+#if defined(ENABLE_ATOP_CACHE) && (ENABLE_ATOP_CACHE == 1)
+    ret = atop_cache_init();
+    if (OPRT_OK != ret) {
+        PR_ERR("atop cache init error:%d", ret);
+    }
+#endif
+
     /* Auto check upgrade timer init */
     ret = tal_sw_timer_create(check_auto_upgrade_timeout_on, client, &client->check_upgrade_timer);
     if (OPRT_OK != ret) {
@@ -802,6 +895,11 @@ int tuya_iot_yield(tuya_iot_client_t *client)
     case STATE_MQTT_YIELD:
         tuya_mqtt_loop(&client->mqctx);
         matop_serice_yield(&client->matop);
+#if defined(ENABLE_MQTT_OFFLINE_QUEUE) && (ENABLE_MQTT_OFFLINE_QUEUE == 1)
+        if (tuya_mqtt_connected(&client->mqctx)) {
+            tuya_offline_queue_drain(tuya_iot_offline_report_send);
+        }
+#endif
         break;
 
     case STATE_IDLE:
@@ -999,6 +1097,7 @@ int tuya_iot_yield(tuya_iot_client_t *client)
     case STATE_STOP:
         tuya_mqtt_stop(&client->mqctx);
         tuya_mqtt_destory(&client->mqctx);
+        tal_kv_flush();
         client->nextstate = STATE_IDLE;
         break;
 
@@ -1043,10 +1142,18 @@ int tuya_iot_activated_data_remove(tuya_iot_client_t *client)
     }
 
     /* Clean client local data */
+#if defined(ENABLE_DP_REPORT_SCHED) && (ENABLE_DP_REPORT_SCHED == 1)
+    dp_sched_clear(client->activate.devid);
+#endif
+#if defined(ENABLE_ATOP_CACHE) && (ENABLE_ATOP_CACHE == 1)
+    atop_cache_clear();
+#endif
     dp_schema_delete(client->activate.devid);
     tal_kv_del((const char *)(client->activate.schemaId));
     tal_kv_del((const char *)(client->config.storage_namespace));
     tuya_endpoint_remove();
+    /* Applications usually reboot on TUYA_EVENT_RESET_COMPLETE */
+    tal_kv_flush();
     client->is_activated = false;
     PR_INFO("Activated data remove successed");
 
@@ -1057,14 +1164,9 @@ int tuya_iot_activated_data_remove(tuya_iot_client_t *client)
     return OPRT_OK;
 }
 
-static int tuya_iot_dp_report_json_common(tuya_iot_client_t *client, const char *dps, const char *time,
-                                          tuya_dp_notify_cb_t cb, void *user_data, int timeout_ms, bool async)
+static int tuya_iot_dp_report_json_publish(tuya_iot_client_t *client, const char *dps, const char *time,
+                                           tuya_dp_notify_cb_t cb, void *user_data, int timeout_ms, bool async)
 {
-    if (client == NULL || dps == NULL) {
-        PR_ERR("param error");
-        return OPRT_INVALID_PARM;
-    }
-
     int ret;
     int printlen = 0;
     char *buffer = NULL;
@@ -1098,6 +1200,39 @@ static int tuya_iot_dp_report_json_common(tuya_iot_client_t *client, const char
     tal_free(buffer);
     return ret;
 }
+
+#if defined(ENABLE_MQTT_OFFLINE_QUEUE) && (ENABLE_MQTT_OFFLINE_QUEUE == 1)
+static int tuya_iot_offline_report_send(const char *dps, const char *time, mqtt_publish_notify_cb_t cb,
+                                        void *user_data)
+{
+    return tuya_iot_dp_report_json_publish(s_iot_client_solo, dps, time, (tuya_dp_notify_cb_t)cb, user_data,
+                                           MQTT_OFFLINE_REPORT_TIMEOUT_MS, true);
+}
+#endif
+
+static int tuya_iot_dp_report_json_common(tuya_iot_client_t *client, const char *dps, const char *time,
+                                          tuya_dp_notify_cb_t cb, void *user_data, int timeout_ms, bool async)
+{
+    if (client == NULL || dps == NULL) {
+        PR_ERR("param error");
+        return OPRT_INVALID_PARM;
+    }
+
+#if defined(ENABLE_MQTT_OFFLINE_QUEUE) && (ENABLE_MQTT_OFFLINE_QUEUE == 1)
+    /* QoS1 reports wait in flash while offline, newer values replace the queued ones and
+     * reports with time stay behind the queued ones to keep their order */
+    if (cb && client->is_activated &&
+        (!tuya_mqtt_connected(&client->mqctx) || (time && tuya_offline_queue_count()))) {
+        return tuya_offline_queue_push(dps, time, (mqtt_publish_notify_cb_t)cb, user_data);
+    }
+    if (NULL == time) {
+        tuya_offline_queue_collapse(dps);
+    }
+#endif
+
+    return tuya_iot_dp_report_json_publish(client, dps, time, cb, user_data, timeout_ms, async);
+}
+
 /**
  * @brief Reports device status asynchronously in JSON format.
  *
@@ -1218,22 +1353,15 @@ int tuya_iot_token_get_port_register(tuya_iot_client_t *client, tuya_token_get_c
     return OPRT_MSG_OUT_OF_LIMIT;
 }
 
-/**
- * @brief Synchronizes the version update for the Tuya IoT client.
- *
- * This function is used to synchronize the version update for the Tuya IoT
- * client.
- *
- * @param client Pointer to the Tuya IoT client structure.
- * @return Returns 0 on success, or a negative error code on failure.
- */
-int tuya_iot_version_update_sync(tuya_iot_client_t *client)
+// format the version info, out is NULL if it is the one already synced
+static int version_info_changed(tuya_iot_client_t *client, char **out, size_t *olen)
 {
     if (client == NULL || client->config.software_ver == NULL || client->config.software_ver[0] == '\0' ||
         client->config.storage_namespace == NULL || client->config.storage_namespace[0] == '\0') {
         return OPRT_INVALID_PARM;
     }
 
+    *out = NULL;
     int rt = OPRT_OK;
 
 #define VERSION_BUFFER_MAX (128)
@@ -1321,17 +1449,47 @@ int tuya_iot_version_update_sync(tuya_iot_client_t *client)
         tal_free(version_buffer);
         return OPRT_OK;
     }
+    tal_kv_free((uint8_t *)readbuf);
+
+    *out = version_buffer;
+    *olen = version_len;
+    return OPRT_OK;
+}
+
+static int version_info_save(tuya_iot_client_t *client, const char *version_buffer, size_t version_len)
+{
+    char version_key[32];
+    snprintf(version_key, sizeof version_key, "%s.ver", client->config.storage_namespace);
+    return tal_kv_set((const char *)version_key, (const uint8_t *)version_buffer, version_len);
+}
+
+/**
+ * @brief Synchronizes the version update for the Tuya IoT client.
+ *
+ * This function is used to synchronize the version update for the Tuya IoT
+ * client.
+ *
+ * @param client Pointer to the Tuya IoT client structure.
+ * @return Returns 0 on success, or a negative error code on failure.
+ */
+int tuya_iot_version_update_sync(tuya_iot_client_t *client)
+{
+    char *version_buffer = NULL;
+    size_t version_len = 0;
+    int rt = version_info_changed(client, &version_buffer, &version_len);
+    if (OPRT_OK != rt || NULL == version_buffer) {
+        return rt;
+    }
 
     /* Post version info to ATOP service */
     rt = atop_service_version_update_v41(client->activate.devid, client->activate.seckey, (const char *)version_buffer);
-    tal_kv_free((uint8_t *)readbuf);
     if (rt != OPRT_OK) {
         tal_free(version_buffer);
         return rt;
     }
 
     /* Save version info */
-    rt = tal_kv_set((const char *)version_key, (const uint8_t *)version_buffer, version_len);
+    rt = version_info_save(client, version_buffer, version_len);
     tal_free(version_buffer);
 
     return rt;
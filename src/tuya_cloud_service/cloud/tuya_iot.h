@@ -230,6 +230,10 @@ struct tuya_iot_client_handle {
     uint8_t state;
     uint8_t nextstate;
     bool is_activated;
+#if defined(ENABLE_ATOP_BATCH) && (ENABLE_ATOP_BATCH == 1)
+    bool startup_version_updated;
+    atop_base_response_t startup_upgrade; // upgrade info got at startup, handled once MQTT is connected
+#endif
     /** device manage */
     dp_schema_t *schema;
 };
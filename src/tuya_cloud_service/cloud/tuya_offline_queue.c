@@ -0,0 +1,498 @@
+/**
+ * @file tuya_offline_queue.c
+ * @brief Flash-backed queue of the DP reports made while MQTT is offline.
+ *
+ * Every queued report is one tal_kv record "offq.<slot>" holding its
+ * sequence number, time and DP object, so the queue is rebuilt in order by
+ * tuya_offline_queue_init after a reboot. At most MQTT_OFFLINE_QUEUE_MAX
+ * reports are kept, the oldest one gives way to a new one.
+ *
+ * A report without time only carries the latest value of each DP, so a new
+ * one removes its DPs from the older reports and the queue never sends a
+ * value that was already superseded. Reports with time are history and are
+ * kept as they are.
+ *
+ * The queue is drained one report at a time: the next one is only sent once
+ * the PUBACK of the previous one arrived and MQTT_OFFLINE_QUEUE_INTERVAL_MS
+ * passed, which keeps the order and does not flood the broker on reconnect.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include "tuya_config_defaults.h"
+#include "tuya_error_code.h"
+#include "tal_api.h"
+#include "tal_kv.h"
+#include "cJSON.h"
+#include "tuya_offline_queue.h"
+
+#if defined(ENABLE_MQTT_OFFLINE_QUEUE) && (ENABLE_MQTT_OFFLINE_QUEUE == 1)
+
+/***********************************************************
+*************************micro define***********************
+***********************************************************/
+#ifndef MQTT_OFFLINE_QUEUE_MAX
+#define MQTT_OFFLINE_QUEUE_MAX 16
+#endif
+
+#if MQTT_OFFLINE_QUEUE_MAX > 32
+#error "MQTT_OFFLINE_QUEUE_MAX must not exceed 32"
+#endif
+
+#ifndef MQTT_OFFLINE_QUEUE_INTERVAL_MS
+#define MQTT_OFFLINE_QUEUE_INTERVAL_MS 200
+#endif
+
+// wait after a report got no PUBACK before sending it again
+#define OFFLINE_QUEUE_RETRY_MS 5000
+
+#define OFFLINE_QUEUE_KEY     "offq.%u"
+#define OFFLINE_QUEUE_KEY_LEN 16
+// bitmap of the slots in use, so init does not probe the empty ones
+#define OFFLINE_QUEUE_MAP_KEY "offq.map"
+
+// record: seq (4, little endian), time length (2), time, dps
+#define OFFLINE_RECORD_HEAD 6
+
+typedef struct {
+    uint32_t seq;
+    uint32_t slot;
+    char *time;
+    char *dps;
+    int result; // passed to cb once the report left the queue
+    mqtt_publish_notify_cb_t cb;
+    void *user_data;
+} offline_report_t;
+
+typedef struct {
+    MUTEX_HANDLE mutex;
+    offline_report_t *item[MQTT_OFFLINE_QUEUE_MAX]; // oldest first
+    uint32_t count;
+    uint32_t slot_used;
+    uint32_t seq;
+    bool inflight; // item[0] is sent, waiting for the PUBACK
+    SYS_TIME_T next_send;
+} offline_queue_t;
+
+// reports taken out under the mutex, their cb is called after it is released
+typedef struct {
+    offline_report_t *item[MQTT_OFFLINE_QUEUE_MAX + 1];
+    uint32_t count;
+} offline_done_t;
+
+/***********************************************************
+*************************variable define********************
+***********************************************************/
+static offline_queue_t sg_offline_queue;
+
+/***********************************************************
+*************************function define********************
+***********************************************************/
+static char *__strdup(const char *str)
+{
+    size_t len = strlen(str);
+    char *dup = tal_malloc(len + 1);
+
+    if (dup) {
+        memcpy(dup, str, len + 1);
+    }
+
+    return dup;
+}
+
+static void __report_free(offline_report_t *report)
+{
+    tal_free(report->time);
+    tal_free(report->dps);
+    tal_free(report);
+}
+
+static void __slots_save(void)
+{
+    tal_kv_set(OFFLINE_QUEUE_MAP_KEY, (const uint8_t *)&sg_offline_queue.slot_used, sizeof(uint32_t));
+}
+
+static int __report_save(offline_report_t *report)
+{
+    char key[OFFLINE_QUEUE_KEY_LEN];
+    size_t time_len = report->time ? strlen(report->time) : 0;
+    size_t dps_len = strlen(report->dps);
+    size_t len = OFFLINE_RECORD_HEAD + time_len + dps_len;
+    int rt = OPRT_OK;
+
+    uint8_t *record = tal_malloc(len);
+    if (NULL == record) {
+        return OPRT_MALLOC_FAILED;
+    }
+    record[0] = report->seq & 0xFF;
+    record[1] = (report->seq >> 8) & 0xFF;
+    record[2] = (report->seq >> 16) & 0xFF;
+    record[3] = (report->seq >> 24) & 0xFF;
+    record[4] = time_len & 0xFF;
+    record[5] = (time_len >> 8) & 0xFF;
+    if (time_len) {
+        memcpy(record + OFFLINE_RECORD_HEAD, report->time, time_len);
+    }
+    memcpy(record + OFFLINE_RECORD_HEAD + time_len, report->dps, dps_len);
+
+    snprintf(key, sizeof(key), OFFLINE_QUEUE_KEY, (unsigned int)report->slot);
+    rt = tal_kv_set(key, record, len);
+    tal_free(record);
+
+    return rt;
+}
+
+static offline_report_t *__report_load(uint32_t slot)
+{
+    char key[OFFLINE_QUEUE_KEY_LEN];
+    uint8_t *record = NULL;
+    size_t len = 0;
+    offline_report_t *report = NULL;
+
+    snprintf(key, sizeof(key), OFFLINE_QUEUE_KEY, (unsigned int)slot);
+    if (OPRT_OK != tal_kv_get(key, &record, &len)) {
+        return NULL;
+    }
+
+    size_t time_len = len < OFFLINE_RECORD_HEAD ? 0 : record[4] | (record[5] << 8);
+    if (len <= OFFLINE_RECORD_HEAD + time_len) {
+        PR_WARN("offline report %u broken", (unsigned int)slot);
+        tal_kv_free(record);
+        tal_kv_del(key);
+        return NULL;
+    }
+
+    report = tal_calloc(1, sizeof(offline_report_t));
+    if (report) {
+        report->seq = record[0] | (record[1] << 8) | (record[2] << 16) | ((uint32_t)record[3] << 24);
+        report->slot = slot;
+        report->time = time_len ? tal_calloc(1, time_len + 1) : NULL;
+        report->dps = tal_calloc(1, len - OFFLINE_RECORD_HEAD - time_len + 1);
+        if ((time_len && NULL == report->time) || NULL == report->dps) {
+            __report_free(report);
+            report = NULL;
+        } else {
+            memcpy(report->time, record + OFFLINE_RECORD_HEAD, time_len);
+            memcpy(report->dps, record + OFFLINE_RECORD_HEAD + time_len, len - OFFLINE_RECORD_HEAD - time_len);
+        }
+    }
+    tal_kv_free(record);
+
+    return report;
+}
+
+/* take item[i] out of the queue and flash, it goes to done */
+static void __report_remove(uint32_t i, int result, offline_done_t *done)
+{
+    char key[OFFLINE_QUEUE_KEY_LEN];
+    offline_report_t *report = sg_offline_queue.item[i];
+
+    memmove(&sg_offline_queue.item[i], &sg_offline_queue.item[i + 1],
+            (sg_offline_queue.count - i - 1) * sizeof(offline_report_t *));
+    sg_offline_queue.count--;
+    sg_offline_queue.slot_used &= ~(1u << report->slot);
+    __slots_save();
+
+    snprintf(key, sizeof(key), OFFLINE_QUEUE_KEY, (unsigned int)report->slot);
+    tal_kv_del(key);
+
+    report->result = result;
+    done->item[done->count++] = report;
+}
+
+static void __done_notify(offline_done_t *done)
+{
+    uint32_t i;
+
+    for (i = 0; i < done->count; i++) {
+        offline_report_t *report = done->item[i];
+        if (report->cb) {
+            report->cb(report->result, report->user_data);
+        }
+        __report_free(report);
+    }
+}
+
+static void __queue_collapse(const cJSON *dps, offline_done_t *done)
+{
+    uint32_t i = sg_offline_queue.inflight ? 1 : 0;
+
+    while (i < sg_offline_queue.count) {
+        offline_report_t *report = sg_offline_queue.item[i];
+        const cJSON *dp = NULL;
+        bool changed = false;
+
+        cJSON *queued = report->time ? NULL : cJSON_Parse(report->dps);
+        if (NULL == queued) {
+            i++;
+            continue;
+        }
+        cJSON_ArrayForEach(dp, dps)
+        {
+            if (cJSON_GetObjectItemCaseSensitive(queued, dp->string)) {
+                cJSON_DeleteItemFromObjectCaseSensitive(queued, dp->string);
+                changed = true;
+            }
+        }
+
+        if (changed && NULL == queued->child) {
+            __report_remove(i, OPRT_OK, done);
+            cJSON_Delete(queued);
+            continue;
+        }
+        if (changed) {
+            char *left = cJSON_PrintUnformatted(queued);
+            if (left) {
+                tal_free(report->dps);
+                report->dps = left;
+                __report_save(report);
+            }
+        }
+        cJSON_Delete(queued);
+        i++;
+    }
+}
+
+/**
+ * @brief init the queue and load the reports saved before a reboot
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int tuya_offline_queue_init(void)
+{
+    OPERATE_RET rt = OPRT_OK;
+    uint32_t slot_map = 0;
+    size_t len = 0;
+    uint32_t slot, i;
+
+    if (sg_offline_queue.mutex) {
+        return OPRT_OK;
+    }
+
+    TUYA_CALL_ERR_RETURN(tal_mutex_create_init(&sg_offline_queue.mutex));
+
+    if (OPRT_OK != tal_kv_get_into(OFFLINE_QUEUE_MAP_KEY, (uint8_t *)&slot_map, sizeof(slot_map), &len) ||
+        len != sizeof(slot_map)) {
+        return OPRT_OK;
+    }
+
+    for (slot = 0; slot < MQTT_OFFLINE_QUEUE_MAX; slot++) {
+        if (0 == (slot_map & (1u << slot))) {
+            continue;
+        }
+        offline_report_t *report = __report_load(slot);
+        if (NULL == report) {
+            continue;
+        }
+        // insertion sort by seq, the queue is short
+        for (i = sg_offline_queue.count; i > 0 && sg_offline_queue.item[i - 1]->seq > report->seq; i--) {
+            sg_offline_queue.item[i] = sg_offline_queue.item[i - 1];
+        }
+        sg_offline_queue.item[i] = report;
+        sg_offline_queue.count++;
+        sg_offline_queue.slot_used |= 1u << slot;
+        if (report->seq >= sg_offline_queue.seq) {
+            sg_offline_queue.seq = report->seq + 1;
+        }
+    }
+
+    if (sg_offline_queue.slot_used != slot_map) {
+        __slots_save();
+    }
+    if (sg_offline_queue.count) {
+        PR_NOTICE("offline queue loaded %u reports", (unsigned int)sg_offline_queue.count);
+    }
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief queue a report, the oldest one is dropped with
+ * OPRT_EXCEED_UPPER_LIMIT if the queue is full
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int tuya_offline_queue_push(const char *dps, const char *time, mqtt_publish_notify_cb_t cb, void *user_data)
+{
+    offline_done_t done = {0};
+    cJSON *dps_json = NULL;
+    uint32_t slot;
+    int rt = OPRT_OK;
+
+    if (NULL == dps || NULL == sg_offline_queue.mutex) {
+        return OPRT_INVALID_PARM;
+    }
+
+    if (NULL == time) {
+        dps_json = cJSON_Parse(dps);
+    }
+
+    offline_report_t *report = tal_calloc(1, sizeof(offline_report_t));
+    if (NULL == report) {
+        cJSON_Delete(dps_json);
+        return OPRT_MALLOC_FAILED;
+    }
+    report->dps = __strdup(dps);
+    report->time = time ? __strdup(time) : NULL;
+    report->cb = cb;
+    report->user_data = user_data;
+    if (NULL == report->dps || (time && NULL == report->time)) {
+        __report_free(report);
+        cJSON_Delete(dps_json);
+        return OPRT_MALLOC_FAILED;
+    }
+
+    tal_mutex_lock(sg_offline_queue.mutex);
+    if (dps_json) {
+        __queue_collapse(dps_json, &done);
+    }
+
+    if (MQTT_OFFLINE_QUEUE_MAX == sg_offline_queue.count) {
+        uint32_t oldest = sg_offline_queue.inflight ? 1 : 0;
+        if (oldest < sg_offline_queue.count) {
+            PR_WARN("offline queue full, drop seq %u", (unsigned int)sg_offline_queue.item[oldest]->seq);
+            __report_remove(oldest, OPRT_EXCEED_UPPER_LIMIT, &done);
+        }
+    }
+
+    for (slot = 0; slot < MQTT_OFFLINE_QUEUE_MAX && (sg_offline_queue.slot_used & (1u << slot)); slot++) {
+    }
+    if (slot == MQTT_OFFLINE_QUEUE_MAX) {
+        rt = OPRT_EXCEED_UPPER_LIMIT;
+    } else {
+        report->seq = sg_offline_queue.seq++;
+        report->slot = slot;
+        rt = __report_save(report);
+    }
+    if (OPRT_OK == rt) {
+        sg_offline_queue.slot_used |= 1u << slot;
+        __slots_save();
+        sg_offline_queue.item[sg_offline_queue.count++] = report;
+        report = NULL;
+    }
+    tal_mutex_unlock(sg_offline_queue.mutex);
+
+    if (report) {
+        PR_ERR("offline report save error:%d", rt);
+        __report_free(report);
+    }
+    cJSON_Delete(dps_json);
+    __done_notify(&done);
+
+    return rt;
+}
+
+/**
+ * @brief drop the DPs of dps from the queued reports without time, called for
+ * the reports sent while online
+ */
+void tuya_offline_queue_collapse(const char *dps)
+{
+    offline_done_t done = {0};
+
+    if (NULL == dps || NULL == sg_offline_queue.mutex || 0 == sg_offline_queue.count) {
+        return;
+    }
+
+    cJSON *dps_json = cJSON_Parse(dps);
+    if (NULL == dps_json) {
+        return;
+    }
+
+    tal_mutex_lock(sg_offline_queue.mutex);
+    __queue_collapse(dps_json, &done);
+    tal_mutex_unlock(sg_offline_queue.mutex);
+
+    cJSON_Delete(dps_json);
+    __done_notify(&done);
+}
+
+static void __offline_report_sent_cb(int result, void *user_data)
+{
+    offline_done_t done = {0};
+    uint32_t seq = (uint32_t)(uintptr_t)user_data;
+
+    tal_mutex_lock(sg_offline_queue.mutex);
+    // the queue may have been cleared while the report was in flight
+    if (sg_offline_queue.inflight && sg_offline_queue.count && sg_offline_queue.item[0]->seq == seq) {
+        sg_offline_queue.inflight = false;
+        if (OPRT_OK == result) {
+            __report_remove(0, OPRT_OK, &done);
+        } else {
+            sg_offline_queue.next_send = tal_system_get_millisecond() + OFFLINE_QUEUE_RETRY_MS;
+        }
+    }
+    tal_mutex_unlock(sg_offline_queue.mutex);
+
+    __done_notify(&done);
+}
+
+/**
+ * @brief send the oldest report if none is waiting for its PUBACK and the
+ * rate limit allows it, called from the MQTT loop while connected
+ */
+void tuya_offline_queue_drain(tuya_offline_send_t send)
+{
+    offline_report_t *report = NULL;
+    SYS_TIME_T now = tal_system_get_millisecond();
+
+    if (NULL == sg_offline_queue.mutex || 0 == sg_offline_queue.count) {
+        return;
+    }
+
+    tal_mutex_lock(sg_offline_queue.mutex);
+    if (!sg_offline_queue.inflight && sg_offline_queue.count && now >= sg_offline_queue.next_send) {
+        report = sg_offline_queue.item[0];
+        sg_offline_queue.inflight = true;
+        sg_offline_queue.next_send = now + MQTT_OFFLINE_QUEUE_INTERVAL_MS;
+    }
+    tal_mutex_unlock(sg_offline_queue.mutex);
+
+    if (NULL == report) {
+        return;
+    }
+
+    // item[0] stays while inflight is set, only the caller's thread clears it
+    int rt = send(report->dps, report->time, __offline_report_sent_cb, (void *)(uintptr_t)report->seq);
+    if (OPRT_OK != rt) {
+        PR_WARN("offline report send error:%d", rt);
+        tal_mutex_lock(sg_offline_queue.mutex);
+        sg_offline_queue.inflight = false;
+        sg_offline_queue.next_send = now + OFFLINE_QUEUE_RETRY_MS;
+        tal_mutex_unlock(sg_offline_queue.mutex);
+    }
+}
+
+/**
+ * @brief number of queued reports
+ */
+uint32_t tuya_offline_queue_count(void)
+{
+    return sg_offline_queue.count;
+}
+
+/**
+ * @brief drop every report from RAM and flash, the cb of each one is called
+ * with OPRT_COM_ERROR
+ */
+void tuya_offline_queue_clear(void)
+{
+    offline_done_t done = {0};
+
+    if (NULL == sg_offline_queue.mutex) {
+        return;
+    }
+
+    tal_mutex_lock(sg_offline_queue.mutex);
+    while (sg_offline_queue.count) {
+        __report_remove(0, OPRT_COM_ERROR, &done);
+    }
+    sg_offline_queue.inflight = false;
+    tal_mutex_unlock(sg_offline_queue.mutex);
+
+    // lets the owners release their user_data
+    __done_notify(&done);
+}
+
+#endif
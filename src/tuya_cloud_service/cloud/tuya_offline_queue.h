@@ -0,0 +1,80 @@
+/**
+ * @file tuya_offline_queue.h
+ * @brief Flash-backed queue of the DP reports made while MQTT is offline.
+ *
+ * With ENABLE_MQTT_OFFLINE_QUEUE, tuya_iot_dp_report_json_async/with_notify
+ * store their report here instead of failing while the MQTT link is down.
+ * The reports are written through tal_kv, so they also survive a reboot, and
+ * are sent again in order at a limited rate once the link is back.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef __TUYA_OFFLINE_QUEUE_H__
+#define __TUYA_OFFLINE_QUEUE_H__
+
+#include "tuya_cloud_types.h"
+#include "mqtt_publish_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief send one queued report, cb must be called once with the PUBACK
+ * result if OPRT_OK is returned
+ */
+typedef int (*tuya_offline_send_t)(const char *dps, const char *time, mqtt_publish_notify_cb_t cb, void *user_data);
+
+/**
+ * @brief init the queue and load the reports saved before a reboot
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int tuya_offline_queue_init(void);
+
+/**
+ * @brief queue a report, the oldest one is dropped with
+ * OPRT_EXCEED_UPPER_LIMIT if the queue is full
+ *
+ * Queued reports without time lose the DPs that dps reports again, a report
+ * left without DPs completes with OPRT_OK.
+ *
+ * @param[in] dps DP object, e.g. {"1":true,"2":30}
+ * @param[in] time time JSON of the report, NULL for none
+ * @param[in] cb called with the PUBACK result once the report is sent, it is
+ * not called for reports loaded after a reboot
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int tuya_offline_queue_push(const char *dps, const char *time, mqtt_publish_notify_cb_t cb, void *user_data);
+
+/**
+ * @brief drop the DPs of dps from the queued reports without time, called for
+ * the reports sent while online
+ */
+void tuya_offline_queue_collapse(const char *dps);
+
+/**
+ * @brief send the oldest report if none is waiting for its PUBACK and the
+ * rate limit allows it, called from the MQTT loop while connected
+ */
+void tuya_offline_queue_drain(tuya_offline_send_t send);
+
+/**
+ * @brief number of queued reports
+ */
+uint32_t tuya_offline_queue_count(void);
+
+/**
+ * @brief drop every report from RAM and flash, the cb of each one is called
+ * with OPRT_COM_ERROR
+ */
+void tuya_offline_queue_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TUYA_OFFLINE_QUEUE_H__ */
@@ -28,7 +28,6 @@ typedef struct {
     uint8_t channel;
     uint8_t progress_percent;
     THREAD_HANDLE upgrade_thrd;
-    TKL_HASH_HANDLE sha256;
 } tuya_ota_t;
 
 int tuya_ota_upgrade_status_report(tuya_ota_t *handle, int status);
@@ -49,8 +48,6 @@ static void file_download_event_cb(http_download_event_id_t id, http_download_ev
     case DL_EVENT_START:
         PR_DEBUG("DL_EVENT_START");
         tuya_ota_upgrade_status_report(ota, TUS_UPGRDING);
-        tal_sha256_create_init(&ota->sha256);
-        tal_sha256_starts_ret(ota->sha256, 0);
         break;
 
     case DL_EVENT_ON_FILESIZE:
@@ -77,11 +74,6 @@ static void file_download_event_cb(http_download_event_id_t id, http_download_ev
             ota_pack.len = event->data_len;
             ota_pack.pri_data = NULL;
             tal_ota_data_process(&ota_pack, (uint32_t *)&event->remain_len);
-            if (event->remain_len) {
-                tal_sha256_update_ret(ota->sha256, event->data, event->data_len - event->remain_len);
-            } else {
-                tal_sha256_update_ret(ota->sha256, event->data, event->data_len);
-            }
         } else if (event_cb) {
             ota->event.id = TUYA_OTA_EVENT_ON_DATA;
             ota->event.data = event->data;
@@ -101,9 +93,8 @@ static void file_download_event_cb(http_download_event_id_t id, http_download_ev
     case DL_EVENT_FINISH:
         PR_DEBUG("DL_EVENT_FINISH");
         PR_DEBUG("File Download Percent: %d%%", 100);
-        tal_sha256_finish_ret(ota->sha256, file_hmac);
-        tal_sha256_free(ota->sha256);
-        hex2str((uint8_t *)file_sha256, file_hmac, 32);
+        /* the downloader hashes the data as the handler consumes it */
+        hex2str((uint8_t *)file_sha256, (uint8_t *)event->sha256, 32);
         tal_sha256_mac((const uint8_t *)client->activate.seckey, strlen(client->activate.seckey), file_sha256, 32 * 2,
                        file_hmac);
         ascs2hex(self_hmac, (uint8_t *)(ota->msg.fw_hmac), FW_HMAC_LEN);
@@ -170,6 +161,7 @@ static void ota_process_thread_func(void *arg)
     tuya_iotdns_query_domain_certs(ota->msg.fw_url, &cert, &cert_len);
 
     http_download_config_t download_cfg;
+    memset(&download_cfg, 0, sizeof(download_cfg));
     download_cfg.file_size = ota->msg.file_size;
     download_cfg.range_length = ota->config.range_size;
     download_cfg.timeout_ms = ota->config.timeout_ms;
@@ -12,6 +12,12 @@
  * handling and socket event detection are integral parts of the loop to ensure
  * robust operation.
  *
+ * On Linux the loop waits in epoll instead, with an eventfd in the set that
+ * tuya_reg_lan_sock and tuya_unreg_lan_sock signal, so a new socket is
+ * watched at once and only the ready sockets are dispatched. The select
+ * loop stays as the fallback when epoll cannot be used, e.g. for the sockets
+ * of an AT modem.
+ *
  * Additionally, the file includes utility functions for setting up the
  * environment for socket event handling, including initializing and
  * deinitializing resources, managing the socket readers list, and processing
@@ -25,11 +31,23 @@
  *
  */
 
+#include "tuya_iot_config.h"
 #include "lan_sock.h"
 #include "tal_api.h"
 #include "tal_network.h"
+#include "tal_network_register.h"
 #include "tuya_lan.h"
 
+#if OPERATING_SYSTEM == SYSTEM_LINUX
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#define LAN_SLOOP_EPOLL 1
+#else
+#define LAN_SLOOP_EPOLL 0
+#endif
+
 #pragma pack(1)
 
 #define LAN_UDP_READER_CNT 5
@@ -40,12 +58,27 @@ typedef struct LAN_SLOOP_S {
     sloop_sock_t *readers;
     BOOL_T terminate;
     QUEUE_HANDLE queue;
+    uint8_t *writing; // readers watched for writing
+#if LAN_SLOOP_EPOLL
+    int epfd;   // -1 when the select loop is used
+    int wakefd; // eventfd signaled on queue posts
+#endif
 } LAN_SLOOP_S, *P_LAN_SLOOP_S;
 #pragma pack()
 
 static P_LAN_SLOOP_S g_sloop = NULL;
+// queue length, at least a register and an unregister per reader
 #define LAN_QUEUE_NUM 6
 
+// wait of a loop pass, pre_select runs at least this often
+#define LAN_SLOOP_WAIT_MS 1000
+
+#if LAN_SLOOP_EPOLL
+#define LAN_SLOOP_EVENT_NUM 16
+// epoll data of the eventfd, the sockets carry their reader index
+#define LAN_SLOOP_WAKE_IDX 0xFFFFFFFF
+#endif
+
 #ifndef STACK_SIZE_LAN
 #define STACK_SIZE_LAN (4 * 1024)
 #endif
@@ -55,14 +88,120 @@ static uint32_t __ty_sock_get_reader_num(void)
     return (LAN_UDP_READER_CNT + tuya_lan_get_client_num());
 }
 
-static void __sock_table_set_fds(TUYA_FD_SET_T *rfds, TUYA_FD_SET_T *efds)
+static void __sock_table_set_fds(TUYA_FD_SET_T *rfds, TUYA_FD_SET_T *wfds, TUYA_FD_SET_T *efds)
 {
     int idx;
     for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
         if (g_sloop->readers[idx].sock >= 0) {
             tal_net_fd_set(g_sloop->readers[idx].sock, rfds);
             tal_net_fd_set(g_sloop->readers[idx].sock, efds);
+            if (g_sloop->writing[idx]) {
+                tal_net_fd_set(g_sloop->readers[idx].sock, wfds);
+            }
+        }
+    }
+}
+
+#if LAN_SLOOP_EPOLL
+static void __sloop_epoll_init(void)
+{
+    g_sloop->epfd = -1;
+    g_sloop->wakefd = -1;
+
+    // the sockets of an AT modem are no file descriptors of the system
+    if (TAL_NET_TYPE_AT_MODEM == tal_network_card_get_active_type()) {
+        return;
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = LAN_SLOOP_WAKE_IDX};
+    if (epfd < 0 || wakefd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) < 0) {
+        PR_WARN("epoll init err, use select");
+        if (epfd >= 0) {
+            close(epfd);
+        }
+        if (wakefd >= 0) {
+            close(wakefd);
+        }
+        return;
+    }
+
+    g_sloop->epfd = epfd;
+    g_sloop->wakefd = wakefd;
+}
+
+static void __sloop_epoll_deinit(void)
+{
+    if (g_sloop->epfd >= 0) {
+        close(g_sloop->epfd);
+        g_sloop->epfd = -1;
+    }
+    if (g_sloop->wakefd >= 0) {
+        close(g_sloop->wakefd);
+        g_sloop->wakefd = -1;
+    }
+}
+
+static void __sloop_epoll_add(int idx)
+{
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = idx};
+
+    if (g_sloop->epfd < 0) {
+        return;
+    }
+    if (epoll_ctl(g_sloop->epfd, EPOLL_CTL_ADD, g_sloop->readers[idx].sock, &ev) < 0) {
+        PR_ERR("epoll add sock %d err:%d", g_sloop->readers[idx].sock, tal_net_get_errno());
+    }
+}
+
+static void __sloop_epoll_mod(int idx)
+{
+    struct epoll_event ev = {.events = EPOLLIN | (g_sloop->writing[idx] ? EPOLLOUT : 0), .data.u32 = idx};
+
+    if (g_sloop->epfd >= 0 && epoll_ctl(g_sloop->epfd, EPOLL_CTL_MOD, g_sloop->readers[idx].sock, &ev) < 0) {
+        PR_ERR("epoll mod sock %d err:%d", g_sloop->readers[idx].sock, tal_net_get_errno());
+    }
+}
+
+static void __sloop_epoll_del(int sock)
+{
+    if (g_sloop->epfd >= 0) {
+        epoll_ctl(g_sloop->epfd, EPOLL_CTL_DEL, sock, NULL);
+    }
+}
+#endif
+
+static void __sloop_wakeup(void)
+{
+#if LAN_SLOOP_EPOLL
+    uint64_t one = 1;
+
+    if (g_sloop && g_sloop->wakefd >= 0) {
+        if (write(g_sloop->wakefd, &one, sizeof(one)) < 0) {
+            PR_TRACE("wakeup err");
+        }
+    }
+#endif
+}
+
+static void __sloop_writing_update(void)
+{
+    int idx = 0;
+    uint8_t writing = 0;
+
+    for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
+        if (g_sloop->readers[idx].sock < 0 || NULL == g_sloop->readers[idx].want_write) {
+            continue;
         }
+        writing = g_sloop->readers[idx].want_write(g_sloop->readers[idx].sock) ? 1 : 0;
+        if (writing == g_sloop->writing[idx]) {
+            continue;
+        }
+        g_sloop->writing[idx] = writing;
+#if LAN_SLOOP_EPOLL
+        __sloop_epoll_mod(idx);
+#endif
     }
 }
 
@@ -102,9 +241,14 @@ void __ty_sock_loop_deinit(void)
         tal_free(g_sloop->readers);
         g_sloop->readers = NULL;
     }
+    tal_free(g_sloop->writing);
+    g_sloop->writing = NULL;
     if (g_sloop->queue) {
         tal_queue_free(g_sloop->queue);
     }
+#if LAN_SLOOP_EPOLL
+    __sloop_epoll_deinit();
+#endif
     if (g_sloop->thread) {
         tal_thread_delete(g_sloop->thread);
     }
@@ -136,7 +280,11 @@ void __ty_add_sock_reader(sloop_sock_t sock_info)
                 PR_DEBUG("reg lan sock %d,read:%p", sock_info.sock, sock_info.read);
                 memset(&g_sloop->readers[idx], 0, sizeof(sloop_sock_t));
                 memcpy(&g_sloop->readers[idx], &sock_info, sizeof(sloop_sock_t));
+                g_sloop->writing[idx] = 0;
                 g_sloop->cnt++;
+#if LAN_SLOOP_EPOLL
+                __sloop_epoll_add(idx);
+#endif
                 break;
             }
         }
@@ -156,12 +304,18 @@ void __ty_del_sock_reader(int sock)
     for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
         if (g_sloop->readers[idx].sock == sock) {
             PR_DEBUG("unreg lan sock %d and close it", sock);
+#if LAN_SLOOP_EPOLL
+            __sloop_epoll_del(sock);
+#endif
             tal_net_close(g_sloop->readers[idx].sock);
             g_sloop->readers[idx].sock = -1;
             // g_sloop->readers[idx].pre_select = NULL;
             g_sloop->readers[idx].read = NULL;
             g_sloop->readers[idx].err = NULL;
             g_sloop->readers[idx].quit = NULL;
+            g_sloop->readers[idx].want_write = NULL;
+            g_sloop->readers[idx].write = NULL;
+            g_sloop->writing[idx] = 0;
             g_sloop->cnt--;
             break;
         }
@@ -175,89 +329,176 @@ void __ty_del_sock_reader(int sock)
     return;
 }
 
-void tuya_sock_loop_run(void *data)
+static void __sloop_cmd_handle(uint32_t timeout_ms)
+{
+    sloop_sock_t queue_data = {0};
+
+    // apply every pending command, not one per pass, so a burst of new
+    // sessions is watched at once
+    while (tal_queue_fetch(g_sloop->queue, &queue_data, timeout_ms) == 0) {
+        if (queue_data.read) {
+            __ty_add_sock_reader(queue_data);
+        } else {
+            __ty_del_sock_reader(queue_data.sock);
+        }
+        memset(&queue_data, 0, sizeof(sloop_sock_t));
+        timeout_ms = 0;
+    }
+}
+
+static void __sloop_select_wait(TUYA_FD_SET_T *rfds, TUYA_FD_SET_T *wfds, TUYA_FD_SET_T *efds)
 {
     int actv_cnt = 0;
     int idx = 0;
-    TUYA_FD_SET_T *rfds, *efds;
-    sloop_sock_t queue_data = {0};
+    int sock = -1;
 
-    rfds = tal_malloc(sizeof(TUYA_FD_SET_T));
-    efds = tal_malloc(sizeof(TUYA_FD_SET_T));
-    if (rfds == NULL || efds == NULL) {
-        PR_ERR("malloc err");
-        goto Err;
+    if (g_sloop->cnt == 0) {
+        // nothing to watch, wait for a socket to be registered
+        __sloop_cmd_handle(2000);
+        return;
     }
-    memset(rfds, 0, sizeof(TUYA_FD_SET_T));
-    memset(efds, 0, sizeof(TUYA_FD_SET_T));
 
-    // while (tuya_get_sock_loop_terminate() &&
-    // tal_thread_get_state(g_sloop->thread) == THREAD_STATE_RUNNING) {
-    while (tuya_get_sock_loop_terminate()) {
-        memset(&queue_data, 0, sizeof(sloop_sock_t));
-        if (tal_queue_fetch(g_sloop->queue, &queue_data, 0) == 0) {
-            if (queue_data.read) {
-                __ty_add_sock_reader(queue_data);
-            } else {
-                __ty_del_sock_reader(queue_data.sock);
+    tal_net_fd_zero(rfds);
+    tal_net_fd_zero(wfds);
+    tal_net_fd_zero(efds);
+    __sock_table_set_fds(rfds, wfds, efds);
+    actv_cnt = tal_net_select(g_sloop->max_sock + 1, rfds, wfds, efds, LAN_SLOOP_WAIT_MS);
+    if (actv_cnt < 0) {
+        PR_ERR("errno:%d", tal_net_get_errno());
+        __sock_select_err_handle();
+        tal_system_sleep(1000);
+        return;
+    }
+
+    for (idx = 0; idx < __ty_sock_get_reader_num() && actv_cnt > 0; idx++) {
+        sock = g_sloop->readers[idx].sock;
+        if (sock < 0) {
+            continue;
+        }
+        if (tal_net_fd_isset(sock, efds)) {
+            if (g_sloop->readers[idx].err) {
+                PR_ERR("socket err:%d, sock:%d, idx:%d", tal_net_get_errno(), sock, idx);
+                g_sloop->readers[idx].err(sock);
             }
+            actv_cnt--;
         }
-        for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
-            if (g_sloop->readers[idx].pre_select) {
-                g_sloop->readers[idx].pre_select();
+        if (tal_net_fd_isset(sock, rfds)) {
+            if (g_sloop->readers[idx].read) {
+                g_sloop->readers[idx].read(sock);
             }
+            actv_cnt--;
         }
-        if (g_sloop->cnt == 0) {
-            tal_system_sleep(2000);
-            continue;
+        if (g_sloop->writing[idx] && tal_net_fd_isset(sock, wfds)) {
+            if (g_sloop->readers[idx].write) {
+                g_sloop->readers[idx].write(sock);
+            }
+            actv_cnt--;
         }
+    }
+}
 
-        tal_net_fd_zero(rfds);
-        tal_net_fd_zero(efds);
-        __sock_table_set_fds(rfds, efds);
-        actv_cnt = tal_net_select(g_sloop->max_sock + 1, rfds, NULL, efds, 1 * 1000);
-        if (actv_cnt < 0) {
-            PR_ERR("errno:%d", tal_net_get_errno());
-            __sock_select_err_handle();
+#if LAN_SLOOP_EPOLL
+static void __sloop_epoll_wait(struct epoll_event *events)
+{
+    int actv_cnt = 0;
+    int i = 0;
+    uint32_t idx = 0;
+    int sock = -1;
+    uint64_t val = 0;
+
+    actv_cnt = epoll_wait(g_sloop->epfd, events, LAN_SLOOP_EVENT_NUM, LAN_SLOOP_WAIT_MS);
+    if (actv_cnt < 0) {
+        if (errno != EINTR) {
+            PR_ERR("epoll errno:%d", errno);
             tal_system_sleep(1000);
+        }
+        return;
+    }
+
+    for (i = 0; i < actv_cnt; i++) {
+        idx = events[i].data.u32;
+        if (idx == LAN_SLOOP_WAKE_IDX) {
+            if (read(g_sloop->wakefd, &val, sizeof(val)) < 0) {
+                PR_TRACE("wakeup read err");
+            }
             continue;
-        } else if (actv_cnt == 0) {
+        }
+        if (idx >= (uint32_t)__ty_sock_get_reader_num()) {
             continue;
-        } else {
-            for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
-                if (g_sloop->readers[idx].sock >= 0) {
-                    if (0 == tal_net_fd_isset(g_sloop->readers[idx].sock, efds)) {
-                        continue;
-                    }
-                    if (g_sloop->readers[idx].err) {
-                        PR_ERR("socket err:%d, sock:%d, idx:%d", tal_net_get_errno(), g_sloop->readers[idx].sock, idx);
-                        g_sloop->readers[idx].err(g_sloop->readers[idx].sock);
-                    }
-                    actv_cnt--;
-                    if (0 == actv_cnt) {
-                        break;
-                    }
-                }
-            }
         }
-
-        if (0 == actv_cnt) {
+        sock = g_sloop->readers[idx].sock;
+        if (sock < 0) {
             continue;
         }
+        if ((events[i].events & EPOLLERR) && g_sloop->readers[idx].err) {
+            PR_ERR("socket err, sock:%d, idx:%d", sock, idx);
+            g_sloop->readers[idx].err(sock);
+        }
+        // a hang up is seen by the read as the end of the stream
+        if ((events[i].events & (EPOLLIN | EPOLLHUP)) && g_sloop->readers[idx].read) {
+            g_sloop->readers[idx].read(sock);
+        }
+        if ((events[i].events & EPOLLOUT) && g_sloop->readers[idx].write) {
+            g_sloop->readers[idx].write(sock);
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Runs the socket loop.
+ *
+ * Each pass applies the queued register and unregister commands, calls the
+ * pre_select callbacks, then waits up to LAN_SLOOP_WAIT_MS for the sockets
+ * and dispatches the ready ones.
+ *
+ * @param data Unused.
+ */
+void tuya_sock_loop_run(void *data)
+{
+    int idx = 0;
+    TUYA_FD_SET_T *rfds = NULL, *wfds = NULL, *efds = NULL;
+#if LAN_SLOOP_EPOLL
+    struct epoll_event *events = NULL;
+
+    if (g_sloop->epfd >= 0) {
+        events = tal_malloc(LAN_SLOOP_EVENT_NUM * sizeof(struct epoll_event));
+        if (events == NULL) {
+            PR_ERR("malloc err");
+            goto Err;
+        }
+    } else
+#endif
+    {
+        rfds = tal_malloc(sizeof(TUYA_FD_SET_T));
+        wfds = tal_malloc(sizeof(TUYA_FD_SET_T));
+        efds = tal_malloc(sizeof(TUYA_FD_SET_T));
+        if (rfds == NULL || wfds == NULL || efds == NULL) {
+            PR_ERR("malloc err");
+            goto Err;
+        }
+        memset(rfds, 0, sizeof(TUYA_FD_SET_T));
+        memset(wfds, 0, sizeof(TUYA_FD_SET_T));
+        memset(efds, 0, sizeof(TUYA_FD_SET_T));
+    }
 
+    // while (tuya_get_sock_loop_terminate() &&
+    // tal_thread_get_state(g_sloop->thread) == THREAD_STATE_RUNNING) {
+    while (tuya_get_sock_loop_terminate()) {
+        __sloop_cmd_handle(0);
         for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
-            if (g_sloop->readers[idx].sock >= 0) {
-                if (tal_net_fd_isset(g_sloop->readers[idx].sock, rfds)) {
-                    if (g_sloop->readers[idx].read) {
-                        g_sloop->readers[idx].read(g_sloop->readers[idx].sock);
-                        actv_cnt--;
-                        if (0 == actv_cnt) {
-                            break;
-                        }
-                    }
-                }
+            if (g_sloop->readers[idx].pre_select) {
+                g_sloop->readers[idx].pre_select();
             }
         }
+        __sloop_writing_update();
+#if LAN_SLOOP_EPOLL
+        if (events) {
+            __sloop_epoll_wait(events);
+            continue;
+        }
+#endif
+        __sloop_select_wait(rfds, wfds, efds);
     }
 
     for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
@@ -267,9 +508,15 @@ void tuya_sock_loop_run(void *data)
     }
 
 Err:
+#if LAN_SLOOP_EPOLL
+    tal_free(events);
+#endif
     if (rfds) {
         tal_free(rfds);
     }
+    if (wfds) {
+        tal_free(wfds);
+    }
     if (efds) {
         tal_free(efds);
     }
@@ -307,7 +554,11 @@ OPERATE_RET tuya_sock_loop_init(void)
     memset(g_sloop, 0, sizeof(LAN_SLOOP_S));
     g_sloop->terminate = TRUE;
 
-    op_ret = tal_queue_create_init(&g_sloop->queue, sizeof(sloop_sock_t), LAN_QUEUE_NUM);
+    uint32_t queue_num = 2 * __ty_sock_get_reader_num();
+    if (queue_num < LAN_QUEUE_NUM) {
+        queue_num = LAN_QUEUE_NUM;
+    }
+    op_ret = tal_queue_create_init(&g_sloop->queue, sizeof(sloop_sock_t), queue_num);
     if (OPRT_OK != op_ret) {
         PR_ERR("init queue err");
         goto Err;
@@ -323,6 +574,16 @@ OPERATE_RET tuya_sock_loop_init(void)
     for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
         g_sloop->readers[idx].sock = -1;
     }
+    g_sloop->writing = tal_malloc(__ty_sock_get_reader_num());
+    if (NULL == g_sloop->writing) {
+        PR_ERR("tal_malloc err");
+        op_ret = OPRT_MALLOC_FAILED;
+        goto Err;
+    }
+    memset(g_sloop->writing, 0, __ty_sock_get_reader_num());
+#if LAN_SLOOP_EPOLL
+    __sloop_epoll_init();
+#endif
     THREAD_CFG_T thread_cfg = {.priority = THREAD_PRIO_2, .stackDepth = STACK_SIZE_LAN, .thrdname = "lan_sock_loop"};
 
     op_ret = tal_thread_create_and_start(&g_sloop->thread, NULL, NULL, tuya_sock_loop_run, NULL, &thread_cfg);
@@ -360,6 +621,7 @@ OPERATE_RET tuya_reg_lan_sock(sloop_sock_t sock_info)
         PR_ERR("queue post err");
         return op_ret;
     }
+    __sloop_wakeup();
     PR_DEBUG("reg post queue %d", sock_info.sock);
     return OPRT_OK;
 }
@@ -385,6 +647,7 @@ OPERATE_RET tuya_unreg_lan_sock(int sock)
         PR_ERR("queue post err");
         return op_ret;
     }
+    __sloop_wakeup();
     PR_DEBUG("unreg post queue %d", sock);
     return OPRT_OK;
 }
@@ -402,6 +665,18 @@ void tuya_sock_loop_disable(void)
     }
 
     g_sloop->terminate = FALSE;
+    __sloop_wakeup();
+}
+
+/**
+ * @brief Wakes the socket loop up.
+ *
+ * The loop polls the want_write callbacks again at once instead of at the end
+ * of its current wait, e.g. after data was queued on a socket.
+ */
+void tuya_sock_loop_wakeup(void)
+{
+    __sloop_wakeup();
 }
 
 /**
@@ -11,6 +11,11 @@
  * Additionally, it supports the registration and handling of LAN commands
  * through a flexible callback mechanism.
  *
+ * Each session keeps its AES-GCM key expanded once the session key is agreed,
+ * and sends under its own lock. Frames the socket does not take at once wait
+ * in a bounded per-session queue that the LAN socket loop flushes when the
+ * socket is writable, so a slow client never blocks the sends to the others.
+ *
  * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
  *
  */
@@ -35,8 +40,17 @@
 #define SERV_PORT_TCP           6668 // device listens for the APP TCP connection
 #define SERV_PORT_APP_UDP_BCAST 7000 // APP broadcast, device listening port
 
+#ifndef LAN_CLIENT_NUM
+#define LAN_CLIENT_NUM 3
+#endif
+
+#ifndef LAN_SEND_QUEUE_NUM
+#define LAN_SEND_QUEUE_NUM 8
+#endif
+
 #define UDP_T_ITRV         5 // s
-#define CLIENT_LMT         3
+#define CLIENT_LMT         LAN_CLIENT_NUM
+#define LISTEN_BACKLOG     (CLIENT_LMT > 5 ? CLIENT_LMT : 5)
 #define RECV_BUF_LMT       512
 #define LAN_FRAME_MAX_LEN  (4 * 1024)
 #define HEART_BEAT_TIMEOUT 30
@@ -46,6 +60,11 @@
 #define RAND_LEN       16
 #define SESSIONKEY_LEN 16
 
+typedef struct {
+    uint8_t *buf;
+    uint32_t len;
+} lan_send_buf_t;
+
 typedef struct {
     BOOL_T active;
     BOOL_T fault;
@@ -57,6 +76,16 @@ typedef struct {
     uint8_t randB[RAND_LEN];
     uint8_t hmac[HMAC_LEN];
     uint8_t secret_key[SESSIONKEY_LEN];
+    BOOL_T key_ready;           // secret_key is agreed, its first byte may be 0
+    uint32_t allow_no_key_num;
+    MUTEX_HANDLE send_mutex;    // kept across the uses of the slot
+    cipher_gcm_key_t *gcm_enc;  // secret_key expanded for lan_send
+    cipher_gcm_key_t *gcm_dec;  // secret_key expanded for the frames read
+    lan_send_buf_t sendq[LAN_SEND_QUEUE_NUM];
+    uint8_t sendq_head;
+    uint8_t sendq_cnt;
+    uint32_t sendq_offset;      // bytes of the head frame already sent
+    TIME_T sendq_time;          // last progress of the queue
 } lan_session_t;
 
 typedef struct {
@@ -111,10 +140,72 @@ static lan_mgr_t *lan_mgr_get(void)
     return s_lan_mgr;
 }
 
+static void lan_session_sendq_clear(lan_session_t *session)
+{
+    while (session->sendq_cnt) {
+        tal_free(session->sendq[session->sendq_head].buf);
+        session->sendq_head = (session->sendq_head + 1) % LAN_SEND_QUEUE_NUM;
+        session->sendq_cnt--;
+    }
+    session->sendq_offset = 0;
+}
+
+static void lan_session_key_free(cipher_gcm_key_t **gcm_key)
+{
+    if (*gcm_key) {
+        mbedtls_gcm_key_free_wrapper(*gcm_key);
+        tal_free(*gcm_key);
+        *gcm_key = NULL;
+    }
+}
+
 static void lan_session_free(lan_session_t *session)
 {
+    MUTEX_HANDLE send_mutex = session->send_mutex;
+
+    if (send_mutex) {
+        tal_mutex_lock(send_mutex);
+    }
+    lan_session_sendq_clear(session);
+    lan_session_key_free(&session->gcm_enc);
+    lan_session_key_free(&session->gcm_dec);
     memset(session, 0, sizeof(lan_session_t));
     session->fd = -1;
+    session->send_mutex = send_mutex;
+    if (send_mutex) {
+        tal_mutex_unlock(send_mutex);
+    }
+}
+
+static cipher_gcm_key_t *lan_session_key_make(const uint8_t *key)
+{
+    cipher_gcm_key_t *gcm_key = tal_malloc(sizeof(cipher_gcm_key_t));
+    if (NULL == gcm_key) {
+        return NULL;
+    }
+    mbedtls_gcm_key_init_wrapper(gcm_key);
+    if (OPRT_OK != mbedtls_gcm_key_setup_wrapper(gcm_key, key, SESSIONKEY_LEN)) {
+        lan_session_key_free(&gcm_key);
+    }
+
+    return gcm_key;
+}
+
+// secret_key is agreed, expand it once, the frames fall back to expanding it
+// per frame if this fails
+static void lan_session_key_setup(lan_session_t *session)
+{
+    cipher_gcm_key_t *gcm_enc = lan_session_key_make(session->secret_key);
+    cipher_gcm_key_t *gcm_dec = lan_session_key_make(session->secret_key);
+
+    tal_mutex_lock(session->send_mutex);
+    lan_session_key_free(&session->gcm_enc);
+    session->gcm_enc = gcm_enc;
+    session->key_ready = TRUE;
+    tal_mutex_unlock(session->send_mutex);
+    // only the sock loop reads frames
+    lan_session_key_free(&session->gcm_dec);
+    session->gcm_dec = gcm_dec;
 }
 
 static void lan_session_close(lan_session_t *session)
@@ -162,6 +253,7 @@ static void lan_sesison_add(int socket, TIME_T time)
         lan->session[i].fault = false;
         lan->session[i].time = time;
         lan->session[i].sequence_out = uni_random_range(0xFFFF);
+        lan->session[i].allow_no_key_num = lan->cfg->allow_no_session_key_num;
         lan->fd_num++;
         break;
     }
@@ -243,7 +335,8 @@ static void lan_session_time_check(const TIME_T time)
         if (lan->session[i].active) {
             if ((time - lan->session[i].time) >= 2592000 && (true != lan->session[i].fault)) { // 1 month sencond
                 continue;
-            } else if ((time - lan->session[i].time >= lan->cfg->heart_timeout) || (lan->session[i].fault == true)) {
+            } else if ((time - lan->session[i].time >= lan->cfg->heart_timeout) || (lan->session[i].fault == true) ||
+                       (lan->session[i].sendq_cnt && time - lan->session[i].sendq_time >= lan->cfg->heart_timeout)) {
                 PR_DEBUG("i:%d,time:%d,time:%d,fault:%d", i, time, lan->session[i].time, lan->session[i].fault);
                 lan_session_close(&lan->session[i]);
             }
@@ -376,7 +469,7 @@ static int lan_tcp_setup_serv_socket(int port)
     }
     ret = tal_net_set_reuse(fd);
     ret |= tal_net_bind(fd, ip_addr, port);
-    ret |= tal_net_listen(fd, 5);
+    ret |= tal_net_listen(fd, LISTEN_BACKLOG);
     if (OPRT_OK != ret) {
         ret = OPRT_SOCK_ERR;
         goto __exit;
@@ -427,6 +520,38 @@ static int lan_get_valid_socket_num(lan_mgr_t *lan)
     return (num - fault_cnt);
 }
 
+// send the queued frames as far as the socket takes them, with send_mutex held
+static int lan_session_sendq_flush(lan_session_t *session)
+{
+    lan_send_buf_t *head = NULL;
+    int ret = 0;
+
+    while (session->sendq_cnt) {
+        head = &session->sendq[session->sendq_head];
+        ret = tal_net_send(session->fd, head->buf + session->sendq_offset, head->len - session->sendq_offset);
+        if (ret < 0) {
+            TUYA_ERRNO err = tal_net_get_errno();
+            if (err == UNW_EINTR || err == UNW_EAGAIN || err == UNW_EWOULDBLOCK) {
+                return OPRT_OK;
+            }
+            PR_ERR("send err fd:%d errno:%d", session->fd, tal_net_get_errno());
+            return OPRT_SVC_LAN_SEND_ERR;
+        }
+        session->sendq_time = tal_time_get_posix();
+        session->sendq_offset += ret;
+        if (session->sendq_offset < head->len) {
+            return OPRT_OK;
+        }
+        tal_free(head->buf);
+        head->buf = NULL;
+        session->sendq_offset = 0;
+        session->sendq_head = (session->sendq_head + 1) % LAN_SEND_QUEUE_NUM;
+        session->sendq_cnt--;
+    }
+
+    return OPRT_OK;
+}
+
 static int lan_send(lan_session_t *session, uint32_t fr_num, uint32_t fr_type, uint32_t ret_code, uint8_t *data,
                     uint32_t len, BOOL_T encryption)
 {
@@ -439,79 +564,79 @@ static int lan_send(lan_session_t *session, uint32_t fr_num, uint32_t fr_type, u
         PR_ERR("session->active == false");
         return OPRT_COM_ERROR;
     }
-    tal_mutex_lock(s_lan_mgr->mutex);
     if (session->fault == true) {
         PR_ERR("session is error");
-        tal_mutex_unlock(s_lan_mgr->mutex);
         return OPRT_SVC_LAN_SOCKET_FAULT;
     }
-    tal_mutex_unlock(s_lan_mgr->mutex);
 
     uint8_t *send_buf = NULL;
-    uint32_t send_len = 0;
+    int send_len = 0;
 
     PR_TRACE("tcp sendbuf socket:%d fr_num:%u fr_type:%d ret:%d len:%d", session->fd, fr_num, fr_type, ret_code, len);
 
-    uint8_t *key = NULL;
     lan_mgr_t *lan = lan_mgr_get();
-    if (lan->iot_client->is_activated) {
-        if (session->secret_key[0]) {
-            key = (uint8_t *)session->secret_key;
-        } else {
-            key = (uint8_t *)lan->iot_client->activate.localkey;
-        }
-    } else {
+    if (!lan->iot_client->is_activated) {
         //! TODO:
         return OPRT_COM_ERROR;
     }
-    int plaintext_len = sizeof(lpv35_plaintext_data_t) + len;
-    lpv35_plaintext_data_t *plaintext_data = tal_malloc(plaintext_len);
-    if (plaintext_data == NULL) {
-        PR_ERR("plaintext_data fail");
-        return OPRT_MALLOC_FAILED;
+
+    // the sequence and the queue order of the session must match
+    tal_mutex_lock(session->send_mutex);
+    if (session->active == false || session->fault == true) {
+        tal_mutex_unlock(session->send_mutex);
+        return OPRT_SVC_LAN_SOCKET_FAULT;
     }
-    memset(plaintext_data, 0, plaintext_len);
-    plaintext_data->ret_code = ret_code;
-    memcpy(plaintext_data->data, data, len);
-    // lpv3.5 test arch
-    lpv35_frame_object_t frame = {.sequence = session->sequence_out++,
-                                  .type = fr_type,
-                                  .data = (void *)plaintext_data,
-                                  .data_len = plaintext_len};
+    if (session->sendq_cnt >= LAN_SEND_QUEUE_NUM) {
+        // the client does not read, drop the frame rather than wait for it
+        PR_WARN("fd:%d send queue full", session->fd);
+        tal_mutex_unlock(session->send_mutex);
+        return OPRT_EXCEED_UPPER_LIMIT;
+    }
+
+    // lpv3.5 test arch, the plaintext is written in the frame and encrypted in place
+    int plaintext_len = sizeof(lpv35_plaintext_data_t) + len;
+    lpv35_frame_object_t frame = {.sequence = session->sequence_out++, .type = fr_type, .data_len = plaintext_len};
     send_buf = tal_malloc(lpv35_frame_buffer_size_get(&frame));
     if (send_buf == NULL) {
         PR_ERR("send_buf malloc fail");
-        tal_free(plaintext_data);
+        tal_mutex_unlock(session->send_mutex);
         return OPRT_MALLOC_FAILED;
     }
-    memset(send_buf, 0, lpv35_frame_buffer_size_get(&frame));
-    op_ret = lpv35_frame_serialize(key, 16, &frame, send_buf, (int *)&send_len);
-    tal_free(plaintext_data);
+    lpv35_plaintext_data_t *plaintext_data = (lpv35_plaintext_data_t *)(send_buf + LPV35_FRAME_DATA_OFFSET);
+    plaintext_data->ret_code = ret_code;
+    memcpy(plaintext_data->data, data, len);
+    frame.data = (uint8_t *)plaintext_data;
+    if (session->key_ready && session->gcm_enc) {
+        op_ret = lpv35_frame_serialize_with_key(session->gcm_enc, &frame, send_buf, &send_len);
+    } else {
+        uint8_t *key = session->key_ready ? session->secret_key : (uint8_t *)lan->iot_client->activate.localkey;
+        op_ret = lpv35_frame_serialize(key, 16, &frame, send_buf, &send_len);
+    }
     if (op_ret != OPRT_OK) {
         PR_ERR("lpv35_frame_serialize fail:%d", op_ret);
+        tal_mutex_unlock(session->send_mutex);
         tal_free(send_buf);
         return OPRT_COM_ERROR;
     }
-    tal_mutex_lock(s_lan_mgr->mutex);
-    int ret = tal_net_send(session->fd, send_buf, send_len);
-    if (ret <= 0 || ret != send_len) {
-        if ((tal_net_get_errno() == UNW_EINTR) || (tal_net_get_errno() == UNW_EAGAIN)) {
-            tal_system_sleep(100);
-            ret = tal_net_send(session->fd, send_buf, send_len);
-            if (ret <= 0 || ret != send_len) {
-                op_ret = OPRT_SVC_LAN_SEND_ERR;
-            }
-        } else {
-            op_ret = OPRT_SVC_LAN_SEND_ERR;
-        }
-    }
 
-    tal_free(send_buf);
-    if (op_ret == OPRT_SVC_LAN_SEND_ERR) {
+    // queue the frame behind the pending ones and send what the socket takes,
+    // the sock loop sends the rest once the socket is writable
+    uint8_t tail = (session->sendq_head + session->sendq_cnt) % LAN_SEND_QUEUE_NUM;
+    session->sendq[tail].buf = send_buf;
+    session->sendq[tail].len = send_len;
+    if (0 == session->sendq_cnt++) {
+        session->sendq_time = tal_time_get_posix();
+    }
+    op_ret = lan_session_sendq_flush(session);
+    if (op_ret != OPRT_OK) {
         lan_session_fault_set(session);
-        PR_ERR("ret:%d send_len:%d errno:%d", ret, send_len, tal_net_get_errno());
     }
-    tal_mutex_unlock(s_lan_mgr->mutex);
+    BOOL_T pending = session->sendq_cnt > 0;
+    tal_mutex_unlock(session->send_mutex);
+
+    if (pending && op_ret == OPRT_OK) {
+        tuya_sock_loop_wakeup();
+    }
     return op_ret;
 }
 
@@ -721,7 +846,7 @@ int tuya_lan_dp_report(char *dpstr)
     int i = 0;
 
     for (i = 0; i < lan->cfg->client_num; i++) {
-        if (session[i].active && session[i].fault == false && session[i].secret_key[0] != '\0') {
+        if (session[i].active && session[i].fault == false && session[i].key_ready) {
             op_ret = lan_send(&session[i], 0, FRM_TP_STAT_REPORT, 0, out, out_len, false);
             if (OPRT_OK != op_ret) {
                 PR_ERR("tcp_send op_ret:%d", op_ret);
@@ -854,6 +979,7 @@ static void lan_protocol_process(lan_mgr_t *lan, lan_session_t *session, lpv35_f
             lan_session_fault_set(session);
             break;
         }
+        lan_session_key_setup(session);
         break;
 
     case FRM_QUERY_STAT:
@@ -904,6 +1030,27 @@ static void lan_tcp_client_sock_err(int fd)
     return;
 }
 
+static BOOL_T lan_tcp_client_sock_want_write(int fd)
+{
+    lan_session_t *session = lan_session_get_by_fd(fd);
+
+    return (session && session->active && session->sendq_cnt > 0) ? TRUE : FALSE;
+}
+
+static void lan_tcp_client_sock_write(int fd)
+{
+    lan_session_t *session = lan_session_get_by_fd(fd);
+    if (NULL == session || !session->active) {
+        return;
+    }
+
+    tal_mutex_lock(session->send_mutex);
+    if (OPRT_OK != lan_session_sendq_flush(session)) {
+        lan_session_fault_set(session);
+    }
+    tal_mutex_unlock(session->send_mutex);
+}
+
 static void lan_tcp_client_sock_read(int32_t fd)
 {
     int ret = 0;
@@ -993,24 +1140,23 @@ recv_again:
         //! TODO:
         if (lan->iot_client->is_activated) {
             if (fr_type == FRM_SECURITY_TYPE3 || fr_type == FRM_SECURITY_TYPE4 || fr_type == FRM_SECURITY_TYPE5) {
-                lan->cfg->allow_no_session_key_num = ALLOW_NO_KEY_NUM;
-                if (session->secret_key[0]) {
+                session->allow_no_key_num = lan->cfg->allow_no_session_key_num;
+                if (session->key_ready) {
                     PR_WARN("already have the session_key, reset session..");
                     lan_session_close(session);
                     break;
                 }
                 key = (uint8_t *)lan->iot_client->activate.localkey;
             } else {
-                if (0 == session->secret_key[0]) {
+                if (!session->key_ready) {
                     // fr_type come first than TYPE3,4,5, wait some packets
                     // before close(used in pressure test)
-                    if (lan->cfg->allow_no_session_key_num > 0) {
-                        PR_ERR("allow no seesion key %d", lan->cfg->allow_no_session_key_num);
-                        lan->cfg->allow_no_session_key_num--;
+                    if (session->allow_no_key_num > 0) {
+                        PR_ERR("allow no seesion key %d", session->allow_no_key_num);
+                        session->allow_no_key_num--;
                     } else {
                         PR_ERR("ERROR, no session_key");
                         lan_session_close(session);
-                        lan->cfg->allow_no_session_key_num = ALLOW_NO_KEY_NUM;
                     }
                     break;
                 }
@@ -1033,7 +1179,11 @@ recv_again:
         }
         //! TODO:
         lpv35_frame_object_t frame_out = {0};
-        ret = lpv35_frame_parse(key, SESSIONKEY_LEN, frame_buffer, frame_len, &frame_out);
+        if (key == session->secret_key && session->gcm_dec) {
+            ret = lpv35_frame_parse_with_key(session->gcm_dec, frame_buffer, frame_len, &frame_out);
+        } else {
+            ret = lpv35_frame_parse(key, SESSIONKEY_LEN, frame_buffer, frame_len, &frame_out);
+        }
         if (ret != OPRT_OK) {
             PR_ERR("lpv35_frame_parse fail:%d", ret);
             break;
@@ -1090,7 +1240,9 @@ static void lan_tcp_serv_sock_read(int32_t fd)
                               .pre_select = NULL,
                               .read = lan_tcp_client_sock_read,
                               .err = lan_tcp_client_sock_err,
-                              .quit = NULL};
+                              .quit = NULL,
+                              .want_write = lan_tcp_client_sock_want_write,
+                              .write = lan_tcp_client_sock_write};
 
     ret = tuya_reg_lan_sock(sock_info);
     if (OPRT_OK != ret) {
@@ -1338,6 +1490,13 @@ int tuya_lan_init(tuya_iot_client_t *iot_client)
         goto __exit;
     }
     memset(s_lan_mgr->session, 0, client_len);
+    for (int i = 0; i < s_lan_mgr->cfg->client_num; i++) {
+        s_lan_mgr->session[i].fd = -1;
+        op_ret = tal_mutex_create_init(&s_lan_mgr->session[i].send_mutex);
+        if (OPRT_OK != op_ret) {
+            goto __exit;
+        }
+    }
     s_lan_mgr->iot_client = iot_client;
 
     if (lan_tcp_create_serv_socket(s_lan_mgr) < 0) {
@@ -1374,6 +1533,11 @@ int tuya_lan_exit(void)
     }
     lan_session_close_all();
     if (s_lan_mgr->session) {
+        for (int i = 0; i < s_lan_mgr->cfg->client_num; i++) {
+            if (s_lan_mgr->session[i].send_mutex) {
+                tal_mutex_release(s_lan_mgr->session[i].send_mutex);
+            }
+        }
         tal_free(s_lan_mgr->session);
         s_lan_mgr->session = NULL;
     }
@@ -1432,6 +1596,34 @@ int tuya_lan_data_report(uint32_t fr_type, uint32_t ret_code, uint8_t *data, uin
     return OPRT_OK;
 }
 
+/**
+ * @brief send data to one connection
+ *
+ * @param[in] socket socket of the connection
+ * @param[in] fr_num refer to LAN_PRO_HEAD_APP_S
+ * @param[in] fr_type refer to LAN_PRO_HEAD_APP_S
+ * @param[in] ret_code refer to LAN_PRO_HEAD_APP_S
+ * @param[in] data refer to LAN_PRO_HEAD_APP_S
+ * @param[in] len refer to LAN_PRO_HEAD_APP_S
+ *
+ * @return OPRT_OK on success, OPRT_EXCEED_UPPER_LIMIT if the send queue of the
+ * connection is full. Others on error, please refer to tuya_error_code.h
+ */
+int tuya_lan_data_com_send(const int32_t socket, const uint32_t fr_num, const uint32_t fr_type, const uint32_t ret_code,
+                           const uint8_t *data, const uint32_t len)
+{
+    if (NULL == lan_mgr_get() || socket < 0) {
+        return OPRT_INVALID_PARM;
+    }
+
+    lan_session_t *session = lan_session_get_by_fd(socket);
+    if (NULL == session) {
+        return OPRT_SVC_LAN_NO_CLIENT_CONNECTED;
+    }
+
+    return lan_send(session, fr_num, fr_type, ret_code, (uint8_t *)data, len, true);
+}
+
 /**
  * @brief get count of vaild connections
  *
@@ -156,6 +156,13 @@ int tuya_lan_unregister_cb(uint32_t frame_type);
 uint32_t tuya_lan_get_client_num(void);
 int tuya_lan_get_connect_client_num(void);
 
+/**
+ * @brief send data to the connection of socket, as tuya_lan_data_report does
+ * to each connection
+ *
+ * @return OPRT_OK on success, OPRT_EXCEED_UPPER_LIMIT if the send queue of the
+ * connection is full. Others on error, please refer to tuya_error_code.h
+ */
 int tuya_lan_data_com_send(const int32_t socket, const uint32_t fr_num, const uint32_t fr_type, const uint32_t ret_code,
                            const uint8_t *data, const uint32_t len);
 
@@ -0,0 +1,487 @@
+/**
+ * @file tuya_json_scan.c
+ * @brief Single-pass JSON scanner that works in place on the message buffer.
+ *
+ * json_scan_root checks the whole text once with an explicit stack of open
+ * containers instead of recursion, one bit per level, so the stack use does
+ * not depend on the message. Values handed out afterwards are known to be
+ * well formed and json_scan_next only has to skip over them.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tuya_error_code.h"
+#include "tuya_json_scan.h"
+
+/***********************************************************
+*************************micro define***********************
+***********************************************************/
+#define JSON_SCAN_DEPTH_MAX  32
+#define JSON_SCAN_NUMBER_MAX 32
+
+/***********************************************************
+*************************function define********************
+***********************************************************/
+static const char *__skip_ws(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+static int __hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* p is on the opening quote */
+static const char *__scan_string(const char *p, const char *end, json_scan_value_t *value)
+{
+    const char *start = ++p;
+
+    while (p < end && *p != '"') {
+        if ((unsigned char)*p < 0x20) {
+            return NULL;
+        }
+        if (*p++ != '\\') {
+            continue;
+        }
+        if (p >= end) {
+            return NULL;
+        }
+        if (*p == 'u') {
+            int i;
+            if (end - p < 5) {
+                return NULL;
+            }
+            for (i = 1; i <= 4; i++) {
+                if (__hex_value(p[i]) < 0) {
+                    return NULL;
+                }
+            }
+            p += 5;
+        } else if (*p && strchr("\"\\/bfnrt", *p)) {
+            p++;
+        } else {
+            return NULL;
+        }
+    }
+    if (p >= end) {
+        return NULL;
+    }
+
+    value->ptr = start;
+    value->len = p - start;
+    value->type = JSON_SCAN_STRING;
+    return p + 1;
+}
+
+static const char *__scan_digits(const char *p, const char *end)
+{
+    const char *start = p;
+
+    while (p < end && *p >= '0' && *p <= '9') {
+        p++;
+    }
+    return p == start ? NULL : p;
+}
+
+static const char *__scan_number(const char *p, const char *end, json_scan_value_t *value)
+{
+    const char *start = p;
+
+    if (*p == '-') {
+        p++;
+    }
+    if (p < end && *p == '0') {
+        p++;
+    } else if (NULL == (p = __scan_digits(p, end))) {
+        return NULL;
+    }
+    if (p < end && *p == '.' && NULL == (p = __scan_digits(p + 1, end))) {
+        return NULL;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        if (NULL == (p = __scan_digits(p, end))) {
+            return NULL;
+        }
+    }
+
+    value->ptr = start;
+    value->len = p - start;
+    value->type = JSON_SCAN_NUMBER;
+    return p;
+}
+
+static const char *__scan_literal(const char *p, const char *end, json_scan_value_t *value)
+{
+    static const struct {
+        const char *text;
+        json_scan_type_t type;
+    } literal[] = {{"true", JSON_SCAN_TRUE}, {"false", JSON_SCAN_FALSE}, {"null", JSON_SCAN_NULL}};
+    size_t i;
+
+    for (i = 0; i < sizeof(literal) / sizeof(literal[0]); i++) {
+        size_t len = strlen(literal[i].text);
+        if ((size_t)(end - p) >= len && 0 == memcmp(p, literal[i].text, len)) {
+            value->ptr = p;
+            value->len = len;
+            value->type = literal[i].type;
+            return p + len;
+        }
+    }
+    return NULL;
+}
+
+/* a member key and its ':', p is on the key */
+static const char *__scan_key(const char *p, const char *end, json_scan_value_t *key)
+{
+    if (p >= end || *p != '"' || NULL == (p = __scan_string(p, end, key))) {
+        return NULL;
+    }
+    p = __skip_ws(p, end);
+    if (p >= end || *p != ':') {
+        return NULL;
+    }
+    return p + 1;
+}
+
+/* one complete value, containers are walked with a bit stack: 1 object, 0 array */
+static const char *__scan_value(const char *p, const char *end, json_scan_value_t *value)
+{
+    json_scan_value_t token;
+    uint32_t stack = 0;
+    uint32_t depth = 0;
+    const char *start = NULL;
+
+    for (;;) {
+        /* a value is expected */
+        p = __skip_ws(p, end);
+        if (p >= end) {
+            return NULL;
+        }
+        if (NULL == start) {
+            start = p;
+        }
+
+        if (*p == '{' || *p == '[') {
+            bool is_object = (*p == '{');
+            if (depth == JSON_SCAN_DEPTH_MAX) {
+                return NULL;
+            }
+            stack = (stack << 1) | (is_object ? 1 : 0);
+            depth++;
+            p = __skip_ws(p + 1, end);
+            if (p < end && *p == (is_object ? '}' : ']')) {
+                p++;
+                stack >>= 1;
+                depth--;
+            } else if (is_object) {
+                if (NULL == (p = __scan_key(p, end, &token))) {
+                    return NULL;
+                }
+                continue;
+            } else {
+                continue;
+            }
+        } else if (*p == '"') {
+            p = __scan_string(p, end, &token);
+        } else if (*p == '-' || (*p >= '0' && *p <= '9')) {
+            p = __scan_number(p, end, &token);
+        } else {
+            p = __scan_literal(p, end, &token);
+        }
+        if (NULL == p) {
+            return NULL;
+        }
+
+        /* a value is complete, close the containers it completes */
+        while (depth > 0) {
+            p = __skip_ws(p, end);
+            if (p >= end) {
+                return NULL;
+            }
+            if (*p == ',') {
+                p = __skip_ws(p + 1, end);
+                if ((stack & 1) && NULL == (p = __scan_key(p, end, &token))) {
+                    return NULL;
+                }
+                break;
+            }
+            if (*p != ((stack & 1) ? '}' : ']')) {
+                return NULL;
+            }
+            p++;
+            stack >>= 1;
+            depth--;
+        }
+        if (0 == depth) {
+            break;
+        }
+    }
+
+    if (*start == '{' || *start == '[') {
+        value->ptr = start;
+        value->len = p - start;
+        value->type = (*start == '{') ? JSON_SCAN_OBJECT : JSON_SCAN_ARRAY;
+    } else {
+        *value = token;
+    }
+    return p;
+}
+
+/**
+ * @brief get the value of a whole JSON text, checking it is well formed
+ *
+ * @return OPRT_OK on success, OPRT_CJSON_PARSE_ERR if the text is not valid JSON
+ */
+int json_scan_root(const char *json, size_t len, json_scan_value_t *value)
+{
+    const char *end = NULL;
+    const char *p = NULL;
+
+    if (NULL == json || NULL == value) {
+        return OPRT_INVALID_PARM;
+    }
+
+    end = json + len;
+    p = __scan_value(json, end, value);
+    if (NULL == p || __skip_ws(p, end) != end) {
+        return OPRT_CJSON_PARSE_ERR;
+    }
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief start scanning the members of an object
+ *
+ * @param[out] scan scanner state
+ * @param[in] object an object value, e.g. from json_scan_root
+ *
+ * @return OPRT_OK on success, OPRT_INVALID_PARM if object is not an object
+ */
+int json_scan_begin(json_scan_t *scan, const json_scan_value_t *object)
+{
+    if (NULL == scan || NULL == object || object->type != JSON_SCAN_OBJECT) {
+        return OPRT_INVALID_PARM;
+    }
+
+    /* inside the braces */
+    scan->cur = object->ptr + 1;
+    scan->end = object->ptr + object->len - 1;
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief get the next member of the object
+ *
+ * @return OPRT_OK on success, OPRT_NOT_FOUND after the last member,
+ * OPRT_CJSON_PARSE_ERR if the text is not valid JSON
+ */
+int json_scan_next(json_scan_t *scan, json_scan_value_t *key, json_scan_value_t *value)
+{
+    const char *p = __skip_ws(scan->cur, scan->end);
+
+    if (p >= scan->end) {
+        scan->cur = scan->end;
+        return OPRT_NOT_FOUND;
+    }
+
+    p = __scan_key(p, scan->end, key);
+    if (NULL == p || NULL == (p = __scan_value(p, scan->end, value))) {
+        scan->cur = scan->end;
+        return OPRT_CJSON_PARSE_ERR;
+    }
+
+    p = __skip_ws(p, scan->end);
+    if (p < scan->end && *p == ',') {
+        p++;
+    }
+    scan->cur = p;
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief find a member of an object
+ *
+ * @return OPRT_OK on success, OPRT_NOT_FOUND if key is not a member
+ */
+int json_scan_find(const json_scan_value_t *object, const char *key, json_scan_value_t *value)
+{
+    json_scan_t scan;
+    json_scan_value_t name;
+    int rt = json_scan_begin(&scan, object);
+
+    while (OPRT_OK == rt) {
+        rt = json_scan_next(&scan, &name, value);
+        if (OPRT_OK == rt && json_scan_equal(&name, key)) {
+            return OPRT_OK;
+        }
+    }
+
+    return rt;
+}
+
+/**
+ * @brief compare a key or string value with a C string, escapes are not decoded
+ */
+bool json_scan_equal(const json_scan_value_t *value, const char *str)
+{
+    size_t len = strlen(str);
+
+    return value->type == JSON_SCAN_STRING && value->len == len && 0 == memcmp(value->ptr, str, len);
+}
+
+/**
+ * @brief convert a number value, the fraction is truncated
+ *
+ * @return OPRT_OK on success, OPRT_INVALID_PARM if value is not a number
+ */
+int json_scan_int(const json_scan_value_t *value, int *out)
+{
+    char number[JSON_SCAN_NUMBER_MAX];
+    double d;
+
+    if (value->type != JSON_SCAN_NUMBER || value->len >= sizeof(number)) {
+        return OPRT_INVALID_PARM;
+    }
+    memcpy(number, value->ptr, value->len);
+    number[value->len] = '\0';
+
+    /* saturate like cJSON valueint */
+    d = strtod(number, NULL);
+    if (d >= INT_MAX) {
+        *out = INT_MAX;
+    } else if (d <= (double)INT_MIN) {
+        *out = INT_MIN;
+    } else {
+        *out = (int)d;
+    }
+
+    return OPRT_OK;
+}
+
+static size_t __utf8_encode(uint32_t code, char *out)
+{
+    if (code < 0x80) {
+        out[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = (char)(0xC0 | (code >> 6));
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = (char)(0xE0 | (code >> 12));
+        out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (code >> 18));
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+static uint32_t __hex4(const char *p)
+{
+    return (__hex_value(p[0]) << 12) | (__hex_value(p[1]) << 8) | (__hex_value(p[2]) << 4) | __hex_value(p[3]);
+}
+
+/**
+ * @brief copy a string value to buf with its escapes decoded, \u escapes
+ * outside ASCII are encoded as UTF-8
+ *
+ * @return OPRT_OK on success, OPRT_INVALID_PARM if value is not a string,
+ * OPRT_BUFFER_NOT_ENOUGH if it does not fit in size bytes with the '\0'
+ */
+int json_scan_string(const json_scan_value_t *value, char *buf, size_t size)
+{
+    const char *p = value->ptr;
+    const char *end = value->ptr + value->len;
+    size_t n = 0;
+
+    if (value->type != JSON_SCAN_STRING || NULL == buf || 0 == size) {
+        return OPRT_INVALID_PARM;
+    }
+
+    while (p < end) {
+        char utf8[4];
+        size_t len = 1;
+
+        if (*p != '\\') {
+            utf8[0] = *p++;
+        } else {
+            p++;
+            switch (*p) {
+            case 'b':
+                utf8[0] = '\b';
+                break;
+            case 'f':
+                utf8[0] = '\f';
+                break;
+            case 'n':
+                utf8[0] = '\n';
+                break;
+            case 'r':
+                utf8[0] = '\r';
+                break;
+            case 't':
+                utf8[0] = '\t';
+                break;
+            case 'u': {
+                uint32_t code = __hex4(p + 1);
+                p += 4;
+                /* surrogate pair, the scanner checked both escapes are hex */
+                if (code >= 0xD800 && code < 0xDC00 && end - p >= 7 && p[1] == '\\' && p[2] == 'u') {
+                    uint32_t low = __hex4(p + 3);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        p += 6;
+                    }
+                }
+                len = __utf8_encode(code, utf8);
+                break;
+            }
+            default:
+                utf8[0] = *p;
+                break;
+            }
+            p++;
+        }
+
+        if (n + len >= size) {
+            buf[n] = '\0';
+            return OPRT_BUFFER_NOT_ENOUGH;
+        }
+        memcpy(buf + n, utf8, len);
+        n += len;
+    }
+    buf[n] = '\0';
+
+    return OPRT_OK;
+}
@@ -0,0 +1,107 @@
+/**
+ * @file tuya_json_scan.h
+ * @brief Single-pass JSON scanner that works in place on the message buffer.
+ *
+ * The scanner walks the members of an object and returns each key and value
+ * as a span of the original text, nested values are skipped without being
+ * parsed. Nothing is allocated, so reading a few members of an inbound
+ * protocol message costs no heap at all; cJSON is only needed by code that
+ * wants the whole tree.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef __TUYA_JSON_SCAN_H__
+#define __TUYA_JSON_SCAN_H__
+
+#include "tuya_cloud_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    JSON_SCAN_INVALID = 0,
+    JSON_SCAN_STRING,
+    JSON_SCAN_NUMBER,
+    JSON_SCAN_OBJECT,
+    JSON_SCAN_ARRAY,
+    JSON_SCAN_TRUE,
+    JSON_SCAN_FALSE,
+    JSON_SCAN_NULL,
+} json_scan_type_t;
+
+/**
+ * @brief a value in the scanned text, for a string the span is between the
+ * quotes and escapes are left as they are
+ */
+typedef struct {
+    const char *ptr;
+    size_t len;
+    json_scan_type_t type;
+} json_scan_value_t;
+
+typedef struct {
+    const char *cur;
+    const char *end;
+} json_scan_t;
+
+/**
+ * @brief start scanning the members of an object
+ *
+ * @param[out] scan scanner state
+ * @param[in] object an object value, e.g. from json_scan_root
+ *
+ * @return OPRT_OK on success, OPRT_INVALID_PARM if object is not an object
+ */
+int json_scan_begin(json_scan_t *scan, const json_scan_value_t *object);
+
+/**
+ * @brief get the next member of the object
+ *
+ * @return OPRT_OK on success, OPRT_NOT_FOUND after the last member,
+ * OPRT_CJSON_PARSE_ERR if the text is not valid JSON
+ */
+int json_scan_next(json_scan_t *scan, json_scan_value_t *key, json_scan_value_t *value);
+
+/**
+ * @brief get the value of a whole JSON text, checking it is well formed
+ *
+ * @return OPRT_OK on success, OPRT_CJSON_PARSE_ERR if the text is not valid JSON
+ */
+int json_scan_root(const char *json, size_t len, json_scan_value_t *value);
+
+/**
+ * @brief find a member of an object
+ *
+ * @return OPRT_OK on success, OPRT_NOT_FOUND if key is not a member
+ */
+int json_scan_find(const json_scan_value_t *object, const char *key, json_scan_value_t *value);
+
+/**
+ * @brief compare a key or string value with a C string, escapes are not decoded
+ */
+bool json_scan_equal(const json_scan_value_t *value, const char *str);
+
+/**
+ * @brief convert a number value, the fraction is truncated
+ *
+ * @return OPRT_OK on success, OPRT_INVALID_PARM if value is not a number
+ */
+int json_scan_int(const json_scan_value_t *value, int *out);
+
+/**
+ * @brief copy a string value to buf with its escapes decoded, \u escapes
+ * outside ASCII are encoded as UTF-8
+ *
+ * @return OPRT_OK on success, OPRT_INVALID_PARM if value is not a string,
+ * OPRT_BUFFER_NOT_ENOUGH if it does not fit in size bytes with the '\0'
+ */
+int json_scan_string(const json_scan_value_t *value, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TUYA_JSON_SCAN_H__ */
@@ -51,6 +51,118 @@
 #define PV23_AD_DATA_LEN     (12)
 #define PV23_EXCEPT_DATA_LEN (PV23_AD_DATA_LEN + PV23_NONCE_LEN + PV23_TAG_LEN)
 
+// room for {"protocol":,"t":,"data":} with two 32-bit numbers and the snprintf '\0'
+#define PROTOCOL_JSON_WRAP_LEN (48)
+
+#ifndef PROTOCOL_GCM_KEY_SLOTS
+#define PROTOCOL_GCM_KEY_SLOTS 4
+#endif
+
+/***********************************************************
+***********************typedef define***********************
+***********************************************************/
+typedef struct {
+    MUTEX_HANDLE mutex;
+    cipher_gcm_key_t key;
+} protocol_gcm_slot_t;
+
+/***********************************************************
+***********************variable define**********************
+***********************************************************/
+// expanded AES-GCM keys, a frame key always maps to the same slot so the MQTT
+// and LAN keys mostly stay expanded in slots of their own
+static protocol_gcm_slot_t s_gcm_slot[PROTOCOL_GCM_KEY_SLOTS];
+static bool s_gcm_ready = false;
+
+/***********************************************************
+***********************function define**********************
+***********************************************************/
+static protocol_gcm_slot_t *__protocol_gcm_slot(const cipher_params_t *input)
+{
+    uint8_t hash = 0;
+    size_t i = 0;
+
+    for (i = 0; i < input->key_len; i++) {
+        hash ^= input->key[i];
+    }
+
+    return &s_gcm_slot[hash % PROTOCOL_GCM_KEY_SLOTS];
+}
+
+static OPERATE_RET __protocol_gcm_encrypt(const cipher_params_t *input, unsigned char *output, size_t *olen,
+                                          unsigned char *tag, size_t tag_len)
+{
+    OPERATE_RET rt = OPRT_OK;
+
+    if (!s_gcm_ready) {
+        return mbedtls_cipher_auth_encrypt_wrapper(input, output, olen, tag, tag_len);
+    }
+
+    protocol_gcm_slot_t *slot = __protocol_gcm_slot(input);
+    tal_mutex_lock(slot->mutex);
+    rt = mbedtls_gcm_key_setup_wrapper(&slot->key, input->key, input->key_len);
+    if (OPRT_OK == rt) {
+        rt = mbedtls_gcm_key_encrypt_wrapper(&slot->key, input, output, olen, tag, tag_len);
+    }
+    tal_mutex_unlock(slot->mutex);
+
+    return rt;
+}
+
+static OPERATE_RET __protocol_gcm_decrypt(const cipher_params_t *input, unsigned char *output, size_t *olen,
+                                          unsigned char *tag, size_t tag_len)
+{
+    OPERATE_RET rt = OPRT_OK;
+
+    if (!s_gcm_ready) {
+        return mbedtls_cipher_auth_decrypt_wrapper(input, output, olen, tag, tag_len);
+    }
+
+    protocol_gcm_slot_t *slot = __protocol_gcm_slot(input);
+    tal_mutex_lock(slot->mutex);
+    rt = mbedtls_gcm_key_setup_wrapper(&slot->key, input->key, input->key_len);
+    if (OPRT_OK == rt) {
+        rt = mbedtls_gcm_key_decrypt_wrapper(&slot->key, input, output, olen, tag, tag_len);
+    }
+    tal_mutex_unlock(slot->mutex);
+
+    return rt;
+}
+
+/**
+ * @brief Initializes the expanded AES-GCM key cache of the protocol layer.
+ *
+ * Frames encrypted before this call, or when it fails, expand their key on
+ * every call.
+ *
+ * @return OPRT_OK on success, others on error
+ */
+OPERATE_RET tuya_protocol_init(void)
+{
+    OPERATE_RET rt = OPRT_OK;
+    int i = 0;
+
+    if (s_gcm_ready) {
+        return OPRT_OK;
+    }
+
+    for (i = 0; i < PROTOCOL_GCM_KEY_SLOTS; i++) {
+        TUYA_CALL_ERR_GOTO(tal_mutex_create_init(&s_gcm_slot[i].mutex), __EXIT);
+        mbedtls_gcm_key_init_wrapper(&s_gcm_slot[i].key);
+    }
+    s_gcm_ready = true;
+
+    return OPRT_OK;
+
+__EXIT:
+    while (i-- > 0) {
+        mbedtls_gcm_key_free_wrapper(&s_gcm_slot[i].key);
+        tal_mutex_release(s_gcm_slot[i].mutex);
+        s_gcm_slot[i].mutex = NULL;
+    }
+    return rt;
+}
+
 /**
  * @brief Generates a serial number for the Tuya protocol packet.
  *
@@ -102,7 +214,7 @@ static OPERATE_RET __parse_data_with_pv23(const DP_CMD_TYPE_E cmd, const uint8_t
     TUYA_CHECK_NULL_RETURN(ec_data, OPRT_MALLOC_FAILED);
 
     // decrypt data
-    op_ret = mbedtls_cipher_auth_decrypt_wrapper(
+    op_ret = __protocol_gcm_decrypt(
         &(const cipher_params_t){.cipher_type = MBEDTLS_CIPHER_AES_128_GCM,
                                  .key = (unsigned char *)key,
                                  .key_len = 16,
@@ -114,7 +226,7 @@ static OPERATE_RET __parse_data_with_pv23(const DP_CMD_TYPE_E cmd, const uint8_t
                                  .data_len = data_len},
         ec_data, &ec_len, (unsigned char *)(data + (len - PV23_TAG_LEN)), PV23_TAG_LEN);
     if (op_ret != OPRT_OK) {
-        PR_ERR("mbedtls_cipher_auth_decrypt_wrapper:0x%x", -op_ret);
+        PR_ERR("gcm decrypt:0x%x", -op_ret);
         *out_data = NULL;
         tal_free(ec_data);
         return op_ret;
@@ -217,51 +329,41 @@ OPERATE_RET tuya_parse_protocol_data(const DP_CMD_TYPE_E cmd, uint8_t *data, con
     return op_ret;
 }
 
+/* {"protocol":<pro>,"t":<time>,"data":<src>} written at buf, returns its length */
+static int __pack_json_wrap(const char *src, uint32_t src_len, const uint32_t pro, char *buf, uint32_t size)
+{
+    int ret = snprintf(buf, size, "{\"protocol\":%" PRIu32 ",\"t\":%" PRIu32 ",\"data\":", pro,
+                       (uint32_t)tal_time_get_posix());
+    if (ret < 0 || (uint32_t)ret + src_len + 1 > size) {
+        return OPRT_BUFFER_NOT_ENOUGH;
+    }
+    memcpy(buf + ret, src, src_len);
+    ret += src_len;
+    buf[ret++] = '}';
+
+    return ret;
+}
+
 static OPERATE_RET __pack_data_with_cmd_pv23(const DP_CMD_TYPE_E cmd, const char *pv, const char *src,
-                                             const uint32_t pro, const uint32_t num, const uint8_t *key,
-                                             uint8_t **pack_out, uint32_t *out_len)
+                                             const uint32_t pro, const uint32_t num, const uint8_t *key, uint8_t *buf,
+                                             uint32_t size, uint32_t *out_len)
 {
     OPERATE_RET op_ret = OPRT_OK;
-    char *out = NULL;
     int offset = 0;
 
-    if (pv == NULL || src == NULL || key == NULL || pack_out == NULL || out_len == NULL) {
+    if (pv == NULL || src == NULL || key == NULL || buf == NULL || out_len == NULL ||
+        size < PV23_EXCEPT_DATA_LEN) {
         return OPRT_INVALID_PARM;
     }
 
     PR_TRACE("To:%d src:%s pro:%d num:%d", cmd, src, pro, num);
-    // make json data
-    int len = strlen(src) + 60;
-    out = tal_malloc(len);
-    if (NULL == out) {
-        PR_ERR("tal_malloc Fails %d", len);
-        return OPRT_MALLOC_FAILED;
+    // make json data in place, the tag goes after it
+    offset = __pack_json_wrap(src, strlen(src), pro, (char *)buf + PV23_DATA_OFFSET, size - PV23_EXCEPT_DATA_LEN);
+    if (offset < 0) {
+        return offset;
     }
 
-    int ret = snprintf(out + offset, len - offset, "{\"protocol\":%" PRIu32 ",\"t\":%" PRIu32 ",\"data\":%s", pro,
-                       (uint32_t)tal_time_get_posix(), src);
-    if (ret < 0 || ret >= len - offset) {
-        tal_free(out);
-        return OPRT_BUFFER_NOT_ENOUGH;
-    }
-    offset += ret;
-
-    if (offset > len - 2) {
-        tal_free(out);
-        return OPRT_BUFFER_NOT_ENOUGH;
-    }
-    out[offset++] = '}';
-    out[offset] = 0;
-
-    PR_TRACE("After Pack:%s offset:%d", out, offset);
-
-    // make pack data
-    uint8_t *buf = tal_malloc(offset + PV23_EXCEPT_DATA_LEN);
-    if (buf == NULL) {
-        tal_free(out);
-        return OPRT_MALLOC_FAILED;
-    }
-    memset(buf, 0, offset + PV23_EXCEPT_DATA_LEN);
+    PR_TRACE("After Pack:%.*s offset:%d", offset, buf + PV23_DATA_OFFSET, offset);
 
     // make head data
     // version
@@ -281,27 +383,24 @@ static OPERATE_RET __pack_data_with_cmd_pv23(const DP_CMD_TYPE_E cmd, const char
     // nonce
     uni_random_string((char *)(buf + PV23_NONCE_OFFSET), PV23_NONCE_LEN);
 
-    // AES GCM encrypt
+    // AES GCM encrypt in place
     size_t encrypt_olen = 0;
-    op_ret = mbedtls_cipher_auth_encrypt_wrapper(&(const cipher_params_t){.cipher_type = MBEDTLS_CIPHER_AES_128_GCM,
-                                                                          .key = (unsigned char *)key,
-                                                                          .key_len = 16,
-                                                                          .nonce = buf + PV23_NONCE_OFFSET,
-                                                                          .nonce_len = PV23_NONCE_LEN,
-                                                                          .ad = buf,
-                                                                          .ad_len = PV23_AD_DATA_LEN,
-                                                                          .data = (unsigned char *)out,
-                                                                          .data_len = strlen(out)},
-                                                 buf + PV23_DATA_OFFSET, &encrypt_olen, buf + PV23_DATA_OFFSET + offset,
-                                                 PV23_TAG_LEN);
-    tal_free(out);
+    op_ret = __protocol_gcm_encrypt(&(const cipher_params_t){.cipher_type = MBEDTLS_CIPHER_AES_128_GCM,
+                                                             .key = (unsigned char *)key,
+                                                             .key_len = 16,
+                                                             .nonce = buf + PV23_NONCE_OFFSET,
+                                                             .nonce_len = PV23_NONCE_LEN,
+                                                             .ad = buf,
+                                                             .ad_len = PV23_AD_DATA_LEN,
+                                                             .data = buf + PV23_DATA_OFFSET,
+                                                             .data_len = offset},
+                                    buf + PV23_DATA_OFFSET, &encrypt_olen, buf + PV23_DATA_OFFSET + offset,
+                                    PV23_TAG_LEN);
     if (op_ret != OPRT_OK) {
-        PR_ERR("mbedtls_cipher_auth_encrypt_wrapper:0x%x", -op_ret);
-        tal_free(buf);
+        PR_ERR("gcm encrypt:0x%x", -op_ret);
         return op_ret;
     }
 
-    *pack_out = buf;
     *out_len = PV23_EXCEPT_DATA_LEN + encrypt_olen;
 
     return OPRT_OK;
@@ -309,55 +408,24 @@ static OPERATE_RET __pack_data_with_cmd_pv23(const DP_CMD_TYPE_E cmd, const char
 
 static OPERATE_RET __pack_data_with_cmd_lpv35(const DP_CMD_TYPE_E cmd, const char *pv, const char *src,
                                               const uint32_t pro, const uint32_t num, const uint8_t *key,
-                                              uint8_t **pack_out, uint32_t *out_len)
+                                              uint8_t *buf, uint32_t size, uint32_t *out_len)
 {
-    char *out = NULL;
     int offset = 0;
 
-    if (pv == NULL || src == NULL || key == NULL || pack_out == NULL || out_len == NULL) {
+    if (pv == NULL || src == NULL || key == NULL || buf == NULL || out_len == NULL || size < DATA_OFFSET_22_32) {
         return OPRT_INVALID_PARM;
     }
 
     PR_TRACE("To:%d src:%s pro:%d num:%d", cmd, src, pro, num);
 
-    // make json data
-    int len = strlen(src) + 60;
-    out = tal_malloc(len);
-    if (NULL == out) {
-        PR_ERR("tal_malloc Fails %d", len);
-        return OPRT_MALLOC_FAILED;
-    }
-
-    int ret = snprintf(out + offset, len - offset, "{\"protocol\":%" PRIu32 ",\"t\":%" PRIu32 ",\"data\":%s", pro,
-                       (uint32_t)tal_time_get_posix(), src);
-    if (ret < 0 || ret >= len - offset) {
-        tal_free(out);
-        return OPRT_BUFFER_NOT_ENOUGH;
-    }
-    offset += ret;
-
-    if (offset > len - 2) {
-        tal_free(out);
-        return OPRT_BUFFER_NOT_ENOUGH;
-    }
-    out[offset++] = '}';
-    out[offset] = 0;
-
-    PR_TRACE("After Pack:%s offset:%d", out, offset);
-
-    // make pack data
-    uint8_t *buf = tal_malloc(DATA_OFFSET_22_32 + offset + 16);
-    if (buf == NULL) {
-        tal_free(out);
-        return OPRT_MALLOC_FAILED;
+    // make json data in place, not aes data
+    offset = __pack_json_wrap(src, strlen(src), pro, (char *)buf + DATA_OFFSET_22_32, size - DATA_OFFSET_22_32);
+    if (offset < 0) {
+        return offset;
     }
-    memset(buf, 0, DATA_OFFSET_22_32 + offset + 16);
 
-    // not aes data
-    memcpy(buf + DATA_OFFSET_22_32, out, offset);
-    tal_free(out);
+    PR_TRACE("After Pack:%.*s offset:%d", offset, buf + DATA_OFFSET_22_32, offset);
 
-    *pack_out = buf;
     *out_len = (DATA_OFFSET_22_32 + offset);
 
     // make head data
@@ -375,6 +443,66 @@ static OPERATE_RET __pack_data_with_cmd_lpv35(const DP_CMD_TYPE_E cmd, const cha
     return OPRT_OK;
 }
 
+/**
+ * @brief Gets the buffer size tuya_pack_protocol_frame needs.
+ *
+ * @param cmd The command type.
+ * @param src_len The length of the source data.
+ *
+ * @return The buffer size in bytes, 0 if cmd is not supported.
+ */
+uint32_t tuya_pack_protocol_frame_size(const DP_CMD_TYPE_E cmd, uint32_t src_len)
+{
+    if (DP_CMD_LAN == cmd) {
+        return DATA_OFFSET_22_32 + PROTOCOL_JSON_WRAP_LEN + src_len;
+    } else if (DP_CMD_MQ == cmd) {
+        return PV23_EXCEPT_DATA_LEN + PROTOCOL_JSON_WRAP_LEN + src_len;
+    }
+    return 0;
+}
+
+/**
+ * @brief Packs the protocol data into a buffer of the caller.
+ *
+ * The JSON wrapper is written straight to its place in the frame and, for
+ * MQTT, encrypted there, so the frame costs no allocation and no copy other
+ * than the one of src.
+ *
+ * @param cmd The command type.
+ * @param src The source data to be packed.
+ * @param pro The protocol number.
+ * @param key The encryption key.
+ * @param buf The frame buffer, at least tuya_pack_protocol_frame_size bytes.
+ * @param size The size of buf.
+ * @param out_len Pointer to the length of the frame.
+ *
+ * @return The operation result status.
+ *     - OPRT_OK: Operation successful.
+ *     - OPRT_BUFFER_NOT_ENOUGH: buf is too small.
+ *     - Other error codes: Operation failed.
+ */
+OPERATE_RET tuya_pack_protocol_frame(const DP_CMD_TYPE_E cmd, const char *src, const uint32_t pro, const uint8_t *key,
+                                     uint8_t *buf, uint32_t size, uint32_t *out_len)
+{
+    if ((NULL == src) || NULL == buf || NULL == out_len) {
+        PR_ERR("Invalid Param");
+        return OPRT_INVALID_PARM;
+    }
+
+    uint32_t num = tuya_pack_protocol_serial_no();
+
+    if (DP_CMD_LAN == cmd) {
+        PR_TRACE("Data To LAN AND V=3.5");
+        return __pack_data_with_cmd_lpv35(cmd, TUYA_LPV35, src, pro, num, key, buf, size, out_len);
+    } else if (DP_CMD_MQ == cmd) {
+        PR_TRACE("Data To MQTT AND V=2.3");
+        return __pack_data_with_cmd_pv23(cmd, TUYA_PV23, src, pro, num, key, buf, size, out_len);
+    }
+
+    PR_ERR("Invlaid Cmd:%d", cmd);
+    return OPRT_COM_ERROR;
+}
+
 /**
  * @brief Packs the protocol data for Tuya Cloud service.
  *
@@ -400,39 +528,26 @@ OPERATE_RET tuya_pack_protocol_data(const DP_CMD_TYPE_E cmd, const char *src, co
         return OPRT_INVALID_PARM;
     }
 
-    OPERATE_RET op_ret = OPRT_OK;
-
-    char *pv = NULL;
+    uint32_t size = tuya_pack_protocol_frame_size(cmd, strlen(src));
+    if (0 == size) {
+        PR_ERR("Invlaid Cmd:%d", cmd);
+        return OPRT_COM_ERROR;
+    }
 
-    if (DP_CMD_LAN == cmd) {
-        pv = TUYA_LPV35;
-    } else if (DP_CMD_MQ == cmd) {
-        pv = TUYA_PV23;
+    uint8_t *buf = tal_malloc(size);
+    if (NULL == buf) {
+        PR_ERR("tal_malloc Fails %d", size);
+        return OPRT_MALLOC_FAILED;
     }
-    uint32_t num = tuya_pack_protocol_serial_no();
 
-    if (DP_CMD_LAN == cmd) {
-        if (0 == strcmp(pv, "3.5")) {
-            PR_TRACE("Data To LAN AND V=3.5");
-            op_ret = __pack_data_with_cmd_lpv35(cmd, pv, src, pro, num, (uint8_t *)key, (uint8_t **)out, out_len);
-        } else {
-            PR_ERR("Data To LAN But No Match Parse %s", pv);
-            return OPRT_COM_ERROR;
-        }
-    } else if (DP_CMD_MQ == cmd) {
-        if (0 == strcmp(pv, "2.3")) {
-            PR_TRACE("Data To MQTT AND V=2.3");
-            op_ret = __pack_data_with_cmd_pv23(cmd, pv, src, pro, num, key, (uint8_t **)out, out_len);
-        } else {
-            PR_ERR("Data To MQTT But No Match Parse %s", pv);
-            return OPRT_COM_ERROR;
-        }
-    } else {
-        PR_ERR("Invlaid Cmd:%d", cmd);
-        return OPRT_COM_ERROR;
+    OPERATE_RET op_ret = tuya_pack_protocol_frame(cmd, src, pro, key, buf, size, out_len);
+    if (OPRT_OK != op_ret) {
+        tal_free(buf);
+        return op_ret;
     }
 
-    return op_ret;
+    *out = (char *)buf;
+    return OPRT_OK;
 }
 
 /**
@@ -450,24 +565,8 @@ int lpv35_frame_buffer_size_get(lpv35_frame_object_t *frame_obj)
             LPV35_FRAME_TAG_SIZE + LPV35_FRAME_TAIL_SIZE);
 }
 
-/**
- * @brief Serializes an LPV35 frame object into a byte array.
- *
- * This function takes a key, key length, input LPV35 frame object, and output
- * byte array as parameters. It serializes the input frame object into the byte
- * array and updates the length of the output array.
- *
- * @param key The key used for serialization.
- * @param key_len The length of the key.
- * @param input The LPV35 frame object to be serialized.
- * @param output The byte array to store the serialized data.
- * @param olen A pointer to the length of the output byte array. This value will
- * be updated with the actual length of the serialized data.
- * @return OPERATE_RET Returns an OPERATE_RET value indicating the success or
- * failure of the serialization process.
- */
-OPERATE_RET lpv35_frame_serialize(const uint8_t *key, int key_len, const lpv35_frame_object_t *input, uint8_t *output,
-                                  int *olen)
+static OPERATE_RET __lpv35_frame_serialize(const uint8_t *key, int key_len, cipher_gcm_key_t *gcm_key,
+                                           const lpv35_frame_object_t *input, uint8_t *output, int *olen)
 {
     if (key == NULL || key_len == 0 || input == NULL || output == NULL || olen == NULL) {
         PR_ERR("PARAM ERROR");
@@ -501,20 +600,25 @@ OPERATE_RET lpv35_frame_serialize(const uint8_t *key, int key_len, const lpv35_f
     // TAG buffer
     uint8_t tag[LPV35_FRAME_TAG_SIZE] = {0};
 
-    // AES GCM encrypt
+    // AES GCM encrypt, input->data may already be at output + offset
     size_t encrypt_olen = 0;
-    op_ret = mbedtls_cipher_auth_encrypt_wrapper(&(const cipher_params_t){.cipher_type = MBEDTLS_CIPHER_AES_128_GCM,
-                                                                          .key = (unsigned char *)key,
-                                                                          .key_len = key_len,
-                                                                          .nonce = nonce,
-                                                                          .nonce_len = LPV35_FRAME_NONCE_SIZE,
-                                                                          .ad = (uint8_t *)(&ad),
-                                                                          .ad_len = sizeof(lpv35_additional_data_t),
-                                                                          .data = input->data,
-                                                                          .data_len = input->data_len},
-                                                 output + offset, &encrypt_olen, tag, LPV35_FRAME_TAG_SIZE);
+    const cipher_params_t params = {.cipher_type = MBEDTLS_CIPHER_AES_128_GCM,
+                                    .key = (unsigned char *)key,
+                                    .key_len = key_len,
+                                    .nonce = nonce,
+                                    .nonce_len = LPV35_FRAME_NONCE_SIZE,
+                                    .ad = (uint8_t *)(&ad),
+                                    .ad_len = sizeof(lpv35_additional_data_t),
+                                    .data = input->data,
+                                    .data_len = input->data_len};
+    if (gcm_key) {
+        op_ret = mbedtls_gcm_key_encrypt_wrapper(gcm_key, &params, output + offset, &encrypt_olen, tag,
+                                                 LPV35_FRAME_TAG_SIZE);
+    } else {
+        op_ret = __protocol_gcm_encrypt(&params, output + offset, &encrypt_olen, tag, LPV35_FRAME_TAG_SIZE);
+    }
     if (op_ret != OPRT_OK) {
-        PR_ERR("mbedtls_cipher_auth_encrypt_wrapper:0x%x", -op_ret);
+        PR_ERR("gcm encrypt:0x%x", -op_ret);
         return op_ret;
     }
     offset += encrypt_olen;
@@ -535,25 +639,51 @@ OPERATE_RET lpv35_frame_serialize(const uint8_t *key, int key_len, const lpv35_f
 }
 
 /**
- * @brief Parses an LPV35 frame.
+ * @brief Serializes an LPV35 frame object into a byte array.
  *
- * This function takes the LPV35 frame key, input data, and output object as
- * parameters and parses the LPV35 frame to populate the output object with the
- * parsed data.
+ * This function takes a key, key length, input LPV35 frame object, and output
+ * byte array as parameters. It serializes the input frame object into the byte
+ * array and updates the length of the output array.
  *
- * @param key The LPV35 frame key.
- * @param key_len The length of the LPV35 frame key.
- * @param input The input data containing the LPV35 frame.
- * @param ilen The length of the input data.
- * @param output The output object to store the parsed data.
+ * @param key The key used for serialization.
+ * @param key_len The length of the key.
+ * @param input The LPV35 frame object to be serialized.
+ * @param output The byte array to store the serialized data.
+ * @param olen A pointer to the length of the output byte array. This value will
+ * be updated with the actual length of the serialized data.
+ * @return OPERATE_RET Returns an OPERATE_RET value indicating the success or
+ * failure of the serialization process.
+ */
+OPERATE_RET lpv35_frame_serialize(const uint8_t *key, int key_len, const lpv35_frame_object_t *input, uint8_t *output,
+                                  int *olen)
+{
+    return __lpv35_frame_serialize(key, key_len, NULL, input, output, olen);
+}
+
+/**
+ * @brief Serializes an LPV35 frame object with an expanded key.
  *
- * @return The result of the operation. Possible return values are:
- *         - OPRT_OK: The LPV35 frame was successfully parsed.
- *         - OPRT_INVALID_PARM: Invalid parameters were provided.
- *         - OPRT_PARSE_FRAME_ERR: Error occurred while parsing the LPV35 frame.
+ * Same as lpv35_frame_serialize, but the frame is encrypted with gcm_key
+ * instead of expanding the key for the frame.
+ *
+ * @param gcm_key The expanded key, the caller serializes its use.
+ * @param input The LPV35 frame object to be serialized.
+ * @param output The byte array to store the serialized data.
+ * @param olen Updated with the length of the serialized data.
+ * @return OPERATE_RET Returns an OPERATE_RET value indicating the success or
+ * failure of the serialization process.
  */
-OPERATE_RET lpv35_frame_parse(const uint8_t *key, int key_len, const uint8_t *input, int ilen,
-                              lpv35_frame_object_t *output)
+OPERATE_RET lpv35_frame_serialize_with_key(cipher_gcm_key_t *gcm_key, const lpv35_frame_object_t *input,
+                                           uint8_t *output, int *olen)
+{
+    if (gcm_key == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+    return __lpv35_frame_serialize(gcm_key->key, gcm_key->key_len, gcm_key, input, output, olen);
+}
+
+static OPERATE_RET __lpv35_frame_parse(const uint8_t *key, int key_len, cipher_gcm_key_t *gcm_key,
+                                       const uint8_t *input, int ilen, lpv35_frame_object_t *output)
 {
     OPERATE_RET op_ret = OPRT_OK;
     int offset = 0;
@@ -562,6 +692,12 @@ OPERATE_RET lpv35_frame_parse(const uint8_t *key, int key_len, const uint8_t *in
         PR_ERR("PARAM ERROR");
         return OPRT_INVALID_PARM;
     }
+    // the length comes from the peer, a frame without room for nonce and tag
+    // would leave a negative data length
+    if (ilen < LPV35_FRAME_MINI_SIZE) {
+        PR_ERR("LPV35 FRAME TOO SHORT:%d", ilen);
+        return OPRT_COM_ERROR;
+    }
 
     // head tail verify
     if ((memcmp(input, LPV35_FRAME_HEAD, LPV35_FRAME_HEAD_SIZE) != 0) ||
@@ -629,18 +765,23 @@ OPERATE_RET lpv35_frame_parse(const uint8_t *key, int key_len, const uint8_t *in
     TUYA_CHECK_NULL_RETURN(output->data, OPRT_MALLOC_FAILED);
     memset(output->data, 0, output->data_len + 1);
     size_t decrypt_olen = 0;
-    op_ret = mbedtls_cipher_auth_decrypt_wrapper(&(const cipher_params_t){.cipher_type = MBEDTLS_CIPHER_AES_128_GCM,
-                                                                          .key = (unsigned char *)key,
-                                                                          .key_len = key_len,
-                                                                          .nonce = nonce,
-                                                                          .nonce_len = LPV35_FRAME_NONCE_SIZE,
-                                                                          .ad = (uint8_t *)(&ad),
-                                                                          .ad_len = sizeof(lpv35_additional_data_t),
-                                                                          .data = data,
-                                                                          .data_len = output->data_len},
-                                                 output->data, &decrypt_olen, tag, LPV35_FRAME_TAG_SIZE);
+    const cipher_params_t params = {.cipher_type = MBEDTLS_CIPHER_AES_128_GCM,
+                                    .key = (unsigned char *)key,
+                                    .key_len = key_len,
+                                    .nonce = nonce,
+                                    .nonce_len = LPV35_FRAME_NONCE_SIZE,
+                                    .ad = (uint8_t *)(&ad),
+                                    .ad_len = sizeof(lpv35_additional_data_t),
+                                    .data = data,
+                                    .data_len = output->data_len};
+    if (gcm_key) {
+        op_ret = mbedtls_gcm_key_decrypt_wrapper(gcm_key, &params, output->data, &decrypt_olen, tag,
+                                                 LPV35_FRAME_TAG_SIZE);
+    } else {
+        op_ret = __protocol_gcm_decrypt(&params, output->data, &decrypt_olen, tag, LPV35_FRAME_TAG_SIZE);
+    }
     if (op_ret != OPRT_OK) {
-        PR_ERR("mbedtls_cipher_auth_decrypt_wrapper:0x%x", -op_ret);
+        PR_ERR("gcm decrypt:0x%x", -op_ret);
         tal_free(output->data);
         output->data = NULL;
         return op_ret;
@@ -650,3 +791,49 @@ OPERATE_RET lpv35_frame_parse(const uint8_t *key, int key_len, const uint8_t *in
 
     return op_ret;
 }
+
+/**
+ * @brief Parses an LPV35 frame.
+ *
+ * This function takes the LPV35 frame key, input data, and output object as
+ * parameters and parses the LPV35 frame to populate the output object with the
+ * parsed data.
+ *
+ * @param key The LPV35 frame key.
+ * @param key_len The length of the LPV35 frame key.
+ * @param input The input data containing the LPV35 frame.
+ * @param ilen The length of the input data.
+ * @param output The output object to store the parsed data.
+ *
+ * @return The result of the operation. Possible return values are:
+ *         - OPRT_OK: The LPV35 frame was successfully parsed.
+ *         - OPRT_INVALID_PARM: Invalid parameters were provided.
+ *         - OPRT_PARSE_FRAME_ERR: Error occurred while parsing the LPV35 frame.
+ */
+OPERATE_RET lpv35_frame_parse(const uint8_t *key, int key_len, const uint8_t *input, int ilen,
+                              lpv35_frame_object_t *output)
+{
+    return __lpv35_frame_parse(key, key_len, NULL, input, ilen, output);
+}
+
+/**
+ * @brief Parses an LPV35 frame with an expanded key.
+ *
+ * Same as lpv35_frame_parse, but the frame is decrypted with gcm_key instead
+ * of expanding the key for the frame.
+ *
+ * @param gcm_key The expanded key, the caller serializes its use.
+ * @param input The input data containing the LPV35 frame.
+ * @param ilen The length of the input data.
+ * @param output The output object to store the parsed data.
+ *
+ * @return OPRT_OK on success, others on error as for lpv35_frame_parse.
+ */
+OPERATE_RET lpv35_frame_parse_with_key(cipher_gcm_key_t *gcm_key, const uint8_t *input, int ilen,
+                                       lpv35_frame_object_t *output)
+{
+    if (gcm_key == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+    return __lpv35_frame_parse(gcm_key->key, gcm_key->key_len, gcm_key, input, ilen, output);
+}
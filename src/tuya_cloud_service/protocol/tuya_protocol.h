@@ -75,6 +75,9 @@ typedef struct {
 
 typedef lpv35_fixed_head_t lpv35_additional_data_t;
 
+// offset of the data in a serialized lpv35 frame
+#define LPV35_FRAME_DATA_OFFSET (LPV35_FRAME_HEAD_SIZE + sizeof(lpv35_additional_data_t) + LPV35_FRAME_NONCE_SIZE)
+
 typedef struct {
     uint32_t ret_code;
     uint8_t data[0];
@@ -96,6 +99,14 @@ typedef dp_cmd_type_t DP_CMD_TYPE_E;
  *  Return: OPERATE_RET
  ***********************************************************/
 
+/**
+ * @brief Initializes the expanded AES-GCM key cache of the protocol layer.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tuya_protocol_init(void);
+
 /**
  * @brief parse protocol data
  *
@@ -129,12 +140,41 @@ OPERATE_RET tuya_parse_protocol_data(const DP_CMD_TYPE_E cmd, uint8_t *data, con
  */
 OPERATE_RET tuya_pack_protocol_data(const DP_CMD_TYPE_E cmd, const char *src, const uint32_t pro, uint8_t *key,
                                     char **out, uint32_t *out_len);
+
+/**
+ * @brief get the buffer size tuya_pack_protocol_frame needs
+ *
+ * @param[in] cmd refer to DP_CMD_TYPE_E
+ * @param[in] src_len origin data length
+ *
+ * @return buffer size, 0 if cmd is not supported
+ */
+uint32_t tuya_pack_protocol_frame_size(const DP_CMD_TYPE_E cmd, uint32_t src_len);
+
+/**
+ * @brief pack protocol data into a caller buffer, the frame is built and
+ * encrypted in place
+ *
+ * @param[in] cmd refer to DP_CMD_TYPE_E
+ * @param[in] src origin data
+ * @param[in] pro pro
+ * @param[in] key pack key
+ * @param[out] buf frame buffer of tuya_pack_protocol_frame_size bytes
+ * @param[in] size buf size
+ * @param[out] out_len frame length
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tuya_pack_protocol_frame(const DP_CMD_TYPE_E cmd, const char *src, const uint32_t pro, const uint8_t *key,
+                                     uint8_t *buf, uint32_t size, uint32_t *out_len);
 /**
  * @brief add head and tail in lpv35 frame
  *
  * @param[in] key encrypt key
  * @param[in] key_len encrypt key len
- * @param[in] input raw data of lpv35 frame
+ * @param[in] input raw data of lpv35 frame, data may be at
+ * output + LPV35_FRAME_DATA_OFFSET to encrypt it in place
  * @param[out] output out frame data
  * @param[out] olen out frame data len
  *
@@ -159,6 +199,37 @@ OPERATE_RET lpv35_frame_serialize(const uint8_t *key, int key_len, const lpv35_f
 OPERATE_RET lpv35_frame_parse(const uint8_t *key, int key_len, const uint8_t *input, int ilen,
                               lpv35_frame_object_t *output);
 
+/**
+ * @brief lpv35_frame_serialize with an expanded key, e.g. the session key of
+ * a LAN client
+ *
+ * @param[in] gcm_key expanded encrypt key, calls on one key must not run
+ * concurrently
+ * @param[in] input raw data of lpv35 frame
+ * @param[out] output out frame data
+ * @param[out] olen out frame data len
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET lpv35_frame_serialize_with_key(cipher_gcm_key_t *gcm_key, const lpv35_frame_object_t *input,
+                                           uint8_t *output, int *olen);
+
+/**
+ * @brief lpv35_frame_parse with an expanded key
+ *
+ * @param[in] gcm_key expanded decrypt key, calls on one key must not run
+ * concurrently
+ * @param[in] input lpv35 frame
+ * @param[in] ilen lpv35 frame len
+ * @param[out] output decrypt raw lpv35 data
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET lpv35_frame_parse_with_key(cipher_gcm_key_t *gcm_key, const uint8_t *input, int ilen,
+                                       lpv35_frame_object_t *output);
+
 /**
  * @brief get lpv35 frame buffer size
  *
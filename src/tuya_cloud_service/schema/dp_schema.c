@@ -24,7 +24,9 @@
 
 #define MAX_TRANS_TYPE_NUM (DTT_SCT_SCENE + 1)
 
+#ifndef DP_SCHEMA_NUM_MAX
 #define DP_SCHEMA_NUM_MAX 1
+#endif
 
 typedef struct {
     // DELAYED_WORK_HANDLE tmm_dp_sync;
@@ -55,6 +57,156 @@ static bool dp_snprintf_append(char *buf, size_t buf_len, size_t *offset, const
     return true;
 }
 
+// same room rule as dp_snprintf_append, the '\0' must still fit
+static bool dp_json_append(char *buf, size_t buf_len, size_t *offset, const char *data, size_t len)
+{
+    if (*offset + len >= buf_len) {
+        return false;
+    }
+    memcpy(buf + *offset, data, len);
+    *offset += len;
+    return true;
+}
+
+static bool dp_json_append_uint(char *buf, size_t buf_len, size_t *offset, uint32_t value, bool negative)
+{
+    char tmp[12];
+    size_t pos = sizeof(tmp);
+
+    do {
+        tmp[--pos] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    if (negative) {
+        tmp[--pos] = '-';
+    }
+
+    return dp_json_append(buf, buf_len, offset, tmp + pos, sizeof(tmp) - pos);
+}
+
+static bool dp_json_append_int(char *buf, size_t buf_len, size_t *offset, int value)
+{
+    if (value < 0) {
+        return dp_json_append_uint(buf, buf_len, offset, 0U - (uint32_t)value, true);
+    }
+    return dp_json_append_uint(buf, buf_len, offset, (uint32_t)value, false);
+}
+
+// quote and escape str as cJSON_PrintUnformatted does
+static bool dp_json_append_str(char *buf, size_t buf_len, size_t *offset, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    const uint8_t *p = (const uint8_t *)str;
+    size_t pos = *offset;
+
+    if (pos + 1 >= buf_len) {
+        return false;
+    }
+    buf[pos++] = '"';
+    for (; *p; p++) {
+        char esc = 0;
+        switch (*p) {
+        case '"':
+            esc = '"';
+            break;
+        case '\\':
+            esc = '\\';
+            break;
+        case '\b':
+            esc = 'b';
+            break;
+        case '\f':
+            esc = 'f';
+            break;
+        case '\n':
+            esc = 'n';
+            break;
+        case '\r':
+            esc = 'r';
+            break;
+        case '\t':
+            esc = 't';
+            break;
+        default:
+            break;
+        }
+        if (esc) {
+            if (pos + 2 >= buf_len) {
+                return false;
+            }
+            buf[pos++] = '\\';
+            buf[pos++] = esc;
+        } else if (*p < 32) {
+            if (pos + 6 >= buf_len) {
+                return false;
+            }
+            memcpy(buf + pos, "\\u00", 4);
+            buf[pos + 4] = hex[*p >> 4];
+            buf[pos + 5] = hex[*p & 0xf];
+            pos += 6;
+        } else {
+            if (pos + 1 >= buf_len) {
+                return false;
+            }
+            buf[pos++] = *p;
+        }
+    }
+    if (pos + 1 >= buf_len) {
+        return false;
+    }
+    buf[pos++] = '"';
+    *offset = pos;
+
+    return true;
+}
+
+// bytes dp_json_append_str writes for str, quotes included
+static size_t dp_json_str_len(const char *str)
+{
+    const uint8_t *p = (const uint8_t *)str;
+    size_t len = 2;
+
+    for (; *p; p++) {
+        if ('"' == *p || '\\' == *p || '\b' == *p || '\f' == *p || '\n' == *p || '\r' == *p || '\t' == *p) {
+            len += 2;
+        } else if (*p < 32) {
+            len += 6;
+        } else {
+            len++;
+        }
+    }
+
+    return len;
+}
+
+// build the id index, the json keys and the devid hash once the nodes are parsed
+static OPERATE_RET dp_schema_compile(dp_schema_t *schema)
+{
+    int i;
+
+    schema->devid_hash = tuya_fnv1a32(schema->devid, strlen(schema->devid));
+    schema->id_max = 0;
+    for (i = 0; i < schema->num; i++) {
+        dp_node_t *node = &schema->node[i];
+        node->key_len = snprintf(node->key, DP_KEY_LEN, "\"%d\":", node->desc.id);
+        if (node->desc.id > schema->id_max) {
+            schema->id_max = node->desc.id;
+        }
+    }
+
+    schema->id_index = tal_malloc((schema->id_max + 1) * sizeof(uint16_t));
+    if (NULL == schema->id_index) {
+        return OPRT_MALLOC_FAILED;
+    }
+    memset(schema->id_index, 0, (schema->id_max + 1) * sizeof(uint16_t));
+    // the first node of an id wins, as with a linear search
+    for (i = schema->num - 1; i >= 0; i--) {
+        schema->id_index[schema->node[i].desc.id] = i + 1;
+    }
+
+    return OPRT_OK;
+}
+
 /**
  * @brief Appends a JSON string to the given data with the specified time, type,
  * and repetition sequence.
@@ -146,6 +298,13 @@ dp_node_t *dp_node_find(dp_schema_t *schema, int id)
     int i;
     dp_node_t *dpnode = NULL;
 
+    if (schema->id_index) {
+        if (id < 0 || id > schema->id_max || 0 == schema->id_index[id]) {
+            return NULL;
+        }
+        return &schema->node[schema->id_index[id] - 1];
+    }
+
     for (i = 0; i < schema->num; i++) {
         if (schema->node[i].desc.id == id) {
             dpnode = &schema->node[i];
@@ -164,6 +323,7 @@ dp_node_t *dp_node_find(dp_schema_t *schema, int id)
 dp_schema_t *dp_schema_find(const char *devid)
 {
     int i = 0;
+    uint32_t hash = tuya_fnv1a32(devid, strlen(devid));
 
     PR_TRACE("try to find schema devid %s", devid);
     dp_schema_mgr_t *dsmgr = &s_dsmgr;
@@ -171,7 +331,7 @@ dp_schema_t *dp_schema_find(const char *devid)
         if (NULL == dsmgr->schema_list[i]) {
             continue;
         }
-        if (0 == strcmp(devid, dsmgr->schema_list[i]->devid)) {
+        if (hash == dsmgr->schema_list[i]->devid_hash && 0 == strcmp(devid, dsmgr->schema_list[i]->devid)) {
             return dsmgr->schema_list[i];
         }
 
@@ -193,20 +353,12 @@ dp_schema_t *dp_schema_find(const char *devid)
  */
 dp_node_t *dp_node_find_by_devid(char *devid, int id)
 {
-    int i;
-    dp_node_t *dpnode = NULL;
-
     dp_schema_t *schema = dp_schema_find(devid);
     if (NULL == schema) {
         return NULL;
     }
-    for (i = 0; i < schema->num; i++) {
-        if (schema->node[i].desc.id == id) {
-            dpnode = &schema->node[i];
-            break;
-        }
-    }
-    return dpnode;
+
+    return dp_node_find(schema, id);
 }
 
 static __attribute__((unused)) OPERATE_RET dp_obj_equal_resp(dp_schema_t *schema, uint8_t *dpid, uint8_t num,
@@ -727,7 +879,7 @@ static bool dp_type_check(dp_rept_type_t dp_rept_type, dp_obj_t *dp, dp_node_t *
         }
 
         case PROP_BITMAP:
-            if (dp->type != cJSON_Number) {
+            if (node->prop.prop_bitmap.max_len < 32 && (dp->value.dp_bitmap >> node->prop.prop_bitmap.max_len)) {
                 PR_ERR("bitmap check fail %d %d %d", dp->type, dp->value.dp_bitmap, node->prop.prop_bitmap.max_len);
                 return FALSE;
             }
@@ -815,7 +967,7 @@ int dp_rept_valid_check(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t
         }
 
         case PROP_STR: {
-            dpvalid->len += 2 * strlen(dp->value.dp_str) + 15;
+            dpvalid->len += dp_json_str_len(dp->value.dp_str) + 15;
         } break;
 
         case PROP_ENUM: {
@@ -866,7 +1018,7 @@ int dp_rept_valid_check(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t
  */
 int dp_rept_json_output(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t *dpvalid, dp_rept_out_t *dpout)
 {
-    uint16_t i, j;
+    uint16_t i, j, next;
     size_t offset = 0;
     size_t time_offset = 0;
     OPERATE_RET op_ret = OPRT_OK;
@@ -903,11 +1055,14 @@ int dp_rept_json_output(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t
         dptimestr[time_offset++] = '{';
     }
 
-    for (i = 0; i < dpvalid->num; i++) {
+    // dpvalid->dpid follows the order of dpin->dps, so the search goes on from the last match
+    for (i = 0, next = 0; i < dpvalid->num; i++) {
         dp_obj_t *dp = NULL;
         for (j = 0; j < dpin->dpscnt; j++) {
-            if (dpvalid->dpid[i] == dpin->dps[j].id) {
-                dp = &dpin->dps[j];
+            uint16_t pos = (next + j) % dpin->dpscnt;
+            if (dpvalid->dpid[i] == dpin->dps[pos].id) {
+                dp = &dpin->dps[pos];
+                next = pos + 1;
                 break;
             }
         }
@@ -916,7 +1071,6 @@ int dp_rept_json_output(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t
             op_ret = OPRT_SVC_DP_ID_NOT_FOUND;
             goto __err_exit;
         }
-        // dp_obj_t  *dp     = &dpin->dps[dpvalid->dpid[i]];
         dp_node_t *dpnode = dp_node_find(schema, dp->id);
         if (NULL == dpnode) {
             PR_DEBUG("dp->id = %d not found", dp->id);
@@ -929,63 +1083,43 @@ int dp_rept_json_output(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t
             goto __err_exit;
         }
 
+        bool append = dp_json_append(dpstr, dpvalid->len, &offset, dpnode->key, dpnode->key_len);
         switch (dp->type) {
         case PROP_BOOL: {
             if (TRUE == dp->value.dp_bool) {
-                if (!dp_snprintf_append(dpstr, dpvalid->len, &offset, "\"%d\":true,", dp->id)) {
-                    op_ret = OPRT_BUFFER_NOT_ENOUGH;
-                    goto __err_exit;
-                }
+                append = append && dp_json_append(dpstr, dpvalid->len, &offset, "true", 4);
             } else {
-                if (!dp_snprintf_append(dpstr, dpvalid->len, &offset, "\"%d\":false,", dp->id)) {
-                    op_ret = OPRT_BUFFER_NOT_ENOUGH;
-                    goto __err_exit;
-                }
+                append = append && dp_json_append(dpstr, dpvalid->len, &offset, "false", 5);
             }
             break;
         }
 
         case PROP_VALUE: {
-            if (!dp_snprintf_append(dpstr, dpvalid->len, &offset, "\"%d\":%d,", dp->id, dp->value.dp_value)) {
-                op_ret = OPRT_BUFFER_NOT_ENOUGH;
-                goto __err_exit;
-            }
+            append = append && dp_json_append_int(dpstr, dpvalid->len, &offset, dp->value.dp_value);
             break;
         }
 
         case PROP_BITMAP: {
-            if (!dp_snprintf_append(dpstr, dpvalid->len, &offset, "\"%d\":%" PRIu32 ",", dp->id,
-                                    dp->value.dp_bitmap)) {
-                op_ret = OPRT_BUFFER_NOT_ENOUGH;
-                goto __err_exit;
-            }
+            append = append && dp_json_append_uint(dpstr, dpvalid->len, &offset, dp->value.dp_bitmap, false);
             break;
         }
 
         case PROP_STR: {
-            cJSON *temp_str = cJSON_CreateString(dp->value.dp_str);
-            char *tmp_data = cJSON_PrintUnformatted(temp_str);
-            if (tmp_data) {
-                if (!dp_snprintf_append(dpstr, dpvalid->len, &offset, "\"%d\":%s,", dp->id, tmp_data)) {
-                    tal_free(tmp_data);
-                    cJSON_Delete(temp_str);
-                    op_ret = OPRT_BUFFER_NOT_ENOUGH;
-                    goto __err_exit;
-                }
-            }
-            tal_free(tmp_data);
-            cJSON_Delete(temp_str);
+            append = append && dp_json_append_str(dpstr, dpvalid->len, &offset, dp->value.dp_str);
             break;
         }
 
         case PROP_ENUM: {
-            if (!dp_snprintf_append(dpstr, dpvalid->len, &offset, "\"%d\":\"%s\",", dp->id,
-                                    dpnode->prop.prop_enum.pp_enum[dp->value.dp_enum])) {
-                op_ret = OPRT_BUFFER_NOT_ENOUGH;
-                goto __err_exit;
-            }
+            const char *name = dpnode->prop.prop_enum.pp_enum[dp->value.dp_enum];
+            append = append && dp_json_append(dpstr, dpvalid->len, &offset, "\"", 1) &&
+                     dp_json_append(dpstr, dpvalid->len, &offset, name, strlen(name)) &&
+                     dp_json_append(dpstr, dpvalid->len, &offset, "\"", 1);
         } break;
         }
+        if (!append || !dp_json_append(dpstr, dpvalid->len, &offset, ",", 1)) {
+            op_ret = OPRT_BUFFER_NOT_ENOUGH;
+            goto __err_exit;
+        }
 
         if (is_need_time && dp->time_stamp) {
             if (!dp_snprintf_append(dptimestr, dpvalid->timelen, &time_offset, "\"%d\":%u,", dp->id, dp->time_stamp)) {
@@ -1637,12 +1771,20 @@ int dp_schema_create(char *devid, char *schema_json, dp_schema_t **dp_schema_out
     dp_schema->actv.preprocess = other_attr.preprocess;
     dp_schema->actv.attach_dp_if = TRUE;
     strncpy(dp_schema->devid, devid, DEV_ID_LEN);
+    op_ret = dp_schema_compile(dp_schema);
+    if (OPRT_OK != op_ret) {
+        PR_ERR("dp schema compile fail:%d", op_ret);
+        goto __exit;
+    }
     if (dp_schema_out) {
         *dp_schema_out = dp_schema;
     }
-    if (s_dsmgr.schema_num < DP_SCHEMA_NUM_MAX) {
-        s_dsmgr.schema_list[s_dsmgr.schema_num] = dp_schema;
-        s_dsmgr.schema_num++;
+    for (int i = 0; i < DP_SCHEMA_NUM_MAX; i++) {
+        if (NULL == s_dsmgr.schema_list[i]) {
+            s_dsmgr.schema_list[i] = dp_schema;
+            s_dsmgr.schema_num++;
+            break;
+        }
     }
     PR_DEBUG("create dp_schema Success ");
     tal_free(nodepos);
@@ -1679,6 +1821,7 @@ int dp_schema_delete(char *devid)
 
         if (0 == strcmp(devid, dsmgr->schema_list[i]->devid)) {
             tal_mutex_release(dsmgr->schema_list[i]->mutex);
+            tal_free(dsmgr->schema_list[i]->id_index);
             tal_free(dsmgr->schema_list[i]);
             dsmgr->schema_list[i] = NULL;
             dsmgr->schema_num--;
@@ -290,6 +290,9 @@ typedef union {
     dp_prop_bitmap_t prop_bitmap;
 } dp_prop_vaule_t;
 
+// "255": with '\0'
+#define DP_KEY_LEN 8
+
 /**
  * @brief Definition of dp  control
  */
@@ -307,6 +310,9 @@ typedef struct {
     TIME_T time_stamp;
     /** sn for ble dp sync report */
     // uint32_t ble_send_sn;
+    /** key of the dp in the reported json, "id": */
+    uint8_t key_len;
+    char key[DP_KEY_LEN];
 } dp_node_t; // dp_obj_t
 
 /**
@@ -329,6 +335,12 @@ typedef struct {
     dp_prop_actv_t actv;
     /** exclusive access to dp */
     MUTEX_HANDLE mutex;
+    /** hash of devid */
+    uint32_t devid_hash;
+    /** node position + 1 by dp id, 0 if no node has the id, wider than num so 255 nodes do not wrap */
+    uint16_t *id_index;
+    /** highest dp id */
+    uint8_t id_max;
     /** count of dp */
     uint8_t num;
     /** dp info */
@@ -348,6 +360,7 @@ typedef struct {
 #define DP_REPT_NO_FILTER_FLAG  (1 << 0)
 #define DP_DUMP_STAT_LOCAL_FLAG (1 << 1)
 #define DP_APPEND_HEADER_FLAG   (1 << 2)
+#define DP_REPT_IMMEDIATE_FLAG  (1 << 3) // not merged by the report scheduler
 
 typedef struct {
     char *devid;
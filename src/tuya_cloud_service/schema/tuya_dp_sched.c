@@ -0,0 +1,670 @@
+/**
+ * @file tuya_dp_sched.c
+ * @brief Coalescing and rate shaping of the object DP reports.
+ *
+ * Every device with DPs waiting has a slot holding the latest value of each
+ * of them, in the order they were first reported, and the deadline of its
+ * window. One delayed work is armed for the earliest deadline of all slots
+ * and sends the slots that are due.
+ *
+ * The rate limit keeps the send times of the last DP_REPORT_SCHED_MAX_RATE
+ * reports in a ring, a slot is only sent once the oldest of them is a second
+ * old, so no second ever has more reports than that. Reports sent at once
+ * are recorded in the ring too but are never held back.
+ *
+ * The DPs of a slot are taken out under the mutex and sent after it is
+ * released, so the send may block without holding up the reporters. The
+ * notifies of the reports merged into the slot go with them and get the
+ * result of that send. The work runs on WORKQ_SYSTEM, a send that blocks on
+ * the network must not hold up the high priority queue.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <inttypes.h>
+
+#include "tuya_config_defaults.h"
+#include "tuya_error_code.h"
+#include "tal_api.h"
+#include "tuya_list.h"
+#include "tuya_protocol.h"
+#include "tuya_dp_sched.h"
+
+#if defined(ENABLE_DP_REPORT_SCHED) && (ENABLE_DP_REPORT_SCHED == 1)
+
+/***********************************************************
+*************************micro define***********************
+***********************************************************/
+#ifndef DP_REPORT_SCHED_WINDOW_MS
+#define DP_REPORT_SCHED_WINDOW_MS 500
+#endif
+
+#ifndef DP_REPORT_SCHED_MAX_RATE
+#define DP_REPORT_SCHED_MAX_RATE 2
+#endif
+
+#if DP_REPORT_SCHED_MAX_RATE < 1
+#error "DP_REPORT_SCHED_MAX_RATE must be at least 1"
+#endif
+
+#define DP_SCHED_RATE_PERIOD_MS 1000
+
+// MQTT fixed header and topic length of a publish
+#define DP_SCHED_MQTT_HEAD_LEN 4
+#define DP_SCHED_TOPIC_PREFIX  "smart/device/out/"
+
+typedef struct {
+    dp_sched_notify_t cb;
+    void *user_data;
+} dp_sched_notify_node_t;
+
+typedef struct {
+    LIST_HEAD node;
+    char devid[DEV_ID_LEN + 1];
+    SYS_TIME_T deadline;   // end of the window, valid while num > 0
+    int flags;             // flags of the merged reports
+    uint32_t reports;      // reports merged
+    uint32_t separate_len; // estimated bytes of the merged reports sent one by one
+    uint16_t num;
+    uint16_t cap;
+    dp_obj_t *dps;
+    uint16_t notify_num;
+    uint16_t notify_cap;
+    dp_sched_notify_node_t *notify;
+    uint32_t immediate[256 / 32]; // by dpid
+} dp_sched_slot_t;
+
+// DPs taken out of a slot to be sent
+typedef struct {
+    char devid[DEV_ID_LEN + 1];
+    int flags;
+    uint16_t num;
+    dp_obj_t *dps;
+    uint16_t notify_num;
+    dp_sched_notify_node_t *notify;
+} dp_sched_batch_t;
+
+typedef struct {
+    MUTEX_HANDLE mutex;
+    DELAYED_WORK_HANDLE work;
+    dp_sched_send_t send;
+    LIST_HEAD slots;
+    SYS_TIME_T sent[DP_REPORT_SCHED_MAX_RATE]; // send times, sent[sent_idx] is the oldest
+    uint32_t sent_idx;
+    SYS_TIME_T armed; // deadline the work is armed for, 0 if none
+    dp_sched_stats_t stats;
+} dp_sched_t;
+
+/***********************************************************
+*************************variable define********************
+***********************************************************/
+static dp_sched_t sg_dp_sched;
+
+/***********************************************************
+*************************function define********************
+***********************************************************/
+static void __dps_free(dp_obj_t *dps, uint16_t num)
+{
+    for (uint16_t i = 0; i < num; i++) {
+        if (PROP_STR == dps[i].type) {
+            tal_free(dps[i].value.dp_str);
+        }
+    }
+    tal_free(dps);
+}
+
+static int __dp_copy(dp_obj_t *dst, const dp_obj_t *src)
+{
+    *dst = *src;
+    if (PROP_STR == src->type) {
+        size_t len = strlen(src->value.dp_str);
+        dst->value.dp_str = tal_malloc(len + 1);
+        if (NULL == dst->value.dp_str) {
+            return OPRT_MALLOC_FAILED;
+        }
+        memcpy(dst->value.dp_str, src->value.dp_str, len + 1);
+    }
+
+    return OPRT_OK;
+}
+
+// bytes of "id":value, in the reported JSON, escapes in strings are not counted
+static uint32_t __dp_json_len(dp_node_t *node, const dp_obj_t *dp)
+{
+    uint32_t len = snprintf(NULL, 0, "\"%d\":,", dp->id);
+
+    switch (dp->type) {
+    case PROP_BOOL:
+        len += dp->value.dp_bool ? 4 : 5;
+        break;
+    case PROP_VALUE:
+        len += snprintf(NULL, 0, "%d", dp->value.dp_value);
+        break;
+    case PROP_BITMAP:
+        len += snprintf(NULL, 0, "%" PRIu32, dp->value.dp_bitmap);
+        break;
+    case PROP_STR:
+        len += strlen(dp->value.dp_str) + 2;
+        break;
+    case PROP_ENUM:
+        if (dp->value.dp_enum < node->prop.prop_enum.cnt) {
+            len += strlen(node->prop.prop_enum.pp_enum[dp->value.dp_enum]) + 2;
+        }
+        break;
+    default:
+        break;
+    }
+
+    return len;
+}
+
+static uint32_t __frame_overhead(const char *devid)
+{
+    return tuya_pack_protocol_frame_size(DP_CMD_MQ, 0) + DP_SCHED_MQTT_HEAD_LEN + strlen(DP_SCHED_TOPIC_PREFIX) +
+           strlen(devid);
+}
+
+static dp_sched_slot_t *__slot_find(const char *devid)
+{
+    P_LIST_HEAD pos;
+
+    tuya_list_for_each(pos, &sg_dp_sched.slots)
+    {
+        dp_sched_slot_t *slot = tuya_list_entry(pos, dp_sched_slot_t, node);
+        if (0 == strcmp(slot->devid, devid)) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+static dp_sched_slot_t *__slot_get(const char *devid)
+{
+    dp_sched_slot_t *slot = __slot_find(devid);
+
+    if (slot) {
+        return slot;
+    }
+
+    slot = tal_calloc(1, sizeof(dp_sched_slot_t));
+    if (NULL == slot) {
+        return NULL;
+    }
+    strncpy(slot->devid, devid, DEV_ID_LEN);
+    tuya_list_add_tail(&slot->node, &sg_dp_sched.slots);
+
+    return slot;
+}
+
+static bool __slot_immediate(dp_sched_slot_t *slot, uint8_t dpid)
+{
+    return slot->immediate[dpid / 32] & (1UL << (dpid % 32));
+}
+
+// move the pending DPs of slot to batch and count the merged report as sent
+static void __slot_take(dp_sched_slot_t *slot, dp_sched_batch_t *batch, SYS_TIME_T now)
+{
+    uint32_t merged_len = 1;
+
+    strcpy(batch->devid, slot->devid);
+    batch->flags = slot->flags;
+    batch->num = slot->num;
+    batch->dps = slot->dps;
+    batch->notify_num = slot->notify_num;
+    batch->notify = slot->notify;
+
+    dp_schema_t *schema = dp_schema_find(slot->devid);
+    for (uint16_t i = 0; schema && i < slot->num; i++) {
+        dp_node_t *node = dp_node_find(schema, slot->dps[i].id);
+        if (node) {
+            merged_len += __dp_json_len(node, &slot->dps[i]);
+        }
+    }
+    merged_len += __frame_overhead(slot->devid);
+    if (slot->separate_len > merged_len) {
+        sg_dp_sched.stats.bytes_saved += slot->separate_len - merged_len;
+    }
+    sg_dp_sched.stats.frames++;
+
+    slot->dps = NULL;
+    slot->num = 0;
+    slot->cap = 0;
+    slot->notify = NULL;
+    slot->notify_num = 0;
+    slot->notify_cap = 0;
+    slot->flags = 0;
+    slot->reports = 0;
+    slot->separate_len = 0;
+
+    sg_dp_sched.sent[sg_dp_sched.sent_idx] = now;
+    sg_dp_sched.sent_idx = (sg_dp_sched.sent_idx + 1) % DP_REPORT_SCHED_MAX_RATE;
+}
+
+// earliest time the rate limit allows a report
+static SYS_TIME_T __rate_next(void)
+{
+    SYS_TIME_T oldest = sg_dp_sched.sent[sg_dp_sched.sent_idx];
+
+    return oldest ? oldest + DP_SCHED_RATE_PERIOD_MS : 0;
+}
+
+static void __notify_all(dp_sched_notify_node_t *notify, uint16_t num, int result)
+{
+    for (uint16_t i = 0; i < num; i++) {
+        notify[i].cb(result, notify[i].user_data);
+    }
+    tal_free(notify);
+}
+
+static void __batch_send(dp_sched_batch_t *batch, int *result)
+{
+    int rt = OPRT_OK;
+
+    if (batch->num) {
+        PR_DEBUG("dp sched send %s, dpscnt %d", batch->devid, batch->num);
+        rt = sg_dp_sched.send(batch->devid, batch->dps, batch->num, batch->flags);
+    }
+    __dps_free(batch->dps, batch->num);
+    __notify_all(batch->notify, batch->notify_num, rt);
+    if (result) {
+        *result = rt;
+    }
+}
+
+// arm the work for the earliest time a slot is due, called with the mutex held
+static void __work_arm(SYS_TIME_T now)
+{
+    SYS_TIME_T next = 0;
+    SYS_TIME_T rate = __rate_next();
+    P_LIST_HEAD pos;
+
+    tuya_list_for_each(pos, &sg_dp_sched.slots)
+    {
+        dp_sched_slot_t *slot = tuya_list_entry(pos, dp_sched_slot_t, node);
+        if (slot->num && (0 == next || slot->deadline < next)) {
+            next = slot->deadline;
+        }
+    }
+    if (0 == next) {
+        return;
+    }
+    if (next < rate) {
+        next = rate;
+    }
+    if (sg_dp_sched.armed && sg_dp_sched.armed <= next) {
+        return;
+    }
+
+    sg_dp_sched.armed = next;
+    tal_workq_start_delayed(sg_dp_sched.work, (next > now) ? (next - now) : 0, LOOP_ONCE);
+}
+
+static void __sched_work(void *data)
+{
+    dp_sched_batch_t batch;
+
+    for (;;) {
+        SYS_TIME_T now = tal_system_get_millisecond();
+        dp_sched_slot_t *due = NULL;
+        P_LIST_HEAD pos;
+
+        tal_mutex_lock(sg_dp_sched.mutex);
+        sg_dp_sched.armed = 0;
+        if (__rate_next() <= now) {
+            tuya_list_for_each(pos, &sg_dp_sched.slots)
+            {
+                dp_sched_slot_t *slot = tuya_list_entry(pos, dp_sched_slot_t, node);
+                if (slot->num && slot->deadline <= now) {
+                    due = slot;
+                    break;
+                }
+            }
+        }
+        if (NULL == due) {
+            __work_arm(now);
+            tal_mutex_unlock(sg_dp_sched.mutex);
+            return;
+        }
+        __slot_take(due, &batch, now);
+        tal_mutex_unlock(sg_dp_sched.mutex);
+
+        __batch_send(&batch, NULL);
+    }
+}
+
+/**
+ * @brief init the scheduler, called once at the client init, it does nothing
+ * if already done
+ *
+ * @param[in] send sends the merged reports
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int dp_sched_init(dp_sched_send_t send)
+{
+    int rt = OPRT_OK;
+
+    if (NULL == send) {
+        return OPRT_INVALID_PARM;
+    }
+    if (sg_dp_sched.send) {
+        return OPRT_OK;
+    }
+
+    INIT_LIST_HEAD(&sg_dp_sched.slots);
+    TUYA_CALL_ERR_RETURN(tal_mutex_create_init(&sg_dp_sched.mutex));
+    rt = tal_workq_init_delayed(WORKQ_SYSTEM, __sched_work, NULL, &sg_dp_sched.work);
+    if (OPRT_OK != rt) {
+        tal_mutex_release(sg_dp_sched.mutex);
+        sg_dp_sched.mutex = NULL;
+        return rt;
+    }
+    sg_dp_sched.send = send;
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief merge a report with the pending one of its device
+ *
+ * The DPs are checked against the schema of devid, a DP of another type than
+ * in the schema fails the whole report, DPs not in the schema are dropped.
+ *
+ * @param[in] devid device of the report
+ * @param[in] dps DPs of the report, strings are copied
+ * @param[in] dpscnt number of DPs
+ * @param[in] flags DP_REPT_* flags, merged reports carry the flags of all
+ * their reports
+ * @param[in] notify called once with the result of the send that carried the
+ * report if OPRT_OK is returned, never otherwise, may be NULL; the result
+ * says the report was queued, not delivered, see dp_sched_notify_t
+ * @param[in] user_data user data of notify
+ *
+ * @return OPRT_OK once merged, the result of the send for a report sent at
+ * once, others on error, in which case nothing of the report was merged
+ */
+int dp_sched_push(const char *devid, const dp_obj_t *dps, uint16_t dpscnt, int flags, dp_sched_notify_t notify,
+                  void *user_data)
+{
+    int rt = OPRT_OK;
+    uint16_t i, j, num = 0;
+    uint32_t report_len = 1;
+    bool immediate = (flags & DP_REPT_IMMEDIATE_FLAG) ? true : false;
+
+    if (NULL == sg_dp_sched.send) {
+        return OPRT_RESOURCE_NOT_READY;
+    }
+    if (NULL == devid || NULL == dps || 0 == dpscnt) {
+        return OPRT_INVALID_PARM;
+    }
+
+    dp_schema_t *schema = dp_schema_find(devid);
+    if (NULL == schema) {
+        return OPRT_INVALID_PARM;
+    }
+    for (i = 0; i < dpscnt; i++) {
+        dp_node_t *node = dp_node_find(schema, dps[i].id);
+        if (node && dps[i].type != node->desc.prop_tp) {
+            PR_ERR("dparr[%d] type not match:%d %d", i, dps[i].type, node->desc.prop_tp);
+            return OPRT_SVC_DP_TP_NOT_MATCH;
+        }
+        if (PROP_STR == dps[i].type && NULL == dps[i].value.dp_str) {
+            return OPRT_INVALID_PARM;
+        }
+    }
+
+    // copy the DPs before taking the mutex, a failed copy leaves the slot as it was
+    dp_obj_t *copies = tal_malloc(sizeof(dp_obj_t) * dpscnt);
+    if (NULL == copies) {
+        return OPRT_MALLOC_FAILED;
+    }
+    for (i = 0; i < dpscnt; i++) {
+        dp_node_t *node = dp_node_find(schema, dps[i].id);
+        if (NULL == node) {
+            PR_ERR("dpnode[%d]: dpid %d not find", i, dps[i].id);
+            continue;
+        }
+        if (OPRT_OK != __dp_copy(&copies[num], &dps[i])) {
+            __dps_free(copies, num);
+            return OPRT_MALLOC_FAILED;
+        }
+        num++;
+        report_len += __dp_json_len(node, &dps[i]);
+        if (TRIG_DIRECT == node->desc.trig) {
+            immediate = true;
+        }
+    }
+    if (0 == num) {
+        tal_free(copies);
+        return OPRT_SVC_DP_ID_NOT_FOUND;
+    }
+
+    tal_mutex_lock(sg_dp_sched.mutex);
+    dp_sched_slot_t *slot = __slot_get(devid);
+    if (NULL == slot) {
+        rt = OPRT_MALLOC_FAILED;
+        goto __err_unlock;
+    }
+
+    if (slot->cap < slot->num + num) {
+        uint16_t cap = slot->num + num;
+        if (cap < schema->num) {
+            cap = schema->num;
+        }
+        dp_obj_t *grown = tal_malloc(sizeof(dp_obj_t) * cap);
+        if (NULL == grown) {
+            rt = OPRT_MALLOC_FAILED;
+            goto __err_unlock;
+        }
+        if (slot->num) {
+            memcpy(grown, slot->dps, sizeof(dp_obj_t) * slot->num);
+        }
+        tal_free(slot->dps);
+        slot->dps = grown;
+        slot->cap = cap;
+    }
+    if (notify && slot->notify_cap == slot->notify_num) {
+        uint16_t cap = slot->notify_cap ? slot->notify_cap * 2 : 4;
+        dp_sched_notify_node_t *grown = tal_malloc(sizeof(dp_sched_notify_node_t) * cap);
+        if (NULL == grown) {
+            rt = OPRT_MALLOC_FAILED;
+            goto __err_unlock;
+        }
+        if (slot->notify_num) {
+            memcpy(grown, slot->notify, sizeof(dp_sched_notify_node_t) * slot->notify_num);
+        }
+        tal_free(slot->notify);
+        slot->notify = grown;
+        slot->notify_cap = cap;
+    }
+
+    // nothing fails from here on, the report is merged as a whole
+    bool fresh = (0 == slot->num);
+    for (i = 0; i < num; i++) {
+        for (j = 0; j < slot->num; j++) {
+            if (slot->dps[j].id == copies[i].id) {
+                break;
+            }
+        }
+        if (j < slot->num) {
+            if (PROP_STR == slot->dps[j].type) {
+                tal_free(slot->dps[j].value.dp_str);
+            }
+            sg_dp_sched.stats.merged++;
+        } else {
+            slot->num++;
+        }
+        slot->dps[j] = copies[i];
+
+        if (__slot_immediate(slot, copies[i].id)) {
+            immediate = true;
+        }
+    }
+    tal_free(copies);
+
+    SYS_TIME_T now = tal_system_get_millisecond();
+    if (fresh) {
+        slot->deadline = now + DP_REPORT_SCHED_WINDOW_MS;
+    }
+    slot->flags |= flags & ~DP_REPT_IMMEDIATE_FLAG;
+    slot->reports++;
+    slot->separate_len += report_len + __frame_overhead(devid);
+    sg_dp_sched.stats.reports++;
+
+    if (immediate) {
+        dp_sched_batch_t batch;
+
+        sg_dp_sched.stats.immediate++;
+        __slot_take(slot, &batch, now);
+        __work_arm(now);
+        tal_mutex_unlock(sg_dp_sched.mutex);
+
+        __batch_send(&batch, &rt);
+        if (OPRT_OK == rt && notify) {
+            notify(rt, user_data);
+        }
+        return rt;
+    }
+
+    if (notify) {
+        slot->notify[slot->notify_num].cb = notify;
+        slot->notify[slot->notify_num].user_data = user_data;
+        slot->notify_num++;
+    }
+    __work_arm(now);
+    tal_mutex_unlock(sg_dp_sched.mutex);
+
+    return OPRT_OK;
+
+__err_unlock:
+    tal_mutex_unlock(sg_dp_sched.mutex);
+    __dps_free(copies, num);
+    return rt;
+}
+
+/**
+ * @brief mark a DP to be reported at once instead of merged
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int dp_sched_immediate_set(const char *devid, uint8_t dpid, bool enable)
+{
+    if (NULL == sg_dp_sched.send || NULL == devid) {
+        return OPRT_INVALID_PARM;
+    }
+
+    tal_mutex_lock(sg_dp_sched.mutex);
+    dp_sched_slot_t *slot = __slot_get(devid);
+    if (NULL == slot) {
+        tal_mutex_unlock(sg_dp_sched.mutex);
+        return OPRT_MALLOC_FAILED;
+    }
+    if (enable) {
+        slot->immediate[dpid / 32] |= (1UL << (dpid % 32));
+    } else {
+        slot->immediate[dpid / 32] &= ~(1UL << (dpid % 32));
+    }
+    tal_mutex_unlock(sg_dp_sched.mutex);
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief send the pending report of devid now, regardless of the window and
+ * the rate limit
+ *
+ * @param[in] devid device, NULL for all
+ */
+void dp_sched_flush(const char *devid)
+{
+    if (NULL == sg_dp_sched.send) {
+        return;
+    }
+
+    for (;;) {
+        dp_sched_batch_t batch;
+        dp_sched_slot_t *due = NULL;
+        P_LIST_HEAD pos;
+
+        tal_mutex_lock(sg_dp_sched.mutex);
+        tuya_list_for_each(pos, &sg_dp_sched.slots)
+        {
+            dp_sched_slot_t *slot = tuya_list_entry(pos, dp_sched_slot_t, node);
+            if (slot->num && (NULL == devid || 0 == strcmp(slot->devid, devid))) {
+                due = slot;
+                break;
+            }
+        }
+        if (NULL == due) {
+            tal_mutex_unlock(sg_dp_sched.mutex);
+            return;
+        }
+        __slot_take(due, &batch, tal_system_get_millisecond());
+        tal_mutex_unlock(sg_dp_sched.mutex);
+
+        __batch_send(&batch, NULL);
+    }
+}
+
+/**
+ * @brief drop the pending report of devid without sending it, the notifies of
+ * its reports get OPRT_COM_ERROR
+ *
+ * @param[in] devid device, NULL for all
+ */
+void dp_sched_clear(const char *devid)
+{
+    P_LIST_HEAD pos, next;
+    LIST_HEAD dropped;
+
+    if (NULL == sg_dp_sched.send) {
+        return;
+    }
+
+    INIT_LIST_HEAD(&dropped);
+    tal_mutex_lock(sg_dp_sched.mutex);
+    tuya_list_for_each_safe(pos, next, &sg_dp_sched.slots)
+    {
+        dp_sched_slot_t *slot = tuya_list_entry(pos, dp_sched_slot_t, node);
+        if (NULL == devid || 0 == strcmp(slot->devid, devid)) {
+            tuya_list_del(&slot->node);
+            tuya_list_add_tail(&slot->node, &dropped);
+        }
+    }
+    tal_mutex_unlock(sg_dp_sched.mutex);
+
+    // the notifies may report again, so they run without the mutex
+    tuya_list_for_each_safe(pos, next, &dropped)
+    {
+        dp_sched_slot_t *slot = tuya_list_entry(pos, dp_sched_slot_t, node);
+        tuya_list_del(&slot->node);
+        __dps_free(slot->dps, slot->num);
+        __notify_all(slot->notify, slot->notify_num, OPRT_COM_ERROR);
+        tal_free(slot);
+    }
+}
+
+/**
+ * @brief copy the counters
+ */
+void dp_sched_stats(dp_sched_stats_t *stats)
+{
+    if (NULL == stats) {
+        return;
+    }
+    if (NULL == sg_dp_sched.send) {
+        memset(stats, 0, sizeof(dp_sched_stats_t));
+        return;
+    }
+
+    tal_mutex_lock(sg_dp_sched.mutex);
+    *stats = sg_dp_sched.stats;
+    tal_mutex_unlock(sg_dp_sched.mutex);
+    if (stats->frames) {
+        stats->batch_x100 = (uint32_t)(((uint64_t)stats->reports * 100) / stats->frames);
+    }
+}
+
+#endif
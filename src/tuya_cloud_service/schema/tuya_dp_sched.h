@@ -0,0 +1,118 @@
+/**
+ * @file tuya_dp_sched.h
+ * @brief Coalescing and rate shaping of the object DP reports.
+ *
+ * With ENABLE_DP_REPORT_SCHED, tuya_iot_dp_obj_report hands its DPs to this
+ * scheduler instead of sending them at once. The reports of a device made
+ * within DP_REPORT_SCHED_WINDOW_MS are merged, only the latest value of each
+ * DP is kept, and go out as one report. At most DP_REPORT_SCHED_MAX_RATE
+ * merged reports are sent per second, DPs reported meanwhile keep merging.
+ *
+ * A report is sent at once, together with what is pending for its device,
+ * if it has DP_REPT_IMMEDIATE_FLAG, or if one of its DPs is TRIG_DIRECT or
+ * was marked with dp_sched_immediate_set.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef __TUYA_DP_SCHED_H__
+#define __TUYA_DP_SCHED_H__
+
+#include "tuya_cloud_types.h"
+#include "dp_schema.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief send a merged report of devid, as tuya_iot_dp_obj_report does
+ * without the scheduler
+ */
+typedef int (*dp_sched_send_t)(const char *devid, dp_obj_t *dps, uint16_t dpscnt, int flags);
+
+/**
+ * @brief result of the send that carried a report, OPRT_COM_ERROR if it was
+ * dropped by dp_sched_clear
+ *
+ * OPRT_OK means the merged report was handed to the channel, e.g. queued for
+ * an MQTT publish or stored by the offline queue, not that the cloud
+ * acknowledged it: the PUBACK is not waited for.
+ */
+typedef void (*dp_sched_notify_t)(int result, void *user_data);
+
+typedef struct {
+    uint32_t reports;     // reports taken by dp_sched_push
+    uint32_t merged;      // DP values replaced by a newer one before being sent
+    uint32_t frames;      // merged reports sent
+    uint32_t immediate;   // merged reports sent at once, not by the window
+    uint32_t batch_x100;  // average reports per merged report, x100
+    uint32_t bytes_saved; // estimated bytes the merged reports saved
+} dp_sched_stats_t;
+
+/**
+ * @brief init the scheduler, called once at the client init, it does nothing
+ * if already done
+ *
+ * @param[in] send sends the merged reports
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int dp_sched_init(dp_sched_send_t send);
+
+/**
+ * @brief merge a report with the pending one of its device
+ *
+ * The DPs are checked against the schema of devid, a DP of another type than
+ * in the schema fails the whole report, DPs not in the schema are dropped.
+ *
+ * @param[in] devid device of the report
+ * @param[in] dps DPs of the report, strings are copied
+ * @param[in] dpscnt number of DPs
+ * @param[in] flags DP_REPT_* flags, merged reports carry the flags of all
+ * their reports
+ * @param[in] notify called once with the result of the send that carried the
+ * report if OPRT_OK is returned, never otherwise, may be NULL; the result
+ * says the report was queued, not delivered, see dp_sched_notify_t
+ * @param[in] user_data user data of notify
+ *
+ * @return OPRT_OK once merged, the result of the send for a report sent at
+ * once, others on error, in which case nothing of the report was merged
+ */
+int dp_sched_push(const char *devid, const dp_obj_t *dps, uint16_t dpscnt, int flags, dp_sched_notify_t notify,
+                  void *user_data);
+
+/**
+ * @brief mark a DP to be reported at once instead of merged
+ *
+ * @return OPRT_OK on success, others on error
+ */
+int dp_sched_immediate_set(const char *devid, uint8_t dpid, bool enable);
+
+/**
+ * @brief send the pending report of devid now, regardless of the window and
+ * the rate limit
+ *
+ * @param[in] devid device, NULL for all
+ */
+void dp_sched_flush(const char *devid);
+
+/**
+ * @brief drop the pending report of devid without sending it, the notifies of
+ * its reports get OPRT_COM_ERROR
+ *
+ * @param[in] devid device, NULL for all
+ */
+void dp_sched_clear(const char *devid);
+
+/**
+ * @brief copy the counters
+ */
+void dp_sched_stats(dp_sched_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TUYA_DP_SCHED_H__ */
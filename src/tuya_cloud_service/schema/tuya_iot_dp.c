@@ -24,6 +24,7 @@
 #include "tuya_lan.h"
 #include "tal_api.h"
 #include "mix_method.h"
+#include "tuya_dp_sched.h"
 
 #ifdef ENABLE_BLUETOOTH
 #include "ble_mgr.h"
@@ -34,6 +35,16 @@ static DELAYED_WORK_HANDLE s_tmm_dp_sync = NULL;
 
 int tuya_iot_dp_sync_start(tuya_iot_client_t *client, uint32_t timeout_s);
 
+/* with the offline queue, reports also go to MQTT while it is disconnected */
+static bool dp_mqtt_channel_ready(void)
+{
+#if defined(ENABLE_MQTT_OFFLINE_QUEUE) && (ENABLE_MQTT_OFFLINE_QUEUE == 1)
+    return true;
+#else
+    return tuya_iot_is_connected();
+#endif
+}
+
 static void dp_sync_cb(int result, void *user_data)
 {
     dp_rept_valid_t *dpvalid = (dp_rept_valid_t *)user_data;
@@ -195,36 +206,14 @@ int tuya_iot_dp_parse(tuya_iot_client_t *client, dp_cmd_type_t cmd_tp, cJSON *cm
     msg->data_js = cmd_js;
     msg->user_data = client;
 
-    return tal_workq_schedule(WORKQ_HIGHTPRI, tuya_iot_dp_parse_on_worq, msg);
+    // dp issue is answered by user, don't let it wait behind other works
+    return tal_workq_schedule_prio(WORKQ_HIGHTPRI, tuya_iot_dp_parse_on_worq, msg, WORK_PRIO_HIGH);
 }
 
-/**
- * @brief Reports device object data to the Tuya IoT cloud service.
- *
- * This function is used to report the device object data to the Tuya IoT cloud
- * service.
- *
- * @param client The Tuya IoT client instance.
- * @param devid The device ID.
- * @param dps An array of device object data.
- * @param dpscnt The number of device object data elements in the array.
- * @param flags Additional flags for the report.
- *
- * @return The result of the operation. Returns 0 on success, or a negative
- * error code on failure.
- */
-int tuya_iot_dp_obj_report(tuya_iot_client_t *client, const char *devid, dp_obj_t *dps, uint16_t dpscnt, int flags)
+static int dp_obj_report_send(tuya_iot_client_t *client, const char *devid, dp_obj_t *dps, uint16_t dpscnt, int flags)
 {
     int ret = OPRT_OK;
 
-    if (!client->is_activated) {
-        PR_DEBUG("client no active");
-        return OPRT_COM_ERROR;
-    }
-    if (NULL == dps || 0 == dpscnt) {
-        return OPRT_INVALID_PARM;
-    }
-
     dp_schema_t *schema = dp_schema_find(devid);
     if (NULL == schema) {
         return OPRT_INVALID_PARM;
@@ -234,7 +223,7 @@ int tuya_iot_dp_obj_report(tuya_iot_client_t *client, const char *devid, dp_obj_
     if (NULL == dpvalid) {
         return OPRT_MALLOC_FAILED;
     }
-    memset(dpvalid, 0, sizeof(sizeof(dp_rept_valid_t) + sizeof(uint8_t) * dpscnt));
+    memset(dpvalid, 0, sizeof(dp_rept_valid_t) + sizeof(uint8_t) * dpscnt);
 
     PR_DEBUG("dp report: devid %s, dps 0x%08x, dpscnt %d, flags %d", devid ? devid : "null", dps, dpscnt, flags);
 
@@ -292,6 +281,7 @@ int tuya_iot_dp_obj_report(tuya_iot_client_t *client, const char *devid, dp_obj_
     ret = dp_rept_json_output(schema, &dpin, dpvalid, &dpout);
     if (OPRT_OK != ret) {
         PR_DEBUG("dp rept json output error %d", ret);
+        tal_free(dpvalid);
         return ret;
     }
 
@@ -303,11 +293,12 @@ int tuya_iot_dp_obj_report(tuya_iot_client_t *client, const char *devid, dp_obj_
         tal_free(out);
         tal_free(dpvalid);
         tuya_iot_dp_sync_start(client, 5);
-    } else if (tuya_iot_is_connected()) {
+    } else if (dp_mqtt_channel_ready()) {
         PR_DEBUG("mqtt channel report");
         ret = tuya_iot_dp_report_json_with_notify(client, dpout.dpsjson, NULL, dp_sync_cb, dpvalid, 5000);
     } else {
         PR_ERR("no channel for connect");
+        tal_free(dpvalid);
     }
 
     if (dpout.dpsjson) {
@@ -320,6 +311,101 @@ int tuya_iot_dp_obj_report(tuya_iot_client_t *client, const char *devid, dp_obj_
     return ret;
 }
 
+#if defined(ENABLE_DP_REPORT_SCHED) && (ENABLE_DP_REPORT_SCHED == 1)
+static int dp_sched_send_cb(const char *devid, dp_obj_t *dps, uint16_t dpscnt, int flags)
+{
+    tuya_iot_client_t *client = tuya_iot_client_get();
+
+    if (!client->is_activated) {
+        return OPRT_COM_ERROR;
+    }
+
+    return dp_obj_report_send(client, devid, dps, dpscnt, flags);
+}
+#endif
+
+/**
+ * @brief Initializes the DP report path of the Tuya IoT client.
+ *
+ * With ENABLE_DP_REPORT_SCHED this starts the report scheduler, see
+ * tuya_dp_sched.h, it is called once by tuya_iot_init.
+ *
+ * @return The result of the operation. Returns 0 on success, or a negative
+ * error code on failure.
+ */
+int tuya_iot_dp_init(void)
+{
+#if defined(ENABLE_DP_REPORT_SCHED) && (ENABLE_DP_REPORT_SCHED == 1)
+    return dp_sched_init(dp_sched_send_cb);
+#else
+    return OPRT_OK;
+#endif
+}
+
+/**
+ * @brief Reports device object data to the Tuya IoT cloud service, with
+ * notify.
+ *
+ * With ENABLE_DP_REPORT_SCHED the report is merged with the others made
+ * within the scheduler window and sent later, unless flags has
+ * DP_REPT_IMMEDIATE_FLAG, see tuya_dp_sched.h. cb then gets the result of the
+ * send that carried the report.
+ *
+ * @param client The Tuya IoT client instance.
+ * @param devid The device ID.
+ * @param dps An array of device object data.
+ * @param dpscnt The number of device object data elements in the array.
+ * @param flags Additional flags for the report.
+ * @param cb Called once with the send result if OPRT_OK is returned, never
+ * otherwise, may be NULL.
+ * @param user_data User data of cb.
+ *
+ * @return The result of the operation. Returns 0 on success, or a negative
+ * error code on failure.
+ */
+int tuya_iot_dp_obj_report_async(tuya_iot_client_t *client, const char *devid, dp_obj_t *dps, uint16_t dpscnt,
+                                 int flags, tuya_dp_notify_cb_t cb, void *user_data)
+{
+    if (!client->is_activated) {
+        PR_DEBUG("client no active");
+        return OPRT_COM_ERROR;
+    }
+    if (NULL == dps || 0 == dpscnt) {
+        return OPRT_INVALID_PARM;
+    }
+
+#if defined(ENABLE_DP_REPORT_SCHED) && (ENABLE_DP_REPORT_SCHED == 1)
+    return dp_sched_push(devid, dps, dpscnt, flags, cb, user_data);
+#else
+    int ret = dp_obj_report_send(client, devid, dps, dpscnt, flags);
+    if (OPRT_OK == ret && cb) {
+        cb(ret, user_data);
+    }
+    return ret;
+#endif
+}
+
+/**
+ * @brief Reports device object data to the Tuya IoT cloud service.
+ *
+ * This function is used to report the device object data to the Tuya IoT cloud
+ * service. With ENABLE_DP_REPORT_SCHED a merged report returns once queued,
+ * use tuya_iot_dp_obj_report_async for the result of its send.
+ *
+ * @param client The Tuya IoT client instance.
+ * @param devid The device ID.
+ * @param dps An array of device object data.
+ * @param dpscnt The number of device object data elements in the array.
+ * @param flags Additional flags for the report.
+ *
+ * @return The result of the operation. Returns 0 on success, or a negative
+ * error code on failure.
+ */
+int tuya_iot_dp_obj_report(tuya_iot_client_t *client, const char *devid, dp_obj_t *dps, uint16_t dpscnt, int flags)
+{
+    return tuya_iot_dp_obj_report_async(client, devid, dps, dpscnt, flags, NULL, NULL);
+}
+
 /**
  * @brief Dumps the object representation of the Tuya IoT data point (DP) for a
  * specific device.
@@ -455,7 +541,7 @@ int tuya_iot_dp_raw_report(tuya_iot_client_t *client, const char *devid, dp_raw_
         dp_rept_json_append(schema, dpout.dpsjson, NULL, NULL, 0, &out);
         ret = tuya_lan_dp_report(out);
         tal_free(out);
-    } else if (tuya_iot_is_connected()) {
+    } else if (dp_mqtt_channel_ready()) {
         ret = tuya_iot_dp_report_json_async(client, dpout.dpsjson, NULL, dp_raw_async_cb, NULL, timeout);
     } else {
         PR_ERR("no channel for connect");
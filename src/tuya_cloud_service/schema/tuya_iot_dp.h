@@ -23,6 +23,13 @@ extern "C" {
 
 #include "tuya_iot.h"
 
+/**
+ * @brief init the DP report path, called by tuya_iot_init
+ *
+ * @return int
+ */
+int tuya_iot_dp_init(void);
+
 /**
  * @brief
  *
@@ -55,6 +62,22 @@ int tuya_iot_dp_schema_create(char *devid, char *schema_json, dp_schema_t **dp_s
  */
 int tuya_iot_dp_obj_report(tuya_iot_client_t *client, const char *devid, dp_obj_t *dps, uint16_t dpscnt, int flags);
 
+/**
+ * @brief tuya_iot_dp_obj_report with the result of the send, for a report
+ * merged by the DP report scheduler it comes after the call returns
+ *
+ * @param client
+ * @param devid
+ * @param dps
+ * @param dpscnt
+ * @param flags
+ * @param cb called once with the send result if OPRT_OK is returned
+ * @param user_data
+ * @return int
+ */
+int tuya_iot_dp_obj_report_async(tuya_iot_client_t *client, const char *devid, dp_obj_t *dps, uint16_t dpscnt,
+                                 int flags, tuya_dp_notify_cb_t cb, void *user_data);
+
 /**
  * @brief
  *
@@ -38,6 +38,7 @@
 #include "mbedtls/ctr_drbg.h"
 #include "mbedtls/hkdf.h"
 #include "mbedtls/aes.h"
+#include "mbedtls/sha256.h"
 
 #define TLS_URL_LEN (128 + 16)
 
@@ -52,10 +53,42 @@ typedef struct {
     int overtime_s;
     MUTEX_HANDLE mutex;
     MUTEX_HANDLE read_mutex;
+    bool user_bio;     // the config send and recv are used after the handshake
+    uint8_t *coalesce; // records of a writev, sent to the socket together
+    size_t coalesce_len;
+    size_t coalesce_size;
 } tuya_mbedtls_context_t;
 
 #define TLS_HANDSHAKE_TIMEOUT (18) // s
 
+#ifndef TLS_WRITEV_COALESCE_MAX
+#define TLS_WRITEV_COALESCE_MAX (16 * 1024)
+#endif
+
+#ifndef TLS_SESSION_CACHE_NUM
+#define TLS_SESSION_CACHE_NUM 2
+#endif
+
+#if TLS_SESSION_CACHE_NUM > 0
+#define TLS_SESSION_CACERT_LEN 32
+
+// last session negotiated with a host, offered again on the next connection
+// that trusts the same CA, a resumed session skips the certificate check
+typedef struct {
+    bool valid;
+    char host[TLS_URL_LEN];
+    uint16_t port;
+    tuya_tls_mode_t mode;
+    uint8_t cacert[TLS_SESSION_CACERT_LEN]; // sha256 of the CA the server was verified with
+    uint32_t stamp; // for replacing the least recently used
+    mbedtls_ssl_session session;
+} tuya_tls_session_cache_t;
+
+static tuya_tls_session_cache_t s_session_cache[TLS_SESSION_CACHE_NUM];
+static uint32_t s_session_stamp = 0;
+static MUTEX_HANDLE s_session_mutex = NULL;
+#endif
+
 static tuya_tls_pre_conn_cb s_pre_conn_cb = NULL;
 static mbedtls_entropy_context ty_entropy;
 static mbedtls_ctr_drbg_context ty_ctr_drbg;
@@ -264,10 +297,8 @@ static void __tuya_tls_log(void *ctx, int level, const char *file, int line, con
     }
 }
 
-static int __tuya_tls_socket_send_cb(void *ctx, const unsigned char *buf, size_t len)
+static int __tuya_tls_socket_send(tuya_mbedtls_context_t *tls_context, const unsigned char *buf, size_t len)
 {
-    tuya_mbedtls_context_t *tls_context = (tuya_mbedtls_context_t *)ctx;
-
     int send_len = tal_net_send(tls_context->socket_fd, buf, len);
     if (send_len < 0) {
         PR_ERR("__tuya_tls_socket_send_cb errr %d %d", send_len, tal_net_get_errno());
@@ -283,6 +314,58 @@ static int __tuya_tls_socket_send_cb(void *ctx, const unsigned char *buf, size_t
     return send_len;
 }
 
+static int __tuya_tls_bio_send(tuya_mbedtls_context_t *tls_context, const unsigned char *buf, size_t len)
+{
+    if (tls_context->user_bio) {
+        return tls_context->config.f_send(tls_context->config.user_data, buf, len);
+    }
+    return __tuya_tls_socket_send(tls_context, buf, len);
+}
+
+static int __tuya_tls_coalesce_flush(tuya_mbedtls_context_t *tls_context)
+{
+    size_t sent = 0;
+
+    while (sent < tls_context->coalesce_len) {
+        int send_len =
+            __tuya_tls_bio_send(tls_context, tls_context->coalesce + sent, tls_context->coalesce_len - sent);
+        if (send_len <= 0) {
+            // only what is left goes out on a retry, the records sent are not repeated
+            memmove(tls_context->coalesce, tls_context->coalesce + sent, tls_context->coalesce_len - sent);
+            tls_context->coalesce_len -= sent;
+            return (send_len < 0) ? send_len : -1;
+        }
+        sent += send_len;
+    }
+    tls_context->coalesce_len = 0;
+
+    return 0;
+}
+
+static int __tuya_tls_bio_send_cb(void *ctx, const unsigned char *buf, size_t len)
+{
+    tuya_mbedtls_context_t *tls_context = (tuya_mbedtls_context_t *)ctx;
+
+    if (NULL == tls_context->coalesce) {
+        return __tuya_tls_bio_send(tls_context, buf, len);
+    }
+
+    // a record of a writev, held to go out with the next ones
+    if (tls_context->coalesce_len + len > tls_context->coalesce_size) {
+        int ret = __tuya_tls_coalesce_flush(tls_context);
+        if (ret < 0) {
+            return ret;
+        }
+        if (len > tls_context->coalesce_size) {
+            return __tuya_tls_bio_send(tls_context, buf, len);
+        }
+    }
+    memcpy(tls_context->coalesce + tls_context->coalesce_len, buf, len);
+    tls_context->coalesce_len += len;
+
+    return len;
+}
+
 static int __tuya_tls_socket_recv_cb(void *ctx, unsigned char *buf, size_t len)
 {
     tuya_mbedtls_context_t *tls_context = (tuya_mbedtls_context_t *)ctx;
@@ -309,6 +392,143 @@ static int __tuya_tls_socket_recv_cb(void *ctx, unsigned char *buf, size_t len)
     return rv;
 }
 
+static int __tuya_tls_bio_recv_cb(void *ctx, unsigned char *buf, size_t len)
+{
+    tuya_mbedtls_context_t *tls_context = (tuya_mbedtls_context_t *)ctx;
+
+    if (tls_context->user_bio) {
+        return tls_context->config.f_recv(tls_context->config.user_data, buf, len);
+    }
+    return __tuya_tls_socket_recv_cb(ctx, buf, len);
+}
+
+/* -------------------------------------------------------------------------- */
+/*                             TLS session cache                              */
+/* -------------------------------------------------------------------------- */
+#if TLS_SESSION_CACHE_NUM > 0
+static void __tuya_tls_session_cacert(const tuya_tls_config_t *config, uint8_t cacert[TLS_SESSION_CACERT_LEN])
+{
+    memset(cacert, 0, TLS_SESSION_CACERT_LEN);
+    if (config->ca_cert && config->ca_cert_size) {
+        mbedtls_sha256((const unsigned char *)config->ca_cert, config->ca_cert_size, cacert, 0);
+    }
+}
+
+static tuya_tls_session_cache_t *__tuya_tls_session_find(const char *hostname, uint16_t port, tuya_tls_mode_t mode,
+                                                         const uint8_t cacert[TLS_SESSION_CACERT_LEN])
+{
+    int i;
+
+    for (i = 0; i < TLS_SESSION_CACHE_NUM; i++) {
+        tuya_tls_session_cache_t *entry = &s_session_cache[i];
+        if (entry->valid && entry->port == port && entry->mode == mode && 0 == strcmp(entry->host, hostname) &&
+            0 == memcmp(entry->cacert, cacert, TLS_SESSION_CACERT_LEN)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief offer the cached session of the host to the server, which resumes
+ * it or falls back to a full handshake
+ */
+static void __tuya_tls_session_load(tuya_mbedtls_context_t *tls_context, const char *hostname, uint16_t port)
+{
+    uint8_t cacert[TLS_SESSION_CACERT_LEN];
+
+    if (NULL == s_session_mutex || NULL == hostname) {
+        return;
+    }
+
+    __tuya_tls_session_cacert(&tls_context->config, cacert);
+    tal_mutex_lock(s_session_mutex);
+    tuya_tls_session_cache_t *entry = __tuya_tls_session_find(hostname, port, tls_context->config.mode, cacert);
+    if (entry) {
+        int ret = mbedtls_ssl_set_session(&tls_context->ssl_ctx, &entry->session);
+        if (ret != 0) {
+            PR_DEBUG("mbedtls_ssl_set_session fail. 0x%x", -ret);
+        } else {
+            entry->stamp = ++s_session_stamp;
+        }
+    }
+    tal_mutex_unlock(s_session_mutex);
+}
+
+/**
+ * @brief keep the session of a finished handshake for the next connection
+ */
+static void __tuya_tls_session_save(tuya_mbedtls_context_t *tls_context, const char *hostname, uint16_t port)
+{
+    uint8_t cacert[TLS_SESSION_CACERT_LEN];
+    int i;
+
+    if (NULL == s_session_mutex || NULL == hostname || strlen(hostname) >= TLS_URL_LEN) {
+        return;
+    }
+
+    __tuya_tls_session_cacert(&tls_context->config, cacert);
+    tal_mutex_lock(s_session_mutex);
+    tuya_tls_session_cache_t *entry = __tuya_tls_session_find(hostname, port, tls_context->config.mode, cacert);
+    if (NULL == entry) {
+        entry = &s_session_cache[0];
+        for (i = 1; i < TLS_SESSION_CACHE_NUM; i++) {
+            if (!entry->valid) {
+                break;
+            }
+            if (!s_session_cache[i].valid || s_session_cache[i].stamp < entry->stamp) {
+                entry = &s_session_cache[i];
+            }
+        }
+    }
+
+    if (entry->valid) {
+        mbedtls_ssl_session_free(&entry->session);
+        entry->valid = false;
+    }
+    mbedtls_ssl_session_init(&entry->session);
+    int ret = mbedtls_ssl_get_session(&tls_context->ssl_ctx, &entry->session);
+    if (ret != 0) {
+        PR_DEBUG("mbedtls_ssl_get_session fail. 0x%x", -ret);
+        mbedtls_ssl_session_free(&entry->session);
+    } else {
+        strcpy(entry->host, hostname);
+        entry->port = port;
+        entry->mode = tls_context->config.mode;
+        memcpy(entry->cacert, cacert, TLS_SESSION_CACERT_LEN);
+        entry->stamp = ++s_session_stamp;
+        entry->valid = true;
+    }
+    tal_mutex_unlock(s_session_mutex);
+}
+
+/**
+ * @brief forget the session of the host after a failed connection
+ */
+static void __tuya_tls_session_drop(tuya_mbedtls_context_t *tls_context, const char *hostname, uint16_t port)
+{
+    uint8_t cacert[TLS_SESSION_CACERT_LEN];
+
+    if (NULL == s_session_mutex || NULL == hostname) {
+        return;
+    }
+
+    __tuya_tls_session_cacert(&tls_context->config, cacert);
+    tal_mutex_lock(s_session_mutex);
+    tuya_tls_session_cache_t *entry = __tuya_tls_session_find(hostname, port, tls_context->config.mode, cacert);
+    if (entry) {
+        mbedtls_ssl_session_free(&entry->session);
+        entry->valid = false;
+    }
+    tal_mutex_unlock(s_session_mutex);
+}
+#else
+#define __tuya_tls_session_load(tls_context, hostname, port)
+#define __tuya_tls_session_save(tls_context, hostname, port)
+#define __tuya_tls_session_drop(tls_context, hostname, port)
+#endif
+
 static int tuya_tls_ciphersuite_list_PSK[] = {MBEDTLS_TLS_ECDHE_PSK_WITH_AES_128_CBC_SHA256, 0};
 
 static void mbedtls_cert_pkey_free(tuya_tls_hander p_tls_handler)
@@ -425,6 +645,13 @@ OPERATE_RET tuya_tls_init(void)
     }
     mbedtls_ctr_drbg_set_prediction_resistance(&ty_ctr_drbg, MBEDTLS_CTR_DRBG_PR_OFF);
 
+#if TLS_SESSION_CACHE_NUM > 0
+    if (NULL == s_session_mutex && OPRT_OK != tal_mutex_create_init(&s_session_mutex)) {
+        PR_ERR("session cache mutex create fail, sessions are not resumed");
+        s_session_mutex = NULL;
+    }
+#endif
+
     PR_NOTICE("tuya_tls_init ok!");
 
     return OPRT_OK;
@@ -636,9 +863,12 @@ OPERATE_RET tuya_tls_connect(tuya_tls_hander p_tls_handler, char *hostname, int
     tls_context->socket_fd = socket_fd;
     tls_context->overtime_s = overtime_s;
     tal_net_set_timeout(tls_context->socket_fd, overtime_s * 1000, TRANS_SEND);
-    mbedtls_ssl_set_bio(p_ssl_ctx, tls_context, __tuya_tls_socket_send_cb, __tuya_tls_socket_recv_cb, NULL);
+    tls_context->user_bio = false;
+    mbedtls_ssl_set_bio(p_ssl_ctx, tls_context, __tuya_tls_bio_send_cb, __tuya_tls_bio_recv_cb, NULL);
     PR_DEBUG("socket fd is set. set to inner send/recv to handshake");
 
+    __tuya_tls_session_load(tls_context, hostname, port_num);
+
     TIME_T cur_time = tal_time_get_posix();
 
     while ((op_ret = mbedtls_ssl_handshake(p_ssl_ctx)) != 0) {
@@ -678,10 +908,12 @@ OPERATE_RET tuya_tls_connect(tuya_tls_hander p_tls_handler, char *hostname, int
         goto tuya_tls_connect_EXIT;
     }
 
+    __tuya_tls_session_save(tls_context, hostname, port_num);
+
     PR_DEBUG("handshake finish for %s. set send/recv to user set", (hostname ? hostname : ""));
+    // through the context still, so that a writev can coalesce the records
     if (tls_context->config.f_send && tls_context->config.f_recv) {
-        mbedtls_ssl_set_bio(p_ssl_ctx, tls_context->config.user_data, tls_context->config.f_send,
-                            tls_context->config.f_recv, NULL);
+        tls_context->user_bio = true;
     }
 
     PR_DEBUG("TUYA_TLS Success Connect %s:%d Suit:%s", (hostname ? hostname : ""), port_num,
@@ -691,11 +923,36 @@ OPERATE_RET tuya_tls_connect(tuya_tls_hander p_tls_handler, char *hostname, int
 
 tuya_tls_connect_EXIT:
 
+    __tuya_tls_session_drop(tls_context, hostname, port_num);
     PR_ERR("TUYA_TLS faild Connect %s:%d", (hostname ? hostname : ""), port_num);
 
     return op_ret;
 }
 
+// write all of buf, with tls_context->mutex held
+static int __tuya_tls_write_all(tuya_mbedtls_context_t *tls_context, const uint8_t *buf, size_t len)
+{
+    int ret = -1;
+    size_t written_len = 0;
+
+    while (written_len < len) {
+        ret = mbedtls_ssl_write(&(tls_context->ssl_ctx), (buf + written_len), (len - written_len));
+        if (ret > 0) {
+            written_len += ret;
+            continue;
+        }
+
+        if ((ret == MBEDTLS_ERR_SSL_WANT_READ) || (ret == MBEDTLS_ERR_SSL_WANT_WRITE)) {
+            continue;
+        }
+
+        // PR_ERR("mbedtls_ssl_write returned %d errno %d", ret,
+        // tal_net_get_errno());
+        return ret;
+    }
+    return written_len;
+}
+
 /**
  * @brief Writes data to the TLS connection.
  *
@@ -717,7 +974,6 @@ int tuya_tls_write(tuya_tls_hander tls_handler, uint8_t *buf, uint32_t len)
 
     tuya_mbedtls_context_t *tls_context = (tuya_mbedtls_context_t *)tls_handler;
     int ret = -1;
-    size_t written_len = 0;
 
     OPERATE_RET mu_ret = OPRT_OK;
     mu_ret = tal_mutex_lock(tls_context->mutex);
@@ -726,33 +982,129 @@ int tuya_tls_write(tuya_tls_hander tls_handler, uint8_t *buf, uint32_t len)
         return mu_ret;
     }
 
-    while (written_len < len) {
-        ret = mbedtls_ssl_write(&(tls_context->ssl_ctx), (buf + written_len), (len - written_len));
-        if (ret > 0) {
-            written_len += ret;
-            continue;
-        }
+    ret = __tuya_tls_write_all(tls_context, buf, len);
 
-        if ((ret == MBEDTLS_ERR_SSL_WANT_READ) || (ret == MBEDTLS_ERR_SSL_WANT_WRITE)) {
-            continue;
+    mu_ret = tal_mutex_unlock(tls_context->mutex);
+    if (OPRT_OK != mu_ret) {
+        PR_ERR("tal_mutex_lock err %d", mu_ret);
+        return mu_ret;
+    }
+    return ret;
+}
+
+/**
+ * @brief Writes several buffers to the TLS connection.
+ *
+ * A buffer followed by others is copied with the start of the next ones into
+ * a record as long as the record payload allows, so a header and its payload
+ * go in one record instead of one each. Whole records and the last buffer are
+ * written from the buffers in place.
+ *
+ * @param tls_handler The TLS handler.
+ * @param iov The buffers to write.
+ * @param iovcnt The number of buffers.
+ * @return The number of bytes written on success, or a negative error code on
+ * failure.
+ */
+int tuya_tls_writev(tuya_tls_hander tls_handler, const tuya_transporter_iovec_t *iov, int iovcnt)
+{
+    if ((tls_handler == NULL) || (iov == NULL) || (iovcnt <= 0)) {
+        PR_ERR("Input Invalid");
+        return OPRT_INVALID_PARM;
+    }
+
+    tuya_mbedtls_context_t *tls_context = (tuya_mbedtls_context_t *)tls_handler;
+    int i, ret = OPRT_OK;
+    size_t total = 0;
+    for (i = 0; i < iovcnt; i++) {
+        total += iov[i].len;
+    }
+    if (total == 0) {
+        return OPRT_INVALID_PARM;
+    }
+
+    int record_len = mbedtls_ssl_get_max_out_record_payload(&tls_context->ssl_ctx);
+    size_t stage_len = (record_len > 0) ? (size_t)record_len : MBEDTLS_SSL_OUT_CONTENT_LEN;
+    if (stage_len > total) {
+        stage_len = total;
+    }
+    uint8_t *stage = NULL;
+    if (iovcnt > 1) {
+        stage = tal_malloc(stage_len);
+        if (NULL == stage) {
+            return OPRT_MALLOC_FAILED;
         }
+    }
 
-        // PR_ERR("mbedtls_ssl_write returned %d errno %d", ret,
-        // tal_net_get_errno());
-        mu_ret = tal_mutex_unlock(tls_context->mutex);
-        if (OPRT_OK != mu_ret) {
-            PR_ERR("tal_mutex_lock err %d", mu_ret);
-            return mu_ret;
+    // room for all the records, a write larger than TLS_WRITEV_COALESCE_MAX
+    // goes out in several sends
+    int expansion = mbedtls_ssl_get_record_expansion(&tls_context->ssl_ctx);
+    size_t records = (total + stage_len - 1) / stage_len;
+    size_t coalesce_size = total + records * ((expansion > 0) ? expansion : 0);
+    if (coalesce_size > TLS_WRITEV_COALESCE_MAX) {
+        coalesce_size = TLS_WRITEV_COALESCE_MAX;
+    }
+    uint8_t *coalesce = NULL;
+    if (records > 1 || iovcnt > 1) {
+        coalesce = tal_malloc(coalesce_size);
+    }
+
+    OPERATE_RET mu_ret = tal_mutex_lock(tls_context->mutex);
+    if (OPRT_OK != mu_ret) {
+        PR_ERR("tuya_hal_mutex_lock err %d", mu_ret);
+        tal_free(stage);
+        tal_free(coalesce);
+        return mu_ret;
+    }
+    // without the buffer the records are sent one by one
+    tls_context->coalesce = coalesce;
+    tls_context->coalesce_len = 0;
+    tls_context->coalesce_size = coalesce_size;
+
+    size_t staged = 0;
+    for (i = 0; i < iovcnt && ret >= 0; i++) {
+        const uint8_t *p = iov[i].buf;
+        size_t n = iov[i].len;
+        while (n > 0 && ret >= 0) {
+            if (staged == 0 && (i == iovcnt - 1 || n >= stage_len)) {
+                // the last buffer or whole records, from the buffer in place
+                size_t direct = (i == iovcnt - 1) ? n : n - n % stage_len;
+                ret = __tuya_tls_write_all(tls_context, p, direct);
+                p += direct;
+                n -= direct;
+                continue;
+            }
+            size_t copy = (n < stage_len - staged) ? n : stage_len - staged;
+            memcpy(stage + staged, p, copy);
+            staged += copy;
+            p += copy;
+            n -= copy;
+            if (staged == stage_len) {
+                ret = __tuya_tls_write_all(tls_context, stage, staged);
+                staged = 0;
+            }
         }
-        return ret;
     }
+    if (staged > 0 && ret >= 0) {
+        ret = __tuya_tls_write_all(tls_context, stage, staged);
+    }
+    if (coalesce && ret >= 0) {
+        // mbedtls took the records held as sent, they are retried here as
+        // __tuya_tls_write_all retries a record
+        do {
+            ret = __tuya_tls_coalesce_flush(tls_context);
+        } while ((ret == MBEDTLS_ERR_SSL_WANT_READ) || (ret == MBEDTLS_ERR_SSL_WANT_WRITE));
+    }
+    tls_context->coalesce = NULL;
 
     mu_ret = tal_mutex_unlock(tls_context->mutex);
+    tal_free(stage);
+    tal_free(coalesce);
     if (OPRT_OK != mu_ret) {
         PR_ERR("tal_mutex_lock err %d", mu_ret);
         return mu_ret;
     }
-    return written_len;
+    return (ret < 0) ? ret : (int)total;
 }
 
 /**
@@ -783,6 +1135,36 @@ int tuya_tls_read(tuya_tls_hander tls_handler, uint8_t *buf, uint32_t len)
     return value;
 }
 
+/**
+ * @brief Sends the close_notify alert of an established connection.
+ *
+ * Servers may refuse to resume the session of a connection that was closed
+ * without it.
+ *
+ * @param[in] tls_handler refer to tuya_tls_hander
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tuya_tls_close_notify(tuya_tls_hander tls_handler)
+{
+    if (tls_handler == NULL) {
+        PR_ERR("Input Invalid");
+        return OPRT_INVALID_PARM;
+    }
+
+    tuya_mbedtls_context_t *tls_context = (tuya_mbedtls_context_t *)tls_handler;
+    tal_mutex_lock(tls_context->mutex);
+    int ret = mbedtls_ssl_close_notify(&(tls_context->ssl_ctx));
+    tal_mutex_unlock(tls_context->mutex);
+    if (ret != 0) {
+        PR_DEBUG("mbedtls_ssl_close_notify fail. 0x%x", -ret);
+        return OPRT_COM_ERROR;
+    }
+
+    return OPRT_OK;
+}
+
 /**
  * @brief generated random
  *
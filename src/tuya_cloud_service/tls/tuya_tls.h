@@ -21,6 +21,7 @@
 
 // mbedtls only used to encryption the seesion,not used to create the seesion
 #include "tuya_cloud_types.h"
+#include "tuya_transporter.h"
 // #include "ssl.h"
 // #include "tuya_cert_manager.h"
 
@@ -186,6 +187,20 @@ OPERATE_RET tuya_tls_connect(tuya_tls_hander p_tls_handler, char *hostname, int
  */
 int tuya_tls_write(tuya_tls_hander tls_handler, uint8_t *buf, uint32_t len);
 
+/**
+ * @brief tls write of several buffers, buffers shorter than a record are
+ * coalesced with the next ones into full records and the records are handed
+ * to the socket together, up to TLS_WRITEV_COALESCE_MAX bytes per send
+ *
+ * @param[in] tls_handler refer to tuya_tls_hander
+ * @param[in] iov buffers to write
+ * @param[in] iovcnt count of buffers
+ *
+ * @return the length written on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+int tuya_tls_writev(tuya_tls_hander tls_handler, const tuya_transporter_iovec_t *iov, int iovcnt);
+
 /**
  * @brief tls read
  *
@@ -198,6 +213,16 @@ int tuya_tls_write(tuya_tls_hander tls_handler, uint8_t *buf, uint32_t len);
  */
 int tuya_tls_read(tuya_tls_hander tls_handler, uint8_t *buf, uint32_t len);
 
+/**
+ * @brief tls close notify, sent before the socket is closed
+ *
+ * @param[in] tls_handler refer to tuya_tls_hander
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tuya_tls_close_notify(tuya_tls_hander tls_handler);
+
 /**
  * @brief generated random
  *
@@ -12,14 +12,27 @@
  *
  */
 
+#include "tuya_iot_config.h"
 #include "tuya_cloud_types.h"
 #include "netmgr.h"
 #include "tal_api.h"
 #include "tal_network.h"
+#include "tal_network_register.h"
 #include "tuya_transporter.h"
 #include "tcp_transporter.h"
 #include "tal_network.h"
 
+#if OPERATING_SYSTEM == SYSTEM_LINUX
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#define TCP_TRANSPORTER_SENDMSG 1
+// buffers handed to one sendmsg
+#define TCP_TRANSPORTER_IOV_MAX 8
+#else
+#define TCP_TRANSPORTER_SENDMSG 0
+#endif
+
 typedef struct tcp_transporter_inter_t {
     struct tuya_transporter_inter_t base;
     tuya_tcp_config_t config;
@@ -338,6 +351,72 @@ OPERATE_RET tuya_tcp_transporter_write(tuya_transporter_t t, uint8_t *buf, int l
     return ret;
 }
 
+#if TCP_TRANSPORTER_SENDMSG
+/**
+ * @brief Writes several buffers to the TCP transporter with sendmsg.
+ *
+ * The buffers leave in the same segments, as one write would send them.
+ * Sockets of an AT modem are not kernel sockets, their buffers are gathered
+ * by tuya_transporter_writev.
+ *
+ * @param t The TCP transporter.
+ * @param iov The buffers to write.
+ * @param iovcnt The number of buffers.
+ * @param timeout_ms The timeout value in milliseconds.
+ * @return The number of bytes written, OPRT_NOT_SUPPORTED or a negative
+ * error code.
+ */
+static OPERATE_RET tuya_tcp_transporter_writev(tuya_transporter_t t, const tuya_transporter_iovec_t *iov, int iovcnt,
+                                               int timeout_ms)
+{
+    tuya_tcp_transporter_t tcp_transporter = (tuya_tcp_transporter_t)t;
+    if (tcp_transporter->socket_fd < 0) {
+        PR_ERR("socket fd:%d", tcp_transporter->socket_fd);
+        return OPRT_INVALID_PARM;
+    }
+
+    if (TAL_NET_TYPE_AT_MODEM == tal_network_card_get_active_type()) {
+        return OPRT_NOT_SUPPORTED;
+    }
+
+    if (timeout_ms > 0 && tuya_tcp_transporter_poll_write(t, timeout_ms) <= 0) {
+        return OPRT_RESOURCE_NOT_READY;
+    }
+
+    struct iovec vec[TCP_TRANSPORTER_IOV_MAX];
+    int idx = 0, skip = 0, total = 0, retry = 1;
+    while (idx < iovcnt) {
+        // the next buffers, the first one without what was already sent
+        int cnt = 0;
+        while (cnt < TCP_TRANSPORTER_IOV_MAX && idx + cnt < iovcnt) {
+            vec[cnt].iov_base = (void *)(iov[idx + cnt].buf + (cnt ? 0 : skip));
+            vec[cnt].iov_len = iov[idx + cnt].len - (cnt ? 0 : skip);
+            cnt++;
+        }
+        struct msghdr msg = {.msg_iov = vec, .msg_iovlen = cnt};
+        ssize_t sent = sendmsg(tcp_transporter->socket_fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (retry-- > 0 && (errno == EINTR || errno == EAGAIN)) {
+                tal_system_sleep(30);
+                continue;
+            }
+            PR_ERR("sendmsg fd:%d errno:%d", tcp_transporter->socket_fd, errno);
+            return OPRT_SEND_ERR;
+        }
+        total += sent;
+        retry = 1; // the retry is per stall, a long write may stall more than once
+        sent += skip;
+        while (idx < iovcnt && sent >= iov[idx].len) {
+            sent -= iov[idx].len;
+            idx++;
+        }
+        skip = sent;
+    }
+
+    return total;
+}
+#endif
+
 /**
  * @brief Destroys a TCP transporter.
  *
@@ -379,6 +458,9 @@ tuya_transporter_t tuya_tcp_transporter_create(void)
     tuya_transporter_set_func((tuya_transporter_t)&t->base, tuya_tcp_transporter_connect, tuya_tcp_transporter_close,
                               tuya_tcp_transporter_read, tuya_tcp_transporter_write, tuya_tcp_transporter_poll_read,
                               tuya_tcp_transporter_poll_write, tuya_tcp_transporter_destroy, tuya_tcp_transporter_ctrl);
+#if TCP_TRANSPORTER_SENDMSG
+    tuya_transporter_set_writev((tuya_transporter_t)&t->base, tuya_tcp_transporter_writev);
+#endif
 
     return &t->base;
 }
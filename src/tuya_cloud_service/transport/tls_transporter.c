@@ -121,6 +121,9 @@ OPERATE_RET tuya_tls_transporter_close(tuya_transporter_t t)
 
     PR_DEBUG("tls transporter close socket fd:%d", tls_transporter->socket_fd);
     if (tls_transporter->socket_fd >= 0) {
+        if (tls_transporter->tls_handler) {
+            tuya_tls_close_notify(tls_transporter->tls_handler);
+        }
         tuya_transporter_close(tls_transporter->tcp_transporter);
         tls_transporter->socket_fd = -1;
     } else {
@@ -182,6 +185,28 @@ OPERATE_RET tuya_tls_transporter_write(tuya_transporter_t t, uint8_t *buf, int l
     return tuya_tls_write(tls_transporter->tls_handler, buf, len);
 }
 
+/**
+ * @brief Writes several buffers to the TLS transporter.
+ *
+ * The buffers are coalesced into records by tuya_tls_writev, a short header
+ * shares its record with the payload after it.
+ *
+ * @param t The TLS transporter object.
+ * @param iov The buffers to write.
+ * @param iovcnt The number of buffers.
+ * @param timeout_ms The timeout value in milliseconds for the write operation.
+ *
+ * @return The number of bytes written or a negative error code.
+ */
+static OPERATE_RET tuya_tls_transporter_writev(tuya_transporter_t t, const tuya_transporter_iovec_t *iov, int iovcnt,
+                                               int timeout_ms)
+{
+    tuya_tls_transporter_t tls_transporter = (tuya_tls_transporter_t)t;
+
+    tls_transporter->write_timeout = timeout_ms;
+    return tuya_tls_writev(tls_transporter->tls_handler, iov, iovcnt);
+}
+
 /**
  * @brief Reads data from the TLS transporter.
  *
@@ -270,6 +295,7 @@ tuya_transporter_t tuya_tls_transporter_create(void)
     tuya_transporter_set_func((tuya_transporter_t)&t->base, tuya_tls_transporter_connect, tuya_tls_transporter_close,
                               tuya_tls_transporter_read, tuya_tls_transporter_write, tuya_tls_transporter_poll_read,
                               NULL, tuya_tls_transporter_destroy, tuya_tls_transporter_ctrl);
+    tuya_transporter_set_writev((tuya_transporter_t)&t->base, tuya_tls_transporter_writev);
     t->tcp_transporter = tuya_tcp_transporter_create();
     t->tls_handler = tuya_tls_connect_create();
     if (t->tls_handler == NULL) {
@@ -215,6 +215,54 @@ OPERATE_RET tuya_transporter_write(tuya_transporter_t t, uint8_t *buf, int len,
     return OPRT_INVALID_PARM;
 }
 
+/**
+ * @brief Writes several buffers to the Tuya transporter as if they were one.
+ *
+ * The transporter's own scatter-gather write is used when it has one, else
+ * the buffers are copied into one and written with f_write.
+ *
+ * @param t The Tuya transporter to write data to.
+ * @param iov The buffers to write, in order.
+ * @param iovcnt The number of buffers.
+ * @param timeout_ms The timeout value in milliseconds for the write operation.
+ *
+ * @return The number of bytes written or a negative error code.
+ */
+OPERATE_RET tuya_transporter_writev(tuya_transporter_t t, const tuya_transporter_iovec_t *iov, int iovcnt,
+                                    int timeout_ms)
+{
+    if (NULL == t || NULL == t->f_write || NULL == iov || iovcnt <= 0) {
+        return OPRT_INVALID_PARM;
+    }
+
+    if (t->f_writev) {
+        OPERATE_RET rt = t->f_writev(t, iov, iovcnt, timeout_ms);
+        if (OPRT_NOT_SUPPORTED != rt) {
+            return rt;
+        }
+    }
+
+    if (1 == iovcnt) {
+        return t->f_write(t, (uint8_t *)iov[0].buf, iov[0].len, timeout_ms);
+    }
+
+    int i, len = 0, offset = 0;
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].len;
+    }
+    uint8_t *buf = tal_malloc(len);
+    if (NULL == buf) {
+        return OPRT_MALLOC_FAILED;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(buf + offset, iov[i].buf, iov[i].len);
+        offset += iov[i].len;
+    }
+    OPERATE_RET rt = t->f_write(t, buf, len, timeout_ms);
+    tal_free(buf);
+    return rt;
+}
+
 /**
  * @brief Reads data from the transport layer using polling.
  *
@@ -357,3 +405,9 @@ tuya_transporter_set_func(tuya_transporter_t t, transporter_connect_fn connect,
 
     return OPRT_OK;
 }
+
+OPERATE_RET tuya_transporter_set_writev(tuya_transporter_t t, transporter_writev_fn writev)
+{
+    t->f_writev = writev;
+    return OPRT_OK;
+}
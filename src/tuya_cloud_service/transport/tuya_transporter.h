@@ -65,6 +65,14 @@ struct tuya_transporter_inter_t;
 
 typedef struct tuya_transporter_inter_t *tuya_transporter_t;
 
+/**
+ * @brief one buffer of a scatter-gather write
+ */
+typedef struct {
+    const uint8_t *buf;
+    int len;
+} tuya_transporter_iovec_t;
+
 typedef OPERATE_RET (*transporter_destroy_fn)(tuya_transporter_t t);
 
 typedef OPERATE_RET (*transporter_connect_fn)(tuya_transporter_t transporter, const char *host, int port,
@@ -74,6 +82,9 @@ typedef OPERATE_RET (*transporter_read_fn)(tuya_transporter_t transporter, uint8
 
 typedef OPERATE_RET (*transporter_write_fn)(tuya_transporter_t transporter, uint8_t *buf, int len, int timeout_ms);
 
+typedef OPERATE_RET (*transporter_writev_fn)(tuya_transporter_t transporter, const tuya_transporter_iovec_t *iov,
+                                             int iovcnt, int timeout_ms);
+
 typedef OPERATE_RET (*transporter_poll_read_fn)(tuya_transporter_t transporter, int timeout_ms);
 
 typedef OPERATE_RET (*transporter_poll_write_fn)(tuya_transporter_t transporter, int timeout_ms);
@@ -92,6 +103,7 @@ struct tuya_transporter_inter_t {
     transporter_close_fn f_close;
     transporter_destroy_fn f_destroy;
     transporter_ctrl f_ctrl;
+    transporter_writev_fn f_writev; // NULL if the buffers are gathered and written with f_write
 };
 
 /**
@@ -233,6 +245,25 @@ OPERATE_RET tuya_transporter_read(tuya_transporter_t transporter, uint8_t *buf,
  */
 OPERATE_RET tuya_transporter_write(tuya_transporter_t transporter, uint8_t *buf, int len, int timeout_ms);
 
+/**
+ * @brief Writes several buffers to the specified transporter as if they were
+ * one.
+ *
+ * The buffers are written without being copied together when the transporter
+ * supports it, a header and a payload kept apart then leave in the same
+ * segments or TLS records. Other transporters have the buffers gathered and
+ * written with tuya_transporter_write.
+ *
+ * @param transporter The transporter to write data to.
+ * @param iov The buffers to write, in order.
+ * @param iovcnt The number of buffers.
+ * @param timeout_ms The timeout value in milliseconds for the write operation.
+ * @return The number of bytes written, the sum of the buffer lengths on
+ * success, or a negative error code on failure.
+ */
+OPERATE_RET tuya_transporter_writev(tuya_transporter_t transporter, const tuya_transporter_iovec_t *iov, int iovcnt,
+                                    int timeout_ms);
+
 /**
  * @brief Reads data from the transporter using polling mechanism.
  *
@@ -313,6 +344,16 @@ OPERATE_RET tuya_transporter_set_func(tuya_transporter_t transporter, transporte
                                       transporter_poll_read_fn poll_read, transporter_poll_read_fn poll_write,
                                       transporter_destroy_fn destroy, transporter_ctrl ctrl);
 
+/**
+ * @brief Sets the scatter-gather write of the Tuya transporter.
+ *
+ * @param transporter The Tuya transporter.
+ * @param writev The function writing several buffers, it may return
+ * OPRT_NOT_SUPPORTED to have them gathered and written with the write function.
+ * @return OPRT_OK
+ */
+OPERATE_RET tuya_transporter_set_writev(tuya_transporter_t transporter, transporter_writev_fn writev);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
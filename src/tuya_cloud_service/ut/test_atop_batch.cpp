@@ -0,0 +1,497 @@
+/**
+ * @file test_atop_batch.cpp
+ * @brief unit test and benchmark of the batched ATOP request, against a
+ * plain HTTP stand-in of the cloud on loopback
+ */
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "mbedtls/base64.h"
+#include "mbedtls/gcm.h"
+
+#include "tuya_cloud_types.h"
+#include "tuya_config_defaults.h"
+#include "tal_api.h"
+#include "tal_kv.h"
+#include "tuya_endpoint.h"
+#include "tuya_iot.h"
+#include "atop_base.h"
+#include "atop_service.h"
+
+#if defined(ENABLE_ATOP_BATCH) && (ENABLE_ATOP_BATCH == 1)
+
+namespace {
+
+const char *s_key = "0123456789abcdef";
+
+// AES-128-GCM with the device key, nonce | ciphertext | tag as the SDK sends it
+bool decrypt(const std::vector<uint8_t> &in, std::string *out)
+{
+    mbedtls_gcm_context gcm;
+
+    if (in.size() < 12 + 16) {
+        return false;
+    }
+    out->resize(in.size() - 12 - 16);
+    mbedtls_gcm_init(&gcm);
+    mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, (const unsigned char *)s_key, 128);
+    int rt = mbedtls_gcm_auth_decrypt(&gcm, out->size(), in.data(), 12, NULL, 0, in.data() + in.size() - 16, 16,
+                                      in.data() + 12, (unsigned char *)&(*out)[0]);
+    mbedtls_gcm_free(&gcm);
+    return 0 == rt;
+}
+
+// base64 of nonce | ciphertext | tag, as the cloud puts it in result
+std::string encrypt(const std::string &plain)
+{
+    std::vector<uint8_t> sealed(12 + plain.size() + 16);
+    mbedtls_gcm_context gcm;
+
+    for (int i = 0; i < 12; i++) {
+        sealed[i] = (uint8_t)rand();
+    }
+    mbedtls_gcm_init(&gcm);
+    mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, (const unsigned char *)s_key, 128);
+    mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, plain.size(), sealed.data(), 12, NULL, 0,
+                              (const unsigned char *)plain.data(), sealed.data() + 12, 16,
+                              sealed.data() + 12 + plain.size());
+    mbedtls_gcm_free(&gcm);
+
+    std::string out(sealed.size() * 4 / 3 + 4, '\0');
+    size_t olen = 0;
+    mbedtls_base64_encode((unsigned char *)&out[0], out.size(), &olen, sealed.data(), sealed.size());
+    out.resize(olen);
+    return out;
+}
+
+std::string print(cJSON *json)
+{
+    char *text = cJSON_PrintUnformatted(json);
+    std::string out = text;
+    cJSON_free(text);
+    cJSON_Delete(json);
+    return out;
+}
+
+// answers each call with {"a":api,"data":params}, the batch api with the
+// list of them, refusing it or every call as asked
+class CloudStandIn {
+  public:
+    CloudStandIn()
+    {
+        struct sockaddr_in addr = {};
+        socklen_t len = sizeof(addr);
+        int on = 1;
+
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listen_fd_, (struct sockaddr *)&addr, sizeof(addr));
+        listen(listen_fd_, 8);
+        getsockname(listen_fd_, (struct sockaddr *)&addr, &len);
+        port_ = ntohs(addr.sin_port);
+        thread_ = std::thread([this] { run(); });
+
+        // point the SDK at it, over plain TCP
+        tuya_endpoint_t *endpoint = (tuya_endpoint_t *)tuya_endpoint_get();
+        snprintf(endpoint->atop.host, sizeof(endpoint->atop.host), "127.0.0.1");
+        endpoint->atop.port = port_;
+        endpoint->cert = NULL;
+        endpoint->cert_len = 0;
+    }
+
+    ~CloudStandIn()
+    {
+        stop_ = true;
+        shutdown(listen_fd_, SHUT_RDWR);
+        close(listen_fd_);
+        thread_.join();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    // requests answered so far, and of them those to the batch api
+    int requests() const
+    {
+        return requests_;
+    }
+
+    int batches() const
+    {
+        return batches_;
+    }
+
+    std::atomic<bool> batch_known{true};  // the batch api is answered
+    std::atomic<bool> device_known{true}; // any call is answered
+    std::atomic<int> latency_ms{0};       // added to each answer, as the network would
+
+  private:
+    void run()
+    {
+        while (!stop_) {
+            int fd = accept(listen_fd_, NULL, NULL);
+            if (fd < 0) {
+                break;
+            }
+            workers_.emplace_back([this, fd] { serve(fd); });
+        }
+    }
+
+    void serve(int fd)
+    {
+        struct timeval tv = {0, 20 * 1000};
+        std::string in;
+        char buf[4096];
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        while (!stop_) {
+            size_t end = in.find("\r\n\r\n");
+            if (std::string::npos != end) {
+                size_t body = 0, pos = in.find("Content-Length: ");
+                if (std::string::npos != pos && pos < end) {
+                    body = strtoul(in.c_str() + pos + 16, NULL, 10);
+                }
+                if (in.size() >= end + 4 + body) {
+                    std::string answer = handle(in.substr(0, end), in.substr(end + 4, body));
+                    in.erase(0, end + 4 + body);
+                    if (latency_ms) {
+                        tal_system_sleep(latency_ms);
+                    }
+                    std::string rsp = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " +
+                                      std::to_string(answer.size()) + "\r\n\r\n" + answer;
+                    if (write(fd, rsp.data(), rsp.size()) != (ssize_t)rsp.size()) {
+                        break;
+                    }
+                    continue;
+                }
+            }
+
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n > 0) {
+                in.append(buf, n);
+            } else if (0 == n || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                break;
+            }
+        }
+        close(fd);
+    }
+
+    std::string handle(const std::string &head, const std::string &body)
+    {
+        size_t pos = head.find("?a=");
+        std::string api = head.substr(pos + 3, head.find('&', pos) - pos - 3);
+        std::vector<uint8_t> sealed;
+        std::string params;
+
+        requests_++;
+        for (size_t i = 5; i + 1 < body.size(); i += 2) {
+            sealed.push_back((uint8_t)strtoul(body.substr(i, 2).c_str(), NULL, 16));
+        }
+        if (0 != body.compare(0, 5, "data=") || !decrypt(sealed, &params)) {
+            ADD_FAILURE() << "request body of " << api << " not decrypted";
+            return "{\"success\":false,\"errorCode\":\"DECRYPT_FAIL\",\"t\":1700000000}";
+        }
+
+        bool batch = (api == "tuya.device.batch.invoke");
+        batches_ += batch ? 1 : 0;
+        if (!device_known) {
+            return "{\"success\":false,\"errorCode\":\"DEVICE_NOT_EXIST\",\"errorMsg\":\"no device\",\"t\":1700000000}";
+        }
+        if (batch && !batch_known) {
+            return "{\"success\":false,\"errorCode\":\"API_OR_API_VERSION_WRONG\",\"errorMsg\":\"no api\","
+                   "\"t\":1700000000}";
+        }
+
+        cJSON *root = cJSON_CreateObject();
+        cJSON *json = cJSON_Parse(params.c_str());
+        if (batch) {
+            cJSON *results = cJSON_CreateArray();
+            cJSON_AddItemToObject(root, "result", results);
+            cJSON *call = NULL;
+            cJSON_ArrayForEach(call, cJSON_GetObjectItem(json, "apis"))
+            {
+                cJSON *each = cJSON_CreateObject();
+                cJSON *echo = cJSON_CreateObject();
+                cJSON_AddItemToObject(each, "result", echo);
+                cJSON_AddStringToObject(echo, "a", cJSON_GetObjectItem(call, "a")->valuestring);
+                cJSON_AddItemToObject(echo, "data", cJSON_Duplicate(cJSON_GetObjectItem(call, "data"), true));
+                cJSON_AddBoolToObject(each, "success", true);
+                cJSON_AddItemToArray(results, each);
+            }
+            cJSON_Delete(json);
+        } else {
+            cJSON *echo = cJSON_CreateObject();
+            cJSON_AddItemToObject(root, "result", echo);
+            cJSON_AddStringToObject(echo, "a", api.c_str());
+            cJSON_AddItemToObject(echo, "data", json);
+        }
+        cJSON_AddBoolToObject(root, "success", true);
+        cJSON_AddNumberToObject(root, "t", 1700000000);
+
+        return "{\"result\":\"" + encrypt(print(root)) + "\",\"t\":1700000000,\"success\":true}";
+    }
+
+    int listen_fd_ = -1;
+    uint16_t port_ = 0;
+    std::thread thread_;
+    std::vector<std::thread> workers_;
+    std::atomic<bool> stop_{false};
+    std::atomic<int> requests_{0};
+    std::atomic<int> batches_{0};
+};
+
+// what a callback was given
+struct Answer {
+    int calls = 0;
+    bool success = false;
+    std::string api;
+    int n = -1;
+};
+
+void answer_cb(atop_base_response_t *response, void *user_data)
+{
+    Answer *answer = (Answer *)user_data;
+    cJSON *result = response->result;
+
+    answer->calls++;
+    answer->success = response->success;
+    if (response->success && result) {
+        answer->api = cJSON_GetObjectItem(result, "a")->valuestring;
+        answer->n = cJSON_GetObjectItem(cJSON_GetObjectItem(result, "data"), "n")->valueint;
+    }
+}
+
+const char *s_apis[] = {"tuya.device.dynamic.config.get", "tuya.device.upgrade.get", "tuya.device.timer.count",
+                        "tuya.device.schema.get"};
+
+atop_base_request_t request_of()
+{
+    atop_base_request_t request = {};
+
+    request.path = "/d.json";
+    request.key = s_key;
+    request.devid = "ut_dev";
+    request.timestamp = 1700000000;
+    return request;
+}
+
+int batch(int count, std::vector<Answer> *answers, std::vector<std::string> *params)
+{
+    std::vector<atop_base_batch_call_t> calls(count);
+
+    answers->assign(count, Answer());
+    params->resize(count);
+    for (int i = 0; i < count; i++) {
+        (*params)[i] = "{\"n\":" + std::to_string(i) + "}";
+        calls[i].api = s_apis[i % 4];
+        calls[i].version = "1.0";
+        calls[i].data = (*params)[i].c_str();
+        calls[i].datalen = (*params)[i].size();
+        calls[i].cb = answer_cb;
+        calls[i].user_data = &(*answers)[i];
+    }
+    atop_base_request_t request = request_of();
+    return atop_base_batch_request(&request, calls.data(), count);
+}
+
+class AtopBatchTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        tal_kv_cfg_t cfg = {};
+        memcpy(cfg.seed, "vmlkasdh93dlvlcy", TAL_LV_KEY_LEN);
+        memcpy(cfg.key, "dflfuap134ddlduq", TAL_LV_KEY_LEN);
+        tal_kv_init(&cfg);
+        ASSERT_EQ(OPRT_OK, tal_sw_timer_init());
+        ASSERT_EQ(OPRT_OK, tal_time_service_init());
+    }
+};
+
+// tuya_run_state_t is private to tuya_iot.c, the startup update is the tenth
+// state, the batch the stand-in sees shows it is the one run
+const uint8_t STARTUP_UPDATE = 9;
+const uint8_t MQTT_CONNECT_START = STARTUP_UPDATE + 1;
+
+// an activated client at the startup update, with a version not synced yet
+void client_of(tuya_iot_client_t *client)
+{
+    memset(client, 0, sizeof(tuya_iot_client_t));
+    client->config.software_ver = "1.0.0";
+    client->config.storage_namespace = "ut";
+    snprintf(client->activate.devid, sizeof(client->activate.devid), "ut_dev");
+    snprintf(client->activate.seckey, sizeof(client->activate.seckey), "%s", s_key);
+    client->nextstate = STARTUP_UPDATE;
+    tal_kv_del("ut.ver");
+}
+
+} // namespace
+
+TEST_F(AtopBatchTest, CallsShareOneRequest)
+{
+    CloudStandIn cloud;
+    std::vector<Answer> answers;
+    std::vector<std::string> params;
+
+    ASSERT_EQ(OPRT_OK, batch(4, &answers, &params));
+    EXPECT_EQ(1, cloud.requests());
+    EXPECT_EQ(1, cloud.batches());
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(1, answers[i].calls) << i;
+        EXPECT_TRUE(answers[i].success) << i;
+        EXPECT_EQ(s_apis[i], answers[i].api) << i;
+        EXPECT_EQ(i, answers[i].n) << i;
+    }
+}
+
+TEST_F(AtopBatchTest, RefusalFailingEveryCallKeepsTheBatch)
+{
+    CloudStandIn cloud;
+    std::vector<Answer> answers;
+    std::vector<std::string> params;
+
+    // the device is gone, the batch and the calls sent after it all fail
+    cloud.device_known = false;
+    batch(3, &answers, &params);
+    EXPECT_EQ(1 + 3, cloud.requests());
+    for (auto &answer : answers) {
+        EXPECT_EQ(1, answer.calls);
+        EXPECT_FALSE(answer.success);
+    }
+
+    // which says nothing of the batch api, it is still used
+    cloud.device_known = true;
+    ASSERT_EQ(OPRT_OK, batch(3, &answers, &params));
+    EXPECT_EQ(1 + 3 + 1, cloud.requests());
+    EXPECT_EQ(2, cloud.batches());
+    for (auto &answer : answers) {
+        EXPECT_TRUE(answer.success);
+    }
+}
+
+TEST_F(AtopBatchTest, BenchmarkStartupCalls)
+{
+    CloudStandIn cloud;
+    std::vector<Answer> answers;
+    std::vector<std::string> params;
+    const int rounds = 10;
+
+    cloud.latency_ms = 30;
+    for (int count : {2, 4}) {
+        // the same calls one by one, then batched
+        int requests = cloud.requests();
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < count; i++) {
+                std::string data = "{\"n\":" + std::to_string(i) + "}";
+                atop_base_request_t request = request_of();
+                atop_base_response_t response = {};
+                request.api = s_apis[i];
+                request.version = "1.0";
+                request.data = (void *)data.c_str();
+                request.datalen = data.size();
+                ASSERT_EQ(OPRT_OK, atop_base_request(&request, &response));
+                EXPECT_TRUE(response.success);
+                atop_base_response_free(&response);
+            }
+        }
+        double each_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        int each_requests = cloud.requests() - requests;
+
+        requests = cloud.requests();
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) {
+            ASSERT_EQ(OPRT_OK, batch(count, &answers, &params));
+        }
+        double batch_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        EXPECT_EQ(rounds, cloud.requests() - requests);
+
+        printf("[   INFO   ] %d calls, %d ms latency: one by one %.0f ms in %d requests, batched %.0f ms in %d\n",
+               count, cloud.latency_ms.load(), each_ms / rounds, each_requests / rounds, batch_ms / rounds,
+               (cloud.requests() - requests) / rounds);
+    }
+}
+
+TEST_F(AtopBatchTest, BenchmarkStartupUpdate)
+{
+    CloudStandIn cloud;
+    tuya_iot_client_t *client = new tuya_iot_client_t;
+    const int rounds = 10;
+
+    cloud.latency_ms = 30;
+    tal_time_set_posix(1700000000, 1);
+
+    // the state machine from the startup update to MQTT connecting, as at boot
+    int requests = cloud.requests();
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        client_of(client);
+        tuya_iot_yield(client);
+        EXPECT_EQ(MQTT_CONNECT_START, client->nextstate);
+        EXPECT_TRUE(client->startup_version_updated) << r;
+        EXPECT_TRUE(client->startup_upgrade.success) << r;
+        atop_base_response_free(&client->startup_upgrade);
+        tuya_mqtt_destory(&client->mqctx);
+    }
+    double batch_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    int batch_requests = cloud.requests() - requests;
+    EXPECT_EQ(rounds, batch_requests);
+    EXPECT_EQ(rounds, cloud.batches());
+
+    // the calls it replaces, the version update and the upgrade check made once online
+    requests = cloud.requests();
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        atop_base_response_t response = {};
+        client_of(client);
+        ASSERT_EQ(OPRT_OK, tuya_iot_version_update_sync(client));
+        ASSERT_EQ(OPRT_OK, atop_service_upgrade_info_get_v44(client->activate.devid, client->activate.seckey, 0,
+                                                             &response));
+        atop_base_response_free(&response);
+    }
+    double each_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    int each_requests = cloud.requests() - requests;
+
+    printf("[   INFO   ] startup update, %d ms latency: batched %.0f ms in %d request(s), one by one %.0f ms in %d\n",
+           cloud.latency_ms.load(), batch_ms / rounds, batch_requests / rounds, each_ms / rounds,
+           each_requests / rounds);
+    delete client;
+}
+
+// last, the batch api is given up for the rest of the run
+TEST_F(AtopBatchTest, RefusedBatchFallsBackForGood)
+{
+    CloudStandIn cloud;
+    std::vector<Answer> answers;
+    std::vector<std::string> params;
+
+    cloud.batch_known = false;
+    ASSERT_EQ(OPRT_OK, batch(3, &answers, &params));
+    EXPECT_EQ(1 + 3, cloud.requests());
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(1, answers[i].calls) << i;
+        EXPECT_TRUE(answers[i].success) << i;
+        EXPECT_EQ(s_apis[i], answers[i].api) << i;
+        EXPECT_EQ(i, answers[i].n) << i;
+    }
+
+    // the next batch goes one by one at once
+    ASSERT_EQ(OPRT_OK, batch(3, &answers, &params));
+    EXPECT_EQ(1 + 3 + 3, cloud.requests());
+    EXPECT_EQ(1, cloud.batches());
+}
+
+#endif
@@ -0,0 +1,290 @@
+/**
+ * @file test_atop_cache.cpp
+ * @brief unit test of the cloud query response cache, with a weather card workload
+ */
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mockcpp/mockcpp.hpp"
+
+#include "tuya_cloud_types.h"
+#include "tuya_config_defaults.h"
+#include "tal_api.h"
+#include "tal_kv.h"
+#include "atop_cache.h"
+
+#if defined(ENABLE_ATOP_CACHE) && (ENABLE_ATOP_CACHE == 1)
+
+USING_MOCKCPP_NS
+
+namespace {
+
+atop_cache_key_t key_of(const char *api, const char *params, uint32_t ttl, const char *id = "ut_dev")
+{
+    atop_cache_key_t key = {};
+
+    key.api = api;
+    key.version = "1.0";
+    key.id = id;
+    key.params = params;
+    key.params_len = strlen(params);
+    key.ttl = ttl;
+    return key;
+}
+
+// the cached response, "" on a miss, which is fetched with answer when given
+std::string query(const atop_cache_key_t &key, const char *answer = NULL)
+{
+    atop_cache_ticket_t ticket;
+    uint8_t *data = NULL;
+    size_t len = 0;
+
+    if (OPRT_OK == atop_cache_get(&key, &ticket, &data, &len)) {
+        std::string out((const char *)data, len);
+        tal_free(data);
+        return out;
+    }
+    if (answer) {
+        atop_cache_put(&ticket, (const uint8_t *)answer, strlen(answer));
+    }
+    atop_cache_release(&ticket);
+    return "";
+}
+
+// whether another thread gets through the cache mutex while a record is written
+std::atomic<int> kv_set_calls{0};
+std::atomic<bool> kv_set_blocked{false};
+
+int unlocked_kv_set(const char *key, const uint8_t *value, size_t length)
+{
+    std::atomic<bool> done{false};
+    std::thread([&done] {
+        atop_cache_stats_t stats;
+        atop_cache_stats(&stats);
+        done = true;
+    }).detach();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (!done && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!done) {
+        kv_set_blocked = true;
+        while (!done) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    kv_set_calls++;
+    return OPRT_OK;
+}
+
+class AtopCacheTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        tal_kv_cfg_t cfg = {};
+        memcpy(cfg.seed, "vmlkasdh93dlvlcy", TAL_LV_KEY_LEN);
+        memcpy(cfg.key, "dflfuap134ddlduq", TAL_LV_KEY_LEN);
+        tal_kv_init(&cfg);
+        ASSERT_EQ(OPRT_OK, tal_time_service_init());
+        ASSERT_EQ(OPRT_OK, atop_cache_init());
+    }
+
+    void SetUp() override
+    {
+        atop_cache_clear();
+    }
+};
+
+} // namespace
+
+TEST_F(AtopCacheTest, ParamsAreCanonical)
+{
+    const char *params = "{\"city\":\"hz\",\"codes\":[\"w.temp\",\"w.pm25\"]}";
+    atop_cache_key_t key =
+        key_of("thing.weather.get", "{\"t\":100,\"city\":\"hz\",\"codes\":[\"w.temp\",\"w.pm25\"]}", 60);
+
+    EXPECT_EQ("", query(key, "{\"temp\":21}"));
+    // another timestamp and member order is the same request
+    EXPECT_EQ("{\"temp\":21}",
+              query(key_of("thing.weather.get", "{\"codes\":[\"w.temp\",\"w.pm25\"],\"city\":\"hz\",\"t\":200}", 60)));
+    EXPECT_EQ("{\"temp\":21}", query(key_of("thing.weather.get", params, 60)));
+
+    // other params, api, version or device are not
+    EXPECT_EQ("", query(key_of("thing.weather.get", "{\"city\":\"sh\",\"codes\":[\"w.temp\",\"w.pm25\"]}", 60)));
+    EXPECT_EQ("", query(key_of("thing.weather.forecast", params, 60)));
+    EXPECT_EQ("", query(key_of("thing.weather.get", "{\"city\":\"hz\",\"codes\":[\"w.pm25\",\"w.temp\"]}", 60)));
+    key.version = "2.0";
+    EXPECT_EQ("", query(key));
+    EXPECT_EQ("", query(key_of("thing.weather.get", params, 60, "other")));
+}
+
+TEST_F(AtopCacheTest, EntriesExpire)
+{
+    atop_cache_key_t key = key_of("thing.weather.get", "{\"city\":\"hz\"}", 1);
+
+    EXPECT_EQ("", query(key, "{\"temp\":21}"));
+    EXPECT_EQ("{\"temp\":21}", query(key));
+    tal_system_sleep(1100);
+    EXPECT_EQ("", query(key, "{\"temp\":22}"));
+    EXPECT_EQ("{\"temp\":22}", query(key));
+}
+
+TEST_F(AtopCacheTest, NoTtlOrFailedFetchIsNotCached)
+{
+    atop_cache_key_t key = key_of("thing.weather.get", "{\"city\":\"hz\"}", 0);
+
+    EXPECT_EQ("", query(key, "{\"temp\":21}"));
+    EXPECT_EQ("", query(key));
+
+    key.ttl = 60;
+    EXPECT_EQ("", query(key));
+    EXPECT_EQ("", query(key, "{\"temp\":21}"));
+    EXPECT_EQ("{\"temp\":21}", query(key));
+}
+
+TEST_F(AtopCacheTest, ConcurrentCallersShareOneFetch)
+{
+    atop_cache_key_t key = key_of("thing.weather.get", "{\"city\":\"hz\"}", 60);
+    atop_cache_stats_t before, after;
+    std::atomic<int> fetches{0};
+    std::vector<std::string> answers(8);
+    std::vector<std::thread> callers;
+
+    atop_cache_stats(&before);
+    for (int i = 0; i < 8; i++) {
+        callers.emplace_back([&, i] {
+            atop_cache_ticket_t ticket;
+            uint8_t *data = NULL;
+            size_t len = 0;
+
+            if (OPRT_OK == atop_cache_get(&key, &ticket, &data, &len)) {
+                answers[i].assign((const char *)data, len);
+                tal_free(data);
+                return;
+            }
+            fetches++;
+            tal_system_sleep(200);
+            atop_cache_put(&ticket, (const uint8_t *)"{\"temp\":21}", 11);
+            atop_cache_release(&ticket);
+            answers[i] = "{\"temp\":21}";
+        });
+    }
+    for (auto &caller : callers) {
+        caller.join();
+    }
+    atop_cache_stats(&after);
+
+    EXPECT_EQ(1, fetches);
+    for (auto &answer : answers) {
+        EXPECT_EQ("{\"temp\":21}", answer);
+    }
+    EXPECT_EQ(1, after.misses - before.misses);
+    EXPECT_EQ(7, after.coalesced - before.coalesced);
+}
+
+TEST_F(AtopCacheTest, WaitersFetchThemselvesWhenTheFetchFails)
+{
+    atop_cache_key_t key = key_of("thing.weather.get", "{\"city\":\"hz\"}", 60);
+    atop_cache_ticket_t ticket;
+    uint8_t *data = NULL;
+    size_t len = 0;
+
+    ASSERT_EQ(OPRT_NOT_FOUND, atop_cache_get(&key, &ticket, &data, &len));
+    std::thread waiter([&] { EXPECT_EQ("", query(key, "{\"temp\":23}")); });
+    tal_system_sleep(100);
+    atop_cache_release(&ticket);
+    waiter.join();
+
+    EXPECT_EQ("{\"temp\":23}", query(key));
+}
+
+TEST_F(AtopCacheTest, PersistedEntriesAreWrittenAndCleared)
+{
+    atop_cache_key_t key = key_of("/device/dns_query", "[{\"host\":\"a.example\",\"port\":443}]", 600, NULL);
+    uint8_t *value = NULL;
+    size_t length = 0;
+
+    key.persist = true;
+    tal_time_set_posix(1700000000, 1);
+    EXPECT_EQ("", query(key, "[{\"ca\":\"AAAA\"}]"));
+    ASSERT_EQ(OPRT_OK, tal_kv_get("atc.map", &value, &length));
+    tal_kv_free(value);
+
+    atop_cache_clear();
+    EXPECT_NE(OPRT_OK, tal_kv_get("atc.map", &value, &length));
+    EXPECT_EQ("", query(key));
+}
+
+TEST_F(AtopCacheTest, InvalidatedEntryIsFetchedAgain)
+{
+    atop_cache_key_t key = key_of("/device/dns_query", "[{\"host\":\"b.example\",\"port\":443}]", 600, NULL);
+
+    key.persist = true;
+    tal_time_set_posix(1700000000, 1);
+    EXPECT_EQ("", query(key, "[{\"ca\":\"old\"}]"));
+    EXPECT_EQ("[{\"ca\":\"old\"}]", query(key));
+
+    // the caller found the response unusable, the next lookup fetches and stores
+    atop_cache_invalidate(&key);
+    EXPECT_EQ("", query(key, "[{\"ca\":\"new\"}]"));
+    EXPECT_EQ("[{\"ca\":\"new\"}]", query(key));
+
+    // invalidating what is not cached does nothing
+    atop_cache_invalidate(&key);
+    atop_cache_invalidate(&key);
+    EXPECT_EQ("", query(key));
+}
+
+TEST_F(AtopCacheTest, RecordIsWrittenOutsideTheCacheLock)
+{
+    atop_cache_key_t key = key_of("/device/dns_query", "[{\"host\":\"c.example\",\"port\":443}]", 600, NULL);
+
+    key.persist = true;
+    tal_time_set_posix(1700000000, 1);
+    kv_set_calls = 0;
+    kv_set_blocked = false;
+    MOCKER(tal_kv_set).stubs().will(invoke(unlocked_kv_set));
+    EXPECT_EQ("", query(key, "[{\"ca\":\"AAAA\"}]"));
+    GlobalMockObject::verify();
+
+    EXPECT_EQ(2, kv_set_calls.load()); // the record and the map
+    EXPECT_FALSE(kv_set_blocked.load());
+    EXPECT_EQ("[{\"ca\":\"AAAA\"}]", query(key));
+}
+
+TEST_F(AtopCacheTest, WeatherCardWorkload)
+{
+    // six getters refreshed every 100 ms for 3 s, with TTLs scaled down from
+    // 10 min for the current data, 1 h for forecast and sunrise and 24 h for the city
+    struct {
+        const char *api;
+        uint32_t ttl;
+    } getters[] = {{"thing.weather.get", 1},      {"thing.weather.aqi", 1},     {"thing.weather.wind", 1},
+                   {"thing.weather.forecast", 6}, {"thing.weather.sunrise", 6}, {"thing.weather.city", 144}};
+    atop_cache_stats_t before, after;
+    int requests = 0, fetches = 0;
+
+    atop_cache_stats(&before);
+    SYS_TIME_T start = tal_system_get_millisecond();
+    while (tal_system_get_millisecond() - start < 3000) {
+        for (auto &getter : getters) {
+            std::string params = "{\"t\":" + std::to_string(++requests) + "}";
+            if (query(key_of(getter.api, params.c_str(), getter.ttl), "{\"v\":1}").empty()) {
+                fetches++;
+            }
+        }
+        tal_system_sleep(100);
+    }
+    atop_cache_stats(&after);
+
+    EXPECT_EQ((uint32_t)fetches, after.misses - before.misses);
+    EXPECT_LT(fetches, requests / 5);
+    printf("[   INFO   ] %d requests, %d went to the cloud, %d saved\n", requests, fetches, requests - fetches);
+}
+
+#endif
@@ -0,0 +1,232 @@
+/**
+ * @file test_dp_schema.cpp
+ * @brief unit test and benchmark of the indexed DP schema and the report serializer
+ */
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_api.h"
+#include "dp_schema.h"
+
+namespace {
+
+const char *s_devid = "schema_test_dev";
+
+std::string node_json(int id, const std::string &prop)
+{
+    return "{\"id\":" + std::to_string(id) + ",\"mode\":\"ro\",\"type\":\"obj\",\"property\":" + prop + "}";
+}
+
+std::string prop_json(int kind)
+{
+    switch (kind % 5) {
+    case 0:
+        return "{\"type\":\"bool\"}";
+    case 1:
+        return "{\"type\":\"value\",\"max\":100000,\"min\":-100000,\"scale\":0}";
+    case 2:
+        return "{\"type\":\"string\",\"maxlen\":64}";
+    case 3:
+        return "{\"type\":\"enum\",\"range\":[\"low\",\"middle\",\"high\"]}";
+    default:
+        return "{\"type\":\"bitmap\",\"maxlen\":8}";
+    }
+}
+
+dp_obj_t dp_of(int id, int kind, int value)
+{
+    static const char *strs[] = {"idle", "running \"fast\"", "line\nbreak", "c:\\path"};
+    dp_obj_t dp = {};
+
+    dp.id = id;
+    switch (kind % 5) {
+    case 0:
+        dp.type = PROP_BOOL;
+        dp.value.dp_bool = value & 1;
+        break;
+    case 1:
+        dp.type = PROP_VALUE;
+        dp.value.dp_value = value % 200000 - 100000;
+        break;
+    case 2:
+        dp.type = PROP_STR;
+        dp.value.dp_str = (char *)strs[value % 4];
+        break;
+    case 3:
+        dp.type = PROP_ENUM;
+        dp.value.dp_enum = value % 3;
+        break;
+    default:
+        dp.type = PROP_BITMAP;
+        dp.value.dp_bitmap = value & 0xff;
+        break;
+    }
+
+    return dp;
+}
+
+// valid check then json output, as dp_obj_report_send does
+int report_json(dp_schema_t *schema, dp_obj_t *dps, uint8_t dpscnt, std::string *json)
+{
+    dp_rept_valid_t *dpvalid = (dp_rept_valid_t *)calloc(1, sizeof(dp_rept_valid_t) + dpscnt);
+    dp_rept_in_t dpin = {};
+    dp_rept_out_t dpout = {};
+
+    dpin.rept_type = T_OBJ_REPT;
+    dpin.flags = DP_REPT_NO_FILTER_FLAG;
+    dpin.dps = dps;
+    dpin.dpscnt = dpscnt;
+
+    int rt = dp_rept_valid_check(schema, &dpin, dpvalid);
+    if (OPRT_OK == rt) {
+        rt = dp_rept_json_output(schema, &dpin, dpvalid, &dpout);
+    }
+    if (OPRT_OK == rt && json) {
+        *json = dpout.dpsjson;
+    }
+    tal_free(dpout.dpsjson);
+    free(dpvalid);
+
+    return rt;
+}
+
+class DpSchemaTest : public ::testing::Test {
+  protected:
+    void TearDown() override
+    {
+        dp_schema_delete((char *)s_devid);
+    }
+
+    dp_schema_t *create(const std::string &json)
+    {
+        std::string copy = json;
+        dp_schema_t *schema = NULL;
+
+        EXPECT_EQ(OPRT_OK, dp_schema_create((char *)s_devid, (char *)copy.c_str(), &schema));
+        return schema;
+    }
+};
+
+} // namespace
+
+TEST_F(DpSchemaTest, NodeFindByIndex)
+{
+    dp_schema_t *schema = create("[" + node_json(1, prop_json(0)) + "," + node_json(101, prop_json(1)) + "," +
+                                 node_json(7, prop_json(3)) + "]");
+    ASSERT_NE(nullptr, schema);
+    EXPECT_EQ(schema, dp_schema_find(s_devid));
+    EXPECT_EQ(nullptr, dp_schema_find("schema_test_other"));
+
+    for (int id : {1, 7, 101}) {
+        dp_node_t *node = dp_node_find(schema, id);
+        ASSERT_NE(nullptr, node) << id;
+        EXPECT_EQ(id, node->desc.id);
+        EXPECT_EQ(node, dp_node_find_by_devid((char *)s_devid, id));
+    }
+    for (int id : {-1, 0, 2, 100, 102, 255, 1000}) {
+        EXPECT_EQ(nullptr, dp_node_find(schema, id)) << id;
+    }
+}
+
+TEST_F(DpSchemaTest, NodeFindAtTheNodeLimit)
+{
+    // the most nodes a schema takes, ids 1..254, each found at its own position
+    std::string json = "[";
+    for (int id = 1; id <= 254; id++) {
+        json += (id > 1 ? "," : "") + node_json(id, prop_json(0));
+    }
+    dp_schema_t *schema = create(json + "]");
+    ASSERT_NE(nullptr, schema);
+    ASSERT_EQ(254, schema->num);
+
+    for (int id = 1; id <= 254; id++) {
+        dp_node_t *node = dp_node_find(schema, id);
+        ASSERT_NE(nullptr, node) << id;
+        EXPECT_EQ(&schema->node[id - 1], node) << id;
+    }
+    EXPECT_EQ(nullptr, dp_node_find(schema, 255));
+}
+
+TEST_F(DpSchemaTest, DeletedSlotIsReused)
+{
+    ASSERT_NE(nullptr, create("[" + node_json(1, prop_json(0)) + "]"));
+    ASSERT_EQ(OPRT_OK, dp_schema_delete((char *)s_devid));
+    EXPECT_EQ(nullptr, dp_schema_find(s_devid));
+
+    dp_schema_t *schema = create("[" + node_json(2, prop_json(1)) + "]");
+    ASSERT_NE(nullptr, schema);
+    EXPECT_EQ(schema, dp_schema_find(s_devid));
+}
+
+TEST_F(DpSchemaTest, JsonOutputEscapesLikeCJson)
+{
+    dp_schema_t *schema = create("[" + node_json(1, prop_json(0)) + "," + node_json(2, prop_json(1)) + "," +
+                                 node_json(3, prop_json(2)) + "," + node_json(4, prop_json(3)) + "," +
+                                 node_json(5, prop_json(4)) + "," + node_json(101, prop_json(1)) + "]");
+    ASSERT_NE(nullptr, schema);
+
+    dp_obj_t dps[6] = {dp_of(1, 0, 1), dp_of(2, 1, 99958), dp_of(3, 2, 0), dp_of(4, 3, 2),
+                       dp_of(5, 4, 9), dp_of(101, 1, 100007)};
+    dps[2].value.dp_str = (char *)"a\"b\\c\nd\x01\t";
+    std::string json;
+    ASSERT_EQ(OPRT_OK, report_json(schema, dps, 6, &json));
+    EXPECT_EQ("{\"1\":true,\"2\":-42,\"3\":\"a\\\"b\\\\c\\nd\\u0001\\t\",\"4\":\"high\",\"5\":9,\"101\":7}", json);
+
+    // a string of control characters needs six bytes each
+    dp_obj_t ctrl = dp_of(3, 2, 0);
+    ctrl.value.dp_str = (char *)"\x01\x02\x03\x04\x05\x06\x07\x0b\x0e\x0f\x10\x11\x12\x13\x14\x15\x16\x17";
+    ASSERT_EQ(OPRT_OK, report_json(schema, &ctrl, 1, &json));
+    EXPECT_EQ(1 + 4 + 2 + 18 * 6 + 1, json.size());
+}
+
+TEST_F(DpSchemaTest, BitmapOutOfRangeIsDropped)
+{
+    dp_schema_t *schema = create("[" + node_json(1, prop_json(0)) + "," + node_json(5, prop_json(4)) + "]");
+    ASSERT_NE(nullptr, schema);
+
+    dp_obj_t dps[2] = {dp_of(1, 0, 0), dp_of(5, 4, 0)};
+    dps[1].value.dp_bitmap = 0x1ff;
+    std::string json;
+    ASSERT_EQ(OPRT_OK, report_json(schema, dps, 2, &json));
+    EXPECT_EQ("{\"1\":false}", json);
+
+    dps[1].value.dp_bitmap = 0xff;
+    ASSERT_EQ(OPRT_OK, report_json(schema, dps, 2, &json));
+    EXPECT_EQ("{\"1\":false,\"5\":255}", json);
+}
+
+TEST_F(DpSchemaTest, BenchmarkValidateAndSerialize)
+{
+    const int dp_num = 120;
+    const int per_report = 10;
+    const int reports = 50000;
+    std::string json = "[";
+
+    for (int i = 1; i <= dp_num; i++) {
+        json += (i > 1 ? "," : "") + node_json(i, prop_json(i));
+    }
+    dp_schema_t *schema = create(json + "]");
+    ASSERT_NE(nullptr, schema);
+
+    srand(1);
+    std::vector<dp_obj_t> dps(per_report);
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reports; r++) {
+        int base = rand() % dp_num;
+        for (int i = 0; i < per_report; i++) {
+            int id = (base + i * 11) % dp_num + 1;
+            dps[i] = dp_of(id, id, rand());
+        }
+        ASSERT_EQ(OPRT_OK, report_json(schema, dps.data(), per_report, NULL));
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[   INFO   ] %d-dp schema, %d dps per report: %.0f reports/s, %.0f ns/dp\n", dp_num, per_report,
+           reports * 1e9 / ns, ns / reports / per_report);
+}
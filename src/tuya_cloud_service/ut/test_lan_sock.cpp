@@ -0,0 +1,182 @@
+/**
+ * @file test_lan_sock.cpp
+ * @brief unit test and load test of the LAN socket loop
+ */
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_system.h"
+#include "lan_sock.h"
+#include "tuya_lan.h"
+
+namespace {
+
+const uint32_t s_udp_readers = 5; // LAN_UDP_READER_CNT in lan_sock.c
+
+std::atomic<int> s_reads;
+std::atomic<SYS_TIME_T> s_read_ms;
+
+void count_read(int sock)
+{
+    char buf[64];
+
+    if (read(sock, buf, sizeof(buf)) > 0) {
+        s_read_ms = tal_system_get_millisecond();
+        s_reads++;
+    }
+}
+
+// the loop side of a client, it answers each message with the same bytes
+void echo_read(int sock)
+{
+    char buf[256];
+    ssize_t n = read(sock, buf, sizeof(buf));
+
+    if (n > 0 && write(sock, buf, n) != n) {
+        ADD_FAILURE() << "echo write";
+    }
+}
+
+sloop_sock_t reader_of(int sock, sloop_sock_read read)
+{
+    sloop_sock_t info = {};
+
+    info.sock = sock;
+    info.read = read;
+    return info;
+}
+
+bool fd_open(int fd)
+{
+    return fcntl(fd, F_GETFD) >= 0 || errno != EBADF;
+}
+
+double cpu_ms()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+class LanSockTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        ASSERT_EQ(OPRT_OK, tuya_sock_loop_init());
+        // let the loop reach its first wait
+        tal_system_sleep(100);
+    }
+
+    void SetUp() override
+    {
+        s_reads = 0;
+        s_read_ms = 0;
+    }
+};
+
+} // namespace
+
+TEST_F(LanSockTest, NewSocketIsWatchedAtOnce)
+{
+    int fd[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fd));
+
+    // the data is there before the socket is registered, the loop must not
+    // wait out its current pass to see it
+    ASSERT_EQ(1, write(fd[1], "x", 1));
+    SYS_TIME_T start = tal_system_get_millisecond();
+    ASSERT_EQ(OPRT_OK, tuya_reg_lan_sock(reader_of(fd[0], count_read)));
+    for (int i = 0; i < 200 && 0 == s_reads; i++) {
+        tal_system_sleep(5);
+    }
+    ASSERT_EQ(1, s_reads);
+    EXPECT_LT(s_read_ms - start, 200);
+
+    // unregister closes the socket
+    ASSERT_EQ(OPRT_OK, tuya_unreg_lan_sock(fd[0]));
+    for (int i = 0; i < 200 && fd_open(fd[0]); i++) {
+        tal_system_sleep(5);
+    }
+    EXPECT_FALSE(fd_open(fd[0]));
+    close(fd[1]);
+}
+
+TEST_F(LanSockTest, EchoLoad)
+{
+    const uint32_t clients = s_udp_readers + tuya_lan_get_client_num();
+    const int rounds = 2000;
+    std::vector<int> loop_fds(clients), client_fds(clients);
+    std::vector<double> rtt_us(clients);
+
+    // a burst of registrations, one per reader slot
+    for (uint32_t i = 0; i < clients; i++) {
+        int fd[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fd));
+        loop_fds[i] = fd[0];
+        client_fds[i] = fd[1];
+        ASSERT_EQ(OPRT_OK, tuya_reg_lan_sock(reader_of(fd[0], echo_read)));
+    }
+
+    double cpu_start = cpu_ms();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < clients; i++) {
+        threads.emplace_back([&, i] {
+            struct timeval tv = {2, 0};
+            setsockopt(client_fds[i], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            auto begin = std::chrono::steady_clock::now();
+            for (int r = 0; r < rounds; r++) {
+                uint32_t out = r, in = 0;
+                if (write(client_fds[i], &out, sizeof(out)) != sizeof(out) ||
+                    read(client_fds[i], &in, sizeof(in)) != sizeof(in) || in != out) {
+                    rtt_us[i] = -1;
+                    return;
+                }
+            }
+            rtt_us[i] =
+                std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count() / rounds;
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    double cpu = cpu_ms() - cpu_start;
+
+    double rtt_sum = 0;
+    for (uint32_t i = 0; i < clients; i++) {
+        EXPECT_GT(rtt_us[i], 0) << "client " << i << " lost an echo";
+        rtt_sum += rtt_us[i];
+    }
+    printf("[   INFO   ] %u clients x %d echoes: %.0f msg/s, rtt avg %.0f us, cpu %.0f ms in %.0f ms\n", clients,
+           rounds, clients * rounds * 1e3 / wall_ms, rtt_sum / clients, cpu, wall_ms);
+
+    for (uint32_t i = 0; i < clients; i++) {
+        ASSERT_EQ(OPRT_OK, tuya_unreg_lan_sock(loop_fds[i]));
+    }
+    for (int i = 0; i < 200 && fd_open(loop_fds[clients - 1]); i++) {
+        tal_system_sleep(5);
+    }
+    for (uint32_t i = 0; i < clients; i++) {
+        EXPECT_FALSE(fd_open(loop_fds[i])) << "client " << i << " not unregistered";
+        close(client_fds[i]);
+    }
+
+    // an idle loop sleeps in its wait
+    cpu_start = cpu_ms();
+    tal_system_sleep(500);
+    EXPECT_LT(cpu_ms() - cpu_start, 50);
+}
@@ -0,0 +1,354 @@
+/**
+ * @file test_mqtt_publish_queue.cpp
+ * @brief unit test and benchmark of the in-flight QoS1 publish tracking
+ */
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_system.h"
+#include "mqtt_publish_queue.h"
+
+namespace {
+
+mqtt_publish_handle_t *publish_new(SYS_TIME_T timeout, uint16_t msgid)
+{
+    mqtt_publish_handle_t *handle = (mqtt_publish_handle_t *)calloc(1, sizeof(mqtt_publish_handle_t));
+    handle->timeout = timeout;
+    handle->msgid = msgid;
+    return handle;
+}
+
+// a broker that answers each 2 byte packet id with the same id, the PUBACK
+class MockBroker {
+  public:
+    MockBroker()
+    {
+        int size = 1 << 22;
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fd_);
+        fcntl(fd_[0], F_SETFL, fcntl(fd_[0], F_GETFL) | O_NONBLOCK);
+        setsockopt(fd_[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(fd_[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        thread_ = std::thread([this] {
+            uint16_t ids[512];
+            ssize_t n;
+            while ((n = read(fd_[1], ids, sizeof(ids))) > 0) {
+                if (write(fd_[1], ids, n) != n) {
+                    break;
+                }
+            }
+        });
+    }
+
+    ~MockBroker()
+    {
+        shutdown(fd_[0], SHUT_RDWR);
+        thread_.join();
+        close(fd_[0]);
+        close(fd_[1]);
+    }
+
+    uint16_t publish()
+    {
+        if (0 == ++msgid_) {
+            ++msgid_;
+        }
+        return write(fd_[0], &msgid_, sizeof(msgid_)) == sizeof(msgid_) ? msgid_ : 0;
+    }
+
+    template <typename F> void yield(F on_ack)
+    {
+        uint16_t ids[256];
+        ssize_t n;
+        while ((n = read(fd_[0], ids, sizeof(ids))) > 0) {
+            for (ssize_t i = 0; i < n / 2; i++) {
+                on_ack(ids[i]);
+            }
+        }
+    }
+
+  private:
+    int fd_[2];
+    uint16_t msgid_ = 0;
+    std::thread thread_;
+};
+
+} // namespace
+
+TEST(MqttPublishQueue, MatchesModel)
+{
+    struct Model {
+        bool live;
+        uint16_t msgid;
+        SYS_TIME_T deadline;
+        mqtt_publish_handle_t *handle;
+    };
+    std::mt19937 rng(3);
+
+    for (int round = 0; round < 100; round++) {
+        mqtt_publish_queue_t queue;
+        ASSERT_EQ(OPRT_OK, mqtt_publish_queue_init(&queue));
+        std::vector<Model> model;
+        uint16_t next_id = 1;
+        SYS_TIME_T now = 1000;
+
+        for (int step = 0; step < 2000; step++) {
+            switch (rng() % 5) {
+            case 0: {
+                uint16_t msgid = (rng() % 2) ? next_id++ : 0;
+                next_id = next_id ? next_id : 1;
+                mqtt_publish_handle_t *handle = publish_new(now + rng() % 500, msgid);
+                model.push_back({true, msgid, handle->timeout, handle});
+                ASSERT_EQ(OPRT_OK, mqtt_publish_queue_add(&queue, handle));
+                break;
+            }
+            case 1: {
+                if (model.empty()) {
+                    break;
+                }
+                Model &m = model[rng() % model.size()];
+                if (m.live && m.msgid) {
+                    ASSERT_EQ(m.handle, mqtt_publish_queue_ack(&queue, m.msgid, now));
+                    m.live = false;
+                    free(m.handle);
+                } else {
+                    ASSERT_EQ(NULL, mqtt_publish_queue_ack(&queue, 60000, now));
+                }
+                break;
+            }
+            case 2: {
+                now += rng() % 50;
+                mqtt_publish_handle_t *handle;
+                while ((handle = mqtt_publish_queue_expire(&queue, now))) {
+                    bool found = false;
+                    for (auto &m : model) {
+                        if (m.live && m.handle == handle) {
+                            EXPECT_LE(m.deadline, now);
+                            m.live = false;
+                            found = true;
+                        }
+                    }
+                    ASSERT_TRUE(found);
+                    free(handle);
+                }
+                for (auto &m : model) {
+                    ASSERT_FALSE(m.live && m.deadline <= now);
+                }
+                break;
+            }
+            case 3: {
+                mqtt_publish_handle_t *handle = mqtt_publish_queue_pending(&queue);
+                if (NULL == handle) {
+                    break;
+                }
+                uint16_t msgid = (rng() % 3) ? next_id++ : 0;
+                next_id = next_id ? next_id : 1;
+                mqtt_publish_queue_sent(&queue, handle, msgid, now);
+                for (auto &m : model) {
+                    if (m.live && m.handle == handle) {
+                        ASSERT_EQ(0, m.msgid);
+                        m.msgid = msgid;
+                    }
+                }
+                break;
+            }
+            default: {
+                mqtt_publish_stats_t stats;
+                uint32_t inflight = 0, pending = 0;
+                mqtt_publish_queue_stats(&queue, &stats);
+                for (auto &m : model) {
+                    if (m.live) {
+                        (m.msgid ? inflight : pending)++;
+                    }
+                }
+                ASSERT_EQ(inflight, stats.inflight);
+                ASSERT_EQ(pending, stats.pending);
+                break;
+            }
+            }
+        }
+        mqtt_publish_queue_deinit(&queue);
+    }
+}
+
+TEST(MqttPublishQueue, StatsAndLatency)
+{
+    mqtt_publish_queue_t queue;
+    mqtt_publish_stats_t stats;
+    mqtt_publish_handle_t *handle = NULL;
+
+    ASSERT_EQ(OPRT_OK, mqtt_publish_queue_init(&queue));
+
+    // sent at 1000, acked 120 ms later
+    ASSERT_EQ(OPRT_OK, mqtt_publish_queue_add(&queue, publish_new(6000, 0)));
+    handle = mqtt_publish_queue_pending(&queue);
+    ASSERT_NE(nullptr, handle);
+    mqtt_publish_queue_sent(&queue, handle, 0, 900);
+    EXPECT_EQ(handle, mqtt_publish_queue_pending(&queue));
+    mqtt_publish_queue_sent(&queue, handle, 7, 1000);
+    EXPECT_EQ(nullptr, mqtt_publish_queue_pending(&queue));
+    EXPECT_EQ(handle, mqtt_publish_queue_ack(&queue, 7, 1120));
+    free(handle);
+
+    // never acked
+    ASSERT_EQ(OPRT_OK, mqtt_publish_queue_add(&queue, publish_new(2000, 8)));
+    EXPECT_EQ(nullptr, mqtt_publish_queue_expire(&queue, 1999));
+    handle = mqtt_publish_queue_expire(&queue, 2000);
+    ASSERT_NE(nullptr, handle);
+    free(handle);
+
+    mqtt_publish_queue_stats(&queue, &stats);
+    EXPECT_EQ(0, stats.inflight);
+    EXPECT_EQ(0, stats.pending);
+    EXPECT_EQ(1, stats.ack_cnt);
+    EXPECT_EQ(1, stats.timeout_cnt);
+    EXPECT_EQ(1, stats.retry_cnt);
+    EXPECT_EQ(1, stats.latency[2]); // 100 < 120 <= 200
+    mqtt_publish_queue_deinit(&queue);
+}
+
+TEST(MqttPublishQueue, BenchMockBroker)
+{
+    // the list and loop of mqtt_service before the queue
+    struct OldPublish {
+        OldPublish *next;
+        uint16_t msgid;
+        SYS_TIME_T timeout;
+    };
+    MockBroker broker;
+    int done = 0;
+
+    for (int n : {10, 100, 1000}) {
+        int rounds = n < 1000 ? 200 : 10;
+        double old_us = 0, new_us = 0;
+
+        for (int r = 0; r < rounds; r++) {
+            OldPublish *list = NULL;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < n; i++) {
+                OldPublish *entry = (OldPublish *)calloc(1, sizeof(OldPublish));
+                entry->timeout = tal_system_get_millisecond() + 5000;
+                OldPublish **tail = &list;
+                while (*tail) {
+                    tail = &(*tail)->next;
+                }
+                *tail = entry;
+            }
+            for (done = 0; done < n;) {
+                for (OldPublish *entry = list; entry; entry = entry->next) {
+                    if (entry->timeout <= tal_system_get_millisecond()) {
+                        ADD_FAILURE();
+                    }
+                    if (0 == entry->msgid) {
+                        entry->msgid = broker.publish();
+                    }
+                }
+                broker.yield([&](uint16_t msgid) {
+                    for (OldPublish **pp = &list; *pp; pp = &(*pp)->next) {
+                        if ((*pp)->msgid == msgid) {
+                            OldPublish *entry = *pp;
+                            *pp = entry->next;
+                            free(entry);
+                            done++;
+                            break;
+                        }
+                    }
+                });
+            }
+            old_us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+            mqtt_publish_queue_t queue;
+            ASSERT_EQ(OPRT_OK, mqtt_publish_queue_init(&queue));
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < n; i++) {
+                mqtt_publish_queue_add(&queue, publish_new(tal_system_get_millisecond() + 5000, 0));
+            }
+            for (done = 0; done < n;) {
+                SYS_TIME_T now = tal_system_get_millisecond();
+                mqtt_publish_handle_t *handle;
+                while ((handle = mqtt_publish_queue_expire(&queue, now))) {
+                    ADD_FAILURE();
+                    free(handle);
+                }
+                while ((handle = mqtt_publish_queue_pending(&queue))) {
+                    uint16_t msgid = broker.publish();
+                    mqtt_publish_queue_sent(&queue, handle, msgid, now);
+                    if (0 == msgid) {
+                        break;
+                    }
+                }
+                broker.yield([&](uint16_t msgid) {
+                    free(mqtt_publish_queue_ack(&queue, msgid, tal_system_get_millisecond()));
+                    done++;
+                });
+            }
+            new_us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            mqtt_publish_queue_deinit(&queue);
+        }
+        printf("burst of %4d QoS1 publishes: list %9.1f us, queue %8.1f us\n", n, old_us / rounds,
+               new_us / rounds);
+    }
+}
+
+TEST(MqttPublishQueue, BenchLoopPass)
+{
+    struct OldPublish {
+        OldPublish *next;
+        uint16_t msgid;
+        SYS_TIME_T timeout;
+    };
+    const int passes = 20000;
+
+    // one tuya_mqtt_loop pass while n publishes wait for their PUBACK
+    for (int n : {10, 100, 1000, 5000}) {
+        OldPublish *list = NULL;
+        mqtt_publish_queue_t queue;
+        ASSERT_EQ(OPRT_OK, mqtt_publish_queue_init(&queue));
+        for (int i = 0; i < n; i++) {
+            OldPublish *entry = (OldPublish *)calloc(1, sizeof(OldPublish));
+            entry->msgid = i + 1;
+            entry->timeout = tal_system_get_millisecond() + 100000;
+            entry->next = list;
+            list = entry;
+            mqtt_publish_queue_add(&queue, publish_new(entry->timeout, i + 1));
+        }
+
+        volatile int hits = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < passes; r++) {
+            for (OldPublish *entry = list; entry; entry = entry->next) {
+                if (entry->timeout <= tal_system_get_millisecond() || 0 == entry->msgid) {
+                    hits++;
+                }
+            }
+        }
+        auto old_cost = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < passes; r++) {
+            if (mqtt_publish_queue_expire(&queue, tal_system_get_millisecond()) || mqtt_publish_queue_pending(&queue)) {
+                hits++;
+            }
+        }
+        auto new_cost = std::chrono::steady_clock::now() - start;
+        EXPECT_EQ(0, hits);
+
+        printf("%5d in flight: list %9.0f ns/pass, queue %5.0f ns/pass\n", n,
+               std::chrono::duration<double, std::nano>(old_cost).count() / passes,
+               std::chrono::duration<double, std::nano>(new_cost).count() / passes);
+        while (list) {
+            OldPublish *next = list->next;
+            free(list);
+            list = next;
+        }
+        mqtt_publish_queue_deinit(&queue);
+    }
+}
@@ -0,0 +1,264 @@
+/**
+ * @file test_mqtt_subscribe_index.cpp
+ * @brief unit test and benchmark of the MQTT subscribe topic index
+ */
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "mqtt_subscribe_index.h"
+
+namespace {
+
+// MQTT 3.1.1 matching, written the straightforward way
+bool ref_match(const std::string &filter, const std::string &topic)
+{
+    if (!topic.empty() && '$' == topic[0] && !filter.empty() && ('+' == filter[0] || '#' == filter[0])) {
+        return false;
+    }
+    size_t f = 0, t = 0;
+    while (true) {
+        size_t fe = filter.find('/', f), te = topic.find('/', t);
+        std::string fl = filter.substr(f, fe == std::string::npos ? std::string::npos : fe - f);
+        std::string tl = topic.substr(t, te == std::string::npos ? std::string::npos : te - t);
+        if ("#" == fl) {
+            return true;
+        }
+        if ("+" != fl && fl != tl) {
+            return false;
+        }
+        if (fe == std::string::npos && te == std::string::npos) {
+            return true;
+        }
+        if (te == std::string::npos) {
+            return filter.substr(fe + 1) == "#";
+        }
+        if (fe == std::string::npos) {
+            return false;
+        }
+        f = fe + 1;
+        t = te + 1;
+    }
+}
+
+bool is_filter(const std::string &topic)
+{
+    std::string level;
+    for (size_t i = 0; i <= topic.size(); i++) {
+        if (i == topic.size() || '/' == topic[i]) {
+            if ("+" == level || "#" == level) {
+                return true;
+            }
+            level.clear();
+        } else {
+            level += topic[i];
+        }
+    }
+    return false;
+}
+
+std::map<long, int> s_hits;
+
+void count_cb(uint16_t msgid, const mqtt_client_message_t *msg, void *userdata)
+{
+    s_hits[(long)userdata]++;
+}
+
+std::string random_topic(std::mt19937 &rng, bool filter)
+{
+    static const char *levels[] = {"a", "b", "", "+", "#", "$s", "cc"};
+    int n = 1 + rng() % 4;
+    std::string out;
+    for (int i = 0; i < n; i++) {
+        int k;
+        do {
+            k = rng() % 7;
+        } while (!filter && (3 == k || 4 == k));
+        if (4 == k && i != n - 1) {
+            k = 0;
+        }
+        out += levels[k];
+        if (i < n - 1) {
+            out += "/";
+        }
+    }
+    return out;
+}
+
+int dispatch(mqtt_subscribe_index_t *index, const char *topic)
+{
+    mqtt_client_message_t msg = {};
+    msg.topic = topic;
+    return mqtt_subscribe_index_dispatch(index, 1, &msg);
+}
+
+struct Reentry {
+    mqtt_subscribe_index_t *index;
+    std::vector<std::string> remove;
+    std::vector<std::string> add;
+    int calls;
+};
+
+void reentry_cb(uint16_t msgid, const mqtt_client_message_t *msg, void *userdata)
+{
+    Reentry *ctx = (Reentry *)userdata;
+    ctx->calls++;
+    for (auto &topic : ctx->remove) {
+        mqtt_subscribe_index_remove(ctx->index, topic.c_str());
+    }
+    for (auto &topic : ctx->add) {
+        mqtt_subscribe_index_add(ctx->index, topic.c_str(), count_cb, (void *)1000);
+    }
+    ctx->remove.clear();
+    ctx->add.clear();
+}
+
+} // namespace
+
+TEST(MqttSubscribeIndex, MatchesReference)
+{
+    std::mt19937 rng(1);
+
+    for (int round = 0; round < 300; round++) {
+        mqtt_subscribe_index_t index = {};
+        std::vector<std::string> subs;
+        std::vector<bool> live;
+        int n = 1 + rng() % 60;
+
+        for (int i = 0; i < n; i++) {
+            subs.push_back(random_topic(rng, true));
+            live.push_back(NULL == mqtt_subscribe_index_find(&index, subs[i].c_str(), count_cb));
+            if (live[i]) {
+                ASSERT_EQ(OPRT_OK, mqtt_subscribe_index_add(&index, subs[i].c_str(), count_cb, (void *)(long)i));
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            if (live[i] && 0 == rng() % 4) {
+                std::string topic = subs[i];
+                mqtt_subscribe_index_remove(&index, topic.c_str());
+                for (int j = 0; j < n; j++) {
+                    if (subs[j] == topic) {
+                        live[j] = false;
+                    }
+                }
+            }
+        }
+        for (int q = 0; q < 50; q++) {
+            std::string topic = random_topic(rng, false);
+            s_hits.clear();
+            dispatch(&index, topic.c_str());
+            for (int i = 0; i < n; i++) {
+                bool expect = live[i] && (is_filter(subs[i]) ? ref_match(subs[i], topic) : subs[i] == topic);
+                ASSERT_EQ(expect ? 1 : 0, s_hits[i]) << "filter " << subs[i] << " topic " << topic;
+            }
+        }
+        mqtt_subscribe_index_clear(&index);
+    }
+}
+
+TEST(MqttSubscribeIndex, UnsubscribeWildcardDuringDispatch)
+{
+    mqtt_subscribe_index_t index = {};
+    Reentry ctx = {&index, {"a/+/c", "a/#"}, {}, 0};
+
+    // the callback removes its own filter and the one matched after it, which
+    // leaves their trie nodes empty while the walk is still on them
+    ASSERT_EQ(OPRT_OK, mqtt_subscribe_index_add(&index, "a/+/c", reentry_cb, &ctx));
+    ASSERT_EQ(OPRT_OK, mqtt_subscribe_index_add(&index, "a/#", count_cb, (void *)1));
+    s_hits.clear();
+    EXPECT_EQ(1, dispatch(&index, "a/b/c"));
+    EXPECT_EQ(1, ctx.calls);
+    EXPECT_EQ(0, s_hits[1]);
+
+    EXPECT_EQ(0, dispatch(&index, "a/b/c"));
+    EXPECT_EQ(NULL, index.wildcard);
+    mqtt_subscribe_index_clear(&index);
+}
+
+TEST(MqttSubscribeIndex, UnsubscribeExactDuringDispatch)
+{
+    mqtt_subscribe_index_t index = {};
+    Reentry ctx = {&index, {"x/y", "x/z"}, {}, 0};
+
+    // same topic twice, the second handle is next in the chain when the first runs
+    ASSERT_EQ(OPRT_OK, mqtt_subscribe_index_add(&index, "x/y", count_cb, (void *)1));
+    ASSERT_EQ(OPRT_OK, mqtt_subscribe_index_add(&index, "x/y", reentry_cb, &ctx));
+    ASSERT_EQ(OPRT_OK, mqtt_subscribe_index_add(&index, "x/z", count_cb, (void *)2));
+    s_hits.clear();
+    EXPECT_EQ(1, dispatch(&index, "x/y"));
+    EXPECT_EQ(0, s_hits[1]);
+    EXPECT_EQ(0, dispatch(&index, "x/y"));
+    EXPECT_EQ(0, dispatch(&index, "x/z"));
+    mqtt_subscribe_index_clear(&index);
+}
+
+TEST(MqttSubscribeIndex, SubscribeDuringDispatch)
+{
+    mqtt_subscribe_index_t index = {};
+    Reentry ctx = {&index, {}, {}, 0};
+
+    ASSERT_EQ(OPRT_OK, mqtt_subscribe_index_add(&index, "s/0", reentry_cb, &ctx));
+    // enough new topics to need a bigger table
+    for (int i = 1; i < 40; i++) {
+        ctx.add.push_back("s/" + std::to_string(i));
+    }
+    ctx.add.push_back("s/+");
+    // the new filter may or may not see the message being dispatched
+    EXPECT_LE(1, dispatch(&index, "s/0"));
+
+    s_hits.clear();
+    for (int i = 1; i < 40; i++) {
+        EXPECT_EQ(2, dispatch(&index, ("s/" + std::to_string(i)).c_str()));
+    }
+    EXPECT_EQ(39 * 2, s_hits[1000]);
+    mqtt_subscribe_index_clear(&index);
+}
+
+TEST(MqttSubscribeIndex, BenchDispatch)
+{
+    struct Entry {
+        std::string topic;
+        mqtt_subscribe_message_cb_t cb;
+        void *userdata;
+    };
+    const int msgs = 100000;
+
+    for (int n : {1, 100, 1000}) {
+        mqtt_subscribe_index_t index = {};
+        std::vector<Entry> list;
+        for (int i = 0; i < n; i++) {
+            char topic[64];
+            snprintf(topic, sizeof(topic), "smart/device/in/6c%020dxyz", i * 7919);
+            list.push_back({topic, count_cb, (void *)1});
+            ASSERT_EQ(OPRT_OK, mqtt_subscribe_index_add(&index, topic, count_cb, (void *)1));
+        }
+
+        // the linked list walk the index replaced
+        auto start = std::chrono::steady_clock::now();
+        for (int q = 0; q < msgs; q++) {
+            const std::string &topic = list[(q * 2654435761u) % n].topic;
+            for (auto &entry : list) {
+                if (entry.topic.size() == topic.size() && !memcmp(entry.topic.data(), topic.data(), topic.size())) {
+                    entry.cb(1, NULL, entry.userdata);
+                }
+            }
+        }
+        auto list_cost = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        for (int q = 0; q < msgs; q++) {
+            ASSERT_EQ(1, dispatch(&index, list[(q * 2654435761u) % n].topic.c_str()));
+        }
+        auto index_cost = std::chrono::steady_clock::now() - start;
+
+        printf("%4d subscriptions: list %7.1f ns/msg, index %7.1f ns/msg\n", n,
+               std::chrono::duration<double, std::nano>(list_cost).count() / msgs,
+               std::chrono::duration<double, std::nano>(index_cost).count() / msgs);
+        mqtt_subscribe_index_clear(&index);
+    }
+}
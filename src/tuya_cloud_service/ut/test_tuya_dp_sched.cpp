@@ -0,0 +1,330 @@
+/**
+ * @file test_tuya_dp_sched.cpp
+ * @brief unit test of the DP report scheduler, with a synthetic sensor workload
+ */
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mockcpp/mockcpp.hpp"
+
+#include "tuya_cloud_types.h"
+#include "tuya_config_defaults.h"
+#include "tal_api.h"
+#include "tal_workq_service.h"
+#include "tkl_memory.h"
+#include "dp_schema.h"
+#include "tuya_dp_sched.h"
+
+USING_MOCKCPP_NS
+
+#if defined(ENABLE_DP_REPORT_SCHED) && (ENABLE_DP_REPORT_SCHED == 1)
+
+// same defaults as tuya_dp_sched.c
+#ifndef DP_REPORT_SCHED_WINDOW_MS
+#define DP_REPORT_SCHED_WINDOW_MS 500
+#endif
+
+#ifndef DP_REPORT_SCHED_MAX_RATE
+#define DP_REPORT_SCHED_MAX_RATE 2
+#endif
+
+namespace {
+
+const char *s_schema = "[{\"id\":1,\"mode\":\"ro\",\"type\":\"obj\",\"property\":{\"type\":\"value\",\"max\":1000,"
+                       "\"min\":0,\"scale\":0}},"
+                       "{\"id\":2,\"mode\":\"ro\",\"type\":\"obj\",\"property\":{\"type\":\"value\",\"max\":1000,"
+                       "\"min\":0,\"scale\":0}},"
+                       "{\"id\":3,\"mode\":\"ro\",\"type\":\"obj\",\"property\":{\"type\":\"bool\"}},"
+                       "{\"id\":4,\"mode\":\"ro\",\"type\":\"obj\",\"property\":{\"type\":\"string\",\"maxlen\":32}},"
+                       "{\"id\":5,\"mode\":\"ro\",\"type\":\"obj\",\"trigger\":\"direct\","
+                       "\"property\":{\"type\":\"bool\"}}]";
+
+struct Sent {
+    std::string devid;
+    SYS_TIME_T time;
+    std::map<int, std::string> dps;
+    int flags;
+};
+
+std::mutex s_lock;
+std::vector<Sent> s_sent;
+std::vector<std::pair<long, int>> s_done;
+
+std::string value_str(const dp_obj_t &dp)
+{
+    switch (dp.type) {
+    case PROP_BOOL:
+        return dp.value.dp_bool ? "true" : "false";
+    case PROP_STR:
+        return dp.value.dp_str;
+    default:
+        return std::to_string(dp.value.dp_value);
+    }
+}
+
+int send_cb(const char *devid, dp_obj_t *dps, uint16_t dpscnt, int flags)
+{
+    Sent sent = {devid, tal_system_get_millisecond(), {}, flags};
+    for (uint16_t i = 0; i < dpscnt; i++) {
+        EXPECT_EQ(0, sent.dps.count(dps[i].id)) << "dp " << (int)dps[i].id << " sent twice";
+        sent.dps[dps[i].id] = value_str(dps[i]);
+    }
+
+    std::lock_guard<std::mutex> guard(s_lock);
+    s_sent.push_back(sent);
+    return OPRT_OK;
+}
+
+void done_cb(int result, void *user_data)
+{
+    std::lock_guard<std::mutex> guard(s_lock);
+    s_done.push_back({(long)user_data, result});
+}
+
+dp_obj_t dp_value(uint8_t id, int value)
+{
+    dp_obj_t dp = {};
+    dp.id = id;
+    dp.type = PROP_VALUE;
+    dp.value.dp_value = value;
+    return dp;
+}
+
+dp_obj_t dp_bool(uint8_t id, bool value)
+{
+    dp_obj_t dp = {};
+    dp.id = id;
+    dp.type = PROP_BOOL;
+    dp.value.dp_bool = value;
+    return dp;
+}
+
+// the copy of a string DP of this many bytes fails
+const size_t FAIL_ALLOC_SIZE = 30;
+
+void *failing_malloc(size_t size)
+{
+    return FAIL_ALLOC_SIZE == size ? NULL : tkl_system_malloc(size);
+}
+
+size_t sent_count()
+{
+    std::lock_guard<std::mutex> guard(s_lock);
+    return s_sent.size();
+}
+
+bool wait_sent(size_t count, int timeout_ms)
+{
+    for (int i = 0; i < timeout_ms / 10 && sent_count() < count; i++) {
+        tal_system_sleep(10);
+    }
+    return sent_count() >= count;
+}
+
+class DpSchedTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        ASSERT_EQ(OPRT_OK, tal_sw_timer_init());
+        ASSERT_EQ(OPRT_OK, tal_workq_init());
+        ASSERT_EQ(OPRT_OK, dp_sched_init(send_cb));
+    }
+
+    void SetUp() override
+    {
+        std::string schema = s_schema;
+        dp_schema_t *out = NULL;
+
+        devid_ = std::string("sched_") + ::testing::UnitTest::GetInstance()->current_test_info()->name();
+        devid_.resize(DEV_ID_LEN < devid_.size() ? DEV_ID_LEN : devid_.size());
+        ASSERT_EQ(OPRT_OK, dp_schema_create((char *)devid_.c_str(), (char *)schema.c_str(), &out));
+        // let the rate limit forget the earlier tests
+        tal_system_sleep(1000);
+        std::lock_guard<std::mutex> guard(s_lock);
+        s_sent.clear();
+        s_done.clear();
+    }
+
+    void TearDown() override
+    {
+        dp_sched_clear(devid_.c_str());
+        dp_schema_delete((char *)devid_.c_str());
+    }
+
+    std::string devid_;
+};
+
+} // namespace
+
+TEST_F(DpSchedTest, KeepsTheLatestValueOfEachDp)
+{
+    dp_obj_t first[] = {dp_value(1, 10), dp_bool(3, true)};
+    dp_obj_t second[] = {dp_value(1, 11), dp_value(2, 20)};
+
+    ASSERT_EQ(OPRT_OK, dp_sched_push(devid_.c_str(), first, 2, 0, done_cb, (void *)1));
+    ASSERT_EQ(OPRT_OK, dp_sched_push(devid_.c_str(), second, 2, 0, done_cb, (void *)2));
+    EXPECT_EQ(0, sent_count());
+
+    ASSERT_TRUE(wait_sent(1, DP_REPORT_SCHED_WINDOW_MS + 500));
+    tal_system_sleep(50);
+
+    std::lock_guard<std::mutex> guard(s_lock);
+    ASSERT_EQ(1, s_sent.size());
+    EXPECT_EQ(devid_, s_sent[0].devid);
+    EXPECT_EQ((std::map<int, std::string>{{1, "11"}, {2, "20"}, {3, "true"}}), s_sent[0].dps);
+    ASSERT_EQ(2, s_done.size());
+    EXPECT_EQ(std::make_pair(1L, (int)OPRT_OK), s_done[0]);
+    EXPECT_EQ(std::make_pair(2L, (int)OPRT_OK), s_done[1]);
+}
+
+TEST_F(DpSchedTest, ImmediateReportTakesThePendingOnes)
+{
+    dp_obj_t pending[] = {dp_value(1, 1)};
+    dp_obj_t alarm[] = {dp_bool(3, true)};
+
+    ASSERT_EQ(OPRT_OK, dp_sched_push(devid_.c_str(), pending, 1, 0, done_cb, (void *)1));
+    ASSERT_EQ(OPRT_OK, dp_sched_push(devid_.c_str(), alarm, 1, DP_REPT_IMMEDIATE_FLAG, done_cb, (void *)2));
+
+    std::lock_guard<std::mutex> guard(s_lock);
+    ASSERT_EQ(1, s_sent.size());
+    EXPECT_EQ((std::map<int, std::string>{{1, "1"}, {3, "true"}}), s_sent[0].dps);
+    EXPECT_EQ(0, s_sent[0].flags & DP_REPT_IMMEDIATE_FLAG);
+    EXPECT_EQ(2, s_done.size());
+}
+
+TEST_F(DpSchedTest, DirectTriggerAndMarkedDpsAreSentAtOnce)
+{
+    dp_obj_t direct[] = {dp_bool(5, true)};
+    dp_obj_t marked[] = {dp_value(2, 7)};
+
+    ASSERT_EQ(OPRT_OK, dp_sched_push(devid_.c_str(), direct, 1, 0, NULL, NULL));
+    EXPECT_EQ(1, sent_count());
+
+    ASSERT_EQ(OPRT_OK, dp_sched_immediate_set(devid_.c_str(), 2, true));
+    ASSERT_EQ(OPRT_OK, dp_sched_push(devid_.c_str(), marked, 1, 0, NULL, NULL));
+    EXPECT_EQ(2, sent_count());
+    ASSERT_EQ(OPRT_OK, dp_sched_immediate_set(devid_.c_str(), 2, false));
+}
+
+TEST_F(DpSchedTest, TypeMismatchFailsWithoutNotify)
+{
+    dp_obj_t wrong[] = {dp_bool(1, true)};
+
+    EXPECT_EQ(OPRT_SVC_DP_TP_NOT_MATCH, dp_sched_push(devid_.c_str(), wrong, 1, 0, done_cb, (void *)1));
+    dp_sched_flush(devid_.c_str());
+    EXPECT_EQ(0, sent_count());
+    EXPECT_TRUE(s_done.empty());
+}
+
+TEST_F(DpSchedTest, FailedCopyMergesNothing)
+{
+    dp_obj_t pending[] = {dp_value(1, 1), dp_value(2, 2)};
+    std::string text(FAIL_ALLOC_SIZE - 1, 's');
+    dp_obj_t str = {};
+    str.id = 4;
+    str.type = PROP_STR;
+    str.value.dp_str = (char *)text.c_str();
+    // the string is copied after the value of DP 1
+    dp_obj_t report[] = {dp_value(1, 100), str};
+
+    ASSERT_EQ(OPRT_OK, dp_sched_push(devid_.c_str(), pending, 2, 0, done_cb, (void *)1));
+    dp_sched_stats_t before, after;
+    dp_sched_stats(&before);
+
+    MOCKER(tal_malloc).stubs().will(invoke(failing_malloc));
+    EXPECT_EQ(OPRT_MALLOC_FAILED, dp_sched_push(devid_.c_str(), report, 2, 0, done_cb, (void *)2));
+    GlobalMockObject::verify();
+
+    // neither the value of DP 1 went in nor was the report counted
+    dp_sched_stats(&after);
+    EXPECT_EQ(before.reports, after.reports);
+    EXPECT_EQ(before.merged, after.merged);
+    dp_sched_flush(devid_.c_str());
+
+    std::lock_guard<std::mutex> guard(s_lock);
+    ASSERT_EQ(1, s_sent.size());
+    EXPECT_EQ((std::map<int, std::string>{{1, "1"}, {2, "2"}}), s_sent[0].dps);
+    ASSERT_EQ(1, s_done.size());
+    EXPECT_EQ(std::make_pair(1L, (int)OPRT_OK), s_done[0]);
+}
+
+TEST_F(DpSchedTest, ClearCompletesThePendingReports)
+{
+    dp_obj_t dps[] = {dp_value(1, 1)};
+
+    ASSERT_EQ(OPRT_OK, dp_sched_push(devid_.c_str(), dps, 1, 0, done_cb, (void *)1));
+    ASSERT_EQ(OPRT_OK, dp_sched_push(devid_.c_str(), dps, 1, 0, done_cb, (void *)2));
+    dp_sched_clear(devid_.c_str());
+
+    tal_system_sleep(DP_REPORT_SCHED_WINDOW_MS + 100);
+    std::lock_guard<std::mutex> guard(s_lock);
+    EXPECT_TRUE(s_sent.empty());
+    ASSERT_EQ(2, s_done.size());
+    EXPECT_EQ(std::make_pair(1L, (int)OPRT_COM_ERROR), s_done[0]);
+    EXPECT_EQ(std::make_pair(2L, (int)OPRT_COM_ERROR), s_done[1]);
+}
+
+TEST_F(DpSchedTest, SensorWorkload)
+{
+    dp_sched_stats_t before, after;
+    const int duration_ms = 4000;
+    long reports = 0;
+    int last[3] = {0};
+
+    dp_sched_stats(&before);
+    SYS_TIME_T start = tal_system_get_millisecond();
+    for (int tick = 0; tal_system_get_millisecond() - start < duration_ms; tick++) {
+        // three sensor DPs every 100 ms, a string every second
+        last[0] = tick % 1000;
+        last[1] = (tick * 7) % 1000;
+        last[2] = tick & 1;
+        dp_obj_t dps[] = {dp_value(1, last[0]), dp_value(2, last[1]), dp_bool(3, last[2])};
+        ASSERT_EQ(OPRT_OK, dp_sched_push(devid_.c_str(), dps, 3, 0, done_cb, (void *)reports++));
+        if (0 == tick % 10) {
+            dp_obj_t str = {};
+            str.id = 4;
+            str.type = PROP_STR;
+            str.value.dp_str = (char *)"sensor status";
+            ASSERT_EQ(OPRT_OK, dp_sched_push(devid_.c_str(), &str, 1, 0, done_cb, (void *)reports++));
+        }
+        tal_system_sleep(100);
+    }
+    dp_sched_flush(devid_.c_str());
+    dp_sched_stats(&after);
+
+    std::lock_guard<std::mutex> guard(s_lock);
+    ASSERT_FALSE(s_sent.empty());
+    EXPECT_EQ(reports, (long)s_done.size());
+    for (auto &done : s_done) {
+        EXPECT_EQ(OPRT_OK, done.second);
+    }
+
+    // no second holds more windowed reports than the rate cap, the flush aside
+    for (size_t i = DP_REPORT_SCHED_MAX_RATE; i + 1 < s_sent.size(); i++) {
+        EXPECT_GE(s_sent[i].time - s_sent[i - DP_REPORT_SCHED_MAX_RATE].time, 1000 - 20);
+    }
+
+    // the last values reported are the ones that went out last
+    std::map<int, std::string> latest;
+    for (auto &sent : s_sent) {
+        for (auto &dp : sent.dps) {
+            latest[dp.first] = dp.second;
+        }
+    }
+    EXPECT_EQ(std::to_string(last[0]), latest[1]);
+    EXPECT_EQ(std::to_string(last[1]), latest[2]);
+    EXPECT_EQ(last[2] ? "true" : "false", latest[3]);
+
+    uint32_t frames = after.frames - before.frames;
+    EXPECT_EQ(s_sent.size(), frames);
+    EXPECT_LT(frames, reports / 2);
+    EXPECT_GT(after.merged, before.merged);
+    EXPECT_GT(after.bytes_saved, before.bytes_saved);
+    printf("[   INFO   ] %ld reports in %u frames, %u values merged, %u bytes saved\n", reports, frames,
+           after.merged - before.merged, after.bytes_saved - before.bytes_saved);
+}
+
+#endif
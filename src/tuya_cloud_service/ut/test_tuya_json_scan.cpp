@@ -0,0 +1,129 @@
+/**
+ * @file test_tuya_json_scan.cpp
+ * @brief unit test and benchmark of the in-place JSON scanner
+ */
+#include <chrono>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "cJSON.h"
+#include "tuya_json_scan.h"
+
+namespace {
+
+bool valid(const std::string &json)
+{
+    json_scan_value_t root;
+    return OPRT_OK == json_scan_root(json.data(), json.size(), &root);
+}
+
+json_scan_value_t root_of(const std::string &json)
+{
+    json_scan_value_t root = {};
+    EXPECT_EQ(OPRT_OK, json_scan_root(json.data(), json.size(), &root)) << json;
+    return root;
+}
+
+const char *s_reset_msg = "{\"protocol\":11,\"t\":1700000000,\"data\":{\"gwId\":\"6c1234567890abcdefgh\","
+                          "\"type\":\"reset_factory\"}}";
+const char *s_upgrade_msg =
+    "{\"protocol\":15,\"t\":1700000000,\"data\":{\"firmwareType\":0,\"url\":"
+    "\"https:\\/\\/fireware.tuyaus.com\\/smart\\/firmware\\/upgrade\\/2024\\/07\\/01\\/ota.bin\","
+    "\"hmac\":\"0F5A1B2C3D4E5F60718293A4B5C6D7E8F90A1B2C3D4E5F60718293A4B5C6D7E8\",\"version\":\"1.0.2\","
+    "\"size\":\"1048576\",\"fileSize\":1048576,\"md5\":\"b2a6f7d9e1c3a5b7d9e1f3a5c7e9b1d3\"}}";
+
+} // namespace
+
+TEST(JsonScan, Validity)
+{
+    const char *good[] = {
+        "{}", " { } ", "[]", "0", "-1.5e+3", "\"a\\u00e9\\n\"", "true", "null",
+        "{\"a\":[1,{\"b\":[]},\"x\"],\"c\":{\"d\":false}}", "[[[[[]]]]]",
+    };
+    const char *bad[] = {
+        "", "{", "}", "{\"a\"}", "{\"a\":}", "{\"a\":1,}", "[1,]", "01", "1.", "-", "\"abc", "\"\\x\"",
+        "{\"a\":1}}", "tru", "{'a':1}", "[1 2]", "\"\\u12g4\"", "{\"a\":1 \"b\":2}",
+    };
+
+    for (auto json : good) {
+        EXPECT_TRUE(valid(json)) << json;
+    }
+    for (auto json : bad) {
+        EXPECT_FALSE(valid(json)) << json;
+    }
+}
+
+TEST(JsonScan, MembersAndValues)
+{
+    std::string json = "{\"protocol\":4,\"t\":-12.9,\"data\":{\"dps\":{\"1\":true}},\"s\":\"a\\/b\\u00e9\","
+                       "\"arr\":[1,2],\"n\":null}";
+    json_scan_value_t root = root_of(json), value;
+    char buf[16];
+    int num = 0;
+
+    ASSERT_EQ(OPRT_OK, json_scan_find(&root, "protocol", &value));
+    ASSERT_EQ(OPRT_OK, json_scan_int(&value, &num));
+    EXPECT_EQ(4, num);
+    ASSERT_EQ(OPRT_OK, json_scan_find(&root, "t", &value));
+    ASSERT_EQ(OPRT_OK, json_scan_int(&value, &num));
+    EXPECT_EQ(-12, num);
+
+    ASSERT_EQ(OPRT_OK, json_scan_find(&root, "data", &value));
+    EXPECT_EQ(JSON_SCAN_OBJECT, value.type);
+    EXPECT_EQ("{\"dps\":{\"1\":true}}", std::string(value.ptr, value.len));
+
+    ASSERT_EQ(OPRT_OK, json_scan_find(&root, "s", &value));
+    EXPECT_EQ(JSON_SCAN_STRING, value.type);
+    EXPECT_TRUE(json_scan_equal(&value, "a\\/b\\u00e9"));
+    ASSERT_EQ(OPRT_OK, json_scan_string(&value, buf, sizeof(buf)));
+    EXPECT_STREQ("a/b\xc3\xa9", buf);
+    EXPECT_EQ(OPRT_BUFFER_NOT_ENOUGH, json_scan_string(&value, buf, 4));
+
+    ASSERT_EQ(OPRT_OK, json_scan_find(&root, "arr", &value));
+    EXPECT_EQ(JSON_SCAN_ARRAY, value.type);
+    ASSERT_EQ(OPRT_OK, json_scan_find(&root, "n", &value));
+    EXPECT_EQ(JSON_SCAN_NULL, value.type);
+    EXPECT_EQ(OPRT_NOT_FOUND, json_scan_find(&root, "missing", &value));
+
+    // members come in text order
+    json_scan_t scan;
+    json_scan_value_t key;
+    std::string keys;
+    ASSERT_EQ(OPRT_OK, json_scan_begin(&scan, &root));
+    while (OPRT_OK == json_scan_next(&scan, &key, &value)) {
+        keys += std::string(key.ptr, key.len) + ",";
+    }
+    EXPECT_EQ("protocol,t,data,s,arr,n,", keys);
+}
+
+TEST(JsonScan, BenchScanVsCjson)
+{
+    const int loops = 20000;
+
+    for (const char *msg : {s_reset_msg, s_upgrade_msg}) {
+        size_t len = strlen(msg);
+        json_scan_value_t root, data, value;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < loops; i++) {
+            ASSERT_EQ(OPRT_OK, json_scan_root(msg, len, &root));
+            ASSERT_EQ(OPRT_OK, json_scan_find(&root, "protocol", &value));
+            ASSERT_EQ(OPRT_OK, json_scan_find(&root, "data", &data));
+        }
+        auto scan_cost = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < loops; i++) {
+            cJSON *json = cJSON_Parse(msg);
+            ASSERT_NE(nullptr, json);
+            cJSON_Delete(json);
+        }
+        auto cjson_cost = std::chrono::steady_clock::now() - start;
+
+        printf("%4zu B message: scan %6.0f ns, cJSON_Parse %6.0f ns\n", len,
+               std::chrono::duration<double, std::nano>(scan_cost).count() / loops,
+               std::chrono::duration<double, std::nano>(cjson_cost).count() / loops);
+    }
+}
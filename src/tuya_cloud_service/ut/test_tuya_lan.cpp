@@ -0,0 +1,462 @@
+/**
+ * @file test_tuya_lan.cpp
+ * @brief unit test and load test of the LAN session table, with lpv3.5
+ * clients on loopback that agree a session key as the APP does
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+#include "mockcpp/mockcpp.hpp"
+
+#include "tuya_cloud_types.h"
+#include "tal_system.h"
+#include "tal_time_service.h"
+#include "tal_memory.h"
+#include "tal_hash.h"
+#include "cipher_wrapper.h"
+#include "tuya_protocol.h"
+#include "tuya_lan.h"
+
+USING_MOCKCPP_NS
+
+namespace {
+
+// same as tuya_lan.c
+const uint16_t s_serv_port = 6668;   // SERV_PORT_TCP
+const TIME_T s_heart_timeout = 30;   // HEART_BEAT_TIMEOUT
+const char *s_localkey = "lan0test1key2abc";
+
+// an odd frame size, so a full socket cuts frames rather than taking them whole
+const uint32_t s_big_len = 1777;
+
+tuya_iot_client_t s_client;
+
+struct Frame {
+    uint32_t sequence;
+    uint32_t type;
+    std::vector<uint8_t> data; // after the ret_code
+};
+
+// the APP side of a LAN session
+class LanClient {
+  public:
+    ~LanClient()
+    {
+        close_link();
+    }
+
+    // a small receive buffer lets the device fill the link quickly
+    bool open(int rcvbuf = 0)
+    {
+        struct sockaddr_in addr = {};
+
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd_ < 0) {
+            return false;
+        }
+        if (rcvbuf) {
+            setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        }
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(s_serv_port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd_, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            return false;
+        }
+
+        return handshake();
+    }
+
+    void close_link()
+    {
+        if (fd_ >= 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    bool send_frame(uint32_t type, const uint8_t *data, uint32_t len, const uint8_t *key)
+    {
+        static const uint8_t empty = 0;
+        lpv35_frame_object_t frame = {};
+        int olen = 0;
+
+        frame.sequence = ++sequence_;
+        frame.type = type;
+        frame.data = (uint8_t *)(len ? data : &empty);
+        frame.data_len = len;
+        std::vector<uint8_t> buf(lpv35_frame_buffer_size_get(&frame));
+
+        if (OPRT_OK != lpv35_frame_serialize(key, 16, &frame, buf.data(), &olen)) {
+            return false;
+        }
+        return write(fd_, buf.data(), olen) == olen;
+    }
+
+    bool heartbeat()
+    {
+        return send_frame(FRM_TP_HB, NULL, 0, session_key_);
+    }
+
+    // the next frame of the device, false on timeout, close or a bad frame
+    bool read_frame(Frame *out, int timeout_ms = 2000)
+    {
+        return read_frame(out, ready_ ? session_key_ : (const uint8_t *)s_localkey, timeout_ms);
+    }
+
+    // the socket of the session on the device side
+    int device_fd() const
+    {
+        struct sockaddr_in mine = {}, peer = {};
+        socklen_t len = sizeof(mine);
+
+        getsockname(fd_, (struct sockaddr *)&mine, &len);
+        for (int fd = 3; fd < 4096; fd++) {
+            len = sizeof(peer);
+            if (fd != fd_ && 0 == getpeername(fd, (struct sockaddr *)&peer, &len) && peer.sin_family == AF_INET &&
+                peer.sin_port == mine.sin_port && peer.sin_addr.s_addr == mine.sin_addr.s_addr) {
+                return fd;
+            }
+        }
+        return -1;
+    }
+
+    // true once the device closed the link, after the frames it had sent
+    bool closed_by_device(int timeout_ms)
+    {
+        Frame frame;
+        auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+        while (std::chrono::steady_clock::now() < end) {
+            if (!read_frame(&frame, 100) && eof_) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+    bool handshake()
+    {
+        const uint8_t *localkey = (const uint8_t *)s_localkey;
+        uint8_t rand_a[16], rand_b[16], hmac[32], tag[16];
+        Frame frame;
+
+        for (uint8_t &byte : rand_a) {
+            byte = (uint8_t)rand();
+        }
+        if (!send_frame(FRM_SECURITY_TYPE3, rand_a, sizeof(rand_a), localkey) || !read_frame(&frame) ||
+            FRM_SECURITY_TYPE4 != frame.type || frame.data.size() != sizeof(rand_b) + sizeof(hmac)) {
+            return false;
+        }
+        memcpy(rand_b, frame.data.data(), sizeof(rand_b));
+        tal_sha256_mac(localkey, 16, rand_a, sizeof(rand_a), hmac);
+        if (0 != memcmp(hmac, frame.data.data() + sizeof(rand_b), sizeof(hmac))) {
+            return false;
+        }
+        tal_sha256_mac(localkey, 16, rand_b, sizeof(rand_b), hmac);
+        if (!send_frame(FRM_SECURITY_TYPE5, hmac, sizeof(hmac), localkey)) {
+            return false;
+        }
+
+        // the device encrypts randA ^ randB with the local key, nonce randA
+        for (int i = 0; i < 16; i++) {
+            session_key_[i] = rand_a[i] ^ rand_b[i];
+        }
+        size_t olen = 0;
+        cipher_params_t params = {};
+        params.cipher_type = MBEDTLS_CIPHER_AES_128_GCM;
+        params.key = (unsigned char *)localkey;
+        params.key_len = 16;
+        params.nonce = rand_a;
+        params.nonce_len = LPV35_FRAME_NONCE_SIZE;
+        params.data = session_key_;
+        params.data_len = sizeof(session_key_);
+        if (OPRT_OK != mbedtls_cipher_auth_encrypt_wrapper(&params, session_key_, &olen, tag, sizeof(tag))) {
+            return false;
+        }
+        ready_ = true;
+
+        // the answer to a heartbeat comes under the session key
+        return heartbeat() && read_frame(&frame) && FRM_TP_HB == frame.type;
+    }
+
+    bool read_frame(Frame *out, const uint8_t *key, int timeout_ms)
+    {
+        const size_t fixed = LPV35_FRAME_HEAD_SIZE + sizeof(lpv35_fixed_head_t);
+
+        while (true) {
+            if (rx_.size() >= fixed) {
+                lpv35_fixed_head_t head;
+                memcpy(&head, rx_.data() + LPV35_FRAME_HEAD_SIZE, sizeof(head));
+                size_t frame_len = fixed + ntohl(head.length) + LPV35_FRAME_TAIL_SIZE;
+                if (rx_.size() >= frame_len) {
+                    return take_frame(out, key, frame_len);
+                }
+            }
+
+            struct pollfd pfd = {fd_, POLLIN, 0};
+            if (poll(&pfd, 1, timeout_ms) <= 0) {
+                return false;
+            }
+            uint8_t buf[4096];
+            ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                eof_ = true;
+                return false;
+            }
+            rx_.insert(rx_.end(), buf, buf + n);
+        }
+    }
+
+    bool take_frame(Frame *out, const uint8_t *key, size_t frame_len)
+    {
+        lpv35_frame_object_t frame = {};
+
+        int rt = lpv35_frame_parse(key, 16, rx_.data(), frame_len, &frame);
+        rx_.erase(rx_.begin(), rx_.begin() + frame_len);
+        if (OPRT_OK != rt) {
+            return false;
+        }
+        out->sequence = frame.sequence;
+        out->type = frame.type;
+        // the device prefixes its data with a ret_code
+        size_t skip = std::min<size_t>(sizeof(lpv35_plaintext_data_t), frame.data_len);
+        out->data.assign(frame.data + skip, frame.data + frame.data_len);
+        tal_free(frame.data);
+        return true;
+    }
+
+    int fd_ = -1;
+    uint32_t sequence_ = 0;
+    uint8_t session_key_[16] = {};
+    bool ready_ = false;
+    bool eof_ = false;
+    std::vector<uint8_t> rx_;
+};
+
+std::vector<uint8_t> big_payload(uint32_t index)
+{
+    std::vector<uint8_t> payload(s_big_len);
+
+    for (uint32_t i = 0; i < s_big_len; i++) {
+        payload[i] = (uint8_t)(index * 31 + i);
+    }
+    return payload;
+}
+
+// send to a client that does not read until its queue is full, returns the frames taken
+int fill_queue(int device_fd, int *last_rt)
+{
+    int taken = 0;
+
+    for (int i = 0; i < 100000; i++) {
+        std::vector<uint8_t> payload = big_payload(taken);
+        *last_rt = tuya_lan_data_com_send(device_fd, 0, FRM_TP_STAT_REPORT, 0, payload.data(), payload.size());
+        if (OPRT_OK != *last_rt) {
+            break;
+        }
+        taken++;
+    }
+    return taken;
+}
+
+// the session time moves with the wall clock plus a jump the test controls
+TIME_T s_clock_base;
+std::chrono::steady_clock::time_point s_clock_start;
+std::atomic<TIME_T> s_clock_jump;
+
+TIME_T shifted_posix(void)
+{
+    auto elapsed = std::chrono::steady_clock::now() - s_clock_start;
+    return s_clock_base + (TIME_T)std::chrono::duration_cast<std::chrono::seconds>(elapsed).count() + s_clock_jump;
+}
+
+class TuyaLanTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        signal(SIGPIPE, SIG_IGN);
+        memset(&s_client, 0, sizeof(s_client));
+        s_client.is_activated = true;
+        strcpy(s_client.activate.localkey, s_localkey);
+        ASSERT_EQ(OPRT_OK, tuya_lan_init(&s_client));
+        // let the loop reach its first wait
+        tal_system_sleep(100);
+    }
+
+    static void TearDownTestSuite()
+    {
+        // unregister the sockets of the service before it is freed
+        tuya_lan_disconnect_all();
+        tal_system_sleep(200);
+        tuya_lan_exit();
+    }
+
+    void TearDown() override
+    {
+        GlobalMockObject::verify();
+        // the sessions of the closed clients go at the next loop pass
+        for (int i = 0; i < 300 && tuya_lan_get_connect_client_num(); i++) {
+            tal_system_sleep(10);
+        }
+        tal_system_sleep(1100);
+    }
+};
+
+} // namespace
+
+TEST_F(TuyaLanTest, FullQueueIsRefused)
+{
+    LanClient client;
+    ASSERT_TRUE(client.open(4096));
+    int device_fd = client.device_fd();
+    ASSERT_GE(device_fd, 0);
+
+    // the client reads nothing, the socket fills and then the queue
+    int last_rt = OPRT_OK;
+    int taken = fill_queue(device_fd, &last_rt);
+    EXPECT_EQ(OPRT_EXCEED_UPPER_LIMIT, last_rt);
+    EXPECT_GT(taken, 0);
+
+    // still refused without blocking, the session stays up
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> payload = big_payload(0);
+    EXPECT_EQ(OPRT_EXCEED_UPPER_LIMIT,
+              tuya_lan_data_com_send(device_fd, 0, FRM_TP_STAT_REPORT, 0, payload.data(), payload.size()));
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+    EXPECT_EQ(1, tuya_lan_get_connect_client_num());
+
+    EXPECT_EQ(OPRT_INVALID_PARM, tuya_lan_data_com_send(-1, 0, FRM_TP_STAT_REPORT, 0, payload.data(), 1));
+}
+
+TEST_F(TuyaLanTest, CutFramesAreResumedIntact)
+{
+    LanClient client;
+    ASSERT_TRUE(client.open(4096));
+    int device_fd = client.device_fd();
+    ASSERT_GE(device_fd, 0);
+
+    int last_rt = OPRT_OK;
+    int taken = fill_queue(device_fd, &last_rt);
+    ASSERT_EQ(OPRT_EXCEED_UPPER_LIMIT, last_rt);
+
+    // the frame in the socket when it filled was cut, the loop sends the rest
+    // and the queue behind it once the client reads
+    Frame frame;
+    uint32_t first_sequence = 0;
+    for (int i = 0; i < taken; i++) {
+        ASSERT_TRUE(client.read_frame(&frame)) << "frame " << i << " of " << taken;
+        if (0 == i) {
+            first_sequence = frame.sequence;
+        }
+        EXPECT_EQ(first_sequence + i, frame.sequence);
+        EXPECT_EQ((uint32_t)FRM_TP_STAT_REPORT, frame.type);
+        ASSERT_EQ(big_payload(i), frame.data) << "frame " << i;
+    }
+
+    // the queue drained, frames are taken again
+    std::vector<uint8_t> payload = big_payload(taken);
+    ASSERT_EQ(OPRT_OK, tuya_lan_data_com_send(device_fd, 0, FRM_TP_STAT_REPORT, 0, payload.data(), payload.size()));
+    ASSERT_TRUE(client.read_frame(&frame));
+    EXPECT_EQ(first_sequence + taken, frame.sequence);
+    EXPECT_EQ(payload, frame.data);
+}
+
+TEST_F(TuyaLanTest, StalledSessionIsClosedAfterHeartTimeout)
+{
+    s_clock_base = tal_time_get_posix();
+    s_clock_start = std::chrono::steady_clock::now();
+    s_clock_jump = 0;
+    MOCKER(tal_time_get_posix).stubs().will(invoke(shifted_posix));
+
+    LanClient stalled, reader;
+    ASSERT_TRUE(stalled.open(4096));
+    ASSERT_TRUE(reader.open());
+    int last_rt = OPRT_OK;
+    fill_queue(stalled.device_fd(), &last_rt);
+    ASSERT_EQ(OPRT_EXCEED_UPPER_LIMIT, last_rt);
+
+    // both keep up their heartbeats, so only the queue of one makes no progress
+    Frame frame;
+    const TIME_T step = s_heart_timeout / 3 + 1;
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(2, tuya_lan_get_connect_client_num()) << "closed before " << i * step << " s";
+        s_clock_jump += step;
+        ASSERT_TRUE(stalled.heartbeat());
+        ASSERT_TRUE(reader.heartbeat());
+        ASSERT_TRUE(reader.read_frame(&frame));
+        EXPECT_EQ((uint32_t)FRM_TP_HB, frame.type);
+    }
+
+    EXPECT_TRUE(stalled.closed_by_device(3000));
+    EXPECT_EQ(1, tuya_lan_get_connect_client_num());
+    ASSERT_TRUE(reader.heartbeat());
+    ASSERT_TRUE(reader.read_frame(&frame));
+    EXPECT_EQ((uint32_t)FRM_TP_HB, frame.type);
+}
+
+TEST_F(TuyaLanTest, BenchmarkFanOut)
+{
+    const uint32_t clients = tuya_lan_get_client_num();
+    const int reports = 2000;
+    std::vector<LanClient> links(clients);
+    std::vector<std::vector<double>> latency_us(clients);
+
+    for (uint32_t i = 0; i < clients; i++) {
+        ASSERT_TRUE(links[i].open()) << "client " << i;
+    }
+    ASSERT_EQ((int)clients, tuya_lan_get_connect_client_num());
+
+    // each report carries the time it was sent
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < clients; i++) {
+        threads.emplace_back([&, i] {
+            Frame frame;
+            for (int r = 0; r < reports && links[i].read_frame(&frame); r++) {
+                int64_t sent_ns = 0;
+                memcpy(&sent_ns, frame.data.data(), sizeof(sent_ns));
+                int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count();
+                latency_us[i].push_back((now_ns - sent_ns) / 1e3);
+            }
+        });
+    }
+    for (int r = 0; r < reports; r++) {
+        uint8_t payload[64] = {0};
+        int64_t now_ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        memcpy(payload, &now_ns, sizeof(now_ns));
+        ASSERT_EQ(OPRT_OK, tuya_lan_data_report(FRM_TP_STAT_REPORT, 0, payload, sizeof(payload)));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (uint32_t i = 0; i < clients; i++) {
+        EXPECT_EQ((size_t)reports, latency_us[i].size()) << "client " << i << " lost frames";
+        all.insert(all.end(), latency_us[i].begin(), latency_us[i].end());
+    }
+    ASSERT_FALSE(all.empty());
+    std::sort(all.begin(), all.end());
+    printf("[   INFO   ] %u clients x %d reports: %.0f frames/s, latency p50 %.0f us, p99 %.0f us, max %.0f us\n",
+           clients, reports, all.size() * 1e3 / wall_ms, all[all.size() / 2], all[all.size() * 99 / 100],
+           all.back());
+}
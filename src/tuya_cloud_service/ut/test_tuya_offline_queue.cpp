@@ -0,0 +1,532 @@
+/**
+ * @file test_tuya_offline_queue.cpp
+ * @brief unit test of the offline DP report queue, alone and through the MQTT
+ * service against a stand-in broker on loopback that drops the link
+ */
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tuya_config_defaults.h"
+#include "tal_system.h"
+#include "tal_kv.h"
+#include "tuya_offline_queue.h"
+#include "mqtt_service.h"
+
+#if defined(ENABLE_MQTT_OFFLINE_QUEUE) && (ENABLE_MQTT_OFFLINE_QUEUE == 1)
+
+// same defaults as tuya_offline_queue.c
+#ifndef MQTT_OFFLINE_QUEUE_MAX
+#define MQTT_OFFLINE_QUEUE_MAX 16
+#endif
+
+#ifndef MQTT_OFFLINE_QUEUE_INTERVAL_MS
+#define MQTT_OFFLINE_QUEUE_INTERVAL_MS 200
+#endif
+
+namespace {
+
+struct Sent {
+    std::string dps;
+    mqtt_publish_notify_cb_t cb;
+    void *user_data;
+};
+
+std::vector<Sent> s_sent;
+std::vector<std::pair<long, int>> s_done;
+
+int send_cb(const char *dps, const char *time, mqtt_publish_notify_cb_t cb, void *user_data)
+{
+    s_sent.push_back({dps, cb, user_data});
+    return OPRT_OK;
+}
+
+void done_cb(int result, void *user_data)
+{
+    s_done.push_back({(long)user_data, result});
+}
+
+// drain until a report goes out, the queue keeps MQTT_OFFLINE_QUEUE_INTERVAL_MS between sends
+bool drain_one()
+{
+    size_t sent = s_sent.size();
+    for (int i = 0; i < 300 && sent == s_sent.size(); i++) {
+        tuya_offline_queue_drain(send_cb);
+        if (sent == s_sent.size()) {
+            tal_system_sleep(10);
+        }
+    }
+    return sent != s_sent.size();
+}
+
+void ack_last(int result)
+{
+    Sent sent = s_sent.back();
+    sent.cb(result, sent.user_data);
+}
+
+// an MQTT 3.1.1 broker serving one client at a time: it accepts CONNECT,
+// SUBSCRIBE and PINGREQ, records each PUBLISH and answers QoS1 with a PUBACK.
+// drop() resets the link, while down() is set new connections are reset too.
+class BrokerStandIn {
+  public:
+    struct Publish {
+        std::string payload;
+        SYS_TIME_T at;
+        int link; // connection it arrived on
+    };
+
+    BrokerStandIn()
+    {
+        struct sockaddr_in addr = {};
+        socklen_t len = sizeof(addr);
+        int on = 1;
+
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listen_fd_, (struct sockaddr *)&addr, sizeof(addr));
+        listen(listen_fd_, 4);
+        getsockname(listen_fd_, (struct sockaddr *)&addr, &len);
+        port_ = ntohs(addr.sin_port);
+        thread_ = std::thread([this] { run(); });
+    }
+
+    ~BrokerStandIn()
+    {
+        stop_ = true;
+        shutdown(listen_fd_, SHUT_RDWR);
+        close(listen_fd_);
+        thread_.join();
+    }
+
+    uint16_t port() const
+    {
+        return port_;
+    }
+
+    // reset the link now
+    void drop()
+    {
+        drop_ = true;
+    }
+
+    std::vector<Publish> published()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return published_;
+    }
+
+    std::atomic<bool> down{false};      // connections are reset as they come
+    std::atomic<int> drop_at_publish{0}; // reset the link instead of the PUBACK of this publish, 1 based
+    std::atomic<int> links{0};          // CONNECTs answered
+
+  private:
+    static void reset(int fd)
+    {
+        struct linger lg = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        close(fd);
+    }
+
+    bool read_all(int fd, uint8_t *buf, size_t len)
+    {
+        while (len) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            if (drop_ || stop_) {
+                return false;
+            }
+            if (poll(&pfd, 1, 10) <= 0) {
+                continue;
+            }
+            ssize_t n = read(fd, buf, len);
+            if (n <= 0) {
+                return false;
+            }
+            buf += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    void serve(int fd)
+    {
+        uint8_t type;
+
+        while (read_all(fd, &type, 1)) {
+            uint32_t length = 0;
+            uint8_t byte;
+            for (int shift = 0; shift < 28; shift += 7) {
+                if (!read_all(fd, &byte, 1)) {
+                    return reset(fd);
+                }
+                length |= (uint32_t)(byte & 0x7F) << shift;
+                if (0 == (byte & 0x80)) {
+                    break;
+                }
+            }
+            std::vector<uint8_t> body(length);
+            if (length && !read_all(fd, body.data(), length)) {
+                break;
+            }
+
+            switch (type >> 4) {
+            case 1: { // CONNECT
+                const uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+                links++;
+                write(fd, connack, sizeof(connack));
+                break;
+            }
+            case 3: { // PUBLISH
+                uint8_t qos = (type >> 1) & 0x03;
+                size_t topic_len = (body[0] << 8) | body[1];
+                size_t offset = 2 + topic_len + (qos ? 2 : 0);
+                int count = 0;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    published_.push_back({std::string(body.begin() + offset, body.end()),
+                                          tal_system_get_millisecond(), links});
+                    count = (int)published_.size();
+                }
+                if (count == drop_at_publish) {
+                    return reset(fd);
+                }
+                if (qos) {
+                    const uint8_t puback[] = {0x40, 0x02, body[2 + topic_len], body[3 + topic_len]};
+                    write(fd, puback, sizeof(puback));
+                }
+                break;
+            }
+            case 8: { // SUBSCRIBE, granted QoS1
+                const uint8_t suback[] = {0x90, 0x03, body[0], body[1], 0x01};
+                write(fd, suback, sizeof(suback));
+                break;
+            }
+            case 12: { // PINGREQ
+                const uint8_t pingresp[] = {0xD0, 0x00};
+                write(fd, pingresp, sizeof(pingresp));
+                break;
+            }
+            default: // DISCONNECT
+                return reset(fd);
+            }
+        }
+        reset(fd);
+    }
+
+    void run()
+    {
+        while (!stop_) {
+            int fd = accept(listen_fd_, NULL, NULL);
+            if (fd < 0) {
+                continue;
+            }
+            if (down) {
+                reset(fd);
+                continue;
+            }
+            drop_ = false;
+            serve(fd);
+        }
+    }
+
+    int listen_fd_ = -1;
+    uint16_t port_ = 0;
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> drop_{false};
+    std::thread thread_;
+    std::mutex mutex_;
+    std::vector<Publish> published_;
+};
+
+// the device side: the real MQTT service, with the offline queue drained as tuya_iot_yield does
+tuya_mqtt_context_t s_mqtt;
+
+// PUBACK wait of the resent reports, shorter than MQTT_OFFLINE_REPORT_TIMEOUT_MS to keep the test short
+#define UT_REPORT_TIMEOUT_MS 500
+
+int mqtt_send_cb(const char *dps, const char *time, mqtt_publish_notify_cb_t cb, void *user_data)
+{
+    return tuya_mqtt_client_publish_common(&s_mqtt, s_mqtt.signature.topic_out, (const uint8_t *)dps, strlen(dps), cb,
+                                           user_data, UT_REPORT_TIMEOUT_MS, true);
+}
+
+void mqtt_open(BrokerStandIn &broker)
+{
+    tuya_mqtt_config_t config = {};
+
+    config.host = "127.0.0.1";
+    config.port = broker.port();
+    config.timeout = 20;
+    config.devid = "ut_devid";
+    config.seckey = "ut_seckey";
+    config.localkey = "0123456789abcdef";
+    ASSERT_EQ(OPRT_OK, tuya_mqtt_init(&s_mqtt, &config));
+    tuya_mqtt_start(&s_mqtt);
+}
+
+void mqtt_close()
+{
+    tuya_mqtt_stop(&s_mqtt);
+    tuya_mqtt_destory(&s_mqtt);
+}
+
+// run the device loop until done() or timeout_ms passed
+bool pump(const std::function<bool()> &done, int timeout_ms)
+{
+    SYS_TIME_T deadline = tal_system_get_millisecond() + timeout_ms;
+
+    while (!done()) {
+        if (tal_system_get_millisecond() > deadline) {
+            return false;
+        }
+        tuya_mqtt_loop(&s_mqtt);
+        if (tuya_mqtt_connected(&s_mqtt)) {
+            tuya_offline_queue_drain(mqtt_send_cb);
+        }
+    }
+    return true;
+}
+
+std::vector<std::string> payloads_of(const std::vector<BrokerStandIn::Publish> &published)
+{
+    std::vector<std::string> out;
+    for (auto &p : published) {
+        out.push_back(p.payload);
+    }
+    return out;
+}
+
+class OfflineQueueTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        tal_kv_cfg_t cfg = {};
+        memcpy(cfg.seed, "vmlkasdh93dlvlcy", TAL_LV_KEY_LEN);
+        memcpy(cfg.key, "dflfuap134ddlduq", TAL_LV_KEY_LEN);
+        tal_kv_init(&cfg);
+        ASSERT_EQ(OPRT_OK, tuya_offline_queue_init());
+        // the stand-in broker resets the link under the client's writes
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    void SetUp() override
+    {
+        tuya_offline_queue_clear();
+        s_sent.clear();
+        s_done.clear();
+    }
+};
+
+} // namespace
+
+TEST_F(OfflineQueueTest, DrainsInOrderOneAtATime)
+{
+    ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"1\":1}", "{\"1\":100}", done_cb, (void *)1));
+    ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"1\":2}", "{\"1\":101}", done_cb, (void *)2));
+    ASSERT_EQ(2, tuya_offline_queue_count());
+
+    ASSERT_TRUE(drain_one());
+    // nothing else goes out before the PUBACK of the first one
+    tal_system_sleep(MQTT_OFFLINE_QUEUE_INTERVAL_MS + 20);
+    tuya_offline_queue_drain(send_cb);
+    ASSERT_EQ(1, s_sent.size());
+    EXPECT_EQ("{\"1\":1}", s_sent[0].dps);
+
+    ack_last(OPRT_OK);
+    ASSERT_TRUE(drain_one());
+    EXPECT_EQ("{\"1\":2}", s_sent[1].dps);
+    ack_last(OPRT_OK);
+
+    EXPECT_EQ(0, tuya_offline_queue_count());
+    ASSERT_EQ(2, s_done.size());
+    EXPECT_EQ(std::make_pair(1L, (int)OPRT_OK), s_done[0]);
+    EXPECT_EQ(std::make_pair(2L, (int)OPRT_OK), s_done[1]);
+}
+
+TEST_F(OfflineQueueTest, NewerValuesCollapseOlderReports)
+{
+    ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"1\":1,\"2\":2}", NULL, done_cb, (void *)1));
+    ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"1\":3}", NULL, done_cb, (void *)2));
+    EXPECT_EQ(2, tuya_offline_queue_count());
+    EXPECT_TRUE(s_done.empty());
+
+    // the first report is left without DPs and completes
+    ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"2\":4}", NULL, done_cb, (void *)3));
+    EXPECT_EQ(2, tuya_offline_queue_count());
+    ASSERT_EQ(1, s_done.size());
+    EXPECT_EQ(std::make_pair(1L, (int)OPRT_OK), s_done[0]);
+
+    ASSERT_TRUE(drain_one());
+    EXPECT_EQ("{\"1\":3}", s_sent[0].dps);
+}
+
+TEST_F(OfflineQueueTest, FullQueueDropsOldest)
+{
+    for (long i = 0; i <= MQTT_OFFLINE_QUEUE_MAX; i++) {
+        ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"1\":1}", "{\"1\":100}", done_cb, (void *)i));
+    }
+    EXPECT_EQ(MQTT_OFFLINE_QUEUE_MAX, tuya_offline_queue_count());
+    ASSERT_EQ(1, s_done.size());
+    EXPECT_EQ(std::make_pair(0L, (int)OPRT_EXCEED_UPPER_LIMIT), s_done[0]);
+}
+
+TEST_F(OfflineQueueTest, ClearCompletesEveryReport)
+{
+    ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"1\":1}", "{\"1\":100}", done_cb, (void *)1));
+    ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"1\":2}", "{\"1\":101}", done_cb, (void *)2));
+    ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"1\":3}", "{\"1\":102}", done_cb, (void *)3));
+    ASSERT_TRUE(drain_one());
+
+    // the owners get their user_data back, the one in flight too
+    tuya_offline_queue_clear();
+    EXPECT_EQ(0, tuya_offline_queue_count());
+    ASSERT_EQ(3, s_done.size());
+    for (long i = 0; i < 3; i++) {
+        EXPECT_EQ(std::make_pair(i + 1, (int)OPRT_COM_ERROR), s_done[i]);
+    }
+
+    // a late PUBACK of the cleared report is ignored
+    ack_last(OPRT_OK);
+    EXPECT_EQ(3, s_done.size());
+}
+
+TEST_F(OfflineQueueTest, BrokerDeliversInOrderAcrossReconnects)
+{
+    BrokerStandIn broker;
+    const long reports = 8;
+
+    mqtt_open(broker);
+    ASSERT_TRUE(pump([] { return tuya_mqtt_connected(&s_mqtt); }, 3000));
+
+    // history reports are never collapsed, each one must arrive, in order
+    for (long i = 0; i < reports; i++) {
+        std::string dps = "{\"1\":" + std::to_string(i) + "}";
+        std::string time = "{\"1\":" + std::to_string(1000 + i) + "}";
+        ASSERT_EQ(OPRT_OK, tuya_offline_queue_push(dps.c_str(), time.c_str(), done_cb, (void *)i));
+    }
+
+    // the third report reaches the broker but the link drops before its PUBACK,
+    // and stays down a while
+    broker.drop_at_publish = 3;
+    broker.down = true;
+    ASSERT_TRUE(pump([&] { return broker.published().size() >= 3; }, 3000));
+    ASSERT_TRUE(pump([] { return !tuya_mqtt_connected(&s_mqtt); }, 3000));
+    pump([] { return false; }, 300);
+    broker.down = false;
+
+    ASSERT_TRUE(pump([&] { return s_done.size() == (size_t)reports; }, 30000));
+    EXPECT_EQ(0, tuya_offline_queue_count());
+    EXPECT_GE(broker.links, 2);
+
+    // at least once: the unacknowledged one may arrive twice, next to itself
+    std::vector<std::string> got = payloads_of(broker.published());
+    std::vector<std::string> unique = got;
+    unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+    ASSERT_EQ((size_t)reports, unique.size());
+    for (long i = 0; i < reports; i++) {
+        EXPECT_EQ("{\"1\":" + std::to_string(i) + "}", unique[i]);
+    }
+    EXPECT_LE(got.size(), (size_t)reports + 1);
+    for (long i = 0; i < reports; i++) {
+        EXPECT_EQ(std::make_pair(i, (int)OPRT_OK), s_done[i]);
+    }
+
+    mqtt_close();
+}
+
+TEST_F(OfflineQueueTest, BrokerGetsOnlyCollapsedValuesAfterReconnect)
+{
+    BrokerStandIn broker;
+
+    mqtt_open(broker);
+    ASSERT_TRUE(pump([] { return tuya_mqtt_connected(&s_mqtt); }, 3000));
+
+    // the link goes, the reports made meanwhile collapse per DP
+    broker.down = true;
+    broker.drop();
+    ASSERT_TRUE(pump([] { return !tuya_mqtt_connected(&s_mqtt); }, 3000));
+    ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"1\":1,\"2\":1}", NULL, done_cb, (void *)1));
+    ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"1\":2}", NULL, done_cb, (void *)2));
+    ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"2\":2}", NULL, done_cb, (void *)3));
+    ASSERT_EQ(OPRT_OK, tuya_offline_queue_push("{\"3\":1}", NULL, done_cb, (void *)4));
+    EXPECT_EQ(3, tuya_offline_queue_count());
+    ASSERT_EQ(1, s_done.size());
+    EXPECT_EQ(std::make_pair(1L, (int)OPRT_OK), s_done[0]);
+
+    broker.down = false;
+    ASSERT_TRUE(pump([] { return s_done.size() == 4; }, 15000));
+
+    // a superseded value never reaches the broker
+    std::vector<std::string> expect = {"{\"1\":2}", "{\"2\":2}", "{\"3\":1}"};
+    EXPECT_EQ(expect, payloads_of(broker.published()));
+
+    mqtt_close();
+}
+
+TEST_F(OfflineQueueTest, BenchmarkDrainRateAcrossReconnect)
+{
+    BrokerStandIn broker;
+
+    mqtt_open(broker);
+    ASSERT_TRUE(pump([] { return tuya_mqtt_connected(&s_mqtt); }, 3000));
+    broker.down = true;
+    broker.drop();
+    ASSERT_TRUE(pump([] { return !tuya_mqtt_connected(&s_mqtt); }, 3000));
+
+    for (long i = 0; i < MQTT_OFFLINE_QUEUE_MAX; i++) {
+        std::string dps = "{\"1\":" + std::to_string(i) + "}";
+        ASSERT_EQ(OPRT_OK, tuya_offline_queue_push(dps.c_str(), "{\"1\":0}", done_cb, (void *)i));
+    }
+
+    // the link drops again halfway through the drain, without a PUBACK
+    int links = broker.links;
+    broker.drop_at_publish = MQTT_OFFLINE_QUEUE_MAX / 2;
+    SYS_TIME_T restored = tal_system_get_millisecond();
+    broker.down = false;
+    ASSERT_TRUE(pump([] { return s_done.size() == MQTT_OFFLINE_QUEUE_MAX; }, 60000));
+    SYS_TIME_T drained = tal_system_get_millisecond();
+
+    std::vector<BrokerStandIn::Publish> got = broker.published();
+    ASSERT_GE(got.size(), (size_t)MQTT_OFFLINE_QUEUE_MAX);
+    EXPECT_EQ(links + 2, broker.links);
+
+    // gaps between reports sent on the same link, the rate limit holds
+    SYS_TIME_T min_gap = UINT32_MAX, max_gap = 0, stall = 0;
+    for (size_t i = 1; i < got.size(); i++) {
+        SYS_TIME_T gap = got[i].at - got[i - 1].at;
+        if (got[i].link != got[i - 1].link) {
+            stall = gap;
+            continue;
+        }
+        min_gap = std::min(min_gap, gap);
+        max_gap = std::max(max_gap, gap);
+    }
+    EXPECT_GE(min_gap + 20, (SYS_TIME_T)MQTT_OFFLINE_QUEUE_INTERVAL_MS);
+
+    printf("[   INFO   ] %d reports drained in %llu ms after the link came back, %.1f reports/s\n",
+           MQTT_OFFLINE_QUEUE_MAX, (unsigned long long)(drained - restored),
+           MQTT_OFFLINE_QUEUE_MAX * 1000.0 / (drained - restored));
+    printf("[   INFO   ] gap between reports %llu..%llu ms (interval %d ms), %llu ms lost to the second drop\n",
+           (unsigned long long)min_gap, (unsigned long long)max_gap, MQTT_OFFLINE_QUEUE_INTERVAL_MS,
+           (unsigned long long)stall);
+
+    mqtt_close();
+}
+
+#endif
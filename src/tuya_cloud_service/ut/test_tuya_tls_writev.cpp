@@ -0,0 +1,458 @@
+/**
+ * @file test_tuya_tls_writev.cpp
+ * @brief unit test and benchmark of tuya_tls_writev, against an mbedtls server
+ * on the far end of a socketpair that keeps each record it reads, with a send
+ * callback that can cut the coalesced records short
+ */
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "tuya_cloud_types.h"
+#include "tal_api.h"
+#include "tuya_tls.h"
+
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+
+// same as tuya_tls.c
+#ifndef TLS_WRITEV_COALESCE_MAX
+#define TLS_WRITEV_COALESCE_MAX (16 * 1024)
+#endif
+
+// the server side needs ENABLE_MBEDTLS_SSL_SRV_C
+#if defined(MBEDTLS_SSL_SRV_C)
+
+namespace {
+
+struct Drbg {
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctx;
+
+    Drbg()
+    {
+        mbedtls_entropy_init(&entropy);
+        mbedtls_ctr_drbg_init(&ctx);
+        mbedtls_ctr_drbg_seed(&ctx, mbedtls_entropy_func, &entropy, (const unsigned char *)"ut", 2);
+    }
+
+    ~Drbg()
+    {
+        mbedtls_ctr_drbg_free(&ctx);
+        mbedtls_entropy_free(&entropy);
+    }
+};
+
+// a self-signed P-256 certificate of 127.0.0.1 and its key
+struct Identity {
+    mbedtls_pk_context key;
+    mbedtls_x509_crt crt;
+    std::string pem;
+
+    explicit Identity(Drbg &rng)
+    {
+        mbedtls_x509write_cert writer;
+        mbedtls_mpi serial;
+        unsigned char buf[2048] = {0};
+
+        mbedtls_pk_init(&key);
+        mbedtls_x509_crt_init(&crt);
+        mbedtls_x509write_crt_init(&writer);
+        mbedtls_mpi_init(&serial);
+
+        mbedtls_pk_setup(&key, mbedtls_pk_info_from_type(MBEDTLS_PK_ECKEY));
+        mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, mbedtls_pk_ec(key), mbedtls_ctr_drbg_random, &rng.ctx);
+        mbedtls_mpi_lset(&serial, 1);
+        mbedtls_x509write_crt_set_version(&writer, MBEDTLS_X509_CRT_VERSION_3);
+        mbedtls_x509write_crt_set_md_alg(&writer, MBEDTLS_MD_SHA256);
+        mbedtls_x509write_crt_set_subject_key(&writer, &key);
+        mbedtls_x509write_crt_set_issuer_key(&writer, &key);
+        mbedtls_x509write_crt_set_subject_name(&writer, "CN=127.0.0.1");
+        mbedtls_x509write_crt_set_issuer_name(&writer, "CN=127.0.0.1");
+        mbedtls_x509write_crt_set_serial(&writer, &serial);
+        mbedtls_x509write_crt_set_validity(&writer, "20200101000000", "20991231235959");
+        mbedtls_x509write_crt_set_basic_constraints(&writer, 1, 0);
+        if (0 == mbedtls_x509write_crt_pem(&writer, buf, sizeof(buf), mbedtls_ctr_drbg_random, &rng.ctx)) {
+            pem = (const char *)buf;
+            mbedtls_x509_crt_parse(&crt, (const unsigned char *)pem.c_str(), pem.size() + 1);
+        }
+
+        mbedtls_mpi_free(&serial);
+        mbedtls_x509write_crt_free(&writer);
+    }
+
+    ~Identity()
+    {
+        mbedtls_x509_crt_free(&crt);
+        mbedtls_pk_free(&key);
+    }
+};
+
+// the server end of a socketpair, it keeps the plain text of each record read
+class TlsPeer {
+  public:
+    TlsPeer(Identity &identity, Drbg &rng)
+    {
+        mbedtls_ssl_config_init(&conf_);
+        mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT);
+        mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &rng.ctx);
+        mbedtls_ssl_conf_own_cert(&conf_, &identity.crt, &identity.key);
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds_);
+        thread_ = std::thread([this] { serve(); });
+    }
+
+    ~TlsPeer()
+    {
+        shutdown(fds_[0], SHUT_RDWR);
+        thread_.join();
+        close(fds_[0]);
+        close(fds_[1]);
+        mbedtls_ssl_config_free(&conf_);
+    }
+
+    int client_fd() const
+    {
+        return fds_[0];
+    }
+
+    // bytes read from the socket, records with their headers and tags
+    size_t wire_bytes() const
+    {
+        return wire_bytes_;
+    }
+
+    std::string plain()
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        return plain_;
+    }
+
+    // plain text length of each application record
+    std::vector<size_t> records()
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        return records_;
+    }
+
+    bool wait_for(size_t len)
+    {
+        for (int i = 0; i < 5000; i++) {
+            {
+                std::lock_guard<std::mutex> guard(lock_);
+                if (plain_.size() >= len) {
+                    return true;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+
+  private:
+    static int bio_send(void *ctx, const unsigned char *buf, size_t len)
+    {
+        TlsPeer *self = (TlsPeer *)ctx;
+        ssize_t n = send(self->fds_[1], buf, len, MSG_NOSIGNAL);
+        return (n < 0) ? MBEDTLS_ERR_SSL_INTERNAL_ERROR : (int)n;
+    }
+
+    static int bio_recv(void *ctx, unsigned char *buf, size_t len)
+    {
+        TlsPeer *self = (TlsPeer *)ctx;
+        ssize_t n = recv(self->fds_[1], buf, len, 0);
+        if (n > 0) {
+            self->wire_bytes_ += n;
+        }
+        return (n < 0) ? MBEDTLS_ERR_SSL_INTERNAL_ERROR : (int)n;
+    }
+
+    void serve()
+    {
+        mbedtls_ssl_context ssl;
+        // larger than a record, a read returns one record at most
+        std::vector<unsigned char> buf(MBEDTLS_SSL_IN_CONTENT_LEN + 1024);
+        int ret = 0;
+
+        mbedtls_ssl_init(&ssl);
+        mbedtls_ssl_setup(&ssl, &conf_);
+        mbedtls_ssl_set_bio(&ssl, this, bio_send, bio_recv, NULL);
+
+        while ((ret = mbedtls_ssl_handshake(&ssl)) != 0) {
+            if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+                break;
+            }
+        }
+        while (0 == ret) {
+            int n = mbedtls_ssl_read(&ssl, buf.data(), buf.size());
+            if (n > 0) {
+                std::lock_guard<std::mutex> guard(lock_);
+                plain_.append((const char *)buf.data(), n);
+                records_.push_back(n);
+            } else if (n != MBEDTLS_ERR_SSL_WANT_READ) {
+                break;
+            }
+        }
+        mbedtls_ssl_free(&ssl);
+    }
+
+    mbedtls_ssl_config conf_;
+    int fds_[2] = {-1, -1};
+    std::thread thread_;
+    std::mutex lock_;
+    std::string plain_;
+    std::vector<size_t> records_;
+    std::atomic<size_t> wire_bytes_{0};
+};
+
+// the send callback of the client after the handshake, each send takes at
+// most max_send bytes and the send numbered want_write_at gets nothing
+struct Wire {
+    int fd = -1;
+    std::atomic<int> sends{0};
+    size_t max_send = 0;
+    int want_write_at = 0;
+};
+
+int wire_send(void *ctx, const uint8_t *buf, size_t len)
+{
+    Wire *wire = (Wire *)ctx;
+    int call = ++wire->sends;
+    if (call == wire->want_write_at) {
+        return MBEDTLS_ERR_SSL_WANT_WRITE;
+    }
+    if (wire->max_send && len > wire->max_send) {
+        len = wire->max_send;
+    }
+    ssize_t n = send(wire->fd, buf, len, MSG_NOSIGNAL);
+    return (n < 0) ? MBEDTLS_ERR_SSL_INTERNAL_ERROR : (int)n;
+}
+
+int wire_recv(void *ctx, uint8_t *buf, size_t len)
+{
+    Wire *wire = (Wire *)ctx;
+    ssize_t n = recv(wire->fd, buf, len, 0);
+    return (n < 0) ? MBEDTLS_ERR_SSL_INTERNAL_ERROR : (int)n;
+}
+
+Drbg *s_rng = NULL;
+Identity *s_identity = NULL;
+
+std::string pattern(size_t len, int seed)
+{
+    std::string s(len, '\0');
+    for (size_t i = 0; i < len; i++) {
+        s[i] = (char)(i * 7 + seed);
+    }
+    return s;
+}
+
+class TlsWritevTest : public ::testing::Test {
+  protected:
+    static void SetUpTestSuite()
+    {
+        ASSERT_EQ(OPRT_OK, tuya_tls_init());
+        s_rng = new Drbg();
+        s_identity = new Identity(*s_rng);
+        ASSERT_FALSE(s_identity->pem.empty());
+    }
+
+    static void TearDownTestSuite()
+    {
+        delete s_identity;
+        delete s_rng;
+    }
+
+    void SetUp() override
+    {
+        peer_ = new TlsPeer(*s_identity, *s_rng);
+        wire_.fd = peer_->client_fd();
+
+        tuya_tls_config_t config = {};
+        config.mode = TUYA_TLS_SERVER_CERT_MODE;
+        config.verify = true;
+        config.ca_cert = (char *)s_identity->pem.c_str();
+        config.ca_cert_size = s_identity->pem.size() + 1;
+        config.f_send = wire_send;
+        config.f_recv = wire_recv;
+        config.user_data = &wire_;
+
+        tls_ = tuya_tls_connect_create();
+        ASSERT_NE(nullptr, tls_);
+        tuya_tls_config_set(tls_, &config);
+        ASSERT_EQ(OPRT_OK, tuya_tls_connect(tls_, (char *)"127.0.0.1", 8443, peer_->client_fd(), 5));
+    }
+
+    void TearDown() override
+    {
+        if (tls_) {
+            tuya_tls_disconnect(tls_);
+            tuya_tls_connect_destroy(tls_);
+        }
+        delete peer_;
+    }
+
+    // writes the buffers, checks what the peer read and returns its new records
+    std::vector<size_t> writev(const std::vector<std::string> &bufs)
+    {
+        std::vector<tuya_transporter_iovec_t> iov;
+        std::string all;
+        for (const std::string &buf : bufs) {
+            iov.push_back({(const uint8_t *)buf.data(), (int)buf.size()});
+            all += buf;
+        }
+        size_t before = peer_->records().size();
+
+        EXPECT_EQ((int)all.size(), tuya_tls_writev(tls_, iov.data(), (int)iov.size()));
+        expected_ += all;
+        EXPECT_TRUE(peer_->wait_for(expected_.size()));
+        EXPECT_TRUE(expected_ == peer_->plain());
+
+        std::vector<size_t> records = peer_->records();
+        return std::vector<size_t>(records.begin() + before, records.end());
+    }
+
+    TlsPeer *peer_ = NULL;
+    tuya_tls_hander tls_ = NULL;
+    Wire wire_;
+    std::string expected_;
+};
+
+} // namespace
+
+TEST_F(TlsWritevTest, MixedBuffersFillWholeRecords)
+{
+    const std::vector<std::vector<size_t>> layouts = {
+        {5, 3000}, {1, 1, 1, 1}, {16, 0, 200}, {3, 5000, 7}, {16, 20000, 3}, {4096, 4096}, {100, 1, 30000, 1, 100},
+    };
+
+    // the record size the peer agreed to, a single large write fills them
+    std::vector<size_t> probe = writev({pattern(40000, 1)});
+    size_t record = 0;
+    for (size_t len : probe) {
+        record = len > record ? len : record;
+    }
+    ASSERT_GT(record, 0u);
+
+    int seed = 2;
+    for (const std::vector<size_t> &layout : layouts) {
+        std::vector<std::string> bufs;
+        size_t total = 0;
+        for (size_t len : layout) {
+            bufs.push_back(pattern(len, seed++));
+            total += len;
+        }
+        wire_.sends = 0;
+        std::vector<size_t> records = writev(bufs);
+
+        // a header goes with the start of its payload, no record is left short
+        // but the last
+        ASSERT_EQ((total + record - 1) / record, records.size()) << layout.size() << " buffers of " << total;
+        for (size_t i = 0; i + 1 < records.size(); i++) {
+            EXPECT_EQ(record, records[i]) << i;
+        }
+        // and the records go out together
+        if (total + records.size() * 64 <= TLS_WRITEV_COALESCE_MAX) {
+            EXPECT_EQ(1, wire_.sends.load()) << total;
+        }
+    }
+}
+
+TEST_F(TlsWritevTest, LargerThanCoalesceMax)
+{
+    for (size_t len : {TLS_WRITEV_COALESCE_MAX - 100, 2 * TLS_WRITEV_COALESCE_MAX + 17, 100000}) {
+        size_t wire_before = peer_->wire_bytes();
+        wire_.sends = 0;
+        std::vector<size_t> records = writev({pattern(16, 0), pattern(len, (int)len)});
+        size_t wire_len = peer_->wire_bytes() - wire_before;
+
+        size_t record = 0;
+        for (size_t n : records) {
+            record = n > record ? n : record;
+        }
+
+        // no send is larger than the coalescing buffer, with records that fit
+        // in it several times a send carries several of them
+        EXPECT_GE((size_t)wire_.sends.load(), (wire_len + TLS_WRITEV_COALESCE_MAX - 1) / TLS_WRITEV_COALESCE_MAX);
+        if (2 * (record + 64) <= TLS_WRITEV_COALESCE_MAX) {
+            EXPECT_LT((size_t)wire_.sends.load(), records.size() / 2 + 1) << len;
+        }
+    }
+}
+
+TEST_F(TlsWritevTest, ShortSendPartwayThroughCoalescedRecords)
+{
+    // each send takes a part of the held records, one of them none at all
+    wire_.max_send = 1000;
+    for (size_t len : {3000, 12000, 2 * TLS_WRITEV_COALESCE_MAX + 17}) {
+        for (int at = 1; at <= 12; at++) {
+            wire_.sends = 0;
+            wire_.want_write_at = at;
+            writev({pattern(16, at), pattern(len, (int)len + at), pattern(3, at)});
+            ASSERT_FALSE(HasFailure()) << len << " bytes, send " << at << " cut";
+        }
+    }
+    wire_.want_write_at = 0;
+    wire_.max_send = 0;
+
+    // the stream is still in order for the next writes
+    writev({pattern(16, 99), pattern(500, 99)});
+}
+
+TEST_F(TlsWritevTest, BenchmarkHeaderAndPayload)
+{
+    const int msgs = 1000;
+    uint8_t header[16];
+    memset(header, 0x48, sizeof(header));
+
+    for (size_t size : {64, 1024, 4096}) {
+        std::string payload = pattern(size, (int)size);
+        double us[2];
+        double sends[2];
+        double records[2];
+
+        for (int gathered = 0; gathered < 2; gathered++) {
+            size_t records_before = peer_->records().size();
+            wire_.sends = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < msgs; i++) {
+                if (gathered) {
+                    tuya_transporter_iovec_t iov[] = {{header, (int)sizeof(header)},
+                                                      {(const uint8_t *)payload.data(), (int)payload.size()}};
+                    ASSERT_EQ((int)(sizeof(header) + size), tuya_tls_writev(tls_, iov, 2));
+                } else {
+                    ASSERT_EQ((int)sizeof(header), tuya_tls_write(tls_, header, sizeof(header)));
+                    ASSERT_EQ((int)size, tuya_tls_write(tls_, (uint8_t *)payload.data(), size));
+                }
+            }
+            for (int i = 0; i < msgs; i++) {
+                expected_ += std::string((const char *)header, sizeof(header)) + payload;
+            }
+            ASSERT_TRUE(peer_->wait_for(expected_.size()));
+            us[gathered] =
+                std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / msgs;
+            sends[gathered] = (double)wire_.sends.load() / msgs;
+            records[gathered] = (double)(peer_->records().size() - records_before) / msgs;
+        }
+
+        EXPECT_TRUE(expected_ == peer_->plain());
+        printf("[   INFO   ] tls header+payload %5zu bytes: write x2 %7.1f us/msg %4.2f sends %4.2f records, "
+               "writev %7.1f us/msg %4.2f sends %4.2f records\n",
+               size, us[0], sends[0], records[0], us[1], sends[1], records[1]);
+        EXPECT_LT(records[1], records[0]) << size;
+        EXPECT_LT(sends[1], sends[0]) << size;
+    }
+}
+
+#endif
@@ -32,6 +32,11 @@
 #define WEATHER_API              "thing.weather.get"
 #define API_VERSION              "1.0"
 
+// seconds a response is answered from the cache, by how often the cloud updates it
+#define WEATHER_CURRENT_CACHE_TTL  (10 * 60)
+#define WEATHER_FORECAST_CACHE_TTL (60 * 60)
+#define WEATHER_CITY_CACHE_TTL     (24 * 60 * 60)
+
 /**
  * @brief Retrieves weather data from the Tuya cloud platform.
  *
@@ -41,6 +46,7 @@
  * and authentication data.
  *
  * @param code The weather data codes to request from the cloud platform.
+ * @param cache_ttl Seconds the response is answered from the cache for.
  * @param response Pointer to store the response from the cloud platform.
  *
  * @return The operation result status. Possible values are:
@@ -49,7 +55,7 @@
  *         - OPRT_MALLOC_FAILED: Memory allocation failed.
  *         - Other error codes: Operation failed.
  */
-static OPERATE_RET tuya_weather_get(const char *code, atop_base_response_t *response)
+static OPERATE_RET tuya_weather_get(const char *code, uint32_t cache_ttl, atop_base_response_t *response)
 {
     OPERATE_RET rt = OPRT_OK;
     TIME_T timestamp = 0;
@@ -102,6 +108,7 @@ static OPERATE_RET tuya_weather_get(const char *code, atop_base_response_t *resp
     atop_request.version = API_VERSION;
     atop_request.data =  (void *)post_data;
     atop_request.datalen = strlen(post_data);
+    atop_request.cache_ttl = cache_ttl;
 
     rt = atop_base_request(&atop_request, response);
     if (OPRT_OK != rt) {
@@ -147,7 +154,7 @@ int tuya_weather_get_current_conditions(WEATHER_CURRENT_CONDITIONS_T *current_co
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_CURRENT_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get current conditions error:%d", rt);
         return OPRT_COM_ERROR;
@@ -232,7 +239,7 @@ int tuya_weather_get_today_high_low_temp(int *high_temp, int *low_temp)
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_FORECAST_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get today high low temp error:%d", rt);
         return OPRT_COM_ERROR;
@@ -296,7 +303,7 @@ int tuya_weather_get_current_wind(char *wind_dir, size_t wind_dir_len, char *win
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_CURRENT_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get today high low temp error:%d", rt);
         return OPRT_COM_ERROR;
@@ -368,7 +375,7 @@ int tuya_weather_get_current_wind_cn(char *wind_dir, size_t wind_dir_len, char *
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_CURRENT_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get today high low temp error:%d", rt);
         return OPRT_COM_ERROR;
@@ -443,7 +450,7 @@ int tuya_weather_get_current_sunrise_sunset_gmt(char *sunrise, size_t sunrise_le
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_FORECAST_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get today high low temp error:%d", rt);
         return OPRT_COM_ERROR;
@@ -513,7 +520,7 @@ int tuya_weather_get_current_sunrise_sunset_local(char *sunrise, size_t sunrise_
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_FORECAST_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get today high low temp error:%d", rt);
         return OPRT_COM_ERROR;
@@ -582,7 +589,7 @@ int tuya_weather_get_current_aqi(WEATHER_CURRENT_AQI_T *current_aqi)
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_CURRENT_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get today high low temp error:%d", rt);
         return OPRT_COM_ERROR;
@@ -676,7 +683,7 @@ int tuya_weather_get_current_aqi_cn(WEATHER_CURRENT_AQI_T *current_aqi)
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_CURRENT_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get today high low temp error:%d", rt);
         return OPRT_COM_ERROR;
@@ -781,7 +788,7 @@ int tuya_weather_get_forecast_conditions(int number, WEATHER_FORECAST_CONDITIONS
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_FORECAST_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get today high low temp error:%d", rt);
         return OPRT_COM_ERROR;
@@ -879,7 +886,7 @@ int tuya_weather_get_forecast_conditions_cn(int number, int *weather, int *humi,
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_FORECAST_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get today high low temp error:%d", rt);
         return OPRT_COM_ERROR;
@@ -959,7 +966,7 @@ int tuya_weather_get_forecast_wind(int number, char **wind_dir, char **wind_spee
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_FORECAST_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get today high low temp error:%d", rt);
         return OPRT_COM_ERROR;
@@ -1056,7 +1063,7 @@ int tuya_weather_get_forecast_high_low_temp(int number, int *high_temp, int *low
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_FORECAST_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get today high low temp error:%d", rt);
         return OPRT_COM_ERROR;
@@ -1128,7 +1135,7 @@ int tuya_weather_get_city(char *province, size_t province_len, char *city, size_
 
     memset(&response, 0, sizeof(atop_base_response_t));
 
-    rt = tuya_weather_get(request_code, &response);
+    rt = tuya_weather_get(request_code, WEATHER_CITY_CACHE_TTL, &response);
     if (OPRT_OK != rt || !response.success) {
         PR_ERR("tuya_weather_get today high low temp error:%d", rt);
         return OPRT_COM_ERROR;